@@ -30,6 +30,11 @@
 
 
 #include "annotation_asap_xml.cpp"
+#include "annotation_spatial_index.cpp"
+#include "annotation_lod.cpp"
+#include "annotation_jobs.cpp"
+#include "annotation_loader.cpp"
+#include "annotation_store.cpp"
 
 u32 add_annotation_group(annotation_set_t* annotation_set, const char* name) {
 	annotation_group_t new_group = {};
@@ -114,7 +119,7 @@ void annotation_set_rectangle_coordinates_to_bounding_box(annotation_set_t* anno
 		annotation->coordinates[1] = V2F(annotation->bounds.min.x, annotation->bounds.max.y);
 		annotation->coordinates[2] = annotation->bounds.max;
 		annotation->coordinates[3] = V2F(annotation->bounds.max.x, annotation->bounds.min.y);
-		annotation_invalidate_derived_calculations_from_coordinates(annotation);
+		annotation_invalidate_derived_calculations_from_coordinates(annotation_set, annotation);
 		notify_annotation_set_modified(annotation_set);
 	}
 }
@@ -137,7 +142,7 @@ void do_drag_annotation_node(scene_t* scene) {
 				annotation->coordinates[(coordinate_index + 1) % 4] = V2F(fixed.x, coordinate->y);
 				annotation->coordinates[(coordinate_index + 3) % 4] = V2F(coordinate->x, fixed.y);
 			}
-			annotation_invalidate_derived_calculations_from_coordinates(annotation);
+			annotation_invalidate_derived_calculations_from_coordinates(annotation_set, annotation);
 			notify_annotation_set_modified(&scene->annotation_set);
 
 		}
@@ -337,7 +342,7 @@ void do_mouse_tool_create_freeform(app_state_t* app_state, input_t* input, scene
 				if (distance_to_start_point < annotation_hover_distance && freeform->coordinate_count >= 3) {
 					// finalize the annotation
 					freeform->is_open = false;
-					annotation_invalidate_derived_calculations_from_coordinates(freeform);
+					annotation_invalidate_derived_calculations_from_coordinates(annotation_set, freeform);
 					notify_annotation_set_modified(annotation_set);
 					viewer_switch_tool(app_state, TOOL_NONE);
 					scene->drag_started = false;
@@ -348,19 +353,21 @@ void do_mouse_tool_create_freeform(app_state_t* app_state, input_t* input, scene
 					// add a point
 					arrput(freeform->coordinates, scene->mouse);
 					++freeform->coordinate_count;
+					annotation_invalidate_derived_calculations_from_coordinates(annotation_set, freeform);
 				}
 			} else if (scene->is_dragging) {
 				// drop points along the way
 				if (distance_since_last_point > annotation_freeform_insert_interval_distance && distance_to_start_point > annotation_hover_distance) {
 					arrput(freeform->coordinates, scene->mouse);
 					++freeform->coordinate_count;
+					annotation_invalidate_derived_calculations_from_coordinates(annotation_set, freeform);
 				}
 			} else if (scene->drag_ended) {
 
 				if (distance_to_start_point < annotation_hover_distance && freeform->coordinate_count >= 3) {
 					// finalize the annotation
 					freeform->is_open = false;
-					annotation_invalidate_derived_calculations_from_coordinates(freeform);
+					annotation_invalidate_derived_calculations_from_coordinates(annotation_set, freeform);
 					viewer_switch_tool(app_state, TOOL_NONE);
 					notify_annotation_set_modified(annotation_set);
 				}
@@ -745,7 +752,13 @@ annotation_hit_result_t get_annotation_hit_result(annotation_set_t* annotation_s
 	// Step 1: discard annotation if the point is outside the annotation's min/max coordinate bounds (plus a tolerance margin)
 	// Step 2: for the remaining annotations, calculate the distances from the point to each of the line segments between coordinates.
 	// Step 3: choose the annotation that has the closest distance.
-	for (i32 annotation_index = 0; annotation_index < annotation_set->active_annotation_count; ++annotation_index) {
+	// The spatial index narrows down the candidates to the annotations near the point.
+	bounds2f query_area = BOUNDS2F(point.x - bounds_check_tolerance, point.y - bounds_check_tolerance,
+	                               point.x + bounds_check_tolerance, point.y + bounds_check_tolerance);
+	i32 candidate_count = 0;
+	i32* candidates = annotation_spatial_index_query(annotation_set, query_area, &candidate_count);
+	for (i32 candidate = 0; candidate < candidate_count; ++candidate) {
+		i32 annotation_index = candidates[candidate];
 		annotation_t* annotation = get_active_annotation(annotation_set, annotation_index);
 		// TODO: think about what to do for annotations that are not polygons (e.g., circles) / i.e. have no coordinates
 		if (annotation->coordinate_count > 0) {
@@ -853,13 +866,16 @@ void deselect_annotation_coordinates(annotation_set_t* annotation_set) {
 
 void notify_annotation_set_modified(annotation_set_t* annotation_set) {
 	annotation_set->modified = true; // need to (auto-)save the changes
+	annotation_set->has_unexported_changes = true;
 	annotation_set->last_modification_time = get_clock();
 }
 
-void annotation_invalidate_derived_calculations_from_coordinates(annotation_t* annotation) {
-	u32 derived_calculation_flags_mask = (ANNOTATION_VALID_BOUNDS | ANNOTATION_VALID_TESSELATION | ANNOTATION_VALID_AREA | ANNOTATION_VALID_LENGTH);
+void annotation_invalidate_derived_calculations_from_coordinates(annotation_set_t* annotation_set, annotation_t* annotation) {
+	u32 derived_calculation_flags_mask = (ANNOTATION_VALID_BOUNDS | ANNOTATION_VALID_TESSELATION | ANNOTATION_VALID_AREA | ANNOTATION_VALID_LENGTH | ANNOTATION_VALID_LOD);
 	annotation->fallback_valid_flags |= (annotation->valid_flags & derived_calculation_flags_mask);
 	annotation->valid_flags &= ~(derived_calculation_flags_mask);
+	++annotation->coordinates_generation; // simplified outlines that are still being calculated are outdated now
+	annotation_spatial_index_mark_dirty(annotation_set, annotation); // the bounds may have changed
 }
 
 void annotation_invalidate_derived_calculations_from_features(annotation_t* annotation) {
@@ -916,7 +932,7 @@ void insert_coordinate(app_state_t* app_state, annotation_set_t* annotation_set,
 		// The coordinate count has changed, maybe the type needs to change?
 		maybe_change_annotation_type_based_on_coordinate_count(annotation);
 
-		annotation_invalidate_derived_calculations_from_coordinates(annotation);
+		annotation_invalidate_derived_calculations_from_coordinates(annotation_set, annotation);
 		notify_annotation_set_modified(annotation_set);
 //		console_print("inserted a coordinate at index %d\n", insert_at_index);
 	} else {
@@ -945,7 +961,7 @@ void delete_coordinate(annotation_set_t* annotation_set, i32 annotation_index, i
 				coordinate->order = i;
 			}
 #endif
-			annotation_invalidate_derived_calculations_from_coordinates(annotation);
+			annotation_invalidate_derived_calculations_from_coordinates(annotation_set, annotation);
 		}
 		notify_annotation_set_modified(annotation_set);
 		deselect_annotation_coordinates(annotation_set);
@@ -1014,6 +1030,7 @@ void delete_selected_annotations(app_state_t* app_state, annotation_set_t* annot
 			annotation_t* annotation = annotation_set->stored_annotations + stored_index;
 			if (annotation->selected) {
 				// TODO: allow undo?
+				annotation_spatial_index_remove(annotation_set, stored_index);
 				continue; // skip (delete)
 			} else {
 				arrput(annotation_set->active_annotation_indices, stored_index);
@@ -1029,6 +1046,7 @@ void delete_selected_annotations(app_state_t* app_state, annotation_set_t* annot
 
 void delete_annotation(annotation_set_t* annotation_set, i32 active_annotation_index) {
 	annotation_t* annotation = get_active_annotation(annotation_set, active_annotation_index);
+	annotation_spatial_index_remove(annotation_set, annotation_set->active_annotation_indices[active_annotation_index]);
 	destroy_annotation(annotation);
 	arrdel(annotation_set->active_annotation_indices, active_annotation_index);
 	--annotation_set->active_annotation_count;
@@ -1060,12 +1078,15 @@ void split_annotation(app_state_t* app_state, annotation_set_t* annotation_set,
 	i32 new_coordinate_count_upper_part = annotation->coordinate_count - upper_coordinate_index;
 	new_annotation.coordinate_count = new_coordinate_count_lower_part + new_coordinate_count_upper_part;
 	new_annotation.coordinates = NULL;
+	new_annotation.tesselated_trianges = NULL;
+	memset(new_annotation.lod_coordinates, 0, sizeof(new_annotation.lod_coordinates));
+	new_annotation.is_lod_pending = false;
+	new_annotation.is_tesselation_pending = false;
 	arrsetlen(new_annotation.coordinates, new_annotation.coordinate_count);
 	v2f* new_coordinates = new_annotation.coordinates;
 	v2f* original_coordinates = annotation->coordinates;
 	memcpy(&new_coordinates[0],                          &original_coordinates[0],                      new_coordinate_count_lower_part * sizeof(v2f));
 	memcpy(&new_coordinates[lower_coordinate_index + 1], &original_coordinates[upper_coordinate_index], new_coordinate_count_upper_part * sizeof(v2f));
-	annotation_invalidate_derived_calculations_from_coordinates(&new_annotation);
 
 	// step 2: compactify the original annotation, leaving only the extracted section between the bounds (inclusive)
 	// e.g.: __<lower>XXXXX<upper>_____
@@ -1073,7 +1094,7 @@ void split_annotation(app_state_t* app_state, annotation_set_t* annotation_set,
 	ASSERT(new_coordinate_count >= 3);
 	memmove(annotation->coordinates, annotation->coordinates + lower_coordinate_index, new_coordinate_count * sizeof(v2f));
 	annotation->coordinate_count = new_coordinate_count;
-	annotation_invalidate_derived_calculations_from_coordinates(annotation);
+	annotation_invalidate_derived_calculations_from_coordinates(annotation_set, annotation);
 	arrsetlen(annotation->coordinates, new_coordinate_count);
 
 	// Add the new annotation
@@ -1082,6 +1103,8 @@ void split_annotation(app_state_t* app_state, annotation_set_t* annotation_set,
 	annotation_set->stored_annotation_count++;
 	arrput(annotation_set->active_annotation_indices, new_stored_annotation_index);
 	annotation_set->active_annotation_count++;
+	// Invalidate only now that the new annotation lives in stored_annotations (the spatial index locates it by address).
+	annotation_invalidate_derived_calculations_from_coordinates(annotation_set, annotation_set->stored_annotations + new_stored_annotation_index);
 
 	annotation_set->is_split_mode = false;
 	recount_selected_annotations(app_state, annotation_set);
@@ -1232,20 +1255,10 @@ bool annotation_need_draw_fill_area(annotation_t* annotation) {
 	return false;
 }
 
-static void draw_annotation_fill_area(temp_memory_t* temp_memory, app_state_t* app_state, scene_t* scene, v2f camera_min, annotation_t* annotation, rgba_t fill_color) {
+static void draw_annotation_fill_area(temp_memory_t* temp_memory, app_state_t* app_state, scene_t* scene, annotation_set_t* annotation_set, v2f camera_min, annotation_t* annotation, rgba_t fill_color) {
 	if (!(annotation->valid_flags & ANNOTATION_VALID_TESSELATION)) {
-		// Performance: don't tesselate large polygons too often (this is CPU intensive!)
-		if (annotation->coordinate_count < 10 || app_state->mouse_mode != MODE_DRAG_ANNOTATION_NODE) {
-			//  Invoke the triangulator to triangulate this polygon.
-				arrsetlen(annotation->tesselated_trianges, 0);
-			if (triangulate_process(annotation->coordinates, annotation->coordinate_count, &annotation->tesselated_trianges)) {
-				DUMMY_STATEMENT;
-				// success
-			} else {
-				annotation->is_complex_polygon = true;
-			}
-			annotation->valid_flags |= ANNOTATION_VALID_TESSELATION;
-		}
+		// Large polygons are tesselated on a worker thread, the old triangles (if any) are drawn in the meantime.
+		annotation_tesselation_request(annotation_set, annotation);
 	}
 	if ((annotation->valid_flags | annotation->fallback_valid_flags) & ANNOTATION_VALID_TESSELATION) {
 		i32 triangle_count = arrlen(annotation->tesselated_trianges) / 3;
@@ -1265,14 +1278,62 @@ static void draw_annotation_fill_area(temp_memory_t* temp_memory, app_state_t* a
 	}
 }
 
+// Polygons that are only a few pixels large on screen are drawn as a (filled) box, or a dot if even smaller.
+static bool annotation_draw_collapsed_if_small(scene_t* scene, annotation_t* annotation, v2f camera_min, rgba_t color, float thickness) {
+	annotation_recalculate_bounds_if_necessary(annotation);
+	bounds2f bounds = annotation->bounds;
+	float screen_extent = MAX(bounds.right - bounds.left, bounds.bottom - bounds.top) / scene->zoom.screen_point_width;
+	if (screen_extent >= annotation_lod_collapse_size) {
+		return false;
+	}
+	ImDrawList* draw_list = ImGui::GetBackgroundDrawList();
+	v2f min = world_pos_to_screen_pos(bounds.min, camera_min, scene->zoom.screen_point_width);
+	v2f max = world_pos_to_screen_pos(bounds.max, camera_min, scene->zoom.screen_point_width);
+	if (screen_extent < 1.0f) {
+		v2f center = v2f_average(min, max);
+		draw_list->AddCircleFilled(center, thickness * 0.5f, *(u32*)(&color), 6);
+	} else {
+		draw_list->AddRectFilled(min, max, *(u32*)(&color));
+		draw_list->AddRect(min, max, *(u32*)(&color), 0.0f, 0, thickness);
+	}
+	return true;
+}
+
 void draw_annotations(app_state_t* app_state, scene_t* scene, annotation_set_t* annotation_set, v2f camera_min) {
 	if (!scene->enable_annotations) return;
 
 	recount_selected_annotations(app_state, annotation_set);
+	annotation_collect_finished_jobs(annotation_set);
 
 	bool did_popup = false;
 
-	for (i32 annotation_index = 0; annotation_index < annotation_set->active_annotation_count; ++annotation_index) {
+	// Only draw the annotations that overlap the viewport (with some margin for the line thickness and nodes).
+	// The annotation that is currently being edited is always drawn, its bounds might lag behind.
+	temp_memory_t visible_temp_memory = begin_temp_memory_on_local_thread();
+	float margin = (annotation_node_size * 1.4f + annotation_selected_line_thickness) * scene->zoom.screen_point_width;
+	bounds2f visible_area = scene->camera_bounds;
+	visible_area.left -= margin;
+	visible_area.top -= margin;
+	visible_area.right += margin;
+	visible_area.bottom += margin;
+	i32 visible_count = 0;
+	i32* query_result = annotation_spatial_index_query(annotation_set, visible_area, &visible_count);
+	i32* visible_indices = (i32*) arena_push_size(visible_temp_memory.arena, (visible_count + 1) * sizeof(i32));
+	memcpy(visible_indices, query_result, visible_count * sizeof(i32));
+	i32 editing_index = annotation_set->editing_annotation_index;
+	if (editing_index >= 0 && editing_index < annotation_set->active_annotation_count) {
+		i32 insert_pos = 0;
+		while (insert_pos < visible_count && visible_indices[insert_pos] < editing_index) ++insert_pos;
+		if (insert_pos == visible_count || visible_indices[insert_pos] != editing_index) {
+			memmove(visible_indices + insert_pos + 1, visible_indices + insert_pos, (visible_count - insert_pos) * sizeof(i32));
+			visible_indices[insert_pos] = editing_index;
+			++visible_count;
+		}
+	}
+
+	for (i32 visible_index = 0; visible_index < visible_count; ++visible_index) {
+		i32 annotation_index = visible_indices[visible_index];
+		if (annotation_index >= annotation_set->active_annotation_count) break; // an annotation got deleted (through the popup menu)
 		temp_memory_t temp_memory = begin_temp_memory_on_local_thread();
 		annotation_t* annotation = get_active_annotation(annotation_set, annotation_index);
 		annotation_group_t* group = annotation_set->stored_groups + annotation->group_id;
@@ -1297,10 +1358,41 @@ void draw_annotations(app_state_t* app_state, scene_t* scene, annotation_set_t*
 		ImDrawListFlags backup_flags = draw_list->Flags;
 //		draw_list->Flags &= ~ImDrawListFlags_AntiAliasedLines;
 
-		if (annotation->coordinate_count > 0) {
-			v2f* points = (v2f*) arena_push_size(temp_memory.arena, sizeof(v2f) * annotation->coordinate_count);
-			for (i32 i = 0; i < annotation->coordinate_count; ++i) {
-				points[i] = world_pos_to_screen_pos(annotation->coordinates[i], camera_min, scene->zoom.screen_point_width);
+		if (annotation->coordinate_count >= 4 && annotation_index != annotation_set->editing_annotation_index &&
+		    annotation_draw_collapsed_if_small(scene, annotation, camera_min, base_color, thickness)) {
+			// Too small on screen for the outline to be discernible, drawn as a box or a dot instead
+		} else if (annotation->coordinate_count > 0) {
+			bool need_draw_nodes = annotation->type == ANNOTATION_POINT ||
+			                       (annotation->selected && (annotation_show_polygon_nodes_outside_edit_mode ||
+			                                                 annotation_set->is_edit_mode || annotation_set->editing_annotation_index == annotation_index));
+
+			// The nodes need the full set of coordinates (on screen)
+			v2f* points = NULL;
+			if (need_draw_nodes) {
+				points = (v2f*) arena_push_size(temp_memory.arena, sizeof(v2f) * annotation->coordinate_count);
+				for (i32 i = 0; i < annotation->coordinate_count; ++i) {
+					points[i] = world_pos_to_screen_pos(annotation->coordinates[i], camera_min, scene->zoom.screen_point_width);
+				}
+			}
+
+			// The outline can be simplified when zoomed out, as long as the difference stays below a pixel
+			v2f* outline_coordinates = annotation->coordinates;
+			i32 outline_coordinate_count = annotation->coordinate_count;
+			i32 lod_level = annotation_lod_select_level(annotation, scene->zoom.screen_point_width);
+			if (lod_level >= 0) {
+				if (annotation->valid_flags & ANNOTATION_VALID_LOD) {
+					outline_coordinates = annotation->lod_coordinates[lod_level];
+					outline_coordinate_count = arrlen(annotation->lod_coordinates[lod_level]);
+				} else if (app_state->mouse_mode != MODE_DRAG_ANNOTATION_NODE) {
+					annotation_lod_request(annotation_set, annotation);
+				}
+			}
+			v2f* outline_points = points;
+			if (outline_coordinates != annotation->coordinates || !outline_points) {
+				outline_points = (v2f*) arena_push_size(temp_memory.arena, sizeof(v2f) * outline_coordinate_count);
+				for (i32 i = 0; i < outline_coordinate_count; ++i) {
+					outline_points[i] = world_pos_to_screen_pos(outline_coordinates[i], camera_min, scene->zoom.screen_point_width);
+				}
 			}
 
 			// Only draw the closing line back to the starting point if needed
@@ -1310,14 +1402,9 @@ void draw_annotations(app_state_t* app_state, scene_t* scene, annotation_set_t*
 			if (annotation_need_draw_fill_area(annotation)) {
 				rgba_t fill_color = base_color;
 				fill_color.a = (u8)(annotation_highlight_opacity * 255.0f);
-				draw_annotation_fill_area(&temp_memory, app_state, scene, camera_min, annotation, fill_color);
+				draw_annotation_fill_area(&temp_memory, app_state, scene, annotation_set, camera_min, annotation, fill_color);
 			}
 
-			bool need_draw_nodes = annotation->type == ANNOTATION_POINT ||
-			                       (annotation->selected && (annotation_show_polygon_nodes_outside_edit_mode ||
-			                                                 annotation_set->is_edit_mode || annotation_set->editing_annotation_index == annotation_index));
-
-
 			rgba_t line_color = base_color;
 			if (need_draw_nodes) {
 				// make nodes stand out more by making the line transparent
@@ -1325,17 +1412,17 @@ void draw_annotations(app_state_t* app_state, scene_t* scene, annotation_set_t*
 			}
 
 			// Draw the annotation in the background list (behind UI elements), as a thick colored line
-			if (annotation->coordinate_count >= 4) {
-				gui_draw_polygon_outline(points, annotation->coordinate_count, line_color, closed, thickness);
-			} else if (annotation->coordinate_count >= 2) {
-				draw_list->AddLine(points[0], points[1], *(u32*)(&line_color), thickness);
-				if (annotation->coordinate_count == 3) {
-					draw_list->AddLine(points[1], points[2], *(u32*)(&line_color), thickness);
+			if (outline_coordinate_count >= 4) {
+				gui_draw_polygon_outline(outline_points, outline_coordinate_count, line_color, closed, thickness);
+			} else if (outline_coordinate_count >= 2) {
+				draw_list->AddLine(outline_points[0], outline_points[1], *(u32*)(&line_color), thickness);
+				if (outline_coordinate_count == 3) {
+					draw_list->AddLine(outline_points[1], outline_points[2], *(u32*)(&line_color), thickness);
 					if (closed) {
-						draw_list->AddLine(points[2], points[0], *(u32*)(&line_color), thickness);
+						draw_list->AddLine(outline_points[2], outline_points[0], *(u32*)(&line_color), thickness);
 					}
 				}
-			} else if (annotation->coordinate_count == 1) {
+			} else if (outline_coordinate_count == 1) {
 				//annotation_draw_coordinate_dot(draw_list, points[0], annotation_node_size * 0.7f, base_color);
 			}
 
@@ -1478,6 +1565,7 @@ void draw_annotations(app_state_t* app_state, scene_t* scene, annotation_set_t*
 		draw_list->Flags = backup_flags;
 		release_temp_memory(&temp_memory);
 	}
+	release_temp_memory(&visible_temp_memory);
 
 	if (!did_popup) {
 		if (ImGui::BeginPopupContextVoid()) {
@@ -1581,6 +1669,10 @@ void draw_annotations_window(app_state_t* app_state, input_t* input) {
 			ImGui::TextUnformatted("Annotation filename: (none)\n");
 		}
 		ImGui::Text("Number of annotations active: %d\n", annotation_set->active_annotation_count);
+		if (annotation_set->loader) {
+			ImGui::SameLine();
+			ImGui::TextUnformatted("(loading...)");
+		}
 		ImGui::Spacing();
 
 //		if (ImGui::CollapsingHeader("Annotation"))
@@ -1982,6 +2074,9 @@ void draw_annotations_window(app_state_t* app_state, input_t* input) {
 
 			ImGui::SliderFloat("Line thickness (normal)", &annotation_normal_line_thickness, 0.0f, 10.0f, "%.1f px");
 			ImGui::SliderFloat("Line thickness (selected)", &annotation_selected_line_thickness, 0.0f, 10.0f, "%.1f px");
+			ImGui::SliderFloat("Outline simplification (zoomed out)", &annotation_lod_max_screen_error, 0.0f, 4.0f, "%.2f px");
+			ImGui::SliderFloat("Draw smaller annotations as boxes", &annotation_lod_collapse_size, 0.0f, 16.0f, "%.1f px");
+			ImGui::Checkbox("Autosave to binary annotation store (export XML on save/close)", &annotation_enable_store);
 
 			ImGui::NewLine();
 
@@ -2296,6 +2391,9 @@ annotation_t duplicate_annotation(annotation_t* annotation) {
 	result.valid_flags = 0;
 	result.fallback_valid_flags = 0;
 	result.tesselated_trianges = NULL;
+	memset(result.lod_coordinates, 0, sizeof(result.lod_coordinates));
+	result.is_lod_pending = false;
+	result.is_tesselation_pending = false;
 
 	return result;
 }
@@ -2304,10 +2402,14 @@ void destroy_annotation(annotation_t* annotation) {
 	if (annotation) {
 		arrfree(annotation->coordinates);
 		arrfree(annotation->tesselated_trianges);
+		annotation_lod_destroy(annotation);
 	}
 }
 
 void destroy_annotation_set(annotation_set_t* annotation_set) {
+	annotation_loader_cancel(annotation_set);
+	annotation_store_close(annotation_set);
+	annotation_wait_for_pending_jobs(annotation_set);
 	// destroy old state
 	for (i32 i = 0; i < annotation_set->stored_annotation_count; ++i) {
 		destroy_annotation(annotation_set->stored_annotations + i);
@@ -2319,6 +2421,7 @@ void destroy_annotation_set(annotation_set_t* annotation_set) {
 	arrfree(annotation_set->stored_features);
 	arrfree(annotation_set->active_feature_indices);
 	if (annotation_set->coco.is_valid) coco_destroy(&annotation_set->coco);
+	annotation_spatial_index_destroy(&annotation_set->spatial_index);
 
 }
 
@@ -2394,8 +2497,32 @@ void save_geojson_annotations(annotation_set_t* annotation_set, const char* file
 	}
 }
 
+static void annotation_set_construct_asap_xml_filename_if_necessary(app_state_t* app_state, annotation_set_t* annotation_set) {
+	// Construct a sensible filename
+	if (annotation_set->asap_xml_filename[0] == '\0') {
+		char image_name_buf[512];
+		// TODO: which image to associate the annotations with?
+		if (arrlen(app_state->loaded_images) > 0) {
+			image_t* image = app_state->loaded_images;
+			strncpy(image_name_buf, image->name, MIN(sizeof(image_name_buf), sizeof(image->name)));
+		} else {
+			strncpy(image_name_buf, "unknown_image", sizeof(image_name_buf));
+		}
+		replace_file_extension(image_name_buf, sizeof(image_name_buf), "xml");
+		snprintf(annotation_set->asap_xml_filename, sizeof(annotation_set->asap_xml_filename), "%s%s", get_active_directory(app_state), image_name_buf);
+		annotation_set->asap_xml_filename[sizeof(annotation_set->asap_xml_filename)-1] = '\0';
+
+	}
+}
+
 void save_annotations(app_state_t* app_state, annotation_set_t* annotation_set, bool force_ignore_delay) {
-	if (!annotation_set->modified) return; // no changes, nothing to do
+	bool need_export = force_ignore_delay && annotation_set->has_unexported_changes;
+	if (!annotation_set->modified && !need_export) return; // no changes, nothing to do
+	if (annotation_set->loader) {
+		// Saving now would truncate the file, because not all annotations have been loaded yet.
+		if (!force_ignore_delay) return;
+		annotation_loader_wait(annotation_set);
+	}
 
 	bool proceed = force_ignore_delay;
 	if (!force_ignore_delay) {
@@ -2406,6 +2533,23 @@ void save_annotations(app_state_t* app_state, annotation_set_t* annotation_set,
 		}
 	}
 	if (proceed) {
+		// The binary annotation store is kept next to the XML file (COCO-only annotation sets don't have one).
+		bool use_store = annotation_enable_store && annotation_set->export_as_asap_xml;
+		if (annotation_set->export_as_asap_xml) {
+			annotation_set_construct_asap_xml_filename_if_necessary(app_state, annotation_set);
+		}
+		if (use_store && !force_ignore_delay) {
+			// Autosave: only the changes get written to the store (in the background). Exporting everything to XML
+			// (and COCO) is deferred until the annotations are explicitly saved, or closed.
+			if (annotation_store_write_changes(annotation_set, false)) {
+				annotation_set->modified = false;
+				return;
+			} else if (!annotation_set->store || !annotation_set->store->has_failed) {
+				return; // still busy writing the previous changes, try again later
+			}
+			// Something went wrong with the store, fall back to exporting everything.
+		}
+
 		if (annotation_set->export_as_asap_xml) {
 			// Backup original XML file to .orig
 			if (annotation_set->asap_xml_filename[0] != '\0' && annotation_set->annotations_were_loaded_from_file) {
@@ -2416,22 +2560,6 @@ void save_annotations(app_state_t* app_state, annotation_set_t* annotation_set,
 				}
 			}
 
-			// Construct a sensible filename
-			if (annotation_set->asap_xml_filename[0] == '\0') {
-				char image_name_buf[512];
-				// TODO: which image to associate the annotations with?
-				if (arrlen(app_state->loaded_images) > 0) {
-					image_t* image = app_state->loaded_images;
-					strncpy(image_name_buf, image->name, MIN(sizeof(image_name_buf), sizeof(image->name)));
-				} else {
-					strncpy(image_name_buf, "unknown_image", sizeof(image_name_buf));
-				}
-				replace_file_extension(image_name_buf, sizeof(image_name_buf), "xml");
-				snprintf(annotation_set->asap_xml_filename, sizeof(annotation_set->asap_xml_filename), "%s%s", get_active_directory(app_state), image_name_buf);
-				annotation_set->asap_xml_filename[sizeof(annotation_set->asap_xml_filename)-1] = '\0';
-
-			}
-
 			save_asap_xml_annotations(annotation_set, annotation_set->asap_xml_filename);
 		}
 		if (app_state->export_as_coco && annotation_set->coco_filename) {
@@ -2450,7 +2578,14 @@ void save_annotations(app_state_t* app_state, annotation_set_t* annotation_set,
 			}
 			memrw_destroy(&out);
 		}
+		if (use_store) {
+			// Let the store know that the XML file is up-to-date again (so that it can be used for loading next time).
+			annotation_store_wait(annotation_set);
+			annotation_store_write_changes(annotation_set, true);
+			annotation_store_wait(annotation_set);
+		}
 		annotation_set->modified = false;
+		annotation_set->has_unexported_changes = false;
 
 
 	}
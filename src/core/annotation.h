@@ -52,8 +52,14 @@ enum annotation_valid_flags_enum {
 	ANNOTATION_VALID_AREA = 4,
 	ANNOTATION_VALID_LENGTH = 8,
 	ANNOTATION_VALID_NONZERO_FEATURE_COUNT = 0x10,
+	ANNOTATION_VALID_LOD = 0x20,
 };
 
+// Level of detail: simplified outlines for drawing large polygons at low magnification.
+// Level k is simplified with a tolerance of lod_base_tolerance * 4^k (so the last level is the coarsest).
+#define ANNOTATION_LOD_LEVEL_COUNT 6
+#define ANNOTATION_LOD_MIN_COORDINATE_COUNT 64
+
 typedef struct annotation_t {
 	annotation_type_enum type;
 	char name[256];
@@ -77,8 +83,14 @@ typedef struct annotation_t {
 	bool8 selected;
 	bool8 has_properties;
 	bool8 is_open; // for 'unfinished' polygons
+	bool8 is_lod_pending; // simplified outlines are being calculated on a worker thread
+	bool8 is_tesselation_pending;
 
 	v2f p0, p1;
+
+	v2f* lod_coordinates[ANNOTATION_LOD_LEVEL_COUNT]; // arrays
+	float lod_base_tolerance;
+	u32 coordinates_generation; // incremented when the coordinates change, so that outdated results can be discarded
 } annotation_t;
 
 /*typedef struct coordinate_t {
@@ -119,6 +131,101 @@ typedef struct annotation_hit_result_t {
 	bool is_valid;
 } annotation_hit_result_t;
 
+typedef struct annotation_spatial_index_entry_t {
+	bounds2i cell_range;
+	i32 active_index; // -1 if the annotation is no longer active
+	u32 query_stamp;
+	bool is_indexed;
+	bool is_unbounded;
+} annotation_spatial_index_entry_t;
+
+typedef struct annotation_spatial_index_t {
+	bounds2f grid_bounds;
+	float cell_width;
+	float cell_height;
+	i32 width_in_cells;
+	i32 height_in_cells;
+	i32** cells; // each cell is an array of stored annotation indices
+	i32* unbounded; // array; annotations that are always checked (no coordinates, or too large for the grid)
+	annotation_spatial_index_entry_t* entries; // array, indexed by stored annotation index
+	i32* dirty; // array; stored indices of annotations whose coordinates changed
+	i32* query_result; // array of active annotation indices
+	u32 current_query_stamp;
+	i32 indexed_active_count;
+	i32 stored_count_at_last_rebuild;
+	i32 outside_grid_count;
+	bool need_rebuild;
+	bool need_remap;
+	bool is_valid;
+} annotation_spatial_index_t;
+
+typedef enum annotation_job_type_enum {
+	ANNOTATION_JOB_LOD = 0,
+	ANNOTATION_JOB_TESSELATION = 1,
+} annotation_job_type_enum;
+
+// Derived calculations that are too slow to do on the main thread for large polygons
+typedef struct annotation_job_t {
+	annotation_job_type_enum type;
+	i32 stored_index;
+	u32 generation;
+	v2f* coordinates; // private copy, the annotation may be edited while the job is running
+	i32 coordinate_count;
+	float lod_base_tolerance;
+	v2f* lod_coordinates[ANNOTATION_LOD_LEVEL_COUNT]; // arrays (output)
+	v2f* tesselated_triangles; // array (output)
+	bool is_complex_polygon;
+	volatile bool32 is_done;
+} annotation_job_t;
+
+typedef struct asap_xml_parser_t asap_xml_parser_t;
+
+// Annotations that are being loaded from a file in the background (see annotation_loader.cpp).
+typedef struct annotation_loader_t {
+	char filename[512];
+	i64 start_clock;
+	asap_xml_parser_t* parser; // owned by the parsing job that is currently running
+	benaphore_t lock;
+	annotation_t* published_annotations; // array (protected by lock)
+	annotation_group_t* published_groups; // array (protected by lock)
+	annotation_feature_t* published_features; // array (protected by lock)
+	i32* published_group_definition_order; // array (protected by lock)
+	i32* group_map; // array; group index in the parser -> group index in the annotation set
+	i32* feature_map; // array; feature index in the parser -> feature index in the annotation set
+	i32 initial_group_count;
+	volatile bool32 is_cancelled;
+	volatile bool32 is_done;
+	bool32 success;
+} annotation_loader_t;
+
+// What the annotation store currently contains for an annotation, so that unchanged annotations can be skipped.
+typedef struct annotation_store_shadow_t {
+	u64 properties_hash;
+	v2f* coordinates;
+	i32 coordinate_count;
+	u32 coordinates_generation;
+	bool is_written;
+} annotation_store_shadow_t;
+
+// Binary file with an append-only journal of changes, for fast autosaving (see annotation_store.cpp).
+typedef struct annotation_store_t {
+	char filename[512];
+	annotation_store_shadow_t* shadows; // array, indexed by stored annotation index
+	u32* keys; // array, indexed by stored annotation index; identifies the annotation in the file
+	u32 next_key;
+	u64 groups_hash;
+	u64 features_hash;
+	u64 active_hash;
+	u64 sequence;
+	i64 source_file_size; // size and modification time of the XML file, when it was last written
+	i64 source_file_mtime;
+	i64 file_size; // (only used by the write job)
+	i64 compacted_size; // (only used by the write job)
+	bool need_full_rewrite;
+	volatile bool32 is_busy; // a write job is in flight
+	volatile bool32 has_failed;
+} annotation_store_t;
+
 typedef struct annotation_set_t {
 	annotation_t* stored_annotations; // array
 	i32 stored_annotation_count;
@@ -139,6 +246,7 @@ typedef struct annotation_set_t {
 	char* coco_filename;
 	char base_filename[512];
 	bool modified;
+	bool has_unexported_changes; // the XML (or COCO) file is not up-to-date, even though the changes were autosaved
 	i64 last_modification_time;
 	i32 hovered_annotation;
 	i32 hovered_coordinate;
@@ -161,6 +269,10 @@ typedef struct annotation_set_t {
 	coco_t coco;
 	bool export_as_asap_xml;
 	bool annotations_were_loaded_from_file;
+	annotation_spatial_index_t spatial_index;
+	annotation_job_t** pending_jobs; // array
+	annotation_loader_t* loader; // non-NULL while annotations are still being loaded
+	annotation_store_t* store;
 } annotation_set_t;
 
 
@@ -211,7 +323,7 @@ annotation_hit_result_t get_annotation_hit_result(annotation_set_t* annotation_s
 i32 project_point_onto_annotation(annotation_set_t* annotation_set, annotation_t* annotation, v2f point, float* t_ptr, v2f* projected_point_ptr, float* distance_ptr);
 void deselect_annotation_coordinates(annotation_set_t* annotation_set);
 void notify_annotation_set_modified(annotation_set_t* annotation_set);
-void annotation_invalidate_derived_calculations_from_coordinates(annotation_t* annotation);
+void annotation_invalidate_derived_calculations_from_coordinates(annotation_set_t* annotation_set, annotation_t* annotation);
 void insert_coordinate(app_state_t* app_state, annotation_set_t* annotation_set, annotation_t* annotation, i32 insert_at_index, v2f new_coordinate);
 void delete_coordinate(annotation_set_t* annotation_set, i32 annotation_index, i32 coordinate_index);
 void delete_selected_annotations(app_state_t* app_state, annotation_set_t* annotation_set);
@@ -231,11 +343,43 @@ void destroy_annotation(annotation_t* annotation);
 void destroy_annotation_set(annotation_set_t* annotation_set);
 void unload_and_reinit_annotations(annotation_set_t* annotation_set);
 bool32 load_asap_xml_annotations(app_state_t* app_state, const char* filename);
+bool load_annotation_store_or_asap_xml(app_state_t* app_state, const char* xml_filename);
 void save_asap_xml_annotations(annotation_set_t* annotation_set, const char* filename_out);
 void save_annotations(app_state_t* app_state, annotation_set_t* annotation_set, bool force_ignore_delay);
 void recount_selected_annotations(app_state_t* app_state, annotation_set_t* annotation_set);
 annotation_set_t create_offsetted_annotation_set_for_area(annotation_set_t* annotation_set, bounds2f area, bool push_coordinates_inward);
 
+// annotation_spatial_index.cpp
+void annotation_spatial_index_update(annotation_set_t* annotation_set);
+void annotation_spatial_index_mark_dirty(annotation_set_t* annotation_set, annotation_t* annotation);
+void annotation_spatial_index_remove(annotation_set_t* annotation_set, i32 stored_index);
+i32* annotation_spatial_index_query(annotation_set_t* annotation_set, bounds2f area, i32* count);
+void annotation_spatial_index_destroy(annotation_spatial_index_t* index);
+
+// annotation_lod.cpp
+i32 annotation_lod_select_level(annotation_t* annotation, float screen_point_width);
+void annotation_lod_request(annotation_set_t* annotation_set, annotation_t* annotation);
+void annotation_lod_destroy(annotation_t* annotation);
+
+// annotation_jobs.cpp
+annotation_job_t* annotation_job_submit(annotation_set_t* annotation_set, annotation_t* annotation, annotation_job_type_enum type, float lod_base_tolerance);
+void annotation_tesselation_request(annotation_set_t* annotation_set, annotation_t* annotation);
+void annotation_collect_finished_jobs(annotation_set_t* annotation_set);
+void annotation_wait_for_pending_jobs(annotation_set_t* annotation_set);
+
+// annotation_loader.cpp
+annotation_loader_t* annotation_loader_create(annotation_set_t* annotation_set, const char* filename);
+void annotation_loader_publish(annotation_loader_t* loader, annotation_set_t* parsed_set, i32 finished_count, i32* group_definition_order);
+void annotation_loader_collect(annotation_set_t* annotation_set);
+void annotation_loader_wait(annotation_set_t* annotation_set);
+void annotation_loader_cancel(annotation_set_t* annotation_set);
+
+// annotation_store.cpp
+bool annotation_store_write_changes(annotation_set_t* annotation_set, bool is_in_sync_with_xml);
+void annotation_store_wait(annotation_set_t* annotation_set);
+void annotation_store_close(annotation_set_t* annotation_set);
+bool annotation_store_load(annotation_set_t* annotation_set, const char* xml_filename);
+
 #ifdef __cplusplus
 }
 #endif
@@ -22,11 +22,6 @@
 // https://dev.yorhel.nl/yxml/man
 #define YXML_STACK_BUFFER_SIZE KILOBYTES(32)
 
-enum {
-	ASAP_XML_PARSE_GROUPS_AND_FEATURES = 0,
-	ASAP_XML_PARSE_ANNOTATIONS = 1,
-};
-
 typedef enum asap_xml_element_enum {
 	ASAP_XML_ELEMENT_NONE = 0,               // for unhandled elements
 	ASAP_XML_ELEMENT_ANNOTATION = 1,         // <Annotation>
@@ -93,15 +88,15 @@ static void annotation_set_attribute(annotation_set_t* annotation_set, annotatio
 	}
 }
 
-static void coordinate_set_attribute(annotation_set_t* annotation_set, annotation_t* annotation, v2f* coordinate, const char* attr,
-                              const char* value) {
-	if (strcmp(attr, "Order") == 0) {
+static void coordinate_set_attribute(annotation_set_t* annotation_set, v2f* coordinate, const char* attr, const char* value) {
+	// X and Y make up most of the file, so check for those first.
+	if (attr[0] == 'X' && attr[1] == '\0') {
+		coordinate->x = parse_float(value, NULL) * annotation_set->mpp.x;
+	} else if (attr[0] == 'Y' && attr[1] == '\0') {
+		coordinate->y = parse_float(value, NULL) * annotation_set->mpp.y;
+	} else if (strcmp(attr, "Order") == 0) {
 		// ignored
 //		coordinate->order = atoi(value);
-	} else if (strcmp(attr, "X") == 0) {
-		coordinate->x = (float)atof(value) * annotation_set->mpp.x;
-	} else if (strcmp(attr, "Y") == 0) {
-		coordinate->y = (float)atof(value) * annotation_set->mpp.y;
 	}
 }
 
@@ -117,7 +112,7 @@ static void group_set_attribute(annotation_group_t* group, const char* attr, con
 
 static void feature_set_attribute(annotation_set_t* annotation_set, annotation_feature_t* feature, const char* attr, const char* value) {
 	if (strcmp(attr, "Value") == 0) {
-		feature->value = (float)atof(value);
+		feature->value = parse_float(value, NULL);
 	} else if (strcmp(attr, "Name") == 0) {
 		strncpy(feature->name, value, sizeof(feature->name));
 	} else if (strcmp(attr, "RestrictToGroup") == 0) {
@@ -131,288 +126,293 @@ static void feature_set_attribute(annotation_set_t* annotation_set, annotation_f
 
 #define ASAP_XML_PARSER_MAX_STACK 16
 
-bool32 load_asap_xml_annotations(app_state_t* app_state, const char* filename) {
-
-	annotation_set_t* annotation_set = &app_state->scene.annotation_set;
-	annotation_group_t current_group = {};
-	annotation_feature_t current_feature = {};
-	asap_xml_element_enum element_stack[ASAP_XML_PARSER_MAX_STACK] = {};
-	i32 element_stack_index = 0;
-	bool is_within_annotationfeatures_tag = false;
-
-
-	mem_t* file = platform_read_entire_file(filename);
-	yxml_t* x = NULL;
-	bool32 success = false;
-	i64 start = get_clock();
-
-	if (0) { failed: cleanup:
-		if (x) free(x);
-		if (file) free(file);
-		return success;
+// The file is read and parsed in slices of this size, one work queue job per slice.
+#define ASAP_XML_LOADER_CHUNK_SIZE MEGABYTES(1)
+
+typedef struct asap_xml_parser_t {
+	FILE* fp;
+	u8* chunk;
+	yxml_t* x;
+	annotation_set_t parsed_set; // private; the finished annotations are handed over using annotation_loader_publish()
+	i32* group_definition_order; // array
+	annotation_group_t current_group;
+	annotation_feature_t current_feature;
+	asap_xml_element_enum element_stack[ASAP_XML_PARSER_MAX_STACK];
+	i32 element_stack_index;
+	char attrbuf[128];
+	char* attrcur;
+	bool is_within_annotationfeatures_tag;
+	bool is_within_annotation;
+} asap_xml_parser_t;
+
+static asap_xml_element_enum asap_xml_get_element_type(const char* name) {
+	// Switch on the first character, so that we need at most a few string comparisons per element.
+	switch (name[0]) {
+		case 'C': {
+			if (strcmp(name, "Coordinate") == 0) return ASAP_XML_ELEMENT_COORDINATE;
+		} break;
+		case 'A': {
+			if (strcmp(name, "Annotation") == 0) return ASAP_XML_ELEMENT_ANNOTATION;
+			if (strcmp(name, "Attributes") == 0) return ASAP_XML_ELEMENT_ATTRIBUTES;
+			if (strcmp(name, "ASAP_Annotations") == 0) return ASAP_XML_ELEMENT_ASAP_ANNOTATIONS;
+			if (strcmp(name, "AnnotationGroups") == 0) return ASAP_XML_ELEMENT_ANNOTATIONGROUPS;
+			if (strcmp(name, "AnnotationFeatures") == 0) return ASAP_XML_ELEMENT_ANNOTATIONFEATURES;
+			if (strcmp(name, "Annotations") == 0) return ASAP_XML_ELEMENT_ANNOTATIONS;
+		} break;
+		case 'F': {
+			if (strcmp(name, "Feature") == 0) return ASAP_XML_ELEMENT_FEATURE;
+		} break;
+		case 'G': {
+			if (strcmp(name, "Group") == 0) return ASAP_XML_ELEMENT_GROUP;
+		} break;
+		default: break;
 	}
+	return ASAP_XML_ELEMENT_NONE;
+}
 
-	if (file) {
-		// hack: merge memory for yxml_t struct and stack buffer
-		// Note: what is a good stack buffer size?
-		x = (yxml_t*) malloc(sizeof(yxml_t) + YXML_STACK_BUFFER_SIZE);
-
-		// ASAP puts all of the group definitions at the end of the file, instead of the beginning.
-		// To preserve the order of the groups, we need to load the XML in two passes:
-		// pass 0: read annotation groups only
-		// pass 1: read annotations and coordinates
-		for (i32 pass = 0; pass < 2; ++pass) {
-			yxml_init(x, x + 1, YXML_STACK_BUFFER_SIZE);
-
-			// parse XML byte for byte
-			char attrbuf[128];
-			char* attrbuf_end = attrbuf + sizeof(attrbuf);
-			char* attrcur = NULL;
-			char contentbuf[128];
-			char* contentbuf_end = contentbuf + sizeof(contentbuf);
-			char* contentcur = NULL;
-
-			char* doc = (char*) file->data;
-			for (; *doc; doc++) {
-				yxml_ret_t r = yxml_parse(x, *doc);
-				if (r == YXML_OK) {
-					continue; // nothing worthy of note has happened -> continue
-				} else if (r < 0) {
-					goto failed;
-				} else if (r > 0) {
-					// token
-					switch(r) {
-						case YXML_ELEMSTART: {
-							// start of an element: '<Tag ..'
-//						    console_print("element start: %s\n", x->elem);
-							contentcur = contentbuf;
-							*contentcur = '\0';
-							++element_stack_index;
-							if (element_stack_index >= ASAP_XML_PARSER_MAX_STACK) {
-								console_print_error("load_asap_xml_annotations(): element stack overflow (too many nested elements)\n");
-								goto failed;
-							}
-
-							asap_xml_element_enum element_type = ASAP_XML_ELEMENT_NONE;
-							if (strcmp(x->elem, "Coordinate") == 0) {
-								element_type = ASAP_XML_ELEMENT_COORDINATE;
-							} else if (strcmp(x->elem, "Annotation") == 0) {
-								element_type = ASAP_XML_ELEMENT_ANNOTATION;
-							} else if (strcmp(x->elem, "Feature") == 0) {
-								element_type = ASAP_XML_ELEMENT_FEATURE;
-							} else if (strcmp(x->elem, "Group") == 0) {
-								element_type = ASAP_XML_ELEMENT_GROUP;
-							} else if (strcmp(x->elem, "Attributes") == 0) {
-								element_type = ASAP_XML_ELEMENT_ATTRIBUTES;
-							} else if (strcmp(x->elem, "ASAP_Annotations") == 0) {
-								element_type = ASAP_XML_ELEMENT_ASAP_ANNOTATIONS;
-							} else if (strcmp(x->elem, "AnnotationGroups") == 0) {
-								element_type = ASAP_XML_ELEMENT_ANNOTATIONGROUPS;
-							} else if (strcmp(x->elem, "AnnotationFeatures") == 0) {
-								element_type = ASAP_XML_ELEMENT_ANNOTATIONFEATURES;
-							} else if (strcmp(x->elem, "Annotations") == 0) {
-								element_type = ASAP_XML_ELEMENT_ANNOTATIONS;
-							}
-
-							if (element_type == ASAP_XML_ELEMENT_ANNOTATIONFEATURES) {
-								// We need to track this in order to disambiguate feature definitions from feature values
-								// Feature definitions are stored separately within an <AnnotationFeatures> tag
-								// Feature values are stored within an <Annotation>
-								// (We are letting both situations use the <Feature> tag, but in a different way)
-								is_within_annotationfeatures_tag = true;
-							} else if (pass == ASAP_XML_PARSE_GROUPS_AND_FEATURES) {
-								if (element_type == ASAP_XML_ELEMENT_GROUP) {
-									// reset the state (start parsing a new group)
-									memset(&current_group, 0, sizeof(current_group));
-									current_group.is_explicitly_defined = true; // (because this group has an XML tag)
-								} else if (element_type == ASAP_XML_ELEMENT_FEATURE && is_within_annotationfeatures_tag) {
-									// reset the state (start parsing a new feature)
-									memset(&current_feature, 0, sizeof(current_feature));
-									current_feature.is_explicitly_defined = true; // (because this feature has an XML tag)
-								}
-							} else if (pass == ASAP_XML_PARSE_ANNOTATIONS) {
-								if (element_type == ASAP_XML_ELEMENT_ANNOTATION) {
-									annotation_t new_annotation = {};
-									arrput(annotation_set->stored_annotations, new_annotation);
-									++annotation_set->stored_annotation_count;
-								} else if (element_type == ASAP_XML_ELEMENT_COORDINATE) {
-									ASSERT(annotation_set->stored_annotation_count == arrlen(annotation_set->stored_annotations));
-									ASSERT(annotation_set->stored_annotation_count > 0);
-									if (annotation_set->stored_annotations != NULL && annotation_set->stored_annotation_count > 0) {
-										annotation_t* current_annotation = arrlastptr(annotation_set->stored_annotations);
-										v2f new_coordinate = {};
-										ASSERT(current_annotation);
-										arrput(current_annotation->coordinates, new_coordinate);
-										++current_annotation->coordinate_count;
-									}
-								} else if (element_type == ASAP_XML_ELEMENT_FEATURE && !is_within_annotationfeatures_tag) {
-									element_type = ASAP_XML_ELEMENT_FEATURE;
-									memset(&current_feature, 0, sizeof(current_feature));
-								}
-							}
-							element_stack[element_stack_index] = element_type;
-
-						} break;
-						case YXML_CONTENT: {
-							// element content
-//						    console_print("   element content: %s\n", x->elem);
-							if (!contentcur) break;
-							char* tmp = x->data;
-							while (*tmp && contentbuf < contentbuf_end) {
-								*(contentcur++) = *(tmp++);
-							}
-							if (contentcur == contentbuf_end) {
-								// too long content
-								// TODO: harden against buffer overflow, see approach in isyntax.c
-								console_print_error("load_asap_xml_annotations(): encountered a too long XML element content\n");
-								goto failed;
-							}
-							*contentcur = '\0';
-						} break;
-
-						case YXML_ELEMEND: {
-							// end of an element: '.. />' or '</Tag>'
-							asap_xml_element_enum current_element_type = element_stack[element_stack_index];
-//						    console_print("element end: %s\n", current_element_type);
-							if (contentcur) {
-								// NOTE: usually only whitespace (newlines and such)
-//							    console_print("elem content: %s\n", contentbuf);
-							}
-
-							if (pass == ASAP_XML_PARSE_GROUPS_AND_FEATURES) {
-								if (current_element_type == ASAP_XML_ELEMENT_GROUP) {
-									annotation_group_t* parsed_group = &current_group;
-									// Check if a group already exists with this name, if not create it
-									i32 group_index = find_annotation_group_or_create_if_not_found(annotation_set, parsed_group->name);
-									annotation_group_t* destination_group = annotation_set->stored_groups + group_index;
-									// 'Commit' the group with all its attributes
-									memcpy(destination_group, parsed_group, sizeof(*destination_group));
-								} else if (is_within_annotationfeatures_tag && current_element_type == ASAP_XML_ELEMENT_FEATURE) {
-									annotation_feature_t* parsed_feature = &current_feature;
-									// Check if a feature already exists with this name, if not create it
-									i32 feature_index = find_annotation_feature_or_create_if_not_found(annotation_set, parsed_feature->name);
-									annotation_feature_t* destination_feature = annotation_set->stored_features + feature_index;
-									// 'Commit' the group with all its attributes
-									memcpy(destination_feature, parsed_feature, sizeof(*destination_feature));
-									destination_feature->id = feature_index;
-								}
-							} else if (pass == ASAP_XML_PARSE_ANNOTATIONS) {
-								if (!is_within_annotationfeatures_tag && current_element_type == ASAP_XML_ELEMENT_FEATURE) {
-									float value = current_feature.value;
-									annotation_feature_t* parsed_feature = &current_feature;
-									// Check if a feature already exists with this name, if not create it
-									i32 feature_index = find_annotation_feature_or_create_if_not_found(annotation_set, parsed_feature->name);
-									annotation_t* annotation = arrlastptr(annotation_set->stored_annotations);
-									if (annotation && feature_index < COUNT(annotation->features)) {
-										annotation->features[feature_index] = value;
-									} else {
-										panic();
-									}
-								}
-							}
-							if (current_element_type == ASAP_XML_ELEMENT_ANNOTATIONFEATURES) {
-								// We need to track this in order to disambiguate feature definitions from feature values
-								// Feature definitions are stored separately within an <AnnotationFeatures> tag
-								// Feature values are stored within an <Annotation>
-								// (We are letting both situations use the <Feature> tag, but in a different way)
-								is_within_annotationfeatures_tag = false;
-							}
-
-							// 'Pop' out of the element stack
-							if (element_stack_index <= 0) {
-								// Underflow! More YXML_ELEMEND than YXML_ELEMSTART?
-								// yxml should throw an error in this case (malformed XML file?); this code should never be reached.
-								panic();
-							}
-							--element_stack_index;
-
-
-						} break;
-
-						case YXML_ATTRSTART: {
-							// attribute: 'Name=..'
-//						    console_print("attr start: %s\n", x->attr);
-							attrcur = attrbuf;
-							*attrcur = '\0';
-						} break;
-						case YXML_ATTRVAL: {
-							// attribute value
-//						    console_print("   attr val: %s\n", x->attr);
-							if (!attrcur) break;
-							char* tmp = x->data;
-							while (*tmp && attrbuf < attrbuf_end) {
-								*(attrcur++) = *(tmp++);
-							}
-							if (attrcur == attrbuf_end) {
-								// too long attribute
-								console_print("load_asap_xml_annotations(): encountered a too long XML attribute\n");
-								goto failed;
-							}
-							*attrcur = '\0';
-						} break;
-						case YXML_ATTREND: {
-							// end of attribute '.."'
-							asap_xml_element_enum current_element_type = element_stack[element_stack_index];
-							if (attrcur) {
-//							    console_print("attr %s = %s\n", x->attr, attrbuf);
-								if (pass == ASAP_XML_PARSE_GROUPS_AND_FEATURES) {
-									if (current_element_type == ASAP_XML_ELEMENT_GROUP) {
-										group_set_attribute(&current_group, x->attr, attrbuf);
-									} else if (current_element_type == ASAP_XML_ELEMENT_FEATURE) {
-										feature_set_attribute(annotation_set, &current_feature, x->attr, attrbuf);
-									}
-								} else if (pass == ASAP_XML_PARSE_ANNOTATIONS) {
-									if (current_element_type == ASAP_XML_ELEMENT_ANNOTATION) {
-										annotation_set_attribute(annotation_set, arrlastptr(annotation_set->stored_annotations), x->attr, attrbuf);
-									} else if (current_element_type == ASAP_XML_ELEMENT_COORDINATE) {
-										annotation_t* annotation = arrlastptr(annotation_set->stored_annotations);
-										ASSERT(annotation);
-										if (annotation) {
-											v2f* coordinate = arrlastptr(annotation->coordinates);
-											ASSERT(coordinate);
-											if (coordinate) {
-												coordinate_set_attribute(annotation_set, annotation, coordinate, x->attr, attrbuf);
-											}
-										}
-									} else if (current_element_type == ASAP_XML_ELEMENT_FEATURE) {
-										feature_set_attribute(annotation_set, &current_feature, x->attr, attrbuf);
-									}
-								}
+static bool asap_xml_parse_chunk(asap_xml_parser_t* parser, const u8* data, size_t size) {
+	yxml_t* x = parser->x;
+	annotation_set_t* parsed_set = &parser->parsed_set;
+
+	for (size_t i = 0; i < size; ++i) {
+		yxml_ret_t r = yxml_parse(x, data[i]);
+		if (r == YXML_OK) {
+			continue; // nothing worthy of note has happened -> continue
+		} else if (r < 0) {
+			console_print_error("load_asap_xml_annotations(): XML parse error (%d)\n", r);
+			return false;
+		}
+		switch(r) {
+			case YXML_ELEMSTART: {
+				// start of an element: '<Tag ..'
+				++parser->element_stack_index;
+				if (parser->element_stack_index >= ASAP_XML_PARSER_MAX_STACK) {
+					console_print_error("load_asap_xml_annotations(): element stack overflow (too many nested elements)\n");
+					return false;
+				}
+				asap_xml_element_enum element_type = asap_xml_get_element_type(x->elem);
+				switch (element_type) {
+					case ASAP_XML_ELEMENT_ANNOTATIONFEATURES: {
+						// We need to track this in order to disambiguate feature definitions from feature values
+						// Feature definitions are stored separately within an <AnnotationFeatures> tag
+						// Feature values are stored within an <Annotation>
+						// (We are letting both situations use the <Feature> tag, but in a different way)
+						parser->is_within_annotationfeatures_tag = true;
+					} break;
+					case ASAP_XML_ELEMENT_GROUP: {
+						// reset the state (start parsing a new group)
+						memset(&parser->current_group, 0, sizeof(parser->current_group));
+						parser->current_group.is_explicitly_defined = true; // (because this group has an XML tag)
+					} break;
+					case ASAP_XML_ELEMENT_FEATURE: {
+						// reset the state (start parsing a new feature definition, or a feature value)
+						memset(&parser->current_feature, 0, sizeof(parser->current_feature));
+						parser->current_feature.is_explicitly_defined = parser->is_within_annotationfeatures_tag;
+					} break;
+					case ASAP_XML_ELEMENT_ANNOTATION: {
+						annotation_t new_annotation = {};
+						arrput(parsed_set->stored_annotations, new_annotation);
+						++parsed_set->stored_annotation_count;
+						parser->is_within_annotation = true;
+					} break;
+					case ASAP_XML_ELEMENT_COORDINATE: {
+						if (parser->is_within_annotation) {
+							annotation_t* current_annotation = arrlastptr(parsed_set->stored_annotations);
+							v2f new_coordinate = {};
+							arrput(current_annotation->coordinates, new_coordinate);
+							++current_annotation->coordinate_count;
+						}
+					} break;
+					default: break;
+				}
+				parser->element_stack[parser->element_stack_index] = element_type;
+			} break;
+
+			case YXML_ELEMEND: {
+				// end of an element: '.. />' or '</Tag>'
+				asap_xml_element_enum current_element_type = parser->element_stack[parser->element_stack_index];
+				switch (current_element_type) {
+					case ASAP_XML_ELEMENT_GROUP: {
+						// Check if a group already exists with this name, if not create it
+						i32 group_index = find_annotation_group_or_create_if_not_found(parsed_set, parser->current_group.name);
+						// 'Commit' the group with all its attributes
+						memcpy(parsed_set->stored_groups + group_index, &parser->current_group, sizeof(annotation_group_t));
+						arrput(parser->group_definition_order, group_index);
+					} break;
+					case ASAP_XML_ELEMENT_FEATURE: {
+						// Check if a feature already exists with this name, if not create it
+						i32 feature_index = find_annotation_feature_or_create_if_not_found(parsed_set, parser->current_feature.name);
+						if (parser->is_within_annotationfeatures_tag) {
+							// 'Commit' the feature with all its attributes
+							annotation_feature_t* destination_feature = parsed_set->stored_features + feature_index;
+							memcpy(destination_feature, &parser->current_feature, sizeof(*destination_feature));
+							destination_feature->id = feature_index;
+						} else if (parser->is_within_annotation) {
+							annotation_t* annotation = arrlastptr(parsed_set->stored_annotations);
+							if (feature_index < COUNT(annotation->features)) {
+								annotation->features[feature_index] = parser->current_feature.value;
+							} else {
+								console_print_error("load_asap_xml_annotations(): too many features, ignoring feature '%s'\n", parser->current_feature.name);
 							}
-						} break;
-						case YXML_PISTART:
-						case YXML_PICONTENT:
-						case YXML_PIEND:
-							break; // processing instructions (uninteresting, skip)
-						default: {
-							console_print("yxml_parse(): unrecognized token (%d)\n", r);
-							goto failed;
 						}
+					} break;
+					case ASAP_XML_ELEMENT_ANNOTATION: {
+						parser->is_within_annotation = false;
+					} break;
+					case ASAP_XML_ELEMENT_ANNOTATIONFEATURES: {
+						parser->is_within_annotationfeatures_tag = false;
+					} break;
+					default: break;
+				}
+
+				// 'Pop' out of the element stack
+				if (parser->element_stack_index <= 0) {
+					// Underflow! More YXML_ELEMEND than YXML_ELEMSTART?
+					// yxml should throw an error in this case (malformed XML file?); this code should never be reached.
+					panic();
+				}
+				--parser->element_stack_index;
+			} break;
+
+			case YXML_ATTRSTART: {
+				// attribute: 'Name=..'
+				parser->attrcur = parser->attrbuf;
+				*parser->attrcur = '\0';
+			} break;
+			case YXML_ATTRVAL: {
+				// attribute value
+				if (!parser->attrcur) break;
+				char* attrbuf_last = parser->attrbuf + sizeof(parser->attrbuf) - 1; // room for the zero terminator
+				for (char* tmp = x->data; *tmp; ++tmp) {
+					if (parser->attrcur == attrbuf_last) {
+						console_print_error("load_asap_xml_annotations(): encountered a too long XML attribute\n");
+						return false;
 					}
+					*(parser->attrcur++) = *tmp;
+				}
+				*parser->attrcur = '\0';
+			} break;
+			case YXML_ATTREND: {
+				// end of attribute '.."'
+				if (!parser->attrcur) break;
+				const char* value = parser->attrbuf;
+				switch (parser->element_stack[parser->element_stack_index]) {
+					case ASAP_XML_ELEMENT_COORDINATE: {
+						if (parser->is_within_annotation) {
+							annotation_t* annotation = arrlastptr(parsed_set->stored_annotations);
+							v2f* coordinate = arrlastptr(annotation->coordinates);
+							coordinate_set_attribute(parsed_set, coordinate, x->attr, value);
+						}
+					} break;
+					case ASAP_XML_ELEMENT_ANNOTATION: {
+						annotation_set_attribute(parsed_set, arrlastptr(parsed_set->stored_annotations), x->attr, value);
+					} break;
+					case ASAP_XML_ELEMENT_GROUP: {
+						group_set_attribute(&parser->current_group, x->attr, value);
+					} break;
+					case ASAP_XML_ELEMENT_FEATURE: {
+						feature_set_attribute(parsed_set, &parser->current_feature, x->attr, value);
+					} break;
+					default: break;
 				}
+				parser->attrcur = NULL;
+			} break;
+			case YXML_CONTENT:
+				break; // element content (usually only whitespace, such as newlines)
+			case YXML_PISTART:
+			case YXML_PICONTENT:
+			case YXML_PIEND:
+				break; // processing instructions (uninteresting, skip)
+			default: {
+				console_print("yxml_parse(): unrecognized token (%d)\n", r);
+				return false;
 			}
 		}
 	}
+	return true;
+}
+
+static void asap_xml_parser_destroy(asap_xml_parser_t* parser) {
+	if (parser->fp) fclose(parser->fp);
+	if (parser->chunk) free(parser->chunk);
+	if (parser->x) free(parser->x);
+	destroy_annotation_set(&parser->parsed_set); // (an annotation that was cut off at the end is discarded)
+	arrfree(parser->group_definition_order);
+	free(parser);
+}
 
-	// At this point, the indices for the 'active' annotations are all nicely in order (as they are loaded).
-	// So we simply set the indices in ascending order, as a reference to look up the actual annotation_t struct.
-	// (later on, the indices might get reordered by the user, annotations might get deleted, inserted, etc.)
-	ASSERT(annotation_set->active_annotation_indices == NULL);
-	arrsetlen(annotation_set->active_annotation_indices, annotation_set->stored_annotation_count);
-	annotation_set->active_annotation_count = annotation_set->stored_annotation_count;
-	for (i32 i = 0; i < annotation_set->active_annotation_count; ++i) {
-		annotation_set->active_annotation_indices[i] = i;
+static void asap_xml_loader_finish(annotation_loader_t* loader, bool success) {
+	asap_xml_parser_destroy(loader->parser);
+	loader->parser = NULL;
+	loader->success = success;
+	write_barrier;
+	loader->is_done = true;
+}
+
+// Parse the next slice of the file. The job submits itself again for the slice after that, so that only one slice is
+// being parsed at any time, and the worker thread (or the main thread, if it is helping out) is never tied up for long.
+static void asap_xml_loader_job_func(i32 logical_thread_index, void* userdata) {
+	annotation_loader_t* loader = *(annotation_loader_t**) userdata;
+	asap_xml_parser_t* parser = loader->parser;
+	if (loader->is_cancelled) {
+		asap_xml_loader_finish(loader, false);
+		return;
 	}
 
-	strncpy(annotation_set->asap_xml_filename, filename, sizeof(annotation_set->asap_xml_filename)-1);
-	annotation_set->export_as_asap_xml = true;
-	annotation_set->annotations_were_loaded_from_file = true;
-	success = true;
-	float seconds_elapsed = get_seconds_elapsed(start, get_clock());
-	console_print_verbose("Loaded ASAP XML annotations in %g seconds.\n", seconds_elapsed);
+	size_t bytes_read = fread(parser->chunk, 1, ASAP_XML_LOADER_CHUNK_SIZE, parser->fp);
+	bool success = asap_xml_parse_chunk(parser, parser->chunk, bytes_read);
+	bool is_end_of_file = (bytes_read < ASAP_XML_LOADER_CHUNK_SIZE);
+	if (is_end_of_file && success) {
+		if (ferror(parser->fp)) {
+			console_print_error("load_asap_xml_annotations(): error reading '%s'\n", loader->filename);
+			success = false;
+		} else if (yxml_eof(parser->x) < 0) {
+			console_print_error("load_asap_xml_annotations(): unexpected end of file '%s'\n", loader->filename);
+			success = false;
+		}
+	}
+
+	i32 finished_count = parser->parsed_set.stored_annotation_count - (parser->is_within_annotation ? 1 : 0);
+	annotation_loader_publish(loader, &parser->parsed_set, finished_count, parser->group_definition_order);
+
+	if (!success || is_end_of_file) {
+		asap_xml_loader_finish(loader, success);
+	} else if (!add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_PREFETCH, asap_xml_loader_job_func, &loader, sizeof(loader))) {
+		asap_xml_loader_finish(loader, false);
+	}
+	// NOTE: at this point, the next job may already be running -> don't touch the parser anymore.
+}
 
-	goto cleanup;
-	// return success;
+// Start loading the annotations in the background. They are added to the annotation set as they come in,
+// see annotation_loader_collect().
+bool32 load_asap_xml_annotations(app_state_t* app_state, const char* filename) {
+	annotation_set_t* annotation_set = &app_state->scene.annotation_set;
+	annotation_loader_wait(annotation_set); // in case we are still busy with another file
+
+	FILE* fp = fopen(filename, "rb");
+	if (!fp) {
+		console_print_error("load_asap_xml_annotations(): could not open '%s'\n", filename);
+		return false;
+	}
+
+	asap_xml_parser_t* parser = (asap_xml_parser_t*) calloc(1, sizeof(asap_xml_parser_t));
+	parser->fp = fp;
+	parser->chunk = (u8*) malloc(ASAP_XML_LOADER_CHUNK_SIZE);
+	// hack: merge memory for yxml_t struct and stack buffer
+	// Note: what is a good stack buffer size?
+	parser->x = (yxml_t*) malloc(sizeof(yxml_t) + YXML_STACK_BUFFER_SIZE);
+	yxml_init(parser->x, parser->x + 1, YXML_STACK_BUFFER_SIZE);
+	parser->parsed_set.mpp = annotation_set->mpp;
+	parser->parsed_set.editing_annotation_index = -1;
+	parser->parsed_set.selected_coordinate_annotation_index = -1;
+	add_annotation_group(&parser->parsed_set, "None"); // group 0 is reserved for "None", same as in the annotation set
+
+	annotation_loader_t* loader = annotation_loader_create(annotation_set, filename);
+	loader->parser = parser;
+	if (!add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_PREFETCH, asap_xml_loader_job_func, &loader, sizeof(loader))) {
+		asap_xml_loader_finish(loader, false);
+	}
+	return true;
 }
 
 void asap_xml_print_color(char* buf, size_t bufsize, rgba_t rgba) {
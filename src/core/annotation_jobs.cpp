@@ -0,0 +1,141 @@
+/*
+  Slidescape, a whole-slide image viewer for digital pathology.
+  Copyright (C) 2019-2022  Pieter Valkema
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Background jobs for derived calculations on large polygons (simplified outlines, tesselation).
+// A job works on a private copy of the coordinates. When it is done, the main thread hands the results over to the
+// annotation, unless the coordinates were changed in the meantime (checked using coordinates_generation).
+
+// Polygons with fewer coordinates are tesselated right away on the main thread, that is fast enough.
+#define ANNOTATION_TESSELATION_MAX_SYNCHRONOUS_COORDINATE_COUNT 256
+
+static void annotation_job_func(i32 logical_thread_index, void* userdata) {
+	annotation_job_t* job = *(annotation_job_t**) userdata;
+	switch (job->type) {
+		case ANNOTATION_JOB_LOD: {
+			annotation_lod_calculate(job);
+		} break;
+		case ANNOTATION_JOB_TESSELATION: {
+			job->is_complex_polygon = !triangulate_process(job->coordinates, job->coordinate_count, &job->tesselated_triangles);
+		} break;
+	}
+	write_barrier;
+	job->is_done = true;
+}
+
+annotation_job_t* annotation_job_submit(annotation_set_t* annotation_set, annotation_t* annotation, annotation_job_type_enum type, float lod_base_tolerance) {
+	annotation_job_t* job = (annotation_job_t*) calloc(1, sizeof(annotation_job_t));
+	job->type = type;
+	job->stored_index = (i32)(annotation - annotation_set->stored_annotations);
+	job->generation = annotation->coordinates_generation;
+	job->coordinate_count = annotation->coordinate_count;
+	job->coordinates = (v2f*) malloc(annotation->coordinate_count * sizeof(v2f));
+	memcpy(job->coordinates, annotation->coordinates, annotation->coordinate_count * sizeof(v2f));
+	job->lod_base_tolerance = lod_base_tolerance;
+	if (!add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, annotation_job_func, &job, sizeof(job))) {
+		free(job->coordinates);
+		free(job);
+		return NULL; // queue is full, try again next frame
+	}
+	arrput(annotation_set->pending_jobs, job);
+	return job;
+}
+
+void annotation_tesselation_request(annotation_set_t* annotation_set, annotation_t* annotation) {
+	if (annotation->valid_flags & ANNOTATION_VALID_TESSELATION) return;
+	if (annotation->coordinate_count < ANNOTATION_TESSELATION_MAX_SYNCHRONOUS_COORDINATE_COUNT) {
+		arrsetlen(annotation->tesselated_trianges, 0);
+		annotation->is_complex_polygon = !triangulate_process(annotation->coordinates, annotation->coordinate_count, &annotation->tesselated_trianges);
+		annotation->valid_flags |= ANNOTATION_VALID_TESSELATION;
+	} else if (!annotation->is_tesselation_pending) {
+		// The previous triangles (if any) keep being drawn until the new ones are ready.
+		if (annotation_job_submit(annotation_set, annotation, ANNOTATION_JOB_TESSELATION, 0.0f)) {
+			annotation->is_tesselation_pending = true;
+		}
+	}
+}
+
+static void annotation_job_free(annotation_job_t* job) {
+	for (i32 level = 0; level < ANNOTATION_LOD_LEVEL_COUNT; ++level) {
+		arrfree(job->lod_coordinates[level]);
+	}
+	arrfree(job->tesselated_triangles);
+	free(job->coordinates);
+	free(job);
+}
+
+static void annotation_job_hand_over_results(annotation_t* annotation, annotation_job_t* job) {
+	bool is_up_to_date = (annotation->coordinates_generation == job->generation);
+	switch (job->type) {
+		case ANNOTATION_JOB_LOD: {
+			annotation->is_lod_pending = false;
+			if (is_up_to_date) {
+				// Swap, so that the old outlines get freed together with the job.
+				for (i32 level = 0; level < ANNOTATION_LOD_LEVEL_COUNT; ++level) {
+					v2f* old_lod_coordinates = annotation->lod_coordinates[level];
+					annotation->lod_coordinates[level] = job->lod_coordinates[level];
+					job->lod_coordinates[level] = old_lod_coordinates;
+				}
+				annotation->lod_base_tolerance = job->lod_base_tolerance;
+				annotation->valid_flags |= ANNOTATION_VALID_LOD;
+			}
+		} break;
+		case ANNOTATION_JOB_TESSELATION: {
+			annotation->is_tesselation_pending = false;
+			// Even if the coordinates have changed since, these triangles are still closer to the current shape than
+			// the ones we had (e.g. while dragging a coordinate), so keep drawing them as a fallback.
+			if (annotation->coordinates != NULL) {
+				v2f* old_triangles = annotation->tesselated_trianges;
+				annotation->tesselated_trianges = job->tesselated_triangles;
+				job->tesselated_triangles = old_triangles;
+				annotation->is_complex_polygon = job->is_complex_polygon;
+				if (is_up_to_date) {
+					annotation->valid_flags |= ANNOTATION_VALID_TESSELATION;
+				} else {
+					annotation->fallback_valid_flags |= ANNOTATION_VALID_TESSELATION;
+				}
+			}
+		} break;
+	}
+}
+
+// Hand over the results of the jobs that have finished to their annotations (NOTE: main thread only).
+void annotation_collect_finished_jobs(annotation_set_t* annotation_set) {
+	for (i32 i = 0; i < arrlen(annotation_set->pending_jobs); ++i) {
+		annotation_job_t* job = annotation_set->pending_jobs[i];
+		if (!job->is_done) continue;
+		read_barrier;
+		if (job->stored_index < annotation_set->stored_annotation_count) {
+			annotation_t* annotation = annotation_set->stored_annotations + job->stored_index;
+			annotation_job_hand_over_results(annotation, job);
+		}
+		annotation_job_free(job);
+		arrdelswap(annotation_set->pending_jobs, i);
+		--i;
+	}
+}
+
+void annotation_wait_for_pending_jobs(annotation_set_t* annotation_set) {
+	for (i32 i = 0; i < arrlen(annotation_set->pending_jobs); ++i) {
+		annotation_job_t* job = annotation_set->pending_jobs[i];
+		while (!job->is_done) {
+			do_worker_work(&global_work_queue, 0);
+		}
+		annotation_job_free(job);
+	}
+	arrfree(annotation_set->pending_jobs);
+}
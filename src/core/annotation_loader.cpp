@@ -0,0 +1,261 @@
+/*
+  Slidescape, a whole-slide image viewer for digital pathology.
+  Copyright (C) 2019-2022  Pieter Valkema
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Loading annotations in the background, so that the first annotations can be drawn while the rest of the file is
+// still being parsed (currently used for ASAP XML, see annotation_asap_xml.cpp).
+// The parser keeps its own private annotation set. Every so often it publishes the annotations it has finished,
+// together with a snapshot of its groups and features. The main thread then moves the annotations over into the real
+// annotation set, translating the group and feature indices along the way.
+
+annotation_loader_t* annotation_loader_create(annotation_set_t* annotation_set, const char* filename) {
+	ASSERT(annotation_set->loader == NULL);
+	annotation_loader_t* loader = (annotation_loader_t*) calloc(1, sizeof(annotation_loader_t));
+	snprintf(loader->filename, sizeof(loader->filename), "%s", filename);
+	loader->start_clock = get_clock();
+	loader->lock = benaphore_create();
+	loader->initial_group_count = annotation_set->stored_group_count;
+	annotation_set->loader = loader;
+	return loader;
+}
+
+static void annotation_loader_destroy(annotation_loader_t* loader) {
+	for (i32 i = 0; i < arrlen(loader->published_annotations); ++i) {
+		destroy_annotation(loader->published_annotations + i);
+	}
+	arrfree(loader->published_annotations);
+	arrfree(loader->published_groups);
+	arrfree(loader->published_features);
+	arrfree(loader->published_group_definition_order);
+	arrfree(loader->group_map);
+	arrfree(loader->feature_map);
+	benaphore_destroy(&loader->lock);
+	free(loader);
+}
+
+// Hand over the first finished_count annotations of the parser's private set to the main thread.
+// (NOTE: called from the parsing job; the annotation that is still being parsed, if any, stays behind.)
+void annotation_loader_publish(annotation_loader_t* loader, annotation_set_t* parsed_set, i32 finished_count, i32* group_definition_order) {
+	ASSERT(finished_count <= parsed_set->stored_annotation_count);
+	benaphore_lock(&loader->lock);
+	for (i32 i = 0; i < finished_count; ++i) {
+		arrput(loader->published_annotations, parsed_set->stored_annotations[i]);
+	}
+	arrsetlen(loader->published_groups, parsed_set->stored_group_count);
+	if (parsed_set->stored_group_count > 0) {
+		memcpy(loader->published_groups, parsed_set->stored_groups, parsed_set->stored_group_count * sizeof(annotation_group_t));
+	}
+	arrsetlen(loader->published_features, parsed_set->stored_feature_count);
+	if (parsed_set->stored_feature_count > 0) {
+		memcpy(loader->published_features, parsed_set->stored_features, parsed_set->stored_feature_count * sizeof(annotation_feature_t));
+	}
+	i32 definition_count = arrlen(group_definition_order);
+	arrsetlen(loader->published_group_definition_order, definition_count);
+	if (definition_count > 0) {
+		memcpy(loader->published_group_definition_order, group_definition_order, definition_count * sizeof(i32));
+	}
+	benaphore_unlock(&loader->lock);
+
+	i32 remaining_count = parsed_set->stored_annotation_count - finished_count;
+	if (finished_count > 0 && remaining_count > 0) {
+		memmove(parsed_set->stored_annotations, parsed_set->stored_annotations + finished_count, remaining_count * sizeof(annotation_t));
+	}
+	arrsetlen(parsed_set->stored_annotations, remaining_count);
+	parsed_set->stored_annotation_count = remaining_count;
+}
+
+// Make sure that all groups and features known to the parser also exist in the annotation set (NOTE: lock must be held).
+static void annotation_loader_sync_groups_and_features(annotation_set_t* annotation_set, annotation_loader_t* loader) {
+	for (i32 i = arrlen(loader->group_map); i < arrlen(loader->published_groups); ++i) {
+		arrput(loader->group_map, find_annotation_group_or_create_if_not_found(annotation_set, loader->published_groups[i].name));
+	}
+	for (i32 i = 0; i < arrlen(loader->published_groups); ++i) {
+		annotation_group_t* parsed_group = loader->published_groups + i;
+		annotation_group_t* group = annotation_set->stored_groups + loader->group_map[i];
+		// The definition may only be encountered after the group was first referenced.
+		if (parsed_group->is_explicitly_defined && !group->is_explicitly_defined) {
+			group->color = parsed_group->color;
+			group->is_explicitly_defined = true;
+		}
+	}
+
+	for (i32 i = arrlen(loader->feature_map); i < arrlen(loader->published_features); ++i) {
+		arrput(loader->feature_map, find_annotation_feature_or_create_if_not_found(annotation_set, loader->published_features[i].name));
+	}
+	for (i32 i = 0; i < arrlen(loader->published_features); ++i) {
+		annotation_feature_t* parsed_feature = loader->published_features + i;
+		annotation_feature_t* feature = annotation_set->stored_features + loader->feature_map[i];
+		if (parsed_feature->is_explicitly_defined && !feature->is_explicitly_defined) {
+			feature->color = parsed_feature->color;
+			if (parsed_feature->restrict_to_group && parsed_feature->group_id < arrlen(loader->group_map)) {
+				feature->restrict_to_group = true;
+				feature->group_id = loader->group_map[parsed_feature->group_id];
+			}
+			feature->is_explicitly_defined = true;
+		}
+	}
+}
+
+// Groups get created in the order in which they are first referenced, but ASAP puts the group definitions at the end
+// of the file. Move the defined groups to the front (in the order in which they were defined), as a two-pass loader would.
+static void annotation_loader_restore_group_order(annotation_set_t* annotation_set, annotation_loader_t* loader) {
+	i32 group_count = annotation_set->stored_group_count;
+	if (group_count != annotation_set->active_group_count) return;
+	for (i32 i = 0; i < group_count; ++i) {
+		if (annotation_set->active_group_indices[i] != i) return; // groups were rearranged in the meantime, leave them be
+	}
+
+	temp_memory_t temp_memory = begin_temp_memory_on_local_thread();
+	i32* new_order = (i32*) arena_push_size(temp_memory.arena, group_count * sizeof(i32)); // new index -> old index
+	i32* remap = (i32*) arena_push_size(temp_memory.arena, group_count * sizeof(i32)); // old index -> new index
+	for (i32 i = 0; i < group_count; ++i) {
+		remap[i] = -1;
+	}
+	i32 placed_count = 0;
+	for (i32 i = 0; i < loader->initial_group_count; ++i) {
+		new_order[placed_count] = i;
+		remap[i] = placed_count++;
+	}
+	for (i32 i = 0; i < arrlen(loader->published_group_definition_order); ++i) {
+		i32 parsed_index = loader->published_group_definition_order[i];
+		if (parsed_index < 0 || parsed_index >= arrlen(loader->group_map)) continue;
+		i32 group_index = loader->group_map[parsed_index];
+		if (remap[group_index] < 0) {
+			new_order[placed_count] = group_index;
+			remap[group_index] = placed_count++;
+		}
+	}
+	for (i32 i = 0; i < group_count; ++i) {
+		if (remap[i] < 0) {
+			new_order[placed_count] = i;
+			remap[i] = placed_count++;
+		}
+	}
+	ASSERT(placed_count == group_count);
+
+	annotation_group_t* old_groups = (annotation_group_t*) arena_push_size(temp_memory.arena, group_count * sizeof(annotation_group_t));
+	memcpy(old_groups, annotation_set->stored_groups, group_count * sizeof(annotation_group_t));
+	for (i32 i = 0; i < group_count; ++i) {
+		annotation_set->stored_groups[i] = old_groups[new_order[i]];
+	}
+	for (i32 i = 0; i < annotation_set->stored_annotation_count; ++i) {
+		annotation_t* annotation = annotation_set->stored_annotations + i;
+		if (annotation->group_id >= 0 && annotation->group_id < group_count) {
+			annotation->group_id = remap[annotation->group_id];
+		}
+	}
+	for (i32 i = 0; i < annotation_set->stored_feature_count; ++i) {
+		annotation_feature_t* feature = annotation_set->stored_features + i;
+		if (feature->restrict_to_group && feature->group_id >= 0 && feature->group_id < group_count) {
+			feature->group_id = remap[feature->group_id];
+		}
+	}
+	if (annotation_set->last_assigned_annotation_group >= 0 && annotation_set->last_assigned_annotation_group < group_count) {
+		annotation_set->last_assigned_annotation_group = remap[annotation_set->last_assigned_annotation_group];
+	}
+	release_temp_memory(&temp_memory);
+}
+
+static void annotation_loader_finish(annotation_set_t* annotation_set) {
+	annotation_loader_t* loader = annotation_set->loader;
+	annotation_loader_restore_group_order(annotation_set, loader);
+
+	snprintf(annotation_set->asap_xml_filename, sizeof(annotation_set->asap_xml_filename), "%s", loader->filename);
+	annotation_set->export_as_asap_xml = true;
+	// NOTE: also set if loading failed halfway, so that the original file gets backed up before it is overwritten.
+	annotation_set->annotations_were_loaded_from_file = true;
+
+	float seconds_elapsed = get_seconds_elapsed(loader->start_clock, get_clock());
+	if (loader->success) {
+		console_print_verbose("Loaded ASAP XML annotations in %g seconds.\n", seconds_elapsed);
+		if (annotation_enable_store && !annotation_set->modified) {
+			// Create the binary annotation store right away, so that next time the annotations load faster.
+			annotation_store_write_changes(annotation_set, true);
+		}
+	} else {
+		console_print_error("Error: could not completely load annotations from '%s'\n", loader->filename);
+	}
+	annotation_loader_destroy(loader);
+	annotation_set->loader = NULL;
+}
+
+// Move the annotations that have been published so far into the annotation set (NOTE: main thread only).
+void annotation_loader_collect(annotation_set_t* annotation_set) {
+	annotation_loader_t* loader = annotation_set->loader;
+	if (!loader) return;
+	bool is_done = loader->is_done;
+	read_barrier;
+
+	benaphore_lock(&loader->lock);
+	annotation_t* annotations = loader->published_annotations;
+	loader->published_annotations = NULL;
+	annotation_loader_sync_groups_and_features(annotation_set, loader);
+	benaphore_unlock(&loader->lock);
+
+	i32 annotation_count = arrlen(annotations);
+	i32 mapped_group_count = arrlen(loader->group_map);
+	i32 mapped_feature_count = MIN(arrlen(loader->feature_map), MAX_ANNOTATION_FEATURES);
+	for (i32 i = 0; i < annotation_count; ++i) {
+		annotation_t* annotation = annotations + i;
+		if (annotation->group_id >= 0 && annotation->group_id < mapped_group_count) {
+			annotation->group_id = loader->group_map[annotation->group_id];
+		} else {
+			annotation->group_id = 0;
+		}
+		float features[MAX_ANNOTATION_FEATURES] = {};
+		for (i32 j = 0; j < mapped_feature_count; ++j) {
+			i32 feature_index = loader->feature_map[j];
+			if (feature_index >= 0 && feature_index < MAX_ANNOTATION_FEATURES) {
+				features[feature_index] = annotation->features[j];
+			}
+		}
+		memcpy(annotation->features, features, sizeof(features));
+
+		arrput(annotation_set->active_annotation_indices, annotation_set->stored_annotation_count);
+		++annotation_set->active_annotation_count;
+		arrput(annotation_set->stored_annotations, *annotation);
+		++annotation_set->stored_annotation_count;
+	}
+	arrfree(annotations);
+
+	if (is_done) {
+		annotation_loader_finish(annotation_set);
+	}
+}
+
+// Block until the whole file has been loaded.
+void annotation_loader_wait(annotation_set_t* annotation_set) {
+	annotation_loader_t* loader = annotation_set->loader;
+	if (!loader) return;
+	while (!loader->is_done) {
+		do_worker_work(&global_work_queue, 0);
+	}
+	annotation_loader_collect(annotation_set);
+}
+
+// Stop loading, discarding the annotations that have not been collected yet.
+void annotation_loader_cancel(annotation_set_t* annotation_set) {
+	annotation_loader_t* loader = annotation_set->loader;
+	if (!loader) return;
+	loader->is_cancelled = true;
+	while (!loader->is_done) {
+		do_worker_work(&global_work_queue, 0);
+	}
+	read_barrier;
+	annotation_loader_destroy(loader);
+	annotation_set->loader = NULL;
+}
@@ -0,0 +1,138 @@
+/*
+  Slidescape, a whole-slide image viewer for digital pathology.
+  Copyright (C) 2019-2022  Pieter Valkema
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Level of detail for drawing polygons with many coordinates (e.g. detailed tumour outlines) at low magnification.
+// The simplified outlines are calculated with the Douglas-Peucker algorithm on a worker thread, the first time they
+// are needed. Until the results arrive (or after the coordinates have changed), the full outline is drawn instead.
+
+typedef struct douglas_peucker_span_t {
+	i32 first;
+	i32 last;
+} douglas_peucker_span_t;
+
+// Simplify the closed outline, keeping only the coordinates that deviate more than the tolerance.
+static void simplify_closed_outline(v2f* coordinates, i32 coordinate_count, float tolerance, v2f** result) {
+	arrsetlen(*result, 0);
+	if (coordinate_count <= 3) {
+		for (i32 i = 0; i < coordinate_count; ++i) {
+			arrput(*result, coordinates[i]);
+		}
+		return;
+	}
+	temp_memory_t temp_memory = begin_temp_memory_on_local_thread();
+	u8* keep = (u8*) arena_push_size(temp_memory.arena, coordinate_count + 1);
+	memset(keep, 0, coordinate_count + 1);
+	// Worst case, every span gets split, so the stack never needs to hold more spans than there are coordinates.
+	douglas_peucker_span_t* stack = (douglas_peucker_span_t*) arena_push_size(temp_memory.arena, (coordinate_count + 2) * sizeof(douglas_peucker_span_t));
+	i32 stack_size = 0;
+
+	// Treat the outline as two open polylines, split at the coordinate farthest away from the first coordinate.
+	// Index coordinate_count is an alias for coordinate 0, closing the loop.
+	i32 farthest_index = 0;
+	float farthest_distance_sq = -1.0f;
+	for (i32 i = 1; i < coordinate_count; ++i) {
+		float distance_sq = v2f_length_squared(v2f_subtract(coordinates[i], coordinates[0]));
+		if (distance_sq > farthest_distance_sq) {
+			farthest_distance_sq = distance_sq;
+			farthest_index = i;
+		}
+	}
+	keep[0] = 1;
+	keep[farthest_index] = 1;
+	stack[stack_size++] = {0, farthest_index};
+	stack[stack_size++] = {farthest_index, coordinate_count};
+
+	float tolerance_sq = SQUARE(tolerance);
+	while (stack_size > 0) {
+		douglas_peucker_span_t span = stack[--stack_size];
+		if (span.last - span.first < 2) continue;
+		v2f line_start = coordinates[span.first];
+		v2f line_end = coordinates[span.last % coordinate_count];
+		i32 split_index = -1;
+		float max_distance_sq = tolerance_sq;
+		for (i32 i = span.first + 1; i < span.last; ++i) {
+			v2f projected_point = project_point_on_line_segment(coordinates[i], line_start, line_end, NULL);
+			float distance_sq = v2f_length_squared(v2f_subtract(coordinates[i], projected_point));
+			if (distance_sq > max_distance_sq) {
+				max_distance_sq = distance_sq;
+				split_index = i;
+			}
+		}
+		if (split_index >= 0) {
+			keep[split_index] = 1;
+			stack[stack_size++] = {span.first, split_index};
+			stack[stack_size++] = {split_index, span.last};
+		}
+	}
+
+	for (i32 i = 0; i < coordinate_count; ++i) {
+		if (keep[i]) {
+			arrput(*result, coordinates[i]);
+		}
+	}
+	release_temp_memory(&temp_memory);
+}
+
+// Calculate the simplified outlines (called from annotation_job_func() on a worker thread).
+static void annotation_lod_calculate(annotation_job_t* job) {
+	// Each level is simplified from the full outline. (Simplifying from the previous level would be cheaper, but then
+	// the errors of all the finer levels add up, and the deviation would no longer be bounded by the level's tolerance.)
+	float tolerance = job->lod_base_tolerance;
+	for (i32 level = 0; level < ANNOTATION_LOD_LEVEL_COUNT; ++level) {
+		simplify_closed_outline(job->coordinates, job->coordinate_count, tolerance, &job->lod_coordinates[level]);
+		tolerance *= 4.0f;
+	}
+}
+
+// Returns the coarsest level that still deviates less than annotation_lod_max_screen_error from the real outline,
+// or -1 if the full outline should be drawn.
+i32 annotation_lod_select_level(annotation_t* annotation, float screen_point_width) {
+	if (annotation->coordinate_count < ANNOTATION_LOD_MIN_COORDINATE_COUNT || annotation->is_open) return -1;
+	float max_tolerance = annotation_lod_max_screen_error * screen_point_width;
+	float tolerance = annotation->lod_base_tolerance;
+	if (!(annotation->valid_flags & ANNOTATION_VALID_LOD)) {
+		// Not calculated yet: predict what the tolerances are going to be.
+		annotation_recalculate_bounds_if_necessary(annotation);
+		float extent = MAX(annotation->bounds.right - annotation->bounds.left, annotation->bounds.bottom - annotation->bounds.top);
+		tolerance = extent / 4096.0f;
+	}
+	i32 selected_level = -1;
+	for (i32 level = 0; level < ANNOTATION_LOD_LEVEL_COUNT; ++level) {
+		if (tolerance > max_tolerance) break;
+		selected_level = level;
+		tolerance *= 4.0f;
+	}
+	return selected_level;
+}
+
+void annotation_lod_request(annotation_set_t* annotation_set, annotation_t* annotation) {
+	if (annotation->is_lod_pending || (annotation->valid_flags & ANNOTATION_VALID_LOD)) return;
+	annotation_recalculate_bounds_if_necessary(annotation);
+	float extent = MAX(annotation->bounds.right - annotation->bounds.left, annotation->bounds.bottom - annotation->bounds.top);
+	if (annotation_job_submit(annotation_set, annotation, ANNOTATION_JOB_LOD, extent / 4096.0f)) {
+		annotation->is_lod_pending = true;
+	}
+}
+
+void annotation_lod_destroy(annotation_t* annotation) {
+	for (i32 level = 0; level < ANNOTATION_LOD_LEVEL_COUNT; ++level) {
+		arrfree(annotation->lod_coordinates[level]);
+	}
+	annotation->valid_flags &= ~ANNOTATION_VALID_LOD;
+	++annotation->coordinates_generation; // results of a job that is still running will be discarded
+}
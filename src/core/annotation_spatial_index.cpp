@@ -0,0 +1,328 @@
+/*
+  Slidescape, a whole-slide image viewer for digital pathology.
+  Copyright (C) 2019-2022  Pieter Valkema
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Spatial index for annotations: a uniform grid over the bounds of the annotation set, so that drawing and
+// hit-testing only need to look at the annotations near the viewport or the mouse cursor.
+// Every cell holds the stored indices of the annotations whose bounds overlap it. Annotations that would cover too many
+// cells (or that have no coordinates, like ellipses) are kept in a separate list that is always checked.
+// The grid is updated incrementally: new annotations are picked up from the end of the active list, annotations whose
+// coordinates changed are reinserted, and deleted annotations are removed. If the set grows well beyond the size the
+// grid was laid out for (or too many annotations fall outside the grid), the whole grid is rebuilt.
+
+#define ANNOTATION_SPATIAL_INDEX_ANNOTATIONS_PER_CELL 4
+#define ANNOTATION_SPATIAL_INDEX_MAX_CELLS_PER_SIDE 1024
+#define ANNOTATION_SPATIAL_INDEX_MAX_CELLS_PER_ANNOTATION 64
+#define ANNOTATION_SPATIAL_INDEX_MIN_REBUILD_COUNT 256
+
+static bounds2i annotation_spatial_index_cell_range(annotation_spatial_index_t* index, bounds2f bounds) {
+	// Anything outside the grid is clamped onto the outermost cells, so it can still be found.
+	bounds2i range;
+	range.left = (i32)floorf((bounds.left - index->grid_bounds.left) / index->cell_width);
+	range.top = (i32)floorf((bounds.top - index->grid_bounds.top) / index->cell_height);
+	range.right = (i32)floorf((bounds.right - index->grid_bounds.left) / index->cell_width);
+	range.bottom = (i32)floorf((bounds.bottom - index->grid_bounds.top) / index->cell_height);
+	range.left = ATLEAST(0, ATMOST(index->width_in_cells - 1, range.left));
+	range.right = ATLEAST(0, ATMOST(index->width_in_cells - 1, range.right));
+	range.top = ATLEAST(0, ATMOST(index->height_in_cells - 1, range.top));
+	range.bottom = ATLEAST(0, ATMOST(index->height_in_cells - 1, range.bottom));
+	return range;
+}
+
+static inline bool annotation_spatial_index_bounds_are_outside_grid(annotation_spatial_index_t* index, bounds2f bounds) {
+	return bounds.left < index->grid_bounds.left || bounds.right > index->grid_bounds.right ||
+	       bounds.top < index->grid_bounds.top || bounds.bottom > index->grid_bounds.bottom;
+}
+
+static void annotation_spatial_index_insert(annotation_set_t* annotation_set, i32 stored_index) {
+	annotation_spatial_index_t* index = &annotation_set->spatial_index;
+	annotation_t* annotation = annotation_set->stored_annotations + stored_index;
+	annotation_spatial_index_entry_t* entry = index->entries + stored_index;
+	ASSERT(!entry->is_indexed);
+	entry->is_indexed = true;
+	entry->is_unbounded = false;
+	if (annotation->coordinate_count == 0) {
+		entry->is_unbounded = true;
+		arrput(index->unbounded, stored_index);
+		return;
+	}
+	annotation_recalculate_bounds_if_necessary(annotation);
+	if (annotation_spatial_index_bounds_are_outside_grid(index, annotation->bounds)) {
+		++index->outside_grid_count;
+	}
+	bounds2i range = annotation_spatial_index_cell_range(index, annotation->bounds);
+	i64 cell_count = (i64)(range.right - range.left + 1) * (range.bottom - range.top + 1);
+	if (cell_count > ANNOTATION_SPATIAL_INDEX_MAX_CELLS_PER_ANNOTATION) {
+		entry->is_unbounded = true;
+		arrput(index->unbounded, stored_index);
+		return;
+	}
+	entry->cell_range = range;
+	for (i32 y = range.top; y <= range.bottom; ++y) {
+		for (i32 x = range.left; x <= range.right; ++x) {
+			arrput(index->cells[y * index->width_in_cells + x], stored_index);
+		}
+	}
+}
+
+static void annotation_spatial_index_remove_from_list(i32* list, i32 stored_index) {
+	for (i32 i = 0; i < arrlen(list); ++i) {
+		if (list[i] == stored_index) {
+			arrdelswap(list, i);
+			return;
+		}
+	}
+}
+
+static void annotation_spatial_index_unlink(annotation_spatial_index_t* index, i32 stored_index) {
+	annotation_spatial_index_entry_t* entry = index->entries + stored_index;
+	if (!entry->is_indexed) return;
+	if (entry->is_unbounded) {
+		annotation_spatial_index_remove_from_list(index->unbounded, stored_index);
+	} else {
+		bounds2i range = entry->cell_range;
+		for (i32 y = range.top; y <= range.bottom; ++y) {
+			for (i32 x = range.left; x <= range.right; ++x) {
+				annotation_spatial_index_remove_from_list(index->cells[y * index->width_in_cells + x], stored_index);
+			}
+		}
+	}
+	entry->is_indexed = false;
+}
+
+static void annotation_spatial_index_free_grid(annotation_spatial_index_t* index) {
+	if (index->cells) {
+		i32 cell_count = index->width_in_cells * index->height_in_cells;
+		for (i32 i = 0; i < cell_count; ++i) {
+			arrfree(index->cells[i]);
+		}
+		free(index->cells);
+		index->cells = NULL;
+	}
+	arrfree(index->unbounded);
+}
+
+static void annotation_spatial_index_rebuild(annotation_set_t* annotation_set) {
+	annotation_spatial_index_t* index = &annotation_set->spatial_index;
+	annotation_spatial_index_free_grid(index);
+
+	// Lay out the grid over the combined bounds of all annotations.
+	bounds2f grid_bounds = {FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
+	i32 bounded_count = 0;
+	for (i32 i = 0; i < annotation_set->active_annotation_count; ++i) {
+		annotation_t* annotation = get_active_annotation(annotation_set, i);
+		if (annotation->coordinate_count > 0) {
+			annotation_recalculate_bounds_if_necessary(annotation);
+			grid_bounds.left = MIN(grid_bounds.left, annotation->bounds.left);
+			grid_bounds.top = MIN(grid_bounds.top, annotation->bounds.top);
+			grid_bounds.right = MAX(grid_bounds.right, annotation->bounds.right);
+			grid_bounds.bottom = MAX(grid_bounds.bottom, annotation->bounds.bottom);
+			++bounded_count;
+		}
+	}
+	if (bounded_count == 0) {
+		grid_bounds = BOUNDS2F(0.0f, 0.0f, 1.0f, 1.0f);
+	}
+	float grid_width = ATLEAST(1.0f, grid_bounds.right - grid_bounds.left);
+	float grid_height = ATLEAST(1.0f, grid_bounds.bottom - grid_bounds.top);
+	grid_bounds.right = grid_bounds.left + grid_width;
+	grid_bounds.bottom = grid_bounds.top + grid_height;
+
+	// Aim for a few annotations per cell, with roughly square cells.
+	float target_cell_count = (float)ATLEAST(1, bounded_count / ANNOTATION_SPATIAL_INDEX_ANNOTATIONS_PER_CELL);
+	float aspect_ratio = grid_width / grid_height;
+	i32 width_in_cells = (i32)ceilf(sqrtf(target_cell_count * aspect_ratio));
+	i32 height_in_cells = (i32)ceilf(sqrtf(target_cell_count / aspect_ratio));
+	index->width_in_cells = ATLEAST(1, ATMOST(ANNOTATION_SPATIAL_INDEX_MAX_CELLS_PER_SIDE, width_in_cells));
+	index->height_in_cells = ATLEAST(1, ATMOST(ANNOTATION_SPATIAL_INDEX_MAX_CELLS_PER_SIDE, height_in_cells));
+	index->grid_bounds = grid_bounds;
+	index->cell_width = grid_width / (float)index->width_in_cells;
+	index->cell_height = grid_height / (float)index->height_in_cells;
+	index->cells = (i32**) calloc((size_t)index->width_in_cells * index->height_in_cells, sizeof(i32*));
+	index->outside_grid_count = 0;
+
+	arrsetlen(index->entries, annotation_set->stored_annotation_count);
+	memset(index->entries, 0, annotation_set->stored_annotation_count * sizeof(annotation_spatial_index_entry_t));
+	for (i32 i = 0; i < annotation_set->stored_annotation_count; ++i) {
+		index->entries[i].active_index = -1;
+	}
+	for (i32 i = 0; i < annotation_set->active_annotation_count; ++i) {
+		i32 stored_index = annotation_set->active_annotation_indices[i];
+		index->entries[stored_index].active_index = i;
+		annotation_spatial_index_insert(annotation_set, stored_index);
+	}
+	index->indexed_active_count = annotation_set->active_annotation_count;
+	index->stored_count_at_last_rebuild = annotation_set->stored_annotation_count;
+	arrsetlen(index->dirty, 0);
+	index->need_rebuild = false;
+	index->need_remap = false;
+	index->is_valid = true;
+}
+
+// Bring the index up to date with the annotation set.
+void annotation_spatial_index_update(annotation_set_t* annotation_set) {
+	annotation_spatial_index_t* index = &annotation_set->spatial_index;
+	i32 stored_count = annotation_set->stored_annotation_count;
+	i32 active_count = annotation_set->active_annotation_count;
+
+	bool need_rebuild = !index->is_valid || index->need_rebuild;
+	// The set was reset or replaced from underneath us (e.g. after loading a different file)
+	if (arrlen(index->entries) > stored_count || index->indexed_active_count > active_count) {
+		need_rebuild = true;
+	}
+	// The grid was laid out for a much smaller set, the cells would become overcrowded
+	if (stored_count > ATLEAST(ANNOTATION_SPATIAL_INDEX_MIN_REBUILD_COUNT, 2 * index->stored_count_at_last_rebuild)) {
+		need_rebuild = true;
+	}
+	if (index->outside_grid_count > ATLEAST(ANNOTATION_SPATIAL_INDEX_MIN_REBUILD_COUNT, index->indexed_active_count / 4)) {
+		need_rebuild = true;
+	}
+	if (need_rebuild) {
+		annotation_spatial_index_rebuild(annotation_set);
+		return;
+	}
+
+	// Annotations that were deleted shift the active indices of the ones after them
+	if (index->need_remap) {
+		for (i32 i = 0; i < arrlen(index->entries); ++i) {
+			index->entries[i].active_index = -1;
+		}
+		for (i32 i = 0; i < index->indexed_active_count; ++i) {
+			i32 stored_index = annotation_set->active_annotation_indices[i];
+			index->entries[stored_index].active_index = i;
+		}
+		index->need_remap = false;
+	}
+
+	// Newly created annotations are appended to the end of both the stored and the active list
+	i32 old_entry_count = (i32)arrlen(index->entries);
+	if (stored_count > old_entry_count) {
+		arrsetlen(index->entries, stored_count);
+		memset(index->entries + old_entry_count, 0, (stored_count - old_entry_count) * sizeof(annotation_spatial_index_entry_t));
+		for (i32 i = old_entry_count; i < stored_count; ++i) {
+			index->entries[i].active_index = -1;
+		}
+	}
+	for (i32 i = index->indexed_active_count; i < active_count; ++i) {
+		i32 stored_index = annotation_set->active_annotation_indices[i];
+		annotation_spatial_index_entry_t* entry = index->entries + stored_index;
+		entry->active_index = i;
+		if (!entry->is_indexed) {
+			annotation_spatial_index_insert(annotation_set, stored_index);
+		}
+	}
+	index->indexed_active_count = active_count;
+
+	// Annotations that were edited need to be moved to the cells overlapping their new bounds
+	for (i32 i = 0; i < arrlen(index->dirty); ++i) {
+		i32 stored_index = index->dirty[i];
+		annotation_spatial_index_entry_t* entry = index->entries + stored_index;
+		if (entry->is_indexed) {
+			annotation_spatial_index_unlink(index, stored_index);
+			annotation_spatial_index_insert(annotation_set, stored_index);
+		}
+	}
+	arrsetlen(index->dirty, 0);
+}
+
+void annotation_spatial_index_mark_dirty(annotation_set_t* annotation_set, annotation_t* annotation) {
+	annotation_spatial_index_t* index = &annotation_set->spatial_index;
+	i64 stored_index = annotation - annotation_set->stored_annotations;
+	if (stored_index >= 0 && stored_index < arrlen(index->entries) && index->entries[stored_index].is_indexed) {
+		arrput(index->dirty, (i32)stored_index);
+	}
+}
+
+// Call this before the annotation is removed from the active list.
+void annotation_spatial_index_remove(annotation_set_t* annotation_set, i32 stored_index) {
+	annotation_spatial_index_t* index = &annotation_set->spatial_index;
+	if (!index->is_valid || stored_index < 0 || stored_index >= arrlen(index->entries)) return;
+	annotation_spatial_index_entry_t* entry = index->entries + stored_index;
+	if (entry->is_indexed) {
+		annotation_spatial_index_unlink(index, stored_index);
+		entry->active_index = -1;
+		--index->indexed_active_count;
+		index->need_remap = true;
+	}
+}
+
+static int annotation_spatial_index_compare_i32(const void* a_raw, const void* b_raw) {
+	i32 a = *(i32*)a_raw;
+	i32 b = *(i32*)b_raw;
+	return (a > b) - (a < b);
+}
+
+static void annotation_spatial_index_consider(annotation_set_t* annotation_set, bounds2f area, i32 stored_index) {
+	annotation_spatial_index_t* index = &annotation_set->spatial_index;
+	annotation_spatial_index_entry_t* entry = index->entries + stored_index;
+	if (entry->query_stamp == index->current_query_stamp) return; // already seen in another cell
+	entry->query_stamp = index->current_query_stamp;
+	if (entry->active_index < 0) return;
+	annotation_t* annotation = annotation_set->stored_annotations + stored_index;
+	if (annotation->coordinate_count > 0) {
+		annotation_recalculate_bounds_if_necessary(annotation);
+		bounds2f bounds = annotation->bounds;
+		if (bounds.right < area.left || bounds.left > area.right || bounds.bottom < area.top || bounds.top > area.bottom) {
+			return;
+		}
+	}
+	arrput(index->query_result, entry->active_index);
+}
+
+// Returns the active indices (in ascending order) of the annotations whose bounds overlap the area. Annotations without
+// coordinates are always returned. The result is only valid until the next query or modification of the set.
+i32* annotation_spatial_index_query(annotation_set_t* annotation_set, bounds2f area, i32* count) {
+	annotation_spatial_index_update(annotation_set);
+	annotation_spatial_index_t* index = &annotation_set->spatial_index;
+	arrsetlen(index->query_result, 0);
+
+	++index->current_query_stamp;
+	if (index->current_query_stamp == 0) {
+		// Wrapped around: stale stamps could now match by accident
+		for (i32 i = 0; i < arrlen(index->entries); ++i) {
+			index->entries[i].query_stamp = 0;
+		}
+		index->current_query_stamp = 1;
+	}
+
+	bounds2i range = annotation_spatial_index_cell_range(index, area);
+	for (i32 y = range.top; y <= range.bottom; ++y) {
+		for (i32 x = range.left; x <= range.right; ++x) {
+			i32* cell = index->cells[y * index->width_in_cells + x];
+			for (i32 i = 0; i < arrlen(cell); ++i) {
+				annotation_spatial_index_consider(annotation_set, area, cell[i]);
+			}
+		}
+	}
+	for (i32 i = 0; i < arrlen(index->unbounded); ++i) {
+		annotation_spatial_index_consider(annotation_set, area, index->unbounded[i]);
+	}
+
+	// Keep the drawing order the same as the order of the active list
+	i32 result_count = (i32)arrlen(index->query_result);
+	qsort(index->query_result, result_count, sizeof(i32), annotation_spatial_index_compare_i32);
+	*count = result_count;
+	return index->query_result;
+}
+
+void annotation_spatial_index_destroy(annotation_spatial_index_t* index) {
+	annotation_spatial_index_free_grid(index);
+	arrfree(index->entries);
+	arrfree(index->dirty);
+	arrfree(index->query_result);
+	memset(index, 0, sizeof(*index));
+}
@@ -0,0 +1,835 @@
+/*
+  Slidescape, a whole-slide image viewer for digital pathology.
+  Copyright (C) 2019-2022  Pieter Valkema
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Binary annotation store: a compact file next to the XML file, that autosave can update without rewriting everything.
+// The file is an append-only journal of records. Each record holds the latest version of one thing (an annotation,
+// the groups, the features, or the order of the active annotations); a record replaces any earlier record of the
+// same kind (and, for annotations, with the same key). A COMMIT record ends each batch of changes. Records after the
+// last COMMIT, or records with a bad checksum (e.g. after a crash halfway through a write), are ignored.
+//
+// On the main thread, we keep track of what the store currently contains ('shadows'), so that we only need to
+// serialize what has changed since. Writing the file happens in the background. Every so often, the file gets
+// compacted, so that only the latest version of each record remains.
+//
+// The XML file stays the 'real' annotation file: it is written when the annotations are explicitly saved or closed.
+// On loading, the store is only used if it is in sync with the XML file (or if the XML file does not exist).
+
+#define ANNOTATION_STORE_MAGIC "SLDANNO\0"
+#define ANNOTATION_STORE_VERSION 1
+#define ANNOTATION_STORE_HASH_SEED 0x736c6465616e6e6fULL
+// Compact the file once it becomes much larger than the latest version of its contents.
+#define ANNOTATION_STORE_COMPACTION_FACTOR 2
+#define ANNOTATION_STORE_COMPACTION_MIN_SIZE MEGABYTES(1)
+
+typedef struct annotation_store_header_t {
+	char magic[8];
+	u32 version;
+	u32 header_size;
+	u64 reserved[2];
+} annotation_store_header_t;
+
+typedef enum annotation_store_record_type_enum {
+	ANNOTATION_STORE_RECORD_GROUPS = 1,
+	ANNOTATION_STORE_RECORD_FEATURES = 2,
+	ANNOTATION_STORE_RECORD_ANNOTATION = 3,
+	ANNOTATION_STORE_RECORD_ACTIVE_ANNOTATIONS = 4,
+	ANNOTATION_STORE_RECORD_COMMIT = 5,
+} annotation_store_record_type_enum;
+
+// Every record starts with this header; the payload is padded to a multiple of 8 bytes.
+typedef struct annotation_store_record_header_t {
+	u32 type;
+	u32 key; // for annotation records: identifies the annotation (stays the same across edits)
+	u32 payload_size;
+	u32 checksum;
+} annotation_store_record_header_t;
+
+// GROUPS and FEATURES payload: table header, stored entries, then the active indices.
+typedef struct annotation_store_table_t {
+	i32 stored_count;
+	i32 active_count;
+} annotation_store_table_t;
+
+enum annotation_store_entry_flags_enum {
+	ANNOTATION_STORE_EXPLICITLY_DEFINED = 1,
+	ANNOTATION_STORE_DELETED = 2,
+	ANNOTATION_STORE_RESTRICT_TO_GROUP = 4,
+};
+
+typedef struct annotation_store_group_t {
+	char name[256];
+	rgba_t color;
+	i32 id;
+	u32 flags;
+	u32 reserved;
+} annotation_store_group_t;
+
+typedef struct annotation_store_feature_t {
+	char name[256];
+	rgba_t color;
+	i32 id;
+	i32 group_id;
+	u32 flags;
+} annotation_store_feature_t;
+
+enum annotation_store_annotation_flags_enum {
+	ANNOTATION_STORE_IS_OPEN = 1,
+};
+
+// ANNOTATION payload: this header, the coordinates (in pixels, as v2f), the nonzero features, then the name.
+typedef struct annotation_store_annotation_t {
+	u32 type;
+	rgba_t color;
+	i32 group_id;
+	u32 flags;
+	i32 coordinate_count;
+	u32 name_length;
+	u32 feature_count;
+	u32 reserved;
+} annotation_store_annotation_t;
+
+typedef struct annotation_store_feature_value_t {
+	u32 index;
+	float value;
+} annotation_store_feature_value_t;
+
+// ACTIVE_ANNOTATIONS payload: this header, then the keys of the active annotations (in order).
+typedef struct annotation_store_active_t {
+	i32 count;
+	u32 reserved;
+} annotation_store_active_t;
+
+enum annotation_store_commit_flags_enum {
+	ANNOTATION_STORE_COMMIT_IS_EXPORTED = 1, // the XML file contains the same annotations as the store
+};
+
+typedef struct annotation_store_commit_t {
+	u64 sequence;
+	i64 source_file_size; // size and modification time of the XML file, as they were when it was last written
+	i64 source_file_mtime;
+	u32 flags;
+	u32 reserved;
+} annotation_store_commit_t;
+
+// Where to find the latest committed version of everything in the file.
+typedef struct annotation_store_index_t {
+	i64* annotation_offsets; // array, indexed by key (0 if there is no record)
+	i64 groups_offset;
+	i64 features_offset;
+	i64 active_offset;
+	i64 commit_offset;
+	i64 valid_size; // everything after the last commit is ignored
+	annotation_store_commit_t last_commit;
+	i32 commit_count;
+} annotation_store_index_t;
+
+typedef struct annotation_store_pending_record_t {
+	u32 key;
+	i64 offset;
+} annotation_store_pending_record_t;
+
+// A batch of records, to be written to the file in the background.
+typedef struct annotation_store_batch_t {
+	annotation_store_t* store;
+	memrw_t data;
+	bool is_full_rewrite;
+} annotation_store_batch_t;
+
+// Only used to detect changes and damaged records, not for security.
+static u64 annotation_store_hash(const void* data, size_t size, u64 hash) {
+	const u8* pos = (const u8*) data;
+	while (size >= 8) {
+		u64 word;
+		memcpy(&word, pos, 8);
+		hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+		hash ^= hash >> 29;
+		pos += 8;
+		size -= 8;
+	}
+	if (size > 0) {
+		u64 word = 0;
+		memcpy(&word, pos, size);
+		hash = (hash ^ word ^ ((u64)size << 56)) * 0x9e3779b97f4a7c15ULL;
+		hash ^= hash >> 29;
+	}
+	return hash;
+}
+
+static u32 annotation_store_checksum(u32 type, u32 key, const void* payload, size_t payload_size) {
+	u64 hash = annotation_store_hash(payload, payload_size, ANNOTATION_STORE_HASH_SEED ^ (((u64)type << 32) | key));
+	return (u32)(hash ^ (hash >> 32));
+}
+
+// Everything that gets written to the store for an annotation, except the coordinates (those are tracked separately).
+static u64 annotation_store_hash_annotation_properties(annotation_t* annotation) {
+	u64 hash = annotation_store_hash(annotation->name, strnlen(annotation->name, sizeof(annotation->name)), ANNOTATION_STORE_HASH_SEED);
+	u32 properties[4] = {(u32)annotation->type, 0, (u32)annotation->group_id, (u32)annotation->is_open};
+	memcpy(&properties[1], &annotation->color, sizeof(rgba_t));
+	hash = annotation_store_hash(properties, sizeof(properties), hash);
+	hash = annotation_store_hash(annotation->features, sizeof(annotation->features), hash);
+	return hash;
+}
+
+static void annotation_store_get_filename(const char* xml_filename, char* buf, i32 buf_size) {
+	snprintf(buf, buf_size, "%s", xml_filename);
+	replace_file_extension(buf, buf_size, "annotations");
+}
+
+static i64 annotation_store_begin_record(memrw_t* out, u32 type, u32 key) {
+	i64 record_start = out->used_size;
+	annotation_store_record_header_t header = {type, key};
+	memrw_write(&header, out, sizeof(header));
+	return record_start;
+}
+
+static void annotation_store_end_record(memrw_t* out, i64 record_start) {
+	static const u8 padding[8] = {};
+	i64 payload_start = record_start + sizeof(annotation_store_record_header_t);
+	i64 unpadded_size = out->used_size - payload_start;
+	memrw_write(padding, out, (8 - (unpadded_size % 8)) % 8);
+	annotation_store_record_header_t* header = (annotation_store_record_header_t*)(out->data + record_start);
+	header->payload_size = (u32)(out->used_size - payload_start);
+	header->checksum = annotation_store_checksum(header->type, header->key, out->data + payload_start, header->payload_size);
+}
+
+static void annotation_store_discard_record(memrw_t* out, i64 record_start) {
+	out->used_size = record_start;
+	out->cursor = record_start;
+}
+
+static void annotation_store_write_header(memrw_t* out) {
+	annotation_store_header_t header = {};
+	memcpy(header.magic, ANNOTATION_STORE_MAGIC, sizeof(header.magic));
+	header.version = ANNOTATION_STORE_VERSION;
+	header.header_size = sizeof(header);
+	memrw_write(&header, out, sizeof(header));
+}
+
+static void annotation_store_write_groups(memrw_t* out, annotation_set_t* annotation_set) {
+	annotation_store_table_t table = {annotation_set->stored_group_count, annotation_set->active_group_count};
+	memrw_write(&table, out, sizeof(table));
+	for (i32 i = 0; i < annotation_set->stored_group_count; ++i) {
+		annotation_group_t* group = annotation_set->stored_groups + i;
+		annotation_store_group_t entry = {};
+		snprintf(entry.name, sizeof(entry.name), "%s", group->name);
+		entry.color = group->color;
+		entry.id = group->id;
+		entry.flags = (group->is_explicitly_defined ? ANNOTATION_STORE_EXPLICITLY_DEFINED : 0) |
+		              (group->deleted ? ANNOTATION_STORE_DELETED : 0);
+		memrw_write(&entry, out, sizeof(entry));
+	}
+	memrw_write(annotation_set->active_group_indices, out, annotation_set->active_group_count * sizeof(i32));
+}
+
+static void annotation_store_write_features(memrw_t* out, annotation_set_t* annotation_set) {
+	annotation_store_table_t table = {annotation_set->stored_feature_count, annotation_set->active_feature_count};
+	memrw_write(&table, out, sizeof(table));
+	for (i32 i = 0; i < annotation_set->stored_feature_count; ++i) {
+		annotation_feature_t* feature = annotation_set->stored_features + i;
+		annotation_store_feature_t entry = {};
+		snprintf(entry.name, sizeof(entry.name), "%s", feature->name);
+		entry.color = feature->color;
+		entry.id = feature->id;
+		entry.group_id = feature->group_id;
+		entry.flags = (feature->is_explicitly_defined ? ANNOTATION_STORE_EXPLICITLY_DEFINED : 0) |
+		              (feature->deleted ? ANNOTATION_STORE_DELETED : 0) |
+		              (feature->restrict_to_group ? ANNOTATION_STORE_RESTRICT_TO_GROUP : 0);
+		memrw_write(&entry, out, sizeof(entry));
+	}
+	memrw_write(annotation_set->active_feature_indices, out, annotation_set->active_feature_count * sizeof(i32));
+}
+
+static void annotation_store_write_annotation(memrw_t* out, annotation_set_t* annotation_set, annotation_t* annotation) {
+	annotation_store_annotation_t header = {};
+	header.type = annotation->type;
+	header.color = annotation->color;
+	header.group_id = annotation->group_id;
+	header.flags = annotation->is_open ? ANNOTATION_STORE_IS_OPEN : 0;
+	header.coordinate_count = annotation->coordinate_count;
+	header.name_length = (u32)strnlen(annotation->name, sizeof(annotation->name));
+	for (i32 i = 0; i < MAX_ANNOTATION_FEATURES; ++i) {
+		if (annotation->features[i] != 0.0f) ++header.feature_count;
+	}
+	memrw_write(&header, out, sizeof(header));
+
+	// Coordinates are stored in pixels (same as in the XML file), so the store does not depend on the scale.
+	u64 coordinates_offset = memrw_push_back(out, NULL, annotation->coordinate_count * sizeof(v2f));
+	v2f* coordinates = (v2f*)(out->data + coordinates_offset);
+	for (i32 i = 0; i < annotation->coordinate_count; ++i) {
+		coordinates[i].x = annotation->coordinates[i].x / annotation_set->mpp.x;
+		coordinates[i].y = annotation->coordinates[i].y / annotation_set->mpp.y;
+	}
+	for (i32 i = 0; i < MAX_ANNOTATION_FEATURES; ++i) {
+		if (annotation->features[i] != 0.0f) {
+			annotation_store_feature_value_t feature_value = {(u32)i, annotation->features[i]};
+			memrw_write(&feature_value, out, sizeof(feature_value));
+		}
+	}
+	memrw_write(annotation->name, out, header.name_length);
+}
+
+// Groups and features are small, we can just serialize them and see if anything changed since the last time.
+static bool annotation_store_write_table_if_changed(memrw_t* out, annotation_set_t* annotation_set, u32 type, u64* last_hash, bool force) {
+	i64 record_start = annotation_store_begin_record(out, type, 0);
+	if (type == ANNOTATION_STORE_RECORD_GROUPS) {
+		annotation_store_write_groups(out, annotation_set);
+	} else {
+		annotation_store_write_features(out, annotation_set);
+	}
+	annotation_store_end_record(out, record_start);
+	u64 hash = annotation_store_hash(out->data + record_start, out->used_size - record_start, ANNOTATION_STORE_HASH_SEED);
+	if (force || hash != *last_hash) {
+		*last_hash = hash;
+		return true;
+	} else {
+		annotation_store_discard_record(out, record_start);
+		return false;
+	}
+}
+
+static u64 annotation_store_hash_active_keys(annotation_set_t* annotation_set, annotation_store_t* store) {
+	u64 hash = annotation_store_hash(&annotation_set->active_annotation_count, sizeof(i32), ANNOTATION_STORE_HASH_SEED);
+	for (i32 i = 0; i < annotation_set->active_annotation_count; ++i) {
+		hash = annotation_store_hash(&store->keys[annotation_set->active_annotation_indices[i]], sizeof(u32), hash);
+	}
+	return hash;
+}
+
+// Find the latest committed version of everything (used for loading, and for compaction).
+static bool annotation_store_scan(u8* data, i64 size, annotation_store_index_t* index) {
+	memset(index, 0, sizeof(*index));
+	if (size < (i64)sizeof(annotation_store_header_t)) return false;
+	annotation_store_header_t* header = (annotation_store_header_t*) data;
+	if (memcmp(header->magic, ANNOTATION_STORE_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->version != ANNOTATION_STORE_VERSION || header->header_size < sizeof(annotation_store_header_t) ||
+	    header->header_size > size) {
+		return false;
+	}
+
+	annotation_store_pending_record_t* pending_annotations = NULL;
+	i64 pending_groups_offset = 0;
+	i64 pending_features_offset = 0;
+	i64 pending_active_offset = 0;
+	i64 pos = header->header_size;
+	index->valid_size = pos;
+	while (pos + (i64)sizeof(annotation_store_record_header_t) <= size) {
+		annotation_store_record_header_t* record = (annotation_store_record_header_t*)(data + pos);
+		i64 payload_size = record->payload_size;
+		u8* payload = data + pos + sizeof(annotation_store_record_header_t);
+		if (payload_size % 8 != 0 || payload_size > size - pos - (i64)sizeof(annotation_store_record_header_t) ||
+		    annotation_store_checksum(record->type, record->key, payload, payload_size) != record->checksum) {
+			break; // damaged or incomplete, probably the write was interrupted
+		}
+		switch(record->type) {
+			case ANNOTATION_STORE_RECORD_GROUPS: pending_groups_offset = pos; break;
+			case ANNOTATION_STORE_RECORD_FEATURES: pending_features_offset = pos; break;
+			case ANNOTATION_STORE_RECORD_ACTIVE_ANNOTATIONS: pending_active_offset = pos; break;
+			case ANNOTATION_STORE_RECORD_ANNOTATION: {
+				annotation_store_pending_record_t pending = {record->key, pos};
+				arrput(pending_annotations, pending);
+			} break;
+			case ANNOTATION_STORE_RECORD_COMMIT: {
+				if (payload_size < (i64)sizeof(annotation_store_commit_t)) break;
+				for (i32 i = 0; i < arrlen(pending_annotations); ++i) {
+					u32 key = pending_annotations[i].key;
+					while (arrlen(index->annotation_offsets) <= (i64)key) {
+						arrput(index->annotation_offsets, 0);
+					}
+					index->annotation_offsets[key] = pending_annotations[i].offset;
+				}
+				arrsetlen(pending_annotations, 0);
+				if (pending_groups_offset) index->groups_offset = pending_groups_offset;
+				if (pending_features_offset) index->features_offset = pending_features_offset;
+				if (pending_active_offset) index->active_offset = pending_active_offset;
+				pending_groups_offset = pending_features_offset = pending_active_offset = 0;
+				memcpy(&index->last_commit, payload, sizeof(annotation_store_commit_t));
+				index->commit_offset = pos;
+				index->valid_size = pos + sizeof(annotation_store_record_header_t) + payload_size;
+				++index->commit_count;
+			} break;
+			default: break; // unknown record type, skip
+		}
+		pos += sizeof(annotation_store_record_header_t) + payload_size;
+	}
+	arrfree(pending_annotations);
+	return true;
+}
+
+static void annotation_store_index_destroy(annotation_store_index_t* index) {
+	arrfree(index->annotation_offsets);
+}
+
+static u8* annotation_store_get_payload(u8* data, i64 record_offset, u32* payload_size) {
+	annotation_store_record_header_t* record = (annotation_store_record_header_t*)(data + record_offset);
+	*payload_size = record->payload_size;
+	return data + record_offset + sizeof(annotation_store_record_header_t);
+}
+
+static void annotation_store_copy_record(memrw_t* out, u8* data, i64 record_offset) {
+	annotation_store_record_header_t* record = (annotation_store_record_header_t*)(data + record_offset);
+	memrw_write(record, out, sizeof(annotation_store_record_header_t) + record->payload_size);
+}
+
+// Write to a temporary file first, so that the old file stays intact if something goes wrong.
+static bool annotation_store_replace_file(const char* filename, const void* data, size_t size) {
+	char temp_filename[4096];
+	snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", filename);
+	FILE* fp = fopen(temp_filename, "wb");
+	if (!fp) return false;
+	bool success = (fwrite(data, size, 1, fp) == 1);
+	success = (fclose(fp) == 0) && success;
+	if (success) {
+#if WINDOWS
+		remove(filename); // rename() does not replace existing files on Windows
+#endif
+		success = (rename(temp_filename, filename) == 0);
+	}
+	if (!success) {
+		remove(temp_filename);
+	}
+	return success;
+}
+
+// Rewrite the file, keeping only the latest committed version of everything (NOTE: called from the write job).
+static void annotation_store_compact(annotation_store_t* store) {
+	mem_t* file = platform_read_entire_file(store->filename);
+	if (!file) return;
+	annotation_store_index_t index = {};
+	if (annotation_store_scan(file->data, file->len, &index) && index.commit_count > 0) {
+		memrw_t out = memrw_create(MAX(store->compacted_size, KILOBYTES(64)));
+		annotation_store_write_header(&out);
+		if (index.groups_offset) annotation_store_copy_record(&out, file->data, index.groups_offset);
+		if (index.features_offset) annotation_store_copy_record(&out, file->data, index.features_offset);
+		if (index.active_offset) {
+			u32 payload_size = 0;
+			u8* payload = annotation_store_get_payload(file->data, index.active_offset, &payload_size);
+			annotation_store_active_t* active = (annotation_store_active_t*) payload;
+			u32* keys = (u32*)(active + 1);
+			i32 key_count = MIN(active->count, (i32)((payload_size - sizeof(*active)) / sizeof(u32)));
+			for (i32 i = 0; i < key_count; ++i) {
+				if (keys[i] < arrlen(index.annotation_offsets) && index.annotation_offsets[keys[i]]) {
+					annotation_store_copy_record(&out, file->data, index.annotation_offsets[keys[i]]);
+				}
+			}
+			annotation_store_copy_record(&out, file->data, index.active_offset);
+		}
+		annotation_store_copy_record(&out, file->data, index.commit_offset);
+		if (annotation_store_replace_file(store->filename, out.data, out.used_size)) {
+			console_print_verbose("Compacted annotation store '%s' (%lld -> %lld bytes)\n", store->filename, (i64)file->len, (i64)out.used_size);
+			store->file_size = out.used_size;
+			store->compacted_size = out.used_size;
+		}
+		memrw_destroy(&out);
+	}
+	annotation_store_index_destroy(&index);
+	free(file);
+}
+
+static void annotation_store_write_job_func(i32 logical_thread_index, void* userdata) {
+	annotation_store_batch_t* batch = *(annotation_store_batch_t**) userdata;
+	annotation_store_t* store = batch->store;
+	bool success = false;
+	if (batch->is_full_rewrite) {
+		success = annotation_store_replace_file(store->filename, batch->data.data, batch->data.used_size);
+		if (success) {
+			store->file_size = batch->data.used_size;
+			store->compacted_size = batch->data.used_size;
+		}
+	} else {
+		// Appending only works if the file still is what we think it is (it might have been deleted or replaced).
+		struct stat st = {};
+		if (platform_stat(store->filename, &st) == 0 && st.st_size == store->file_size) {
+			FILE* fp = fopen(store->filename, "ab");
+			if (fp) {
+				success = (fwrite(batch->data.data, batch->data.used_size, 1, fp) == 1);
+				success = (fclose(fp) == 0) && success;
+				if (success) {
+					store->file_size += batch->data.used_size;
+				}
+			}
+		} else {
+			// Nothing is lost yet, the changes will be included when the whole file gets written next time.
+			store->need_full_rewrite = true;
+			success = true;
+		}
+	}
+	if (!success) {
+		console_print_error("Error: could not write to annotation store '%s'\n", store->filename);
+		store->has_failed = true;
+	} else if (store->file_size > ANNOTATION_STORE_COMPACTION_FACTOR * store->compacted_size + ANNOTATION_STORE_COMPACTION_MIN_SIZE) {
+		annotation_store_compact(store);
+	}
+	memrw_destroy(&batch->data);
+	free(batch);
+	write_barrier;
+	store->is_busy = false;
+}
+
+static annotation_store_t* annotation_store_create(annotation_set_t* annotation_set) {
+	ASSERT(annotation_set->store == NULL);
+	annotation_store_t* store = (annotation_store_t*) calloc(1, sizeof(annotation_store_t));
+	annotation_store_get_filename(annotation_set->asap_xml_filename, store->filename, sizeof(store->filename));
+	store->need_full_rewrite = true;
+	annotation_set->store = store;
+	return store;
+}
+
+// Serialize everything that changed since the last time, and write it to the store in the background.
+// If is_in_sync_with_xml is set, the store remembers the current state of the XML file (meaning: it was just written).
+// Returns false if the changes could not be handed over (yet), e.g. if the previous write has not finished.
+bool annotation_store_write_changes(annotation_set_t* annotation_set, bool is_in_sync_with_xml) {
+	if (annotation_set->asap_xml_filename[0] == '\0') return false;
+	annotation_store_t* store = annotation_set->store;
+	if (!store) {
+		store = annotation_store_create(annotation_set);
+	}
+	if (store->is_busy) return false;
+	read_barrier;
+	if (store->has_failed) return false;
+
+	if (is_in_sync_with_xml) {
+		struct stat st = {};
+		if (platform_stat(annotation_set->asap_xml_filename, &st) == 0) {
+			store->source_file_size = st.st_size;
+			store->source_file_mtime = st.st_mtime;
+		} else {
+			store->source_file_size = 0;
+			store->source_file_mtime = 0;
+		}
+	}
+
+	bool write_everything = store->need_full_rewrite;
+	bool has_changes = write_everything || is_in_sync_with_xml;
+	memrw_t out = memrw_create(KILOBYTES(64));
+	if (write_everything) {
+		annotation_store_write_header(&out);
+	}
+
+	if (annotation_store_write_table_if_changed(&out, annotation_set, ANNOTATION_STORE_RECORD_GROUPS, &store->groups_hash, write_everything)) {
+		has_changes = true;
+	}
+	if (annotation_store_write_table_if_changed(&out, annotation_set, ANNOTATION_STORE_RECORD_FEATURES, &store->features_hash, write_everything)) {
+		has_changes = true;
+	}
+
+	// Annotations created since the last time get a new key.
+	while (arrlen(store->shadows) < annotation_set->stored_annotation_count) {
+		annotation_store_shadow_t shadow = {};
+		arrput(store->shadows, shadow);
+		arrput(store->keys, store->next_key++);
+	}
+
+	for (i32 i = 0; i < annotation_set->active_annotation_count; ++i) {
+		i32 stored_index = annotation_set->active_annotation_indices[i];
+		annotation_t* annotation = annotation_set->stored_annotations + stored_index;
+		annotation_store_shadow_t* shadow = store->shadows + stored_index;
+		u64 properties_hash = annotation_store_hash_annotation_properties(annotation);
+		if (write_everything || !shadow->is_written || shadow->properties_hash != properties_hash ||
+		    shadow->coordinates != annotation->coordinates || shadow->coordinate_count != annotation->coordinate_count ||
+		    shadow->coordinates_generation != annotation->coordinates_generation) {
+			i64 record_start = annotation_store_begin_record(&out, ANNOTATION_STORE_RECORD_ANNOTATION, store->keys[stored_index]);
+			annotation_store_write_annotation(&out, annotation_set, annotation);
+			annotation_store_end_record(&out, record_start);
+			shadow->properties_hash = properties_hash;
+			shadow->coordinates = annotation->coordinates;
+			shadow->coordinate_count = annotation->coordinate_count;
+			shadow->coordinates_generation = annotation->coordinates_generation;
+			shadow->is_written = true;
+			has_changes = true;
+		}
+	}
+
+	u64 active_hash = annotation_store_hash_active_keys(annotation_set, store);
+	if (write_everything || active_hash != store->active_hash) {
+		store->active_hash = active_hash;
+		i64 record_start = annotation_store_begin_record(&out, ANNOTATION_STORE_RECORD_ACTIVE_ANNOTATIONS, 0);
+		annotation_store_active_t active = {annotation_set->active_annotation_count};
+		memrw_write(&active, &out, sizeof(active));
+		for (i32 i = 0; i < annotation_set->active_annotation_count; ++i) {
+			memrw_write(&store->keys[annotation_set->active_annotation_indices[i]], &out, sizeof(u32));
+		}
+		annotation_store_end_record(&out, record_start);
+		has_changes = true;
+	}
+
+	if (!has_changes) {
+		memrw_destroy(&out);
+		return true;
+	}
+
+	annotation_store_commit_t commit = {};
+	commit.sequence = ++store->sequence;
+	commit.source_file_size = store->source_file_size;
+	commit.source_file_mtime = store->source_file_mtime;
+	commit.flags = is_in_sync_with_xml ? ANNOTATION_STORE_COMMIT_IS_EXPORTED : 0;
+	i64 record_start = annotation_store_begin_record(&out, ANNOTATION_STORE_RECORD_COMMIT, 0);
+	memrw_write(&commit, &out, sizeof(commit));
+	annotation_store_end_record(&out, record_start);
+
+	annotation_store_batch_t* batch = (annotation_store_batch_t*) calloc(1, sizeof(annotation_store_batch_t));
+	batch->store = store;
+	batch->data = out;
+	batch->is_full_rewrite = write_everything;
+	store->need_full_rewrite = false;
+	store->is_busy = true;
+	if (!add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, annotation_store_write_job_func, &batch, sizeof(batch))) {
+		annotation_store_write_job_func(0, &batch);
+	}
+	return true;
+}
+
+// Block until the last batch of changes has been written.
+void annotation_store_wait(annotation_set_t* annotation_set) {
+	annotation_store_t* store = annotation_set->store;
+	if (!store) return;
+	while (store->is_busy) {
+		do_worker_work(&global_work_queue, 0);
+	}
+	read_barrier;
+}
+
+void annotation_store_close(annotation_set_t* annotation_set) {
+	annotation_store_t* store = annotation_set->store;
+	if (!store) return;
+	annotation_store_wait(annotation_set);
+	arrfree(store->shadows);
+	arrfree(store->keys);
+	free(store);
+	annotation_set->store = NULL;
+}
+
+static bool annotation_store_read_annotation(annotation_set_t* annotation_set, u8* payload, u32 payload_size, annotation_t* annotation) {
+	if (payload_size < sizeof(annotation_store_annotation_t)) return false;
+	annotation_store_annotation_t header;
+	memcpy(&header, payload, sizeof(header));
+	u64 required_size = sizeof(header) + (u64)header.coordinate_count * sizeof(v2f) +
+	                    (u64)header.feature_count * sizeof(annotation_store_feature_value_t) + header.name_length;
+	if (header.coordinate_count < 0 || required_size > payload_size || header.name_length >= sizeof(annotation->name)) {
+		return false;
+	}
+	u8* pos = payload + sizeof(header);
+
+	memset(annotation, 0, sizeof(*annotation));
+	annotation->type = (annotation_type_enum) header.type;
+	annotation->color = header.color;
+	annotation->group_id = header.group_id;
+	annotation->is_open = (header.flags & ANNOTATION_STORE_IS_OPEN) != 0;
+	if (header.coordinate_count > 0) {
+		arrsetlen(annotation->coordinates, header.coordinate_count);
+		memcpy(annotation->coordinates, pos, header.coordinate_count * sizeof(v2f));
+		for (i32 i = 0; i < header.coordinate_count; ++i) {
+			annotation->coordinates[i].x *= annotation_set->mpp.x;
+			annotation->coordinates[i].y *= annotation_set->mpp.y;
+		}
+		annotation->coordinate_count = header.coordinate_count;
+		pos += header.coordinate_count * sizeof(v2f);
+	}
+	for (u32 i = 0; i < header.feature_count; ++i) {
+		annotation_store_feature_value_t feature_value;
+		memcpy(&feature_value, pos, sizeof(feature_value));
+		if (feature_value.index < MAX_ANNOTATION_FEATURES) {
+			annotation->features[feature_value.index] = feature_value.value;
+		}
+		pos += sizeof(feature_value);
+	}
+	memcpy(annotation->name, pos, header.name_length);
+	annotation->name[header.name_length] = '\0';
+	return true;
+}
+
+static void annotation_store_read_groups(annotation_set_t* annotation_set, u8* payload, u32 payload_size) {
+	if (payload_size < sizeof(annotation_store_table_t)) return;
+	annotation_store_table_t* table = (annotation_store_table_t*) payload;
+	if (table->stored_count <= 0 || table->active_count < 0 ||
+	    sizeof(*table) + (u64)table->stored_count * sizeof(annotation_store_group_t) + (u64)table->active_count * sizeof(i32) > payload_size) {
+		return;
+	}
+	annotation_store_group_t* entries = (annotation_store_group_t*)(table + 1);
+	i32* active_indices = (i32*)(entries + table->stored_count);
+	arrsetlen(annotation_set->stored_groups, table->stored_count);
+	for (i32 i = 0; i < table->stored_count; ++i) {
+		annotation_group_t* group = annotation_set->stored_groups + i;
+		memset(group, 0, sizeof(*group));
+		memcpy(group->name, entries[i].name, sizeof(group->name));
+		group->name[sizeof(group->name)-1] = '\0';
+		group->color = entries[i].color;
+		group->id = entries[i].id;
+		group->is_explicitly_defined = (entries[i].flags & ANNOTATION_STORE_EXPLICITLY_DEFINED) != 0;
+		group->deleted = (entries[i].flags & ANNOTATION_STORE_DELETED) != 0;
+	}
+	annotation_set->stored_group_count = table->stored_count;
+	arrsetlen(annotation_set->active_group_indices, 0);
+	for (i32 i = 0; i < table->active_count; ++i) {
+		if (active_indices[i] >= 0 && active_indices[i] < table->stored_count) {
+			arrput(annotation_set->active_group_indices, active_indices[i]);
+		}
+	}
+	annotation_set->active_group_count = arrlen(annotation_set->active_group_indices);
+}
+
+static void annotation_store_read_features(annotation_set_t* annotation_set, u8* payload, u32 payload_size) {
+	if (payload_size < sizeof(annotation_store_table_t)) return;
+	annotation_store_table_t* table = (annotation_store_table_t*) payload;
+	if (table->stored_count < 0 || table->active_count < 0 ||
+	    sizeof(*table) + (u64)table->stored_count * sizeof(annotation_store_feature_t) + (u64)table->active_count * sizeof(i32) > payload_size) {
+		return;
+	}
+	annotation_store_feature_t* entries = (annotation_store_feature_t*)(table + 1);
+	i32* active_indices = (i32*)(entries + table->stored_count);
+	arrsetlen(annotation_set->stored_features, table->stored_count);
+	for (i32 i = 0; i < table->stored_count; ++i) {
+		annotation_feature_t* feature = annotation_set->stored_features + i;
+		memset(feature, 0, sizeof(*feature));
+		memcpy(feature->name, entries[i].name, sizeof(feature->name));
+		feature->name[sizeof(feature->name)-1] = '\0';
+		feature->color = entries[i].color;
+		feature->id = entries[i].id;
+		feature->group_id = entries[i].group_id;
+		feature->is_explicitly_defined = (entries[i].flags & ANNOTATION_STORE_EXPLICITLY_DEFINED) != 0;
+		feature->deleted = (entries[i].flags & ANNOTATION_STORE_DELETED) != 0;
+		feature->restrict_to_group = (entries[i].flags & ANNOTATION_STORE_RESTRICT_TO_GROUP) != 0;
+	}
+	annotation_set->stored_feature_count = table->stored_count;
+	arrsetlen(annotation_set->active_feature_indices, 0);
+	for (i32 i = 0; i < table->active_count; ++i) {
+		if (active_indices[i] >= 0 && active_indices[i] < table->stored_count) {
+			arrput(annotation_set->active_feature_indices, active_indices[i]);
+		}
+	}
+	annotation_set->active_feature_count = arrlen(annotation_set->active_feature_indices);
+}
+
+// Load the annotations from the store that belongs to the XML file (the annotation set should still be empty).
+// Returns false if there is no usable store, or if the XML file was changed since the store was last in sync with it.
+bool annotation_store_load(annotation_set_t* annotation_set, const char* xml_filename) {
+	if (annotation_set->stored_annotation_count > 0 || annotation_set->loader || annotation_set->store) return false;
+	i64 start = get_clock();
+	char store_filename[512];
+	annotation_store_get_filename(xml_filename, store_filename, sizeof(store_filename));
+	if (!file_exists(store_filename)) return false;
+
+	file_handle_t file_handle = open_file_handle_for_simultaneous_access(store_filename);
+	if (!file_handle) return false;
+	file_mapping_t mapping = {};
+	mem_t* file = NULL;
+	u8* data = NULL;
+	i64 size = 0;
+	if (file_mapping_open(&mapping, file_handle, FILE_MAPPING_ADVICE_SEQUENTIAL)) {
+		data = mapping.data;
+		size = mapping.size;
+	} else {
+		file = platform_read_entire_file(store_filename);
+		if (file) {
+			data = file->data;
+			size = file->len;
+		}
+	}
+
+	bool success = false;
+	annotation_store_index_t index = {};
+	if (data && annotation_store_scan(data, size, &index) && index.commit_count > 0) {
+		struct stat st = {};
+		bool xml_exists = (platform_stat(xml_filename, &st) == 0);
+		if (xml_exists && (st.st_size != index.last_commit.source_file_size || st.st_mtime != index.last_commit.source_file_mtime)) {
+			console_print("Annotation store '%s' is outdated, loading the XML file instead\n", store_filename);
+		} else {
+			snprintf(annotation_set->asap_xml_filename, sizeof(annotation_set->asap_xml_filename), "%s", xml_filename);
+			annotation_set->export_as_asap_xml = true;
+			annotation_set->annotations_were_loaded_from_file = xml_exists;
+			// The XML file might not have the latest changes yet (e.g. if the program was closed unexpectedly).
+			annotation_set->has_unexported_changes = !xml_exists || !(index.last_commit.flags & ANNOTATION_STORE_COMMIT_IS_EXPORTED);
+
+			annotation_store_t* store = annotation_store_create(annotation_set);
+			u32 payload_size = 0;
+			if (index.groups_offset) {
+				u8* payload = annotation_store_get_payload(data, index.groups_offset, &payload_size);
+				annotation_store_read_groups(annotation_set, payload, payload_size);
+			}
+			if (index.features_offset) {
+				u8* payload = annotation_store_get_payload(data, index.features_offset, &payload_size);
+				annotation_store_read_features(annotation_set, payload, payload_size);
+			}
+			if (index.active_offset) {
+				u8* payload = annotation_store_get_payload(data, index.active_offset, &payload_size);
+				annotation_store_active_t* active = (annotation_store_active_t*) payload;
+				u32* keys = (u32*)(active + 1);
+				i32 key_count = MIN(active->count, (i32)((payload_size - sizeof(*active)) / sizeof(u32)));
+				for (i32 i = 0; i < key_count; ++i) {
+					u32 key = keys[i];
+					if (key >= arrlen(index.annotation_offsets) || !index.annotation_offsets[key]) continue;
+					u8* annotation_payload = annotation_store_get_payload(data, index.annotation_offsets[key], &payload_size);
+					annotation_t annotation;
+					if (!annotation_store_read_annotation(annotation_set, annotation_payload, payload_size, &annotation)) continue;
+					if (annotation.group_id < 0 || annotation.group_id >= annotation_set->active_group_count) {
+						annotation.group_id = 0;
+					}
+
+					arrput(annotation_set->active_annotation_indices, annotation_set->stored_annotation_count);
+					++annotation_set->active_annotation_count;
+					arrput(annotation_set->stored_annotations, annotation);
+					++annotation_set->stored_annotation_count;
+
+					// The store already contains this annotation, no need to write it again.
+					annotation_store_shadow_t shadow = {};
+					shadow.properties_hash = annotation_store_hash_annotation_properties(&annotation);
+					shadow.coordinates = annotation.coordinates;
+					shadow.coordinate_count = annotation.coordinate_count;
+					shadow.coordinates_generation = annotation.coordinates_generation;
+					shadow.is_written = true;
+					arrput(store->shadows, shadow);
+					arrput(store->keys, key);
+					store->next_key = MAX(store->next_key, key + 1);
+				}
+			}
+			store->sequence = index.last_commit.sequence;
+			store->source_file_size = index.last_commit.source_file_size;
+			store->source_file_mtime = index.last_commit.source_file_mtime;
+			store->file_size = size;
+			store->compacted_size = size;
+			// If the last write was interrupted, appending after the damaged part would be useless.
+			store->need_full_rewrite = (index.valid_size != size);
+			// Remember what the groups, features and active annotations look like, so they don't get written again.
+			memrw_t scratch = memrw_create(KILOBYTES(64));
+			annotation_store_write_table_if_changed(&scratch, annotation_set, ANNOTATION_STORE_RECORD_GROUPS, &store->groups_hash, true);
+			annotation_store_write_table_if_changed(&scratch, annotation_set, ANNOTATION_STORE_RECORD_FEATURES, &store->features_hash, true);
+			memrw_destroy(&scratch);
+			store->active_hash = annotation_store_hash_active_keys(annotation_set, store);
+			success = true;
+			console_print("Loaded %d annotations from annotation store '%s' in %g seconds\n", annotation_set->active_annotation_count,
+			              store_filename, get_seconds_elapsed(start, get_clock()));
+		}
+	}
+	annotation_store_index_destroy(&index);
+	if (mapping.is_valid) file_mapping_close(&mapping);
+	if (file) free(file);
+	file_handle_close(file_handle);
+	return success;
+}
+
+// Prefer the binary annotation store over the XML file, as long as it is up-to-date.
+bool load_annotation_store_or_asap_xml(app_state_t* app_state, const char* xml_filename) {
+	annotation_set_t* annotation_set = &app_state->scene.annotation_set;
+	if (annotation_enable_store && annotation_store_load(annotation_set, xml_filename)) {
+		return true;
+	}
+	if (file_exists(xml_filename)) {
+		console_print("Found XML annotations: '%s'\n", xml_filename);
+		return load_asap_xml_annotations(app_state, xml_filename);
+	}
+	return false;
+}
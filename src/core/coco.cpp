@@ -144,108 +144,153 @@ static void coco_parse_images(coco_t* coco, json_array_s* info) {
 	}
 }
 
-static void coco_parse_annotations(coco_t* coco, json_array_s* info) {
-	console_print_verbose("[JSON] parsing annotations\n");
-
-	json_array_element_s* array_element = info->start;
-	while (array_element) {
-		if (array_element->value->type == json_type_object) {
-
-			json_object_s* annotation_object = (json_object_s*)array_element->value->payload;
-			json_object_element_s* element = annotation_object->start;
-			coco_annotation_t* annotation = arraddnptr(coco->annotations, 1);
-			memset(annotation, 0, sizeof(*annotation));
-			++coco->annotation_count;
-			while (element) {
-				const char* element_name = element->name->string;
-				// outer array (each element is a 'segmentation' associated with the annotation
-				// For now, we assume that there is only a single segmentation
-				// TODO: accept multiple segmentations per annotation
-				if (element->value->type == json_type_array) {
-					json_array_s* payload_array = (json_array_s*) element->value->payload;
-					json_array_element_s* sub_array_element = payload_array->start;
-					if (strcmp(element_name, "segmentation") == 0) {
-						// [[x, y, x, y, x, y, ... ]]
-						i32 coordinate_count = 0;
-						v2f* coordinates = NULL; // sb
-						// Assuming only a single element exists...
-						/*while*/if (sub_array_element) {
-							if (sub_array_element->value->type == json_type_array) {
-								json_array_s* coordinate_array = (json_array_s*) sub_array_element->value->payload;
-								json_array_element_s* coordinate_array_element = coordinate_array->start;
-								i32 number_index = 0;
-								v2f new_coord = {};
-								while (coordinate_array_element) {
-									i32 coordinate_index = number_index / 2;
-									bool is_x = (number_index % 2) == 0; // X and Y coordinates are interleaved
-									float number = 0.0;
-									if (coordinate_array_element->value->type == json_type_number) {
-										json_number_s* payload_number = (json_number_s*) coordinate_array_element->value->payload;
-										number = strtof(payload_number->number, NULL);
-									}
-									if (is_x) {
-										new_coord.x = number;
-									} else {
-										new_coord.y = number;
-										arrput(coordinates, new_coord);
-										++coordinate_count;
-										new_coord = v2f(); // reset for next iteration
-									}
-									coordinate_array_element = coordinate_array_element->next;
-									++number_index;
-								}
-							}
-							sub_array_element = sub_array_element->next;
-						}
-						annotation->segmentation.coordinates = coordinates;
-						annotation->segmentation.coordinate_count = coordinate_count;
-					} else if (strcmp(element_name, "bbox") == 0) {
-						i32 coordinate_index = 0;
-						float coordinates[4] = {};
-						while (sub_array_element && coordinate_index < 4) {
-							if (sub_array_element->value->type == json_type_number) {
-								json_number_s* payload_number = (json_number_s*) element->value->payload;
-								coordinates[coordinate_index] = strtof(payload_number->number, NULL);
-								++coordinate_index;
+static void coco_parse_annotation(coco_annotation_t* annotation, json_object_s* annotation_object) {
+	json_object_element_s* element = annotation_object->start;
+	while (element) {
+		const char* element_name = element->name->string;
+		// outer array (each element is a 'segmentation' associated with the annotation
+		// For now, we assume that there is only a single segmentation
+		// TODO: accept multiple segmentations per annotation
+		if (element->value->type == json_type_array) {
+			json_array_s* payload_array = (json_array_s*) element->value->payload;
+			json_array_element_s* sub_array_element = payload_array->start;
+			if (strcmp(element_name, "segmentation") == 0) {
+				// [[x, y, x, y, x, y, ... ]]
+				i32 coordinate_count = 0;
+				v2f* coordinates = NULL; // sb
+				// Assuming only a single element exists...
+				/*while*/if (sub_array_element) {
+					if (sub_array_element->value->type == json_type_array) {
+						json_array_s* coordinate_array = (json_array_s*) sub_array_element->value->payload;
+						arrsetcap(coordinates, coordinate_array->length / 2);
+						json_array_element_s* coordinate_array_element = coordinate_array->start;
+						i32 number_index = 0;
+						v2f new_coord = {};
+						while (coordinate_array_element) {
+							bool is_x = (number_index % 2) == 0; // X and Y coordinates are interleaved
+							float number = 0.0;
+							if (coordinate_array_element->value->type == json_type_number) {
+								json_number_s* payload_number = (json_number_s*) coordinate_array_element->value->payload;
+								number = parse_float(payload_number->number, NULL);
 							}
-							sub_array_element = sub_array_element->next;
-						}
-						annotation->bbox = *((rect2f*)coordinates);
-					} else if (strcmp(element_name, "features") == 0) {
-						//[id,value,id,value,...]
-						i32 sub_element_index = 0;
-						i32 feature_id = 0;
-						while (sub_array_element && sub_element_index < (COCO_MAX_ANNOTATION_FEATURES * 2)) {
-							if (sub_array_element->value->type == json_type_number) {
-								json_number_s* payload_number = (json_number_s*) element->value->payload;
-								if (sub_element_index % 2 == 0) {
-									feature_id = atoi(payload_number->number);
-								} else {
-									annotation->features[feature_id] = strtof(payload_number->number, NULL);
-								}
-								++sub_element_index;
+							if (is_x) {
+								new_coord.x = number;
+							} else {
+								new_coord.y = number;
+								arrput(coordinates, new_coord);
+								++coordinate_count;
+								new_coord = v2f(); // reset for next iteration
 							}
-							sub_array_element = sub_array_element->next;
+							coordinate_array_element = coordinate_array_element->next;
+							++number_index;
 						}
 					}
-				} else if (element->value->type == json_type_number) {
-					json_number_s* payload_number = (json_number_s*) element->value->payload;
-					if (strcmp(element_name, "id") == 0) {
-						annotation->id = atoi(payload_number->number);
-					} else if (strcmp(element_name, "category_id") == 0) {
-						annotation->category_id = atoi(payload_number->number);
-					} else if (strcmp(element_name, "image_id") == 0) {
-						annotation->image_id = atoi(payload_number->number);
-					} else if (strcmp(element_name, "area") == 0) {
-						annotation->area = strtof(payload_number->number, NULL);
+					sub_array_element = sub_array_element->next;
+				}
+				annotation->segmentation.coordinates = coordinates;
+				annotation->segmentation.coordinate_count = coordinate_count;
+			} else if (strcmp(element_name, "bbox") == 0) {
+				i32 coordinate_index = 0;
+				float coordinates[4] = {};
+				while (sub_array_element && coordinate_index < 4) {
+					if (sub_array_element->value->type == json_type_number) {
+						json_number_s* payload_number = (json_number_s*) sub_array_element->value->payload;
+						coordinates[coordinate_index] = parse_float(payload_number->number, NULL);
+						++coordinate_index;
 					}
+					sub_array_element = sub_array_element->next;
 				}
-				element = element->next;
+				annotation->bbox = *((rect2f*)coordinates);
+			} else if (strcmp(element_name, "features") == 0) {
+				//[id,value,id,value,...]
+				i32 sub_element_index = 0;
+				i32 feature_id = 0;
+				while (sub_array_element && sub_element_index < (COCO_MAX_ANNOTATION_FEATURES * 2)) {
+					if (sub_array_element->value->type == json_type_number) {
+						json_number_s* payload_number = (json_number_s*) sub_array_element->value->payload;
+						if (sub_element_index % 2 == 0) {
+							feature_id = atoi(payload_number->number);
+						} else if (feature_id >= 0 && feature_id < COCO_MAX_ANNOTATION_FEATURES) {
+							annotation->features[feature_id] = parse_float(payload_number->number, NULL);
+						}
+						++sub_element_index;
+					}
+					sub_array_element = sub_array_element->next;
+				}
+			}
+		} else if (element->value->type == json_type_number) {
+			json_number_s* payload_number = (json_number_s*) element->value->payload;
+			if (strcmp(element_name, "id") == 0) {
+				annotation->id = atoi(payload_number->number);
+			} else if (strcmp(element_name, "category_id") == 0) {
+				annotation->category_id = atoi(payload_number->number);
+			} else if (strcmp(element_name, "image_id") == 0) {
+				annotation->image_id = atoi(payload_number->number);
+			} else if (strcmp(element_name, "area") == 0) {
+				annotation->area = parse_float(payload_number->number, NULL);
 			}
 		}
+		element = element->next;
+	}
+}
 
+// Converting the annotations is split into batches, which are spread out over the worker threads.
+#define COCO_ANNOTATIONS_PER_BATCH 256
+
+typedef struct coco_parse_annotations_batch_t {
+	coco_annotation_t* annotations;
+	json_object_s** annotation_objects;
+	i32 count;
+	volatile i32* finished_batch_count;
+} coco_parse_annotations_batch_t;
+
+static void coco_parse_annotations_batch_func(i32 logical_thread_index, void* userdata) {
+	coco_parse_annotations_batch_t* batch = (coco_parse_annotations_batch_t*) userdata;
+	for (i32 i = 0; i < batch->count; ++i) {
+		coco_parse_annotation(batch->annotations + i, batch->annotation_objects[i]);
+	}
+	write_barrier;
+	atomic_increment(batch->finished_batch_count);
+}
+
+static void coco_parse_annotations(coco_t* coco, json_array_s* info) {
+	console_print_verbose("[JSON] parsing annotations\n");
+
+	// Walking the DOM is cheap; collect the annotation objects first, so that the batches can be handed out.
+	json_object_s** annotation_objects = NULL; // sb
+	arrsetcap(annotation_objects, info->length);
+	json_array_element_s* array_element = info->start;
+	while (array_element) {
+		if (array_element->value->type == json_type_object) {
+			arrput(annotation_objects, (json_object_s*)array_element->value->payload);
+		}
 		array_element = array_element->next;
 	}
+
+	i32 annotation_count = arrlen(annotation_objects);
+	coco_annotation_t* annotations = arraddnptr(coco->annotations, annotation_count);
+	memset(annotations, 0, annotation_count * sizeof(coco_annotation_t));
+	coco->annotation_count += annotation_count;
+
+	volatile i32 finished_batch_count = 0;
+	i32 batch_count = 0;
+	for (i32 first = 0; first < annotation_count; first += COCO_ANNOTATIONS_PER_BATCH) {
+		coco_parse_annotations_batch_t batch = {};
+		batch.annotations = annotations + first;
+		batch.annotation_objects = annotation_objects + first;
+		batch.count = MIN(COCO_ANNOTATIONS_PER_BATCH, annotation_count - first);
+		batch.finished_batch_count = &finished_batch_count;
+		++batch_count;
+		if (annotation_count <= COCO_ANNOTATIONS_PER_BATCH ||
+		    !add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_VISIBLE_TILE, coco_parse_annotations_batch_func, &batch, sizeof(batch))) {
+			coco_parse_annotations_batch_func(0, &batch); // not worth the overhead (or the queue is unavailable)
+		}
+	}
+	while (finished_batch_count < batch_count) {
+		do_worker_work(&global_work_queue, 0);
+	}
+	read_barrier;
+	arrfree(annotation_objects);
 }
 
 static void coco_parse_categories(coco_t* coco, json_array_s* info) {
@@ -129,7 +129,7 @@ int app_command_execute(app_state_t* app_state) {
 			if (load_generic_file(app_state, filename, 0)) {
 				if (arrlen(app_state->loaded_images) > 0) {
 					image_t* image = app_state->loaded_images;
-					if (image->backend == IMAGE_BACKEND_TIFF) {
+					if (image->type == IMAGE_TYPE_WSI) {
 						u32 export_flags = 0;
 						// TODO: allow configuration
 						if (command->export_command.with_annotations) {
@@ -138,6 +138,8 @@ int app_command_execute(app_state_t* app_state) {
 						export_flags |= EXPORT_FLAGS_PUSH_ANNOTATION_COORDINATES_INWARD;
 
 						annotation_set_t* annotation_set = &app_state->scene.annotation_set;
+						// Annotations are loaded in the background, and nobody else collects them in headless mode.
+						annotation_loader_wait(annotation_set);
 						if (annotation_set->active_annotation_count > 0) {
 
 							// Search for the ROI
@@ -164,7 +166,7 @@ int app_command_execute(app_state_t* app_state) {
 								char filename_hint[512];
 								export_region_get_name_hint(app_state, filename_hint, sizeof(filename_hint));
 
-								export_cropped_bigtiff(app_state, image, &image->tiff, world_bounds, pixel_bounds,
+								export_cropped_bigtiff(app_state, image, world_bounds, pixel_bounds,
 								                       filename_hint, 512,
 								                       tiff_export_desired_color_space, tiff_export_jpeg_quality, export_flags);
 							}
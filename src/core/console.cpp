@@ -168,6 +168,76 @@ void console_execute_command(app_state_t* app_state, const char* command) {
 			gui_add_modal_message_popup("Success", "All done!");
 			extern void begin_a_very_long_task();
 			begin_a_very_long_task();
+		} else if (strcmp(cmd, "bench_work_queue") == 0) {
+			i32 max_thread_count = arg ? atoi(arg) : 64;
+			benchmark_work_queue(max_thread_count);
+		} else if (strcmp(cmd, "bench_idwt") == 0) {
+			i32 iterations = arg ? atoi(arg) : 1000;
+			isyntax_benchmark_idwt(iterations);
+		} else if (strcmp(cmd, "bench_hulsken") == 0) {
+			// Benchmark codeblock decompression on a sample of the codeblocks in the currently loaded iSyntax file
+			image_t* image = arrlen(app_state->loaded_images) > 0 ? app_state->loaded_images + 0 : NULL;
+			if (image && image->backend == IMAGE_BACKEND_ISYNTAX) {
+				i32 max_codeblocks = arg ? atoi(arg) : 4096;
+				isyntax_benchmark_hulsken_decompress(&image->isyntax, max_codeblocks, 3);
+			} else {
+				console_print_error("bench_hulsken: no iSyntax image loaded\n");
+			}
+		} else if (strcmp(cmd, "bench_jpeg") == 0) {
+			// Benchmark JPEG tile decoding on a sample of the tiles in the currently loaded TIFF file
+			image_t* image = arrlen(app_state->loaded_images) > 0 ? app_state->loaded_images + 0 : NULL;
+			if (image && image->backend == IMAGE_BACKEND_TIFF) {
+				i32 max_tiles = arg ? atoi(arg) : 1024;
+				tiff_benchmark_jpeg_decode(&image->tiff, max_tiles, 3);
+			} else {
+				console_print_error("bench_jpeg: no TIFF image loaded\n");
+			}
+		} else if (strcmp(cmd, "idwt_simd") == 0) {
+			// Force a specific instruction set for the inverse wavelet transform (-1 = automatic)
+			if (arg) {
+				i32 simd = atoi(arg);
+				if (simd < 0 || isyntax_dwt_is_simd_supported(simd)) {
+					isyntax_dwt_simd_override = simd;
+				} else {
+					console_print_error("%s is not supported on this CPU\n", isyntax_dwt_get_simd_name(simd));
+				}
+			}
+			console_print("IDWT instruction set: %s\n", isyntax_dwt_simd_override < 0 ? "automatic" : isyntax_dwt_get_simd_name(isyntax_dwt_simd_override));
+		} else if (strcmp(cmd, "mmap") == 0) {
+			// Toggle memory-mapped reading of compressed tile data (takes effect for files opened afterwards)
+			if (arg) {
+				is_file_mapping_enabled = atoi(arg) != 0;
+			}
+			console_print("Memory-mapped file reads: %s\n", is_file_mapping_enabled ? "on" : "off");
+		} else if (strcmp(cmd, "tile_cache") == 0) {
+			// Set the budget for decoded tiles kept in memory (0 = only keep tiles needed for an export)
+			if (arg) {
+				tile_cache_ram_budget_mb = MAX(0, atoi(arg));
+			}
+			tile_cache_print_stats(&app_state->tile_cache);
+		} else if (strcmp(cmd, "tile_cache_vram") == 0) {
+			// Set the budget for tile textures kept in video memory (0 = unlimited)
+			if (arg) {
+				tile_cache_vram_budget_mb = MAX(0, atoi(arg));
+			}
+			tile_cache_print_stats(&app_state->tile_cache);
+		} else if (strcmp(cmd, "isyntax_cache") == 0) {
+			// Set the budget for decoded iSyntax coefficients (0 = unlimited), and report memory usage
+			if (arg) {
+				isyntax_coeff_cache_budget_mb = MAX(0, atoi(arg));
+			}
+			image_t* image = arrlen(app_state->loaded_images) > 0 ? app_state->loaded_images + 0 : NULL;
+			if (image && image->backend == IMAGE_BACKEND_ISYNTAX) {
+				isyntax_print_cache_stats(&image->isyntax);
+			} else {
+				console_print("iSyntax coefficient cache budget: %d MB\n", isyntax_coeff_cache_budget_mb);
+			}
+		} else if (strcmp(cmd, "isyntax_chunk_cache") == 0) {
+			// Set the budget for compressed iSyntax data chunks (0 = unlimited)
+			if (arg) {
+				isyntax_chunk_cache_budget_mb = MAX(0, atoi(arg));
+			}
+			console_print("iSyntax data chunk cache budget: %d MB\n", isyntax_chunk_cache_budget_mb);
 		} else if (strcmp(cmd, "modal") == 0) {
 			gui_add_modal_message_popup("Modal test", "This is a modal message test.");
 		} else if (strcmp(cmd, "tiff_save_description") == 0) {
@@ -244,7 +244,7 @@ static void gui_draw_main_menu_bar(app_state_t* app_state) {
 		bool prev_is_vsync_enabled = is_vsync_enabled;
 		bool prev_fullscreen = is_fullscreen;
 		bool has_image_loaded = (arrlen(app_state->loaded_images) > 0);
-		bool can_save = scene->annotation_set.modified;
+		bool can_save = scene->annotation_set.modified || scene->annotation_set.has_unexported_changes;
 
 		if (ImGui::BeginMenu("File")) {
 			if (ImGui::MenuItem("Open...", "Ctrl+O", &menu_items_clicked.open_file)) {}
@@ -740,7 +740,9 @@ void draw_export_region_dialog(app_state_t* app_state) {
 
 			if (proceed_with_export) {
 				switch(image->backend) {
-					case IMAGE_BACKEND_TIFF: {
+					case IMAGE_BACKEND_TIFF:
+					case IMAGE_BACKEND_DICOM:
+					case IMAGE_BACKEND_OPENSLIDE: {
 						u32 export_flags = 0;
 						if (display_export_annotations_checkbox) {
 							if (also_export_annotations) {
@@ -750,7 +752,7 @@ void draw_export_region_dialog(app_state_t* app_state) {
 								export_flags |= EXPORT_FLAGS_PUSH_ANNOTATION_COORDINATES_INWARD;
 							}
 						}
-						begin_export_cropped_bigtiff(app_state, image, &image->tiff, scene->crop_bounds, scene->selection_pixel_bounds,
+						begin_export_cropped_bigtiff(app_state, image, scene->crop_bounds, scene->selection_pixel_bounds,
 						                             filename_buffer, 512,
 						                             tiff_export_desired_color_space, tiff_export_jpeg_quality, export_flags);
 						gui_add_modal_progress_bar_popup("Exporting region...", &global_tiff_export_progress, false);
@@ -1356,7 +1358,7 @@ static void a_very_long_task(i32 logical_thread_index, void* userdata) {
 
 // for testing the progress bar popup
 void begin_a_very_long_task() {
-	add_work_queue_entry(&global_work_queue, a_very_long_task, NULL, 0);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, a_very_long_task, NULL, 0);
 }
 
 
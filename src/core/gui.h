@@ -124,6 +124,9 @@ extern float annotation_insert_hover_distance INIT(= 30.0f);
 extern float annotation_freeform_insert_interval_distance INIT(= 35.0f);
 extern bool annotation_highlight_inside_of_polygons INIT(=true);
 extern float annotation_highlight_opacity INIT(=0.1f);
+extern float annotation_lod_max_screen_error INIT(= 0.5f); // in screen pixels; 0 disables simplified outlines
+extern float annotation_lod_collapse_size INIT(= 4.0f); // smaller polygons (in screen pixels) are drawn as a box or dot
+extern bool annotation_enable_store INIT(= true); // autosave to a binary annotation store, export to XML only on save/close
 extern bool show_delete_annotation_prompt;
 extern bool show_save_quit_prompt;
 extern bool dont_ask_to_delete_annotations;
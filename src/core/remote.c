@@ -19,6 +19,7 @@
 #include "common.h"
 #include "platform.h"
 #include "viewer.h"
+#include "remote.h"
 
 #if !defined(MBEDTLS_CONFIG_FILE)
 #include "mbedtls/config.h"
@@ -56,6 +57,9 @@
 
 #define DEBUG_LEVEL DO_DEBUG
 
+// Don't wait forever on a connection that has silently gone away.
+#define REMOTE_READ_TIMEOUT_MS 30000
+
 typedef struct {
 	i64 start_clock;
 	i64 sockfd;
@@ -65,6 +69,15 @@ typedef struct {
 	mbedtls_ssl_context ssl;
 	mbedtls_ssl_config conf;
 	mbedtls_x509_crt cacert;
+	// The connection is kept open and reused for later requests from the same thread (HTTP keep-alive)
+	char hostname[256];
+	i32 portno;
+	bool is_open;
+	i32 responses_received;
+	// Received bytes not yet consumed (may already belong to the next pipelined response)
+	i32 read_buffer_pos;
+	i32 read_buffer_used;
+	u8 read_buffer[KILOBYTES(16)];
 } tls_connection_t;
 
 static void my_debug( void *ctx, int level,
@@ -168,6 +181,7 @@ tls_connection_t* open_remote_connection(const char* hostname, i32 portno, void*
 	mbedtls_ssl_conf_ca_chain( &connection->conf, &connection->cacert, NULL );
 	mbedtls_ssl_conf_rng( &connection->conf, mbedtls_ctr_drbg_random, &connection->ctr_drbg );
 	mbedtls_ssl_conf_dbg( &connection->conf, my_debug, stdout );
+	mbedtls_ssl_conf_read_timeout( &connection->conf, REMOTE_READ_TIMEOUT_MS );
 
 	if( ( ret = mbedtls_ssl_setup( &connection->ssl, &connection->conf ) ) != 0 )
 	{
@@ -181,7 +195,7 @@ tls_connection_t* open_remote_connection(const char* hostname, i32 portno, void*
 		goto exit;
 	}
 
-	mbedtls_ssl_set_bio( &connection->ssl, &connection->server_fd, mbedtls_net_send, mbedtls_net_recv, NULL );
+	mbedtls_ssl_set_bio( &connection->ssl, &connection->server_fd, mbedtls_net_send, NULL, mbedtls_net_recv_timeout );
 
 	/*
 	 * 4. Handshake
@@ -225,12 +239,13 @@ tls_connection_t* open_remote_connection(const char* hostname, i32 portno, void*
 
 	exit:
 
-#ifdef MBEDTLS_ERROR_C
 	if( exit_code != MBEDTLS_EXIT_SUCCESS )
 	{
+#ifdef MBEDTLS_ERROR_C
 		char error_buf[100];
 		mbedtls_strerror( ret, error_buf, 100 );
 		console_print_error("Last error was: %d - %s\n\n", ret, error_buf );
+#endif
 		mbedtls_net_free( &connection->server_fd );
 
 		mbedtls_x509_crt_free( &connection->cacert );
@@ -242,7 +257,6 @@ tls_connection_t* open_remote_connection(const char* hostname, i32 portno, void*
 		return NULL;
 
 	}
-#endif
 
 	return connection;
 
@@ -263,113 +277,242 @@ float close_remote_connection(tls_connection_t* connection) {
 	return seconds_elapsed;
 }
 
-bool remote_request(tls_connection_t* connection, const char* request, i32 request_len, memrw_t* mem_buffer) {
+// NOTE: this can't be indexed by the logical_thread_index passed in by the caller: the main thread uses 0, but so do
+// worker threads that run nested jobs from within do_worker_work(&global_work_queue, 0).
+static THREAD_LOCAL tls_connection_t* thread_remote_connection;
 
-	bool success = false;
-	/*
-	 * 3. Write the GET request
-	 */
-//	mbedtls_printf( "  > Write to server:" );
-//	fflush( stdout );
-
-//	u8 buf[1024];
-//	i32 len = sprintf( (char *) buf, GET_REQUEST );
-	i32 ret = 1;
-	i32 len = request_len;
-
-#ifdef REMOTE_VERBOSE
-	console_print("Writing request: %s", request);
-#endif
+static void drop_remote_connection(tls_connection_t* connection) {
+	if (connection->is_open) {
+		close_remote_connection(connection);
+		connection->is_open = false;
+	}
+}
 
-	while( ( ret = mbedtls_ssl_write( &connection->ssl, (const u8*)request, request_len ) ) <= 0 )
-	{
-		if( ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE )
-		{
-			console_print_error( " failed\n  ! mbedtls_ssl_write returned %d\n\n", ret );
-			goto exit;
+// Each thread keeps its own connection open (HTTP keep-alive), so that we only pay for the TLS handshake once.
+static tls_connection_t* get_remote_connection(const char* hostname, i32 portno) {
+	tls_connection_t* connection = thread_remote_connection;
+	if (connection && connection->is_open) {
+		if (connection->portno == portno && strcmp(connection->hostname, hostname) == 0) {
+			return connection;
 		}
+		drop_remote_connection(connection);
 	}
+	if (!connection) {
+		connection = (tls_connection_t*) calloc(1, sizeof(tls_connection_t));
+		thread_remote_connection = connection;
+	}
+	if (!open_remote_connection(hostname, portno, connection)) {
+		return NULL;
+	}
+	strncpy(connection->hostname, hostname, sizeof(connection->hostname) - 1);
+	connection->hostname[sizeof(connection->hostname) - 1] = '\0';
+	connection->portno = portno;
+	connection->is_open = true;
+	connection->responses_received = 0;
+	connection->read_buffer_pos = 0;
+	connection->read_buffer_used = 0;
+	return connection;
+}
 
-	len = ret;
-#ifdef REMOTE_VERBOSE
-	console_print( " %d bytes written\n\n%s", request_len, request );
-#endif
-
-	/*
-	 * 7. Read the HTTP response
-	 */
-#ifdef REMOTE_VERBOSE
-	console_print( "  < Read from server:" );
-#endif
-	fflush( stdout );
-
-	u8 read_buffer[KILOBYTES(16)];
-
-	do
-	{
-		len = sizeof( read_buffer );
-		memset( read_buffer, 0, sizeof( read_buffer ) );
-		ret = mbedtls_ssl_read( &connection->ssl, read_buffer, len );
+static bool remote_send(tls_connection_t* connection, const u8* data, i32 size) {
+	while (size > 0) {
+		i32 ret = mbedtls_ssl_write(&connection->ssl, data, size);
+		if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+			continue;
+		}
+		if (ret <= 0) {
+			console_print_verbose("remote: mbedtls_ssl_write returned -0x%x\n", (unsigned int) -ret);
+			return false;
+		}
+		data += ret;
+		size -= ret;
+	}
+	return true;
+}
 
-		if( ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE )
+// Returns the number of received bytes that are available for consumption, or 0 if the connection was closed.
+static i32 remote_fill_read_buffer(tls_connection_t* connection) {
+	if (connection->read_buffer_pos < connection->read_buffer_used) {
+		return connection->read_buffer_used - connection->read_buffer_pos;
+	}
+	connection->read_buffer_pos = 0;
+	connection->read_buffer_used = 0;
+	for (;;) {
+		i32 ret = mbedtls_ssl_read(&connection->ssl, connection->read_buffer, sizeof(connection->read_buffer));
+		if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
 			continue;
+		}
+		if (ret > 0) {
+			connection->read_buffer_used = ret;
+			return ret;
+		}
+		if (ret < 0 && ret != MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+			console_print_verbose("remote: mbedtls_ssl_read returned -0x%x\n", (unsigned int) -ret);
+		}
+		return 0;
+	}
+}
 
-		if( ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY ) {
-			ret = 0;
-			success = true;
-			break;
+// Returns the Content-Length, or -1 if the server did not specify it.
+static i64 parse_http_response_headers(const char* headers, i64 size, i32* status_code, bool* keep_alive) {
+	i64 content_length = -1;
+	*status_code = 0;
+	*keep_alive = false;
+	if (size >= 12 && strncmp(headers, "HTTP/1.", 7) == 0) {
+		*keep_alive = (headers[7] != '0'); // persistent connections are the default from HTTP/1.1 onwards
+		*status_code = atoi(headers + 9);
+	}
+	const char* end = headers + size;
+	const char* line = headers;
+	while (line < end) {
+		const char* line_end = line;
+		while (line_end < end && *line_end != '\n') ++line_end;
+		if (line_end - line > 15 && strncasecmp(line, "Content-Length:", 15) == 0) {
+			content_length = strtoll(line + 15, NULL, 10);
+		} else if (line_end - line > 11 && strncasecmp(line, "Connection:", 11) == 0) {
+			const char* value = line + 11;
+			while (value < line_end && *value == ' ') ++value;
+			if (line_end - value >= 5 && strncasecmp(value, "close", 5) == 0) {
+				*keep_alive = false;
+			} else if (line_end - value >= 10 && strncasecmp(value, "keep-alive", 10) == 0) {
+				*keep_alive = true;
+			}
 		}
+		line = line_end + 1;
+	}
+	return content_length;
+}
 
-		if( ret < 0 )
-		{
-			console_print_error( "failed\n  ! mbedtls_ssl_read returned %d\n\n", ret );
-			break;
+// Read one complete HTTP response (headers + content) into mem_buffer.
+// The content length is taken from the Content-Length header, so that the connection can be reused afterwards.
+// Without it, we can only read until the server closes the connection.
+static bool remote_read_response(tls_connection_t* connection, memrw_t* mem_buffer, i64* content_offset, i32* status_code,
+                                 bool* keep_alive) {
+	memrw_rewind(mem_buffer);
+
+	// Headers
+	i64 headers_end = 0;
+	while (headers_end == 0) {
+		i32 available = remote_fill_read_buffer(connection);
+		if (available == 0) {
+			return false;
 		}
+		memrw_push_back(mem_buffer, connection->read_buffer + connection->read_buffer_pos, available);
+		connection->read_buffer_pos += available;
+		headers_end = find_end_of_http_headers(mem_buffer->data, mem_buffer->used_size);
+	}
+	i64 content_length = parse_http_response_headers((char*) mem_buffer->data, headers_end, status_code, keep_alive);
+	*content_offset = headers_end;
+
+	if (content_length < 0) {
+		*keep_alive = false;
+		while (remote_fill_read_buffer(connection) > 0) {
+			i32 available = connection->read_buffer_used - connection->read_buffer_pos;
+			memrw_push_back(mem_buffer, connection->read_buffer + connection->read_buffer_pos, available);
+			connection->read_buffer_pos += available;
+		}
+		return true;
+	}
 
-		if( ret == 0 )
-		{
-//			mbedtls_printf( "\n\nEOF\n\n" );
-			success = true;
-			break;
+	// We may already have received more than this response (the start of the next pipelined response); give that back.
+	i64 response_size = headers_end + content_length;
+	if ((i64) mem_buffer->used_size > response_size) {
+		i64 excess = mem_buffer->used_size - response_size;
+		ASSERT(excess <= connection->read_buffer_pos);
+		connection->read_buffer_pos -= (i32) excess;
+		mem_buffer->used_size = response_size;
+	}
+
+	// Content
+	while ((i64) mem_buffer->used_size < response_size) {
+		i32 available = remote_fill_read_buffer(connection);
+		if (available == 0) {
+			return false;
 		}
+		i32 bytes_to_take = (i32) MIN((i64) available, response_size - (i64) mem_buffer->used_size);
+		memrw_push_back(mem_buffer, connection->read_buffer + connection->read_buffer_pos, bytes_to_take);
+		connection->read_buffer_pos += bytes_to_take;
+	}
+	return true;
+}
 
-		len = ret;
+// Send one or more (pipelined) requests over the thread's persistent connection, and read back the responses in order.
+// on_response is called as soon as each response has arrived, so that processing can start before the rest are in.
+// If a reused connection turns out to have been closed by the server in the meantime, we reconnect and try again.
+typedef bool remote_response_func_t(void* userdata, i32 response_index, u8* response, i64 response_size, i64 content_offset,
+                                    i32 status_code);
+
+static i32 remote_pipelined_requests(const char* hostname, i32 portno, const char** requests, i32 request_count,
+                                     remote_response_func_t* on_response, void* userdata) {
+	i32 responses_handled = 0;
+	memrw_t mem_buffer = memrw_create(KILOBYTES(64));
+	for (i32 attempt = 0; attempt < 2 && responses_handled < request_count; ++attempt) {
+		tls_connection_t* connection = get_remote_connection(hostname, portno);
+		if (!connection) break;
+		bool is_reused_connection = (connection->responses_received > 0);
+
+		// Write all the requests at once; the server answers them in order.
+		memrw_rewind(&mem_buffer);
+		for (i32 i = responses_handled; i < request_count; ++i) {
+			memrw_push_back(&mem_buffer, (void*) requests[i], strlen(requests[i]));
+		}
+		bool ok = remote_send(connection, mem_buffer.data, (i32) mem_buffer.used_size);
 #ifdef REMOTE_VERBOSE
-		console_print( " %d bytes read\n", len );
+		console_print("Writing request: %.*s", (int) mem_buffer.used_size, (char*) mem_buffer.data);
 #endif
-		memrw_push_back(mem_buffer, read_buffer, len);
-	}
-	while( 1 );
 
-	exit:
-	return success;
+		bool got_response_on_this_attempt = false;
+		bool keep_alive = true;
+		while (ok && keep_alive && responses_handled < request_count) {
+			i64 content_offset = 0;
+			i32 status_code = 0;
+			ok = remote_read_response(connection, &mem_buffer, &content_offset, &status_code, &keep_alive);
+			if (!ok) break;
+			got_response_on_this_attempt = true;
+			++connection->responses_received;
+			if (!on_response(userdata, responses_handled, mem_buffer.data, mem_buffer.used_size, content_offset, status_code)) {
+				ok = false; // the caller does not want the rest
+				responses_handled = request_count;
+				break;
+			}
+			++responses_handled;
+		}
+		if (!ok || !keep_alive) {
+			drop_remote_connection(connection);
+		}
+		// Only retry if the connection was already stale before we got anything back from it.
+		if (!is_reused_connection || got_response_on_this_attempt) break;
+	}
+	memrw_destroy(&mem_buffer);
+	return responses_handled;
+}
 
+static bool remote_collect_response(void* userdata, i32 response_index, u8* response, i64 response_size,
+                                    i64 content_offset, i32 status_code) {
+	memrw_t* result = (memrw_t*) userdata;
+	memrw_push_back(result, response, response_size);
+	return true;
 }
 
+// Returns the whole HTTP response (including the headers).
 u8 *do_http_request(const char *hostname, i32 portno, const char *uri, i32 *bytes_read, i32 thread_id) {
-	tls_connection_t* connection = open_remote_connection(hostname, portno, alloca(sizeof(tls_connection_t)));
-	if (connection) {
-		static const char requestfmt[] = "GET %s HTTP/1.1\r\nConnection: close\r\n\r\n";
-		char request[4096];
-		snprintf(request, sizeof(request), requestfmt, uri);
-		size_t request_len = strlen(request);
-
-		memrw_t mem_buffer = memrw_create(MEGABYTES(1));
-		bool read_ok = remote_request(connection, request, request_len, &mem_buffer);
-		float seconds_elapsed = close_remote_connection(connection);
-		if (read_ok) {
-			console_print_verbose( "[thread %d] http request: %d bytes read in %g seconds\n", thread_id, mem_buffer.used_size, seconds_elapsed );
-			if (bytes_read) {
-				*bytes_read = mem_buffer.used_size;
-			}
-			return mem_buffer.data;
-//			console_print("Downloaded case list '%s' in %g seconds.\n", filename, seconds_elapsed);
-		} else {
-			memrw_destroy(&mem_buffer);
-			return NULL;
+	char request[4096];
+	snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n", uri, hostname);
+	const char* requests[1] = {request};
+
+	i64 start = get_clock();
+	memrw_t mem_buffer = memrw_create(MEGABYTES(1));
+	if (remote_pipelined_requests(hostname, portno, requests, 1, remote_collect_response, &mem_buffer) == 1) {
+		float seconds_elapsed = get_seconds_elapsed(start, get_clock());
+		console_print_verbose( "[thread %d] http request: %d bytes read in %g seconds\n", thread_id, mem_buffer.used_size, seconds_elapsed );
+		if (bytes_read) {
+			*bytes_read = mem_buffer.used_size;
 		}
+		return mem_buffer.data;
+	} else {
+		memrw_destroy(&mem_buffer);
+		return NULL;
 	}
-	return NULL;
 }
 
 u8 *download_remote_chunk(const char *hostname, i32 portno, const char *filename, i64 chunk_offset, i64 chunk_size,
@@ -382,61 +525,89 @@ u8 *download_remote_chunk(const char *hostname, i32 portno, const char *filename
 
 }
 
-u8 *download_remote_batch(const char *hostname, i32 portno, const char *filename, i64 *chunk_offsets, i64 *chunk_sizes,
-                          i32 batch_size, i32 *bytes_read, i32 thread_id) {
+typedef struct remote_batch_t {
+	i64* chunk_sizes;
+	remote_chunk_func_t* on_chunk;
+	void* userdata;
+} remote_batch_t;
+
+static bool remote_batch_on_response(void* userdata, i32 response_index, u8* response, i64 response_size,
+                                     i64 content_offset, i32 status_code) {
+	remote_batch_t* batch = (remote_batch_t*) userdata;
+	i64 content_length = response_size - content_offset;
+	if (status_code != 200 || content_length < batch->chunk_sizes[response_index]) {
+		console_print_error("Remote batch: bad response for chunk %d (status %d, %lld bytes)\n", response_index, status_code, content_length);
+		return false;
+	}
+	batch->on_chunk(batch->userdata, response_index, response + content_offset, batch->chunk_sizes[response_index]);
+	return true;
+}
+
+// Request each chunk separately (pipelined over the same connection), and hand them over as soon as they arrive.
+// Returns the number of chunks delivered; these are always the first ones of the batch.
+i32 download_remote_batch(const char *hostname, i32 portno, const char *filename, i64 *chunk_offsets, i64 *chunk_sizes,
+                          i32 batch_size, i32 thread_id, remote_chunk_func_t* on_chunk, void* userdata) {
 	ASSERT(batch_size > 0);
-	char uri[4092] = {0};
-	char* pos = uri;
-	i32 bytes_printed = snprintf(uri, sizeof(uri), "/slide/%s", filename);
-	pos += bytes_printed;
-	i32 bytes_left = sizeof(uri) - bytes_printed;
+	const char** requests = (const char**) alloca(batch_size * sizeof(char*));
 	for (i32 i = 0; i < batch_size; ++i) {
-		if (bytes_left <= 0) {
-			ASSERT(!"uri became too long");
-			return NULL;
-		}
-		bytes_printed += snprintf(pos, bytes_left, "/%lld/%lld", chunk_offsets[i], chunk_sizes[i]);
-		pos = uri + bytes_printed;
-		bytes_left = sizeof(uri) - bytes_printed;
+		char request[2048];
+		snprintf(request, sizeof(request), "GET /slide/%s/%lld/%lld HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n",
+		         filename, chunk_offsets[i], chunk_sizes[i], hostname);
+		size_t request_len = strlen(request);
+		char* request_copy = (char*) alloca(request_len + 1);
+		memcpy(request_copy, request, request_len + 1);
+		requests[i] = request_copy;
 	}
-	u8* read_buffer = do_http_request(hostname, portno, uri, bytes_read, thread_id);
-	return read_buffer;
+	remote_batch_t batch = {chunk_sizes, on_chunk, userdata};
+	i64 start = get_clock();
+	i32 chunks_delivered = remote_pipelined_requests(hostname, portno, requests, batch_size,
+	                                                 remote_batch_on_response, &batch);
+	console_print_verbose("[thread %d] remote batch: %d/%d chunks in %g seconds\n", thread_id, chunks_delivered, batch_size,
+	                      get_seconds_elapsed(start, get_clock()));
+	return chunks_delivered;
 }
 
+// Returns only the content (without the HTTP headers), zero-terminated.
 u8* download_remote_caselist(const char* hostname, i32 portno, const char* filename, i32* bytes_read) {
 	char uri[2048];
 	snprintf(uri, sizeof(uri), "/slide_set/%s", filename);
-	u8* read_buffer = do_http_request(hostname, portno, uri, bytes_read, 0);
-	return read_buffer;
+	i32 response_size = 0;
+	u8* read_buffer = do_http_request(hostname, portno, uri, &response_size, 0);
+	if (read_buffer) {
+		i64 content_offset = find_end_of_http_headers(read_buffer, response_size);
+		i64 content_length = response_size - content_offset;
+		u8* content = (u8*) malloc(content_length + 1);
+		memcpy(content, read_buffer + content_offset, content_length);
+		content[content_length] = '\0';
+		free(read_buffer);
+		if (bytes_read) {
+			*bytes_read = (i32) content_length;
+		}
+		return content;
+	}
+	return NULL;
 }
 
 bool32 open_remote_slide(app_state_t *app_state, const char *hostname, i32 portno, const char *filename) {
 
 	bool32 success = false;
 
-	static const char requestfmt[] = "GET /slide/%s/header HTTP/1.1\r\nConnection: close\r\n\r\n";
-	char request[4096];
-	snprintf(request, sizeof(request), requestfmt, filename);
-	i32 request_len = (i32)strlen(request);
-
-	tls_connection_t* connection = open_remote_connection(hostname, portno, alloca(sizeof(tls_connection_t)));
-	if (!connection) {
-		return false;
-	}
+	char uri[2048];
+	snprintf(uri, sizeof(uri), "/slide/%s/header", filename);
 
-	memrw_t mem_buffer = memrw_create(MEGABYTES(2));
-	bool32 read_ok = remote_request(connection, request, request_len, &mem_buffer);
-	float seconds_elapsed = close_remote_connection(connection);
+	i64 start = get_clock();
+	i32 bytes_read = 0;
+	u8* read_buffer = do_http_request(hostname, portno, uri, &bytes_read, 0);
+	float seconds_elapsed = get_seconds_elapsed(start, get_clock());
 
-	if (read_ok && mem_buffer.used_size > 0) {
+	if (read_buffer && bytes_read > 0) {
 		// now we should have the whole HTTP response
 #if REMOTE_CLIENT_VERBOSE
-		console_print("HTTP read finished, length = %d\n", mem_buffer->len);
+		console_print("HTTP read finished, length = %d\n", bytes_read);
 #endif
-//	fwrite(read_buffer, total_bytes_read, 1, stdout);
 
 		tiff_t tiff = {0};
-		if (tiff_deserialize(&tiff, mem_buffer.data, mem_buffer.used_size)) {
+		if (tiff_deserialize(&tiff, read_buffer, bytes_read)) {
 			tiff.is_remote = true;
 			tiff.location = (network_location_t){ .hostname = hostname, .portno = portno, .filename = filename };
 
@@ -450,10 +621,8 @@ bool32 open_remote_slide(app_state_t *app_state, const char *hostname, i32 portn
 		}
 
 	}
-	memrw_destroy(&mem_buffer);
-
+	if (read_buffer) free(read_buffer);
 
-//	float seconds_elapsed = close_remote_connection(connection);
 	console_print("Open remote took %g seconds\n", seconds_elapsed);
 	return success;
 }
@@ -461,25 +630,16 @@ bool32 open_remote_slide(app_state_t *app_state, const char *hostname, i32 portn
 #if DO_DEBUG
 void do_remote_connection_test() {
 	const char* hostname = "google.com";
-	tls_connection_t* connection = open_remote_connection(hostname, 443, alloca(sizeof(tls_connection_t)));
-	if (connection) {
-		static const char request[] = "GET / HTTP/1.0\r\nConnection: close\r\n\r\n";
-		memrw_t mem_buffer = memrw_create(MEGABYTES(1));
-		bool read_ok = remote_request(connection, request, strlen(request), &mem_buffer);
-		float seconds_elapsed = close_remote_connection(connection);
-		if (read_ok) {
-			console_print( "Remote connection test (%s): %d bytes read in %g seconds\n", hostname, mem_buffer.used_size, seconds_elapsed );
-			memrw_push_back(&mem_buffer, "\0", 1);
-			FILE* test_out = fopen("test_google.html", "wb");
-			fwrite(mem_buffer.data, mem_buffer.used_size-1, 1, test_out);
-			fclose(test_out);
-//			console_print("Downloaded case list '%s' in %g seconds.\n", filename, seconds_elapsed);
-		} else {
-		}
-		memrw_destroy(&mem_buffer);
+	i64 start = get_clock();
+	i32 bytes_read = 0;
+	u8* read_buffer = do_http_request(hostname, 443, "/", &bytes_read, 0);
+	float seconds_elapsed = get_seconds_elapsed(start, get_clock());
+	if (read_buffer) {
+		console_print( "Remote connection test (%s): %d bytes read in %g seconds\n", hostname, bytes_read, seconds_elapsed );
+		FILE* test_out = fopen("test_google.html", "wb");
+		fwrite(read_buffer, bytes_read, 1, test_out);
+		fclose(test_out);
+		free(read_buffer);
 	}
 }
 #endif
-
-
-
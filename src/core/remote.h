@@ -26,13 +26,16 @@ extern "C" {
 #endif
 
 
+// Called for each chunk of a batch download, as soon as it has arrived.
+typedef void remote_chunk_func_t(void* userdata, i32 chunk_index, u8* chunk, i64 chunk_size);
+
 // prototypes
 void init_networking();
 u8 *do_http_request(const char *hostname, i32 portno, const char *uri, i32 *bytes_read, i32 thread_id);
 u8 *download_remote_chunk(const char *hostname, i32 portno, const char *filename, i64 chunk_offset, i64 chunk_size,
                           i32 *bytes_read, i32 thread_id);
-u8 *download_remote_batch(const char *hostname, i32 portno, const char *filename, i64 *chunk_offsets, i64 *chunk_sizes,
-                          i32 batch_size, i32 *bytes_read, i32 thread_id);
+i32 download_remote_batch(const char *hostname, i32 portno, const char *filename, i64 *chunk_offsets, i64 *chunk_sizes,
+                          i32 batch_size, i32 thread_id, remote_chunk_func_t* on_chunk, void* userdata);
 u8* download_remote_caselist(const char* hostname, i32 portno, const char* filename, i32* bytes_read);
 bool32 open_remote_slide(app_state_t *app_state, const char *hostname, i32 portno, const char *filename);
 
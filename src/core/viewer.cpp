@@ -57,6 +57,7 @@
 #include "viewer_io_file.cpp"
 #include "viewer_io_remote.cpp"
 #include "viewer_options.cpp"
+#include "viewer_tile_cache.cpp"
 #include "commandline.cpp"
 
 tile_t* get_tile(level_image_t* image_level, i32 tile_x, i32 tile_y) {
@@ -115,11 +116,15 @@ void unload_image(image_t* image) {
 		for (i32 i = 0; i < image->level_count; ++i) {
 			level_image_t* level_image = image->level_images + i;
 			if (level_image->tiles) {
+				tile_cache_forget_tiles(&global_app_state.tile_cache, level_image->tiles, level_image->tile_count);
 				for (i32 j = 0; j < level_image->tile_count; ++j) {
 					tile_t* tile = level_image->tiles + j;
 					if (tile->texture != 0) {
 						unload_texture(tile->texture);
 					}
+					if (tile->pixels) {
+						tile_release_cache(tile);
+					}
 				}
 			}
 			free(level_image->tiles);
@@ -158,6 +163,7 @@ void unload_all_images(app_state_t *app_state) {
 		ASSERT(app_state->loaded_images);
 		for (i32 i = 0; i < current_image_count; ++i) {
 			image_t* old_image = app_state->loaded_images + i;
+			cancel_tile_load_requests_for_resource(app_state, old_image->resource_id);
 			unload_image(old_image);
 		}
 		arrfree(app_state->loaded_images);
@@ -202,7 +208,7 @@ void image_change_resolution(image_t* image, float mpp_x, float mpp_y) {
 
 			// If this downsampling level is 'backed' by a corresponding image pyramid level (not guaranteed),
 			// then we also need to update the dimension info for the backend-specific data structure
-			if (level_image->exists) {
+			if (level_image->exists && !level_image->is_virtual) {
 				i32 pyramid_image_index = level_image->pyramid_image_index;
 				if (image->backend == IMAGE_BACKEND_TIFF) {
 					ASSERT(pyramid_image_index < tiff->ifd_count);
@@ -329,6 +335,41 @@ bool init_image_from_tiff(app_state_t* app_state, image_t* image, tiff_t tiff, b
 						tile->tile_x = tile_index % level_image->width_in_tiles;
 						tile->tile_y = tile_index / level_image->width_in_tiles;
 					}
+				} else if ((ifd_index = tiff_get_virtual_level_source(&image->tiff, level_index)) >= 0) {
+					// The current downsampling level has no corresponding IFD level image, but we can synthesize it
+					// from a finer level by decoding the JPEG tiles at reduced resolution.
+					tiff_ifd_t* source_ifd = tiff.level_images_ifd + ifd_index;
+					i32 scale_shift = level_index - source_ifd->downsample_level;
+					level_image->exists = true;
+					level_image->is_virtual = true;
+					level_image->pyramid_image_index = ifd_index;
+					level_image->downsample_factor = source_ifd->downsample_factor * (float)(1 << scale_shift);
+					level_image->width_in_tiles = (source_ifd->width_in_tiles + (1 << scale_shift) - 1) >> scale_shift;
+					level_image->height_in_tiles = (source_ifd->height_in_tiles + (1 << scale_shift) - 1) >> scale_shift;
+					level_image->tile_count = level_image->width_in_tiles * level_image->height_in_tiles;
+					level_image->tile_width = source_ifd->tile_width;
+					level_image->tile_height = source_ifd->tile_height;
+					level_image->um_per_pixel_x = source_ifd->um_per_pixel_x * (float)(1 << scale_shift);
+					level_image->um_per_pixel_y = source_ifd->um_per_pixel_y * (float)(1 << scale_shift);
+					level_image->x_tile_side_in_um = level_image->um_per_pixel_x * (float)level_image->tile_width;
+					level_image->y_tile_side_in_um = level_image->um_per_pixel_y * (float)level_image->tile_height;
+					level_image->tiles = (tile_t*) calloc(1, level_image->tile_count * sizeof(tile_t));
+					for (i32 tile_index = 0; tile_index < level_image->tile_count; ++tile_index) {
+						tile_t* tile = level_image->tiles + tile_index;
+						tile->tile_index = tile_index;
+						tile->tile_x = tile_index % level_image->width_in_tiles;
+						tile->tile_y = tile_index / level_image->width_in_tiles;
+						// The tile is empty if all the tiles it covers in the source level are empty
+						tile->is_empty = true;
+						for (i32 y = tile->tile_y << scale_shift; y < ((tile->tile_y + 1) << scale_shift) && y < source_ifd->height_in_tiles; ++y) {
+							for (i32 x = tile->tile_x << scale_shift; x < ((tile->tile_x + 1) << scale_shift) && x < source_ifd->width_in_tiles; ++x) {
+								if (source_ifd->tile_byte_counts[y * source_ifd->width_in_tiles + x] != 0) {
+									tile->is_empty = false;
+								}
+							}
+						}
+					}
+					console_print_verbose("TIFF: level %d is missing, synthesizing it from level %d\n", level_index, source_ifd->downsample_level);
 				} else {
 					// The current downsampling level has no corresponding IFD level image :(
 					// So we need only some placeholder information.
@@ -345,33 +386,43 @@ bool init_image_from_tiff(app_state_t* app_state, image_t* image, tiff_t tiff, b
 				DUMMY_STATEMENT;
 			}
 		} else {
-			// The image is NOT tiled
+			// The image is NOT tiled, but consists of strips.
+			// The TIFF backend presents these as virtual tiles, and generates the downsampled levels on the fly.
 			memset(image->level_images, 0, sizeof(image->level_images));
-			image->level_count = 1;
-			level_image_t* level_image = image->level_images + 0;
+			image->level_count = tiff.max_downsample_level + 1;
+			if (image->level_count > WSI_MAX_LEVELS) {
+				panic();
+			}
 			tiff_ifd_t* ifd = tiff.main_image_ifd;
-			level_image->exists = true;
-			level_image->pyramid_image_index = 0;
-			level_image->downsample_factor = ifd->downsample_factor;
-			level_image->tile_count = 1;
-			level_image->width_in_tiles = 1;
-			ASSERT(level_image->width_in_tiles > 0);
-			level_image->height_in_tiles = 1;
-			level_image->tile_width = ifd->tile_width;
-			level_image->tile_height = ifd->tile_height;
-			level_image->um_per_pixel_x = ifd->um_per_pixel_x;
-			level_image->um_per_pixel_y = ifd->um_per_pixel_y;
-			level_image->x_tile_side_in_um = ifd->x_tile_side_in_um;
-			level_image->y_tile_side_in_um = ifd->y_tile_side_in_um;
-			ASSERT(level_image->x_tile_side_in_um > 0);
-			ASSERT(level_image->y_tile_side_in_um > 0);
-			level_image->tiles = (tile_t*) calloc(1, sizeof(tile_t)); // only 1 tile in this case
 			ASSERT(ifd->strip_byte_counts != NULL);
 			ASSERT(ifd->strip_offsets != NULL);
-			tile_t* tile = level_image->tiles + 0;
-			tile->tile_index = 0;
-			tile->tile_x = 0;
-			tile->tile_y = 0;
+			for (i32 level_index = 0; level_index < image->level_count; ++level_index) {
+				level_image_t* level_image = image->level_images + level_index;
+				level_image->exists = true;
+				level_image->is_virtual = (level_index > 0);
+				level_image->pyramid_image_index = 0; // all levels are generated from the same IFD
+				level_image->downsample_factor = exp2f((float)level_index);
+				i64 level_tile_side_in_pixels = (i64)ifd->tile_width << level_index;
+				level_image->width_in_tiles = (i32)((ifd->image_width + level_tile_side_in_pixels - 1) / level_tile_side_in_pixels);
+				ASSERT(level_image->width_in_tiles > 0);
+				level_image->height_in_tiles = (i32)((ifd->image_height + level_tile_side_in_pixels - 1) / level_tile_side_in_pixels);
+				level_image->tile_count = level_image->width_in_tiles * level_image->height_in_tiles;
+				level_image->tile_width = ifd->tile_width;
+				level_image->tile_height = ifd->tile_height;
+				level_image->um_per_pixel_x = ifd->um_per_pixel_x * level_image->downsample_factor;
+				level_image->um_per_pixel_y = ifd->um_per_pixel_y * level_image->downsample_factor;
+				level_image->x_tile_side_in_um = level_image->um_per_pixel_x * (float)ifd->tile_width;
+				level_image->y_tile_side_in_um = level_image->um_per_pixel_y * (float)ifd->tile_height;
+				ASSERT(level_image->x_tile_side_in_um > 0);
+				ASSERT(level_image->y_tile_side_in_um > 0);
+				level_image->tiles = (tile_t*) calloc(1, level_image->tile_count * sizeof(tile_t));
+				for (i32 tile_index = 0; tile_index < level_image->tile_count; ++tile_index) {
+					tile_t* tile = level_image->tiles + tile_index;
+					tile->tile_index = tile_index;
+					tile->tile_x = tile_index % level_image->width_in_tiles;
+					tile->tile_y = tile_index / level_image->width_in_tiles;
+				}
+			}
 		}
 
 
@@ -503,7 +554,7 @@ bool init_image_from_dicom(app_state_t* app_state, image_t* image, dicom_series_
 	dicom = &image->dicom;
 	image->is_freshly_loaded = true;
 
-	dicom_instance_t* base_level_instance = dicom->wsi.level_instances[0];
+	dicom_instance_t* base_level_instance = dicom->wsi.levels[0].instance;
 	ASSERT(base_level_instance);
 	if (!base_level_instance) return false;
 
@@ -534,17 +585,32 @@ bool init_image_from_dicom(app_state_t* app_state, image_t* image, dicom_series_
 
 		for (i32 level_index = 0; level_index < image->level_count; ++level_index) {
 			level_image_t* level_image = image->level_images + level_index;
-			dicom_instance_t* level_instance = dicom->wsi.level_instances[level_index];
+			i32 scale_shift = 0;
+			dicom_wsi_level_t* source_level = dicom_wsi_get_level_source(&dicom->wsi, level_index, &scale_shift);
+			level_image->downsample_factor = exp2f((float)level_index);
+			if (!source_level) {
+				// The level is missing from the pyramid, and can't be synthesized from a finer level.
+				level_image->exists = false;
+				level_image->tile_width = image->tile_width;
+				level_image->tile_height = image->tile_height;
+				level_image->um_per_pixel_x = level_image->downsample_factor * image->mpp_x;
+				level_image->um_per_pixel_y = level_image->downsample_factor * image->mpp_y;
+				level_image->x_tile_side_in_um = level_image->um_per_pixel_x * (float)image->tile_width;
+				level_image->y_tile_side_in_um = level_image->um_per_pixel_y * (float)image->tile_height;
+				continue;
+			}
 
 			level_image->exists = true;
-			level_image->needs_indexing = level_instance->is_pixel_data_encapsulated && !level_instance->are_all_offsets_read;
+			// Missing levels are synthesized by decoding the finer level at reduced resolution (see dicom_wsi_decode_tile_to_bgra())
+			level_image->is_virtual = (scale_shift > 0);
+			level_image->needs_indexing = false; // frame offsets that are still missing are read on the first tile request
 			level_image->pyramid_image_index = level_index; // not used
-			level_image->downsample_factor = exp2f((float)level_index);
-			level_image->width_in_tiles = level_instance->width_in_tiles;
+			dicom_instance_t* level_instance = source_level->instance;
+			level_image->width_in_tiles = (source_level->width_in_tiles + (1 << scale_shift) - 1) >> scale_shift;
 			ASSERT(level_image->width_in_tiles > 0);
-			level_image->height_in_tiles = level_instance->height_in_tiles;
+			level_image->height_in_tiles = (source_level->height_in_tiles + (1 << scale_shift) - 1) >> scale_shift;
 			ASSERT(level_image->height_in_tiles > 0);
-			level_image->tile_count = level_instance->tile_count;
+			level_image->tile_count = level_image->width_in_tiles * level_image->height_in_tiles;
 			level_image->tile_width = level_instance->columns;
 			level_image->tile_height = level_instance->rows;
 			if (level_instance->rows != image->tile_width) {
@@ -574,9 +640,14 @@ bool init_image_from_dicom(app_state_t* app_state, image_t* image, dicom_series_
 				tile->tile_x = tile_index % level_image->width_in_tiles;
 				tile->tile_y = tile_index / level_image->width_in_tiles;
 
-				dicom_tile_t* isyntax_tile = level_instance->tiles + tile_index;
-				if (!isyntax_tile->exists) {
-					tile->is_empty = true;
+				// The tile is empty if none of the tiles it covers in the source level exist
+				tile->is_empty = true;
+				for (i32 y = tile->tile_y << scale_shift; y < ((tile->tile_y + 1) << scale_shift) && y < source_level->height_in_tiles; ++y) {
+					for (i32 x = tile->tile_x << scale_shift; x < ((tile->tile_x + 1) << scale_shift) && x < source_level->width_in_tiles; ++x) {
+						if (dicom_wsi_get_tile(source_level, x, y, source_level->default_focal_plane)->exists) {
+							tile->is_empty = false;
+						}
+					}
 				}
 			}
 			DUMMY_STATEMENT;
@@ -741,6 +812,79 @@ void autosave(app_state_t* app_state, bool force_ignore_delay) {
 	}
 }
 
+static tile_load_request_t* acquire_tile_load_request(app_state_t* app_state, load_tile_task_t* task) {
+	if (app_state->tile_load_request_count >= MAX_TILE_LOAD_REQUESTS) {
+		return NULL;
+	}
+	for (i32 i = 0; i < MAX_TILE_LOAD_REQUESTS; ++i) {
+		i32 slot = (app_state->next_tile_load_request_slot + i) % MAX_TILE_LOAD_REQUESTS;
+		tile_load_request_t* request = app_state->tile_load_requests + slot;
+		if (!request->is_active) {
+			request->is_active = true;
+			request->state = TILE_LOAD_REQUEST_QUEUED;
+			request->resource_id = task->resource_id;
+			request->tile = task->tile;
+			request->level = task->level;
+			request->tile_x = task->tile_x;
+			request->tile_y = task->tile_y;
+			++app_state->tile_load_request_count;
+			app_state->next_tile_load_request_slot = (slot + 1) % MAX_TILE_LOAD_REQUESTS;
+			task->request = request;
+			task->request_generation = request->generation;
+			return request;
+		}
+	}
+	return NULL;
+}
+
+static void release_tile_load_request(app_state_t* app_state, tile_load_request_t* request, i32 generation) {
+	if (request && request->is_active && request->generation == generation) {
+		request->is_active = false;
+		request->tile = NULL;
+		atomic_increment(&request->generation);
+		--app_state->tile_load_request_count;
+	}
+}
+
+// Returns true if the request was still waiting in the queue; in that case the worker will skip it.
+// Requests that a worker has already picked up are allowed to finish, since the result will likely still be useful.
+static bool try_cancel_tile_load_request(tile_load_request_t* request) {
+	bool result = atomic_compare_exchange(&request->state, TILE_LOAD_REQUEST_CANCELLED, TILE_LOAD_REQUEST_QUEUED);
+	return result;
+}
+
+void cancel_tile_load_requests_for_resource(app_state_t* app_state, i32 resource_id) {
+	if (app_state->tile_load_request_count == 0) return;
+	for (i32 i = 0; i < MAX_TILE_LOAD_REQUESTS; ++i) {
+		tile_load_request_t* request = app_state->tile_load_requests + i;
+		if (request->is_active && request->resource_id == resource_id) {
+			// NOTE: the tiles are about to be freed, so don't touch request->tile here.
+			try_cancel_tile_load_request(request);
+		}
+	}
+}
+
+void cancel_tile_load_requests_outside_bounds(app_state_t* app_state, image_t* image, bounds2i* wanted_tiles_per_level,
+                                              i32 lowest_wanted_level, i32 highest_wanted_level) {
+	if (app_state->tile_load_request_count == 0) return;
+	for (i32 i = 0; i < MAX_TILE_LOAD_REQUESTS; ++i) {
+		tile_load_request_t* request = app_state->tile_load_requests + i;
+		if (!request->is_active || request->resource_id != image->resource_id || request->state != TILE_LOAD_REQUEST_QUEUED) {
+			continue;
+		}
+		bool is_wanted = false;
+		if (request->level >= lowest_wanted_level && request->level <= highest_wanted_level) {
+			bounds2i wanted = wanted_tiles_per_level[request->level];
+			is_wanted = request->tile_x >= wanted.min.x && request->tile_x < wanted.max.x &&
+			            request->tile_y >= wanted.min.y && request->tile_y < wanted.max.y;
+		}
+		if (!is_wanted && try_cancel_tile_load_request(request)) {
+			// The tile may be requested again right away if it comes back into view; the stale queue entry becomes a no-op.
+			request->tile->is_submitted_for_loading = false;
+		}
+	}
+}
+
 void request_tiles(app_state_t* app_state, image_t* image, load_tile_task_t* wishlist, i32 tiles_to_load) {
 	if (tiles_to_load > 0){
 		app_state->allow_idling_next_frame = false;
@@ -754,16 +898,28 @@ void request_tiles(app_state_t* app_state, image_t* image, load_tile_task_t* wis
 			intermittent_interval = 5; // reduce load on remote server; can be tweaked
 			if (intermittent % intermittent_interval == 0) {
 				load_tile_task_batch_t batch = {};
-				batch.task_count = ATMOST(COUNT(batch.tile_tasks), tiles_to_load);
-				memcpy(batch.tile_tasks, wishlist, batch.task_count * sizeof(load_tile_task_t));
-				if (add_work_queue_entry(&global_work_queue, tiff_load_tile_batch_func, &batch, sizeof(batch))) {
-					// success
-					for (i32 i = 0; i < batch.task_count; ++i) {
-						load_tile_task_t* task = batch.tile_tasks + i;
-						tile_t* tile = task->tile;
-						tile->is_submitted_for_loading = true;
-						tile->need_gpu_residency = task->need_gpu_residency;
-						tile->need_keep_in_cache = task->need_keep_in_cache;
+				for (i32 i = 0; i < tiles_to_load && batch.task_count < COUNT(batch.tile_tasks); ++i) {
+					load_tile_task_t* task = batch.tile_tasks + batch.task_count;
+					*task = wishlist[i];
+					if (acquire_tile_load_request(app_state, task)) {
+						++batch.task_count;
+					}
+				}
+				if (batch.task_count > 0) {
+					if (try_add_work_queue_entry(&global_work_queue, WORK_QUEUE_PRIORITY_VISIBLE_TILE, tiff_load_tile_batch_func, &batch, sizeof(batch))) {
+						// success
+						for (i32 i = 0; i < batch.task_count; ++i) {
+							load_tile_task_t* task = batch.tile_tasks + i;
+							tile_t* tile = task->tile;
+							tile->is_submitted_for_loading = true;
+							tile->need_gpu_residency = task->need_gpu_residency;
+							tile->need_keep_in_cache = task->need_keep_in_cache;
+						}
+					} else {
+						for (i32 i = 0; i < batch.task_count; ++i) {
+							load_tile_task_t* task = batch.tile_tasks + i;
+							release_tile_load_request(app_state, task->request, task->request_generation);
+						}
 					}
 				}
 			}
@@ -774,18 +930,25 @@ void request_tiles(app_state_t* app_state, image_t* image, load_tile_task_t* wis
 				tile_t* tile = task.tile;
 				if (tile->is_cached && tile->texture == 0 && task.need_gpu_residency) {
 					// only GPU upload needed
-					if (add_work_queue_entry(&global_completion_queue, viewer_upload_already_cached_tile_to_gpu, &task, sizeof(task))) {
+					if (try_add_work_queue_entry(&global_completion_queue, WORK_QUEUE_PRIORITY_VISIBLE_TILE, viewer_upload_already_cached_tile_to_gpu, &task, sizeof(task))) {
+						++app_state->tile_cache.hits;
 						tile->is_submitted_for_loading = true;
 						tile->need_gpu_residency = task.need_gpu_residency;
 						tile->need_keep_in_cache = task.need_keep_in_cache;
 					}
 				} else {
-					if (add_work_queue_entry(&global_work_queue, load_tile_func, &task, sizeof(task))) {
-						// TODO: should we even allow this to fail?
+					// NOTE: we don't want to block the main thread if the queue is full; the tile will be requested again next frame.
+					if (!acquire_tile_load_request(app_state, &task)) {
+						break; // too many requests in flight
+					}
+					if (try_add_work_queue_entry(&global_work_queue, WORK_QUEUE_PRIORITY_VISIBLE_TILE, load_tile_func, &task, sizeof(task))) {
 						// success
+						++app_state->tile_cache.misses;
 						tile->is_submitted_for_loading = true;
 						tile->need_gpu_residency = task.need_gpu_residency;
 						tile->need_keep_in_cache = task.need_keep_in_cache;
+					} else {
+						release_tile_load_request(app_state, task.request, task.request_generation);
 					}
 				}
 			}
@@ -793,6 +956,57 @@ void request_tiles(app_state_t* app_state, image_t* image, load_tile_task_t* wis
 	}
 }
 
+// After a failed load (e.g. a download error), wait before requesting the tile again: 0.5 s after the first failure,
+// doubling with each consecutive failure up to 16 s, so that an unreachable server isn't hammered every frame.
+static bool is_tile_load_retry_due(tile_t* tile) {
+	i32 doublings = MIN(tile->load_failure_count - 1, 5);
+	float retry_delay = 0.5f * (float)(1 << doublings);
+	return get_seconds_elapsed(tile->time_load_failed, get_clock()) >= retry_delay;
+}
+
+// iSyntax tiles are pushed by the streamer instead of being requested through request_tiles(). If the texture of such a
+// tile was evicted while its pixels are still cached in RAM, the streamer has nothing left to do for it, so we need to
+// re-upload the retained pixels ourselves.
+static void request_gpu_upload_of_cached_tiles(app_state_t* app_state, image_t* image, scene_t* scene,
+                                               i32 lowest_visible_scale, i32 highest_visible_scale) {
+	i32 max_uploads = 10;
+	i32 upload_count = 0;
+	for (i32 scale = highest_visible_scale; scale >= lowest_visible_scale; --scale) {
+		level_image_t* drawn_level = image->level_images + scale;
+		if (!drawn_level->exists) {
+			continue;
+		}
+		bounds2i level_tiles_bounds = BOUNDS2I(0, 0, (i32)drawn_level->width_in_tiles, (i32)drawn_level->height_in_tiles);
+		bounds2i visible_tiles = world_bounds_to_tile_bounds(&scene->camera_bounds, drawn_level->x_tile_side_in_um,
+		                                                     drawn_level->y_tile_side_in_um, image->origin_offset);
+		visible_tiles = clip_bounds2i(visible_tiles, level_tiles_bounds);
+		for (i32 tile_y = visible_tiles.min.y; tile_y < visible_tiles.max.y; ++tile_y) {
+			for (i32 tile_x = visible_tiles.min.x; tile_x < visible_tiles.max.x; ++tile_x) {
+				tile_t* tile = get_tile(drawn_level, tile_x, tile_y);
+				if (tile->texture != 0 || !tile->is_cached || !tile->pixels || tile->is_submitted_for_loading) {
+					continue;
+				}
+				if (upload_count >= max_uploads) {
+					return; // continue next frame
+				}
+				load_tile_task_t task = {
+						.resource_id = image->resource_id,
+						.image = image, .tile = tile, .level = scale, .tile_x = tile_x, .tile_y = tile_y,
+						.need_gpu_residency = true,
+						.need_keep_in_cache = tile->need_keep_in_cache,
+				};
+				if (!try_add_work_queue_entry(&global_completion_queue, WORK_QUEUE_PRIORITY_VISIBLE_TILE, viewer_upload_already_cached_tile_to_gpu, &task, sizeof(task))) {
+					return;
+				}
+				++app_state->tile_cache.hits;
+				tile->is_submitted_for_loading = true;
+				tile->need_gpu_residency = true;
+				++upload_count;
+			}
+		}
+	}
+}
+
 bool is_resource_valid(app_state_t* app_state, i32 resource_id) {
 	for (i32 i = 0; i < arrlen(app_state->active_resources); ++i) {
 		if (app_state->active_resources[i] == resource_id) {
@@ -824,7 +1038,11 @@ void viewer_process_completion_queue(app_state_t* app_state) {
 			if (transfer_state->need_finalization) {
 				finalize_texture_upload_using_pbo(transfer_state);
 				tile_t* tile = (tile_t*) transfer_state->userdata;  // TODO: think of something more elegant?
+				if (tile->texture && tile->texture != transfer_state->texture) {
+					unload_texture(tile->texture); // the tile was decoded again (e.g. to recreate evicted iSyntax coefficients)
+				}
 				tile->texture = transfer_state->texture;
+				tile_cache_track(app_state, tile, transfer_state->texture_width, transfer_state->texture_height);
 			}
 			float time_elapsed = get_seconds_elapsed(app_state->last_frame_start, get_clock());
 			if (time_elapsed > max_texture_load_time) {
@@ -852,15 +1070,34 @@ void viewer_process_completion_queue(app_state_t* app_state) {
 
 			if (entry.callback == viewer_notify_load_tile_completed) {
 				viewer_notify_tile_completed_task_t* task = (viewer_notify_tile_completed_task_t*) entry.userdata;
+				bool is_current_request = !task->request || (task->request->is_active &&
+				                                              task->request->generation == task->request_generation);
+				release_tile_load_request(app_state, task->request, task->request_generation);
 				image_t* image = get_image_from_resource_id(app_state, task->resource_id);
 				if (!image) {
 					// Image doesn't exist anymore (was unloaded?)
-					if (task->pixel_memory) free(task->pixel_memory);
+					if (task->pixel_memory) tile_pixels_free(task->pixel_memory);
+				} else if (task->was_cancelled) {
+					// The request was cancelled before a worker got to it; the tile state was already reset at that point.
+					ASSERT(!task->pixel_memory);
+				} else if (task->has_failed) {
+					// Not loaded this time (e.g. download error). Unless the tile has been requested again in the
+					// meantime, allow it to be resubmitted.
+					ASSERT(!task->pixel_memory);
+					if (is_current_request) {
+						tile_t* tile = get_tile_from_tile_index(image, task->scale, task->tile_index);
+						if (tile) {
+							tile->is_submitted_for_loading = false;
+							tile->load_failure_count = MIN(tile->load_failure_count + 1, 255);
+							tile->time_load_failed = get_clock();
+						}
+					}
 				} else {
 					// Upload the tile to the GPU
 					tile_t* tile = get_tile_from_tile_index(image, task->scale, task->tile_index);
 					ASSERT(tile);
 					tile->is_submitted_for_loading = false;
+					tile->load_failure_count = 0;
 
 					if (task->pixel_memory) {
 						bool need_free_pixel_memory = true;
@@ -869,19 +1106,28 @@ void viewer_process_completion_queue(app_state_t* app_state) {
 									submit_texture_upload_via_pbo(app_state, task->tile_width, task->tile_height,
 									                              4, task->pixel_memory, finalize_textures_immediately);
 							if (finalize_textures_immediately) {
+								if (tile->texture && tile->texture != transfer_state->texture) {
+									unload_texture(tile->texture);
+								}
 								tile->texture = transfer_state->texture;
 							} else {
 								transfer_state->userdata = (void*) tile;
 								tile->is_submitted_for_loading = true; // stuff still needs to happen, don't resubmit!
 							}
 						}
-						if (tile->need_keep_in_cache) {
+						// Keep the decoded pixels around, so that the tile can be uploaded again without decoding it
+						// if its texture gets evicted. (The tile cache enforces the memory budget.)
+						if (tile->need_keep_in_cache || tile_cache_should_retain_pixels(&app_state->tile_cache)) {
 							need_free_pixel_memory = false;
+							if (tile->pixels && tile->pixels != task->pixel_memory) {
+								tile_pixels_free(tile->pixels); // superseded by the tile being decoded again
+							}
 							tile->pixels = task->pixel_memory;
 							tile->is_cached = true;
 						}
+						tile_cache_track(app_state, tile, task->tile_width, task->tile_height);
 						if (need_free_pixel_memory) {
-							free(task->pixel_memory);
+							tile_pixels_free(task->pixel_memory);
 						}
 					} else {
 						tile->is_empty = true; // failed; don't resubmit!
@@ -905,11 +1151,12 @@ void viewer_process_completion_queue(app_state_t* app_state) {
 							                                                                       tile->pixels,
 							                                                                       finalize_textures_immediately);
 							tile->texture = transfer_state->texture;
+							tile_cache_track(app_state, tile, task->image->tile_width, task->image->tile_height);
 						} else {
 							ASSERT(!"viewer_only_upload_cached_tile() called but !tile->need_gpu_residency\n");
 						}
 
-						if (!task->need_keep_in_cache) {
+						if (!task->need_keep_in_cache && !tile_cache_should_retain_pixels(&app_state->tile_cache)) {
 							tile_release_cache(tile);
 						}
 					} else {
@@ -997,6 +1244,7 @@ void update_and_render_image(app_state_t* app_state, input_t *input, float delta
 				tile_streamer.is_cropped = scene->is_cropped;
 				tile_streamer.zoom = scene->zoom;
 				isyntax_begin_stream_image_tiles(&tile_streamer);
+				request_gpu_upload_of_cached_tiles(app_state, image, scene, lowest_visible_scale, highest_visible_scale);
 			}
 		} else if (image->backend == IMAGE_BACKEND_STBI) {
 			simple_image_t* simple = &image->simple;
@@ -1015,6 +1263,7 @@ void update_and_render_image(app_state_t* app_state, input_t *input, float delta
 			// Create a 'wishlist' of tiles to request
 			load_tile_task_t tile_wishlist[32];
 			i32 num_tasks_on_wishlist = 0;
+			bounds2i wanted_tiles_per_level[WSI_MAX_LEVELS] = {};
 			float screen_radius = ATLEAST(1.0f, sqrtf(SQUARE(client_width/2) + SQUARE(client_height/2)));
 
 			for (i32 scale = highest_visible_scale; scale >= lowest_visible_scale; --scale) {
@@ -1040,6 +1289,10 @@ void update_and_render_image(app_state_t* app_state, input_t *input, float delta
 					visible_tiles = clip_bounds2i(visible_tiles, crop_tile_bounds);
 				}
 
+				// Keep a margin of one tile, so that requests near the edge of the screen don't get cancelled while panning.
+				wanted_tiles_per_level[scale] = BOUNDS2I(visible_tiles.min.x - 1, visible_tiles.min.y - 1,
+				                                         visible_tiles.max.x + 1, visible_tiles.max.y + 1);
+
 				i32 base_priority = (image->level_count - scale) * 100; // highest priority for the most zoomed in levels
 
 
@@ -1050,6 +1303,9 @@ void update_and_render_image(app_state_t* app_state, input_t *input, float delta
 						if (tile->texture != 0 || tile->is_empty || tile->is_submitted_for_loading) {
 							continue; // nothing needs to be done with this tile
 						}
+						if (tile->load_failure_count > 0 && !is_tile_load_retry_due(tile)) {
+							continue; // the last attempt failed, wait a bit before trying again
+						}
 
 						float tile_distance_from_center_of_screen_x =
 								(scene->camera.x - ((tile_x + 0.5f) * drawn_level->x_tile_side_in_um)) / drawn_level->um_per_pixel_x;
@@ -1081,6 +1337,9 @@ void update_and_render_image(app_state_t* app_state, input_t *input, float delta
 //				console_print_verbose("Num tiles on wishlist = %d\n", num_tasks_on_wishlist);
 //			}
 
+			// Requests that are still waiting in the queue but are no longer needed would only delay the visible tiles.
+			cancel_tile_load_requests_outside_bounds(app_state, image, wanted_tiles_per_level, lowest_visible_scale, highest_visible_scale);
+
 			qsort(tile_wishlist, num_tasks_on_wishlist, sizeof(load_tile_task_t), priority_cmp_func);
 
 //		    last_section = profiler_end_section(last_section, "viewer_update_and_render: create tiles wishlist", 5.0f);
@@ -1484,6 +1743,7 @@ void viewer_update_and_render(app_state_t *app_state, input_t *input, i32 client
 
 	if (!app_state->is_export_in_progress) {
 		viewer_process_completion_queue(app_state);
+		tile_cache_update(app_state);
 	}
 
 	if (image_count == 0) {
@@ -2013,7 +2273,7 @@ void viewer_update_and_render(app_state_t *app_state, input_t *input, i32 client
 
 
 			// Ctrl+S: save annotations manually
-			if (scene->annotation_set.modified) {
+			if (scene->annotation_set.modified || scene->annotation_set.has_unexported_changes) {
 				if (was_key_pressed(input, KEY_S) && input->keyboard.key_ctrl.down) {
 					save_annotations(app_state, &scene->annotation_set, true);
 				}
@@ -2136,6 +2396,7 @@ void do_after_scene_render(app_state_t* app_state, input_t* input) {
 	gui_draw(app_state, curr_input, app_state->client_viewport.w, app_state->client_viewport.h);
 //	last_section = profiler_end_section(last_section, "gui draw", 10.0f);
 
+	annotation_loader_collect(&app_state->scene.annotation_set);
 	autosave(app_state, false);
 //	last_section = profiler_end_section(last_section, "autosave", 10.0f);
 
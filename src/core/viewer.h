@@ -146,7 +146,10 @@ typedef struct tile_t {
 	bool8 is_cached;
 	bool8 need_keep_in_cache;
 	bool8 need_gpu_residency; // TODO: revise: still needed?
+	bool8 is_tracked_by_tile_cache;
+	u8 load_failure_count;
 	i64 time_last_drawn;
+	i64 time_load_failed; // clock value of the last failed load, used to delay retries
 } tile_t;
 
 typedef struct cached_tile_t {
@@ -169,6 +172,7 @@ typedef struct {
 	v2f origin_offset;
 	i32 pyramid_image_index;
 	bool exists;
+	bool is_virtual; // not stored in the file, but synthesized by the backend from a finer level
 	bool needs_indexing; //TODO: implement
 	bool indexing_job_submitted;
 } level_image_t;
@@ -228,6 +232,27 @@ typedef enum load_tile_error_code_enum {
 	LOAD_TILE_READ_REMOTE_FAILED,
 } load_tile_error_code_enum;
 
+// Tile load requests from the viewer are tracked in a fixed table owned by the main thread, so that queued work can be
+// cancelled when the tile scrolls out of view (or the image is unloaded) without the worker touching freed memory.
+#define MAX_TILE_LOAD_REQUESTS 1024
+
+typedef enum tile_load_request_state_enum {
+	TILE_LOAD_REQUEST_QUEUED = 0,
+	TILE_LOAD_REQUEST_STARTED,
+	TILE_LOAD_REQUEST_CANCELLED,
+} tile_load_request_state_enum;
+
+typedef struct tile_load_request_t {
+	volatile i32 state;
+	volatile i32 generation; // incremented each time the slot is released, invalidating stale handles
+	bool is_active;
+	i32 resource_id;
+	tile_t* tile;
+	i32 level;
+	i32 tile_x;
+	i32 tile_y;
+} tile_load_request_t;
+
 typedef struct load_tile_task_t {
 	i32 resource_id;
 	image_t* image;
@@ -239,6 +264,8 @@ typedef struct load_tile_task_t {
 	bool8 need_gpu_residency;
 	bool8 need_keep_in_cache;
 	work_queue_callback_t* completion_callback;
+	tile_load_request_t* request; // NULL if the load can't be cancelled (e.g. during export)
+	i32 request_generation;
 } load_tile_task_t;
 
 typedef struct viewer_notify_tile_completed_task_t {
@@ -249,8 +276,23 @@ typedef struct viewer_notify_tile_completed_task_t {
 	i32 tile_height;
 	i32 resource_id;
 	bool want_gpu_residency;
+	bool was_cancelled;
+	bool has_failed; // e.g. the download failed; unlike a decoding error, it is worth trying again later
+	tile_load_request_t* request;
+	i32 request_generation;
 } viewer_notify_tile_completed_task_t;
 
+// Called by the worker before starting on the tile; returns false if the request was cancelled in the meantime.
+static inline bool begin_tile_load_request(tile_load_request_t* request, i32 generation) {
+	if (!request) {
+		return true; // untracked request, can't be cancelled
+	}
+	if (request->generation != generation) {
+		return false;
+	}
+	return atomic_compare_exchange(&request->state, TILE_LOAD_REQUEST_STARTED, TILE_LOAD_REQUEST_QUEUED);
+}
+
 
 #define TILE_LOAD_BATCH_MAX 8
 
@@ -427,6 +469,24 @@ struct app_command_t {
 	const char** inputs; // array
 };
 
+typedef struct tile_cache_entry_t {
+	tile_t* tile;
+	u32 bytes; // size of the pixels, and of the texture
+} tile_cache_entry_t;
+
+typedef struct tile_cache_t {
+	tile_cache_entry_t* entries; // array
+	i64 ram_bytes_resident;
+	i64 vram_bytes_resident;
+	i64 hits; // requested tiles that only needed to be uploaded from system memory
+	i64 misses; // requested tiles that needed to be decoded
+	i64 ram_evictions;
+	i64 vram_evictions;
+	i64 evictions_in_current_window;
+	float evictions_per_second;
+	i64 window_start;
+} tile_cache_t;
+
 typedef struct app_state_t {
 	app_command_t command;
 	u8* temp_storage_memory; // TODO: remove, use thread local temp storage instead
@@ -461,6 +521,10 @@ typedef struct app_state_t {
 	bool is_window_title_set_for_image;
 	input_t* input;
 	i32* active_resources; // array
+	tile_load_request_t tile_load_requests[MAX_TILE_LOAD_REQUESTS];
+	i32 tile_load_request_count;
+	i32 next_tile_load_request_slot;
+	tile_cache_t tile_cache;
 	bool is_export_in_progress;
 	bool export_as_coco;
 	bool enable_autosave;
@@ -480,6 +544,8 @@ bool init_image_from_stbi(app_state_t* app_state, image_t* image, simple_image_t
 bool load_generic_file(app_state_t* app_state, const char* filename, u32 filetype_hint);
 image_t load_image_from_file(app_state_t* app_state, file_info_t* file, directory_info_t* directory, u32 filetype_hint);
 void load_tile_func(i32 logical_thread_index, void* userdata);
+void notify_tile_load_request_cancelled(i32 logical_thread_index, load_tile_task_t* task);
+void notify_tile_load_request_failed(i32 logical_thread_index, load_tile_task_t* task);
 void load_wsi(wsi_t* wsi, const char* filename);
 void unload_wsi(wsi_t* wsi);
 void tile_release_cache(tile_t* tile);
@@ -490,6 +556,8 @@ bool is_key_down(input_t* input, i32 keycode);
 void init_app_state(app_state_t* app_state, app_command_t command);
 void autosave(app_state_t* app_state, bool force_ignore_delay);
 void request_tiles(app_state_t* app_state, image_t* image, load_tile_task_t* wishlist, i32 tiles_to_load);
+void cancel_tile_load_requests_outside_bounds(app_state_t* app_state, image_t* image, bounds2i* wanted_tiles_per_level, i32 lowest_wanted_level, i32 highest_wanted_level);
+void cancel_tile_load_requests_for_resource(app_state_t* app_state, i32 resource_id);
 void scene_update_camera_pos(scene_t* scene, v2f pos);
 void viewer_switch_tool(app_state_t* app_state, placement_tool_enum tool);
 void viewer_update_and_render(app_state_t* app_state, input_t* input, i32 client_width, i32 client_height, float delta_time);
@@ -504,6 +572,7 @@ void upload_tile_on_worker_thread(image_t* image, void* tile_pixels, i32 scale,
 const char* get_active_directory(app_state_t* app_state);
 void viewer_upload_already_cached_tile_to_gpu(int logical_thread_index, void* userdata);
 void viewer_notify_load_tile_completed(int logical_thread_index, void* userdata);
+u8* decode_tile_pixels(i32 logical_thread_index, image_t* image, i32 level, i32 tile_x, i32 tile_y);
 file_info_t viewer_get_file_info(const char* filename);
 
 // viewer_io_remote.cpp
@@ -512,6 +581,13 @@ void tiff_load_tile_batch_func(i32 logical_thread_index, void* userdata);
 // viewer_options.cpp
 void viewer_init_options(app_state_t* app_state);
 
+// viewer_tile_cache.cpp
+void tile_cache_track(app_state_t* app_state, tile_t* tile, i32 tile_width, i32 tile_height);
+void tile_cache_forget_tiles(tile_cache_t* cache, tile_t* tiles, u64 tile_count);
+bool tile_cache_should_retain_pixels(tile_cache_t* cache);
+void tile_cache_update(app_state_t* app_state);
+void tile_cache_print_stats(tile_cache_t* cache);
+
 // viewer_commandline.cpp
 app_command_t app_parse_commandline(int argc, const char** argv);
 void app_command_execute_immediately(app_command_t* app_command);
@@ -520,6 +596,7 @@ int app_command_execute(app_state_t* app_state);
 // isyntax_streamer.cpp
 void isyntax_stream_image_tiles(tile_streamer_t* tile_streamer, isyntax_t* isyntax);
 void isyntax_begin_stream_image_tiles(tile_streamer_t* tile_streamer);
+void isyntax_print_cache_stats(isyntax_t* isyntax);
 
 // scene.cpp
 void zoom_update_pos(zoom_state_t* zoom, float pos);
@@ -553,6 +630,10 @@ extern v2f simple_view_pos; // used by simple images (remove?)
 extern bool window_start_maximized INIT(=true);
 extern i32 desired_window_width INIT(=1280);
 extern i32 desired_window_height INIT(=720);
+extern i32 tile_cache_ram_budget_mb INIT(=1024); // decoded tiles kept in system memory (0 = only keep tiles needed for export)
+extern i32 tile_cache_vram_budget_mb INIT(=1024); // tile textures (0 = unlimited)
+extern i32 isyntax_chunk_cache_budget_mb INIT(=256); // compressed iSyntax data chunks (0 = unlimited)
+extern i32 isyntax_coeff_cache_budget_mb INIT(=1024); // decoded iSyntax wavelet coefficients (0 = unlimited)
 extern bool draw_macro_image_in_background;
 extern bool draw_label_image_in_background; // TODO: implement
 
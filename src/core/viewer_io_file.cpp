@@ -28,16 +28,43 @@ void viewer_upload_already_cached_tile_to_gpu(int logical_thread_index, void* us
 
 void viewer_notify_load_tile_completed(int logical_thread_index, void* userdata) {
 	viewer_notify_tile_completed_task_t* task = (viewer_notify_tile_completed_task_t*)userdata;
-	add_work_queue_entry(&global_completion_queue, viewer_notify_load_tile_completed, task, sizeof(*task));
+	add_work_queue_entry_with_priority(&global_completion_queue, WORK_QUEUE_PRIORITY_VISIBLE_TILE, viewer_notify_load_tile_completed, task, sizeof(*task));
 }
 
 
-void load_tile_func(i32 logical_thread_index, void* userdata) {
-	load_tile_task_t* task = (load_tile_task_t*) userdata;
-	i32 level = task->level;
-	i32 tile_x = task->tile_x;
-	i32 tile_y = task->tile_y;
-	image_t* image = task->image;
+// Let the main thread know that the request was skipped, so that the request slot can be released.
+void notify_tile_load_request_cancelled(i32 logical_thread_index, load_tile_task_t* task) {
+	viewer_notify_tile_completed_task_t completion_task = {};
+	completion_task.resource_id = task->resource_id;
+	completion_task.scale = task->level;
+	completion_task.was_cancelled = true;
+	completion_task.request = task->request;
+	completion_task.request_generation = task->request_generation;
+	ASSERT(task->completion_callback);
+	if (task->completion_callback) {
+		task->completion_callback(logical_thread_index, &completion_task);
+	}
+}
+
+// Let the main thread know that the tile could not be loaded this time, so that it can be requested again.
+void notify_tile_load_request_failed(i32 logical_thread_index, load_tile_task_t* task) {
+	level_image_t* level_image = task->image->level_images + task->level;
+	viewer_notify_tile_completed_task_t completion_task = {};
+	completion_task.resource_id = task->resource_id;
+	completion_task.scale = task->level;
+	completion_task.tile_index = task->tile_y * level_image->width_in_tiles + task->tile_x;
+	completion_task.has_failed = true;
+	completion_task.request = task->request;
+	completion_task.request_generation = task->request_generation;
+	ASSERT(task->completion_callback);
+	if (task->completion_callback) {
+		task->completion_callback(logical_thread_index, &completion_task);
+	}
+}
+
+// Decode a single tile, for any of the random-access backends. Returns NULL if the tile could not be decoded.
+// (iSyntax tiles are reconstructed by the iSyntax streamer instead, see isyntax_streamer.c)
+u8* decode_tile_pixels(i32 logical_thread_index, image_t* image, i32 level, i32 tile_x, i32 tile_y) {
 	level_image_t* level_image = image->level_images + level;
 	ASSERT(level_image->exists);
 	i32 tile_index = tile_y * level_image->width_in_tiles + tile_x;
@@ -47,13 +74,9 @@ void load_tile_func(i32 logical_thread_index, void* userdata) {
 	float tile_x_excess = tile_world_pos_x_end - image->width_in_um;
 	float tile_y_excess = tile_world_pos_y_end - image->height_in_um;
 
-	// Note: when the thread started up we allocated a large blob of memory for the thread to use privately
-	// TODO: better/more explicit allocator (instead of some setting some hard-coded pointers)
-	thread_memory_t* thread_memory = local_thread_memory;
 	size_t pixel_memory_size = level_image->tile_width * level_image->tile_height * BYTES_PER_PIXEL;
-	u8* temp_memory = (u8*)malloc(pixel_memory_size);
+	u8* temp_memory = tile_pixels_alloc(pixel_memory_size);
 	memset(temp_memory, 0xFF, pixel_memory_size);
-//	u8* compressed_tile_data = NULL;
 
 	bool failed = false;
 	ASSERT(image->type == IMAGE_TYPE_WSI);
@@ -62,7 +85,7 @@ void load_tile_func(i32 logical_thread_index, void* userdata) {
 		tiff_ifd_t* level_ifd = tiff->level_images_ifd + level_image->pyramid_image_index;
 		u8* pixels = tiff_decode_tile(logical_thread_index, tiff, level_ifd, tile_index, level, tile_x, tile_y);
 		if (pixels) {
-			free(temp_memory);
+			tile_pixels_free(temp_memory);
 			temp_memory = pixels;
 		} else {
 			failed = true;
@@ -98,7 +121,7 @@ void load_tile_func(i32 logical_thread_index, void* userdata) {
 	} else if (image->backend == IMAGE_BACKEND_DICOM) {
 		u8* pixels = dicom_wsi_decode_tile_to_bgra(&image->dicom, level, tile_index);
 		if (pixels) {
-			free(temp_memory);
+			tile_pixels_free(temp_memory);
 			temp_memory = pixels;
 		} else {
 			failed = true;
@@ -114,11 +137,28 @@ void load_tile_func(i32 logical_thread_index, void* userdata) {
 		failed = true;
 	}
 
-
 	if (failed && temp_memory != NULL) {
-		free(temp_memory);
+		tile_pixels_free(temp_memory);
 		temp_memory = NULL;
 	}
+	return temp_memory;
+}
+
+void load_tile_func(i32 logical_thread_index, void* userdata) {
+	load_tile_task_t* task = (load_tile_task_t*) userdata;
+	if (!begin_tile_load_request(task->request, task->request_generation)) {
+		// Cancelled: the tile went out of view or the image was unloaded (in which case task->image is invalid!)
+		notify_tile_load_request_cancelled(logical_thread_index, task);
+		return;
+	}
+	i32 level = task->level;
+	i32 tile_x = task->tile_x;
+	i32 tile_y = task->tile_y;
+	image_t* image = task->image;
+	level_image_t* level_image = image->level_images + level;
+	i32 tile_index = tile_y * level_image->width_in_tiles + tile_x;
+
+	u8* temp_memory = decode_tile_pixels(logical_thread_index, image, level, tile_x, tile_y);
 
 //	console_print_verbose("[thread %d] completing...\n", logical_thread_index);
 
@@ -145,6 +185,8 @@ void load_tile_func(i32 logical_thread_index, void* userdata) {
 	completion_task.scale = level;
 	completion_task.tile_index = tile_index;
 	completion_task.want_gpu_residency = true;
+	completion_task.request = task->request;
+	completion_task.request_generation = task->request_generation;
 
 	//	console_print("[thread %d] Loaded tile: level=%d tile_x=%d tile_y=%d\n", logical_thread_index, level, tile_x, tile_y);
 	ASSERT(task->completion_callback);
@@ -465,11 +507,8 @@ bool viewer_load_new_image(app_state_t* app_state, file_info_t* file, directory_
 
 		// TODO: use most recently updated annotations?
 		replace_file_extension(temp_filename, temp_size, "xml");
-		if (file_exists(temp_filename)) {
-			console_print("Found XML annotations: '%s'\n", temp_filename);
-			if (!were_annotations_loaded) {
-				load_asap_xml_annotations(app_state, temp_filename);
-			}
+		if (!were_annotations_loaded) {
+			load_annotation_store_or_asap_xml(app_state, temp_filename);
 		}
 
 
@@ -509,7 +548,7 @@ bool load_generic_file(app_state_t* app_state, const char* filename, u32 filetyp
 					annotation_set_t* annotation_set = &app_state->scene.annotation_set;
 					unload_and_reinit_annotations(annotation_set);
 					annotation_set->mpp = V2F(0.25f, 0.25f);
-					success = load_asap_xml_annotations(app_state, filename);
+					success = load_annotation_store_or_asap_xml(app_state, filename);
 				} else if (file.type == VIEWER_FILE_TYPE_JSON) {
 					// TODO: disambiguate between COCO annotations and case lists
 					reload_global_caselist(app_state, filename);
@@ -765,7 +804,7 @@ void unload_wsi(wsi_t* wsi) {
 
 void tile_release_cache(tile_t* tile) {
 	ASSERT(tile);
-	if (tile->pixels) free(tile->pixels);
+	if (tile->pixels) tile_pixels_free(tile->pixels);
 	tile->pixels = NULL;
 	tile->is_cached = false;
 	tile->need_keep_in_cache = false;
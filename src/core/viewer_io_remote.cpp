@@ -17,8 +17,71 @@
 */
 
 
+typedef struct tiff_remote_batch_t {
+	i32 logical_thread_index;
+	load_tile_task_batch_t* batch;
+} tiff_remote_batch_t;
+
+static void tiff_remote_tile_arrived(void* userdata, i32 chunk_index, u8* chunk, i64 chunk_size) {
+	tiff_remote_batch_t* remote_batch = (tiff_remote_batch_t*) userdata;
+	i32 logical_thread_index = remote_batch->logical_thread_index;
+	load_tile_task_t* task = remote_batch->batch->tile_tasks + chunk_index;
+	image_t* image = task->image;
+	tiff_t* tiff = &image->tiff;
+	level_image_t* level_image = image->level_images + task->level;
+
+	size_t pixel_memory_size = level_image->tile_width * level_image->tile_height * BYTES_PER_PIXEL;
+	u8* pixel_memory = tile_pixels_alloc(pixel_memory_size);
+	memset(pixel_memory, 0xFF, pixel_memory_size);
+
+	tiff_ifd_t* level_ifd = tiff->level_images_ifd + level_image->pyramid_image_index;
+	u8* jpeg_tables = level_ifd->jpeg_tables;
+	u64 jpeg_tables_length = level_ifd->jpeg_tables_length;
+
+	if (chunk[0] == 0xFF && chunk[1] == 0xD9) {
+		// JPEG stream is empty
+	} else {
+		if (!jpeg_decode_tile(jpeg_tables, jpeg_tables_length, chunk, chunk_size,
+		                      pixel_memory, (level_ifd->color_space == TIFF_PHOTOMETRIC_YCBCR))) {
+			console_print_error("[thread %d] failed to decode level %d, tile (%d, %d)\n", logical_thread_index, task->level, task->tile_x, task->tile_y);
+		}
+	}
+
+	viewer_notify_tile_completed_task_t completion_task = {};
+	completion_task.resource_id = task->resource_id;
+	completion_task.pixel_memory = pixel_memory;
+	// TODO: check if we need to pass the tile height here too?
+	completion_task.tile_width = level_image->tile_width;
+	completion_task.scale = task->level;
+	completion_task.tile_index = task->tile_y * level_image->width_in_tiles + task->tile_x;
+	completion_task.want_gpu_residency = true;
+	completion_task.request = task->request;
+	completion_task.request_generation = task->request_generation;
+
+	ASSERT(task->completion_callback);
+	if (task->completion_callback) {
+		task->completion_callback(logical_thread_index, &completion_task);
+	}
+}
+
 void tiff_load_tile_batch_func(i32 logical_thread_index, void* userdata) {
 	load_tile_task_batch_t* batch = (load_tile_task_batch_t*) userdata;
+
+	// Skip the tiles that have been cancelled while the batch was waiting in the queue.
+	i32 remaining_task_count = 0;
+	for (i32 i = 0; i < batch->task_count; ++i) {
+		load_tile_task_t* task = batch->tile_tasks + i;
+		if (begin_tile_load_request(task->request, task->request_generation)) {
+			batch->tile_tasks[remaining_task_count++] = *task;
+		} else {
+			notify_tile_load_request_cancelled(logical_thread_index, task);
+		}
+	}
+	batch->task_count = remaining_task_count;
+	if (batch->task_count == 0) {
+		return;
+	}
+
 	load_tile_task_t* first_task = batch->tile_tasks;
 	image_t* image = first_task->image;
 
@@ -34,11 +97,9 @@ void tiff_load_tile_batch_func(i32 logical_thread_index, void* userdata) {
 
 		if (tiff->is_remote) {
 
-			i32 bytes_read = 0;
 			i32 batch_size = batch->task_count;
 			i64 chunk_offsets[TILE_LOAD_BATCH_MAX];
 			i64 chunk_sizes[TILE_LOAD_BATCH_MAX];
-			i64 total_read_size = 0;
 			for (i32 i = 0; i < batch_size; ++i) {
 				load_tile_task_t* task = batch->tile_tasks + i;
 
@@ -58,72 +119,20 @@ void tiff_load_tile_batch_func(i32 logical_thread_index, void* userdata) {
 
 				chunk_offsets[i] = tile_offset;
 				chunk_sizes[i] = chunk_size;
-				total_read_size += chunk_size;
 			}
 
-
-//			u32 new_textures[TILE_LOAD_BATCH_MAX] = {0};
-
-			// Note: First download everything, then decode and upload everything to the GPU.
-			// It would be faster to pipeline this somehow.
-			u8* read_buffer = download_remote_batch(tiff->location.hostname, tiff->location.portno,
-			                                        tiff->location.filename,
-			                                        chunk_offsets, chunk_sizes, batch_size, &bytes_read, logical_thread_index);
-			if (read_buffer && bytes_read > 0) {
-				i64 content_offset = find_end_of_http_headers(read_buffer, bytes_read);
-				i64 content_length = bytes_read - content_offset;
-				u8* content = read_buffer + content_offset;
-
-				// TODO: better way to check the real content length?
-				if (content_length >= total_read_size) {
-
-					i64 chunk_offset_in_read_buffer = 0;
-					for (i32 i = 0; i < batch_size; ++i) {
-						load_tile_task_t* task = batch->tile_tasks + i;
-						level_image_t* level_image = image->level_images + task->level;
-
-						size_t pixel_memory_size = level_image->tile_width * level_image->tile_height * BYTES_PER_PIXEL;
-						u8* pixel_memory = (u8*)malloc(pixel_memory_size);
-						memset(pixel_memory, 0xFF, pixel_memory_size);
-
-						u8* current_chunk = content + chunk_offset_in_read_buffer;
-						chunk_offset_in_read_buffer += chunk_sizes[i];
-
-						tiff_ifd_t* level_ifd = tiff->level_images_ifd + level_image->pyramid_image_index;
-						u8* jpeg_tables = level_ifd->jpeg_tables;
-						u64 jpeg_tables_length = level_ifd->jpeg_tables_length;
-
-						if (content[0] == 0xFF && content[1] == 0xD9) {
-							// JPEG stream is empty
-						} else {
-							if (jpeg_decode_tile(jpeg_tables, jpeg_tables_length, current_chunk, chunk_sizes[i],
-							                     pixel_memory, (level_ifd->color_space == TIFF_PHOTOMETRIC_YCBCR))) {
-//		                    console_print("thread %d: successfully decoded level %d, tile %d (%d, %d)\n", logical_thread_index, level, tile_index, tile_x, tile_y);
-							} else {
-								console_print_error("[thread %d] failed to decode level %d, tile (%d, %d)\n", logical_thread_index, task->level, task->tile_x, task->tile_y);
-							}
-						}
-
-						viewer_notify_tile_completed_task_t completion_task = {};
-						completion_task.resource_id = task->resource_id;
-						completion_task.pixel_memory = pixel_memory;
-						// TODO: check if we need to pass the tile height here too?
-						completion_task.tile_width = level_image->tile_width;
-						completion_task.scale = task->level;
-						completion_task.tile_index = task->tile_y * level_image->width_in_tiles + task->tile_x;
-						completion_task.want_gpu_residency = true;
-
-						ASSERT(task->completion_callback);
-						if (task->completion_callback) {
-							task->completion_callback(logical_thread_index, &completion_task);
-						}
-						add_work_queue_entry(&global_completion_queue, task->completion_callback, &completion_task, sizeof(completion_task));
-
-						//new_textures[i] = load_texture(pixel_memory, TILE_DIM, TILE_DIM, GL_BGRA);
-					}
-
-				}
-
+			// The tiles are requested separately (pipelined over a persistent connection), so that we can start
+			// decoding the first tile while the rest are still on their way.
+			tiff_remote_batch_t remote_batch = {};
+			remote_batch.logical_thread_index = logical_thread_index;
+			remote_batch.batch = batch;
+			i32 tiles_delivered = download_remote_batch(tiff->location.hostname, tiff->location.portno,
+			                                            tiff->location.filename, chunk_offsets, chunk_sizes, batch_size,
+			                                            logical_thread_index, tiff_remote_tile_arrived, &remote_batch);
+
+			// Release the requests for the tiles that did not arrive, so that they can be requested again.
+			for (i32 i = tiles_delivered; i < batch_size; ++i) {
+				notify_tile_load_request_failed(logical_thread_index, batch->tile_tasks + i);
 			}
 
 #if 0
@@ -142,7 +151,6 @@ void tiff_load_tile_batch_func(i32 logical_thread_index, void* userdata) {
 			}
 #endif
 
-			free(read_buffer);
 		}
 
 	}
@@ -257,7 +257,7 @@ void upload_tile_on_worker_thread(image_t* image, void* tile_pixels, i32 scale,
 
 //write data into the mapped buffer, possibly in another thread.
 	memcpy(mapped_buffer, tile_pixels, pixel_memory_size);
-	free(tile_pixels);
+	tile_pixels_free(tile_pixels);
 
 // after reading is complete back on the main thread
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, local_thread_memory->pbo);
@@ -294,7 +294,7 @@ void upload_tile_on_worker_thread(image_t* image, void* tile_pixels, i32 scale,
 	completion_task.tile_index = tile_index;
 	completion_task.want_gpu_residency = true;
 	//	console_print("[thread %d] Loaded tile: level=%d tile_x=%d tile_y=%d\n", logical_thread_index, level, tile_x, tile_y);
-	add_work_queue_entry(&global_completion_queue, viewer_notify_load_tile_completed, &completion_task, sizeof(completion_task));
+	add_work_queue_entry_with_priority(&global_completion_queue, WORK_QUEUE_PRIORITY_VISIBLE_TILE, viewer_notify_load_tile_completed, &completion_task, sizeof(completion_task));
 #endif
 
 }
@@ -32,6 +32,10 @@ void viewer_init_options(app_state_t* app_state) {
 	ini_register_i32(ini, "window_height", &desired_window_height);
 	ini_register_bool(ini, "window_start_maximized", &window_start_maximized);
 	ini_register_bool(ini, "vsync", &is_vsync_enabled);
+	ini_register_i32(ini, "tile_cache_ram_mb", &tile_cache_ram_budget_mb);
+	ini_register_i32(ini, "tile_cache_vram_mb", &tile_cache_vram_budget_mb);
+	ini_register_i32(ini, "isyntax_chunk_cache_mb", &isyntax_chunk_cache_budget_mb);
+	ini_register_i32(ini, "isyntax_coeff_cache_mb", &isyntax_coeff_cache_budget_mb);
 
 	ini_apply(ini);
 }
@@ -0,0 +1,187 @@
+/*
+  Slidescape, a whole-slide image viewer for digital pathology.
+  Copyright (C) 2019-2022  Pieter Valkema
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Bookkeeping for decoded tiles that are resident in system memory (tile->pixels) and/or in video memory
+// (tile->texture). Tiles are registered when they gain pixels or a texture; once per frame the resident sizes are
+// recounted and the least recently drawn tiles are evicted until both budgets are met again.
+// NOTE: only call these from the main thread (tile state is owned by the main thread).
+
+static inline bool tile_cache_is_tile_pinned(app_state_t* app_state, tile_t* tile) {
+	// Tiles that are on screen, still being loaded or uploaded, or needed for an export in progress stay resident.
+	return tile->need_keep_in_cache || tile->is_submitted_for_loading || tile->time_last_drawn >= app_state->frame_counter - 1;
+}
+
+void tile_cache_track(app_state_t* app_state, tile_t* tile, i32 tile_width, i32 tile_height) {
+	if (!tile) return;
+	if (tile->time_last_drawn < app_state->frame_counter) {
+		tile->time_last_drawn = app_state->frame_counter; // counts as a use, so that fresh tiles aren't evicted first
+	}
+	if (tile->is_tracked_by_tile_cache) return;
+	tile_cache_entry_t entry = {};
+	entry.tile = tile;
+	entry.bytes = (u32)(tile_width * tile_height * BYTES_PER_PIXEL);
+	arrput(app_state->tile_cache.entries, entry);
+	tile->is_tracked_by_tile_cache = true;
+}
+
+// Stop tracking tiles that are about to be freed (e.g. because the image is being unloaded)
+void tile_cache_forget_tiles(tile_cache_t* cache, tile_t* tiles, u64 tile_count) {
+	for (i32 i = 0; i < arrlen(cache->entries); ++i) {
+		tile_cache_entry_t* entry = cache->entries + i;
+		if (entry->tile >= tiles && entry->tile < tiles + tile_count) {
+			entry->tile->is_tracked_by_tile_cache = false;
+			arrdelswap(cache->entries, i);
+			--i;
+		}
+	}
+}
+
+bool tile_cache_should_retain_pixels(tile_cache_t* cache) {
+	return tile_cache_ram_budget_mb > 0;
+}
+
+// iSyntax tiles are not requested by the viewer, they are pushed by the iSyntax streamer. If both the pixels and the
+// texture of such a tile are evicted, the streamer needs to be told to reconstruct it again.
+static isyntax_tile_t* tile_cache_find_isyntax_tile(app_state_t* app_state, tile_t* tile, isyntax_level_t** isyntax_level) {
+	for (i32 i = 0; i < arrlen(app_state->loaded_images); ++i) {
+		image_t* image = app_state->loaded_images + i;
+		if (image->backend != IMAGE_BACKEND_ISYNTAX) continue;
+		isyntax_image_t* wsi = image->isyntax.images + image->isyntax.wsi_image_index;
+		for (i32 level = 0; level < image->level_count && level < wsi->level_count; ++level) {
+			level_image_t* level_image = image->level_images + level;
+			if (tile >= level_image->tiles && tile < level_image->tiles + level_image->tile_count) {
+				*isyntax_level = wsi->levels + level;
+				return wsi->levels[level].tiles + tile->tile_index;
+			}
+		}
+	}
+	return NULL;
+}
+
+static int tile_cache_entry_lru_compare_func(const void* a_raw, const void* b_raw) {
+	tile_cache_entry_t* a = (tile_cache_entry_t*)a_raw;
+	tile_cache_entry_t* b = (tile_cache_entry_t*)b_raw;
+	if (a->tile->time_last_drawn < b->tile->time_last_drawn) return -1;
+	if (a->tile->time_last_drawn > b->tile->time_last_drawn) return 1;
+	return 0;
+}
+
+static void tile_cache_evict(app_state_t* app_state, bool evict_textures) {
+	tile_cache_t* cache = &app_state->tile_cache;
+	i64 budget = evict_textures ? MEGABYTES((i64)tile_cache_vram_budget_mb) : MEGABYTES((i64)tile_cache_ram_budget_mb);
+	i64* resident = evict_textures ? &cache->vram_bytes_resident : &cache->ram_bytes_resident;
+	// Evict down to a bit below the budget, so that we don't need to do this again on the very next frame.
+	i64 target = budget - budget / 8;
+
+	temp_memory_t temp_memory = begin_temp_memory_on_local_thread();
+	tile_cache_entry_t* candidates = (tile_cache_entry_t*)arena_push_size(temp_memory.arena, arrlen(cache->entries) * sizeof(tile_cache_entry_t));
+	i32 candidate_count = 0;
+	for (i32 i = 0; i < arrlen(cache->entries); ++i) {
+		tile_cache_entry_t* entry = cache->entries + i;
+		tile_t* tile = entry->tile;
+		bool is_resident = evict_textures ? (tile->texture != 0) : (tile->is_cached && tile->pixels != NULL);
+		if (is_resident && !tile_cache_is_tile_pinned(app_state, tile)) {
+			bool is_last_copy = evict_textures ? !(tile->is_cached && tile->pixels != NULL) : (tile->texture == 0);
+			if (is_last_copy) {
+				isyntax_level_t* isyntax_level = NULL;
+				isyntax_tile_t* isyntax_tile = tile_cache_find_isyntax_tile(app_state, tile, &isyntax_level);
+				if (isyntax_tile && isyntax_level->is_fully_loaded) {
+					continue; // the coefficients for these levels are discarded after the first load, can't recreate
+				}
+			}
+			candidates[candidate_count++] = *entry;
+		}
+	}
+	qsort(candidates, candidate_count, sizeof(tile_cache_entry_t), tile_cache_entry_lru_compare_func);
+
+	for (i32 i = 0; i < candidate_count && *resident > target; ++i) {
+		tile_t* tile = candidates[i].tile;
+		bool is_last_copy = evict_textures ? !(tile->is_cached && tile->pixels != NULL) : (tile->texture == 0);
+		if (is_last_copy) {
+			isyntax_level_t* isyntax_level = NULL;
+			isyntax_tile_t* isyntax_tile = tile_cache_find_isyntax_tile(app_state, tile, &isyntax_level);
+			if (isyntax_tile) {
+				isyntax_tile->want_reload = true; // picked up by the iSyntax streamer
+			}
+		}
+		if (evict_textures) {
+			unload_texture(tile->texture);
+			tile->texture = 0;
+			++cache->vram_evictions;
+		} else {
+			tile_release_cache(tile);
+			++cache->ram_evictions;
+		}
+		*resident -= candidates[i].bytes;
+		++cache->evictions_in_current_window;
+	}
+	release_temp_memory(&temp_memory);
+}
+
+// Once per frame: recount what is resident, drop tiles that no longer hold anything, and enforce the budgets.
+void tile_cache_update(app_state_t* app_state) {
+	tile_cache_t* cache = &app_state->tile_cache;
+	i64 ram_bytes_resident = 0;
+	i64 vram_bytes_resident = 0;
+	for (i32 i = 0; i < arrlen(cache->entries); ++i) {
+		tile_cache_entry_t* entry = cache->entries + i;
+		tile_t* tile = entry->tile;
+		bool has_pixels = tile->is_cached && tile->pixels != NULL;
+		bool has_texture = tile->texture != 0;
+		if (!has_pixels && !has_texture) {
+			tile->is_tracked_by_tile_cache = false;
+			arrdelswap(cache->entries, i);
+			--i;
+			continue;
+		}
+		if (has_pixels) ram_bytes_resident += entry->bytes;
+		if (has_texture) vram_bytes_resident += entry->bytes;
+	}
+	cache->ram_bytes_resident = ram_bytes_resident;
+	cache->vram_bytes_resident = vram_bytes_resident;
+
+	if (cache->ram_bytes_resident > MEGABYTES((i64)tile_cache_ram_budget_mb)) {
+		tile_cache_evict(app_state, false);
+	}
+	if (tile_cache_vram_budget_mb > 0 && cache->vram_bytes_resident > MEGABYTES((i64)tile_cache_vram_budget_mb)) {
+		tile_cache_evict(app_state, true);
+	}
+
+	i64 now = get_clock();
+	if (cache->window_start == 0) {
+		cache->window_start = now;
+	}
+	float window_seconds = get_seconds_elapsed(cache->window_start, now);
+	if (window_seconds >= 1.0f) {
+		cache->evictions_per_second = (float)cache->evictions_in_current_window / window_seconds;
+		cache->evictions_in_current_window = 0;
+		cache->window_start = now;
+	}
+}
+
+void tile_cache_print_stats(tile_cache_t* cache) {
+	i64 lookups = cache->hits + cache->misses;
+	float hit_rate = lookups > 0 ? (float)cache->hits * 100.0f / (float)lookups : 0.0f;
+	console_print("Tile cache: %d tiles tracked\n", (i32)arrlen(cache->entries));
+	console_print("   RAM:  %.1f / %d MB resident, %lld evictions\n", (float)cache->ram_bytes_resident / MEGABYTES(1),
+	              tile_cache_ram_budget_mb, cache->ram_evictions);
+	console_print("   VRAM: %.1f / %d MB resident, %lld evictions\n", (float)cache->vram_bytes_resident / MEGABYTES(1),
+	              tile_cache_vram_budget_mb, cache->vram_evictions);
+	console_print("   hit rate: %.1f%% (%lld hits, %lld misses), %.1f evictions/s\n", hit_rate, cache->hits, cache->misses,
+	              cache->evictions_per_second);
+}
@@ -50,6 +50,60 @@ static void dicom_switch_data_encoding(dicom_instance_t* instance, dicom_data_el
 	} else if (uid_length == 23 && strncmp(suffix, ".1.99", 5) == 0) {
 		instance->encoding = DICOM_TRANSFER_SYNTAX_DEFLATED_EXPLICIT_VR_LITTLE_ENDIAN; // 1.2.840.10008.1.2.1.99
 	}
+
+	// Also determine the codec needed for the pixel data.
+	// UIDs are padded to an even length with a trailing NUL byte, so compare the suffix without padding.
+	static const struct { const char* suffix; dicom_pixel_encoding_enum pixel_encoding; } known_suffixes[] = {
+		{"", DICOM_PIXEL_ENCODING_NATIVE},
+		{".1", DICOM_PIXEL_ENCODING_NATIVE},
+		{".1.99", DICOM_PIXEL_ENCODING_NATIVE},
+		{".2", DICOM_PIXEL_ENCODING_NATIVE},
+		{".4.50", DICOM_PIXEL_ENCODING_JPEG_BASELINE},
+		{".4.51", DICOM_PIXEL_ENCODING_JPEG_BASELINE},
+		{".4.57", DICOM_PIXEL_ENCODING_JPEG_LOSSLESS},
+		{".4.70", DICOM_PIXEL_ENCODING_JPEG_LOSSLESS},
+		{".4.80", DICOM_PIXEL_ENCODING_JPEG_LS},
+		{".4.81", DICOM_PIXEL_ENCODING_JPEG_LS},
+		{".4.90", DICOM_PIXEL_ENCODING_JPEG_2000},
+		{".4.91", DICOM_PIXEL_ENCODING_JPEG_2000},
+		{".5", DICOM_PIXEL_ENCODING_RLE},
+	};
+	instance->pixel_encoding = DICOM_PIXEL_ENCODING_UNKNOWN;
+	if (uid_length < 17 || strncmp((const char*)(instance->data + transfer_syntax_uid->data_offset), "1.2.840.10008.1.2", 17) != 0) {
+		return;
+	}
+	u32 suffix_length = uid_length - 17;
+	while (suffix_length > 0 && (suffix[suffix_length-1] == '\0' || suffix[suffix_length-1] == ' ')) {
+		--suffix_length;
+	}
+	for (i32 i = 0; i < COUNT(known_suffixes); ++i) {
+		if (strlen(known_suffixes[i].suffix) == suffix_length && strncmp(suffix, known_suffixes[i].suffix, suffix_length) == 0) {
+			instance->pixel_encoding = known_suffixes[i].pixel_encoding;
+			break;
+		}
+	}
+}
+
+// Frames of native (uncompressed) pixel data are stored back to back.
+static u32 dicom_get_native_frame_size(dicom_instance_t* instance) {
+	return (u32)instance->rows * instance->columns * instance->samples_per_pixel * ((instance->bits_allocated + 7) / 8);
+}
+
+// Returns where a frame is stored in the file. For encapsulated pixel data, the frame offsets need to be known
+// (see dicom_instance_ensure_frame_offsets()); otherwise the returned size is zero.
+dicom_frame_location_t dicom_instance_get_frame_location(dicom_instance_t* instance, u32 frame_index) {
+	dicom_frame_location_t location = {0};
+	if (instance->is_pixel_data_encapsulated) {
+		if (instance->are_all_offsets_read && frame_index < instance->pixel_data_offset_count) {
+			location.offset_in_file = sizeof(dicom_header_t) + instance->pixel_data_start_offset + (u64)instance->pixel_data_offsets[frame_index];
+			location.size = instance->pixel_data_sizes[frame_index];
+		}
+	} else if (instance->found_pixel_data && frame_index < instance->number_of_frames) {
+		u32 frame_size = dicom_get_native_frame_size(instance);
+		location.offset_in_file = sizeof(dicom_header_t) + instance->pixel_data.data_offset + (u64)frame_index * frame_size;
+		location.size = frame_size;
+	}
+	return location;
 }
 
 static inline bool32 need_alternate_element_layout(u16 vr) {
@@ -679,7 +733,8 @@ bool dicom_read_encapsulated_pixel_data_item(dicom_instance_t* instance, dicom_d
 
 				// We might be lucky if we have already read to the end of the file.
 				// In that case, we can continue parsing the rest of the items to fill out the offset table.
-				// Otherwise, abort reading further elements (we'll need to read them later).
+				// Otherwise, abort reading further elements: the offsets are filled in lazily when the first frame
+				// is needed (see dicom_instance_ensure_frame_offsets()), so that opening the series isn't held up.
 				if (instance->bytes_read_from_file < instance->total_bytes_in_stream) {
 					instance->need_parse_abort = true;
 				}
@@ -967,15 +1022,8 @@ dicom_instance_t dicom_load_file(dicom_series_t* dicom_series, file_info_t* file
 									} else {
 										ASSERT(!instance.has_basic_offset_table);
 										// There is no offset table, and we haven't read enough data yet to know all of the frame offsets.
-										// We can choose to read to the end of the file immediately if it isn't too large.
-										i64 bytes_left_to_read = instance.total_bytes_in_stream - instance.bytes_read_from_file;
-										i64 reasonable_size_to_read_immediately = MEGABYTES(4);
-										if (bytes_left_to_read < reasonable_size_to_read_immediately) {
-											chunk_size = bytes_left_to_read;
-											// continue reading
-										} else {
-											stop_reading = true;
-										}
+										// Don't read the rest of the file now; the item headers are scanned on first access instead.
+										stop_reading = true;
 									}
 								}
 							}
@@ -1019,14 +1067,18 @@ dicom_instance_t dicom_load_file(dicom_series_t* dicom_series, file_info_t* file
 	return instance;
 }
 
-typedef struct indexed_value_t {
-	i64 value;
-	i32 index;
-} indexed_value_t;
-
-// for qsort
-static int compare_indexed_value (const void* a, const void* b) {
-	return ( ((indexed_value_t*)b)->value - ((indexed_value_t*)a)->value );
+typedef struct dicom_load_file_task_t {
+	dicom_series_t* series;
+	file_info_t* file;
+	dicom_instance_t* result;
+	volatile i32* files_remaining;
+} dicom_load_file_task_t;
+
+static void dicom_load_file_task_func(i32 logical_thread_index, void* userdata) {
+	dicom_load_file_task_t* task = (dicom_load_file_task_t*) userdata;
+	*task->result = dicom_load_file(task->series, task->file);
+	write_barrier;
+	atomic_decrement(task->files_remaining);
 }
 
 bool dicom_open_from_directory(dicom_series_t* dicom, directory_info_t* directory) {
@@ -1035,20 +1087,45 @@ bool dicom_open_from_directory(dicom_series_t* dicom, directory_info_t* director
 	#if DO_DEBUG
 	dicom->debug_output_file = fopen("dicom_dump.txt", "wb");
 	#endif
-	dicom->tag_handler_func = handle_dicom_tag_for_tag_dumping;
+	// Formatting every element is expensive; only do it if anyone is going to look at the output.
+	bool is_dumping_tags = (dicom->debug_output_file != NULL || is_verbose_mode);
+	dicom->tag_handler_func = is_dumping_tags ? handle_dicom_tag_for_tag_dumping : NULL;
 
 	// TODO: load child directories as well.
 
 	bool success = true;
 
+	// Parse the instances concurrently (on a network share, most of the time is spent waiting on I/O).
+	// Parsing stops at the pixel data, so this only touches the first part of each file.
+	// If the tags are being dumped, load the files one after another, to keep the output readable.
 	i32 file_count = arrlen(directory->dicom_files);
+	dicom_instance_t* loaded_instances = calloc(MAX(file_count, 1), sizeof(dicom_instance_t));
+	volatile i32 files_remaining = file_count;
+	write_barrier;
 	for (i32 i = 0; i < file_count; ++i) {
-		file_info_t* file = directory->dicom_files + i;
-		dicom_instance_t instance = dicom_load_file(dicom, file);
-		if (instance.is_valid) {
-			arrput(dicom->instances, instance);
+		dicom_load_file_task_t task = {0};
+		task.series = dicom;
+		task.file = directory->dicom_files + i;
+		task.result = loaded_instances + i;
+		task.files_remaining = &files_remaining;
+		if (is_dumping_tags || !add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_VISIBLE_TILE,
+		                                                           dicom_load_file_task_func, &task, sizeof(task))) {
+			dicom_load_file_task_func(0, &task); // do it ourselves
+		}
+	}
+	// Help out while waiting for the files to finish
+	while (files_remaining > 0) {
+		if (!do_worker_work(&global_work_queue, 0)) {
+			platform_sleep(0);
 		}
 	}
+	read_barrier;
+	for (i32 i = 0; i < file_count; ++i) {
+		if (loaded_instances[i].is_valid) {
+			arrput(dicom->instances, loaded_instances[i]);
+		}
+	}
+	free(loaded_instances);
 
 	if (dicom->debug_output_file) {
 		fclose(dicom->debug_output_file);
@@ -1056,116 +1133,16 @@ bool dicom_open_from_directory(dicom_series_t* dicom, directory_info_t* director
 
 	console_print("DICOM: series has %d instances\n", arrlen(dicom->instances));
 
-	// TODO: move much of this to dicom_wsi.c
-
-	for (i32 i = 0; i < arrlen(dicom->instances); ++i) {
-		dicom_instance_t* instance = dicom->instances + i;
-
-		// TODO: handle concatenations
-		// https://dicom.nema.org/medical/dicom/current/output/chtml/part03/sect_C.7.6.16.html#sect_C.7.6.16.1.3
-		// Strategy: fold concatenated instances back into a single 'parent' instance, with links to the children?
-
-		console_print_verbose("%d: #=%d flavor=%s w=%u h=%u\n", i, instance->instance_number, instance->image_flavor_cs.value,
-		              instance->total_pixel_matrix_columns, instance->total_pixel_matrix_rows);
-	}
-
-	// Sort levels (volumes) by descending image width to get the
-	indexed_value_t* volume_image_widths = alloca(arrlen(dicom->instances) * sizeof(indexed_value_t));
-	i32 running_volume_index = 0;
 	for (i32 i = 0; i < arrlen(dicom->instances); ++i) {
 		dicom_instance_t* instance = dicom->instances + i;
-		if (instance->image_flavor == DICOM_IMAGE_FLAVOR_VOLUME) {
-			i64 pixel_count = instance->total_pixel_matrix_columns;
-			volume_image_widths[running_volume_index++] = (indexed_value_t){pixel_count, i};
-		}
-	}
-	i32 volume_count = running_volume_index;
-	qsort(volume_image_widths, volume_count, sizeof(indexed_value_t), compare_indexed_value);
-
-	// Verify that all the widths are different (we are not supporting concatenations or z-levels just yet)
-	i64 previous_width = 0;
-	bool ok = true;
-	for (i32 i = 0; i < volume_count; ++i) {
-		i64 width = volume_image_widths[i].value;
-		if (width == previous_width) {
-			ok = false;
-			break;
-		}
-		previous_width = width;
-	}
-	if (!ok) {
-		// TODO: handle concatenations
-		console_print("DICOM: multiple instances with same image width - can't determine levels\n");
-	} else {
-		dicom->wsi.level_count = volume_count;
-		for (i32 i = 0; i < volume_count; ++i) {
-			i32 instance_index = volume_image_widths[i].index;
-			dicom_instance_t* instance = dicom->instances + instance_index;
-			dicom->wsi.level_instances[i] = instance;
-			console_print("level %d: #=%d w=%u h=%u\n", i, instance_index, instance->total_pixel_matrix_columns, instance->total_pixel_matrix_rows);
-		}
-	}
-
-	ASSERT(dicom->wsi.level_count > 0);
-	dicom_instance_t* base_level_instance = dicom->wsi.level_instances[0];
-	ASSERT(base_level_instance);
-	if (base_level_instance) {
-		if (base_level_instance->pixel_spacing.x > 0 && base_level_instance->pixel_spacing.y > 0) {
-			dicom->wsi.is_mpp_known = true;
-			dicom->wsi.mpp_x = base_level_instance->pixel_spacing.x * 1000.0f;
-			dicom->wsi.mpp_y = base_level_instance->pixel_spacing.y * 1000.0f;
-		}
-	} else {
-		// TODO: handle error condition
+		console_print_verbose("%d: #=%d flavor=%s w=%u h=%u frames=%d concatenation=%d\n", i, instance->instance_number,
+		                      instance->image_flavor_cs.value, instance->total_pixel_matrix_columns,
+		                      instance->total_pixel_matrix_rows, (i32)instance->number_of_frames, instance->in_concatenation_number);
 	}
 
-
-	// Set up tiles
-	for (i32 i = 0; i < dicom->wsi.level_count; ++i) {
-		dicom_instance_t* instance = dicom->wsi.level_instances[i];
-
-		instance->width_in_tiles = (instance->total_pixel_matrix_columns + instance->columns - 1) / instance->columns;
-		instance->height_in_tiles = (instance->total_pixel_matrix_rows + instance->rows - 1) / instance->rows;
-		instance->tile_count = instance->width_in_tiles * instance->height_in_tiles;
-		instance->tiles = calloc(instance->tile_count, sizeof(dicom_tile_t));
-
-		if(arrlen(instance->per_frame_plane_position_slide) > 0) {
-			for (i32 frame_index = 0; frame_index < arrlen(instance->per_frame_plane_position_slide); ++frame_index) {
-				dicom_plane_position_slide_t* plane_position = instance->per_frame_plane_position_slide + frame_index;
-				i32 tile_x = plane_position->column_position_in_total_image_pixel_matrix / instance->columns;
-				i32 tile_y = plane_position->row_position_in_total_image_pixel_matrix / instance->rows;
-
-				dicom_tile_t* tile = instance->tiles + tile_y * instance->width_in_tiles + tile_x;
-				ASSERT(!tile->exists);
-				tile->exists = true;
-				tile->instance = instance; //NOTE: points to element in dicom_series->instances array
-				tile->frame_index = frame_index;
-				if (instance->pixel_data_offsets && instance->pixel_data_sizes) {
-					// TODO: bounds check
-					tile->data_offset_in_file = sizeof(dicom_header_t) + instance->pixel_data_start_offset + instance->pixel_data_offsets[frame_index];
-					tile->data_size = instance->pixel_data_sizes[frame_index];
-				}
-			}
-		} else {
-			// We don't have tile position information -> guess that all tiles are present in the logical order
-			ASSERT(instance->number_of_frames == instance->tile_count);
-			for (i32 tile_y = 0; tile_y < instance->height_in_tiles; ++tile_y) {
-				for (i32 tile_x = 0; tile_x < instance->width_in_tiles; ++tile_x) {
-					i32 frame_index = tile_y * instance->width_in_tiles + tile_x;
-					dicom_tile_t* tile = instance->tiles + frame_index;
-					ASSERT(!tile->exists);
-					tile->exists = true;
-					tile->instance = instance;
-					tile->frame_index = frame_index;
-					if (instance->pixel_data_offsets && instance->pixel_data_sizes) {
-						// TODO: bounds check
-						tile->data_offset_in_file = sizeof(dicom_header_t) + instance->pixel_data_start_offset + instance->pixel_data_offsets[frame_index];
-						tile->data_size = instance->pixel_data_sizes[frame_index];
-					}
-				}
-			}
-		}
-
+	// Group the instances into pyramid levels and index their frames.
+	if (!dicom_wsi_build_levels(dicom)) {
+		success = false;
 	}
 
 	// Reopen files for simultaneous access
@@ -1175,7 +1152,10 @@ bool dicom_open_from_directory(dicom_series_t* dicom, directory_info_t* director
 		if (!instance->file_handle) {
 			console_print_error("Error: Could not reopen file for asynchronous I/O: '%s'\n", instance->filename);
 			success = false;
+		} else {
+			file_mapping_open(&instance->file_mapping, instance->file_handle, FILE_MAPPING_ADVICE_RANDOM);
 		}
+		instance->frame_offsets_lock = benaphore_create();
 	}
 
 	console_print("DICOM parsing took %g seconds\n", get_seconds_elapsed(start, get_clock()));
@@ -1352,10 +1332,11 @@ void dicom_instance_destroy(dicom_instance_t* instance) {
 		platform_sleep(1);
 		do_worker_work(&global_work_queue, 0);
 	}
+	if (instance->frame_offsets_lock.semaphore) benaphore_destroy(&instance->frame_offsets_lock);
 	if (instance->pixel_data_offsets) free(instance->pixel_data_offsets);
 	if (instance->pixel_data_sizes) free(instance->pixel_data_sizes);
-	if (instance->tiles) free(instance->tiles);
 	arrfree(instance->per_frame_plane_position_slide);
+	file_mapping_close(&instance->file_mapping);
 	if (instance->file_handle) file_handle_close(instance->file_handle);
 }
 
@@ -1364,6 +1345,9 @@ void dicom_destroy(dicom_series_t* dicom_series) {
 		dicom_instance_t* instance = dicom_series->instances + i;
 		dicom_instance_destroy(instance);
 	}
+	for (i32 i = 0; i < COUNT(dicom_series->wsi.levels); ++i) {
+		if (dicom_series->wsi.levels[i].tiles) free(dicom_series->wsi.levels[i].tiles);
+	}
 }
 
 // Undo the encapsulation of encoded pixel data
@@ -1400,19 +1384,61 @@ i64 dicom_defragment_encapsulated_pixel_data_frame(u8* data, i64 len) {
 	return current_dest_offset; // return size of defragmented data
 }
 
-#if 0
-void dicom_read_pixel_data_offsets(dicom_instance_t* instance) {
-	if (instance->is_pixel_data_encapsulated && instance->found_pixel_data) {
-
-		if (instance->file_handle) {
-			i64 chunk_size = MEGABYTES(4);
-			temp_memory_t temp = begin_temp_memory_on_local_thread();
-
-			size_t bytes_to_read = MIN(bytes_left_in_file, chunk_size);
-			file_handle_read_at_offset(chunk, instance->file_handle, offset, bytes_to_read);
+// Without a basic offset table, the frame offsets can only be found by walking over the pixel data items.
+// Only the item headers (8 bytes each) are needed, so this touches a small part of the file.
+static bool dicom_read_pixel_data_offsets(dicom_instance_t* instance) {
+	ASSERT(instance->pixel_data_offsets && instance->pixel_data_sizes);
+	i64 offset = instance->pixel_data_start_offset; // relative to the start of the data stream
+	for (u32 frame_index = 0; frame_index < instance->pixel_data_offset_count; ++frame_index) {
+		if (offset + 8 > instance->total_bytes_in_stream) {
+			return false;
+		}
+		u8 item_header[8];
+		i64 offset_in_file = sizeof(dicom_header_t) + offset;
+		u8* mapped = file_mapping_get_range(&instance->file_mapping, offset_in_file, sizeof(item_header));
+		if (mapped) {
+			memcpy(item_header, mapped, sizeof(item_header));
+		} else if (file_handle_read_at_offset(item_header, instance->file_handle, offset_in_file, sizeof(item_header)) != sizeof(item_header)) {
+			return false;
+		}
+		dicom_data_element_t element = dicom_read_data_element(item_header, 0, DICOM_TRANSFER_SYNTAX_IMPLICIT_VR_LITTLE_ENDIAN, sizeof(item_header));
+		if (element.tag.as_u32 != DICOM_Item || element.length == DICOM_UNDEFINED_LENGTH) {
+			return false;
+		}
+		instance->pixel_data_offsets[frame_index] = offset - instance->pixel_data_start_offset;
+		instance->pixel_data_sizes[frame_index] = element.data_offset + element.length;
+		offset += element.data_offset + element.length;
+	}
+	return true;
+}
 
-			release_temp_memory(&temp);
+// Make sure the locations of the frames are known. Safe to call from multiple threads.
+bool dicom_instance_ensure_frame_offsets(dicom_instance_t* instance) {
+	if (instance->are_all_offsets_read) {
+		read_barrier;
+		return true;
+	}
+	if (!instance->is_pixel_data_encapsulated) {
+		return instance->found_pixel_data; // native frames are stored back to back, nothing to look up
+	}
+	if (!instance->found_pixel_data || !instance->pixel_data_offsets) {
+		return false;
+	}
+	benaphore_lock(&instance->frame_offsets_lock);
+	bool success = instance->are_all_offsets_read;
+	if (!success) {
+		i64 start = get_clock();
+		success = dicom_read_pixel_data_offsets(instance);
+		if (success) {
+			write_barrier;
+			instance->are_all_offsets_read = true;
+			console_print_verbose("DICOM: read %u frame offsets for instance #=%lld in %g seconds\n", instance->pixel_data_offset_count,
+			                      instance->instance_number, get_seconds_elapsed(start, get_clock()));
+		} else {
+			console_print_error("DICOM: could not read the frame offsets in '%s'\n", instance->filename);
+			instance->is_image_invalid = true;
 		}
 	}
+	benaphore_unlock(&instance->frame_offsets_lock);
+	return success;
 }
-#endif
@@ -82,6 +82,19 @@ typedef enum dicom_transfer_syntax_enum {
 	DICOM_TRANSFER_SYNTAX_EXPLICIT_VR_BIG_ENDIAN_RETIRED,
 } dicom_transfer_syntax_enum;
 
+// How the pixel data is encoded, as specified by the transfer syntax.
+// list of UIDs: https://dicom.nema.org/medical/dicom/current/output/chtml/part06/chapter_A.html
+typedef enum dicom_pixel_encoding_enum {
+	DICOM_PIXEL_ENCODING_UNKNOWN = 0,
+	DICOM_PIXEL_ENCODING_NATIVE,         // 1.2.840.10008.1.2, 1.2.840.10008.1.2.1, 1.2.840.10008.1.2.1.99
+	DICOM_PIXEL_ENCODING_JPEG_BASELINE,  // 1.2.840.10008.1.2.4.50 (and 1.2.840.10008.1.2.4.51 for 8-bit data)
+	DICOM_PIXEL_ENCODING_JPEG_LOSSLESS,  // 1.2.840.10008.1.2.4.57, 1.2.840.10008.1.2.4.70
+	DICOM_PIXEL_ENCODING_JPEG_LS,        // 1.2.840.10008.1.2.4.80, 1.2.840.10008.1.2.4.81
+	DICOM_PIXEL_ENCODING_JPEG_2000,      // 1.2.840.10008.1.2.4.90, 1.2.840.10008.1.2.4.91
+	DICOM_PIXEL_ENCODING_RLE,            // 1.2.840.10008.1.2.5
+	DICOM_PIXEL_ENCODING_COUNT
+} dicom_pixel_encoding_enum;
+
 typedef enum dicom_photometric_interpretation_enum {
 	DICOM_PHOTOMETRIC_INTERPRETATION_UNKNOWN = 0,
 	DICOM_PHOTOMETRIC_INTERPRETATION_MONOCHROME1 = 1,
@@ -118,6 +131,16 @@ typedef enum dicom_image_flavor_enum {
 	DICOM_IMAGE_FLAVOR_THUMBNAIL,
 } dicom_image_flavor_enum;
 
+// C.7.6.17.3 Dimension Organization Type
+// https://dicom.nema.org/medical/dicom/current/output/chtml/part03/sect_C.7.6.17.3.html
+typedef enum dicom_dimension_organization_enum {
+	DICOM_DIMENSION_ORGANIZATION_UNKNOWN = 0,
+	DICOM_DIMENSION_ORGANIZATION_TILED_FULL,   // frames are implicitly ordered: row-major tiles, then focal planes, then optical paths
+	DICOM_DIMENSION_ORGANIZATION_TILED_SPARSE, // every frame has an explicit position in the Per-Frame Functional Groups
+	DICOM_DIMENSION_ORGANIZATION_3D,
+	DICOM_DIMENSION_ORGANIZATION_3D_TEMPORAL,
+} dicom_dimension_organization_enum;
+
 typedef struct dicom_header_t {
 	u8 preamble[128]; // the preamble will be all zeroes, if not used by a specific application/implementation
 	union {
@@ -194,14 +217,16 @@ typedef struct dicom_parser_pos_t {
 } dicom_parser_pos_t;
 
 typedef struct dicom_tile_t {
-	dicom_instance_t* instance;
+	dicom_instance_t* instance; // the instance that contains the frame (may be part of a concatenation)
 	u32 frame_index;
-	u32 data_offset_in_file;
-	u32 data_size;
 	bool exists;
-	u8* data;
 } dicom_tile_t;
 
+typedef struct dicom_frame_location_t {
+	u64 offset_in_file;
+	u32 size;
+} dicom_frame_location_t;
+
 // C.8.12.6.1 Plane Position (Slide) Macro
 // https://dicom.nema.org/medical/dicom/current/output/chtml/part03/sect_C.8.12.6.html#sect_C.8.12.6.1
 typedef struct dicom_plane_position_slide_t {
@@ -218,6 +243,7 @@ typedef struct dicom_instance_t {
 	dicom_parser_callback_func_t* tag_handler_func;
 	char filename[512];
 	file_handle_t file_handle; // for simultaneous file access on multiple threads
+	file_mapping_t file_mapping; // if valid, single-fragment frames are decoded straight from the mapping
 	i32 nesting_level;
 	dicom_parser_pos_t pos_stack[16]; // one per nesting level, for keeping track where we need to push/pop during parsing
 	dicom_tag_t nested_sequences[8]; // one for every two nesting levels (sequences only, not sequence items)
@@ -231,8 +257,9 @@ typedef struct dicom_instance_t {
 	bool found_pixel_data;
 	bool is_pixel_data_encapsulated;
 	bool has_basic_offset_table;
-	bool are_all_offsets_read;
+	volatile bool are_all_offsets_read; // if false after parsing, the frame offsets are filled in on first access
 	bool need_parse_abort;
+	benaphore_t frame_offsets_lock;
 	dicom_data_element_t pixel_data;
 	u32* pixel_data_offsets; // malloc'ed
 	u32* pixel_data_sizes; // malloc'ed
@@ -240,6 +267,7 @@ typedef struct dicom_instance_t {
 	u32 pixel_data_offset_count;
 	dicom_uid_enum media_storage_sop_class_uid;
 	dicom_uid_enum transfer_syntax_uid;
+	dicom_pixel_encoding_enum pixel_encoding;
 	bool is_image_original;
 	dicom_cs_t image_flavor_cs;
 	dicom_image_flavor_enum image_flavor;
@@ -262,19 +290,34 @@ typedef struct dicom_instance_t {
 	v2f pixel_spacing;
 	u32 total_pixel_matrix_columns;
 	u32 total_pixel_matrix_rows;
-	i32 tile_count;
-	i32 width_in_tiles;
-	i32 height_in_tiles;
+	u32 total_pixel_matrix_focal_planes;
+	u32 number_of_optical_paths;
+	dicom_dimension_organization_enum dimension_organization;
+	char concatenation_uid[65]; // empty if the instance is not part of a concatenation
+	u16 in_concatenation_number;
+	u32 concatenation_frame_offset_number; // number of frames in the concatenation that precede this instance
 	v2f origin_offset;
-	dicom_tile_t* tiles; // malloc'ed
 	dicom_plane_position_slide_t current_plane_position_slide; // for parsing only
 	dicom_plane_position_slide_t* per_frame_plane_position_slide; // array
 } dicom_instance_t;
 
+// All frames of one pyramid level, which may be spread out across several instances (concatenations or separately
+// stored focal planes). The tiles form a dense index, so looking up the frame for a tile is O(1).
+typedef struct dicom_wsi_level_t {
+	dicom_instance_t* instance; // reference instance for the frame properties (tile size, encoding, color space)
+	i32 instance_count;
+	i32 width_in_tiles;
+	i32 height_in_tiles;
+	i32 tile_count; // per focal plane
+	i32 focal_plane_count;
+	i32 default_focal_plane; // the plane that is displayed
+	dicom_tile_t* tiles; // malloc'ed; index = (focal_plane * height_in_tiles + tile_y) * width_in_tiles + tile_x
+} dicom_wsi_level_t;
+
 typedef struct dicom_wsi_t {
 	dicom_instance_t* label_instance;
 	i32 level_count;
-	dicom_instance_t* level_instances[16];
+	dicom_wsi_level_t levels[16];
 	float mpp_x;
 	float mpp_y;
 	bool is_mpp_known;
@@ -297,6 +340,8 @@ typedef struct file_info_t file_info_t;
 bool dicom_init();
 void dicom_destroy(dicom_series_t* dicom_series);
 void dicom_instance_destroy(dicom_instance_t* instance);
+bool dicom_instance_ensure_frame_offsets(dicom_instance_t* instance);
+dicom_frame_location_t dicom_instance_get_frame_location(dicom_instance_t* instance, u32 frame_index);
 bool is_file_a_dicom_file(u8* file_header_data, size_t file_header_data_len);
 bool dicom_open_from_directory(dicom_series_t* dicom, directory_info_t* directory);
 bool dicom_open_from_file(dicom_series_t* dicom, file_info_t* file);
@@ -17,6 +17,8 @@
 */
 
 #include "common.h"
+#include "platform.h"
+#include "intrinsics.h"
 #include "dicom.h"
 #include "dicom_wsi.h"
 
@@ -292,6 +294,57 @@ void dicom_wsi_interpret_top_level_data_element(dicom_instance_t* instance, dico
 			// Total number of rows in pixel matrix; i.e., height of total imaged volume in pixels.
 			instance->total_pixel_matrix_rows = *(u32*)data;
 		} break;
+		case DICOM_TotalPixelMatrixFocalPlanes: {
+			// Type 1C
+			// Number of focal planes in the Total Pixel Matrix. Required if Dimension Organization Type is TILED_FULL.
+			instance->total_pixel_matrix_focal_planes = *(u32*)data;
+		} break;
+		case DICOM_NumberOfOpticalPaths: {
+			// Type 1C
+			// Number of optical paths in the Total Pixel Matrix. Required if Dimension Organization Type is TILED_FULL.
+			instance->number_of_optical_paths = *(u32*)data;
+		} break;
+
+		// C.7.6.17 Multi-frame Dimension Module
+		// https://dicom.nema.org/medical/dicom/current/output/chtml/part03/sect_C.7.6.17.html
+		case DICOM_DimensionOrganizationType: {
+			// Type 3
+			// Dimension organization of the frames: TILED_FULL, TILED_SPARSE, 3D or 3D_TEMPORAL.
+			dicom_cs_t cs = dicom_parse_code_string((str_t){data_str, element.length}, NULL);
+			if (strcmp(cs.value, "TILED_FULL") == 0) {
+				instance->dimension_organization = DICOM_DIMENSION_ORGANIZATION_TILED_FULL;
+			} else if (strcmp(cs.value, "TILED_SPARSE") == 0) {
+				instance->dimension_organization = DICOM_DIMENSION_ORGANIZATION_TILED_SPARSE;
+			} else if (strcmp(cs.value, "3D") == 0) {
+				instance->dimension_organization = DICOM_DIMENSION_ORGANIZATION_3D;
+			} else if (strcmp(cs.value, "3D_TEMPORAL") == 0) {
+				instance->dimension_organization = DICOM_DIMENSION_ORGANIZATION_3D_TEMPORAL;
+			}
+		} break;
+
+		// C.7.6.16.2.2 Multi-frame Functional Groups Module: concatenations
+		// https://dicom.nema.org/medical/dicom/current/output/chtml/part03/sect_C.7.6.16.html#sect_C.7.6.16.1.3
+		case DICOM_ConcatenationUID: {
+			// Type 1C
+			// Identifier of all SOP Instances that belong to the same Concatenation.
+			u32 length = MIN(element.length, sizeof(instance->concatenation_uid) - 1);
+			while (length > 0 && (data_str[length-1] == '\0' || data_str[length-1] == ' ')) {
+				--length; // strip padding
+			}
+			memcpy(instance->concatenation_uid, data_str, length);
+			instance->concatenation_uid[length] = '\0';
+		} break;
+		case DICOM_InConcatenationNumber: {
+			// Type 1C
+			// Identifier for one SOP Instance belonging to a Concatenation. The first instance has value 1.
+			instance->in_concatenation_number = *(u16*)data;
+		} break;
+		case DICOM_ConcatenationFrameOffsetNumber: {
+			// Type 1C
+			// Offset of the first frame in a multi-frame image of a concatenation. Logical frame numbers in a
+			// concatenation can be used across all of its SOP Instances. Offset numbers begin with 0.
+			instance->concatenation_frame_offset_number = *(u32*)data;
+		} break;
 	}
 }
 
@@ -351,18 +404,262 @@ void dicom_wsi_finalize_sequence_item(dicom_instance_t* instance) {
 	}
 }
 
-u8* dicom_wsi_decode_tile_to_bgra(dicom_series_t* dicom_series, i32 scale, i32 tile_index) {
-	dicom_instance_t* instance = dicom_series->wsi.level_instances[scale];
-	ASSERT(instance);
-	if (!instance) return NULL;
-	dicom_tile_t* dicom_tile = instance->tiles + tile_index;
-	size_t read_size = dicom_tile->data_size;
-	if (dicom_tile->data_size == DICOM_UNDEFINED_LENGTH) {
+// Sort by descending width; instances of the same size (concatenations) stay in their logical order.
+static int dicom_compare_volume_instances(const void* a_raw, const void* b_raw) {
+	dicom_instance_t* a = *(dicom_instance_t**)a_raw;
+	dicom_instance_t* b = *(dicom_instance_t**)b_raw;
+	if (a->total_pixel_matrix_columns != b->total_pixel_matrix_columns) {
+		return (a->total_pixel_matrix_columns > b->total_pixel_matrix_columns) ? -1 : 1;
+	}
+	if (a->in_concatenation_number != b->in_concatenation_number) {
+		return (a->in_concatenation_number < b->in_concatenation_number) ? -1 : 1;
+	}
+	if (a->instance_number != b->instance_number) {
+		return (a->instance_number < b->instance_number) ? -1 : 1;
+	}
+	return 0;
+}
+
+static inline bool dicom_instance_has_explicit_frame_positions(dicom_instance_t* instance) {
+	return instance->number_of_frames > 0 && arrlen(instance->per_frame_plane_position_slide) >= instance->number_of_frames;
+}
+
+// Find the tile position and focal plane of a frame. The focal plane is identified by a key: the Z offset if the frame
+// has an explicit position (TILED_SPARSE), or otherwise the focal plane number in the TILED_FULL order, made unique
+// for each group of instances (a concatenation, or a single instance).
+static bool dicom_wsi_get_frame_position(dicom_wsi_level_t* level, dicom_instance_t* instance, u32 frame_index, i32 group_index,
+                                         i32* tile_x, i32* tile_y, float* focal_plane_key) {
+	if (dicom_instance_has_explicit_frame_positions(instance)) {
+		// Positions are 1-based; the top left pixel of the Total Pixel Matrix is at (1,1).
+		dicom_plane_position_slide_t* position = instance->per_frame_plane_position_slide + frame_index;
+		*tile_x = ATLEAST(0, position->column_position_in_total_image_pixel_matrix - 1) / instance->columns;
+		*tile_y = ATLEAST(0, position->row_position_in_total_image_pixel_matrix - 1) / instance->rows;
+		*focal_plane_key = position->z_offset_in_slide_coordinate_system;
+	} else {
+		if (instance->dimension_organization == DICOM_DIMENSION_ORGANIZATION_TILED_SPARSE) {
+			return false; // positions are missing
+		}
+		// TILED_FULL: frames are ordered by row-major tile position, then focal plane, then optical path.
+		// Only the first optical path is used.
+		u64 logical_frame_index = (u64)instance->concatenation_frame_offset_number + frame_index;
+		u32 focal_plane_count = ATLEAST(1, instance->total_pixel_matrix_focal_planes);
+		u64 focal_plane = logical_frame_index / level->tile_count;
+		if (focal_plane >= focal_plane_count) {
+			return false;
+		}
+		i32 tile_index = (i32)(logical_frame_index % level->tile_count);
+		*tile_x = tile_index % level->width_in_tiles;
+		*tile_y = tile_index / level->width_in_tiles;
+		*focal_plane_key = (float)(group_index * focal_plane_count + focal_plane);
+	}
+	return (*tile_x < level->width_in_tiles && *tile_y < level->height_in_tiles);
+}
+
+static int dicom_compare_float(const void* a_raw, const void* b_raw) {
+	float a = *(float*)a_raw;
+	float b = *(float*)b_raw;
+	return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
+static i32 dicom_find_focal_plane(float* keys, i32 key_count, float key) {
+	for (i32 i = 0; i < key_count; ++i) {
+		if (fabsf(keys[i] - key) < 1e-6f) return i;
+	}
+	return -1;
+}
+
+// Build the (tile_x, tile_y, focal plane) -> (instance, frame) index for one level.
+static void dicom_wsi_index_level(dicom_wsi_level_t* level, dicom_instance_t** instances, i32 instance_count) {
+	// Group concatenated instances, so that their focal planes line up.
+	i32* group_indices = alloca(instance_count * sizeof(i32));
+	i32 group_count = 0;
+	for (i32 i = 0; i < instance_count; ++i) {
+		group_indices[i] = -1;
+		if (instances[i]->concatenation_uid[0] != '\0') {
+			for (i32 j = 0; j < i; ++j) {
+				if (strcmp(instances[i]->concatenation_uid, instances[j]->concatenation_uid) == 0) {
+					group_indices[i] = group_indices[j];
+					break;
+				}
+			}
+		}
+		if (group_indices[i] < 0) {
+			group_indices[i] = group_count++;
+		}
+	}
+
+	// First pass: find the focal planes
+	float* focal_plane_keys = NULL;
+	for (i32 i = 0; i < instance_count; ++i) {
+		dicom_instance_t* instance = instances[i];
+		for (u32 frame_index = 0; frame_index < instance->number_of_frames; ++frame_index) {
+			i32 tile_x, tile_y;
+			float key;
+			if (dicom_wsi_get_frame_position(level, instance, frame_index, group_indices[i], &tile_x, &tile_y, &key)) {
+				if (dicom_find_focal_plane(focal_plane_keys, arrlen(focal_plane_keys), key) < 0) {
+					arrput(focal_plane_keys, key);
+				}
+			}
+		}
+	}
+	level->focal_plane_count = ATLEAST(1, arrlen(focal_plane_keys));
+	if (arrlen(focal_plane_keys) > 1) {
+		qsort(focal_plane_keys, arrlen(focal_plane_keys), sizeof(float), dicom_compare_float);
+	}
+
+	// Second pass: fill in the tiles
+	level->tiles = calloc((size_t)level->tile_count * level->focal_plane_count, sizeof(dicom_tile_t));
+	i32* frames_per_focal_plane = alloca(level->focal_plane_count * sizeof(i32));
+	memset(frames_per_focal_plane, 0, level->focal_plane_count * sizeof(i32));
+	i32 skipped_frame_count = 0;
+	for (i32 i = 0; i < instance_count; ++i) {
+		dicom_instance_t* instance = instances[i];
+		for (u32 frame_index = 0; frame_index < instance->number_of_frames; ++frame_index) {
+			i32 tile_x, tile_y;
+			float key;
+			i32 focal_plane = -1;
+			if (dicom_wsi_get_frame_position(level, instance, frame_index, group_indices[i], &tile_x, &tile_y, &key)) {
+				focal_plane = dicom_find_focal_plane(focal_plane_keys, arrlen(focal_plane_keys), key);
+			}
+			dicom_tile_t* tile = (focal_plane >= 0) ? dicom_wsi_get_tile(level, tile_x, tile_y, focal_plane) : NULL;
+			if (!tile || tile->exists) {
+				++skipped_frame_count; // unknown position, other optical path, or duplicate
+				continue;
+			}
+			tile->exists = true;
+			tile->instance = instance; //NOTE: points to element in dicom_series->instances array
+			tile->frame_index = frame_index;
+			++frames_per_focal_plane[focal_plane];
+		}
+	}
+	if (skipped_frame_count > 0) {
+		console_print_verbose("DICOM: %d frames were not indexed (duplicate or unsupported position)\n", skipped_frame_count);
+	}
+
+	// Display the most complete focal plane (for ties, the one closest to the middle of the stack).
+	level->default_focal_plane = 0;
+	for (i32 i = 1; i < level->focal_plane_count; ++i) {
+		i32 best = level->default_focal_plane;
+		i32 middle = level->focal_plane_count / 2;
+		if (frames_per_focal_plane[i] > frames_per_focal_plane[best] ||
+		    (frames_per_focal_plane[i] == frames_per_focal_plane[best] && abs(i - middle) < abs(best - middle))) {
+			level->default_focal_plane = i;
+		}
+	}
+	arrfree(focal_plane_keys);
+}
+
+// Group the VOLUME instances into pyramid levels, and index the frames of each level.
+bool dicom_wsi_build_levels(dicom_series_t* dicom) {
+	dicom_wsi_t* wsi = &dicom->wsi;
+	dicom_instance_t** volumes = NULL;
+	for (i32 i = 0; i < arrlen(dicom->instances); ++i) {
+		dicom_instance_t* instance = dicom->instances + i;
+		if (instance->image_flavor == DICOM_IMAGE_FLAVOR_VOLUME && instance->total_pixel_matrix_columns > 0 &&
+		    instance->total_pixel_matrix_rows > 0 && instance->columns > 0 && instance->rows > 0) {
+			arrput(volumes, instance);
+		}
+	}
+	i32 volume_count = arrlen(volumes);
+	if (volume_count == 0) {
+		console_print_error("DICOM: series does not contain any VOLUME images\n");
+		return false;
+	}
+	qsort(volumes, volume_count, sizeof(dicom_instance_t*), dicom_compare_volume_instances);
+
+	// Assign each volume to the downsampling level that matches its size relative to the base level.
+	// The pyramid may have gaps (e.g. only levels 0, 2 and 4); see dicom_wsi_get_level_source() for how those are filled in.
+	// Instances with the same size (concatenations, or focal planes stored separately) end up in the same level.
+	dicom_instance_t* base_instance = volumes[0];
+	i32* volume_levels = alloca(volume_count * sizeof(i32));
+	i32 level_count = 0;
+	for (i32 i = 0; i < volume_count; ++i) {
+		dicom_instance_t* instance = volumes[i];
+		float downsample_factor = (float)base_instance->total_pixel_matrix_columns / (float)instance->total_pixel_matrix_columns;
+		i32 level_index = (i32)roundf(log2f(downsample_factor));
+		volume_levels[i] = -1;
+		if (level_index < 0 || level_index >= COUNT(wsi->levels)) {
+			console_print("DICOM: skipping instance #=%d w=%u h=%u (no matching level)\n", (i32)instance->instance_number,
+			              instance->total_pixel_matrix_columns, instance->total_pixel_matrix_rows);
+			continue;
+		}
+		dicom_wsi_level_t* level = wsi->levels + level_index;
+		if (!level->instance) {
+			level->instance = instance;
+			level->width_in_tiles = (instance->total_pixel_matrix_columns + instance->columns - 1) / instance->columns;
+			level->height_in_tiles = (instance->total_pixel_matrix_rows + instance->rows - 1) / instance->rows;
+			level->tile_count = level->width_in_tiles * level->height_in_tiles;
+		} else if (instance->total_pixel_matrix_columns != level->instance->total_pixel_matrix_columns ||
+		           instance->total_pixel_matrix_rows != level->instance->total_pixel_matrix_rows ||
+		           instance->columns != level->instance->columns || instance->rows != level->instance->rows) {
+			console_print("DICOM: skipping instance #=%d w=%u h=%u (does not match the other instances in level %d)\n",
+			              (i32)instance->instance_number, instance->total_pixel_matrix_columns,
+			              instance->total_pixel_matrix_rows, level_index);
+			continue;
+		}
+		++level->instance_count;
+		volume_levels[i] = level_index;
+		level_count = MAX(level_count, level_index + 1);
+	}
+	wsi->level_count = level_count;
+
+	for (i32 level_index = 0; level_index < level_count; ++level_index) {
+		dicom_wsi_level_t* level = wsi->levels + level_index;
+		if (!level->instance) continue; // missing level
+		dicom_instance_t** level_volumes = alloca(level->instance_count * sizeof(dicom_instance_t*));
+		i32 level_volume_count = 0;
+		for (i32 i = 0; i < volume_count; ++i) {
+			if (volume_levels[i] == level_index) {
+				level_volumes[level_volume_count++] = volumes[i];
+			}
+		}
+		dicom_wsi_index_level(level, level_volumes, level_volume_count);
+		console_print("level %d: w=%u h=%u, %d instance(s), %d focal plane(s)\n", level_index,
+		              level->instance->total_pixel_matrix_columns, level->instance->total_pixel_matrix_rows,
+		              level->instance_count, level->focal_plane_count);
+	}
+	arrfree(volumes);
+
+	dicom_instance_t* base_level_instance = wsi->levels[0].instance;
+	ASSERT(base_level_instance);
+	if (base_level_instance->pixel_spacing.x > 0 && base_level_instance->pixel_spacing.y > 0) {
+		wsi->is_mpp_known = true;
+		wsi->mpp_x = base_level_instance->pixel_spacing.x * 1000.0f;
+		wsi->mpp_y = base_level_instance->pixel_spacing.y * 1000.0f;
+	}
+	return true;
+}
+
+static dicom_pixel_encoding_enum dicom_get_pixel_encoding(dicom_instance_t* instance) {
+	if (instance->pixel_encoding == DICOM_PIXEL_ENCODING_UNKNOWN &&
+	    instance->lossy_image_compression_method == DICOM_LOSSY_IMAGE_COMPRESSION_METHOD_ISO_10918_1) {
+		return DICOM_PIXEL_ENCODING_JPEG_BASELINE; // no transfer syntax found, but the image says it is JPEG
+	}
+	return instance->pixel_encoding;
+}
+
+static inline bool dicom_is_ycbcr(dicom_instance_t* instance) {
+	return instance->photometric_interpretation != DICOM_PHOTOMETRIC_INTERPRETATION_RGB;
+}
+
+// Returns the compressed frame data for a tile, either straight from the file mapping or defragmented into the thread's
+// temporary arena. Returns NULL if the frame could not be read.
+static u8* dicom_read_frame_data(dicom_tile_t* dicom_tile, i64* data_size_ptr) {
+	dicom_instance_t* instance = dicom_tile->instance;
+	if (!dicom_instance_ensure_frame_offsets(instance)) {
+		return NULL;
+	}
+	dicom_frame_location_t location = dicom_instance_get_frame_location(instance, dicom_tile->frame_index);
+	if (location.size == 0) {
+		return NULL;
+	}
+	size_t read_size = location.size;
+	if (location.size == DICOM_UNDEFINED_LENGTH) {
 		u8 temp[12];
-		size_t bytes_read = file_handle_read_at_offset(temp, instance->file_handle, dicom_tile->data_offset_in_file, 12);
+		size_t bytes_read = file_handle_read_at_offset(temp, instance->file_handle, location.offset_in_file, 12);
 		dicom_data_element_t element = dicom_read_data_element(temp, 0, instance->encoding, bytes_read);
 		if (element.tag.as_u32 == DICOM_Item) {
-			read_size = element.length; // TODO: bounds/sanity checks
+			read_size = element.data_offset + element.length; // including the item header // TODO: bounds/sanity checks
 		} else {
 			ASSERT(!"could not read a valid Item");
 			return NULL;
@@ -372,26 +669,304 @@ u8* dicom_wsi_decode_tile_to_bgra(dicom_series_t* dicom_series, i32 scale, i32 t
 		ASSERT(!"unknown length");
 		return NULL;
 	}
-	u8* compressed_tile_data = (u8*)arena_push_size(&local_thread_memory->temp_arena, read_size);
-	file_handle_read_at_offset(compressed_tile_data, instance->file_handle, dicom_tile->data_offset_in_file, read_size);
-
-	// TODO: handle native pixel data instead of encapsulated
-	i64 data_size = dicom_defragment_encapsulated_pixel_data_frame(compressed_tile_data, read_size);
-	if (data_size > 0) {
-		if (instance->lossy_image_compression_method == DICOM_LOSSY_IMAGE_COMPRESSION_METHOD_ISO_10918_1) {
-			// JPEG compression
-			i32 width = 0;
-			i32 height = 0;
-			i32 channels_in_file = 0;
-			u8* pixels = jpeg_decode_image(compressed_tile_data, data_size, &width, &height, &channels_in_file);
-			if (pixels && width == instance->columns && height == instance->rows && channels_in_file == 4) {
-				// success
-				return pixels;
-			} else {
-				if (pixels) free(pixels);
+	u8* compressed_tile_data = NULL;
+	i64 data_size = 0;
+
+	// Most frames consist of a single fragment. In that case the JPEG stream can be decoded straight from the
+	// file mapping, otherwise the fragments need to be copied together first.
+	u8* mapped = file_mapping_get_range(&instance->file_mapping, location.offset_in_file, read_size);
+	if (mapped) {
+		dicom_data_element_t element = dicom_read_data_element(mapped, 0, DICOM_TRANSFER_SYNTAX_IMPLICIT_VR_LITTLE_ENDIAN, read_size);
+		if (element.tag.as_u32 == DICOM_Item && element.length <= read_size - element.data_offset) {
+			i64 fragment_end = element.data_offset + element.length;
+			bool is_single_fragment = (fragment_end == read_size);
+			if (!is_single_fragment && read_size - fragment_end >= 8) {
+				dicom_data_element_t next = dicom_read_data_element(mapped, fragment_end, DICOM_TRANSFER_SYNTAX_IMPLICIT_VR_LITTLE_ENDIAN, read_size - fragment_end);
+				is_single_fragment = (next.tag.as_u32 == DICOM_SequenceDelimitationItem);
+			}
+			if (is_single_fragment) {
+				compressed_tile_data = mapped + element.data_offset;
+				data_size = element.length;
+			}
+		}
+	}
+
+	if (!compressed_tile_data) {
+		compressed_tile_data = (u8*)arena_push_size(&local_thread_memory->temp_arena, read_size);
+		if (mapped) {
+			memcpy(compressed_tile_data, mapped, read_size);
+		} else {
+			file_handle_read_at_offset(compressed_tile_data, instance->file_handle, location.offset_in_file, read_size);
+		}
+		// TODO: handle native pixel data instead of encapsulated
+		data_size = dicom_defragment_encapsulated_pixel_data_frame(compressed_tile_data, read_size);
+	}
+	*data_size_ptr = data_size;
+	return data_size > 0 ? compressed_tile_data : NULL;
+}
+
+// For a level that is missing from the pyramid, find the nearest finer level it can be synthesized from.
+// JPEG DCT scaling goes down to 1/8, so the source can be at most 3 levels finer.
+dicom_wsi_level_t* dicom_wsi_get_level_source(dicom_wsi_t* wsi, i32 scale, i32* scale_shift) {
+	for (i32 shift = 0; shift <= 3 && shift <= scale; ++shift) {
+		dicom_wsi_level_t* level = wsi->levels + (scale - shift);
+		dicom_instance_t* instance = level->instance;
+		if (!instance) continue;
+		if (shift > 0) {
+			u32 divisor_mask = (1u << shift) - 1;
+			if (dicom_get_pixel_encoding(instance) != DICOM_PIXEL_ENCODING_JPEG_BASELINE ||
+			    (instance->columns & divisor_mask) != 0 || (instance->rows & divisor_mask) != 0) {
 				return NULL;
 			}
 		}
+		*scale_shift = shift;
+		return level;
 	}
 	return NULL;
 }
+
+// Synthesize a tile for a missing level by decoding the (2^scale_shift)^2 tiles it covers in the finer level at reduced
+// resolution (DCT scaling).
+static u8* dicom_wsi_decode_downscaled_tile(dicom_wsi_level_t* level, i32 scale_shift, i32 tile_x, i32 tile_y) {
+	dicom_instance_t* instance = level->instance;
+	u32 tile_width = instance->columns;
+	u32 tile_height = instance->rows;
+	u32 part_width = tile_width >> scale_shift;
+	u32 part_height = tile_height >> scale_shift;
+	u32 pitch = tile_width * 4;
+	u8* pixels = (u8*)tile_pixels_alloc(tile_height * pitch);
+	memset(pixels, 0xFF, tile_height * pitch);
+	bool is_ycbcr = dicom_is_ycbcr(instance);
+
+	i32 parts_per_side = 1 << scale_shift;
+	i32 parts_decoded = 0;
+	for (i32 part_y = 0; part_y < parts_per_side; ++part_y) {
+		i32 source_tile_y = (tile_y << scale_shift) + part_y;
+		if (source_tile_y >= level->height_in_tiles) break;
+		for (i32 part_x = 0; part_x < parts_per_side; ++part_x) {
+			i32 source_tile_x = (tile_x << scale_shift) + part_x;
+			if (source_tile_x >= level->width_in_tiles) break;
+			dicom_tile_t* source_tile = dicom_wsi_get_tile(level, source_tile_x, source_tile_y, level->default_focal_plane);
+			if (!source_tile->exists) continue;
+
+			temp_memory_t temp_memory = begin_temp_memory_on_local_thread();
+			i64 data_size = 0;
+			u8* compressed = dicom_read_frame_data(source_tile, &data_size);
+			if (compressed) {
+				u8* dest = pixels + (part_y * part_height) * pitch + (part_x * part_width) * 4;
+				if (jpeg_decode_tile_downscaled(NULL, 0, compressed, data_size, dest, pitch, part_width, part_height, is_ycbcr, scale_shift)) {
+					++parts_decoded;
+				}
+			}
+			release_temp_memory(&temp_memory);
+		}
+	}
+	if (parts_decoded == 0) {
+		tile_pixels_free(pixels);
+		return NULL;
+	}
+	return pixels;
+}
+
+// Convert interleaved 8-bit RGB to BGRA.
+// This also works in place, if the RGB data is stored in the last 3/4 of the destination buffer (src == dest + pixel_count).
+static void dicom_convert_rgb_to_bgra(u8* src, u32* dest, i64 pixel_count) {
+	i64 i = 0;
+#if defined(__SSE2__) && defined(__SSSE3__)
+	// 16 pixels per iteration. The last load reads 4 bytes past the 48 bytes of the block, so stop in time.
+	// All loads happen before the stores, so that the in-place case never overwrites RGB data that is still needed.
+	__m128i v_perm = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	__m128i v_alpha = _mm_set1_epi32(0xFF000000);
+	for (; (i + 16) * 3 + 4 <= pixel_count * 3; i += 16) {
+		u8* s = src + i * 3;
+		__m128i p0 = _mm_loadu_si128((__m128i*)(s));
+		__m128i p1 = _mm_loadu_si128((__m128i*)(s + 12));
+		__m128i p2 = _mm_loadu_si128((__m128i*)(s + 24));
+		__m128i p3 = _mm_loadu_si128((__m128i*)(s + 36));
+		p0 = _mm_or_si128(_mm_shuffle_epi8(p0, v_perm), v_alpha);
+		p1 = _mm_or_si128(_mm_shuffle_epi8(p1, v_perm), v_alpha);
+		p2 = _mm_or_si128(_mm_shuffle_epi8(p2, v_perm), v_alpha);
+		p3 = _mm_or_si128(_mm_shuffle_epi8(p3, v_perm), v_alpha);
+		_mm_storeu_si128((__m128i*)(dest + i), p0);
+		_mm_storeu_si128((__m128i*)(dest + i + 4), p1);
+		_mm_storeu_si128((__m128i*)(dest + i + 8), p2);
+		_mm_storeu_si128((__m128i*)(dest + i + 12), p3);
+	}
+#endif
+	for (; i < pixel_count; ++i) {
+		u8* s = src + i * 3;
+		dest[i] = 0xFF000000 | ((u32)s[0] << 16) | ((u32)s[1] << 8) | (u32)s[2];
+	}
+}
+
+// Native (uncompressed) pixel data. Only 8 bits per sample are supported.
+static bool dicom_decode_native_frame(dicom_instance_t* instance, u8* frame_data, i64 frame_size, u8* pixels) {
+	i64 pixel_count = (i64)instance->columns * instance->rows;
+	u32* dest = (u32*)pixels;
+	if (instance->bits_allocated != 8 || frame_size < pixel_count * instance->samples_per_pixel) {
+		return false;
+	}
+	if (instance->samples_per_pixel == 3 && instance->photometric_interpretation == DICOM_PHOTOMETRIC_INTERPRETATION_RGB) {
+		if (instance->planar_configuration == 0) {
+			dicom_convert_rgb_to_bgra(frame_data, dest, pixel_count);
+		} else {
+			u8* r = frame_data;
+			u8* g = frame_data + pixel_count;
+			u8* b = frame_data + 2 * pixel_count;
+			for (i64 i = 0; i < pixel_count; ++i) {
+				dest[i] = 0xFF000000 | ((u32)r[i] << 16) | ((u32)g[i] << 8) | (u32)b[i];
+			}
+		}
+		return true;
+	} else if (instance->samples_per_pixel == 1) {
+		u8 invert = (instance->photometric_interpretation == DICOM_PHOTOMETRIC_INTERPRETATION_MONOCHROME1) ? 0xFF : 0;
+		for (i64 i = 0; i < pixel_count; ++i) {
+			u32 value = frame_data[i] ^ invert;
+			dest[i] = 0xFF000000 | (value << 16) | (value << 8) | value;
+		}
+		return true;
+	}
+	return false;
+}
+
+static bool dicom_decode_jpeg_frame(dicom_instance_t* instance, u8* frame_data, i64 frame_size, u8* pixels) {
+	return jpeg_decode_tile_downscaled(NULL, 0, frame_data, frame_size, pixels, instance->columns * 4,
+	                                   instance->columns, instance->rows, dicom_is_ycbcr(instance), 0);
+}
+
+// RLE Lossless: every sample plane is a separate PackBits segment (R, G, B for color images).
+// https://dicom.nema.org/medical/dicom/current/output/chtml/part05/sect_G.3.html
+static bool dicom_decode_rle_frame(dicom_instance_t* instance, u8* frame_data, i64 frame_size, u8* pixels) {
+	if (instance->bits_allocated != 8 || frame_size < 64) {
+		return false;
+	}
+	u32 segment_count = *(u32*)frame_data;
+	u32* segment_offsets = (u32*)frame_data + 1;
+	if (segment_count != instance->samples_per_pixel || segment_count > 3) {
+		return false;
+	}
+	i64 pixel_count = (i64)instance->columns * instance->rows;
+	memset(pixels, 0xFF, pixel_count * 4);
+	for (u32 segment = 0; segment < segment_count; ++segment) {
+		i64 pos = segment_offsets[segment];
+		i64 end = (segment + 1 < segment_count) ? segment_offsets[segment + 1] : frame_size;
+		if (pos < 64 || end > frame_size || pos > end) {
+			return false;
+		}
+		// Samples are written into the B, G and R bytes of the BGRA output; monochrome images fill all three.
+		i32 channel_offset = (segment_count == 3) ? 2 - (i32)segment : 0;
+		i32 channel_count = (segment_count == 3) ? 1 : 3;
+		i64 i = 0;
+		while (pos < end && i < pixel_count) {
+			i8 n = (i8)frame_data[pos++];
+			if (n >= 0) {
+				i64 run = MIN((i64)n + 1, MIN(end - pos, pixel_count - i));
+				for (i64 k = 0; k < run; ++k, ++i) {
+					for (i32 c = 0; c < channel_count; ++c) pixels[i * 4 + channel_offset + c] = frame_data[pos + k];
+				}
+				pos += n + 1;
+			} else if (n != -128 && pos < end) {
+				u8 value = frame_data[pos++];
+				i64 run = MIN(1 - (i64)n, pixel_count - i);
+				for (i64 k = 0; k < run; ++k, ++i) {
+					for (i32 c = 0; c < channel_count; ++c) pixels[i * 4 + channel_offset + c] = value;
+				}
+			}
+		}
+		if (instance->photometric_interpretation == DICOM_PHOTOMETRIC_INTERPRETATION_MONOCHROME1) {
+			for (i64 k = 0; k < pixel_count; ++k) {
+				pixels[k * 4] ^= 0xFF;
+				pixels[k * 4 + 1] ^= 0xFF;
+				pixels[k * 4 + 2] ^= 0xFF;
+			}
+		}
+	}
+	return true;
+}
+
+// Frame codecs, indexed by pixel encoding (transfer syntax). A codec decodes one frame into a BGRA buffer of
+// columns x rows pixels. Codecs without a decoder can be plugged in using dicom_wsi_register_frame_codec().
+static dicom_frame_codec_t dicom_frame_codecs[DICOM_PIXEL_ENCODING_COUNT] = {
+	[DICOM_PIXEL_ENCODING_UNKNOWN] = {"unknown", NULL},
+	[DICOM_PIXEL_ENCODING_NATIVE] = {"native", dicom_decode_native_frame},
+	[DICOM_PIXEL_ENCODING_JPEG_BASELINE] = {"JPEG baseline", dicom_decode_jpeg_frame},
+	[DICOM_PIXEL_ENCODING_JPEG_LOSSLESS] = {"JPEG lossless", NULL},
+	[DICOM_PIXEL_ENCODING_JPEG_LS] = {"JPEG-LS", NULL},
+	[DICOM_PIXEL_ENCODING_JPEG_2000] = {"JPEG 2000", NULL},
+	[DICOM_PIXEL_ENCODING_RLE] = {"RLE lossless", dicom_decode_rle_frame},
+};
+
+void dicom_wsi_register_frame_codec(dicom_pixel_encoding_enum pixel_encoding, const char* name, dicom_frame_decode_func_t* decode) {
+	ASSERT(pixel_encoding > DICOM_PIXEL_ENCODING_UNKNOWN && pixel_encoding < DICOM_PIXEL_ENCODING_COUNT);
+	dicom_frame_codecs[pixel_encoding].name = name;
+	dicom_frame_codecs[pixel_encoding].decode = decode;
+}
+
+// Native frames are not encapsulated. If the file is mapped, they are converted straight from the mapping; otherwise
+// they are read into the end of the tile buffer and converted in place.
+static u8* dicom_read_native_frame_data(dicom_tile_t* dicom_tile, u8* pixels, i64* data_size_ptr) {
+	dicom_instance_t* instance = dicom_tile->instance;
+	dicom_frame_location_t location = dicom_instance_get_frame_location(instance, dicom_tile->frame_index);
+	i64 pixel_buffer_size = (i64)instance->columns * instance->rows * 4;
+	i64 frame_size = location.size;
+	*data_size_ptr = frame_size;
+	if (frame_size == 0) {
+		return NULL;
+	}
+	u8* mapped = file_mapping_get_range(&instance->file_mapping, location.offset_in_file, frame_size);
+	if (mapped) {
+		return mapped;
+	}
+	u8* frame_data = NULL;
+	if (frame_size <= pixel_buffer_size && instance->planar_configuration == 0) {
+		frame_data = pixels + (pixel_buffer_size - frame_size);
+	} else {
+		frame_data = (u8*)arena_push_size(&local_thread_memory->temp_arena, frame_size);
+	}
+	size_t bytes_read = file_handle_read_at_offset(frame_data, instance->file_handle, location.offset_in_file, frame_size);
+	return (bytes_read == (size_t)frame_size) ? frame_data : NULL;
+}
+
+u8* dicom_wsi_decode_tile_to_bgra(dicom_series_t* dicom_series, i32 scale, i32 tile_index) {
+	i32 scale_shift = 0;
+	dicom_wsi_level_t* level = dicom_wsi_get_level_source(&dicom_series->wsi, scale, &scale_shift);
+	ASSERT(level);
+	if (!level) return NULL;
+	if (scale_shift > 0) {
+		i32 width_in_tiles = (level->width_in_tiles + (1 << scale_shift) - 1) >> scale_shift;
+		return dicom_wsi_decode_downscaled_tile(level, scale_shift, tile_index % width_in_tiles, tile_index / width_in_tiles);
+	}
+	dicom_tile_t* dicom_tile = dicom_wsi_get_tile(level, tile_index % level->width_in_tiles, tile_index / level->width_in_tiles,
+	                                              level->default_focal_plane);
+	if (!dicom_tile->exists) {
+		return NULL;
+	}
+	dicom_instance_t* instance = dicom_tile->instance;
+
+	dicom_pixel_encoding_enum pixel_encoding = dicom_get_pixel_encoding(instance);
+	dicom_frame_codec_t* codec = dicom_frame_codecs + pixel_encoding;
+	if (!codec->decode) {
+		if (!codec->has_reported_missing_decoder) {
+			console_print_error("DICOM: no decoder available for %s pixel data\n", codec->name);
+			codec->has_reported_missing_decoder = true;
+		}
+		return NULL;
+	}
+
+	u8* pixels = (u8*)tile_pixels_alloc((size_t)instance->columns * instance->rows * 4);
+	temp_memory_t temp_memory = begin_temp_memory_on_local_thread();
+	i64 data_size = 0;
+	u8* frame_data = NULL;
+	if (pixel_encoding == DICOM_PIXEL_ENCODING_NATIVE) {
+		frame_data = dicom_read_native_frame_data(dicom_tile, pixels, &data_size);
+	} else {
+		frame_data = dicom_read_frame_data(dicom_tile, &data_size);
+	}
+	bool success = frame_data && codec->decode(instance, frame_data, data_size, pixels);
+	release_temp_memory(&temp_memory);
+	if (!success) {
+		tile_pixels_free(pixels);
+		return NULL;
+	}
+	return pixels;
+}
@@ -26,9 +26,25 @@ extern "C" {
 #include "common.h"
 #include "dicom.h"
 
+// Decodes a single frame into a BGRA buffer of columns x rows pixels (frame_data and pixels may overlap for native data)
+typedef bool dicom_frame_decode_func_t(dicom_instance_t* instance, u8* frame_data, i64 frame_size, u8* pixels);
+
+typedef struct dicom_frame_codec_t {
+	const char* name;
+	dicom_frame_decode_func_t* decode;
+	bool has_reported_missing_decoder;
+} dicom_frame_codec_t;
+
+static inline dicom_tile_t* dicom_wsi_get_tile(dicom_wsi_level_t* level, i32 tile_x, i32 tile_y, i32 focal_plane) {
+	return level->tiles + ((i64)focal_plane * level->height_in_tiles + tile_y) * level->width_in_tiles + tile_x;
+}
+
 void dicom_wsi_interpret_top_level_data_element(dicom_instance_t *instance, dicom_data_element_t element);
 void dicom_wsi_interpret_nested_data_element(dicom_instance_t* instance, dicom_data_element_t element);
 void dicom_wsi_finalize_sequence_item(dicom_instance_t* instance);
+bool dicom_wsi_build_levels(dicom_series_t* dicom);
+dicom_wsi_level_t* dicom_wsi_get_level_source(dicom_wsi_t* wsi, i32 scale, i32* scale_shift);
+void dicom_wsi_register_frame_codec(dicom_pixel_encoding_enum pixel_encoding, const char* name, dicom_frame_decode_func_t* decode);
 u8* dicom_wsi_decode_tile_to_bgra(dicom_series_t* dicom_series, i32 scale, i32 tile_index);
 
 #ifdef __cplusplus
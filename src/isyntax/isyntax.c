@@ -299,7 +299,10 @@ static bool isyntax_parse_scannedimage_child_node(isyntax_t* isyntax, u32 group,
 						// stb_image.h
 						image->pixels = stbi_load_from_memory(decoded, decoded_len, &image->width, &image->height, &channels_in_file, 4);
 #endif
-						free(decoded);
+						// Hold on to the JPEG data until the header index has been saved (see isyntax_index_cache.c)
+						if (image->encoded_image_data) free(image->encoded_image_data);
+						image->encoded_image_data = decoded;
+						image->encoded_image_size = decoded_len;
 					}
 				} break;
 				case 0x1013: /*DP_COLOR_MANAGEMENT*/                        {} break;
@@ -924,38 +927,6 @@ static void signed_magnitude_to_twos_complement_16_block(u16* data, u32 len) {
 	ASSERT(i == len);
 }
 
-// Convert a block of 16-bit signed integers to their absolute value
-// Almost the same as the signed magnitude <-> twos complement conversion, except the sign bit is cleared at the end
-static void convert_to_absolute_value_16_block(i16* data, u32 len) {
-#if defined(__SSE2__)
-	// Fast SIMD version
-	i32 i;
-	for (i = 0; i < len; i += 8) {
-		__m128i x = _mm_loadu_si128((__m128i*)(data + i));
-		__m128i sign_masks = _mm_srai_epi16(x, 15); // 0x0000 if positive, 0xFFFF if negative
-		__m128i maybe_positive = _mm_andnot_si128(sign_masks, x); // (~m & x)
-		__m128i value_if_negative = _mm_sub_epi16(_mm_and_si128(x, _mm_set1_epi16(0x8000)), x); // (x & 0x8000) - x
-		__m128i maybe_negative = _mm_and_si128(sign_masks, value_if_negative);
-		__m128i result = _mm_or_si128(maybe_positive, maybe_negative);
-		result = _mm_and_si128(result, _mm_set1_epi16(0x7FFF)); // x &= 0x7FFF (clear sign bit)
-		_mm_storeu_si128((__m128i*)(data + i), result);
-	}
-	if (i < len) {
-		for (; i < len; ++i) {
-			data[i] = signed_magnitude_to_twos_complement_16(data[i]) & 0x7FFF;
-		}
-	}
-#else
-    // Slow version
-    i32 i = 0;
-	for (; i < len; ++i) {
-		data[i] = signed_magnitude_to_twos_complement_16(data[i]) & 0x7FFF;
-	}
-#endif
-	ASSERT(i == len);
-}
-
-
 void debug_convert_wavelet_coefficients_to_image2(icoeff_t* coefficients, i32 width, i32 height, const char* filename) {
 	if (coefficients) {
 		u8* decoded_8bit = (u8*)malloc(width*height);
@@ -997,18 +968,17 @@ static rgba_t ycocg_to_bgr(i32 Y, i32 Co, i32 Cg) {
 	return (rgba_t){ATMOST(255, B), ATMOST(255, G), ATMOST(255, R), 255};
 }
 
-static u32* convert_ycocg_to_bgra_block(icoeff_t* Y, icoeff_t* Co, icoeff_t* Cg, i32 width, i32 height, i32 stride) {
-	i32 first_valid_pixel = ISYNTAX_IDWT_FIRST_VALID_PIXEL;
-	u32* bgra = (u32*)malloc(width * height * sizeof(u32)); // TODO: performance: block allocator
-
+// Reconstruct BGRA pixels from the Y, Co and Cg channels.
+// The absolute value of the Y channel is taken on the fly, so we only need a single pass over the (cropped) IDWT output.
+static void convert_ycocg_to_bgra_rows(icoeff_t* Y, icoeff_t* Co, icoeff_t* Cg, i32 width, i32 height, i32 stride, u32* bgra) {
 	i64 start = get_clock();
 	for (i32 y = 0; y < height; ++y) {
 		u32* dest = bgra + (y * width);
 #if 1 && defined(__SSE2__) && defined(__SSSE3__)
 		// Fast SIMD version (~2x faster on my system)
 		for (i32 i = 0; i < width; i += 8) {
-			// Do the color space conversion
-			__m128i Y_ = _mm_loadu_si128((__m128i*)(Y + i));
+			// For the Y channel we need the absolute value (with the sign bit cleared)
+			__m128i Y_ = _mm_and_si128(_mm_abs_epi16(_mm_loadu_si128((__m128i*)(Y + i))), _mm_set1_epi16(0x7FFF));
 			__m128i Co_ = _mm_loadu_si128((__m128i*)(Co + i));
 			__m128i Cg_ = _mm_loadu_si128((__m128i*)(Cg + i));
 			__m128i tmp = _mm_sub_epi16(Y_, _mm_srai_epi16(Cg_, 1)); // tmp = Y - Cg/2
@@ -1041,7 +1011,8 @@ static u32* convert_ycocg_to_bgra_block(icoeff_t* Y, icoeff_t* Co, icoeff_t* Cg,
 #else
 		// Slow non-SIMD version
 		for (i32 x = 0; x < width; ++x) {
-			((rgba_t*)dest)[x] = ycocg_to_bgr(Y[x], Co[x], Cg[x]);
+			i32 Y_abs = signed_magnitude_to_twos_complement_16(Y[x]) & 0x7FFF;
+			((rgba_t*)dest)[x] = ycocg_to_bgr(Y_abs, Co[x], Cg[x]);
 		}
 #endif
 		Y += stride;
@@ -1049,11 +1020,53 @@ static u32* convert_ycocg_to_bgra_block(icoeff_t* Y, icoeff_t* Co, icoeff_t* Cg,
 		Cg += stride;
 	}
 	total_rgb_transform_time += get_seconds_elapsed(start, get_clock());
-	return bgra;
 }
 
 #define DEBUG_OUTPUT_IDWT_STEPS_AS_PNG 0
 
+// Temporary buffer for the IDWT passes (the vertical pass SIMD kernels do aligned stores into it).
+#define ISYNTAX_IDWT_TMP_SIZE(quadrant_width, quadrant_height) \
+	((MAX(quadrant_width, quadrant_height)*2) * OPJ_DWT_MAX_PARALLEL_COLS * sizeof(icoeff_t) + OPJ_DWT_TMP_ALIGNMENT)
+
+static inline icoeff_t* isyntax_idwt_align_tmp(u8* tmp) {
+	return (icoeff_t*)(((uintptr_t)tmp + OPJ_DWT_TMP_ALIGNMENT - 1) & ~(uintptr_t)(OPJ_DWT_TMP_ALIGNMENT - 1));
+}
+
+static void isyntax_idwt_h(icoeff_t* idwt, i32 quadrant_width, i32 full_height, i32 idwt_stride, icoeff_t* tmp) {
+	opj_dwt_t h = {0};
+	h.mem = tmp;
+	h.kernels = opj_dwt_get_simd_kernels();
+	h.sn = quadrant_width; // number of elements in low pass band
+	h.dn = quadrant_width; // number of elements in high pass band
+	h.cas = 1;
+
+	for (i32 y = 0; y < full_height; ++y) {
+		icoeff_t* input_row = idwt + y * idwt_stride;
+		opj_idwt53_h(&h, input_row);
+	}
+}
+
+// Vertical pass over the columns [0, width), with the low pass band in the first quadrant_height rows.
+static void isyntax_idwt_v(icoeff_t* idwt, i32 width, i32 quadrant_height, i32 idwt_stride, icoeff_t* tmp) {
+	opj_dwt_t v = {0};
+	v.mem = tmp;
+	v.sn = quadrant_height; // number of elements in low pass band
+	v.dn = quadrant_height; // number of elements in high pass band
+	v.cas = 1;
+
+	i32 x = 0;
+	// Process as many columns as possible using the widest vectors, then try narrower ones for the remainder.
+	for (const opj_dwt_simd_kernels_t* k = opj_dwt_get_simd_kernels(); k != NULL; k = k->narrower) {
+		v.kernels = k;
+		for (; x + k->parallel_cols <= width; x += k->parallel_cols) {
+			opj_idwt53_v(&v, idwt + x, idwt_stride, k->parallel_cols);
+		}
+	}
+	if (x < width) {
+		opj_idwt53_v(&v, idwt + x, idwt_stride, (width - x));
+	}
+}
+
 void isyntax_idwt(icoeff_t* idwt, i32 quadrant_width, i32 quadrant_height, bool output_steps_as_png, const char* png_name) {
 	i32 full_width = quadrant_width * 2;
 	i32 full_height= quadrant_height * 2;
@@ -1065,19 +1078,10 @@ void isyntax_idwt(icoeff_t* idwt, i32 quadrant_width, i32 quadrant_height, bool
 		debug_convert_wavelet_coefficients_to_image2(idwt, full_width, full_height, filename);
 	}
 
-	// Horizontal pass
-	opj_dwt_t h = {0};
-	size_t dwt_mem_size = (MAX(quadrant_width, quadrant_height)*2) * PARALLEL_COLS_53 * sizeof(icoeff_t);
-
-	h.mem = (icoeff_t*)alloca(dwt_mem_size); // TODO: need aligned memory?
-	h.sn = quadrant_width; // number of elements in low pass band
-	h.dn = quadrant_width; // number of elements in high pass band
-	h.cas = 1;
+	icoeff_t* tmp = isyntax_idwt_align_tmp((u8*)alloca(ISYNTAX_IDWT_TMP_SIZE(quadrant_width, quadrant_height)));
 
-	for (i32 y = 0; y < full_height; ++y) {
-		icoeff_t* input_row = idwt + y * idwt_stride;
-		opj_idwt53_h(&h, input_row);
-	}
+	// Horizontal pass
+	isyntax_idwt_h(idwt, quadrant_width, full_height, idwt_stride, tmp);
 
 	if (output_steps_as_png) {
 		char filename[512];
@@ -1086,27 +1090,129 @@ void isyntax_idwt(icoeff_t* idwt, i32 quadrant_width, i32 quadrant_height, bool
 	}
 
 	// Vertical pass
+	isyntax_idwt_v(idwt, full_width, quadrant_height, idwt_stride, tmp);
+
+	if (output_steps_as_png) {
+		char filename[512];
+		snprintf(filename, sizeof(filename), "%s_step2.png", png_name);
+		debug_convert_wavelet_coefficients_to_image2(idwt, full_width, full_height, filename);
+	}
+
+}
+
+// Vertical pass for only the output rows [row_begin, row_end) and columns [col_begin, col_begin + width), after the
+// horizontal pass has been done on the whole buffer. The result goes into dest (with row stride width), and the idwt
+// buffer is left intact. This lets the caller do the vertical pass in bands of rows, and consume each band while it is
+// still in cache, instead of making another pass over the whole IDWT output afterwards.
+// Number of output rows processed at a time in the final (vertical) IDWT pass and the color conversion.
+#define ISYNTAX_IDWT_BAND_ROWS 32
+
+static void isyntax_idwt_v_rows(icoeff_t* idwt, i32 quadrant_width, i32 quadrant_height, i32 row_begin, i32 row_end,
+                                i32 col_begin, i32 width, icoeff_t* dest) {
+	i32 idwt_stride = 2 * quadrant_width;
 	opj_dwt_t v = {0};
-	v.mem = h.mem;
 	v.sn = quadrant_height; // number of elements in low pass band
 	v.dn = quadrant_height; // number of elements in high pass band
 	v.cas = 1;
 
-	i32 x;
-	i32 last_x = full_width;
-	for (x = 0; x + PARALLEL_COLS_53 <= last_x; x += PARALLEL_COLS_53) {
-		opj_idwt53_v(&v, idwt + x, idwt_stride, PARALLEL_COLS_53);
+	i32 x = 0;
+	// Process as many columns as possible using the widest vectors, then try narrower ones for the remainder.
+	for (const opj_dwt_simd_kernels_t* k = opj_dwt_get_simd_kernels(); k != NULL; k = k->narrower) {
+		v.kernels = k;
+		for (; x + k->parallel_cols <= width; x += k->parallel_cols) {
+			opj_idwt53_v_rows(&v, idwt + col_begin + x, idwt_stride, k->parallel_cols, row_begin, row_end, dest + x, width);
+		}
 	}
-	if (x < last_x) {
-		opj_idwt53_v(&v, idwt + x, idwt_stride, (last_x - x));
+	if (x < width) {
+		opj_idwt53_v_rows(&v, idwt + col_begin + x, idwt_stride, (width - x), row_begin, row_end, dest + x, width);
 	}
+}
 
-	if (output_steps_as_png) {
-		char filename[512];
-		snprintf(filename, sizeof(filename), "%s_step2.png", png_name);
-		debug_convert_wavelet_coefficients_to_image2(idwt, full_width, full_height, filename);
-	}
+// Time isyntax_idwt() on each of the instruction sets supported by this CPU, and check that the output is
+// bit-exact with the scalar reference implementation.
+void isyntax_benchmark_idwt(i32 iterations) {
+	if (iterations <= 0) iterations = 1000;
+	// Typical iSyntax tile (128x128 codeblocks + padding), and a small odd size to exercise the remainder loops.
+	i32 quadrant_sizes[][2] = {{128 + ISYNTAX_IDWT_PAD_L + ISYNTAX_IDWT_PAD_R, 128 + ISYNTAX_IDWT_PAD_L + ISYNTAX_IDWT_PAD_R}, {37, 29}};
+	// The second input pattern uses the full coefficient range (including the limits), where the intermediate sums in
+	// the lifting steps would overflow 16 bits if they were computed naively.
+	const char* pattern_names[] = {"typical coefficients", "extreme coefficients"};
+	i32 old_override = isyntax_dwt_simd_override;
+
+	for (i32 pattern = 0; pattern < COUNT(pattern_names); ++pattern) {
+		for (i32 size_index = 0; size_index < COUNT(quadrant_sizes); ++size_index) {
+			i32 quadrant_width = quadrant_sizes[size_index][0];
+			i32 quadrant_height = quadrant_sizes[size_index][1];
+			i32 coeff_count = 4 * quadrant_width * quadrant_height;
+			size_t buffer_size = coeff_count * sizeof(icoeff_t);
+			icoeff_t* input = (icoeff_t*)malloc(buffer_size);
+			icoeff_t* reference = (icoeff_t*)malloc(buffer_size);
+			icoeff_t* output = (icoeff_t*)malloc(buffer_size);
+			i32 full_width = 2 * quadrant_width;
+			i32 full_height = 2 * quadrant_height;
+			icoeff_t* band = (icoeff_t*)malloc(ISYNTAX_IDWT_BAND_ROWS * full_width * sizeof(icoeff_t));
+			u8* tmp_memory = (u8*)malloc(ISYNTAX_IDWT_TMP_SIZE(quadrant_width, quadrant_height));
+
+			u32 rng = 0x9E3779B9;
+			for (i32 i = 0; i < coeff_count; ++i) {
+				rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+				if (pattern == 0) {
+					// Mostly small coefficients (like real data), with some larger ones mixed in.
+					input[i] = (rng % 16 == 0) ? (icoeff_t)((i32)(rng % 8192) - 4096) : (icoeff_t)((i32)(rng % 512) - 256);
+				} else {
+					// Runs of values at (or next to) the limits, and random values over the whole range.
+					static const i32 extremes[] = {INT16_MIN, INT16_MIN + 1, -1, 0, 1, INT16_MAX - 1, INT16_MAX};
+					input[i] = (rng % 4 == 0) ? (icoeff_t)(i16)(rng >> 16) : (icoeff_t)extremes[(rng >> 8) % COUNT(extremes)];
+				}
+			}
 
+			console_print("IDWT benchmark: %dx%d tile, %s, %d iterations\n", 2 * quadrant_width, 2 * quadrant_height,
+			              pattern_names[pattern], iterations);
+			float scalar_ms = 0.0f;
+			for (i32 simd = 0; simd < ISYNTAX_DWT_SIMD_COUNT; ++simd) {
+				if (!isyntax_dwt_is_simd_supported(simd)) continue;
+				isyntax_dwt_simd_override = simd;
+
+				memcpy(output, input, buffer_size);
+				isyntax_idwt(output, quadrant_width, quadrant_height, false, NULL);
+				bool is_exact = true;
+				if (simd == ISYNTAX_DWT_SIMD_NONE) {
+					memcpy(reference, output, buffer_size);
+				} else {
+					is_exact = (memcmp(reference, output, buffer_size) == 0);
+				}
+				// The vertical pass done in bands of rows (as in isyntax_load_tile()) should give the same result.
+				memcpy(output, input, buffer_size);
+				isyntax_idwt_h(output, quadrant_width, full_height, full_width, isyntax_idwt_align_tmp(tmp_memory));
+				for (i32 y = 0; y < full_height; y += ISYNTAX_IDWT_BAND_ROWS) {
+					i32 band_height = ATMOST(ISYNTAX_IDWT_BAND_ROWS, full_height - y);
+					isyntax_idwt_v_rows(output, quadrant_width, quadrant_height, y, y + band_height, 0, full_width, band);
+					if (memcmp(band, reference + y * full_width, band_height * full_width * sizeof(icoeff_t)) != 0) {
+						is_exact = false;
+					}
+				}
+
+				i64 clock_start = get_clock();
+				for (i32 i = 0; i < iterations; ++i) {
+					memcpy(output, input, buffer_size);
+					isyntax_idwt(output, quadrant_width, quadrant_height, false, NULL);
+				}
+				float ms_per_tile = get_seconds_elapsed(clock_start, get_clock()) * 1000.0f / (float)iterations;
+				if (simd == ISYNTAX_DWT_SIMD_NONE) scalar_ms = ms_per_tile;
+				console_print("    %-10s %8.4f ms/tile  (%5.2fx)  %s\n", isyntax_dwt_get_simd_name(simd), ms_per_tile,
+				              scalar_ms / ms_per_tile, is_exact ? "bit-exact" : "MISMATCH");
+				if (!is_exact) {
+					console_print_error("Error: IDWT output for %s does not match the scalar reference\n", isyntax_dwt_get_simd_name(simd));
+				}
+			}
+			free(input);
+			free(reference);
+			free(output);
+			free(band);
+			free(tmp_memory);
+		}
+	}
+	isyntax_dwt_simd_override = old_override;
 }
 
 static inline void get_offsetted_coeff_blocks(icoeff_t** ll_hl_lh_hh, i32 offset, isyntax_tile_channel_t* color_channel, i32 block_stride, icoeff_t* black_dummy_coeff, icoeff_t* white_dummy_coeff) {
@@ -1240,7 +1346,9 @@ static size_t get_idwt_buffer_size(i32 block_width, i32 block_height) {
 	return idwt_buffer_size;
 }
 
-u32 isyntax_idwt_tile_for_color_channel(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y, i32 color, icoeff_t* dest_buffer) {
+// Stitch together the input for the IDWT of one color channel of a tile (with margins sampled from the adjacent tiles),
+// and do the horizontal pass. The vertical pass is done in bands of rows by isyntax_load_tile(), see isyntax_idwt_v_rows().
+u32 isyntax_begin_idwt_tile_for_color_channel(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y, i32 color, icoeff_t* dest_buffer) {
 	isyntax_level_t* level = wsi->levels + scale;
 	ASSERT(tile_x >= 0 && tile_x < level->width_in_tiles);
 	ASSERT(tile_y >= 0 && tile_y < level->height_in_tiles);
@@ -1478,13 +1586,8 @@ u32 isyntax_idwt_tile_for_color_channel(isyntax_t* isyntax, isyntax_image_t* wsi
 		}
 	}
 
-	bool output_pngs = false;
-	const char* debug_png = "debug_idwt_";
-	/*
-	if (scale == wsi->max_scale && tile_x == 1 && tile_y == 1 && color == 0) {
-		output_pngs = true;
-	}*/
-	isyntax_idwt(idwt, quadrant_width, quadrant_height, output_pngs, debug_png);
+	icoeff_t* tmp = isyntax_idwt_align_tmp((u8*)alloca(ISYNTAX_IDWT_TMP_SIZE(quadrant_width, quadrant_height)));
+	isyntax_idwt_h(idwt, quadrant_width, full_height, dest_stride, tmp);
 
 	u32 invalid_edges = invalid_neighbors_h | invalid_neighbors_ll;
 	return invalid_edges;
@@ -1497,153 +1600,135 @@ u32* isyntax_load_tile(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32
 	isyntax_tile_t* tile = level->tiles + tile_y * level->width_in_tiles + tile_x;
 	i32 block_width = isyntax->block_width;
 	i32 block_height = isyntax->block_height;
-	size_t block_size = block_width * block_height * sizeof(icoeff_t);
 	i32 first_valid_pixel = ISYNTAX_IDWT_FIRST_VALID_PIXEL;
-	i32 idwt_width = 2 * (block_width + ISYNTAX_IDWT_PAD_L + ISYNTAX_IDWT_PAD_R);
-	i32 idwt_height = 2 * (block_height + ISYNTAX_IDWT_PAD_L + ISYNTAX_IDWT_PAD_R);
-	i32 idwt_stride = idwt_width;
+	i32 quadrant_width = block_width + ISYNTAX_IDWT_PAD_L + ISYNTAX_IDWT_PAD_R;
+	i32 quadrant_height = block_height + ISYNTAX_IDWT_PAD_L + ISYNTAX_IDWT_PAD_R;
+	i32 idwt_width = 2 * quadrant_width;
+	i32 idwt_height = 2 * quadrant_height;
+	i32 tile_width = block_width * 2;
+	i32 tile_height = block_height * 2;
 	size_t row_copy_size = block_width * sizeof(icoeff_t);
 
 	temp_memory_t temp_memory = begin_temp_memory_on_local_thread();
 
-	icoeff_t* Y = NULL;
-	icoeff_t* Co = NULL;
-	icoeff_t* Cg = NULL;
-
 	float elapsed_idwt = 0.0f;
 	float elapsed_malloc = 0.0f;
 
+	// Stitch together the input for each of the color channels, and do the horizontal IDWT pass.
+	// idwt will be allocated in temporary memory (only needed for the duration of this function)
+	icoeff_t* idwt[3] = {0};
 	u32 invalid_edges = 0;
-
+	i64 start_idwt = get_clock();
 	for (i32 color = 0; color < 3; ++color) {
-		i64 start_idwt = get_clock();
-		// idwt will be allocated in temporary memory (only needed for the duration of this function)
 		size_t idwt_buffer_size = idwt_width * idwt_height * sizeof(icoeff_t);
-		icoeff_t* idwt = arena_push_size(temp_memory.arena, idwt_buffer_size);
-		memset(idwt, 0, idwt_buffer_size);
-		invalid_edges |= isyntax_idwt_tile_for_color_channel(isyntax, wsi, scale, tile_x, tile_y, color, idwt);
-		elapsed_idwt += get_seconds_elapsed(start_idwt, get_clock());
-		ASSERT(idwt);
-		switch(color) {
-			case 0: Y = idwt; break;
-			case 1: Co = idwt; break;
-			case 2: Cg = idwt; break;
-			default: {
-				ASSERT(!"invalid code path");
-			} break;
-		}
-
-		// Distribute result to child tiles
-		if (scale > 0) {
-			isyntax_level_t* next_level = wsi->levels + (scale - 1);
-			isyntax_tile_t* child_top_left = next_level->tiles + (tile_y*2) * next_level->width_in_tiles + (tile_x*2);
-			isyntax_tile_t* child_top_right = child_top_left + 1;
-			isyntax_tile_t* child_bottom_left = child_top_left + next_level->width_in_tiles;
-			isyntax_tile_t* child_bottom_right = child_bottom_left + 1;
-
-			ASSERT(child_top_left->color_channels[color].coeff_ll == NULL);
-			ASSERT(child_top_right->color_channels[color].coeff_ll == NULL);
-			ASSERT(child_bottom_left->color_channels[color].coeff_ll == NULL);
-			ASSERT(child_bottom_right->color_channels[color].coeff_ll == NULL);
+		idwt[color] = arena_push_size(temp_memory.arena, idwt_buffer_size);
+		memset(idwt[color], 0, idwt_buffer_size);
+		invalid_edges |= isyntax_begin_idwt_tile_for_color_channel(isyntax, wsi, scale, tile_x, tile_y, color, idwt[color]);
+	}
+	elapsed_idwt += get_seconds_elapsed(start_idwt, get_clock());
+
+	// The result is distributed to the LL blocks of the child tiles.
+	isyntax_tile_t* children[4] = {0};
+	// Even if the parent tile has invalid edges around the outside, its child LL blocks will still have valid edges on the inside.
+	static const u32 edges_inside_parent[4] = {
+			ISYNTAX_ADJ_TILE_CENTER_RIGHT | ISYNTAX_ADJ_TILE_BOTTOM_RIGHT | ISYNTAX_ADJ_TILE_BOTTOM_CENTER, // top left
+			ISYNTAX_ADJ_TILE_CENTER_LEFT | ISYNTAX_ADJ_TILE_BOTTOM_LEFT | ISYNTAX_ADJ_TILE_BOTTOM_CENTER,   // top right
+			ISYNTAX_ADJ_TILE_CENTER_RIGHT | ISYNTAX_ADJ_TILE_TOP_RIGHT | ISYNTAX_ADJ_TILE_TOP_CENTER,       // bottom left
+			ISYNTAX_ADJ_TILE_CENTER_LEFT | ISYNTAX_ADJ_TILE_TOP_LEFT | ISYNTAX_ADJ_TILE_TOP_CENTER,         // bottom right
+	};
+	if (scale > 0) {
+		isyntax_level_t* next_level = wsi->levels + (scale - 1);
+		isyntax_tile_t* child_top_left = next_level->tiles + (tile_y*2) * next_level->width_in_tiles + (tile_x*2);
+		isyntax_tile_t* all_children[4] = {child_top_left, child_top_left + 1,
+		                                   child_top_left + next_level->width_in_tiles, child_top_left + next_level->width_in_tiles + 1};
+		for (i32 i = 0; i < 4; ++i) {
+			isyntax_tile_t* child = all_children[i];
+			// This tile may be reconstructed again after the streamer evicted its pixels or some of the coefficients
+			// below it. Children that still have valid LL blocks are in use and are left alone.
+			if (child->has_ll && child->ll_invalid_edges == 0) continue;
+			children[i] = child;
 
 			// NOTE: malloc() and free() can become a bottleneck, they don't scale well especially across many threads.
 			// We use a custom block allocator to address this.
-			i64 start_malloc = get_clock();
-			child_top_left->color_channels[color].coeff_ll = (icoeff_t*)block_alloc(&isyntax->ll_coeff_block_allocator);
-			child_top_right->color_channels[color].coeff_ll = (icoeff_t*)block_alloc(&isyntax->ll_coeff_block_allocator);
-			child_bottom_left->color_channels[color].coeff_ll = (icoeff_t*)block_alloc(&isyntax->ll_coeff_block_allocator);
-			child_bottom_right->color_channels[color].coeff_ll = (icoeff_t*)block_alloc(&isyntax->ll_coeff_block_allocator);
-			elapsed_malloc += get_seconds_elapsed(start_malloc, get_clock());
-
-			i32 dest_stride = block_width;
-			// Blit top left child LL block
-			{
-				icoeff_t* dest = child_top_left->color_channels[color].coeff_ll;
-				icoeff_t* source = idwt + (first_valid_pixel * idwt_stride) + first_valid_pixel;
-				for (i32 y = 0; y < block_height; ++y) {
-					memcpy(dest, source, row_copy_size);
-					dest += dest_stride;
-					source += idwt_stride;
-				}
-			}
-			// Blit top right child LL block
-			{
-				icoeff_t* dest = child_top_right->color_channels[color].coeff_ll;
-				icoeff_t* source = idwt + (first_valid_pixel * idwt_stride) + first_valid_pixel + block_width;
-				for (i32 y = 0; y < block_height; ++y) {
-					memcpy(dest, source, row_copy_size);
-					dest += dest_stride;
-					source += idwt_stride;
-				}
-			}
-			// Blit bottom left child LL block
-			{
-				icoeff_t* dest = child_bottom_left->color_channels[color].coeff_ll;
-				icoeff_t* source = idwt + ((first_valid_pixel + block_height) * idwt_stride) + first_valid_pixel;
-				for (i32 y = 0; y < block_height; ++y) {
-					memcpy(dest, source, row_copy_size);
-					dest += dest_stride;
-					source += idwt_stride;
-				}
-			}
-			// Blit bottom right child LL block
-			{
-				icoeff_t* dest = child_bottom_right->color_channels[color].coeff_ll;
-				icoeff_t* source = idwt + ((first_valid_pixel + block_height) * idwt_stride) + first_valid_pixel + block_width;
-				for (i32 y = 0; y < block_height; ++y) {
-					memcpy(dest, source, row_copy_size);
-					dest += dest_stride;
-					source += idwt_stride;
+			for (i32 color = 0; color < 3; ++color) {
+				isyntax_tile_channel_t* child_channel = child->color_channels + color;
+				if (child_channel->coeff_ll == NULL) {
+					i64 start_malloc = get_clock();
+					child_channel->coeff_ll = (icoeff_t*)block_alloc(&isyntax->ll_coeff_block_allocator);
+					elapsed_malloc += get_seconds_elapsed(start_malloc, get_clock());
 				}
 			}
+		}
+	}
 
-			// After the last color channel, we can report that the children now have their LL blocks available.
-			if (color == 2) {
-				child_top_left->has_ll = true;
-				child_top_right->has_ll = true;
-				child_bottom_left->has_ll = true;
-				child_bottom_right->has_ll = true;
-
-				// Even if the parent tile has invalid edges around the outside, its child LL blocks will still have valid edges on the inside.
-				child_top_left->ll_invalid_edges = invalid_edges & ~(ISYNTAX_ADJ_TILE_CENTER_RIGHT | ISYNTAX_ADJ_TILE_BOTTOM_RIGHT | ISYNTAX_ADJ_TILE_BOTTOM_CENTER);
-				child_top_right->ll_invalid_edges = invalid_edges & ~(ISYNTAX_ADJ_TILE_CENTER_LEFT | ISYNTAX_ADJ_TILE_BOTTOM_LEFT | ISYNTAX_ADJ_TILE_BOTTOM_CENTER);
-				child_bottom_left->ll_invalid_edges = invalid_edges & ~(ISYNTAX_ADJ_TILE_CENTER_RIGHT | ISYNTAX_ADJ_TILE_TOP_RIGHT | ISYNTAX_ADJ_TILE_TOP_CENTER);
-				child_bottom_right->ll_invalid_edges = invalid_edges & ~(ISYNTAX_ADJ_TILE_CENTER_LEFT | ISYNTAX_ADJ_TILE_TOP_LEFT | ISYNTAX_ADJ_TILE_TOP_CENTER);
-
-				if (invalid_edges != 0) {
-					console_print("load: scale=%d x=%d y=%d  idwt time =%g  invalid edges=%x\n", scale, tile_x, tile_y, elapsed_idwt, invalid_edges);
-					// early out
-					tile->is_submitted_for_loading = false;
-					release_temp_memory(&temp_memory);
-					return NULL;
+	// If some of the edges are invalid, the pixels would be wrong (the child LL blocks are still useful, see above).
+	bool want_pixels = !(scale > 0 && invalid_edges != 0);
+	u32* bgra = want_pixels ? (u32*)tile_pixels_alloc(tile_width * tile_height * sizeof(u32)) : NULL;
+
+	// Do the vertical IDWT pass in bands of rows, skipping the margins. While a band is still in cache, we blit it into
+	// the child LL blocks and reconstruct the RGB pixels from it.
+	icoeff_t* band[3];
+	for (i32 color = 0; color < 3; ++color) {
+		band[color] = arena_push_size(temp_memory.arena, ISYNTAX_IDWT_BAND_ROWS * tile_width * sizeof(icoeff_t));
+	}
+	for (i32 band_y = 0; band_y < tile_height; band_y += ISYNTAX_IDWT_BAND_ROWS) {
+		i32 band_height = ATMOST(ISYNTAX_IDWT_BAND_ROWS, tile_height - band_y);
+		i32 row_begin = first_valid_pixel + band_y;
+		start_idwt = get_clock();
+		for (i32 color = 0; color < 3; ++color) {
+			isyntax_idwt_v_rows(idwt[color], quadrant_width, quadrant_height, row_begin, row_begin + band_height,
+			                    first_valid_pixel, tile_width, band[color]);
+		}
+		elapsed_idwt += get_seconds_elapsed(start_idwt, get_clock());
+
+		if (scale > 0) {
+			for (i32 y = band_y; y < band_y + band_height; ++y) {
+				i32 child_y = y / block_height;
+				for (i32 child_x = 0; child_x < 2; ++child_x) {
+					isyntax_tile_t* child = children[child_y * 2 + child_x];
+					if (!child) continue;
+					for (i32 color = 0; color < 3; ++color) {
+						icoeff_t* dest = child->color_channels[color].coeff_ll + (y % block_height) * block_width;
+						icoeff_t* source = band[color] + (y - band_y) * tile_width + child_x * block_width;
+						memcpy(dest, source, row_copy_size);
+					}
 				}
 			}
 		}
-	}
 
-	tile->is_loaded = true; // Meaning: it is now safe to start loading 'child' tiles of the next level
+		if (bgra) {
+			// For the Y (luminance) color channel, we actually need the absolute value of the Y-channel wavelet coefficient.
+			// (This doesn't hold for Co and Cg, those are are used directly as signed integers)
+			convert_ycocg_to_bgra_rows(band[0], band[1], band[2], tile_width, band_height, tile_width, bgra + band_y * tile_width);
+		}
+	}
 
-	// For the Y (luminance) color channel, we actually need the absolute value of the Y-channel wavelet coefficient.
-	// (This doesn't hold for Co and Cg, those are are used directly as signed integers)
-	convert_to_absolute_value_16_block(Y, idwt_width * idwt_height);
+	// Now we can report that the children have their LL blocks available.
+	for (i32 i = 0; i < 4; ++i) {
+		isyntax_tile_t* child = children[i];
+		if (!child) continue;
+		child->ll_invalid_edges = invalid_edges & ~edges_inside_parent[i];
+		write_barrier;
+		child->has_ll = true;
+	}
 
-	// Reconstruct RGB image from separate color channels while cutting off margins
-	i64 start = get_clock();
-	i32 tile_width = block_width * 2;
-	i32 tile_height = block_height * 2;
+	if (!want_pixels) {
+		console_print("load: scale=%d x=%d y=%d  idwt time =%g  invalid edges=%x\n", scale, tile_x, tile_y, elapsed_idwt, invalid_edges);
+		// early out
+		tile->is_submitted_for_loading = false;
+		release_temp_memory(&temp_memory);
+		return NULL;
+	}
 
-	i32 valid_offset = (first_valid_pixel * idwt_stride) + first_valid_pixel;
-	u32* bgra = convert_ycocg_to_bgra_block(Y + valid_offset, Co + valid_offset, Cg + valid_offset,
-											tile_width, tile_height, idwt_stride);
+	tile->is_loaded = true; // Meaning: it is now safe to start loading 'child' tiles of the next level
 
-	//		float elapsed_rgb = get_seconds_elapsed(start, get_clock());
-	//	console_print_verbose("load: scale=%d x=%d y=%d  idwt time =%g  rgb transform time=%g  malloc time=%g\n", scale, tile_x, tile_y, elapsed_idwt, elapsed_rgb, elapsed_malloc);
+	//	console_print_verbose("load: scale=%d x=%d y=%d  idwt time =%g  rgb transform time=%g  malloc time=%g\n", scale, tile_x, tile_y, elapsed_idwt, total_rgb_transform_time, elapsed_malloc);
 
 	/*if (scale == wsi->max_scale && tile_x == 1 && tile_y == 1) {
 		stbi_write_png("debug_dwt_output.png", tile_width, tile_height, 4, bgra, tile_width * 4);
 	}*/
 
-	release_temp_memory(&temp_memory); // free Y, Co and Cg
+	release_temp_memory(&temp_memory); // free the IDWT buffers
 	return bgra;
 }
 
@@ -1724,11 +1809,99 @@ void save_code_in_huffman_fast_lookup_table(huffman_t* h, u32 code, u32 code_wid
 	}
 }
 
+// Multi-symbol lookup table: for every HUFFMAN_FAST_BITS-bit window of the bitstream, stores up to
+// HUFFMAN_MULTI_MAX_SYMBOLS consecutive symbols whose codes fit entirely inside the window.
+// The zero run symbol is never included (it is followed by a counter that needs special handling).
+// Entry layout: bits 0-23 = symbols (first symbol in the lowest byte), bits 24-25 = symbol count, bits 26-29 = total code size
+#define HUFFMAN_MULTI_MAX_SYMBOLS 3
+#define HUFFMAN_MULTI_MIN_MESSAGE_LENGTH (1 << HUFFMAN_FAST_BITS) // not worth building the table for smaller messages
+
+static void build_huffman_multi_symbol_lookup_table(huffman_t* h, u8 zerorun_symbol, u32* multi) {
+	for (u32 window = 0; window < (1 << HUFFMAN_FAST_BITS); ++window) {
+		u32 entry = 0;
+		u32 count = 0;
+		u32 total_size = 0;
+		while (count < HUFFMAN_MULTI_MAX_SYMBOLS) {
+			// The bits shifted in at the top are not part of the window, so the code must fit in the remaining bits.
+			u16 c = h->fast[window >> total_size];
+			if (c > 255 || c == zerorun_symbol) break;
+			u32 code_size = h->size[c];
+			if (code_size == 0 || total_size + code_size > HUFFMAN_FAST_BITS) break;
+			entry |= (u32)c << (8 * count);
+			++count;
+			total_size += code_size;
+		}
+		multi[window] = entry | (count << 24) | (total_size << 26);
+	}
+}
+
+#if defined(__SSE2__)
+// Transpose the bitplanes of one coefficient into 16-bit twos complement values, 128 coefficients at a time.
+// planes[bit] points to the bitplane for bit position 'bit' (0 = sign, 1..15 = magnitude lsb..msb), or NULL if absent.
+// The output is written in raster order (the snake order of the 4x4 areas is undone on the fly).
+// Areas where all bitplanes are zero are skipped, so the output must be cleared beforehand.
+static void isyntax_transpose_bitplanes_sse2(u8** planes, i32 block_width, i32 block_height, i16* out) {
+	i32 bytes_per_bitplane = (block_width * block_height) / 8;
+	i32 area_stride_x = block_width / 4;
+	__m128i zero = _mm_setzero_si128();
+	__m128i magnitude_mask = _mm_set1_epi16(0x7FFF);
+	for (i32 j = 0; j < bytes_per_bitplane; j += 16) {
+		__m128i r[16];
+		__m128i any = zero;
+		for (i32 p = 0; p < 16; ++p) {
+			r[p] = planes[p] ? _mm_loadu_si128((__m128i*)(planes[p] + j)) : zero;
+			any = _mm_or_si128(any, r[p]);
+		}
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) == 0xFFFF) {
+			continue; // empty region
+		}
+
+		// 16x16 byte transpose: afterwards, r[b] holds byte (j+b) of each of the 16 bitplanes.
+		for (i32 pass = 0; pass < 4; ++pass) {
+			__m128i t[16];
+			for (i32 i = 0; i < 8; ++i) {
+				t[2*i] = _mm_unpacklo_epi8(r[i], r[i+8]);
+				t[2*i+1] = _mm_unpackhi_epi8(r[i], r[i+8]);
+			}
+			memcpy(r, t, sizeof(r));
+		}
+
+		for (i32 b = 0; b < 16; ++b) {
+			// Bit k of each byte belongs to coefficient 8*(j+b)+k; gather it across the 16 bitplanes with movemask.
+			__m128i col = r[b];
+			__m128i v = _mm_setr_epi16((i16)_mm_movemask_epi8(_mm_slli_epi16(col, 7)),
+			                           (i16)_mm_movemask_epi8(_mm_slli_epi16(col, 6)),
+			                           (i16)_mm_movemask_epi8(_mm_slli_epi16(col, 5)),
+			                           (i16)_mm_movemask_epi8(_mm_slli_epi16(col, 4)),
+			                           (i16)_mm_movemask_epi8(_mm_slli_epi16(col, 3)),
+			                           (i16)_mm_movemask_epi8(_mm_slli_epi16(col, 2)),
+			                           (i16)_mm_movemask_epi8(_mm_slli_epi16(col, 1)),
+			                           (i16)_mm_movemask_epi8(col));
+			// Bitplanes are stored sign, lsb ... msb: rotate right by one to get signed magnitude
+			v = _mm_or_si128(_mm_srli_epi16(v, 1), _mm_slli_epi16(v, 15));
+			// Convert signed magnitude to twos complement (ex. 0x8002 becomes -2)
+			__m128i sign = _mm_srai_epi16(v, 15);
+			v = _mm_sub_epi16(_mm_xor_si128(_mm_and_si128(v, magnitude_mask), sign), sign);
+
+			// Reshuffle snake-order: these 8 coefficients are two rows of a 4x4 area
+			i32 i = (j + b) * 8;
+			i32 area4x4_index = i / 16;
+			i32 area_x = (area4x4_index % area_stride_x) * 4;
+			i32 area_y = (area4x4_index / area_stride_x) * 4 + (i % 16) / 4;
+			_mm_storel_epi64((__m128i*)(out + area_y * block_width + area_x), v);
+			_mm_storel_epi64((__m128i*)(out + (area_y + 1) * block_width + area_x), _mm_unpackhi_epi64(v, v));
+		}
+	}
+}
+#endif
+
 static u32 max_code_size;
 static u32 symbol_counts[256];
 static u64 fast_count;
 static u64 nonfast_count;
 
+bool isyntax_hulsken_fast_paths_enabled = true;
+
 bool isyntax_hulsken_decompress(u8* compressed, size_t compressed_size, i32 block_width, i32 block_height,
 								i32 coefficient, i32 compressor_version, i16* out_buffer) {
 	ASSERT(compressor_version == 1 || compressor_version == 2);
@@ -1911,11 +2084,36 @@ bool isyntax_hulsken_decompress(u8* compressed, size_t compressed_size, i32 bloc
 	u32 zerorun_code_mask = (1 << zerorun_code_size) - 1;
 
 	u32 zero_counter_mask = (1 << zero_counter_size) - 1;
+
+	// For larger messages, decode several symbols per table lookup where possible.
+	u32* multi_symbol_table = NULL;
+	if (isyntax_hulsken_fast_paths_enabled && serialized_length >= HUFFMAN_MULTI_MIN_MESSAGE_LENGTH) {
+		multi_symbol_table = (u32*)arena_push_size(temp_memory.arena, (1 << HUFFMAN_FAST_BITS) * sizeof(u32));
+		build_huffman_multi_symbol_lookup_table(&huffman, zerorun_symbol, multi_symbol_table);
+	}
+	// Only use the multi-symbol table while every decoded symbol is guaranteed to start inside the stream,
+	// and there is room in the output for the maximum number of symbols.
+	i32 multi_symbol_bits_limit = block_size_in_bits - HUFFMAN_FAST_BITS;
+	i32 multi_symbol_length_limit = serialized_length - HUFFMAN_MULTI_MAX_SYMBOLS;
+
 	i32 decompressed_length = 0;
 	while (bits_read < block_size_in_bits) {
 		if (decompressed_length >= serialized_length) {
 			break; // done
 		}
+		if (multi_symbol_table && bits_read <= multi_symbol_bits_limit && decompressed_length <= multi_symbol_length_limit) {
+			u32 entry = multi_symbol_table[bitstream_lsb_read(compressed, bits_read) & fast_mask];
+			u32 count = (entry >> 24) & 3;
+			if (count > 0) {
+				u8* dest = decompressed_buffer + decompressed_length;
+				dest[0] = (u8)entry;
+				dest[1] = (u8)(entry >> 8);
+				dest[2] = (u8)(entry >> 16);
+				decompressed_length += count;
+				bits_read += (entry >> 26) & 0xF;
+				continue;
+			}
+		}
 		i32 symbol = 0;
 		i32 code_size = 1;
 		u64 blob = bitstream_lsb_read(compressed, bits_read);
@@ -2077,6 +2275,25 @@ bool isyntax_hulsken_decompress(u8* compressed, size_t compressed_size, i32 bloc
 
 	// unpack bitplanes
 	i32 compressed_bitplane_index = 0;
+#if defined(__SSE2__)
+	if (isyntax_hulsken_fast_paths_enabled && ((block_width * block_height) % 128) == 0 && (block_width % 4) == 0) {
+		memset(out_buffer, 0, coeff_buffer_size);
+		for (i32 coeff_index = 0; coeff_index < coeff_count; ++coeff_index) {
+			u16 bitmask = bitmasks[coeff_index];
+			if (bitmask == 0) continue;
+			u8* planes[16] = {0};
+			for (i32 bit = 0; bit < 16; ++bit) {
+				if (bitmask & (1 << bit)) {
+					planes[bit] = decompressed_buffer + (compressed_bitplane_index * bytes_per_bitplane);
+					++compressed_bitplane_index;
+				}
+			}
+			isyntax_transpose_bitplanes_sse2(planes, block_width, block_height, out_buffer + (coeff_index * (block_width * block_height)));
+		}
+		release_temp_memory(&temp_memory); // frees decompressed_buffer
+		return true;
+	}
+#endif
 	arena_align(temp_memory.arena, 32);
 	u16* coeff_buffer = (u16*)arena_push_size(temp_memory.arena, coeff_buffer_size);
 	memset(coeff_buffer, 0, coeff_buffer_size);
@@ -2158,6 +2375,98 @@ bool isyntax_hulsken_decompress(u8* compressed, size_t compressed_size, i32 bloc
 	return true;
 }
 
+// Decode a sample of the codeblocks in the file, with and without the fast decoding paths, and report the throughput.
+void isyntax_benchmark_hulsken_decompress(isyntax_t* isyntax, i32 max_codeblocks, i32 iterations) {
+	if (max_codeblocks <= 0) max_codeblocks = 4096;
+	if (iterations <= 0) iterations = 3;
+	isyntax_image_t* wsi = isyntax->images + isyntax->wsi_image_index;
+	if (wsi->codeblock_count <= 0 || !wsi->codeblocks) {
+		console_print_error("Hulsken benchmark: no codeblocks available\n");
+		return;
+	}
+	i32 block_width = isyntax->block_width;
+	i32 block_height = isyntax->block_height;
+
+	// Sample non-empty codeblocks evenly across the whole file (covers all scales and both LL and H codeblocks).
+	i32 sample_stride = MAX(1, wsi->codeblock_count / max_codeblocks);
+	isyntax_codeblock_t** samples = (isyntax_codeblock_t**)malloc(max_codeblocks * sizeof(isyntax_codeblock_t*));
+	u64* sample_offsets = (u64*)malloc(max_codeblocks * sizeof(u64));
+	i32 sample_count = 0;
+	u64 total_compressed_size = 0;
+	for (i32 i = 0; i < wsi->codeblock_count && sample_count < max_codeblocks; i += sample_stride) {
+		isyntax_codeblock_t* codeblock = wsi->codeblocks + i;
+		if (codeblock->block_size <= 8) continue;
+		samples[sample_count] = codeblock;
+		sample_offsets[sample_count] = total_compressed_size;
+		++sample_count;
+		total_compressed_size += codeblock->block_size + 8; // safety bytes for the bitstream reader
+	}
+	if (sample_count == 0) {
+		console_print_error("Hulsken benchmark: no non-empty codeblocks found\n");
+		free(samples);
+		free(sample_offsets);
+		return;
+	}
+	u8* compressed = (u8*)calloc(1, total_compressed_size);
+	u64 payload_size = 0;
+	for (i32 i = 0; i < sample_count; ++i) {
+		isyntax_codeblock_t* codeblock = samples[i];
+		file_handle_read_at_offset(compressed + sample_offsets[i], isyntax->file_handle, codeblock->block_data_offset, codeblock->block_size);
+		payload_size += codeblock->block_size;
+	}
+
+	size_t max_coeff_buffer_size = 3 * block_width * block_height * sizeof(i16);
+	i16* reference = (i16*)malloc(max_coeff_buffer_size);
+	i16* output = (i16*)malloc(max_coeff_buffer_size);
+
+	bool old_fast_paths_enabled = isyntax_hulsken_fast_paths_enabled;
+	i32 mismatch_count = 0;
+	for (i32 i = 0; i < sample_count; ++i) {
+		isyntax_codeblock_t* codeblock = samples[i];
+		size_t coeff_buffer_size = (codeblock->coefficient == 1 ? 3 : 1) * block_width * block_height * sizeof(i16);
+		u8* data = compressed + sample_offsets[i];
+		isyntax_hulsken_fast_paths_enabled = false;
+		isyntax_hulsken_decompress(data, codeblock->block_size, block_width, block_height, codeblock->coefficient, 1, reference);
+		isyntax_hulsken_fast_paths_enabled = true;
+		isyntax_hulsken_decompress(data, codeblock->block_size, block_width, block_height, codeblock->coefficient, 1, output);
+		if (memcmp(reference, output, coeff_buffer_size) != 0) {
+			++mismatch_count;
+		}
+	}
+
+	console_print("Hulsken benchmark: %d codeblocks, %.2f MB compressed, %d iterations (single thread)\n",
+	              sample_count, (float)payload_size / MEGABYTES(1), iterations);
+	float baseline_mb_per_s = 0.0f;
+	for (i32 pass = 0; pass < 2; ++pass) {
+		isyntax_hulsken_fast_paths_enabled = (pass == 1);
+		i64 clock_start = get_clock();
+		for (i32 iteration = 0; iteration < iterations; ++iteration) {
+			for (i32 i = 0; i < sample_count; ++i) {
+				isyntax_codeblock_t* codeblock = samples[i];
+				isyntax_hulsken_decompress(compressed + sample_offsets[i], codeblock->block_size, block_width, block_height,
+				                           codeblock->coefficient, 1, output);
+			}
+		}
+		float seconds = get_seconds_elapsed(clock_start, get_clock());
+		float mb_per_s = ((float)payload_size * iterations / MEGABYTES(1)) / seconds;
+		if (pass == 0) baseline_mb_per_s = mb_per_s;
+		console_print("    %-10s %8.2f MB/s compressed  %8.1f us/codeblock  (%5.2fx)\n", pass == 0 ? "baseline" : "fast",
+		              mb_per_s, seconds * 1e6f / (float)(sample_count * iterations), mb_per_s / baseline_mb_per_s);
+	}
+	if (mismatch_count > 0) {
+		console_print_error("Error: %d codeblocks decoded differently with the fast paths enabled\n", mismatch_count);
+	} else {
+		console_print("    output of the fast paths is bit-exact\n");
+	}
+	isyntax_hulsken_fast_paths_enabled = old_fast_paths_enabled;
+
+	free(reference);
+	free(output);
+	free(compressed);
+	free(samples);
+	free(sample_offsets);
+}
+
 #if 0
 void debug_read_codeblock_from_file(isyntax_codeblock_t* codeblock, FILE* fp) {
 	if (fp && !codeblock->data) {
@@ -2232,12 +2541,35 @@ static void test_output_block_header(isyntax_image_t* wsi_image) {
 }
 #endif
 
+static void isyntax_create_coeff_block_allocators(isyntax_t* isyntax) {
+	size_t ll_coeff_block_size = isyntax->block_width * isyntax->block_height * sizeof(icoeff_t);
+	size_t block_allocator_maximum_capacity_in_blocks = GIGABYTES(32) / ll_coeff_block_size;
+	size_t ll_coeff_block_allocator_capacity_in_blocks = block_allocator_maximum_capacity_in_blocks / 4;
+	size_t h_coeff_block_size = ll_coeff_block_size * 3;
+	size_t h_coeff_block_allocator_capacity_in_blocks = ll_coeff_block_allocator_capacity_in_blocks * 3;
+	isyntax->ll_coeff_block_allocator = block_allocator_create(ll_coeff_block_size, ll_coeff_block_allocator_capacity_in_blocks, MEGABYTES(256));
+	isyntax->h_coeff_block_allocator = block_allocator_create(h_coeff_block_size, h_coeff_block_allocator_capacity_in_blocks, MEGABYTES(256));
+}
+
 bool isyntax_open(isyntax_t* isyntax, const char* filename) {
 
 	console_print_verbose("Attempting to open iSyntax: %s\n", filename);
 	ASSERT(isyntax);
 	memset(isyntax, 0, sizeof(*isyntax));
 
+	// If we have seen this file before, we can skip parsing the XML header and the seektable
+	if (isyntax_index_cache_enabled && isyntax_index_cache_load(isyntax, filename)) {
+		isyntax_create_coeff_block_allocators(isyntax);
+		isyntax->file_handle = open_file_handle_for_simultaneous_access(filename);
+		if (!isyntax->file_handle) {
+			console_print_error("Error: Could not reopen file for asynchronous I/O\n");
+			isyntax_destroy(isyntax);
+			return false;
+		}
+		file_mapping_open(&isyntax->file_mapping, isyntax->file_handle, FILE_MAPPING_ADVICE_RANDOM);
+		return true;
+	}
+
 	int ret = 0; (void)ret;
 	file_stream_t fp = file_stream_open_for_reading(filename);
 	bool success = false;
@@ -2606,16 +2938,22 @@ bool isyntax_open(isyntax_t* isyntax, const char* filename) {
 				goto failed;
 			}
 
-			size_t ll_coeff_block_size = isyntax->block_width * isyntax->block_height * sizeof(icoeff_t);
-			size_t block_allocator_maximum_capacity_in_blocks = GIGABYTES(32) / ll_coeff_block_size;
-			size_t ll_coeff_block_allocator_capacity_in_blocks = block_allocator_maximum_capacity_in_blocks / 4;
-			size_t h_coeff_block_size = ll_coeff_block_size * 3;
-			size_t h_coeff_block_allocator_capacity_in_blocks = ll_coeff_block_allocator_capacity_in_blocks * 3;
-			isyntax->ll_coeff_block_allocator = block_allocator_create(ll_coeff_block_size, ll_coeff_block_allocator_capacity_in_blocks, MEGABYTES(256));
-			isyntax->h_coeff_block_allocator = block_allocator_create(h_coeff_block_size, h_coeff_block_allocator_capacity_in_blocks, MEGABYTES(256));
+			isyntax_create_coeff_block_allocators(isyntax);
 
 			success = true;
 
+			if (isyntax_index_cache_enabled) {
+				isyntax_index_cache_save(isyntax, filename);
+			}
+			for (i32 i = 0; i < isyntax->image_count; ++i) {
+				isyntax_image_t* image = isyntax->images + i;
+				if (image->encoded_image_data) {
+					free(image->encoded_image_data);
+					image->encoded_image_data = NULL;
+					image->encoded_image_size = 0;
+				}
+			}
+
 			free(read_buffer);
 		}
 		file_stream_close(fp);
@@ -2625,6 +2963,8 @@ bool isyntax_open(isyntax_t* isyntax, const char* filename) {
 			if (!isyntax->file_handle) {
 				console_print_error("Error: Could not reopen file for asynchronous I/O\n");
 				success = false;
+			} else {
+				file_mapping_open(&isyntax->file_mapping, isyntax->file_handle, FILE_MAPPING_ADVICE_RANDOM);
 			}
 		}
 	}
@@ -2632,11 +2972,22 @@ bool isyntax_open(isyntax_t* isyntax, const char* filename) {
 }
 
 void isyntax_destroy(isyntax_t* isyntax) {
+	// Let queued tile requests know they can be skipped, so we don't have to wait for them to do useless work.
+	isyntax->is_being_destroyed = true;
+	write_barrier;
 	while (isyntax->refcount > 0) {
 //		console_print_error("refcount = %d\n", isyntax->refcount);
 		platform_sleep(1);
 		do_worker_work(&global_work_queue, 0);
 	}
+	// Chunk reads that were still in flight write into buffers we own, so wait for them before freeing anything.
+	for (i32 i = 0; i < arrlen(isyntax->pending_chunk_reads); ++i) {
+		isyntax_chunk_read_t* read = isyntax->pending_chunk_reads[i];
+		async_read_finalize(&read->op);
+		free(read->op.dest);
+		free(read);
+	}
+	arrfree(isyntax->pending_chunk_reads);
 	if (isyntax->ll_coeff_block_allocator.is_valid) {
 		block_allocator_destroy(&isyntax->ll_coeff_block_allocator);
 	}
@@ -2657,6 +3008,10 @@ void isyntax_destroy(isyntax_t* isyntax) {
 			free(image->pixels);
 			image->pixels = NULL;
 		}
+		if (image->encoded_image_data) {
+			free(image->encoded_image_data);
+			image->encoded_image_data = NULL;
+		}
 		if (image->image_type == ISYNTAX_IMAGE_TYPE_WSI) {
 			if (image->codeblocks) {
 				free(image->codeblocks);
@@ -2665,7 +3020,7 @@ void isyntax_destroy(isyntax_t* isyntax) {
 			if (image->data_chunks) {
 				for (i32 i = 0; i < image->data_chunk_count; ++i) {
 					isyntax_data_chunk_t* chunk = image->data_chunks + i;
-					if (chunk->data) {
+					if (chunk->data && !file_mapping_owns(&isyntax->file_mapping, chunk->data)) {
 						free(chunk->data);
 					}
 				}
@@ -2691,5 +3046,6 @@ void isyntax_destroy(isyntax_t* isyntax) {
 			}
 		}
 	}
+	file_mapping_close(&isyntax->file_mapping);
 	file_handle_close(isyntax->file_handle);
 }
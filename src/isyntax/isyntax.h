@@ -186,8 +186,17 @@ typedef struct isyntax_data_chunk_t {
 	i32 scale;
 	i32 level_count;
 	u8* data;
+	i64 last_used; // streamer pass in which the chunk was last needed (for LRU eviction)
+	volatile i32 pending_decompress_count; // queued H coefficient decompression tasks that will read the data
+	bool is_read_pending; // an asynchronous read for the chunk is in flight
 } isyntax_data_chunk_t;
 
+// Asynchronous read of a data chunk that is still in flight (may outlive a streaming pass)
+typedef struct isyntax_chunk_read_t {
+	io_operation_t op;
+	i32 chunk_index;
+} isyntax_chunk_read_t;
+
 typedef struct isyntax_tile_channel_t {
 	icoeff_t* coeff_h;
 	icoeff_t* coeff_ll;
@@ -206,6 +215,10 @@ typedef struct isyntax_tile_t {
 	bool is_submitted_for_h_coeff_decompression;
 	bool is_submitted_for_loading;
 	bool is_loaded;
+	u8 load_priority; // work queue lane the pending load request was submitted to
+	volatile i32 load_generation; // even: request queued; odd: claimed by a worker. Bumped to supersede a queued request.
+	volatile bool want_reload; // set by the viewer after it evicted the decoded tile
+	i64 last_used; // streamer pass in which the tile was last within the stream bounds (for LRU eviction)
 } isyntax_tile_t;
 
 typedef struct isyntax_level_t {
@@ -221,6 +234,7 @@ typedef struct isyntax_level_t {
 	float origin_offset_in_pixels;
 	v2f origin_offset;
 	isyntax_tile_t* tiles;
+	bounds2i stream_bounds; // tiles currently within reach of the tile streamer; queued requests outside are dropped
 	bool is_fully_loaded;
 } isyntax_level_t;
 
@@ -289,9 +303,23 @@ typedef struct isyntax_xml_parser_t {
 	bool initialized;
 } isyntax_xml_parser_t;
 
+// Memory held by the streamer for compressed data chunks and decoded coefficient blocks.
+// Only accessed by the tile streaming task (there is at most one in flight).
+typedef struct isyntax_cache_stats_t {
+	i64 pass_counter;
+	i64 chunk_bytes_resident; // copies of data chunks (chunks that point into the file mapping are not counted)
+	i64 coeff_bytes_resident;
+	i64 peak_bytes_resident;
+	float steady_bytes_resident; // moving average over the last ~10 seconds
+	i64 last_update_clock;
+	i64 chunks_evicted;
+	i64 tiles_evicted;
+} isyntax_cache_stats_t;
+
 typedef struct isyntax_t {
 	i64 filesize;
 	file_handle_t file_handle;
+	file_mapping_t file_mapping; // if valid, data chunks point straight into the mapping instead of being read
 	isyntax_image_t images[16];
 	i32 image_count;
 	isyntax_header_template_t header_templates[64];
@@ -310,26 +338,50 @@ typedef struct isyntax_t {
 	icoeff_t* white_dummy_coeff;
 	block_allocator_t ll_coeff_block_allocator;
 	block_allocator_t h_coeff_block_allocator;
+	isyntax_cache_stats_t cache_stats;
+	isyntax_chunk_read_t** pending_chunk_reads; // array (stb_ds), only accessed by the tile streaming task
 	float loading_time;
 	i32 refcount;
+	volatile bool is_being_destroyed;
 } isyntax_t;
 
+// Instruction sets for the inverse wavelet transform, chosen at runtime
+typedef enum isyntax_dwt_simd_enum {
+	ISYNTAX_DWT_SIMD_NONE = 0,
+	ISYNTAX_DWT_SIMD_SSE2,
+	ISYNTAX_DWT_SIMD_AVX2,
+	ISYNTAX_DWT_SIMD_AVX512,
+	ISYNTAX_DWT_SIMD_NEON,
+	ISYNTAX_DWT_SIMD_COUNT
+} isyntax_dwt_simd_enum;
+
+extern i32 isyntax_dwt_simd_override; // -1 = pick the fastest available
+extern bool isyntax_hulsken_fast_paths_enabled; // multi-symbol Huffman decoding + SIMD bitplane transpose
+extern bool isyntax_index_cache_enabled; // store/reuse a binary index of the parsed header in global_cache_dir
+
 // function prototypes
 void isyntax_xml_parser_init(isyntax_xml_parser_t* parser);
 bool isyntax_hulsken_decompress(u8 *compressed, size_t compressed_size, i32 block_width, i32 block_height, i32 coefficient, i32 compressor_version, i16* out_buffer);
+void isyntax_benchmark_hulsken_decompress(isyntax_t* isyntax, i32 max_codeblocks, i32 iterations);
 bool isyntax_open(isyntax_t* isyntax, const char* filename);
+bool isyntax_index_cache_load(isyntax_t* isyntax, const char* filename);
+void isyntax_index_cache_save(isyntax_t* isyntax, const char* filename);
 void isyntax_destroy(isyntax_t* isyntax);
 void isyntax_idwt(icoeff_t* idwt, i32 quadrant_width, i32 quadrant_height, bool output_steps_as_png, const char* png_name);
+bool isyntax_dwt_is_simd_supported(u32 simd);
+const char* isyntax_dwt_get_simd_name(u32 simd);
+void isyntax_benchmark_idwt(i32 iterations);
 u32* isyntax_load_tile(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y);
 u32 isyntax_get_adjacent_tiles_mask(isyntax_level_t* level, i32 tile_x, i32 tile_y);
 u32 isyntax_get_adjacent_tiles_mask_only_existing(isyntax_level_t* level, i32 tile_x, i32 tile_y);
-u32 isyntax_idwt_tile_for_color_channel(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y, i32 color, icoeff_t* dest_buffer);
+u32 isyntax_begin_idwt_tile_for_color_channel(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y, i32 color, icoeff_t* dest_buffer);
 void isyntax_decompress_codeblock_in_chunk(isyntax_codeblock_t* codeblock, i32 block_width, i32 block_height, u8* chunk, u64 chunk_base_offset, i16* out_buffer);
 i32 isyntax_get_chunk_codeblocks_per_color_for_level(i32 level, bool has_ll);
 
 // TODO: move this somewhere suitable
 void isyntax_begin_first_load(i32 resource_id, isyntax_t* isyntax, isyntax_image_t* wsi_image);
-void isyntax_begin_load_tile(i32 resource_id, isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y);
+void isyntax_begin_load_tile(i32 resource_id, isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y, u32 priority, bool is_cancellable);
+void isyntax_reprioritize_load_tile(i32 resource_id, isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y, u32 priority);
 
 #ifdef __cplusplus
 }
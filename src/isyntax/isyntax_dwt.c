@@ -45,29 +45,32 @@
  */
 // End of OpenJPEG copyright notice.
 
-#if (DWT_COEFF_BITS==16)
-#ifdef __AVX2__
-/** Number of int32 values in a AVX2 register */
-#define VREG_INT_COUNT       16
-#else
-/** Number of int32 values in a SSE2 register */
-#define VREG_INT_COUNT       8
-#endif
-#else
-#ifdef __AVX2__
-/** Number of int32 values in a AVX2 register */
-#define VREG_INT_COUNT       8
-#else
-/** Number of int32 values in a SSE2 register */
-#define VREG_INT_COUNT       4
-#endif
-#endif
-
-/** Number of columns that we can process in parallel in the vertical pass */
-#define PARALLEL_COLS_53     (2*VREG_INT_COUNT)
+// The SIMD kernels are selected at runtime, see opj_dwt_get_simd_kernels().
+typedef void opj_idwt53_h_func_t(icoeff_t* tmp, const i32 sn, const i32 len, icoeff_t* tiledp);
+typedef void opj_idwt53_v_mcols_func_t(icoeff_t* tmp, const i32 sn, const i32 len, icoeff_t* tiledp_col, const size_t stride);
+typedef void opj_idwt53_v_mcols_rows_func_t(const icoeff_t* tiledp_col, const i32 sn, const size_t stride,
+                                            i32 row_begin, i32 row_end, icoeff_t* out, const size_t out_stride);
+
+typedef struct opj_dwt_simd_kernels_t {
+	const char* name;
+	i32 parallel_cols; /* number of columns processed in parallel in the vertical pass */
+	opj_idwt53_h_func_t* h_cas1_even; /* NULL if not available */
+	opj_idwt53_v_mcols_func_t* v_cas0_mcols;
+	opj_idwt53_v_mcols_func_t* v_cas1_mcols;
+	opj_idwt53_v_mcols_rows_func_t* v_cas1_mcols_rows;
+	const struct opj_dwt_simd_kernels_t* narrower; /* for the remaining columns that don't fill a whole vector */
+} opj_dwt_simd_kernels_t;
+
+i32 isyntax_dwt_simd_override = -1;
+
+/** Largest number of columns any of the kernels processes in parallel (AVX-512 with 16-bit coefficients) */
+#define OPJ_DWT_MAX_PARALLEL_COLS 64
+/** Alignment needed for the temporary buffer (size of the largest vector register) */
+#define OPJ_DWT_TMP_ALIGNMENT 64
 
 typedef struct dwt_local {
 	icoeff_t* mem;
+	const opj_dwt_simd_kernels_t* kernels;
 	i32 dn;   /* number of elements in high pass band */
 	i32 sn;   /* number of elements in low pass band */
 	i32 cas;  /* 0 = start on even coord, 1 = start on odd coord */
@@ -178,22 +181,84 @@ static void opj_idwt53_h(const opj_dwt_t *dwt, icoeff_t* tiledp) {
 			out[0] = in_even[0] + out[1];
 			memcpy(tiledp, dwt->mem, (u32)len * sizeof(icoeff_t));
 		} else if (len > 2) {
-			opj_idwt53_h_cas1(dwt->mem, sn, len, tiledp);
+			if (dwt->kernels->h_cas1_even && len == 2 * sn) {
+				dwt->kernels->h_cas1_even(dwt->mem, sn, len, tiledp);
+			} else {
+				opj_idwt53_h_cas1(dwt->mem, sn, len, tiledp);
+			}
 		}
 	}
 }
 
-#if (defined(__SSE2__) || defined(__AVX2__))
+// Instantiate the SIMD kernels for each instruction set we may want to use (the choice is made at runtime).
+// NOTE: on x86, the project is currently compiled with -mavx (see GCC_CPU_OPTIONS in CMakeLists.txt), so the rest of
+// the program already requires AVX. In practice the runtime choice is therefore only between AVX2 and AVX-512 (or
+// SSE2 if forced with isyntax_dwt_simd_override, e.g. in the benchmark); the SSE2 kernels will only be used as the
+// fallback on older CPUs once the global -mavx baseline is lowered.
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define OPJ_DWT_X86 1
+#define OPJ_DWT_TARGET(x)
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OPJ_DWT_X86 1
+#define OPJ_DWT_TARGET(x) __attribute__((target(x)))
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OPJ_DWT_NEON 1
+#endif
+#ifndef OPJ_DWT_X86
+#define OPJ_DWT_X86 0
+#endif
+#ifndef OPJ_DWT_NEON
+#define OPJ_DWT_NEON 0
+#endif
+
+#if OPJ_DWT_X86
+
+/* SSE2 */
+#define DWT_SIMD_NAME(name) name##_sse2
+#define DWT_SIMD_TARGET     OPJ_DWT_TARGET("sse2")
+#define VREG        __m128i
+#if (DWT_COEFF_BITS==16)
+#define VREG_INT_COUNT 8
+#define LOAD_CST(x) _mm_set1_epi16(x)
+#define ADD(x,y)    _mm_add_epi16((x),(y))
+#define SUB(x,y)    _mm_sub_epi16((x),(y))
+#define SAR(x,y)    _mm_srai_epi16((x),(y))
+#define FAVG(x,y)   ADD(_mm_and_si128((x),(y)), SAR(_mm_xor_si128((x),(y)), 1))
+#define STOREU_INTERLEAVED(p,x,y) do { \
+	_mm_storeu_si128((VREG*)(p), _mm_unpacklo_epi16((x),(y))); \
+	_mm_storeu_si128((VREG*)(p) + 1, _mm_unpackhi_epi16((x),(y))); } while (0)
+#else
+#define VREG_INT_COUNT 4
+#define LOAD_CST(x) _mm_set1_epi32(x)
+#define ADD(x,y)    _mm_add_epi32((x),(y))
+#define SUB(x,y)    _mm_sub_epi32((x),(y))
+#define SAR(x,y)    _mm_srai_epi32((x),(y))
+#endif
+#define LOAD(x)     _mm_load_si128((const VREG*)(x))
+#define LOADU(x)    _mm_loadu_si128((const VREG*)(x))
+#define STORE(x,y)  _mm_store_si128((VREG*)(x),(y))
+#define STOREU(x,y) _mm_storeu_si128((VREG*)(x),(y))
+#include "isyntax_dwt_simd.c"
 
-/* Conveniency macros to improve the readabilty of the formulas */
-#if __AVX2__
+/* AVX2 */
+#define DWT_SIMD_NAME(name) name##_avx2
+#define DWT_SIMD_TARGET     OPJ_DWT_TARGET("avx2")
 #define VREG        __m256i
 #if (DWT_COEFF_BITS==16)
+#define VREG_INT_COUNT 16
 #define LOAD_CST(x) _mm256_set1_epi16(x)
 #define ADD(x,y)    _mm256_add_epi16((x),(y))
 #define SUB(x,y)    _mm256_sub_epi16((x),(y))
 #define SAR(x,y)    _mm256_srai_epi16((x),(y))
+#define FAVG(x,y)   ADD(_mm256_and_si256((x),(y)), SAR(_mm256_xor_si256((x),(y)), 1))
+/* unpacklo/hi operate within 128-bit lanes, so the lanes need to be put back in order */
+#define STOREU_INTERLEAVED(p,x,y) do { \
+	VREG lo_ = _mm256_unpacklo_epi16((x),(y)); VREG hi_ = _mm256_unpackhi_epi16((x),(y)); \
+	_mm256_storeu_si256((VREG*)(p), _mm256_permute2x128_si256(lo_, hi_, 0x20)); \
+	_mm256_storeu_si256((VREG*)(p) + 1, _mm256_permute2x128_si256(lo_, hi_, 0x31)); } while (0)
 #else
+#define VREG_INT_COUNT 8
 #define LOAD_CST(x) _mm256_set1_epi32(x)
 #define ADD(x,y)    _mm256_add_epi32((x),(y))
 #define SUB(x,y)    _mm256_sub_epi32((x),(y))
@@ -203,244 +268,128 @@ static void opj_idwt53_h(const opj_dwt_t *dwt, icoeff_t* tiledp) {
 #define LOADU(x)    _mm256_loadu_si256((const VREG*)(x))
 #define STORE(x,y)  _mm256_store_si256((VREG*)(x),(y))
 #define STOREU(x,y) _mm256_storeu_si256((VREG*)(x),(y))
-#else
-#define VREG        __m128i
+#include "isyntax_dwt_simd.c"
+
+/* AVX-512 (BW needed for the 16-bit operations) */
+#define DWT_SIMD_NAME(name) name##_avx512
+#define DWT_SIMD_TARGET     OPJ_DWT_TARGET("avx512f,avx512bw")
+#define VREG        __m512i
 #if (DWT_COEFF_BITS==16)
-#define LOAD_CST(x) _mm_set1_epi16(x)
-#define ADD(x,y)    _mm_add_epi16((x),(y))
-#define SUB(x,y)    _mm_sub_epi16((x),(y))
-#define SAR(x,y)    _mm_srai_epi16((x),(y))
+#define VREG_INT_COUNT 32
+#define LOAD_CST(x) _mm512_set1_epi16(x)
+#define ADD(x,y)    _mm512_add_epi16((x),(y))
+#define SUB(x,y)    _mm512_sub_epi16((x),(y))
+#define SAR(x,y)    _mm512_srai_epi16((x),(y))
+#define FAVG(x,y)   ADD(_mm512_and_si512((x),(y)), SAR(_mm512_xor_si512((x),(y)), 1))
+#define STOREU_INTERLEAVED(p,x,y) do { \
+	VREG lo_ = _mm512_unpacklo_epi16((x),(y)); VREG hi_ = _mm512_unpackhi_epi16((x),(y)); \
+	_mm512_storeu_si512((VREG*)(p), _mm512_permutex2var_epi64(lo_, _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11), hi_)); \
+	_mm512_storeu_si512((VREG*)(p) + 1, _mm512_permutex2var_epi64(lo_, _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15), hi_)); } while (0)
 #else
-#define LOAD_CST(x) _mm_set1_epi32(x)
-#define ADD(x,y)    _mm_add_epi32((x),(y))
-#define SUB(x,y)    _mm_sub_epi32((x),(y))
-#define SAR(x,y)    _mm_srai_epi32((x),(y))
-#endif
-#define LOAD(x)     _mm_load_si128((const VREG*)(x))
-#define LOADU(x)    _mm_loadu_si128((const VREG*)(x))
-#define STORE(x,y)  _mm_store_si128((VREG*)(x),(y))
-#define STOREU(x,y) _mm_storeu_si128((VREG*)(x),(y))
+#define VREG_INT_COUNT 16
+#define LOAD_CST(x) _mm512_set1_epi32(x)
+#define ADD(x,y)    _mm512_add_epi32((x),(y))
+#define SUB(x,y)    _mm512_sub_epi32((x),(y))
+#define SAR(x,y)    _mm512_srai_epi32((x),(y))
 #endif
-#define ADD3(x,y,z) ADD(ADD(x,y),z)
-
-static void opj_idwt53_v_final_memcpy(icoeff_t* tiledp_col, const icoeff_t* tmp, i32 len, size_t stride) {
-	for (i32 i = 0; i < len; ++i) {
-		/* A memcpy(&tiledp_col[i * stride + 0],
-					&tmp[PARALLEL_COLS_53 * i + 0],
-					PARALLEL_COLS_53 * sizeof(i32))
-		   would do but would be a tiny bit slower.
-		   We can take here advantage of our knowledge of alignment */
-		STOREU(&tiledp_col[(size_t)i * stride + 0],
-		       LOAD(&tmp[PARALLEL_COLS_53 * i + 0]));
-		STOREU(&tiledp_col[(size_t)i * stride + VREG_INT_COUNT],
-		       LOAD(&tmp[PARALLEL_COLS_53 * i + VREG_INT_COUNT]));
-	}
-}
-
-/** Vertical inverse 5x3 wavelet transform for 8 columns in SSE2, or
- * 16 in AVX2, when top-most pixel is on even coordinate */
-static void opj_idwt53_v_cas0_mcols_SSE2_OR_AVX2(icoeff_t* tmp, const i32 sn, const i32 len, icoeff_t* tiledp_col, const size_t stride) {
-	const icoeff_t* in_even = &tiledp_col[0];
-	const icoeff_t* in_odd = &tiledp_col[(size_t)sn * stride];
+#define LOAD(x)     _mm512_load_si512((const VREG*)(x))
+#define LOADU(x)    _mm512_loadu_si512((const VREG*)(x))
+#define STORE(x,y)  _mm512_store_si512((VREG*)(x),(y))
+#define STOREU(x,y) _mm512_storeu_si512((VREG*)(x),(y))
+#include "isyntax_dwt_simd.c"
 
-	i32 i;
-	size_t j;
-	VREG d1c_0, d1n_0, s1n_0, s0c_0, s0n_0;
-	VREG d1c_1, d1n_1, s1n_1, s0c_1, s0n_1;
-	const VREG two = LOAD_CST(2);
+#elif OPJ_DWT_NEON
 
-	ASSERT(len > 1);
-/*#if __AVX2__
-	ASSERT(PARALLEL_COLS_53 == 16);
-    ASSERT(VREG_INT_COUNT == 8);
+/* NEON */
+#define DWT_SIMD_NAME(name) name##_neon
+#define DWT_SIMD_TARGET
+#if (DWT_COEFF_BITS==16)
+#define VREG        int16x8_t
+#define VREG_INT_COUNT 8
+#define LOAD_CST(x) vdupq_n_s16(x)
+#define ADD(x,y)    vaddq_s16((x),(y))
+#define SUB(x,y)    vsubq_s16((x),(y))
+#define SAR(x,y)    vshrq_n_s16((x),(y))
+#define FAVG(x,y)   vhaddq_s16((x),(y)) /* halving add: (x+y)>>1 without overflow */
+#define STOREU_INTERLEAVED(p,x,y) do { int16x8x2_t xy_ = {{(x), (y)}}; vst2q_s16((int16_t*)(p), xy_); } while (0)
+#define LOAD(x)     vld1q_s16((const int16_t*)(x))
+#define STORE(x,y)  vst1q_s16((int16_t*)(x),(y))
 #else
-	ASSERT(PARALLEL_COLS_53 == 8);
-	ASSERT(VREG_INT_COUNT == 4);
-#endif*/
-
-	/* Note: loads of input even/odd values must be done in a unaligned */
-	/* fashion. But stores in tmp can be done with aligned store, since */
-	/* the temporary buffer is properly aligned */
-	ASSERT((size_t)tmp % (sizeof(icoeff_t) * VREG_INT_COUNT) == 0);
-
-	s1n_0 = LOADU(in_even + 0);
-	s1n_1 = LOADU(in_even + VREG_INT_COUNT);
-	d1n_0 = LOADU(in_odd);
-	d1n_1 = LOADU(in_odd + VREG_INT_COUNT);
-
-	/* s0n = s1n - ((d1n + 1) >> 1); <==> */
-	/* s0n = s1n - ((d1n + d1n + 2) >> 2); */
-	s0n_0 = SUB(s1n_0, SAR(ADD3(d1n_0, d1n_0, two), 2));
-	s0n_1 = SUB(s1n_1, SAR(ADD3(d1n_1, d1n_1, two), 2));
-
-	for (i = 0, j = 1; i < (len - 3); i += 2, j++) {
-		d1c_0 = d1n_0;
-		s0c_0 = s0n_0;
-		d1c_1 = d1n_1;
-		s0c_1 = s0n_1;
-
-		s1n_0 = LOADU(in_even + j * stride);
-		s1n_1 = LOADU(in_even + j * stride + VREG_INT_COUNT);
-		d1n_0 = LOADU(in_odd + j * stride);
-		d1n_1 = LOADU(in_odd + j * stride + VREG_INT_COUNT);
-
-		/*s0n = s1n - ((d1c + d1n + 2) >> 2);*/
-		s0n_0 = SUB(s1n_0, SAR(ADD3(d1c_0, d1n_0, two), 2));
-		s0n_1 = SUB(s1n_1, SAR(ADD3(d1c_1, d1n_1, two), 2));
-
-		STORE(tmp + PARALLEL_COLS_53 * (i + 0), s0c_0);
-		STORE(tmp + PARALLEL_COLS_53 * (i + 0) + VREG_INT_COUNT, s0c_1);
-
-		/* d1c + ((s0c + s0n) >> 1) */
-		STORE(tmp + PARALLEL_COLS_53 * (i + 1) + 0,
-		      ADD(d1c_0, SAR(ADD(s0c_0, s0n_0), 1)));
-		STORE(tmp + PARALLEL_COLS_53 * (i + 1) + VREG_INT_COUNT,
-		      ADD(d1c_1, SAR(ADD(s0c_1, s0n_1), 1)));
-	}
+#define VREG        int32x4_t
+#define VREG_INT_COUNT 4
+#define LOAD_CST(x) vdupq_n_s32(x)
+#define ADD(x,y)    vaddq_s32((x),(y))
+#define SUB(x,y)    vsubq_s32((x),(y))
+#define SAR(x,y)    vshrq_n_s32((x),(y))
+#define LOAD(x)     vld1q_s32((const int32_t*)(x))
+#define STORE(x,y)  vst1q_s32((int32_t*)(x),(y))
+#endif
+#define LOADU(x)    LOAD(x)
+#define STOREU(x,y) STORE(x,y)
+#include "isyntax_dwt_simd.c"
 
-	STORE(tmp + PARALLEL_COLS_53 * (i + 0) + 0, s0n_0);
-	STORE(tmp + PARALLEL_COLS_53 * (i + 0) + VREG_INT_COUNT, s0n_1);
+#endif
 
-	if (len & 1) {
-		VREG tmp_len_minus_1;
-		s1n_0 = LOADU(in_even + (size_t)((len - 1) / 2) * stride);
-		/* tmp_len_minus_1 = s1n - ((d1n + 1) >> 1); */
-		tmp_len_minus_1 = SUB(s1n_0, SAR(ADD3(d1n_0, d1n_0, two), 2));
-		STORE(tmp + PARALLEL_COLS_53 * (len - 1), tmp_len_minus_1);
-		/* d1n + ((s0n + tmp_len_minus_1) >> 1) */
-		STORE(tmp + PARALLEL_COLS_53 * (len - 2),
-		      ADD(d1n_0, SAR(ADD(s0n_0, tmp_len_minus_1), 1)));
-
-		s1n_1 = LOADU(in_even + (size_t)((len - 1) / 2) * stride + VREG_INT_COUNT);
-		/* tmp_len_minus_1 = s1n - ((d1n + 1) >> 1); */
-		tmp_len_minus_1 = SUB(s1n_1, SAR(ADD3(d1n_1, d1n_1, two), 2));
-		STORE(tmp + PARALLEL_COLS_53 * (len - 1) + VREG_INT_COUNT,
-		      tmp_len_minus_1);
-		/* d1n + ((s0n + tmp_len_minus_1) >> 1) */
-		STORE(tmp + PARALLEL_COLS_53 * (len - 2) + VREG_INT_COUNT,
-		      ADD(d1n_1, SAR(ADD(s0n_1, tmp_len_minus_1), 1)));
+#if (DWT_COEFF_BITS==16)
+#define OPJ_DWT_H_KERNEL(suffix) opj_idwt53_h_cas1_even_##suffix
+#else
+#define OPJ_DWT_H_KERNEL(suffix) NULL
+#endif
 
-	} else {
-		STORE(tmp + PARALLEL_COLS_53 * (len - 1) + 0,
-		      ADD(d1n_0, s0n_0));
-		STORE(tmp + PARALLEL_COLS_53 * (len - 1) + VREG_INT_COUNT,
-		      ADD(d1n_1, s0n_1));
+static opj_dwt_simd_kernels_t opj_dwt_simd_kernels[ISYNTAX_DWT_SIMD_COUNT] = {
+	[ISYNTAX_DWT_SIMD_NONE] = {"scalar", 16, NULL, NULL, NULL, NULL, NULL},
+#if OPJ_DWT_X86
+	[ISYNTAX_DWT_SIMD_SSE2] = {"SSE2", (DWT_COEFF_BITS==16) ? 16 : 8, OPJ_DWT_H_KERNEL(sse2),
+	                           opj_idwt53_v_cas0_mcols_sse2, opj_idwt53_v_cas1_mcols_sse2, opj_idwt53_v_cas1_mcols_rows_sse2, NULL},
+	[ISYNTAX_DWT_SIMD_AVX2] = {"AVX2", (DWT_COEFF_BITS==16) ? 32 : 16, OPJ_DWT_H_KERNEL(avx2),
+	                           opj_idwt53_v_cas0_mcols_avx2, opj_idwt53_v_cas1_mcols_avx2, opj_idwt53_v_cas1_mcols_rows_avx2, opj_dwt_simd_kernels + ISYNTAX_DWT_SIMD_SSE2},
+	[ISYNTAX_DWT_SIMD_AVX512] = {"AVX-512BW", (DWT_COEFF_BITS==16) ? 64 : 32, OPJ_DWT_H_KERNEL(avx512),
+	                             opj_idwt53_v_cas0_mcols_avx512, opj_idwt53_v_cas1_mcols_avx512, opj_idwt53_v_cas1_mcols_rows_avx512, opj_dwt_simd_kernels + ISYNTAX_DWT_SIMD_AVX2},
+#elif OPJ_DWT_NEON
+	[ISYNTAX_DWT_SIMD_NEON] = {"NEON", (DWT_COEFF_BITS==16) ? 16 : 8, OPJ_DWT_H_KERNEL(neon),
+	                           opj_idwt53_v_cas0_mcols_neon, opj_idwt53_v_cas1_mcols_neon, opj_idwt53_v_cas1_mcols_rows_neon, NULL},
+#endif
+};
+
+bool isyntax_dwt_is_simd_supported(u32 simd) {
+	if (simd >= ISYNTAX_DWT_SIMD_COUNT) return false;
+	u32 cpu_features = get_cpu_simd_features();
+	switch (simd) {
+		default: return false;
+		case ISYNTAX_DWT_SIMD_NONE: return true;
+		case ISYNTAX_DWT_SIMD_SSE2: return OPJ_DWT_X86 && (cpu_features & CPU_SIMD_SSE2);
+		case ISYNTAX_DWT_SIMD_AVX2: return OPJ_DWT_X86 && (cpu_features & CPU_SIMD_AVX2);
+		case ISYNTAX_DWT_SIMD_AVX512: return OPJ_DWT_X86 && (cpu_features & CPU_SIMD_AVX512BW);
+		case ISYNTAX_DWT_SIMD_NEON: return OPJ_DWT_NEON && (cpu_features & CPU_SIMD_NEON);
 	}
-
-	opj_idwt53_v_final_memcpy(tiledp_col, tmp, len, stride);
 }
 
+const char* isyntax_dwt_get_simd_name(u32 simd) {
+	return (simd < ISYNTAX_DWT_SIMD_COUNT && opj_dwt_simd_kernels[simd].name) ? opj_dwt_simd_kernels[simd].name : "unavailable";
+}
 
-/** Vertical inverse 5x3 wavelet transform for 8 columns in SSE2, or
- * 16 in AVX2, when top-most pixel is on odd coordinate */
-static void opj_idwt53_v_cas1_mcols_SSE2_OR_AVX2(icoeff_t* tmp, const i32 sn, const i32 len, icoeff_t* tiledp_col, const size_t stride) {
-	i32 i;
-	size_t j;
-
-	VREG s1_0, s2_0, dc_0, dn_0;
-	VREG s1_1, s2_1, dc_1, dn_1;
-	const VREG two = LOAD_CST(2);
-
-	const icoeff_t* in_even = &tiledp_col[(size_t)sn * stride];
-	const icoeff_t* in_odd = &tiledp_col[0];
-
-	ASSERT(len > 2);
-/*#if __AVX2__
-	ASSERT(PARALLEL_COLS_53 == 16);
-    ASSERT(VREG_INT_COUNT == 8);
-#else
-	ASSERT(PARALLEL_COLS_53 == 8);
-	ASSERT(VREG_INT_COUNT == 4);
-#endif*/
-
-	/* Note: loads of input even/odd values must be done in a unaligned */
-	/* fashion. But stores in tmp can be done with aligned store, since */
-	/* the temporary buffer is properly aligned */
-	ASSERT((size_t)tmp % (sizeof(icoeff_t) * VREG_INT_COUNT) == 0);
-
-	s1_0 = LOADU(in_even + stride);
-	/* in_odd[0] - ((in_even[0] + s1 + 2) >> 2); */
-	dc_0 = SUB(LOADU(in_odd + 0),
-	           SAR(ADD3(LOADU(in_even + 0), s1_0, two), 2));
-	STORE(tmp + PARALLEL_COLS_53 * 0, ADD(LOADU(in_even + 0), dc_0));
-
-	s1_1 = LOADU(in_even + stride + VREG_INT_COUNT);
-	/* in_odd[0] - ((in_even[0] + s1 + 2) >> 2); */
-	dc_1 = SUB(LOADU(in_odd + VREG_INT_COUNT),
-	           SAR(ADD3(LOADU(in_even + VREG_INT_COUNT), s1_1, two), 2));
-	STORE(tmp + PARALLEL_COLS_53 * 0 + VREG_INT_COUNT,
-	      ADD(LOADU(in_even + VREG_INT_COUNT), dc_1));
-
-	for (i = 1, j = 1; i < (len - 2 - !(len & 1)); i += 2, j++) {
-
-		s2_0 = LOADU(in_even + (j + 1) * stride);
-		s2_1 = LOADU(in_even + (j + 1) * stride + VREG_INT_COUNT);
-
-		/* dn = in_odd[j * stride] - ((s1 + s2 + 2) >> 2); */
-		dn_0 = SUB(LOADU(in_odd + j * stride),
-		           SAR(ADD3(s1_0, s2_0, two), 2));
-		dn_1 = SUB(LOADU(in_odd + j * stride + VREG_INT_COUNT),
-		           SAR(ADD3(s1_1, s2_1, two), 2));
-
-		STORE(tmp + PARALLEL_COLS_53 * i, dc_0);
-		STORE(tmp + PARALLEL_COLS_53 * i + VREG_INT_COUNT, dc_1);
-
-		/* tmp[i + 1] = s1 + ((dn + dc) >> 1); */
-		STORE(tmp + PARALLEL_COLS_53 * (i + 1) + 0,
-		      ADD(s1_0, SAR(ADD(dn_0, dc_0), 1)));
-		STORE(tmp + PARALLEL_COLS_53 * (i + 1) + VREG_INT_COUNT,
-		      ADD(s1_1, SAR(ADD(dn_1, dc_1), 1)));
-
-		dc_0 = dn_0;
-		s1_0 = s2_0;
-		dc_1 = dn_1;
-		s1_1 = s2_1;
+// Returns the fastest set of kernels the CPU supports (unless overridden with isyntax_dwt_simd_override).
+static const opj_dwt_simd_kernels_t* opj_dwt_get_simd_kernels(void) {
+	static volatile i32 best_simd = -1; // NOTE: racy initialization is benign, every thread computes the same value
+	if (isyntax_dwt_simd_override >= 0 && isyntax_dwt_is_simd_supported(isyntax_dwt_simd_override)) {
+		return opj_dwt_simd_kernels + isyntax_dwt_simd_override;
 	}
-	STORE(tmp + PARALLEL_COLS_53 * i, dc_0);
-	STORE(tmp + PARALLEL_COLS_53 * i + VREG_INT_COUNT, dc_1);
-
-	if (!(len & 1)) {
-		/*dn = in_odd[(len / 2 - 1) * stride] - ((s1 + 1) >> 1); */
-		dn_0 = SUB(LOADU(in_odd + (size_t)(len / 2 - 1) * stride),
-		           SAR(ADD3(s1_0, s1_0, two), 2));
-		dn_1 = SUB(LOADU(in_odd + (size_t)(len / 2 - 1) * stride + VREG_INT_COUNT),
-		           SAR(ADD3(s1_1, s1_1, two), 2));
-
-		/* tmp[len - 2] = s1 + ((dn + dc) >> 1); */
-		STORE(tmp + PARALLEL_COLS_53 * (len - 2) + 0,
-		      ADD(s1_0, SAR(ADD(dn_0, dc_0), 1)));
-		STORE(tmp + PARALLEL_COLS_53 * (len - 2) + VREG_INT_COUNT,
-		      ADD(s1_1, SAR(ADD(dn_1, dc_1), 1)));
-
-		STORE(tmp + PARALLEL_COLS_53 * (len - 1) + 0, dn_0);
-		STORE(tmp + PARALLEL_COLS_53 * (len - 1) + VREG_INT_COUNT, dn_1);
-	} else {
-		STORE(tmp + PARALLEL_COLS_53 * (len - 1) + 0, ADD(s1_0, dc_0));
-		STORE(tmp + PARALLEL_COLS_53 * (len - 1) + VREG_INT_COUNT,
-		      ADD(s1_1, dc_1));
+	if (best_simd < 0) {
+		i32 simd = ISYNTAX_DWT_SIMD_NONE;
+		if (isyntax_dwt_is_simd_supported(ISYNTAX_DWT_SIMD_NEON)) simd = ISYNTAX_DWT_SIMD_NEON;
+		if (isyntax_dwt_is_simd_supported(ISYNTAX_DWT_SIMD_SSE2)) simd = ISYNTAX_DWT_SIMD_SSE2;
+		if (isyntax_dwt_is_simd_supported(ISYNTAX_DWT_SIMD_AVX2)) simd = ISYNTAX_DWT_SIMD_AVX2;
+		if (isyntax_dwt_is_simd_supported(ISYNTAX_DWT_SIMD_AVX512)) simd = ISYNTAX_DWT_SIMD_AVX512;
+		best_simd = simd;
 	}
-
-	opj_idwt53_v_final_memcpy(tiledp_col, tmp, len, stride);
+	return opj_dwt_simd_kernels + best_simd;
 }
 
-#undef VREG
-#undef LOAD_CST
-#undef LOADU
-#undef LOAD
-#undef STORE
-#undef STOREU
-#undef ADD
-#undef ADD3
-#undef SUB
-#undef SAR
-
-#endif /* (defined(__SSE2__) || defined(__AVX2__)) && !defined(STANDARD_SLOW_VERSION) */
-
 /** Vertical inverse 5x3 wavelet transform for one column, when top-most
  * pixel is on even coordinate */
 static void opj_idwt3_v_cas0(icoeff_t* tmp, const i32 sn, const i32 len, icoeff_t* tiledp_col, const size_t stride) {
 	i32 i, j;
-	i32 d1c, d1n, s1n, s0c, s0n;
+	icoeff_t d1c, d1n, s1n, s0c, s0n;
 
 	ASSERT(len > 1);
 
@@ -484,7 +433,7 @@ static void opj_idwt3_v_cas0(icoeff_t* tmp, const i32 sn, const i32 len, icoeff_
  * pixel is on odd coordinate */
 static void opj_idwt3_v_cas1(icoeff_t* tmp, const i32 sn, const i32 len, icoeff_t* tiledp_col, const size_t stride) {
 	i32 i, j;
-	i32 s1, s2, dc, dn;
+	icoeff_t s1, s2, dc, dn;
 	const icoeff_t* in_even = &tiledp_col[(size_t)sn * stride];
 	const icoeff_t* in_odd = &tiledp_col[0];
 
@@ -531,14 +480,12 @@ static void opj_idwt53_v(const opj_dwt_t *dwt, icoeff_t* tiledp_col, size_t stri
 	if (dwt->cas == 0) {
 		/* If len == 1, unmodified value */
 
-#if (defined(__SSE2__) || defined(__AVX2__))
-		if (len > 1 && nb_cols == PARALLEL_COLS_53) {
-			/* Same as below general case, except that thanks to SSE2/AVX2 */
-			/* we can efficiently process 8/16 columns in parallel */
-			opj_idwt53_v_cas0_mcols_SSE2_OR_AVX2(dwt->mem, sn, len, tiledp_col, stride);
+		if (len > 1 && nb_cols == dwt->kernels->parallel_cols && dwt->kernels->v_cas0_mcols) {
+			/* Same as below general case, except that thanks to SIMD */
+			/* we can efficiently process multiple columns in parallel */
+			dwt->kernels->v_cas0_mcols(dwt->mem, sn, len, tiledp_col, stride);
 			return;
 		}
-#endif
 		if (len > 1) {
 			i32 c;
 			for (c = 0; c < nb_cols; c++, tiledp_col++) {
@@ -574,14 +521,12 @@ static void opj_idwt53_v(const opj_dwt_t *dwt, icoeff_t* tiledp_col, size_t stri
 			return;
 		}
 
-#if (defined(__SSE2__) || defined(__AVX2__))
-		if (len > 2 && nb_cols == PARALLEL_COLS_53) {
-			/* Same as below general case, except that thanks to SSE2/AVX2 */
-			/* we can efficiently process 8/16 columns in parallel */
-			opj_idwt53_v_cas1_mcols_SSE2_OR_AVX2(dwt->mem, sn, len, tiledp_col, stride);
+		if (len > 2 && nb_cols == dwt->kernels->parallel_cols && dwt->kernels->v_cas1_mcols) {
+			/* Same as below general case, except that thanks to SIMD */
+			/* we can efficiently process multiple columns in parallel */
+			dwt->kernels->v_cas1_mcols(dwt->mem, sn, len, tiledp_col, stride);
 			return;
 		}
-#endif
 		if (len > 2) {
 			i32 c;
 			for (c = 0; c < nb_cols; c++, tiledp_col++) {
@@ -591,4 +536,56 @@ static void opj_idwt53_v(const opj_dwt_t *dwt, icoeff_t* tiledp_col, size_t stri
 		}
 	}
 }
-// End of openjp2 code.
\ No newline at end of file
+// End of openjp2 code.
+
+/** Vertical inverse 5x3 wavelet transform for one column, when top-most pixel is on odd coordinate and the column length
+ * is even (len == 2 * sn), computing only the output rows [row_begin, row_end) into out. Bit-exact with
+ * opj_idwt3_v_cas1(); see opj_idwt53_v_cas1_mcols_rows() in isyntax_dwt_simd.c for how this works. */
+static void opj_idwt3_v_cas1_rows(const icoeff_t* tiledp_col, const i32 sn, const size_t stride,
+                                  i32 row_begin, i32 row_end, icoeff_t* out, const size_t out_stride) {
+	const icoeff_t* in_even = &tiledp_col[(size_t)sn * stride];
+	const icoeff_t* in_odd = &tiledp_col[0];
+#define D(j) (icoeff_t)(in_odd[(size_t)(j) * stride] - \
+                        ((in_even[(size_t)(j) * stride] + in_even[(size_t)((j) < sn - 1 ? (j) + 1 : (j)) * stride] + 2) >> 2))
+
+	ASSERT(sn >= 2 && row_begin >= 0 && row_begin < row_end && row_end <= 2 * sn);
+
+	i32 r = row_begin;
+	i32 j = r / 2;
+	icoeff_t dc, dn;
+	if (r & 1) {
+		dc = D(j);
+		*out = dc;
+		out += out_stride;
+		++r;
+		++j;
+	} else {
+		dc = D(ATLEAST(j - 1, 0)); /* for the first row: ((d[0] + d[0]) >> 1) == d[0] */
+	}
+	for (; r < row_end; r += 2, ++j) {
+		dn = D(j);
+		*out = in_even[(size_t)j * stride] + ((dn + dc) >> 1);
+		out += out_stride;
+		if (r + 1 < row_end) {
+			*out = dn;
+			out += out_stride;
+		}
+		dc = dn;
+	}
+#undef D
+}
+
+/* Inverse vertical 5-3 wavelet transform for several columns, computing only the output rows [row_begin, row_end).
+ * The result goes into out (with row stride out_stride), the input is left intact.
+ * NOTE: only implemented for cas == 1 and an even length, which is what iSyntax uses. */
+static void opj_idwt53_v_rows(const opj_dwt_t *dwt, const icoeff_t* tiledp_col, size_t stride, i32 nb_cols,
+                              i32 row_begin, i32 row_end, icoeff_t* out, size_t out_stride) {
+	ASSERT(dwt->cas == 1 && dwt->sn == dwt->dn);
+	if (nb_cols == dwt->kernels->parallel_cols && dwt->kernels->v_cas1_mcols_rows) {
+		dwt->kernels->v_cas1_mcols_rows(tiledp_col, dwt->sn, stride, row_begin, row_end, out, out_stride);
+		return;
+	}
+	for (i32 c = 0; c < nb_cols; c++, tiledp_col++, out++) {
+		opj_idwt3_v_cas1_rows(tiledp_col, dwt->sn, stride, row_begin, row_end, out, out_stride);
+	}
+}
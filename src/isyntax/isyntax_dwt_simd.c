@@ -0,0 +1,331 @@
+// Code from the openjp2 library:
+// inverse discrete wavelet transform (5/3), SIMD kernels
+
+// See: https://github.com/uclouvain/openjpeg
+// The OpenJPEG license information is included in isyntax_dwt.c.
+
+// This file is a 'template': it is included by isyntax_dwt.c once for each supported instruction set.
+// Before including, the following need to be defined:
+// DWT_SIMD_NAME(name)   -> decorate function names with the instruction set suffix
+// DWT_SIMD_TARGET       -> function attribute enabling the instruction set (may be empty)
+// VREG, VREG_INT_COUNT  -> vector register type, and number of icoeff_t values it holds
+// LOAD_CST, ADD, SUB, SAR, LOAD, LOADU, STORE, STOREU -> basic operations
+// FAVG(x,y)             -> floor((x+y)/2) without intermediate overflow (16-bit coefficients only)
+// STOREU_INTERLEAVED(p,x,y) -> store x0,y0,x1,y1,... at p (16-bit coefficients only)
+// These are all undefined again at the end of this file.
+
+/** Number of columns that we can process in parallel in the vertical pass */
+#define PARALLEL_COLS_53     (2*VREG_INT_COUNT)
+#define ADD3(x,y,z) ADD(ADD(x,y),z)
+
+/* (x + y) >> 1 and (x + y + 2) >> 2 as in the scalar code, where the sum is computed without overflow (the scalar code
+ * promotes icoeff_t to int). With 16-bit coefficients, a plain ADD would wrap around for large coefficients. */
+#ifdef FAVG
+#define HALF_SUM(x,y)    FAVG(x,y)
+#define QUARTER_SUM(x,y) FAVG(FAVG(x,y), one)
+#else
+#define HALF_SUM(x,y)    SAR(ADD(x,y), 1)
+#define QUARTER_SUM(x,y) SAR(ADD3(x,y,two), 2)
+#endif
+
+static DWT_SIMD_TARGET void DWT_SIMD_NAME(opj_idwt53_v_final_memcpy)(icoeff_t* tiledp_col, const icoeff_t* tmp, i32 len, size_t stride) {
+	for (i32 i = 0; i < len; ++i) {
+		/* A memcpy(&tiledp_col[i * stride + 0],
+					&tmp[PARALLEL_COLS_53 * i + 0],
+					PARALLEL_COLS_53 * sizeof(i32))
+		   would do but would be a tiny bit slower.
+		   We can take here advantage of our knowledge of alignment */
+		STOREU(&tiledp_col[(size_t)i * stride + 0],
+		       LOAD(&tmp[PARALLEL_COLS_53 * i + 0]));
+		STOREU(&tiledp_col[(size_t)i * stride + VREG_INT_COUNT],
+		       LOAD(&tmp[PARALLEL_COLS_53 * i + VREG_INT_COUNT]));
+	}
+}
+
+/** Vertical inverse 5x3 wavelet transform for PARALLEL_COLS_53 columns,
+ * when top-most pixel is on even coordinate */
+static DWT_SIMD_TARGET void DWT_SIMD_NAME(opj_idwt53_v_cas0_mcols)(icoeff_t* tmp, const i32 sn, const i32 len, icoeff_t* tiledp_col, const size_t stride) {
+	const icoeff_t* in_even = &tiledp_col[0];
+	const icoeff_t* in_odd = &tiledp_col[(size_t)sn * stride];
+
+	i32 i;
+	size_t j;
+	VREG d1c_0, d1n_0, s1n_0, s0c_0, s0n_0;
+	VREG d1c_1, d1n_1, s1n_1, s0c_1, s0n_1;
+	const VREG one = LOAD_CST(1);
+	const VREG two = LOAD_CST(2);
+
+	ASSERT(len > 1);
+	/* Note: loads of input even/odd values must be done in a unaligned */
+	/* fashion. But stores in tmp can be done with aligned store, since */
+	/* the temporary buffer is properly aligned */
+	ASSERT((size_t)tmp % (sizeof(icoeff_t) * VREG_INT_COUNT) == 0);
+
+	s1n_0 = LOADU(in_even + 0);
+	s1n_1 = LOADU(in_even + VREG_INT_COUNT);
+	d1n_0 = LOADU(in_odd);
+	d1n_1 = LOADU(in_odd + VREG_INT_COUNT);
+
+	/* s0n = s1n - ((d1n + 1) >> 1); <==> */
+	/* s0n = s1n - ((d1n + d1n + 2) >> 2); */
+	s0n_0 = SUB(s1n_0, QUARTER_SUM(d1n_0, d1n_0));
+	s0n_1 = SUB(s1n_1, QUARTER_SUM(d1n_1, d1n_1));
+
+	for (i = 0, j = 1; i < (len - 3); i += 2, j++) {
+		d1c_0 = d1n_0;
+		s0c_0 = s0n_0;
+		d1c_1 = d1n_1;
+		s0c_1 = s0n_1;
+
+		s1n_0 = LOADU(in_even + j * stride);
+		s1n_1 = LOADU(in_even + j * stride + VREG_INT_COUNT);
+		d1n_0 = LOADU(in_odd + j * stride);
+		d1n_1 = LOADU(in_odd + j * stride + VREG_INT_COUNT);
+
+		/*s0n = s1n - ((d1c + d1n + 2) >> 2);*/
+		s0n_0 = SUB(s1n_0, QUARTER_SUM(d1c_0, d1n_0));
+		s0n_1 = SUB(s1n_1, QUARTER_SUM(d1c_1, d1n_1));
+
+		STORE(tmp + PARALLEL_COLS_53 * (i + 0), s0c_0);
+		STORE(tmp + PARALLEL_COLS_53 * (i + 0) + VREG_INT_COUNT, s0c_1);
+
+		/* d1c + ((s0c + s0n) >> 1) */
+		STORE(tmp + PARALLEL_COLS_53 * (i + 1) + 0,
+		      ADD(d1c_0, HALF_SUM(s0c_0, s0n_0)));
+		STORE(tmp + PARALLEL_COLS_53 * (i + 1) + VREG_INT_COUNT,
+		      ADD(d1c_1, HALF_SUM(s0c_1, s0n_1)));
+	}
+
+	STORE(tmp + PARALLEL_COLS_53 * (i + 0) + 0, s0n_0);
+	STORE(tmp + PARALLEL_COLS_53 * (i + 0) + VREG_INT_COUNT, s0n_1);
+
+	if (len & 1) {
+		VREG tmp_len_minus_1;
+		s1n_0 = LOADU(in_even + (size_t)((len - 1) / 2) * stride);
+		/* tmp_len_minus_1 = s1n - ((d1n + 1) >> 1); */
+		tmp_len_minus_1 = SUB(s1n_0, QUARTER_SUM(d1n_0, d1n_0));
+		STORE(tmp + PARALLEL_COLS_53 * (len - 1), tmp_len_minus_1);
+		/* d1n + ((s0n + tmp_len_minus_1) >> 1) */
+		STORE(tmp + PARALLEL_COLS_53 * (len - 2),
+		      ADD(d1n_0, HALF_SUM(s0n_0, tmp_len_minus_1)));
+
+		s1n_1 = LOADU(in_even + (size_t)((len - 1) / 2) * stride + VREG_INT_COUNT);
+		/* tmp_len_minus_1 = s1n - ((d1n + 1) >> 1); */
+		tmp_len_minus_1 = SUB(s1n_1, QUARTER_SUM(d1n_1, d1n_1));
+		STORE(tmp + PARALLEL_COLS_53 * (len - 1) + VREG_INT_COUNT,
+		      tmp_len_minus_1);
+		/* d1n + ((s0n + tmp_len_minus_1) >> 1) */
+		STORE(tmp + PARALLEL_COLS_53 * (len - 2) + VREG_INT_COUNT,
+		      ADD(d1n_1, HALF_SUM(s0n_1, tmp_len_minus_1)));
+
+	} else {
+		STORE(tmp + PARALLEL_COLS_53 * (len - 1) + 0,
+		      ADD(d1n_0, s0n_0));
+		STORE(tmp + PARALLEL_COLS_53 * (len - 1) + VREG_INT_COUNT,
+		      ADD(d1n_1, s0n_1));
+	}
+
+	DWT_SIMD_NAME(opj_idwt53_v_final_memcpy)(tiledp_col, tmp, len, stride);
+}
+
+
+/** Vertical inverse 5x3 wavelet transform for PARALLEL_COLS_53 columns,
+ * when top-most pixel is on odd coordinate */
+static DWT_SIMD_TARGET void DWT_SIMD_NAME(opj_idwt53_v_cas1_mcols)(icoeff_t* tmp, const i32 sn, const i32 len, icoeff_t* tiledp_col, const size_t stride) {
+	i32 i;
+	size_t j;
+
+	VREG s1_0, s2_0, dc_0, dn_0;
+	VREG s1_1, s2_1, dc_1, dn_1;
+	const VREG one = LOAD_CST(1);
+	const VREG two = LOAD_CST(2);
+
+	const icoeff_t* in_even = &tiledp_col[(size_t)sn * stride];
+	const icoeff_t* in_odd = &tiledp_col[0];
+
+	ASSERT(len > 2);
+	/* Note: loads of input even/odd values must be done in a unaligned */
+	/* fashion. But stores in tmp can be done with aligned store, since */
+	/* the temporary buffer is properly aligned */
+	ASSERT((size_t)tmp % (sizeof(icoeff_t) * VREG_INT_COUNT) == 0);
+
+	s1_0 = LOADU(in_even + stride);
+	/* in_odd[0] - ((in_even[0] + s1 + 2) >> 2); */
+	dc_0 = SUB(LOADU(in_odd + 0),
+	           QUARTER_SUM(LOADU(in_even + 0), s1_0));
+	STORE(tmp + PARALLEL_COLS_53 * 0, ADD(LOADU(in_even + 0), dc_0));
+
+	s1_1 = LOADU(in_even + stride + VREG_INT_COUNT);
+	/* in_odd[0] - ((in_even[0] + s1 + 2) >> 2); */
+	dc_1 = SUB(LOADU(in_odd + VREG_INT_COUNT),
+	           QUARTER_SUM(LOADU(in_even + VREG_INT_COUNT), s1_1));
+	STORE(tmp + PARALLEL_COLS_53 * 0 + VREG_INT_COUNT,
+	      ADD(LOADU(in_even + VREG_INT_COUNT), dc_1));
+
+	for (i = 1, j = 1; i < (len - 2 - !(len & 1)); i += 2, j++) {
+
+		s2_0 = LOADU(in_even + (j + 1) * stride);
+		s2_1 = LOADU(in_even + (j + 1) * stride + VREG_INT_COUNT);
+
+		/* dn = in_odd[j * stride] - ((s1 + s2 + 2) >> 2); */
+		dn_0 = SUB(LOADU(in_odd + j * stride),
+		           QUARTER_SUM(s1_0, s2_0));
+		dn_1 = SUB(LOADU(in_odd + j * stride + VREG_INT_COUNT),
+		           QUARTER_SUM(s1_1, s2_1));
+
+		STORE(tmp + PARALLEL_COLS_53 * i, dc_0);
+		STORE(tmp + PARALLEL_COLS_53 * i + VREG_INT_COUNT, dc_1);
+
+		/* tmp[i + 1] = s1 + ((dn + dc) >> 1); */
+		STORE(tmp + PARALLEL_COLS_53 * (i + 1) + 0,
+		      ADD(s1_0, HALF_SUM(dn_0, dc_0)));
+		STORE(tmp + PARALLEL_COLS_53 * (i + 1) + VREG_INT_COUNT,
+		      ADD(s1_1, HALF_SUM(dn_1, dc_1)));
+
+		dc_0 = dn_0;
+		s1_0 = s2_0;
+		dc_1 = dn_1;
+		s1_1 = s2_1;
+	}
+	STORE(tmp + PARALLEL_COLS_53 * i, dc_0);
+	STORE(tmp + PARALLEL_COLS_53 * i + VREG_INT_COUNT, dc_1);
+
+	if (!(len & 1)) {
+		/*dn = in_odd[(len / 2 - 1) * stride] - ((s1 + 1) >> 1); */
+		dn_0 = SUB(LOADU(in_odd + (size_t)(len / 2 - 1) * stride),
+		           QUARTER_SUM(s1_0, s1_0));
+		dn_1 = SUB(LOADU(in_odd + (size_t)(len / 2 - 1) * stride + VREG_INT_COUNT),
+		           QUARTER_SUM(s1_1, s1_1));
+
+		/* tmp[len - 2] = s1 + ((dn + dc) >> 1); */
+		STORE(tmp + PARALLEL_COLS_53 * (len - 2) + 0,
+		      ADD(s1_0, HALF_SUM(dn_0, dc_0)));
+		STORE(tmp + PARALLEL_COLS_53 * (len - 2) + VREG_INT_COUNT,
+		      ADD(s1_1, HALF_SUM(dn_1, dc_1)));
+
+		STORE(tmp + PARALLEL_COLS_53 * (len - 1) + 0, dn_0);
+		STORE(tmp + PARALLEL_COLS_53 * (len - 1) + VREG_INT_COUNT, dn_1);
+	} else {
+		STORE(tmp + PARALLEL_COLS_53 * (len - 1) + 0, ADD(s1_0, dc_0));
+		STORE(tmp + PARALLEL_COLS_53 * (len - 1) + VREG_INT_COUNT,
+		      ADD(s1_1, dc_1));
+	}
+
+	DWT_SIMD_NAME(opj_idwt53_v_final_memcpy)(tiledp_col, tmp, len, stride);
+}
+
+/** Vertical inverse 5x3 wavelet transform for PARALLEL_COLS_53 columns, when top-most pixel is on odd coordinate and
+ * the column length is even (len == 2 * sn), computing only the output rows [row_begin, row_end).
+ * The output is written to out instead of back into tiledp_col, so the input is left intact. Bit-exact with
+ * opj_idwt53_v_cas1_mcols(): written out, the lifting steps are
+ *   d[j] = in_odd[j] - ((in_even[j] + in_even[j+1] + 2) >> 2)  (with in_even[sn] := in_even[sn-1])
+ *   out[2j] = in_even[j] + ((d[j] + d[j-1]) >> 1)                (with d[-1] := d[0], so out[0] = in_even[0] + d[0])
+ *   out[2j+1] = d[j]
+ * so any output row only depends on a few input rows, and there is no need for the temporary buffer. */
+static DWT_SIMD_TARGET void DWT_SIMD_NAME(opj_idwt53_v_cas1_mcols_rows)(const icoeff_t* tiledp_col, const i32 sn, const size_t stride,
+                                                                        i32 row_begin, i32 row_end, icoeff_t* out, const size_t out_stride) {
+	const icoeff_t* in_even = &tiledp_col[(size_t)sn * stride];
+	const icoeff_t* in_odd = &tiledp_col[0];
+	const VREG one = LOAD_CST(1);
+	const VREG two = LOAD_CST(2);
+	(void)one; (void)two; /* only one of them is used, depending on the definition of QUARTER_SUM */
+
+	ASSERT(sn >= 2 && row_begin >= 0 && row_begin < row_end && row_end <= 2 * sn);
+
+#define D(j, c) SUB(LOADU(in_odd + (size_t)(j) * stride + (c)), \
+                    QUARTER_SUM(LOADU(in_even + (size_t)(j) * stride + (c)), \
+                                LOADU(in_even + (size_t)((j) < sn - 1 ? (j) + 1 : (j)) * stride + (c))))
+
+	i32 r = row_begin;
+	i32 j = r / 2;
+	VREG dc_0, dc_1; /* d[j-1] */
+	if (r & 1) {
+		dc_0 = D(j, 0);
+		dc_1 = D(j, VREG_INT_COUNT);
+		STOREU(out, dc_0);
+		STOREU(out + VREG_INT_COUNT, dc_1);
+		out += out_stride;
+		++r;
+		++j;
+	} else {
+		dc_0 = D(ATLEAST(j - 1, 0), 0); /* for the first row: ((d[0] + d[0]) >> 1) == d[0] */
+		dc_1 = D(ATLEAST(j - 1, 0), VREG_INT_COUNT);
+	}
+	for (; r < row_end; r += 2, ++j) {
+		VREG dn_0 = D(j, 0);
+		VREG dn_1 = D(j, VREG_INT_COUNT);
+		STOREU(out, ADD(LOADU(in_even + (size_t)j * stride), HALF_SUM(dn_0, dc_0)));
+		STOREU(out + VREG_INT_COUNT, ADD(LOADU(in_even + (size_t)j * stride + VREG_INT_COUNT), HALF_SUM(dn_1, dc_1)));
+		out += out_stride;
+		if (r + 1 < row_end) {
+			STOREU(out, dn_0);
+			STOREU(out + VREG_INT_COUNT, dn_1);
+			out += out_stride;
+		}
+		dc_0 = dn_0;
+		dc_1 = dn_1;
+	}
+#undef D
+}
+
+#if (DWT_COEFF_BITS==16)
+/** Horizontal inverse 5x3 wavelet transform for one row, when left-most
+ * pixel is on odd coordinate and the row length is even. Bit-exact with opj_idwt53_h_cas1().
+ * Instead of the single-pass lifting (which has a loop-carried dependency), the odd and even samples are
+ * computed in two separate passes that can each be vectorized. */
+static DWT_SIMD_TARGET void DWT_SIMD_NAME(opj_idwt53_h_cas1_even)(icoeff_t* tmp, const i32 sn, const i32 len, icoeff_t* tiledp) {
+	const i32 n = sn;
+	const icoeff_t* in_even = &tiledp[sn];
+	const icoeff_t* in_odd = &tiledp[0];
+	icoeff_t* d = tmp + len; // the high pass results are stored after the output row
+	const VREG one = LOAD_CST(1);
+	i32 j;
+
+	ASSERT(len == 2 * n && n >= 2);
+
+	/* d[j] = in_odd[j] - ((in_even[j] + in_even[j+1] + 2) >> 2); */
+	/* Note: (a + b + 2) >> 2 == FAVG(FAVG(a, b), 1), but without overflowing 16 bits. */
+	for (j = 0; j + VREG_INT_COUNT <= n - 1; j += VREG_INT_COUNT) {
+		VREG s1 = LOADU(in_even + j);
+		VREG s2 = LOADU(in_even + j + 1);
+		STOREU(d + j, SUB(LOADU(in_odd + j), FAVG(FAVG(s1, s2), one)));
+	}
+	for (; j < n - 1; ++j) {
+		d[j] = in_odd[j] - ((in_even[j] + in_even[j + 1] + 2) >> 2);
+	}
+	d[n - 1] = in_odd[n - 1] - ((in_even[n - 1] + 1) >> 1); // symmetric extension at the right edge
+
+	/* tmp[2j] = in_even[j] + ((d[j] + d[j-1]) >> 1);  tmp[2j+1] = d[j]; */
+	tmp[0] = in_even[0] + d[0];
+	tmp[1] = d[0];
+	for (j = 1; j + VREG_INT_COUNT <= n; j += VREG_INT_COUNT) {
+		VREG dc = LOADU(d + j);
+		VREG s = ADD(LOADU(in_even + j), FAVG(dc, LOADU(d + j - 1)));
+		STOREU_INTERLEAVED(tmp + 2 * j, s, dc);
+	}
+	for (; j < n; ++j) {
+		tmp[2 * j] = in_even[j] + ((d[j] + d[j - 1]) >> 1);
+		tmp[2 * j + 1] = d[j];
+	}
+	memcpy(tiledp, tmp, (u32)len * sizeof(icoeff_t));
+}
+#endif
+
+#undef PARALLEL_COLS_53
+#undef ADD3
+#undef HALF_SUM
+#undef QUARTER_SUM
+#undef DWT_SIMD_NAME
+#undef DWT_SIMD_TARGET
+#undef VREG
+#undef VREG_INT_COUNT
+#undef LOAD_CST
+#undef ADD
+#undef SUB
+#undef SAR
+#undef FAVG
+#undef STOREU_INTERLEAVED
+#undef LOAD
+#undef LOADU
+#undef STORE
+#undef STOREU
@@ -0,0 +1,471 @@
+/*
+  Slidescape, a whole-slide image viewer for digital pathology.
+  Copyright (C) 2019-2022  Pieter Valkema
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Persistent index of the iSyntax header.
+// Opening an iSyntax file normally requires base64-decoding and parsing the (often very large) XML header, and then
+// reading the seektable to fill in the codeblock offsets. The result of all that work is stored in a binary file in
+// the cache directory, so that reopening the same slide only needs to read back a few flat arrays.
+//
+// Layout of an index file (all sections 8-byte aligned, native byte order):
+// Header | Image records | Level records | Codeblocks | Data chunks | Tiles | Encoded macro/label images
+//
+// The codeblock and data chunk sections are stored exactly as they are laid out in memory, so the file can be
+// mapped and used in place. The index is keyed by the file size, the modification time and a hash of the first
+// and last bytes of the slide; if any of those differ, the index is ignored and the header is parsed again.
+
+#include "common.h"
+#include "platform.h"
+
+#include "isyntax.h"
+#include "jpeg_decoder.h"
+
+#define ISYNTAX_INDEX_CACHE_MAGIC 0x58495353 // "SSIX"
+#define ISYNTAX_INDEX_CACHE_VERSION 1
+#define ISYNTAX_INDEX_CACHE_HASHED_BYTES KILOBYTES(64) // hashed at both the start and the end of the file
+
+bool isyntax_index_cache_enabled = true;
+
+typedef struct isyntax_index_cache_key_t {
+	i64 filesize;
+	i64 mtime;
+	u32 partial_hash;
+} isyntax_index_cache_key_t;
+
+typedef struct isyntax_index_cache_header_t {
+	u32 magic;
+	u32 version;
+	u32 codeblock_record_size; // catches layout changes of isyntax_codeblock_t
+	u32 data_chunk_record_size;
+	i64 filesize;
+	i64 mtime;
+	u32 partial_hash;
+	i32 image_count;
+	i32 macro_image_index;
+	i32 label_image_index;
+	i32 wsi_image_index;
+	float mpp_x;
+	float mpp_y;
+	u32 is_mpp_known;
+	u64 total_size;
+	isyntax_header_template_t header_templates[64];
+} isyntax_index_cache_header_t;
+
+typedef struct isyntax_index_cache_image_t {
+	u32 image_type;
+	i32 width;
+	i32 height;
+	i32 offset_x;
+	i32 offset_y;
+	i32 level_count;
+	i32 max_scale;
+	i32 codeblock_count;
+	i32 data_chunk_count;
+	u32 header_codeblocks_are_partial;
+	u32 compression_is_lossy;
+	i32 lossy_image_compression_ratio;
+	u64 encoded_image_size;
+	u64 encoded_image_offset;
+	u64 codeblocks_offset;
+	u64 data_chunks_offset;
+} isyntax_index_cache_image_t;
+
+typedef struct isyntax_index_cache_level_t {
+	i32 scale;
+	i32 width_in_tiles;
+	i32 height_in_tiles;
+	float downsample_factor;
+	float um_per_pixel_x;
+	float um_per_pixel_y;
+	float x_tile_side_in_um;
+	float y_tile_side_in_um;
+	u64 tile_count;
+	float origin_offset_in_pixels;
+	v2f origin_offset;
+	u64 tiles_offset;
+} isyntax_index_cache_level_t;
+
+typedef struct isyntax_index_cache_tile_t {
+	u32 codeblock_index;
+	u32 codeblock_chunk_index;
+	u32 data_chunk_index;
+	u32 exists;
+} isyntax_index_cache_tile_t;
+
+static inline u64 align_index_offset(u64 offset) {
+	return (offset + 7) & ~(u64)7;
+}
+
+static bool isyntax_index_cache_get_key(const char* filename, isyntax_index_cache_key_t* key) {
+	struct stat st = {0};
+	if (platform_stat(filename, &st) != 0) {
+		return false;
+	}
+	memset(key, 0, sizeof(*key));
+	key->filesize = st.st_size;
+	key->mtime = (i64)st.st_mtime;
+
+	file_stream_t fp = file_stream_open_for_reading(filename);
+	if (!fp) {
+		return false;
+	}
+	// Hash the start (XML header) and the end (last codeblocks) of the file.
+	// Combined with the size and modification time, this is plenty to tell slides apart.
+	size_t hashed_size = MIN(key->filesize, ISYNTAX_INDEX_CACHE_HASHED_BYTES);
+	u8* buffer = (u8*)malloc(hashed_size * 2);
+	i64 bytes_read = file_stream_read(buffer, hashed_size, fp);
+	if (key->filesize > (i64)hashed_size) {
+		file_stream_set_pos(fp, key->filesize - hashed_size);
+		bytes_read += file_stream_read(buffer + hashed_size, hashed_size, fp);
+	}
+	file_stream_close(fp);
+	key->partial_hash = crc32(buffer, (int)bytes_read);
+	free(buffer);
+	return bytes_read > 0;
+}
+
+static bool isyntax_index_cache_get_path(const isyntax_index_cache_key_t* key, char* path, size_t path_size) {
+	if (!global_cache_dir) {
+		return false;
+	}
+	snprintf(path, path_size, "%s" PATH_SEP "%08x_%llx.isyntax_index", global_cache_dir,
+	         key->partial_hash, (unsigned long long)key->filesize);
+	return true;
+}
+
+static void isyntax_index_cache_free_partial(isyntax_t* isyntax) {
+	for (i32 image_index = 0; image_index < COUNT(isyntax->images); ++image_index) {
+		isyntax_image_t* image = isyntax->images + image_index;
+		if (image->pixels) free(image->pixels);
+		if (image->codeblocks) free(image->codeblocks);
+		if (image->data_chunks) free(image->data_chunks);
+		for (i32 i = 0; i < COUNT(image->levels); ++i) {
+			if (image->levels[i].tiles) free(image->levels[i].tiles);
+		}
+	}
+	memset(isyntax, 0, sizeof(*isyntax));
+}
+
+// Fills in everything that isyntax_open() would otherwise derive from the XML header and the seektable.
+// Returns false (leaving the isyntax_t zeroed) if there is no valid index for this file.
+bool isyntax_index_cache_load(isyntax_t* isyntax, const char* filename) {
+	isyntax_index_cache_key_t key;
+	char path[1024];
+	if (!isyntax_index_cache_get_key(filename, &key) || !isyntax_index_cache_get_path(&key, path, sizeof(path))) {
+		return false;
+	}
+	if (!file_exists(path)) {
+		return false;
+	}
+
+	i64 load_begin = get_clock();
+	mem_t* file = platform_read_entire_file(path);
+	if (!file) {
+		return false;
+	}
+	u8* base = file->data;
+	u64 size = file->len;
+	bool success = false;
+
+	if (0) { failed:
+		console_print_verbose("iSyntax: ignoring stale or invalid header index %s\n", path);
+		isyntax_index_cache_free_partial(isyntax);
+		free(file);
+		return false;
+	}
+
+	// Bounds check for a section of the file
+#define INDEX_SECTION_OK(offset, bytes) ((offset) <= size && (u64)(bytes) <= size - (offset))
+
+	if (size < sizeof(isyntax_index_cache_header_t)) goto failed;
+	isyntax_index_cache_header_t* header = (isyntax_index_cache_header_t*)base;
+	if (header->magic != ISYNTAX_INDEX_CACHE_MAGIC || header->version != ISYNTAX_INDEX_CACHE_VERSION ||
+	    header->codeblock_record_size != sizeof(isyntax_codeblock_t) ||
+	    header->data_chunk_record_size != sizeof(isyntax_data_chunk_t) ||
+	    header->total_size != size) {
+		goto failed;
+	}
+	if (header->filesize != key.filesize || header->mtime != key.mtime || header->partial_hash != key.partial_hash) {
+		goto failed;
+	}
+	if (header->image_count <= 0 || header->image_count > COUNT(isyntax->images)) goto failed;
+
+	isyntax->filesize = header->filesize;
+	isyntax->image_count = header->image_count;
+	isyntax->macro_image_index = header->macro_image_index;
+	isyntax->label_image_index = header->label_image_index;
+	isyntax->wsi_image_index = header->wsi_image_index;
+	isyntax->mpp_x = header->mpp_x;
+	isyntax->mpp_y = header->mpp_y;
+	isyntax->is_mpp_known = header->is_mpp_known != 0;
+	memcpy(isyntax->header_templates, header->header_templates, sizeof(isyntax->header_templates));
+	if (isyntax->wsi_image_index < 0 || isyntax->wsi_image_index >= isyntax->image_count) goto failed;
+
+	u64 image_records_offset = align_index_offset(sizeof(isyntax_index_cache_header_t));
+	u64 image_records_size = isyntax->image_count * sizeof(isyntax_index_cache_image_t);
+	if (!INDEX_SECTION_OK(image_records_offset, image_records_size)) goto failed;
+	isyntax_index_cache_image_t* image_records = (isyntax_index_cache_image_t*)(base + image_records_offset);
+	u64 level_records_offset = align_index_offset(image_records_offset + image_records_size);
+
+	for (i32 image_index = 0; image_index < isyntax->image_count; ++image_index) {
+		isyntax_index_cache_image_t* record = image_records + image_index;
+		isyntax_image_t* image = isyntax->images + image_index;
+		image->image_type = record->image_type;
+		image->width = record->width;
+		image->height = record->height;
+		image->offset_x = record->offset_x;
+		image->offset_y = record->offset_y;
+		image->compression_is_lossy = record->compression_is_lossy != 0;
+		image->lossy_image_compression_ratio = record->lossy_image_compression_ratio;
+		image->header_codeblocks_are_partial = record->header_codeblocks_are_partial != 0;
+
+		if (record->encoded_image_size > 0) {
+			// Macro and label images are stored as JPEG, exactly as they were embedded in the XML header
+			if (!INDEX_SECTION_OK(record->encoded_image_offset, record->encoded_image_size)) goto failed;
+			i32 channels_in_file = 0;
+			image->pixels = jpeg_decode_image(base + record->encoded_image_offset, (u32)record->encoded_image_size,
+			                                  &image->width, &image->height, &channels_in_file);
+		}
+
+		if (image->image_type != ISYNTAX_IMAGE_TYPE_WSI) {
+			continue;
+		}
+		if (record->level_count <= 0 || record->level_count > COUNT(image->levels)) goto failed;
+		image->level_count = record->level_count;
+		image->max_scale = record->max_scale;
+
+		image->codeblock_count = record->codeblock_count;
+		size_t codeblocks_size = (size_t)record->codeblock_count * sizeof(isyntax_codeblock_t);
+		if (record->codeblock_count < 0 || !INDEX_SECTION_OK(record->codeblocks_offset, codeblocks_size)) goto failed;
+		image->codeblocks = (isyntax_codeblock_t*)malloc(codeblocks_size);
+		memcpy(image->codeblocks, base + record->codeblocks_offset, codeblocks_size);
+
+		image->data_chunk_count = record->data_chunk_count;
+		size_t data_chunks_size = (size_t)record->data_chunk_count * sizeof(isyntax_data_chunk_t);
+		if (record->data_chunk_count < 0 || !INDEX_SECTION_OK(record->data_chunks_offset, data_chunks_size)) goto failed;
+		image->data_chunks = (isyntax_data_chunk_t*)malloc(MAX(data_chunks_size, sizeof(isyntax_data_chunk_t)));
+		memcpy(image->data_chunks, base + record->data_chunks_offset, data_chunks_size);
+		for (i32 i = 0; i < image->data_chunk_count; ++i) {
+			image->data_chunks[i].data = NULL; // the pointer stored in the file is meaningless
+			image->data_chunks[i].last_used = 0;
+			image->data_chunks[i].pending_decompress_count = 0;
+			image->data_chunks[i].is_read_pending = false;
+		}
+
+		u64 level_records_size = image->level_count * sizeof(isyntax_index_cache_level_t);
+		if (!INDEX_SECTION_OK(level_records_offset, level_records_size)) goto failed;
+		isyntax_index_cache_level_t* level_records = (isyntax_index_cache_level_t*)(base + level_records_offset);
+		level_records_offset = align_index_offset(level_records_offset + level_records_size);
+
+		for (i32 i = 0; i < image->level_count; ++i) {
+			isyntax_index_cache_level_t* level_record = level_records + i;
+			isyntax_level_t* level = image->levels + i;
+			level->scale = level_record->scale;
+			level->width_in_tiles = level_record->width_in_tiles;
+			level->height_in_tiles = level_record->height_in_tiles;
+			level->downsample_factor = level_record->downsample_factor;
+			level->um_per_pixel_x = level_record->um_per_pixel_x;
+			level->um_per_pixel_y = level_record->um_per_pixel_y;
+			level->x_tile_side_in_um = level_record->x_tile_side_in_um;
+			level->y_tile_side_in_um = level_record->y_tile_side_in_um;
+			level->tile_count = level_record->tile_count;
+			level->origin_offset_in_pixels = level_record->origin_offset_in_pixels;
+			level->origin_offset = level_record->origin_offset;
+			if (level->tile_count != (u64)level->width_in_tiles * level->height_in_tiles) goto failed;
+
+			u64 tile_records_size = level->tile_count * sizeof(isyntax_index_cache_tile_t);
+			if (!INDEX_SECTION_OK(level_record->tiles_offset, tile_records_size)) goto failed;
+			isyntax_index_cache_tile_t* tile_records = (isyntax_index_cache_tile_t*)(base + level_record->tiles_offset);
+			level->tiles = (isyntax_tile_t*)calloc(1, MAX(level->tile_count, 1) * sizeof(isyntax_tile_t));
+			for (u64 j = 0; j < level->tile_count; ++j) {
+				isyntax_index_cache_tile_t* tile_record = tile_records + j;
+				isyntax_tile_t* tile = level->tiles + j;
+				if (tile_record->exists) {
+					if (tile_record->codeblock_index >= (u32)image->codeblock_count ||
+					    tile_record->data_chunk_index >= (u32)image->data_chunk_count) {
+						goto failed;
+					}
+					tile->exists = true;
+					tile->codeblock_index = tile_record->codeblock_index;
+					tile->codeblock_chunk_index = tile_record->codeblock_chunk_index;
+					tile->data_chunk_index = tile_record->data_chunk_index;
+				}
+			}
+		}
+	}
+#undef INDEX_SECTION_OK
+
+	isyntax_image_t* wsi_image = isyntax->images + isyntax->wsi_image_index;
+	if (wsi_image->image_type != ISYNTAX_IMAGE_TYPE_WSI) goto failed;
+
+	isyntax->block_width = isyntax->header_templates[0].block_width;
+	isyntax->block_height = isyntax->header_templates[0].block_height;
+	isyntax->tile_width = isyntax->block_width * 2;
+	isyntax->tile_height = isyntax->block_height * 2;
+	isyntax->loading_time = get_seconds_elapsed(load_begin, get_clock());
+	success = true;
+
+	console_print_verbose("iSyntax: loaded header index from %s in %g seconds\n", path, isyntax->loading_time);
+	free(file);
+	return success;
+}
+
+// Writes the parsed header of an opened iSyntax file to the cache directory. Failure to do so is not an error.
+void isyntax_index_cache_save(isyntax_t* isyntax, const char* filename) {
+	isyntax_index_cache_key_t key;
+	char path[1024];
+	if (!isyntax_index_cache_get_key(filename, &key) || !isyntax_index_cache_get_path(&key, path, sizeof(path))) {
+		return;
+	}
+	if (key.filesize != isyntax->filesize) {
+		return; // file changed while we were parsing it?
+	}
+
+	// First pass: figure out where all the sections go.
+	u64 offset = align_index_offset(sizeof(isyntax_index_cache_header_t));
+	offset = align_index_offset(offset + isyntax->image_count * sizeof(isyntax_index_cache_image_t));
+	u64 level_records_offset = offset;
+	for (i32 image_index = 0; image_index < isyntax->image_count; ++image_index) {
+		isyntax_image_t* image = isyntax->images + image_index;
+		if (image->image_type == ISYNTAX_IMAGE_TYPE_WSI) {
+			offset = align_index_offset(offset + image->level_count * sizeof(isyntax_index_cache_level_t));
+		}
+	}
+	u64 arrays_offset = offset;
+	for (i32 image_index = 0; image_index < isyntax->image_count; ++image_index) {
+		isyntax_image_t* image = isyntax->images + image_index;
+		offset = align_index_offset(offset + image->encoded_image_size);
+		if (image->image_type == ISYNTAX_IMAGE_TYPE_WSI) {
+			offset = align_index_offset(offset + image->codeblock_count * sizeof(isyntax_codeblock_t));
+			offset = align_index_offset(offset + image->data_chunk_count * sizeof(isyntax_data_chunk_t));
+			for (i32 i = 0; i < image->level_count; ++i) {
+				offset = align_index_offset(offset + image->levels[i].tile_count * sizeof(isyntax_index_cache_tile_t));
+			}
+		}
+	}
+	u64 total_size = offset;
+
+	// Second pass: fill in the sections.
+	u8* base = (u8*)calloc(1, total_size);
+	if (!base) return;
+	isyntax_index_cache_header_t* header = (isyntax_index_cache_header_t*)base;
+	header->magic = ISYNTAX_INDEX_CACHE_MAGIC;
+	header->version = ISYNTAX_INDEX_CACHE_VERSION;
+	header->codeblock_record_size = sizeof(isyntax_codeblock_t);
+	header->data_chunk_record_size = sizeof(isyntax_data_chunk_t);
+	header->filesize = key.filesize;
+	header->mtime = key.mtime;
+	header->partial_hash = key.partial_hash;
+	header->image_count = isyntax->image_count;
+	header->macro_image_index = isyntax->macro_image_index;
+	header->label_image_index = isyntax->label_image_index;
+	header->wsi_image_index = isyntax->wsi_image_index;
+	header->mpp_x = isyntax->mpp_x;
+	header->mpp_y = isyntax->mpp_y;
+	header->is_mpp_known = isyntax->is_mpp_known;
+	header->total_size = total_size;
+	memcpy(header->header_templates, isyntax->header_templates, sizeof(header->header_templates));
+
+	isyntax_index_cache_image_t* image_records = (isyntax_index_cache_image_t*)(base + align_index_offset(sizeof(isyntax_index_cache_header_t)));
+	offset = arrays_offset;
+	for (i32 image_index = 0; image_index < isyntax->image_count; ++image_index) {
+		isyntax_image_t* image = isyntax->images + image_index;
+		isyntax_index_cache_image_t* record = image_records + image_index;
+		record->image_type = image->image_type;
+		record->width = image->width;
+		record->height = image->height;
+		record->offset_x = image->offset_x;
+		record->offset_y = image->offset_y;
+		record->level_count = image->level_count;
+		record->max_scale = image->max_scale;
+		record->compression_is_lossy = image->compression_is_lossy;
+		record->lossy_image_compression_ratio = image->lossy_image_compression_ratio;
+		record->header_codeblocks_are_partial = image->header_codeblocks_are_partial;
+
+		if (image->encoded_image_data && image->encoded_image_size > 0) {
+			record->encoded_image_size = image->encoded_image_size;
+			record->encoded_image_offset = offset;
+			memcpy(base + offset, image->encoded_image_data, image->encoded_image_size);
+		}
+		offset = align_index_offset(offset + image->encoded_image_size);
+
+		if (image->image_type != ISYNTAX_IMAGE_TYPE_WSI) {
+			continue;
+		}
+		record->codeblock_count = image->codeblock_count;
+		record->codeblocks_offset = offset;
+		memcpy(base + offset, image->codeblocks, image->codeblock_count * sizeof(isyntax_codeblock_t));
+		offset = align_index_offset(offset + image->codeblock_count * sizeof(isyntax_codeblock_t));
+
+		record->data_chunk_count = image->data_chunk_count;
+		record->data_chunks_offset = offset;
+		isyntax_data_chunk_t* data_chunks = (isyntax_data_chunk_t*)(base + offset);
+		for (i32 i = 0; i < image->data_chunk_count; ++i) {
+			data_chunks[i] = image->data_chunks[i];
+			data_chunks[i].data = NULL;
+		}
+		offset = align_index_offset(offset + image->data_chunk_count * sizeof(isyntax_data_chunk_t));
+
+		isyntax_index_cache_level_t* level_records = (isyntax_index_cache_level_t*)(base + level_records_offset);
+		level_records_offset = align_index_offset(level_records_offset + image->level_count * sizeof(isyntax_index_cache_level_t));
+		for (i32 i = 0; i < image->level_count; ++i) {
+			isyntax_level_t* level = image->levels + i;
+			isyntax_index_cache_level_t* level_record = level_records + i;
+			level_record->scale = level->scale;
+			level_record->width_in_tiles = level->width_in_tiles;
+			level_record->height_in_tiles = level->height_in_tiles;
+			level_record->downsample_factor = level->downsample_factor;
+			level_record->um_per_pixel_x = level->um_per_pixel_x;
+			level_record->um_per_pixel_y = level->um_per_pixel_y;
+			level_record->x_tile_side_in_um = level->x_tile_side_in_um;
+			level_record->y_tile_side_in_um = level->y_tile_side_in_um;
+			level_record->tile_count = level->tile_count;
+			level_record->origin_offset_in_pixels = level->origin_offset_in_pixels;
+			level_record->origin_offset = level->origin_offset;
+			level_record->tiles_offset = offset;
+
+			isyntax_index_cache_tile_t* tile_records = (isyntax_index_cache_tile_t*)(base + offset);
+			for (u64 j = 0; j < level->tile_count; ++j) {
+				isyntax_tile_t* tile = level->tiles + j;
+				if (tile->exists) {
+					tile_records[j].exists = 1;
+					tile_records[j].codeblock_index = tile->codeblock_index;
+					tile_records[j].codeblock_chunk_index = tile->codeblock_chunk_index;
+					tile_records[j].data_chunk_index = tile->data_chunk_index;
+				}
+			}
+			offset = align_index_offset(offset + level->tile_count * sizeof(isyntax_index_cache_tile_t));
+		}
+	}
+	ASSERT(offset == total_size);
+
+	// Write to a temporary file first, so that a crash or a concurrent reader never sees a half-written index.
+	char temp_path[1040];
+	snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+	file_stream_t fp = file_stream_open_for_writing(temp_path);
+	if (fp) {
+		file_stream_write(base, total_size, fp);
+		file_stream_close(fp);
+		remove(path);
+		if (rename(temp_path, path) == 0) {
+			console_print_verbose("iSyntax: saved header index to %s (%llu bytes)\n", path, (unsigned long long)total_size);
+		} else {
+			remove(temp_path);
+		}
+	}
+	free(base);
+}
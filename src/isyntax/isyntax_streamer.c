@@ -36,7 +36,7 @@ void submit_tile_completed(i32 resource_id, void* tile_pixels, i32 scale, i32 ti
 	completion_task.want_gpu_residency = true;
 	completion_task.resource_id = resource_id;
 	//	console_print("[thread %d] Loaded tile: level=%d tile_x=%d tile_y=%d\n", logical_thread_index, level, tile_x, tile_y);
-	if (!add_work_queue_entry(&global_completion_queue, viewer_notify_load_tile_completed, &completion_task, sizeof(completion_task))) {
+	if (!add_work_queue_entry_with_priority(&global_completion_queue, WORK_QUEUE_PRIORITY_VISIBLE_TILE, viewer_notify_load_tile_completed, &completion_task, sizeof(completion_task))) {
 		ASSERT(!"tile cannot be submitted and will leak");
 	}
 #endif
@@ -56,7 +56,7 @@ static void isyntax_init_dummy_codeblocks(isyntax_t* isyntax) {
 	}
 }
 
-static i32 isyntax_load_all_tiles_in_level(i32 resource_id, isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale) {
+static i32 isyntax_load_all_tiles_in_level(i32 logical_thread_index, i32 resource_id, isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale) {
 	i32 tiles_loaded = 0;
 	i32 tile_index = 0;
 	isyntax_level_t* level = wsi->levels + scale;
@@ -66,7 +66,8 @@ static i32 isyntax_load_all_tiles_in_level(i32 resource_id, isyntax_t* isyntax,
 			if (!tile->exists) continue;
 			i32 tasks_waiting = get_work_queue_task_count(&global_work_queue);
 			if (global_worker_thread_idle_count > 0 && tasks_waiting < logical_cpu_count * 10) {
-				isyntax_begin_load_tile(resource_id, isyntax, wsi, scale, tile_x, tile_y);
+				// NOTE: not cancellable, because we will be waiting on the result below.
+				isyntax_begin_load_tile(resource_id, isyntax, wsi, scale, tile_x, tile_y, WORK_QUEUE_PRIORITY_VISIBLE_TILE, false);
 			} else if (!is_tile_streamer_frame_boundary_passed) {
 				u32* tile_pixels = isyntax_load_tile(isyntax, wsi, scale, tile_x, tile_y);
 				if (tile_pixels) {
@@ -85,7 +86,7 @@ static i32 isyntax_load_all_tiles_in_level(i32 resource_id, isyntax_t* isyntax,
 			isyntax_tile_t* tile = level->tiles + tile_index;
 			if (!tile->exists) continue;
 			while (!tile->is_loaded) {
-				do_worker_work(&global_work_queue, 0);
+				do_worker_work(&global_work_queue, logical_thread_index);
 			}
 		}
 	}
@@ -104,7 +105,133 @@ static i32 isyntax_load_all_tiles_in_level(i32 resource_id, isyntax_t* isyntax,
 
 
 
-static void isyntax_do_first_load(i32 resource_id, isyntax_t* isyntax, isyntax_image_t* wsi) {
+typedef struct isyntax_first_load_state_t {
+	isyntax_t* isyntax;
+	isyntax_image_t* wsi;
+	i32 levels_in_chunk;
+	i32 codeblocks_per_color;
+	volatile i32 chunks_remaining;
+	// Per chunk timings, summed after all chunks are done (so no atomics needed)
+	float* io_seconds;
+	float* decompress_seconds;
+	u64* bytes_read;
+} isyntax_first_load_state_t;
+
+typedef struct isyntax_first_load_chunk_task_t {
+	isyntax_first_load_state_t* state;
+	i32 tile_x; // of the top level tile that the chunk belongs to
+	i32 tile_y;
+} isyntax_first_load_chunk_task_t;
+
+// Decompress the H codeblocks for the tiles at a lower scale that are stored in the same data chunk as a top level tile.
+// The tiles covered by the chunk are a square block of tiles_per_side x tiles_per_side, the codeblocks are stored per color
+// channel in raster order, starting at first_codeblock_in_color.
+static void isyntax_first_load_decompress_child_codeblocks(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 top_tile_x, i32 top_tile_y,
+                                                          i32 tiles_per_side, i32 first_codeblock_in_color, i32 codeblocks_per_color,
+                                                          isyntax_codeblock_t* top_chunk_codeblock, u8* chunk) {
+	isyntax_level_t* level = wsi->levels + scale;
+	i32 first_tile_x = top_tile_x * tiles_per_side;
+	i32 first_tile_y = top_tile_y * tiles_per_side;
+	if (first_tile_x >= level->width_in_tiles || first_tile_y >= level->height_in_tiles) return;
+	isyntax_tile_t* first_tile = level->tiles + first_tile_y * level->width_in_tiles + first_tile_x;
+	if (!first_tile->exists) return;
+	// LL blocks will be 'donated' later, when the higher level gets transformed
+	u64 offset0 = top_chunk_codeblock->block_data_offset;
+	for (i32 color = 0; color < 3; ++color) {
+		for (i32 i = 0; i < tiles_per_side * tiles_per_side; ++i) {
+			isyntax_codeblock_t* codeblock = top_chunk_codeblock + color * codeblocks_per_color + first_codeblock_in_color + i;
+			ASSERT(codeblock->scale == scale);
+			i32 tile_x = first_tile_x + (i % tiles_per_side);
+			i32 tile_y = first_tile_y + (i / tiles_per_side);
+			if (tile_x >= level->width_in_tiles || tile_y >= level->height_in_tiles) continue;
+			isyntax_tile_t* tile = level->tiles + tile_y * level->width_in_tiles + tile_x;
+			isyntax_tile_channel_t* color_channel = tile->color_channels + color;
+			ASSERT(color_channel->coeff_h == NULL);
+			color_channel->coeff_h = (icoeff_t*)block_alloc(&isyntax->h_coeff_block_allocator);
+			isyntax_decompress_codeblock_in_chunk(codeblock, isyntax->block_width, isyntax->block_height, chunk, offset0, color_channel->coeff_h);
+
+			// We're loading everything at once for this level, so we can set every tile as having their neighors loaded as well.
+			color_channel->neighbors_loaded = isyntax_get_adjacent_tiles_mask(level, tile_x, tile_y);
+		}
+	}
+}
+
+// Read one top level data chunk and decompress all the codeblocks in it (for all the levels in the chunk).
+static void isyntax_first_load_chunk(isyntax_first_load_state_t* state, i32 tile_x, i32 tile_y) {
+	isyntax_t* isyntax = state->isyntax;
+	isyntax_image_t* wsi = state->wsi;
+	i32 scale = wsi->max_scale;
+	isyntax_level_t* level = wsi->levels + scale;
+	i32 tile_index = tile_y * level->width_in_tiles + tile_x;
+	isyntax_tile_t* tile = level->tiles + tile_index;
+	i32 codeblocks_per_color = state->codeblocks_per_color;
+	i32 chunk_codeblock_count = codeblocks_per_color * 3;
+
+	temp_memory_t temp_memory = begin_temp_memory_on_local_thread();
+
+	// Read codeblock data from disk
+	i64 start_io = get_clock();
+	isyntax_codeblock_t* top_chunk_codeblock = wsi->codeblocks + tile->codeblock_chunk_index;
+	u64 offset0 = top_chunk_codeblock->block_data_offset;
+	isyntax_codeblock_t* last_codeblock = wsi->codeblocks + tile->codeblock_chunk_index + chunk_codeblock_count - 1;
+	u64 offset1 = last_codeblock->block_data_offset + last_codeblock->block_size;
+	u64 read_size = offset1 - offset0;
+	size_t bytes_read = 0;
+	u8* chunk = file_mapping_get_range(&isyntax->file_mapping, offset0, read_size + 8); // safety bytes for the bitstream reader
+	if (chunk) {
+		bytes_read = read_size;
+	} else {
+		arena_align(temp_memory.arena, 64);
+		chunk = (u8*) arena_push_size(temp_memory.arena, read_size + 8);
+		memset(chunk + read_size, 0, 8);
+		bytes_read = file_handle_read_at_offset(chunk, isyntax->file_handle, offset0, read_size);
+	}
+	if (!(bytes_read > 0)) {
+		console_print_error("Error: could not read iSyntax data at offset %lld (read size %lld)\n", offset0, read_size);
+	}
+	state->io_seconds[tile_index] = get_seconds_elapsed(start_io, get_clock());
+	state->bytes_read[tile_index] = bytes_read;
+
+	// Decompress the top level tile (both H and LL codeblocks)
+	i64 start_decompress = get_clock();
+	i32 ll_block_offset = (codeblocks_per_color - 1);
+	for (i32 color = 0; color < 3; ++color) {
+		isyntax_codeblock_t* h_block = top_chunk_codeblock + color * codeblocks_per_color;
+		isyntax_codeblock_t* ll_block = h_block + ll_block_offset;
+		isyntax_tile_channel_t* color_channel = tile->color_channels + color;
+		ASSERT(color_channel->coeff_h == NULL);
+		ASSERT(color_channel->coeff_ll == NULL);
+		color_channel->coeff_h = (icoeff_t*)block_alloc(&isyntax->h_coeff_block_allocator);
+		isyntax_decompress_codeblock_in_chunk(h_block, isyntax->block_width, isyntax->block_height, chunk, offset0, color_channel->coeff_h);
+		color_channel->coeff_ll = (icoeff_t*)block_alloc(&isyntax->ll_coeff_block_allocator);
+		isyntax_decompress_codeblock_in_chunk(ll_block, isyntax->block_width, isyntax->block_height, chunk, offset0, color_channel->coeff_ll);
+
+		// We're loading everything at once for this level, so we can set every tile as having their neighors loaded as well.
+		color_channel->neighbors_loaded = isyntax_get_adjacent_tiles_mask(level, tile_x, tile_y);
+	}
+
+	// Decompress the remaining levels in the data chunk (codeblocks 1-4 are at scale-1, codeblocks 5-20 at scale-2)
+	if (state->levels_in_chunk >= 2) {
+		isyntax_first_load_decompress_child_codeblocks(isyntax, wsi, scale - 1, tile_x, tile_y, 2, 1, codeblocks_per_color,
+		                                               top_chunk_codeblock, chunk);
+	}
+	if (state->levels_in_chunk >= 3) {
+		isyntax_first_load_decompress_child_codeblocks(isyntax, wsi, scale - 2, tile_x, tile_y, 4, 5, codeblocks_per_color,
+		                                               top_chunk_codeblock, chunk);
+	}
+	state->decompress_seconds[tile_index] = get_seconds_elapsed(start_decompress, get_clock());
+
+	release_temp_memory(&temp_memory); // deallocate data chunk
+	write_barrier;
+	atomic_decrement(&state->chunks_remaining);
+}
+
+void isyntax_first_load_chunk_task_func(i32 logical_thread_index, void* userdata) {
+	isyntax_first_load_chunk_task_t* task = (isyntax_first_load_chunk_task_t*) userdata;
+	isyntax_first_load_chunk(task->state, task->tile_x, task->tile_y);
+}
+
+static void isyntax_do_first_load(i32 logical_thread_index, i32 resource_id, isyntax_t* isyntax, isyntax_image_t* wsi) {
 
 	i64 start_first_load = get_clock();
 	i32 tiles_loaded = 0;
@@ -114,186 +241,73 @@ static void isyntax_do_first_load(i32 resource_id, isyntax_t* isyntax, isyntax_i
 
 	i32 scale = wsi->max_scale;
 	isyntax_level_t* current_level = wsi->levels + scale;
-	i32 codeblocks_per_color = isyntax_get_chunk_codeblocks_per_color_for_level(scale, true); // most often 1 + 4 + 16 (for scale n, n-1, n-2) + 1 (LL block)
-	i32 chunk_codeblock_count = codeblocks_per_color * 3;
-	i32 block_color_offsets[3] = {0, codeblocks_per_color, 2 * codeblocks_per_color};
-
 	i32 levels_in_chunk = (scale % 3) + 1;
 
 	temp_memory_t temp_memory = begin_temp_memory_on_local_thread();
 
-	u8** data_chunks = arena_push_array(temp_memory.arena, current_level->tile_count, u8*);
-	memset(data_chunks, 0, current_level->tile_count * sizeof(u8*));
-
-	// Read codeblock data from disk
-	{
-		i64 start = get_clock();
-
-		i32 tile_index = 0;
-		for (i32 tile_y = 0; tile_y < current_level->height_in_tiles; ++tile_y) {
-			for (i32 tile_x = 0; tile_x < current_level->width_in_tiles; ++tile_x, ++tile_index) {
-				isyntax_tile_t* tile = current_level->tiles + tile_index;
-				if (!tile->exists) continue;
-				isyntax_codeblock_t* top_chunk_codeblock = wsi->codeblocks + tile->codeblock_chunk_index;
-				u64 offset0 = top_chunk_codeblock->block_data_offset;
-//				console_print("loading chunk %d\n", tile->codeblock_chunk_index);
-
-				isyntax_codeblock_t* last_codeblock = wsi->codeblocks + tile->codeblock_chunk_index + chunk_codeblock_count - 1;
-				u64 offset1 = last_codeblock->block_data_offset + last_codeblock->block_size;
-				u64 read_size = offset1 - offset0;
-				arena_align(temp_memory.arena, 64);
-				data_chunks[tile_index] = (u8*) arena_push_size(temp_memory.arena, read_size);
-
-				size_t bytes_read = file_handle_read_at_offset(data_chunks[tile_index], isyntax->file_handle, offset0, read_size);
-				if (!(bytes_read > 0)) {
-					console_print_error("Error: could not read iSyntax data at offset %lld (read size %lld)\n", offset0, read_size);
-				}
-			}
-		}
-		float elapsed = get_seconds_elapsed(start, get_clock());
-		console_print_verbose("I/O + decompress: scale=%d  time=%g\n", scale, elapsed);
+	// Phase 1: read the top level data chunks and decompress all their codeblocks, one chunk per task.
+	// Each chunk only touches its own tiles, so the chunks can be processed in any order on any thread.
+	isyntax_first_load_state_t state = {0};
+	state.isyntax = isyntax;
+	state.wsi = wsi;
+	state.levels_in_chunk = levels_in_chunk;
+	state.codeblocks_per_color = isyntax_get_chunk_codeblocks_per_color_for_level(scale, true); // most often 1 + 4 + 16 (for scale n, n-1, n-2) + 1 (LL block)
+	state.io_seconds = arena_push_array(temp_memory.arena, current_level->tile_count, float);
+	state.decompress_seconds = arena_push_array(temp_memory.arena, current_level->tile_count, float);
+	state.bytes_read = arena_push_array(temp_memory.arena, current_level->tile_count, u64);
+	memset(state.io_seconds, 0, current_level->tile_count * sizeof(float));
+	memset(state.decompress_seconds, 0, current_level->tile_count * sizeof(float));
+	memset(state.bytes_read, 0, current_level->tile_count * sizeof(u64));
+
+	i64 start_chunks = get_clock();
+	i32 chunk_count = 0;
+	for (i32 i = 0; i < current_level->tile_count; ++i) {
+		if (current_level->tiles[i].exists) ++chunk_count;
 	}
-
-	// Decompress the top level tiles
-	i32 tile_index = 0;
+	state.chunks_remaining = chunk_count;
+	write_barrier;
 	for (i32 tile_y = 0; tile_y < current_level->height_in_tiles; ++tile_y) {
-		for (i32 tile_x = 0; tile_x < current_level->width_in_tiles; ++tile_x, ++tile_index) {
-			isyntax_tile_t* tile = current_level->tiles + tile_index;
+		for (i32 tile_x = 0; tile_x < current_level->width_in_tiles; ++tile_x) {
+			isyntax_tile_t* tile = current_level->tiles + tile_y * current_level->width_in_tiles + tile_x;
 			if (!tile->exists) continue;
-			isyntax_codeblock_t* top_chunk_codeblock = wsi->codeblocks + tile->codeblock_chunk_index;
-			u64 offset0 = top_chunk_codeblock->block_data_offset;
-
-			isyntax_codeblock_t* h_blocks[3];
-			isyntax_codeblock_t* ll_blocks[3];
-			i32 ll_block_offset = (codeblocks_per_color - 1);
-			for (i32 i = 0; i < 3; ++i) {
-				h_blocks[i] = top_chunk_codeblock + block_color_offsets[i];
-				ll_blocks[i] = top_chunk_codeblock + block_color_offsets[i] + ll_block_offset;
-			}
-			for (i32 i = 0; i < 3; ++i) {
-				isyntax_codeblock_t* h_block =  h_blocks[i];
-				isyntax_codeblock_t* ll_block = ll_blocks[i];
-				isyntax_tile_channel_t* color_channel = tile->color_channels + i;
-				ASSERT(color_channel->coeff_h == NULL);
-				ASSERT(color_channel->coeff_ll == NULL);
-				color_channel->coeff_h = (icoeff_t*)block_alloc(&isyntax->h_coeff_block_allocator);
-				isyntax_decompress_codeblock_in_chunk(h_block, isyntax->block_width, isyntax->block_height, data_chunks[tile_index], offset0, color_channel->coeff_h);
-				color_channel->coeff_ll = (icoeff_t*)block_alloc(&isyntax->ll_coeff_block_allocator);
-				isyntax_decompress_codeblock_in_chunk(ll_block, isyntax->block_width, isyntax->block_height, data_chunks[tile_index], offset0, color_channel->coeff_ll);
-
-				// We're loading everything at once for this level, so we can set every tile as having their neighors loaded as well.
-				color_channel->neighbors_loaded = isyntax_get_adjacent_tiles_mask(current_level, tile_x, tile_y);
+			isyntax_first_load_chunk_task_t task = {0};
+			task.state = &state;
+			task.tile_x = tile_x;
+			task.tile_y = tile_y;
+			if (!add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_VISIBLE_TILE, isyntax_first_load_chunk_task_func, &task, sizeof(task))) {
+				isyntax_first_load_chunk(&state, tile_x, tile_y); // queue is full, do it ourselves
 			}
 		}
 	}
-
-	// Transform and submit the top level tiles
-	tiles_loaded += isyntax_load_all_tiles_in_level(resource_id, isyntax, wsi, scale);
-
-	// Decompress and transform the remaining levels in the data chunks.
-	if (levels_in_chunk >= 2) {
-		scale = wsi->max_scale - 1;
-		current_level = wsi->levels + scale;
-		// First do the Hulsken decompression on all tiles for this level
-		i32 chunk_index = 0;
-		for (i32 tile_y = 0; tile_y < current_level->height_in_tiles; tile_y += 2) {
-			for (i32 tile_x = 0; tile_x < current_level->width_in_tiles; tile_x += 2, ++chunk_index) {
-				tile_index = tile_y * current_level->width_in_tiles + tile_x;
-				isyntax_tile_t* tile = current_level->tiles + tile_index;
-				if (!tile->exists) continue;
-				// LL blocks should already be available (these were 'donated' when we were loading the higher level)
-				ASSERT(tile->color_channels[0].coeff_ll != NULL);
-				ASSERT(tile->color_channels[1].coeff_ll != NULL);
-				ASSERT(tile->color_channels[2].coeff_ll != NULL);
-				isyntax_codeblock_t* top_chunk_codeblock = wsi->codeblocks + tile->codeblock_chunk_index;
-				u64 offset0 = top_chunk_codeblock->block_data_offset;
-
-				i32 chunk_codeblock_indices_for_color[4] = {1, 2, 3, 4};
-				i32 tile_delta_x[4] = {0, 1, 0, 1};
-				i32 tile_delta_y[4] = {0, 0, 1, 1};
-				for (i32 color = 0; color < 3; ++color) {
-					// Decompress the codeblocks in this chunk for this level and this color channel
-					for (i32 i = 0; i < 4; ++i) {
-						isyntax_codeblock_t* codeblock = top_chunk_codeblock + chunk_codeblock_indices_for_color[i];
-						ASSERT(codeblock->scale == scale);
-						i64 offset_in_chunk = codeblock->block_data_offset - offset0;
-						ASSERT(offset_in_chunk >= 0);
-						i32 tile_x_in_chunk = tile_x + tile_delta_x[i];
-						i32 tile_y_in_chunk = tile_y + tile_delta_y[i];
-						tile_index = (tile_y_in_chunk * current_level->width_in_tiles) + tile_x_in_chunk;
-						isyntax_tile_t* tile_in_chunk = current_level->tiles + tile_index;
-						isyntax_tile_channel_t* color_channel = tile_in_chunk->color_channels + color;
-						color_channel->coeff_h = (icoeff_t*)block_alloc(&isyntax->h_coeff_block_allocator);
-						isyntax_hulsken_decompress(data_chunks[chunk_index] + offset_in_chunk, codeblock->block_size,
-												   isyntax->block_width, isyntax->block_height,
-												   codeblock->coefficient, 1, color_channel->coeff_h);
-
-						// We're loading everything at once for this level, so we can set every tile as having their neighors loaded as well.
-						color_channel->neighbors_loaded = isyntax_get_adjacent_tiles_mask(current_level, tile_x_in_chunk, tile_y_in_chunk);
-					}
-
-					// Move to the next color channel in the chunk of codeblocks
-					for (i32 i = 0; i < 4; ++i) {
-						chunk_codeblock_indices_for_color[i] += codeblocks_per_color;
-					}
-				}
-			}
+	// Help out while waiting for the chunks to finish
+	while (state.chunks_remaining > 0) {
+		if (!do_worker_work(&global_work_queue, logical_thread_index)) {
+			platform_sleep(0);
 		}
-		// Now do the inverse wavelet transforms
-		tiles_loaded += isyntax_load_all_tiles_in_level(resource_id, isyntax, wsi, scale);
 	}
+	read_barrier;
+	float elapsed_chunks = get_seconds_elapsed(start_chunks, get_clock());
 
-	// Now for the next level down (if present in the chunk)
-	if (levels_in_chunk >= 3) {
-		scale = wsi->max_scale - 2;
-		ASSERT(scale >= 0);
-		current_level = wsi->levels + scale;
-		// First do the Hulsken decompression on all tiles for this level
-		i32 chunk_index = 0;
-		for (i32 tile_y = 0; tile_y < current_level->height_in_tiles; tile_y += 4) {
-			for (i32 tile_x = 0; tile_x < current_level->width_in_tiles; tile_x += 4, ++chunk_index) {
-				tile_index = tile_y * current_level->width_in_tiles + tile_x;
-				isyntax_tile_t* tile = current_level->tiles + tile_index;
-				if (!tile->exists) continue;
-				// LL blocks should already be available (these were 'donated' when we were loading the higher level)
-				ASSERT(tile->color_channels[0].coeff_ll != NULL);
-				ASSERT(tile->color_channels[1].coeff_ll != NULL);
-				ASSERT(tile->color_channels[2].coeff_ll != NULL);
-				isyntax_codeblock_t* top_chunk_codeblock = wsi->codeblocks + tile->codeblock_chunk_index;
-				u64 offset0 = top_chunk_codeblock->block_data_offset;
-
-				i32 chunk_codeblock_indices_for_color[16] = {5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20};
-				i32 tile_delta_x[16] = {0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3};
-				i32 tile_delta_y[16] = {0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3};
-				for (i32 color = 0; color < 3; ++color) {
-					// Decompress the codeblocks in this chunk for this level and this color channel
-					for (i32 i = 0; i < 16; ++i) {
-						isyntax_codeblock_t* codeblock = top_chunk_codeblock + chunk_codeblock_indices_for_color[i];
-						ASSERT(codeblock->scale == scale);
-						i64 offset_in_chunk = codeblock->block_data_offset - offset0;
-						ASSERT(offset_in_chunk >= 0);
-						i32 tile_x_in_chunk = tile_x + tile_delta_x[i];
-						i32 tile_y_in_chunk = tile_y + tile_delta_y[i];
-						tile_index = (tile_y_in_chunk * current_level->width_in_tiles) + tile_x_in_chunk;
-						isyntax_tile_t* tile_in_chunk = current_level->tiles + tile_index;
-						isyntax_tile_channel_t* color_channel = tile_in_chunk->color_channels + color;
-						color_channel->coeff_h = (icoeff_t*) block_alloc(&isyntax->h_coeff_block_allocator);
-						isyntax_hulsken_decompress(data_chunks[chunk_index] + offset_in_chunk, codeblock->block_size, isyntax->block_width,
-						                                                    isyntax->block_height, codeblock->coefficient, 1, color_channel->coeff_h); // TODO: free using _aligned_free()
-
-						// We're loading everything at once for this level, so we can set every tile as having their neighors loaded as well.
-						color_channel->neighbors_loaded = isyntax_get_adjacent_tiles_mask(current_level, tile_x_in_chunk, tile_y_in_chunk);
-					}
+	// Phase 2: inverse wavelet transforms, level by level (each level needs the LL coefficients 'donated' by the level above).
+	float elapsed_idwt[3] = {0};
+	for (i32 i = 0; i < levels_in_chunk; ++i) {
+		i64 start_idwt = get_clock();
+		tiles_loaded += isyntax_load_all_tiles_in_level(logical_thread_index, resource_id, isyntax, wsi, wsi->max_scale - i);
+		elapsed_idwt[i] = get_seconds_elapsed(start_idwt, get_clock());
+	}
 
-					// Move to the next color channel in the chunk of codeblocks
-					for (i32 i = 0; i < 16; ++i) {
-						chunk_codeblock_indices_for_color[i] += codeblocks_per_color;
-					}
-				}
-			}
-		}
-		// Now do the inverse wavelet transforms
-		tiles_loaded += isyntax_load_all_tiles_in_level(resource_id, isyntax, wsi, scale);
+	float total_io_seconds = 0.0f;
+	float total_decompress_seconds = 0.0f;
+	u64 total_bytes_read = 0;
+	for (i32 i = 0; i < current_level->tile_count; ++i) {
+		total_io_seconds += state.io_seconds[i];
+		total_decompress_seconds += state.decompress_seconds[i];
+		total_bytes_read += state.bytes_read[i];
+	}
+	console_print_verbose("   iSyntax first load: %d chunks (%.1f MB) read + decompressed in %g s (I/O %g s, decompress %g s, summed over threads)\n",
+	                      chunk_count, (float)total_bytes_read / MEGABYTES(1), elapsed_chunks, total_io_seconds, total_decompress_seconds);
+	for (i32 i = 0; i < levels_in_chunk; ++i) {
+		console_print_verbose("   iSyntax first load: IDWT scale=%d took %g s\n", wsi->max_scale - i, elapsed_idwt[i]);
 	}
 
 	console_print("   iSyntax: loading the first %d tiles took %g seconds\n", tiles_loaded, get_seconds_elapsed(start_first_load, get_clock()));
@@ -317,7 +331,7 @@ static void isyntax_do_first_load(i32 resource_id, isyntax_t* isyntax, isyntax_i
 	}
 //	console_print("   blocks allocated and freed: %d\n", blocks_freed);
 
-	release_temp_memory(&temp_memory); // deallocate data chunk
+	release_temp_memory(&temp_memory); // deallocate per chunk timings
 
 	wsi->first_load_complete = true;
 
@@ -331,39 +345,89 @@ typedef struct isyntax_load_tile_task_t {
 	i32 tile_x;
 	i32 tile_y;
 	i32 tile_index;
+	i32 generation;
+	bool is_cancellable;
 } isyntax_load_tile_task_t;
 
+static inline bool isyntax_is_tile_within_stream_bounds(isyntax_level_t* level, i32 tile_x, i32 tile_y) {
+	bounds2i bounds = level->stream_bounds;
+	bool result = (tile_x >= bounds.min.x && tile_x < bounds.max.x && tile_y >= bounds.min.y && tile_y < bounds.max.y);
+	return result;
+}
+
 void isyntax_load_tile_task_func(i32 logical_thread_index, void* userdata) {
 	isyntax_load_tile_task_t* task = (isyntax_load_tile_task_t*) userdata;
-	u32* tile_pixels = isyntax_load_tile(task->isyntax, task->wsi, task->scale, task->tile_x, task->tile_y);
-	if (tile_pixels) {
-		submit_tile_completed(task->resource_id, tile_pixels, task->scale, task->tile_index, task->isyntax->tile_width, task->isyntax->tile_height);
+	isyntax_level_t* level = task->wsi->levels + task->scale;
+	isyntax_tile_t* tile = level->tiles + task->tile_index;
+	// Claim the request. If this fails, the request was superseded (resubmitted with a different priority).
+	if (atomic_compare_exchange(&tile->load_generation, task->generation + 1, task->generation)) {
+		if (task->is_cancellable && (task->isyntax->is_being_destroyed || !isyntax_is_tile_within_stream_bounds(level, task->tile_x, task->tile_y))) {
+			// No longer needed: the tile scrolled out of view while waiting in the queue, or the image is closing.
+			// The streamer may submit it again later.
+			tile->is_submitted_for_loading = false;
+		} else {
+			u32* tile_pixels = isyntax_load_tile(task->isyntax, task->wsi, task->scale, task->tile_x, task->tile_y);
+			if (tile_pixels) {
+				submit_tile_completed(task->resource_id, tile_pixels, task->scale, task->tile_index, task->isyntax->tile_width, task->isyntax->tile_height);
+			}
+		}
 	}
 	atomic_decrement(&task->isyntax->refcount); // release
 }
 
-void isyntax_begin_load_tile(i32 resource_id, isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y) {
+static bool isyntax_submit_load_tile_task(i32 resource_id, isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y,
+                                          u32 priority, bool is_cancellable, i32 generation) {
+	isyntax_level_t* level = wsi->levels + scale;
+	isyntax_load_tile_task_t task = {0};
+	task.resource_id = resource_id;
+	task.isyntax = isyntax;
+	task.wsi = wsi;
+	task.scale = scale;
+	task.tile_x = tile_x;
+	task.tile_y = tile_y;
+	task.tile_index = tile_y * level->width_in_tiles + tile_x;
+	task.generation = generation;
+	task.is_cancellable = is_cancellable;
+
+	atomic_increment(&isyntax->refcount); // retain; don't destroy isyntax while busy
+	if (!add_work_queue_entry_with_priority(&global_work_queue, priority, isyntax_load_tile_task_func, &task, sizeof(task))) {
+		atomic_decrement(&isyntax->refcount);
+		return false;
+	}
+	return true;
+}
+
+void isyntax_begin_load_tile(i32 resource_id, isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y, u32 priority, bool is_cancellable) {
 	isyntax_level_t* level = wsi->levels + scale;
 	i32 tile_index = tile_y * level->width_in_tiles + tile_x;
 	isyntax_tile_t* tile = level->tiles + tile_index;
 	if (!tile->is_submitted_for_loading) {
-		isyntax_load_tile_task_t task = {0};
-		task.resource_id = resource_id;
-		task.isyntax = isyntax;
-		task.wsi = wsi;
-		task.scale = scale;
-		task.tile_x = tile_x;
-		task.tile_y = tile_y;
-		task.tile_index = tile_index;
-
+		// Any stale requests for this tile that may still be in the queue will have an older generation number.
+		i32 generation = (tile->load_generation | 1) + 1;
+		tile->load_generation = generation;
+		tile->load_priority = priority;
 		tile->is_submitted_for_loading = true;
-		atomic_increment(&isyntax->refcount); // retain; don't destroy isyntax while busy
-		if (!add_work_queue_entry(&global_work_queue, isyntax_load_tile_task_func, &task, sizeof(task))) {
+		if (!isyntax_submit_load_tile_task(resource_id, isyntax, wsi, scale, tile_x, tile_y, priority, is_cancellable, generation)) {
 			tile->is_submitted_for_loading = false; // chicken out
-			atomic_decrement(&isyntax->refcount);
-		};
+		}
 	}
+}
 
+// Move a queued load request to a different work queue lane (e.g. a prefetched tile that has scrolled into view).
+// The old queue entry becomes a no-op. Requests that have already been picked up by a worker are left alone.
+void isyntax_reprioritize_load_tile(i32 resource_id, isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y, u32 priority) {
+	isyntax_level_t* level = wsi->levels + scale;
+	isyntax_tile_t* tile = level->tiles + tile_y * level->width_in_tiles + tile_x;
+	i32 generation = tile->load_generation;
+	if (!tile->is_submitted_for_loading || tile->load_priority == priority || (generation & 1) != 0) {
+		return;
+	}
+	if (atomic_compare_exchange(&tile->load_generation, generation + 2, generation)) {
+		tile->load_priority = priority;
+		if (!isyntax_submit_load_tile_task(resource_id, isyntax, wsi, scale, tile_x, tile_y, priority, true, generation + 2)) {
+			tile->is_submitted_for_loading = false; // the old request is already invalidated
+		}
+	}
 }
 
 typedef struct isyntax_first_load_task_t {
@@ -374,7 +438,9 @@ typedef struct isyntax_first_load_task_t {
 
 void isyntax_first_load_task_func(i32 logical_thread_index, void* userdata) {
 	isyntax_first_load_task_t* task = (isyntax_first_load_task_t*) userdata;
-	isyntax_do_first_load(task->resource_id, task->isyntax, task->wsi);
+	if (!task->isyntax->is_being_destroyed) {
+		isyntax_do_first_load(logical_thread_index, task->resource_id, task->isyntax, task->wsi);
+	}
 	atomic_decrement(&task->isyntax->refcount); // release
 }
 
@@ -384,7 +450,7 @@ void isyntax_begin_first_load(i32 resource_id, isyntax_t* isyntax, isyntax_image
 	task.isyntax = isyntax;
 	task.wsi = wsi_image;
 	atomic_increment(&isyntax->refcount); // retain; don't destroy isyntax while busy
-	if (!add_work_queue_entry(&global_work_queue, isyntax_first_load_task_func, &task, sizeof(task))) {
+	if (!add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_VISIBLE_TILE, isyntax_first_load_task_func, &task, sizeof(task))) {
 		atomic_decrement(&isyntax->refcount); // chicken out
 	}
 }
@@ -441,11 +507,20 @@ typedef struct isyntax_decompress_h_coeff_for_tile_task_t {
 
 void isyntax_decompress_h_coeff_for_tile_task_func(i32 logical_thread_index, void* userdata) {
 	isyntax_decompress_h_coeff_for_tile_task_t* task = (isyntax_decompress_h_coeff_for_tile_task_t*) userdata;
-	isyntax_decompress_h_coeff_for_tile(task->isyntax, task->wsi, task->scale, task->tile_x, task->tile_y);
+	isyntax_level_t* level = task->wsi->levels + task->scale;
+	if (task->isyntax->is_being_destroyed || !isyntax_is_tile_within_stream_bounds(level, task->tile_x, task->tile_y)) {
+		// No longer needed; the streamer may submit it again later.
+		isyntax_tile_t* tile = level->tiles + task->tile_y * level->width_in_tiles + task->tile_x;
+		tile->is_submitted_for_h_coeff_decompression = false;
+	} else {
+		isyntax_decompress_h_coeff_for_tile(task->isyntax, task->wsi, task->scale, task->tile_x, task->tile_y);
+	}
+	isyntax_tile_t* tile = level->tiles + task->tile_y * level->width_in_tiles + task->tile_x;
+	atomic_decrement(&task->wsi->data_chunks[tile->data_chunk_index].pending_decompress_count); // chunk may be evicted now
 	atomic_decrement(&task->isyntax->refcount); // release
 }
 
-void isyntax_begin_decompress_h_coeff_for_tile(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, isyntax_tile_t* tile, i32 tile_x, i32 tile_y) {
+void isyntax_begin_decompress_h_coeff_for_tile(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, isyntax_tile_t* tile, i32 tile_x, i32 tile_y, u32 priority) {
 	isyntax_decompress_h_coeff_for_tile_task_t task = {0};
 	task.isyntax = isyntax;
 	task.wsi = wsi;
@@ -453,9 +528,12 @@ void isyntax_begin_decompress_h_coeff_for_tile(isyntax_t* isyntax, isyntax_image
 	task.tile_x = tile_x;
 	task.tile_y = tile_y;
 
+	isyntax_data_chunk_t* chunk = wsi->data_chunks + tile->data_chunk_index;
 	atomic_increment(&isyntax->refcount); // retain; don't destroy isyntax while busy
+	atomic_increment(&chunk->pending_decompress_count); // don't evict the chunk while the task is queued
 	tile->is_submitted_for_h_coeff_decompression = true;
-	if (!add_work_queue_entry(&global_work_queue, isyntax_decompress_h_coeff_for_tile_task_func, &task, sizeof(task))) {
+	if (!add_work_queue_entry_with_priority(&global_work_queue, priority, isyntax_decompress_h_coeff_for_tile_task_func, &task, sizeof(task))) {
+		atomic_decrement(&chunk->pending_decompress_count);
 		atomic_decrement(&isyntax->refcount); // chicken out
 		tile->is_submitted_for_h_coeff_decompression = false;
 	}
@@ -488,6 +566,12 @@ typedef struct isyntax_load_region_t {
 	i32 visible_height;
 } isyntax_load_region_t;
 
+static inline bool isyntax_is_tile_in_visible_region(isyntax_load_region_t* region, i32 local_tile_x, i32 local_tile_y) {
+	bool result = (local_tile_x >= region->visible_offset.x && local_tile_x < region->visible_offset.x + region->visible_width &&
+	               local_tile_y >= region->visible_offset.y && local_tile_y < region->visible_offset.y + region->visible_height);
+	return result;
+}
+
 typedef struct isyntax_chunk_load_task_t {
 	i32 index;
 	i32 priority; // currently unused
@@ -583,6 +667,351 @@ void isyntax_mark_tile_for_full_loading_and_set_adjacent_requirements(isyntax_lo
 }
 
 
+// Cache for compressed data chunks and decoded coefficient blocks.
+// Otherwise, the chunks and coefficients of every region that was ever looked at would stay resident for as long as
+// the image is open. At the end of each streaming pass, whatever exceeds the budget is evicted (least recently used
+// first), as long as no queued or running task still depends on it. Evicted data is recreated on demand: chunks are
+// read again for tiles that are missing H coefficients, and parent tiles are reconstructed again for tiles that are
+// missing LL coefficients.
+
+static u64 isyntax_get_data_chunk_size(isyntax_image_t* wsi, isyntax_data_chunk_t* chunk) {
+	isyntax_codeblock_t* last_codeblock = wsi->codeblocks + chunk->top_codeblock_index + (chunk->codeblock_count_per_color * 3) - 1;
+	u64 offset1 = last_codeblock->block_data_offset + last_codeblock->block_size;
+	return offset1 - chunk->offset;
+}
+
+static inline bool isyntax_is_tile_load_in_flight(isyntax_tile_t* tile) {
+	return tile->is_submitted_for_loading && !tile->is_loaded;
+}
+
+// The coefficients of a tile are read when the tile itself or one of its neighbors is reconstructed, and its LL
+// coefficients are written when the parent tile is reconstructed.
+static bool isyntax_are_tile_coefficients_in_use(isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y) {
+	isyntax_level_t* level = wsi->levels + scale;
+	isyntax_tile_t* tile = level->tiles + tile_y * level->width_in_tiles + tile_x;
+	if (tile->is_submitted_for_h_coeff_decompression && !tile->has_h) {
+		return true;
+	}
+	for (i32 y = MAX(tile_y - 1, 0); y <= MIN(tile_y + 1, level->height_in_tiles - 1); ++y) {
+		for (i32 x = MAX(tile_x - 1, 0); x <= MIN(tile_x + 1, level->width_in_tiles - 1); ++x) {
+			if (isyntax_is_tile_load_in_flight(level->tiles + y * level->width_in_tiles + x)) {
+				return true;
+			}
+		}
+	}
+	if (scale < wsi->max_scale) {
+		isyntax_level_t* parent_level = wsi->levels + (scale + 1);
+		isyntax_tile_t* parent = parent_level->tiles + (tile_y / 2) * parent_level->width_in_tiles + (tile_x / 2);
+		if (isyntax_is_tile_load_in_flight(parent)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Once a tile and all of its neighbors have been reconstructed (and the tile has passed on the LL coefficients to
+// its children), its own coefficients are only needed again if the viewer evicts one of those tiles.
+static bool isyntax_are_tile_and_neighbors_loaded(isyntax_level_t* level, i32 tile_x, i32 tile_y) {
+	for (i32 y = MAX(tile_y - 1, 0); y <= MIN(tile_y + 1, level->height_in_tiles - 1); ++y) {
+		for (i32 x = MAX(tile_x - 1, 0); x <= MIN(tile_x + 1, level->width_in_tiles - 1); ++x) {
+			isyntax_tile_t* tile = level->tiles + y * level->width_in_tiles + x;
+			if (tile->exists && !tile->is_loaded) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Tiles of which a child lost its LL coefficients (evicted) need to be reconstructed again, even if they were loaded.
+static bool isyntax_is_ll_missing_for_children(isyntax_image_t* wsi, i32 scale, i32 tile_x, i32 tile_y) {
+	if (scale == 0) return false;
+	isyntax_level_t* child_level = wsi->levels + (scale - 1);
+	for (i32 i = 0; i < 4; ++i) {
+		i32 child_x = tile_x * 2 + (i % 2);
+		i32 child_y = tile_y * 2 + (i / 2);
+		if (child_x >= child_level->width_in_tiles || child_y >= child_level->height_in_tiles) continue;
+		isyntax_tile_t* child = child_level->tiles + child_y * child_level->width_in_tiles + child_x;
+		if (child->exists && !child->has_ll) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// The LL coefficients of the level just below the levels decoded during the first load can't be recreated
+// (the coefficients of their parents are discarded after the first load), so those are never evicted.
+static inline bool isyntax_can_evict_ll_coefficients(isyntax_image_t* wsi, i32 scale) {
+	return scale < wsi->max_scale && !wsi->levels[scale + 1].is_fully_loaded;
+}
+
+static i64 isyntax_evict_tile_coefficients(isyntax_t* isyntax, isyntax_image_t* wsi, i32 scale, isyntax_tile_t* tile) {
+	bool evict_ll = isyntax_can_evict_ll_coefficients(wsi, scale);
+	i64 bytes_freed = 0;
+	for (i32 color = 0; color < 3; ++color) {
+		isyntax_tile_channel_t* channel = tile->color_channels + color;
+		if (channel->coeff_h) {
+			block_free(&isyntax->h_coeff_block_allocator, channel->coeff_h);
+			channel->coeff_h = NULL;
+			bytes_freed += isyntax->h_coeff_block_allocator.block_size;
+		}
+		if (evict_ll && channel->coeff_ll) {
+			block_free(&isyntax->ll_coeff_block_allocator, channel->coeff_ll);
+			channel->coeff_ll = NULL;
+			bytes_freed += isyntax->ll_coeff_block_allocator.block_size;
+		}
+		channel->neighbors_loaded = 0;
+	}
+	tile->has_h = false;
+	tile->is_submitted_for_h_coeff_decompression = false;
+	if (evict_ll) {
+		tile->has_ll = false;
+		tile->ll_invalid_edges = 0;
+	}
+	return bytes_freed;
+}
+
+typedef struct isyntax_cache_candidate_t {
+	i64 last_used;
+	i32 rank; // lower ranks are evicted first
+	i32 scale;
+	i32 tile_index;
+} isyntax_cache_candidate_t;
+
+static int isyntax_cache_candidate_compare_func(const void* a_raw, const void* b_raw) {
+	isyntax_cache_candidate_t* a = (isyntax_cache_candidate_t*)a_raw;
+	isyntax_cache_candidate_t* b = (isyntax_cache_candidate_t*)b_raw;
+	if (a->rank != b->rank) return a->rank - b->rank;
+	if (a->last_used < b->last_used) return -1;
+	if (a->last_used > b->last_used) return 1;
+	return 0;
+}
+
+static void isyntax_evict_coefficients(isyntax_t* isyntax, isyntax_image_t* wsi, i64 bytes_to_free) {
+	isyntax_cache_stats_t* stats = &isyntax->cache_stats;
+	isyntax_cache_candidate_t* candidates = NULL;
+	for (i32 scale = 0; scale <= wsi->max_scale; ++scale) {
+		isyntax_level_t* level = wsi->levels + scale;
+		if (level->is_fully_loaded) continue;
+		bool evict_ll = isyntax_can_evict_ll_coefficients(wsi, scale);
+		for (i32 tile_y = 0; tile_y < level->height_in_tiles; ++tile_y) {
+			for (i32 tile_x = 0; tile_x < level->width_in_tiles; ++tile_x) {
+				i32 tile_index = tile_y * level->width_in_tiles + tile_x;
+				isyntax_tile_t* tile = level->tiles + tile_index;
+				if (tile->last_used == stats->pass_counter) continue; // needed for the current view
+				isyntax_tile_channel_t* channel = tile->color_channels; // all color channels are allocated together
+				if (!(channel->coeff_h || (evict_ll && channel->coeff_ll))) continue;
+				if (isyntax_are_tile_coefficients_in_use(wsi, scale, tile_x, tile_y)) continue;
+
+				isyntax_cache_candidate_t candidate = {0};
+				candidate.last_used = tile->last_used;
+				candidate.scale = scale;
+				candidate.tile_index = tile_index;
+				if (tile->has_ll && tile->ll_invalid_edges != 0) {
+					candidate.rank = 0; // incomplete LL coefficients, these need to be recreated anyway
+				} else if (isyntax_are_tile_and_neighbors_loaded(level, tile_x, tile_y)) {
+					candidate.rank = 1;
+				} else {
+					candidate.rank = 2; // still needed to reconstruct a neighbor (once it comes back into view)
+				}
+				arrput(candidates, candidate);
+			}
+		}
+	}
+	qsort(candidates, arrlen(candidates), sizeof(isyntax_cache_candidate_t), isyntax_cache_candidate_compare_func);
+
+	i64 bytes_freed = 0;
+	for (i32 i = 0; i < arrlen(candidates) && bytes_freed < bytes_to_free; ++i) {
+		isyntax_cache_candidate_t* candidate = candidates + i;
+		isyntax_tile_t* tile = wsi->levels[candidate->scale].tiles + candidate->tile_index;
+		bytes_freed += isyntax_evict_tile_coefficients(isyntax, wsi, candidate->scale, tile);
+		++stats->tiles_evicted;
+	}
+	arrfree(candidates);
+}
+
+static int isyntax_chunk_lru_compare_func(const void* a_raw, const void* b_raw) {
+	isyntax_data_chunk_t* a = *(isyntax_data_chunk_t**)a_raw;
+	isyntax_data_chunk_t* b = *(isyntax_data_chunk_t**)b_raw;
+	if (a->last_used < b->last_used) return -1;
+	if (a->last_used > b->last_used) return 1;
+	return 0;
+}
+
+static void isyntax_evict_data_chunks(isyntax_t* isyntax, isyntax_image_t* wsi, i64 bytes_to_free) {
+	isyntax_cache_stats_t* stats = &isyntax->cache_stats;
+	isyntax_data_chunk_t** candidates = NULL;
+	for (i32 i = 0; i < wsi->data_chunk_count; ++i) {
+		isyntax_data_chunk_t* chunk = wsi->data_chunks + i;
+		// Chunks inside the file mapping cost nothing to keep (the OS pages them out as needed).
+		if (!chunk->data || file_mapping_owns(&isyntax->file_mapping, chunk->data)) continue;
+		if (chunk->last_used == stats->pass_counter || chunk->pending_decompress_count > 0) continue;
+		arrput(candidates, chunk);
+	}
+	qsort(candidates, arrlen(candidates), sizeof(isyntax_data_chunk_t*), isyntax_chunk_lru_compare_func);
+
+	i64 bytes_freed = 0;
+	for (i32 i = 0; i < arrlen(candidates) && bytes_freed < bytes_to_free; ++i) {
+		isyntax_data_chunk_t* chunk = candidates[i];
+		i64 chunk_bytes = isyntax_get_data_chunk_size(wsi, chunk) + 7; // including the safety bytes for the bitstream reader
+		free(chunk->data);
+		chunk->data = NULL;
+		stats->chunk_bytes_resident -= chunk_bytes;
+		bytes_freed += chunk_bytes;
+		++stats->chunks_evicted;
+	}
+	arrfree(candidates);
+}
+
+// Called at the end of each streaming pass.
+static void isyntax_update_cache(isyntax_t* isyntax, isyntax_image_t* wsi) {
+	isyntax_cache_stats_t* stats = &isyntax->cache_stats;
+	read_barrier; // see tile state written by the worker threads
+
+	// Mark the tiles the streamer is currently interested in (plus the neighbors they need) as recently used.
+	// This is also where tiles evicted by the viewer are reset, so that they will be reconstructed again.
+	for (i32 scale = 0; scale <= wsi->max_scale; ++scale) {
+		isyntax_level_t* level = wsi->levels + scale;
+		if (level->is_fully_loaded) continue;
+		bounds2i bounds = level->stream_bounds;
+		if (bounds.max.x <= bounds.min.x || bounds.max.y <= bounds.min.y) continue;
+		i32 min_x = MAX(bounds.min.x - 1, 0);
+		i32 min_y = MAX(bounds.min.y - 1, 0);
+		i32 max_x = MIN(bounds.max.x + 1, level->width_in_tiles);
+		i32 max_y = MIN(bounds.max.y + 1, level->height_in_tiles);
+		for (i32 tile_y = min_y; tile_y < max_y; ++tile_y) {
+			for (i32 tile_x = min_x; tile_x < max_x; ++tile_x) {
+				isyntax_tile_t* tile = level->tiles + tile_y * level->width_in_tiles + tile_x;
+				tile->last_used = stats->pass_counter;
+				if (tile->want_reload) {
+					tile->want_reload = false;
+					if (tile->is_loaded) {
+						tile->is_loaded = false;
+						tile->is_submitted_for_loading = false;
+					}
+				}
+			}
+		}
+	}
+
+	// Evict down to a bit below the budgets, so that we don't need to do this again on the very next pass.
+	i64 chunk_budget = MEGABYTES((i64)isyntax_chunk_cache_budget_mb);
+	if (chunk_budget > 0 && stats->chunk_bytes_resident > chunk_budget) {
+		isyntax_evict_data_chunks(isyntax, wsi, stats->chunk_bytes_resident - (chunk_budget - chunk_budget / 8));
+	}
+	i64 coeff_budget = MEGABYTES((i64)isyntax_coeff_cache_budget_mb);
+	i64 coeff_bytes_resident = (i64)(block_allocator_bytes_in_use(&isyntax->ll_coeff_block_allocator) +
+	                                 block_allocator_bytes_in_use(&isyntax->h_coeff_block_allocator));
+	if (coeff_budget > 0 && coeff_bytes_resident > coeff_budget) {
+		isyntax_evict_coefficients(isyntax, wsi, coeff_bytes_resident - (coeff_budget - coeff_budget / 8));
+		coeff_bytes_resident = (i64)(block_allocator_bytes_in_use(&isyntax->ll_coeff_block_allocator) +
+		                             block_allocator_bytes_in_use(&isyntax->h_coeff_block_allocator));
+	}
+	stats->coeff_bytes_resident = coeff_bytes_resident;
+
+	i64 bytes_resident = stats->chunk_bytes_resident + stats->coeff_bytes_resident;
+	stats->peak_bytes_resident = MAX(stats->peak_bytes_resident, bytes_resident);
+	// Exponential moving average with a time constant of about 10 seconds
+	i64 now = get_clock();
+	if (stats->last_update_clock == 0) {
+		stats->steady_bytes_resident = (float)bytes_resident;
+	} else {
+		float dt = get_seconds_elapsed(stats->last_update_clock, now);
+		float alpha = dt / (dt + 10.0f);
+		stats->steady_bytes_resident += alpha * ((float)bytes_resident - stats->steady_bytes_resident);
+	}
+	stats->last_update_clock = now;
+	++stats->pass_counter;
+}
+
+void isyntax_print_cache_stats(isyntax_t* isyntax) {
+	isyntax_cache_stats_t* stats = &isyntax->cache_stats;
+	console_print("iSyntax cache:\n");
+	console_print("   data chunks:  %.1f / %d MB resident, %lld evicted\n", (float)stats->chunk_bytes_resident / MEGABYTES(1),
+	              isyntax_chunk_cache_budget_mb, stats->chunks_evicted);
+	console_print("   coefficients: %.1f / %d MB resident, %lld tiles evicted\n", (float)stats->coeff_bytes_resident / MEGABYTES(1),
+	              isyntax_coeff_cache_budget_mb, stats->tiles_evicted);
+	console_print("   total: %.1f MB now, %.1f MB steady state, %.1f MB peak\n",
+	              (float)(stats->chunk_bytes_resident + stats->coeff_bytes_resident) / MEGABYTES(1),
+	              stats->steady_bytes_resident / MEGABYTES(1), (float)stats->peak_bytes_resident / MEGABYTES(1));
+	console_print("   chunk reads: %s%s, %d in flight\n", async_read_get_backend_name(),
+	              isyntax->file_mapping.is_valid ? " (unused, file is memory-mapped)" : "", (i32)arrlen(isyntax->pending_chunk_reads));
+}
+
+static void isyntax_submit_chunk_read(isyntax_t* isyntax, i32 chunk_index, u64 read_size, size_t safety_bytes) {
+	isyntax_image_t* wsi = isyntax->images + isyntax->wsi_image_index;
+	isyntax_data_chunk_t* chunk = wsi->data_chunks + chunk_index;
+	u8* buffer = (u8*)malloc(read_size + safety_bytes);
+	memset(buffer + read_size, 0, safety_bytes);
+	isyntax_chunk_read_t* read = (isyntax_chunk_read_t*)calloc(1, sizeof(isyntax_chunk_read_t));
+	read->chunk_index = chunk_index;
+	chunk->is_read_pending = true;
+	read->op.dest = buffer;
+	read->op.file = isyntax->file_handle;
+	read->op.offset = chunk->offset;
+	read->op.size_to_read = read_size;
+	async_read_submit(&read->op);
+	arrput(isyntax->pending_chunk_reads, read);
+}
+
+// Hand over the chunks that have finished reading. Returns the number of chunks that became available.
+static i32 isyntax_collect_chunk_reads(isyntax_t* isyntax, isyntax_image_t* wsi) {
+	i32 chunks_collected = 0;
+	for (i32 i = 0; i < arrlen(isyntax->pending_chunk_reads); ++i) {
+		isyntax_chunk_read_t* read = isyntax->pending_chunk_reads[i];
+		if (!async_read_has_finished(&read->op)) continue;
+		isyntax_data_chunk_t* chunk = wsi->data_chunks + read->chunk_index;
+		u64 read_size = read->op.size_to_read;
+		i64 bytes_read = async_read_finalize(&read->op);
+		if (!(bytes_read > 0)) {
+			console_print_error("Error: could not read iSyntax data at offset %lld (read size %lld)\n", chunk->offset, read_size);
+			memset(read->op.dest, 0, read_size);
+		}
+		chunk->data = (u8*)read->op.dest;
+		chunk->is_read_pending = false;
+		isyntax->cache_stats.chunk_bytes_resident += read_size + 7;
+		free(read);
+		arrdelswap(isyntax->pending_chunk_reads, i);
+		--i;
+		++chunks_collected;
+	}
+	return chunks_collected;
+}
+
+// Submit H coefficient decompression for all requested tiles whose data chunk is available.
+static void isyntax_decompress_h_coeff_in_regions(isyntax_t* isyntax, isyntax_image_t* wsi, isyntax_load_region_t* regions,
+                                                  i32 highest_scale_to_load, i32 lowest_visible_scale) {
+	for (i32 scale = highest_scale_to_load; scale >= lowest_visible_scale; --scale) {
+		isyntax_level_t* level = wsi->levels + scale;
+		isyntax_load_region_t* region = regions + scale;
+
+		for (i32 local_tile_y = 0; local_tile_y < region->height_in_tiles; ++local_tile_y) {
+			i32 tile_y = region->offset.y + local_tile_y;
+			for (i32 local_tile_x = 0; local_tile_x < region->width_in_tiles; ++local_tile_x) {
+				i32 tile_x = region->offset.x + local_tile_x;
+
+				isyntax_tile_t* tile = level->tiles + tile_y * level->width_in_tiles + tile_x;
+				isyntax_tile_req_t* req = region->tile_req + local_tile_y * region->width_in_tiles + local_tile_x;
+
+				if (tile->exists && req->need_h_coeff && !tile->is_submitted_for_h_coeff_decompression) {
+					isyntax_data_chunk_t* chunk = wsi->data_chunks + tile->data_chunk_index;
+					if (chunk->data) {
+						chunk->last_used = isyntax->cache_stats.pass_counter;
+						i32 tasks_waiting = get_work_queue_task_count(&global_work_queue);
+						if (global_worker_thread_idle_count > 0 && tasks_waiting < logical_cpu_count * 10) {
+							u32 priority = isyntax_is_tile_in_visible_region(region, local_tile_x, local_tile_y) ? WORK_QUEUE_PRIORITY_VISIBLE_TILE : WORK_QUEUE_PRIORITY_PREFETCH;
+							isyntax_begin_decompress_h_coeff_for_tile(isyntax, wsi, scale, tile, tile_x, tile_y, priority);
+						} else if (!is_tile_streamer_frame_boundary_passed) {
+							tile->is_submitted_for_h_coeff_decompression = true;
+							isyntax_decompress_h_coeff_for_tile(isyntax, wsi, scale, tile_x, tile_y);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
 bool isyntax_load_next_level_greedily = false;
 
 void isyntax_stream_image_tiles(tile_streamer_t* tile_streamer, isyntax_t* isyntax) {
@@ -601,6 +1030,9 @@ void isyntax_stream_image_tiles(tile_streamer_t* tile_streamer, isyntax_t* isynt
 
 		ASSERT(wsi->level_count >= 0);
 
+		// Pick up chunks that arrived after the previous pass stopped waiting for them.
+		isyntax_collect_chunk_reads(isyntax, wsi);
+
 		i32 highest_visible_scale = ATLEAST(wsi->max_scale, 0);
 		i32 lowest_visible_scale = ATLEAST(tile_streamer->zoom.level, 0);
 		lowest_visible_scale = ATMOST(highest_visible_scale, lowest_visible_scale);
@@ -625,6 +1057,14 @@ void isyntax_stream_image_tiles(tile_streamer_t* tile_streamer, isyntax_t* isynt
 		}
 
 		i32 scales_to_load_count = (highest_scale_to_load+1) - lowest_scale_to_preload;
+
+		// Levels we are not looking at anymore: drop any requests that are still queued.
+		// (The bounds for the other levels are set below.)
+		for (i32 scale = 0; scale <= wsi->max_scale; ++scale) {
+			if (scale < lowest_scale_to_preload || scale > highest_scale_to_load) {
+				wsi->levels[scale].stream_bounds = (bounds2i){0};
+			}
+		}
 		if (scales_to_load_count > 0) {
 
 			// Allocate temporary memory to hold scales_to_load + 1 regions
@@ -665,6 +1105,7 @@ void isyntax_stream_image_tiles(tile_streamer_t* tile_streamer, isyntax_t* isynt
 				padded_bounds.max.x += pad_amount;
 				padded_bounds.max.y += pad_amount;
 				padded_bounds = clip_bounds2i(padded_bounds, level_tiles_bounds);
+				level->stream_bounds = padded_bounds;
 
 				i32 local_bounds_width = padded_bounds.max.x - padded_bounds.min.x;
 				i32 local_bounds_height = padded_bounds.max.y - padded_bounds.min.y;
@@ -745,7 +1186,9 @@ void isyntax_stream_image_tiles(tile_streamer_t* tile_streamer, isyntax_t* isynt
 						for (i32 local_tile_x = 0; local_tile_x < region->width_in_tiles; ++local_tile_x) {
 							i32 tile_x = region->offset.x + local_tile_x;
 							isyntax_tile_req_t* req = region->tile_req + (local_tile_y * region->width_in_tiles) + local_tile_x;
-							if (req->need_ll_coeff) {
+							isyntax_tile_t* tile = wsi->levels[scale].tiles + tile_y * wsi->levels[scale].width_in_tiles + tile_x;
+							bool has_valid_ll = tile->exists && tile->has_ll && tile->ll_invalid_edges == 0;
+							if (req->need_ll_coeff && !has_valid_ll) {
 
 //								ASSERT(tile->exists);
 								// For getting the LL coefficients, we need the (scale+1) level to be reconstructed first
@@ -807,6 +1250,7 @@ void isyntax_stream_image_tiles(tile_streamer_t* tile_streamer, isyntax_t* isynt
 							if (req->need_h_coeff && !tile->has_h) {
 								u32 chunk_index = tile->data_chunk_index;
 								isyntax_data_chunk_t* chunk = wsi->data_chunks + chunk_index;
+								chunk->last_used = isyntax->cache_stats.pass_counter;
 								if (chunk->data == NULL) {
 									bool already_in_list = false;
 									for (i32 i = 0; i < chunks_to_load_count; ++i) {
@@ -836,29 +1280,21 @@ void isyntax_stream_image_tiles(tile_streamer_t* tile_streamer, isyntax_t* isynt
 				// Sorting read operations by offset to improve read performance
 				qsort(chunks_to_load, chunks_to_load_count, sizeof(chunks_to_load[0]), chunk_index_compare_func);
 
-				i64 clock_io_start = get_clock();
-				i32 chunks_loaded = 0;
 				for (i32 i = 0; i < chunks_to_load_count; ++i) {
 					u32 chunk_index = chunks_to_load[i].index;
 					isyntax_data_chunk_t * chunk = wsi->data_chunks + chunk_index;
-					if (!chunk->data) {
-						isyntax_codeblock_t* last_codeblock = wsi->codeblocks + chunk->top_codeblock_index + (chunk->codeblock_count_per_color * 3) - 1;
-						u64 offset1 = last_codeblock->block_data_offset + last_codeblock->block_size;
-						u64 read_size = offset1 - chunk->offset;
+					if (!chunk->data && !chunk->is_read_pending) {
+						u64 read_size = isyntax_get_data_chunk_size(wsi, chunk);
 						size_t safety_bytes = 7; // allocate extra safety bytes at the end for bitstream_lsb_read(), which might read past the end of the buffer
-						chunk->data = (u8*)malloc(read_size + safety_bytes);
-//				        console_print("loading chunk %d\n", chunk_index);
-
-						size_t bytes_read = file_handle_read_at_offset(chunk->data, isyntax->file_handle, chunk->offset, read_size);
-						if (!(bytes_read > 0)) {
-							console_print_error("Error: could not read iSyntax data at offset %lld (read size %lld)\n", chunk->offset, read_size);
-						}
-
-						++chunks_loaded;
-						float seconds_elapsed_io = get_seconds_elapsed(clock_io_start, get_clock());
-						if (seconds_elapsed_io > 0.2f) {
-					        console_print_verbose("Loaded %d chunks before timing out\n", i+1);
-					        break;
+						u8* mapped = file_mapping_get_range(&isyntax->file_mapping, chunk->offset, read_size + safety_bytes);
+						if (mapped) {
+							// No copy needed; let the OS start paging the chunk in while we queue up the decoding work.
+							file_mapping_advise(&isyntax->file_mapping, chunk->offset, read_size, FILE_MAPPING_ADVICE_WILLNEED);
+							chunk->data = mapped;
+						} else {
+							// Queue up all the reads at once; the chunks are picked up for decompression as they arrive.
+//				            console_print("loading chunk %d\n", chunk_index);
+							isyntax_submit_chunk_read(isyntax, chunk_index, read_size, safety_bytes);
 						}
 					}
 				}
@@ -882,39 +1318,16 @@ void isyntax_stream_image_tiles(tile_streamer_t* tile_streamer, isyntax_t* isynt
 		//		}
 
 				// Now try to reconstruct the tiles
-				// Decompress tiles
-				for (i32 scale = highest_scale_to_load; scale >= lowest_visible_scale; --scale) {
-					isyntax_level_t* level = wsi->levels + scale;
-					isyntax_load_region_t* region = regions + scale;
-
-					if (lowest_visible_scale == 0) {
-						DUMMY_STATEMENT;
-					}
+				// Decompress tiles (for the chunks that are already in memory)
+				isyntax_decompress_h_coeff_in_regions(isyntax, wsi, regions, highest_scale_to_load, lowest_visible_scale);
 
-					for (i32 local_tile_y = 0; local_tile_y < region->height_in_tiles; ++local_tile_y) {
-						i32 tile_y = region->offset.y + local_tile_y;
-						for (i32 local_tile_x = 0; local_tile_x < region->width_in_tiles; ++local_tile_x) {
-							i32 tile_x = region->offset.x + local_tile_x;
-
-							isyntax_tile_t* tile = level->tiles + tile_y * level->width_in_tiles + tile_x;
-							isyntax_tile_req_t* req = region->tile_req + local_tile_y * region->width_in_tiles + local_tile_x;
-
-							if (tile->exists && req->need_h_coeff && !tile->is_submitted_for_h_coeff_decompression) {
-								isyntax_data_chunk_t* chunk = wsi->data_chunks + tile->data_chunk_index;
-								if (chunk->data) {
-									i32 tasks_waiting = get_work_queue_task_count(&global_work_queue);
-									if (global_worker_thread_idle_count > 0 && tasks_waiting < logical_cpu_count * 10) {
-										isyntax_begin_decompress_h_coeff_for_tile(isyntax, wsi, scale, tile, tile_x, tile_y);
-									} else if (!is_tile_streamer_frame_boundary_passed) {
-										tile->is_submitted_for_h_coeff_decompression = true;
-										isyntax_decompress_h_coeff_for_tile(isyntax, wsi, scale, tile_x, tile_y);
-									}
-
-								}
-							}
-						}
+				// Start decompressing the rest of the chunks as soon as each of them comes in.
+				while (arrlen(isyntax->pending_chunk_reads) > 0 && !is_tile_streamer_frame_boundary_passed) {
+					if (isyntax_collect_chunk_reads(isyntax, wsi) > 0) {
+						isyntax_decompress_h_coeff_in_regions(isyntax, wsi, regions, highest_scale_to_load, lowest_visible_scale);
+					} else {
+						platform_sleep(1);
 					}
-
 				}
 
 //		        i64 perf_clock_decompress = get_clock();
@@ -935,8 +1348,19 @@ void isyntax_stream_image_tiles(tile_streamer_t* tile_streamer, isyntax_t* isynt
 							if (!req->want_full_load_for_display) {
 								continue; // This tile does not need to be loaded (probably because it has already been loaded)
 							}
+							if (tile->is_submitted_for_loading && tile->is_loaded && scale > target_scale &&
+							    isyntax_is_ll_missing_for_children(wsi, scale, tile_x, tile_y)) {
+								// Reconstruct again, to recreate the LL coefficients that were evicted from the cache.
+								tile->is_submitted_for_loading = false;
+								tile->is_loaded = false;
+							}
 							if (tile->is_submitted_for_loading) {
-								continue; // a worker thread is already on it, don't resubmit
+								// A worker thread is already on it, don't resubmit.
+								// But if it is still waiting in the prefetch lane and has since come into view, move it forward.
+								if (tile->load_priority != WORK_QUEUE_PRIORITY_VISIBLE_TILE && isyntax_is_tile_in_visible_region(region, local_tile_x, local_tile_y)) {
+									isyntax_reprioritize_load_tile(resource_id, isyntax, wsi, scale, tile_x, tile_y, WORK_QUEUE_PRIORITY_VISIBLE_TILE);
+								}
+								continue;
 							}
 							if (!tile->has_ll) {
 								continue; // higher level tile needs to load first
@@ -1007,7 +1431,8 @@ void isyntax_stream_image_tiles(tile_streamer_t* tile_streamer, isyntax_t* isynt
 							++tiles_loaded;
 
 							// All the prerequisites have been met, we should be able to load this tile
-							isyntax_begin_load_tile(resource_id, isyntax, wsi, scale, tile_x, tile_y);
+							u32 priority = isyntax_is_tile_in_visible_region(region, local_tile_x, local_tile_y) ? WORK_QUEUE_PRIORITY_VISIBLE_TILE : WORK_QUEUE_PRIORITY_PREFETCH;
+							isyntax_begin_load_tile(resource_id, isyntax, wsi, scale, tile_x, tile_y, priority, true);
 
 							if (is_tile_streamer_frame_boundary_passed) {
 								goto break_out_of_loop2; // camera bounds updated, recalculate
@@ -1037,6 +1462,9 @@ void isyntax_stream_image_tiles(tile_streamer_t* tile_streamer, isyntax_t* isynt
 //	if (elapsed > 1e-4f) {
 //		console_print("streaming elapsed: %g; loaded %d tiles\n", elapsed, tiles_loaded);
 //	}
+	if (wsi->first_load_complete) {
+		isyntax_update_cache(isyntax, wsi);
+	}
 }
 
 void isyntax_stream_image_tiles_func(i32 logical_thread_index, void* userdata) {
@@ -1063,7 +1491,7 @@ void isyntax_begin_stream_image_tiles(tile_streamer_t* tile_streamer) {
 	if (!is_tile_stream_task_in_progress) {
 		atomic_increment(&tile_streamer->image->isyntax.refcount); // retain; don't destroy isyntax while busy
 		is_tile_stream_task_in_progress = true;
-		add_work_queue_entry(&global_work_queue, isyntax_stream_image_tiles_func, tile_streamer, sizeof(*tile_streamer));
+		add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_VISIBLE_TILE, isyntax_stream_image_tiles_func, tile_streamer, sizeof(*tile_streamer));
 	} else {
 		is_tile_streamer_frame_boundary_passed = true;
 	}
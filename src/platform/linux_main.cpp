@@ -123,9 +123,10 @@ void* worker_thread(void* parameter) {
     return 0;
 }
 
-void init_work_queue(work_queue_t* queue, const char* name) {
+void init_work_queue(work_queue_t* queue, const char* name, bool is_shared_by_workers) {
 	i32 semaphore_initial_count = 0;
 	queue->semaphore = sem_open(name, O_CREAT, 0644, semaphore_initial_count);
+	work_queue_init(queue, total_thread_count, is_shared_by_workers);
 }
 
 platform_thread_info_t thread_infos[MAX_THREAD_COUNT];
@@ -134,9 +135,9 @@ void linux_init_multithreading() {
 	init_thread_memory(0);
     worker_thread_count = total_thread_count - 1;
 
-	init_work_queue(&global_work_queue, "/worksem"); // Queue for newly submitted tasks
-	init_work_queue(&global_completion_queue, "/completionsem"); // Message queue for completed tasks
-	init_work_queue(&global_export_completion_queue, "/completionsem"); // Message queue for export task
+	init_work_queue(&global_work_queue, "/worksem", true); // Queue for newly submitted tasks
+	init_work_queue(&global_completion_queue, "/completionsem", false); // Message queue for completed tasks
+	init_work_queue(&global_export_completion_queue, "/completionsem", false); // Message queue for export task
 
     pthread_t threads[MAX_THREAD_COUNT] = {};
 
@@ -155,6 +156,27 @@ void linux_init_multithreading() {
 
 }
 
+static char linux_cache_path[512];
+
+// Use $XDG_CACHE_HOME/slidescape (or ~/.cache/slidescape) for things that can safely be regenerated.
+void linux_setup_cache_dir() {
+	const char* xdg_cache_home = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+	char base_path[512];
+	if (xdg_cache_home && xdg_cache_home[0] == '/') {
+		snprintf(base_path, sizeof(base_path), "%s", xdg_cache_home);
+	} else if (home && home[0]) {
+		snprintf(base_path, sizeof(base_path), "%s/.cache", home);
+		mkdir(base_path, 0700);
+	} else {
+		return;
+	}
+	snprintf(linux_cache_path, sizeof(linux_cache_path), "%s/slidescape", base_path);
+	if (mkdir(linux_cache_path, 0700) == 0 || errno == EEXIST) {
+		global_cache_dir = linux_cache_path;
+	}
+}
+
 void linux_init_input() {
     old_input = &inputs[0];
     curr_input = &inputs[1];
@@ -383,6 +405,7 @@ int main(int argc, const char** argv)
 	console_printer_benaphore = benaphore_create();
     if (verbose_console) console_print("Starting up...\n");
     get_system_info(verbose_console);
+	linux_setup_cache_dir();
 
 	app_state_t* app_state = &global_app_state;
 	init_app_state(app_state, app_command);
@@ -393,11 +416,12 @@ int main(int argc, const char** argv)
     if (app_command.headless) {
         is_openslide_available = init_openslide();
         is_openslide_loading_done = true;
+        dicom_init();
         return app_command_execute(app_state);
     }
 
-    add_work_queue_entry(&global_work_queue, (work_queue_callback_t*)init_openslide, NULL, 0);
-    add_work_queue_entry(&global_work_queue, (work_queue_callback_t*)dicom_init, NULL, 0);
+    add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, (work_queue_callback_t*)init_openslide, NULL, 0);
+    add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, (work_queue_callback_t*)dicom_init, NULL, 0);
     linux_init_input();
 
 	/*i32 num_video_drivers = SDL_GetNumVideoDrivers();
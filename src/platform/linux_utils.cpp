@@ -19,6 +19,16 @@
 #include "common.h"
 #include "platform.h"
 
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <time.h>
+
+#if LINUX
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
 int platform_stat(const char* filename, struct stat* st) {
 	return stat(filename, st);
 }
@@ -94,4 +104,340 @@ void file_handle_close(file_handle_t file_handle) {
 size_t file_handle_read_at_offset(void* dest, file_handle_t file_handle, u64 offset, size_t bytes_to_read) {
 	size_t bytes_read = pread(file_handle, dest, bytes_to_read, offset);
 	return bytes_read;
-}
\ No newline at end of file
+}
+
+// Asynchronous reads.
+// On Linux, requests go to an io_uring if the kernel supports it (it may also be blocked, e.g. by the seccomp profile
+// of a container). Otherwise (and on macOS), a small pool of threads services the requests using pread().
+// Either way, many reads can be in flight at the same time, so that the storage device can work at full queue depth.
+
+#define ASYNC_IO_QUEUE_DEPTH 256
+#define ASYNC_IO_THREAD_COUNT 8
+
+enum async_io_backend_enum {
+	ASYNC_IO_BACKEND_THREAD_POOL = 0,
+	ASYNC_IO_BACKEND_IO_URING,
+};
+
+static u32 async_io_backend;
+static pthread_once_t async_io_init_once = PTHREAD_ONCE_INIT;
+
+static void async_read_complete(io_operation_t* op, i64 bytes_read) {
+	op->bytes_read = bytes_read;
+	__atomic_store_n(&op->is_finished, true, __ATOMIC_RELEASE);
+}
+
+// Read synchronously, continuing after a short read (pread() may return fewer bytes than requested).
+static i64 async_read_blocking(io_operation_t* op, size_t bytes_already_read) {
+	size_t total_bytes_read = bytes_already_read;
+	while (total_bytes_read < op->size_to_read) {
+		ssize_t ret = pread(op->file, (u8*)op->dest + total_bytes_read, op->size_to_read - total_bytes_read, op->offset + total_bytes_read);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		} else if (ret == 0) {
+			break; // end of file
+		}
+		total_bytes_read += ret;
+	}
+	return (i64)total_bytes_read;
+}
+
+typedef struct async_io_thread_pool_t {
+	io_operation_t* queue[ASYNC_IO_QUEUE_DEPTH];
+	u32 read_index;
+	u32 write_index;
+	benaphore_t lock;
+	semaphore_handle_t semaphore; // counts the queued requests
+} async_io_thread_pool_t;
+
+static async_io_thread_pool_t async_io_thread_pool;
+
+static void* async_io_thread_proc(void* userdata) {
+	async_io_thread_pool_t* pool = (async_io_thread_pool_t*)userdata;
+	for (;;) {
+		semaphore_wait(pool->semaphore);
+		benaphore_lock(&pool->lock);
+		io_operation_t* op = pool->queue[pool->read_index++ % ASYNC_IO_QUEUE_DEPTH];
+		benaphore_unlock(&pool->lock);
+		async_read_complete(op, async_read_blocking(op, 0));
+	}
+	return NULL;
+}
+
+static bool async_io_thread_pool_init(async_io_thread_pool_t* pool) {
+	pool->lock = benaphore_create();
+	pool->semaphore = semaphore_create(0, ASYNC_IO_QUEUE_DEPTH);
+	i32 threads_created = 0;
+	for (i32 i = 0; i < ASYNC_IO_THREAD_COUNT; ++i) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, async_io_thread_proc, pool) == 0) {
+			pthread_detach(thread);
+			++threads_created;
+		}
+	}
+	return threads_created > 0;
+}
+
+static bool async_io_thread_pool_submit(async_io_thread_pool_t* pool, io_operation_t* op) {
+	benaphore_lock(&pool->lock);
+	if (pool->write_index - pool->read_index >= ASYNC_IO_QUEUE_DEPTH) {
+		benaphore_unlock(&pool->lock);
+		return false;
+	}
+	pool->queue[pool->write_index++ % ASYNC_IO_QUEUE_DEPTH] = op;
+	benaphore_unlock(&pool->lock);
+	semaphore_post(pool->semaphore);
+	return true;
+}
+
+#if LINUX
+
+// Minimal io_uring setup using the raw system calls (liburing is not required).
+typedef struct async_io_uring_t {
+	int fd;
+	u32 sq_entries;
+	u32 cq_entries;
+	u32* sq_head;
+	u32* sq_tail;
+	u32* sq_ring_mask;
+	u32* sq_array;
+	struct io_uring_sqe* sqes;
+	u32* cq_head;
+	u32* cq_tail;
+	u32* cq_ring_mask;
+	struct io_uring_cqe* cqes;
+	u32 in_flight;
+	benaphore_t lock;
+} async_io_uring_t;
+
+static async_io_uring_t async_io_ring;
+
+static bool async_io_uring_init(async_io_uring_t* ring) {
+	struct io_uring_params params = {};
+	int fd = (int)syscall(__NR_io_uring_setup, ASYNC_IO_QUEUE_DEPTH, &params);
+	if (fd < 0) {
+		return false;
+	}
+	size_t sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+	size_t cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	bool is_single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (is_single_mmap) {
+		sq_ring_size = MAX(sq_ring_size, cq_ring_size);
+	}
+	u8* sq_ring = (u8*)mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	u8* cq_ring = sq_ring;
+	if (!is_single_mmap) {
+		cq_ring = (u8*)mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED) {
+			munmap(sq_ring, sq_ring_size);
+			close(fd);
+			return false;
+		}
+	}
+	size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	struct io_uring_sqe* sqes = (struct io_uring_sqe*)mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		if (!is_single_mmap) munmap(cq_ring, cq_ring_size);
+		munmap(sq_ring, sq_ring_size);
+		close(fd);
+		return false;
+	}
+	ring->fd = fd;
+	ring->sq_entries = params.sq_entries;
+	ring->cq_entries = params.cq_entries;
+	ring->sq_head = (u32*)(sq_ring + params.sq_off.head);
+	ring->sq_tail = (u32*)(sq_ring + params.sq_off.tail);
+	ring->sq_ring_mask = (u32*)(sq_ring + params.sq_off.ring_mask);
+	ring->sq_array = (u32*)(sq_ring + params.sq_off.array);
+	ring->sqes = sqes;
+	ring->cq_head = (u32*)(cq_ring + params.cq_off.head);
+	ring->cq_tail = (u32*)(cq_ring + params.cq_off.tail);
+	ring->cq_ring_mask = (u32*)(cq_ring + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq_ring + params.cq_off.cqes);
+	ring->lock = benaphore_create();
+	return true;
+}
+
+// Hand any queued submission entries to the kernel. Entries that could not be submitted (e.g. EAGAIN) stay in the
+// submission queue and will be retried on the next call. Call with the lock held.
+static void async_io_uring_flush(async_io_uring_t* ring) {
+	u32 to_submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	while (to_submit > 0) {
+		int ret = (int)syscall(__NR_io_uring_enter, ring->fd, to_submit, 0, 0, NULL, 0);
+		if (ret < 0 && errno == EINTR) continue;
+		break;
+	}
+}
+
+static bool async_io_uring_submit(async_io_uring_t* ring, io_operation_t* op) {
+	benaphore_lock(&ring->lock);
+	u32 tail = *ring->sq_tail; // only written by us
+	u32 head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	// Don't let more requests be in flight than the completion queue can hold
+	if (tail - head >= ring->sq_entries || ring->in_flight >= ring->cq_entries) {
+		benaphore_unlock(&ring->lock);
+		return false;
+	}
+	u32 index = tail & *ring->sq_ring_mask;
+	struct io_uring_sqe* sqe = ring->sqes + index;
+	memset(sqe, 0, sizeof(*sqe));
+	op->iov.iov_base = op->dest;
+	op->iov.iov_len = op->size_to_read;
+	sqe->opcode = IORING_OP_READV; // (IORING_OP_READ would need Linux 5.6)
+	sqe->fd = op->file;
+	sqe->off = op->offset;
+	sqe->addr = (u64)(uintptr_t)&op->iov;
+	sqe->len = 1;
+	sqe->user_data = (u64)(uintptr_t)op;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++ring->in_flight;
+	async_io_uring_flush(ring);
+	benaphore_unlock(&ring->lock);
+	return true;
+}
+
+static void async_io_uring_reap(async_io_uring_t* ring) {
+	benaphore_lock(&ring->lock);
+	async_io_uring_flush(ring);
+	u32 head = *ring->cq_head;
+	u32 tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head) {
+		struct io_uring_cqe* cqe = ring->cqes + (head & *ring->cq_ring_mask);
+		io_operation_t* op = (io_operation_t*)(uintptr_t)cqe->user_data;
+		i64 bytes_read = cqe->res;
+		if (bytes_read > 0 && (size_t)bytes_read < op->size_to_read) {
+			bytes_read = async_read_blocking(op, bytes_read); // short read, get the rest (rare)
+		} else if (bytes_read < 0) {
+			bytes_read = -1;
+		}
+		--ring->in_flight;
+		async_read_complete(op, bytes_read);
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	benaphore_unlock(&ring->lock);
+}
+
+#endif //LINUX
+
+static void async_io_init() {
+#if LINUX
+	if (async_io_uring_init(&async_io_ring)) {
+		async_io_backend = ASYNC_IO_BACKEND_IO_URING;
+		console_print_verbose("Asynchronous reads: using io_uring\n");
+		return;
+	}
+#endif
+	async_io_backend = ASYNC_IO_BACKEND_THREAD_POOL;
+	if (!async_io_thread_pool_init(&async_io_thread_pool)) {
+		console_print_error("Error: could not create the I/O threads, reads will be synchronous\n");
+	}
+	console_print_verbose("Asynchronous reads: using a pool of %d I/O threads\n", ASYNC_IO_THREAD_COUNT);
+}
+
+void async_read_submit(io_operation_t* op) {
+	pthread_once(&async_io_init_once, async_io_init);
+	op->bytes_read = 0;
+	op->is_finished = false;
+	bool submitted = false;
+#if LINUX
+	if (async_io_backend == ASYNC_IO_BACKEND_IO_URING) {
+		submitted = async_io_uring_submit(&async_io_ring, op);
+	}
+#endif
+	if (async_io_backend == ASYNC_IO_BACKEND_THREAD_POOL) {
+		submitted = async_io_thread_pool_submit(&async_io_thread_pool, op);
+	}
+	if (!submitted) {
+		// Queue is full, read it right away.
+		async_read_complete(op, async_read_blocking(op, 0));
+	}
+}
+
+bool async_read_has_finished(io_operation_t* op) {
+	if (__atomic_load_n(&op->is_finished, __ATOMIC_ACQUIRE)) {
+		return true;
+	}
+#if LINUX
+	if (async_io_backend == ASYNC_IO_BACKEND_IO_URING) {
+		async_io_uring_reap(&async_io_ring);
+	}
+#endif
+	return __atomic_load_n(&op->is_finished, __ATOMIC_ACQUIRE);
+}
+
+i64 async_read_finalize(io_operation_t* op) {
+	// NOTE: platform_sleep() is not available in the server builds, which also link this file.
+	struct timespec poll_interval = {0, 1000000}; // 1 ms
+	while (!async_read_has_finished(op)) {
+		nanosleep(&poll_interval, NULL);
+	}
+	return op->bytes_read;
+}
+
+const char* async_read_get_backend_name() {
+	pthread_once(&async_io_init_once, async_io_init);
+	return async_io_backend == ASYNC_IO_BACKEND_IO_URING ? "io_uring" : "thread pool";
+}
+
+static int file_mapping_advice_to_madvise(u32 advice) {
+	switch(advice) {
+		default:
+		case FILE_MAPPING_ADVICE_NORMAL: return MADV_NORMAL;
+		case FILE_MAPPING_ADVICE_RANDOM: return MADV_RANDOM;
+		case FILE_MAPPING_ADVICE_SEQUENTIAL: return MADV_SEQUENTIAL;
+		case FILE_MAPPING_ADVICE_WILLNEED: return MADV_WILLNEED;
+		case FILE_MAPPING_ADVICE_DONTNEED: return MADV_DONTNEED;
+	}
+}
+
+bool file_mapping_open(file_mapping_t* mapping, file_handle_t file_handle, u32 advice) {
+	memset(mapping, 0, sizeof(*mapping));
+	if (!is_file_mapping_enabled || file_handle <= 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(file_handle, &st) != 0 || st.st_size <= 0 || st.st_size > FILE_MAPPING_MAX_SIZE) {
+		return false;
+	}
+	// Don't use up a large part of a restricted address space (ulimit -v); reading through the file handle still works.
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_AS, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && (u64)st.st_size > limit.rlim_cur / 4) {
+		return false;
+	}
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, file_handle, 0);
+	if (data == MAP_FAILED) {
+		console_print_verbose("mmap() failed (%s), falling back to regular reads\n", strerror(errno));
+		return false;
+	}
+	mapping->data = (u8*)data;
+	mapping->size = st.st_size;
+	mapping->is_valid = true;
+	if (advice != FILE_MAPPING_ADVICE_NORMAL) {
+		madvise(data, st.st_size, file_mapping_advice_to_madvise(advice));
+	}
+	return true;
+}
+
+void file_mapping_close(file_mapping_t* mapping) {
+	if (mapping->is_valid) {
+		munmap(mapping->data, mapping->size);
+	}
+	memset(mapping, 0, sizeof(*mapping));
+}
+
+void file_mapping_advise(file_mapping_t* mapping, u64 offset, u64 size, u32 advice) {
+	if (!file_mapping_get_range(mapping, offset, size)) {
+		return;
+	}
+	// madvise() wants a page-aligned address
+	static i64 page_size;
+	if (!page_size) page_size = sysconf(_SC_PAGESIZE);
+	u64 aligned_offset = offset & ~(u64)(page_size - 1);
+	madvise(mapping->data + aligned_offset, size + (offset - aligned_offset), file_mapping_advice_to_madvise(advice));
+}
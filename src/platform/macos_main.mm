@@ -644,6 +644,8 @@ void macos_init_multithreading() {
 	worker_thread_count = total_thread_count - 1;
 	global_work_queue.semaphore = sem_open("/worksem", O_CREAT, 0644, semaphore_initial_count);
 	global_completion_queue.semaphore = sem_open("/completionsem", O_CREAT, 0644, semaphore_initial_count);
+	work_queue_init(&global_work_queue, total_thread_count, true);
+	work_queue_init(&global_completion_queue, total_thread_count, false);
 
 	pthread_t threads[MAX_THREAD_COUNT] = {};
 
@@ -84,6 +84,51 @@ bool is_directory(const char* path) {
 }
 
 
+static u32 detect_cpu_simd_features(void) {
+	u32 features = 0;
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	int info[4] = {0};
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+	__cpuid(info, 1);
+	if (info[3] & (1 << 26)) features |= CPU_SIMD_SSE2;
+	if (info[2] & (1 << 9)) features |= CPU_SIMD_SSSE3;
+	bool os_saves_ymm = false;
+	bool os_saves_zmm = false;
+	if ((info[2] & (1 << 27)) && (info[2] & (1 << 28))) { // OSXSAVE and AVX
+		u64 xcr0 = _xgetbv(0);
+		os_saves_ymm = (xcr0 & 0x6) == 0x6;
+		os_saves_zmm = (xcr0 & 0xE6) == 0xE6;
+	}
+	if (max_leaf >= 7) {
+		__cpuidex(info, 7, 0);
+		if (os_saves_ymm && (info[1] & (1 << 5))) features |= CPU_SIMD_AVX2;
+		if (os_saves_zmm && (info[1] & (1 << 16)) && (info[1] & (1 << 30))) features |= CPU_SIMD_AVX512BW; // AVX512F + AVX512BW
+	}
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	// NOTE: __builtin_cpu_supports() also checks whether the OS preserves the extended register state.
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) features |= CPU_SIMD_SSE2;
+	if (__builtin_cpu_supports("ssse3")) features |= CPU_SIMD_SSSE3;
+	if (__builtin_cpu_supports("avx2")) features |= CPU_SIMD_AVX2;
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) features |= CPU_SIMD_AVX512BW;
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+	features |= CPU_SIMD_NEON; // always available on AArch64
+#endif
+	return features;
+}
+
+u32 get_cpu_simd_features(void) {
+	static volatile u32 cached_features; // NOTE: racy initialization is benign, every thread computes the same value
+	static volatile bool is_initialized;
+	if (!is_initialized) {
+		cached_features = detect_cpu_simd_features();
+		write_barrier;
+		is_initialized = true;
+	}
+	return cached_features;
+}
+
 void get_system_info(bool verbose) {
 #if WINDOWS
     SYSTEM_INFO system_info;
@@ -106,6 +151,12 @@ void get_system_info(bool verbose) {
     page_alignment_mask = ~((u64)(sysconf(_SC_PAGE_SIZE) - 1));
 #endif
     if (verbose) console_print("There are %d logical CPU cores\n", logical_cpu_count);
+	if (verbose) {
+		u32 simd = get_cpu_simd_features();
+		console_print("SIMD support:%s%s%s%s%s\n", (simd & CPU_SIMD_SSE2) ? " SSE2" : "", (simd & CPU_SIMD_SSSE3) ? " SSSE3" : "",
+		              (simd & CPU_SIMD_AVX2) ? " AVX2" : "", (simd & CPU_SIMD_AVX512BW) ? " AVX-512BW" : "",
+		              (simd & CPU_SIMD_NEON) ? " NEON" : "");
+	}
     total_thread_count = MIN(logical_cpu_count, MAX_THREAD_COUNT);
 }
 
@@ -145,6 +196,29 @@ benaphore_t benaphore_create(void) {
 	return result;
 }
 
+semaphore_handle_t semaphore_create(i32 initial_count, i32 max_count) {
+	semaphore_handle_t result;
+#if WINDOWS
+	result = CreateSemaphore(NULL, initial_count, max_count, NULL);
+#elif (APPLE || LINUX)
+	static i32 counter = 1;
+	char semaphore_name[64];
+	i32 c = atomic_increment(&counter);
+	snprintf(semaphore_name, sizeof(semaphore_name)-1, "/semaphore%d", c);
+	result = sem_open(semaphore_name, O_CREAT, 0644, initial_count);
+	sem_unlink(semaphore_name); // the name is not needed anymore, we only use the handle
+#endif
+	return result;
+}
+
+void semaphore_destroy(semaphore_handle_t semaphore) {
+#if WINDOWS
+	CloseHandle(semaphore);
+#elif (APPLE || LINUX)
+	sem_close(semaphore);
+#endif
+}
+
 void benaphore_destroy(benaphore_t* benaphore) {
 #if WINDOWS
 	CloseHandle(benaphore->semaphore);
@@ -165,46 +239,7 @@ void benaphore_unlock(benaphore_t* benaphore) {
 	}
 }
 
-// Performance considerations for async I/O on Linux:
-// https://github.com/littledan/linux-aio#performance-considerations
-
-// TODO: aiocb64 doesn't exist on macOS? need #defines?
-
-
-
-/*void async_read_submit(io_operation_t* op) {
-#if WINDOWS
-	// stub
-#elif (APPLE || LINUX)
-	memset(&op->cb, 0, sizeof(op->cb));
-	op->cb.aio_nbytes = op->size_to_read;
-	op->cb.aio_fildes = op->file;
-	op->cb.aio_offset = op->offset;
-	op->cb.aio_buf = op->dest;
-
-	if (aio_read(&op->cb) == -1) {
-		console_print_error("submit_async_read(): unable to create I/O request\n");
-	}
-#endif
-}
-
-bool async_read_has_finished(io_operation_t* op) {
-#if WINDOWS
-	// stub
-#elif (APPLE || LINUX)
-	int status = aio_error(&op->cb);
-	return (status != EINPROGRESS);
-#endif
-}
-
-i64 async_read_finalize(io_operation_t* op) {
-#if WINDOWS
-	// stub
-#elif (APPLE || LINUX)
-	i64 bytes_read = aio_return(&op->cb);
-	return bytes_read;
-#endif
-}*/
+// NOTE: async_read_submit() and friends are implemented in the platform specific utils (linux_utils.cpp, win32_utils.cpp).
 
 
 
@@ -227,6 +262,12 @@ void* block_allocator_proc(allocator_t* this_allocator, size_t size_to_allocate,
 }
 */
 
+static void block_allocator_chunk_init(block_allocator_chunk_t* chunk, size_t chunk_size) {
+	// Keep the blocks cache line aligned, so that SIMD code can use aligned loads/stores
+	chunk->raw_memory = (u8*)malloc(chunk_size + BLOCK_ALLOCATOR_ALIGNMENT - 1);
+	chunk->memory = (u8*)(((uintptr_t)chunk->raw_memory + BLOCK_ALLOCATOR_ALIGNMENT - 1) & ~(uintptr_t)(BLOCK_ALLOCATOR_ALIGNMENT - 1));
+}
+
 block_allocator_t block_allocator_create(size_t block_size, size_t max_capacity_in_blocks, size_t chunk_size) {
 	u64 total_capacity = (u64)block_size * (u64)max_capacity_in_blocks;
 	u64 chunk_count = total_capacity / chunk_size;
@@ -239,7 +280,7 @@ block_allocator_t block_allocator_create(size_t block_size, size_t max_capacity_
 	result.chunk_count = chunk_count;
 	result.used_chunks = 1;
 	result.chunks = calloc(1, chunk_count * sizeof(block_allocator_chunk_t));
-	result.chunks[0].memory = (u8*)malloc(chunk_size);
+	block_allocator_chunk_init(result.chunks, chunk_size);
 	result.free_list_storage = calloc(1, max_capacity_in_blocks * sizeof(block_allocator_item_t));
 	result.lock = benaphore_create();
 	result.is_valid = true;
@@ -249,7 +290,7 @@ block_allocator_t block_allocator_create(size_t block_size, size_t max_capacity_
 void block_allocator_destroy(block_allocator_t* allocator) {
 	for (i32 i = 0; i < allocator->used_chunks; ++i) {
 		block_allocator_chunk_t* chunk = allocator->chunks + i;
-		if (chunk->memory) free(chunk->memory);
+		if (chunk->raw_memory) free(chunk->raw_memory);
 	}
 	if (allocator->chunks) free(allocator->chunks);
 	if (allocator->free_list_storage) free(allocator->free_list_storage);
@@ -258,6 +299,16 @@ void block_allocator_destroy(block_allocator_t* allocator) {
 }
 
 void* block_alloc(block_allocator_t* allocator) {
+	void* result = block_try_alloc(allocator);
+	if (!result) {
+		console_print_error("block_alloc(): out of memory!\n");
+		panic();
+	}
+	return result;
+}
+
+// Same as block_alloc(), but returns NULL instead of panicking if the allocator is at capacity.
+void* block_try_alloc(block_allocator_t* allocator) {
 	void* result = NULL;
 	benaphore_lock(&allocator->lock);
 	if (allocator->free_list != NULL) {
@@ -280,12 +331,9 @@ void* block_alloc(block_allocator_t* allocator) {
 				chunk_index = allocator->used_chunks++;
 				current_chunk = allocator->chunks + chunk_index;
 				ASSERT(current_chunk->memory == NULL);
-				current_chunk->memory = (u8*)malloc(allocator->chunk_size);
+				block_allocator_chunk_init(current_chunk, allocator->chunk_size);
 				i32 block_index = current_chunk->used_blocks++;
 				result = current_chunk->memory + block_index * allocator->block_size;
-			} else {
-				console_print_error("block_alloc(): out of memory!\n");
-				panic();
 			}
 		}
 	}
@@ -322,12 +370,215 @@ void block_free(block_allocator_t* allocator, void* ptr_to_free) {
 
 }
 
+// Bytes currently handed out by the allocator. (Freed blocks are recycled, but the chunks are only released by
+// block_allocator_destroy().)
+size_t block_allocator_bytes_in_use(block_allocator_t* allocator) {
+	benaphore_lock(&allocator->lock);
+	size_t blocks_in_use = 0;
+	for (i32 i = 0; i < allocator->used_chunks; ++i) {
+		blocks_in_use += allocator->chunks[i].used_blocks;
+	}
+	blocks_in_use -= allocator->free_list_length;
+	benaphore_unlock(&allocator->lock);
+	return blocks_in_use * allocator->block_size;
+}
+
+static inline void cpu_relax(void) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	_mm_pause();
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	_mm_pause();
+#elif defined(__GNUC__) && defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+static void tile_pixel_pool_lock(tile_pixel_pool_t* pool) {
+	while (!atomic_compare_exchange(&pool->lock, 1, 0)) {
+		// Wait for the lock to look free before retrying, so that we don't keep bouncing the cache line around.
+		while (pool->lock) {
+			cpu_relax();
+		}
+	}
+}
+
+static void tile_pixel_pool_unlock(tile_pixel_pool_t* pool) {
+	atomic_compare_exchange(&pool->lock, 0, 1);
+}
+
+#define TILE_PIXEL_CHUNK_ALL_FREE ((u32)((1ull << TILE_PIXEL_POOL_BLOCKS_PER_CHUNK) - 1))
+
+// Returns the index of the chunk containing ptr, or -1 if the pointer does not belong to the pool.
+static i32 tile_pixel_pool_find_chunk(tile_pixel_pool_t* pool, u8* ptr) {
+	i32 lo = 0;
+	i32 hi = pool->chunk_count - 1;
+	while (lo <= hi) {
+		i32 mid = lo + (hi - lo) / 2;
+		tile_pixel_chunk_t* chunk = pool->chunks + mid;
+		if (ptr < chunk->memory) {
+			hi = mid - 1;
+		} else if (ptr >= chunk->memory + chunk->block_size * TILE_PIXEL_POOL_BLOCKS_PER_CHUNK) {
+			lo = mid + 1;
+		} else {
+			return mid;
+		}
+	}
+	return -1;
+}
+
+static u8* tile_pixel_chunk_take_block(tile_pixel_pool_t* pool, tile_pixel_chunk_t* chunk) {
+	tile_pixel_size_class_t* size_class = pool->size_classes + chunk->size_class_index;
+	if (chunk->free_mask == TILE_PIXEL_CHUNK_ALL_FREE) {
+		--size_class->idle_chunk_count;
+	}
+	i32 block_index = bit_scan_forward(chunk->free_mask);
+	chunk->free_mask &= ~(1u << block_index);
+	--size_class->free_block_count;
+	return chunk->memory + block_index * chunk->block_size;
+}
+
+u8* tile_pixels_alloc(size_t size) {
+	tile_pixel_pool_t* pool = &global_tile_pixel_pool;
+	size_t block_size = (size + BLOCK_ALLOCATOR_ALIGNMENT - 1) & ~(size_t)(BLOCK_ALLOCATOR_ALIGNMENT - 1);
+	u8* result = NULL;
+
+	tile_pixel_pool_lock(pool);
+	i32 size_class_index = -1;
+	for (i32 i = 0; i < pool->size_class_count; ++i) {
+		if (pool->size_classes[i].block_size == block_size) {
+			size_class_index = i;
+			break;
+		}
+	}
+	if (size_class_index < 0 && pool->size_class_count < TILE_PIXEL_POOL_MAX_SIZE_CLASSES) {
+		// Not seen this tile size before
+		size_class_index = pool->size_class_count++;
+		tile_pixel_size_class_t* size_class = pool->size_classes + size_class_index;
+		memset(size_class, 0, sizeof(*size_class));
+		size_class->block_size = block_size;
+	}
+	if (size_class_index >= 0 && pool->size_classes[size_class_index].free_block_count > 0) {
+		tile_pixel_size_class_t* size_class = pool->size_classes + size_class_index;
+		if (size_class->recent_chunk) {
+			i32 chunk_index = tile_pixel_pool_find_chunk(pool, size_class->recent_chunk);
+			if (chunk_index >= 0 && pool->chunks[chunk_index].size_class_index == size_class_index &&
+			    pool->chunks[chunk_index].free_mask != 0) {
+				result = tile_pixel_chunk_take_block(pool, pool->chunks + chunk_index);
+			}
+		}
+	}
+	if (!result && size_class_index >= 0 && pool->size_classes[size_class_index].free_block_count > 0) {
+		// Prefer partially used chunks, so that idle chunks stay idle and can be released.
+		tile_pixel_chunk_t* idle_chunk = NULL;
+		for (i32 i = 0; i < pool->chunk_count; ++i) {
+			tile_pixel_chunk_t* chunk = pool->chunks + i;
+			if (chunk->size_class_index != size_class_index || chunk->free_mask == 0) continue;
+			if (chunk->free_mask == TILE_PIXEL_CHUNK_ALL_FREE) {
+				if (!idle_chunk) idle_chunk = chunk;
+			} else {
+				result = tile_pixel_chunk_take_block(pool, chunk);
+				break;
+			}
+		}
+		if (!result && idle_chunk) {
+			result = tile_pixel_chunk_take_block(pool, idle_chunk);
+		}
+	}
+	bool can_add_chunk = (size_class_index >= 0 && pool->chunk_count < TILE_PIXEL_POOL_MAX_CHUNKS);
+	tile_pixel_pool_unlock(pool);
+
+	if (!result && can_add_chunk) {
+		// No free blocks of this size: allocate a new chunk (outside of the lock, this may take a while).
+		tile_pixel_chunk_t new_chunk = {0};
+		new_chunk.raw_memory = (u8*)malloc(block_size * TILE_PIXEL_POOL_BLOCKS_PER_CHUNK + BLOCK_ALLOCATOR_ALIGNMENT - 1);
+		if (new_chunk.raw_memory) {
+			new_chunk.memory = (u8*)(((uintptr_t)new_chunk.raw_memory + BLOCK_ALLOCATOR_ALIGNMENT - 1) & ~(uintptr_t)(BLOCK_ALLOCATOR_ALIGNMENT - 1));
+			new_chunk.block_size = block_size;
+			new_chunk.size_class_index = size_class_index;
+			new_chunk.free_mask = TILE_PIXEL_CHUNK_ALL_FREE;
+
+			tile_pixel_pool_lock(pool);
+			if (pool->chunk_count < TILE_PIXEL_POOL_MAX_CHUNKS) {
+				// Insert the chunk, keeping the array sorted by address
+				i32 insert_index = 0;
+				while (insert_index < pool->chunk_count && pool->chunks[insert_index].memory < new_chunk.memory) {
+					++insert_index;
+				}
+				memmove(pool->chunks + insert_index + 1, pool->chunks + insert_index,
+				        (pool->chunk_count - insert_index) * sizeof(tile_pixel_chunk_t));
+				pool->chunks[insert_index] = new_chunk;
+				++pool->chunk_count;
+				tile_pixel_size_class_t* size_class = pool->size_classes + size_class_index;
+				size_class->free_block_count += TILE_PIXEL_POOL_BLOCKS_PER_CHUNK;
+				++size_class->idle_chunk_count;
+				result = tile_pixel_chunk_take_block(pool, pool->chunks + insert_index);
+				new_chunk.raw_memory = NULL;
+			}
+			tile_pixel_pool_unlock(pool);
+			if (new_chunk.raw_memory) {
+				free(new_chunk.raw_memory); // lost the race for the last chunk slot
+			}
+		}
+	}
+
+	if (result) {
+		atomic_increment(&pool->pooled_alloc_count);
+	} else {
+		// Pool exhausted (or too many different tile sizes): fall back to the general purpose allocator.
+		result = (u8*)malloc(size);
+		atomic_increment(&pool->fallback_alloc_count);
+	}
+	return result;
+}
+
+// Accepts both pooled buffers and buffers that came from malloc() (e.g. from decoders that allocate their own output).
+void tile_pixels_free(void* pixels) {
+	if (!pixels) return;
+	tile_pixel_pool_t* pool = &global_tile_pixel_pool;
+	u8* memory_to_release = NULL;
+	tile_pixel_pool_lock(pool);
+	i32 chunk_index = tile_pixel_pool_find_chunk(pool, (u8*)pixels);
+	if (chunk_index >= 0) {
+		tile_pixel_chunk_t* chunk = pool->chunks + chunk_index;
+		tile_pixel_size_class_t* size_class = pool->size_classes + chunk->size_class_index;
+		i32 block_index = (i32)(((u8*)pixels - chunk->memory) / chunk->block_size);
+		ASSERT(!(chunk->free_mask & (1u << block_index)));
+		chunk->free_mask |= (1u << block_index);
+		++size_class->free_block_count;
+		if (chunk->free_mask == TILE_PIXEL_CHUNK_ALL_FREE) {
+			if (size_class->idle_chunk_count >= TILE_PIXEL_POOL_MAX_IDLE_CHUNKS_PER_SIZE_CLASS) {
+				// Enough idle chunks of this size already, give the memory back.
+				memory_to_release = chunk->raw_memory;
+				size_class->free_block_count -= TILE_PIXEL_POOL_BLOCKS_PER_CHUNK;
+				if (size_class->recent_chunk == chunk->memory) {
+					size_class->recent_chunk = NULL;
+				}
+				memmove(pool->chunks + chunk_index, pool->chunks + chunk_index + 1,
+				        (pool->chunk_count - chunk_index - 1) * sizeof(tile_pixel_chunk_t));
+				--pool->chunk_count;
+			} else {
+				++size_class->idle_chunk_count;
+				size_class->recent_chunk = chunk->memory;
+			}
+		} else {
+			size_class->recent_chunk = chunk->memory;
+		}
+	}
+	tile_pixel_pool_unlock(pool);
+	if (chunk_index < 0) {
+		free(pixels);
+	} else if (memory_to_release) {
+		free(memory_to_release);
+	}
+}
+
 void init_thread_memory(i32 logical_thread_index) {
 	// Allocate a private memory buffer
 	u64 thread_memory_size = MEGABYTES(16);
 	local_thread_memory = (thread_memory_t*) platform_alloc(thread_memory_size); // how much actually needed?
 	thread_memory_t* thread_memory = local_thread_memory;
 	memset(thread_memory, 0, sizeof(thread_memory_t));
+	thread_memory->logical_thread_index = logical_thread_index;
 #if !WINDOWS
 	// TODO: implement creation of async I/O events
 #endif
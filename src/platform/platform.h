@@ -32,7 +32,7 @@
 #else
 #include <semaphore.h>
 #include <unistd.h>
-#include <aio.h> // For async io
+#include <sys/uio.h> // For async io
 #include <errno.h> // For async io
 #endif
 
@@ -92,12 +92,41 @@ typedef struct mem_t {
 
 typedef void (work_queue_callback_t)(int logical_thread_index, void* userdata);
 
+// Priority lanes for the work queue (highest priority first).
+// Instruction set extensions that can be selected at runtime (code compiled for the baseline target may still use these
+// through function-level target attributes).
+typedef enum cpu_simd_feature_enum {
+	CPU_SIMD_SSE2 = 0x1,
+	CPU_SIMD_SSSE3 = 0x2,
+	CPU_SIMD_AVX2 = 0x4,
+	CPU_SIMD_AVX512BW = 0x8,
+	CPU_SIMD_NEON = 0x10,
+} cpu_simd_feature_enum;
+
+typedef enum work_queue_priority_enum {
+	WORK_QUEUE_PRIORITY_VISIBLE_TILE = 0, // tiles needed to fill the current viewport (and other work the user is waiting for)
+	WORK_QUEUE_PRIORITY_PREFETCH,         // tiles near (but not inside) the viewport, progressively loaded content
+	WORK_QUEUE_PRIORITY_EXPORT,           // exporting regions/images
+	WORK_QUEUE_PRIORITY_BACKGROUND,       // everything else
+	WORK_QUEUE_PRIORITY_COUNT,
+} work_queue_priority_enum;
+
 typedef struct work_queue_entry_t {
 	bool32 is_valid;
+	u32 priority;
 	work_queue_callback_t* callback;
 	u8 userdata[128];
 } work_queue_entry_t;
 
+#define WORK_QUEUE_DEQUE_CAPACITY 256 // per thread, per priority lane (must be a power of 2)
+
+typedef struct work_queue_deque_t {
+	volatile i32 lock;
+	i32 head; // oldest entry (other threads steal from here)
+	i32 tail; // one past the newest entry (the owning thread pushes and pops here)
+	work_queue_entry_t* entries;
+} work_queue_deque_t;
+
 #if WINDOWS
 typedef HANDLE semaphore_handle_t;
 typedef HANDLE file_handle_t;
@@ -110,13 +139,18 @@ typedef FILE* file_stream_t;
 
 typedef struct work_queue_t {
 	semaphore_handle_t semaphore;
-	i32 volatile next_entry_to_submit;
-	i32 volatile next_entry_to_execute;
+	i32 deque_count; // one deque per thread, for each priority lane
+	work_queue_deque_t* deques; // indexed as [priority * deque_count + thread_index]
+	work_queue_entry_t* entry_storage;
+	i32 volatile lane_task_count[WORK_QUEUE_PRIORITY_COUNT];
 	i32 volatile completion_count;
 	i32 volatile completion_goal;
 	i32 volatile start_count;
 	i32 volatile start_goal;
-	work_queue_entry_t entries[1024];
+	bool is_shared_by_workers; // if true, submitting threads may help out executing work when the queue is full
+	volatile i32 overflow_lock;
+	volatile i32 overflow_count;
+	work_queue_entry_t* overflow_entries; // (stb_ds array) entries that did not fit in a full deque, oldest first
 } work_queue_t;
 
 typedef struct benaphore_t {
@@ -139,6 +173,7 @@ typedef struct {
 #else
 	// TODO: implement this
 #endif
+	i32 logical_thread_index;
 	u64 thread_memory_raw_size;
 	u64 thread_memory_usable_size; // free space from aligned_rest_of_thread_memory onward
 	void* aligned_rest_of_thread_memory;
@@ -236,18 +271,58 @@ typedef SDL_Window* window_handle_t;
 typedef SDL_Window* window_handle_t;
 #endif
 
-typedef struct {
+// Asynchronous read request. The struct must stay in place until the read has finished.
+typedef struct io_operation_t {
 	void* dest;
 	file_handle_t file;
 	i64 offset;
 	size_t size_to_read;
+	volatile i64 bytes_read; // -1 if the read failed; only valid once is_finished is set
+	volatile bool is_finished;
 #if WINDOWS
 	OVERLAPPED overlapped;
 #elif (APPLE || LINUX)
-	struct aiocb cb;
+	struct iovec iov;
 #endif
 } io_operation_t;
 
+// Read-only view of a whole file, so that decoders can read compressed data in place instead of copying it.
+typedef struct file_mapping_t {
+	u8* data;
+	i64 size;
+#if WINDOWS
+	HANDLE mapping_handle;
+#endif
+	bool is_valid;
+} file_mapping_t;
+
+enum file_mapping_advice_enum {
+	FILE_MAPPING_ADVICE_NORMAL = 0,
+	FILE_MAPPING_ADVICE_RANDOM,     // tile reads jump around the file; don't bother with readahead
+	FILE_MAPPING_ADVICE_SEQUENTIAL,
+	FILE_MAPPING_ADVICE_WILLNEED,   // start reading this range in the background
+	FILE_MAPPING_ADVICE_DONTNEED,   // we are done with this range for now
+};
+
+// Files larger than this are never mapped, but read through the file handle instead.
+#if defined(_WIN64) || defined(__x86_64__) || defined(__aarch64__)
+#define FILE_MAPPING_MAX_SIZE TERABYTES(1)
+#else
+#define FILE_MAPPING_MAX_SIZE MEGABYTES(512)
+#endif
+
+// Returns a pointer into the mapping if the whole range is mapped, otherwise NULL.
+static inline u8* file_mapping_get_range(file_mapping_t* mapping, u64 offset, u64 size) {
+	if (mapping && mapping->is_valid && offset <= (u64)mapping->size && size <= (u64)mapping->size - offset) {
+		return mapping->data + offset;
+	}
+	return NULL;
+}
+
+static inline bool file_mapping_owns(file_mapping_t* mapping, void* ptr) {
+	return mapping && mapping->is_valid && (u8*)ptr >= mapping->data && (u8*)ptr < mapping->data + mapping->size;
+}
+
 // See:
 // https://github.com/SasLuca/rayfork/blob/rayfork-0.9/source/core/rayfork-core.c
 
@@ -274,9 +349,12 @@ struct block_allocator_item_t {
 
 typedef struct block_allocator_chunk_t {
 	size_t used_blocks;
-	u8* memory;
+	u8* memory; // aligned to BLOCK_ALLOCATOR_ALIGNMENT
+	u8* raw_memory;
 } block_allocator_chunk_t;
 
+#define BLOCK_ALLOCATOR_ALIGNMENT 64
+
 typedef struct block_allocator_t {
 	size_t block_size;
 	i32 chunk_capacity_in_blocks;
@@ -291,6 +369,41 @@ typedef struct block_allocator_t {
 	bool is_valid;
 } block_allocator_t;
 
+// Pool for decoded tile pixel buffers (BGRA). Tiles are allocated and freed at a high rate by the worker threads
+// and the main thread; recycling them avoids hammering malloc() with large allocations.
+// Buffers are grouped into size classes (one per distinct tile size) and are cache line aligned. The chunks are kept
+// sorted by address, so that tile_pixels_free() can find the owning chunk with a binary search. Chunks that become
+// completely unused are returned to the OS, apart from a few that are kept around for reuse.
+#define TILE_PIXEL_POOL_MAX_SIZE_CLASSES 8
+#define TILE_PIXEL_POOL_MAX_CHUNKS 1024
+#define TILE_PIXEL_POOL_BLOCKS_PER_CHUNK 16
+#define TILE_PIXEL_POOL_MAX_IDLE_CHUNKS_PER_SIZE_CLASS 2
+
+typedef struct tile_pixel_chunk_t {
+	u8* memory; // aligned to BLOCK_ALLOCATOR_ALIGNMENT
+	u8* raw_memory;
+	size_t block_size;
+	i32 size_class_index;
+	u32 free_mask; // bit i is set if block i is available
+} tile_pixel_chunk_t;
+
+typedef struct tile_pixel_size_class_t {
+	size_t block_size;
+	i32 free_block_count;
+	i32 idle_chunk_count; // chunks with all blocks available
+	u8* recent_chunk; // chunk that most recently had a block returned, tried first by tile_pixels_alloc()
+} tile_pixel_size_class_t;
+
+typedef struct tile_pixel_pool_t {
+	tile_pixel_chunk_t chunks[TILE_PIXEL_POOL_MAX_CHUNKS]; // sorted by address
+	i32 chunk_count;
+	tile_pixel_size_class_t size_classes[TILE_PIXEL_POOL_MAX_SIZE_CLASSES];
+	i32 size_class_count;
+	volatile i32 lock; // spinlock, only held for short bookkeeping (chunk memory is allocated/released outside of it)
+	volatile i32 pooled_alloc_count;
+	volatile i32 fallback_alloc_count;
+} tile_pixel_pool_t;
+
 typedef struct directory_listing_t directory_listing_t;
 
 // Inline procedures as wrappers for system routines
@@ -361,9 +474,16 @@ void file_stream_close(file_stream_t file_stream);
 file_handle_t open_file_handle_for_simultaneous_access(const char* filename);
 void file_handle_close(file_handle_t file_handle);
 size_t file_handle_read_at_offset(void* dest, file_handle_t file_handle, u64 offset, size_t bytes_to_read);
+bool file_mapping_open(file_mapping_t* mapping, file_handle_t file_handle, u32 advice);
+void file_mapping_close(file_mapping_t* mapping);
+void file_mapping_advise(file_mapping_t* mapping, u64 offset, u64 size, u32 advice);
 
+void work_queue_init(work_queue_t* queue, i32 deque_count, bool is_shared_by_workers);
+void work_queue_destroy(work_queue_t* queue);
 i32 get_work_queue_task_count(work_queue_t* queue);
-bool add_work_queue_entry(work_queue_t* queue, work_queue_callback_t callback, void* userdata, size_t userdata_size);
+i32 get_work_queue_task_count_for_priority(work_queue_t* queue, u32 priority);
+bool add_work_queue_entry_with_priority(work_queue_t* queue, u32 priority, work_queue_callback_t callback, void* userdata, size_t userdata_size);
+bool try_add_work_queue_entry(work_queue_t* queue, u32 priority, work_queue_callback_t callback, void* userdata, size_t userdata_size);
 bool is_queue_work_in_progress(work_queue_t* queue);
 bool is_queue_work_waiting_to_start(work_queue_t* queue);
 work_queue_entry_t get_next_work_queue_entry(work_queue_t* queue);
@@ -371,11 +491,16 @@ void mark_queue_entry_completed(work_queue_t* queue);
 bool do_worker_work(work_queue_t* queue, int logical_thread_index);
 void drain_work_queue(work_queue_t* queue); // NOTE: only use this on the main thread
 void test_multithreading_work_queue();
+void benchmark_work_queue(i32 max_thread_count);
 
 bool file_exists(const char* filename);
 bool is_directory(const char* path);
 
 void get_system_info(bool verbose);
+u32 get_cpu_simd_features(void);
+
+semaphore_handle_t semaphore_create(i32 initial_count, i32 max_count);
+void semaphore_destroy(semaphore_handle_t semaphore);
 
 benaphore_t benaphore_create(void);
 void benaphore_destroy(benaphore_t* benaphore);
@@ -384,12 +509,18 @@ void benaphore_unlock(benaphore_t* benaphore);
 
 void async_read_submit(io_operation_t* op);
 bool async_read_has_finished(io_operation_t* op);
-i64 async_read_finalize(io_operation_t* op);
+i64 async_read_finalize(io_operation_t* op); // waits for the read to finish, returns the number of bytes read
+const char* async_read_get_backend_name();
 
 block_allocator_t block_allocator_create(size_t block_size, size_t max_capacity_in_blocks, size_t chunk_size);
 void block_allocator_destroy(block_allocator_t* allocator);
 void* block_alloc(block_allocator_t* allocator);
+void* block_try_alloc(block_allocator_t* allocator);
 void block_free(block_allocator_t* allocator, void* ptr_to_free);
+size_t block_allocator_bytes_in_use(block_allocator_t* allocator);
+
+u8* tile_pixels_alloc(size_t size);
+void tile_pixels_free(void* pixels);
 
 void init_thread_memory(i32 logical_thread_index);
 
@@ -441,11 +572,14 @@ extern work_queue_t global_work_queue;
 extern work_queue_t global_completion_queue;
 extern work_queue_t global_export_completion_queue;
 extern i32 global_worker_thread_idle_count;
+extern tile_pixel_pool_t global_tile_pixel_pool;
 extern THREAD_LOCAL i32 work_queue_call_depth;
 extern bool is_verbose_mode INIT(= false);
+extern bool is_file_mapping_enabled INIT(= true);
 extern benaphore_t console_printer_benaphore;
 extern bool cursor_hidden;
 extern const char* global_settings_dir;
+extern const char* global_cache_dir; // may be NULL if there is no writable cache location
 extern char global_export_save_as_filename[512];
 extern bool save_file_dialog_open;
 
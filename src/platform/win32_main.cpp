@@ -94,6 +94,7 @@ HGLRC glrcs[MAX_THREAD_COUNT];
 static char g_exe_name[512];
 static char g_root_dir[512];
 static char g_appdata_path[MAX_PATH];
+static char g_cache_path[MAX_PATH];
 
 
 
@@ -332,6 +333,11 @@ void win32_setup_appdata() {
 			}
 		}
 		global_settings_dir = g_appdata_path;
+
+		snprintf(g_cache_path, sizeof(g_cache_path), "%s\\cache", g_appdata_path);
+		if (file_exists(g_cache_path) || CreateDirectoryA(g_cache_path, 0)) {
+			global_cache_dir = g_cache_path;
+		}
 	}
 }
 
@@ -1654,9 +1660,10 @@ DWORD WINAPI thread_proc(void* parameter) {
 	}
 }
 
-void init_work_queue(work_queue_t* queue, const char* name) {
+void init_work_queue(work_queue_t* queue, const char* name, bool is_shared_by_workers) {
 	i32 semaphore_initial_count = 0;
 	queue->semaphore = CreateSemaphoreExA(0, semaphore_initial_count, worker_thread_count, name, 0, SEMAPHORE_ALL_ACCESS);
+	work_queue_init(queue, total_thread_count, is_shared_by_workers);
 }
 
 void win32_init_multithreading() {
@@ -1664,9 +1671,9 @@ void win32_init_multithreading() {
 
 	worker_thread_count = total_thread_count - 1;
 
-	init_work_queue(&global_work_queue, "/worksem"); // Queue for newly submitted tasks
-	init_work_queue(&global_completion_queue, "/completionsem"); // Message queue for completed tasks
-	init_work_queue(&global_export_completion_queue, "/exportcompletionsem"); // Message queue for export task
+	init_work_queue(&global_work_queue, "/worksem", true); // Queue for newly submitted tasks
+	init_work_queue(&global_completion_queue, "/completionsem", false); // Message queue for completed tasks
+	init_work_queue(&global_export_completion_queue, "/exportcompletionsem", false); // Message queue for export task
 
 	// NOTE: the main thread is considered thread 0.
 	for (i32 i = 1; i < total_thread_count; ++i) {
@@ -1972,6 +1979,7 @@ int main() {
 
 	if (app_command.headless) {
 		load_openslide_task(0, NULL);
+		load_dicom_task(0, NULL);
 		return app_command_execute(app_state);
 	}
 
@@ -1979,10 +1987,10 @@ int main() {
 	win32_init_main_window(app_state);
 
 	// Load OpenSlide in the background, we might not need it immediately.
-	add_work_queue_entry(&global_work_queue, load_openslide_task, NULL, 0);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, load_openslide_task, NULL, 0);
 
 	// Load DICOM support in the background
-	add_work_queue_entry(&global_work_queue, load_dicom_task, NULL, 0);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, load_dicom_task, NULL, 0);
 
 	win32_init_input();
 //	do_remote_connection_test();
@@ -84,6 +84,47 @@ void file_handle_close(file_handle_t file_handle) {
 	}
 }
 
+bool file_mapping_open(file_mapping_t* mapping, file_handle_t file_handle, u32 advice) {
+	memset(mapping, 0, sizeof(*mapping));
+	if (!is_file_mapping_enabled || !file_handle || file_handle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER file_size = {};
+	if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart <= 0 || file_size.QuadPart > FILE_MAPPING_MAX_SIZE) {
+		return false;
+	}
+	HANDLE mapping_handle = CreateFileMappingW(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping_handle) {
+		win32_diagnostic_verbose("CreateFileMappingW");
+		return false;
+	}
+	void* data = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+	if (!data) {
+		win32_diagnostic_verbose("MapViewOfFile");
+		CloseHandle(mapping_handle);
+		return false;
+	}
+	mapping->data = (u8*)data;
+	mapping->size = file_size.QuadPart;
+	mapping->mapping_handle = mapping_handle;
+	mapping->is_valid = true;
+	return true;
+}
+
+void file_mapping_close(file_mapping_t* mapping) {
+	if (mapping->is_valid) {
+		UnmapViewOfFile(mapping->data);
+		CloseHandle(mapping->mapping_handle);
+	}
+	memset(mapping, 0, sizeof(*mapping));
+}
+
+void file_mapping_advise(file_mapping_t* mapping, u64 offset, u64 size, u32 advice) {
+	// NOTE: PrefetchVirtualMemory() could be used for FILE_MAPPING_ADVICE_WILLNEED, but it requires Windows 8.
+	// The system cache does a reasonable job with memory-mapped files by itself.
+	(void)mapping; (void)offset; (void)size; (void)advice;
+}
+
 size_t win32_overlapped_read(thread_memory_t* thread_memory, HANDLE file_handle, void* dest, u32 read_size, i64 offset) {
 	// We align reads to 4K boundaries, so that file handles can be used with the FILE_FLAG_NO_BUFFERING flag.
 	// See: https://docs.microsoft.com/en-us/windows/win32/fileio/file-buffering
@@ -157,6 +198,24 @@ size_t file_handle_read_at_offset(void* dest, file_handle_t file_handle, u64 off
 	return bytes_read;
 }
 
+// On Windows, reads are done synchronously: the operation has already finished when async_read_submit() returns.
+void async_read_submit(io_operation_t* op) {
+	op->bytes_read = win32_overlapped_read(local_thread_memory, op->file, op->dest, op->size_to_read, op->offset);
+	op->is_finished = true;
+}
+
+bool async_read_has_finished(io_operation_t* op) {
+	return op->is_finished;
+}
+
+i64 async_read_finalize(io_operation_t* op) {
+	return op->bytes_read;
+}
+
+const char* async_read_get_backend_name() {
+	return "synchronous";
+}
+
 int platform_stat(const char* filename, struct stat* st) {
 	size_t filename_len = strlen(filename) + 1;
 	wchar_t* wide_filename = win32_string_widen(filename, filename_len, (wchar_t*) alloca(2 * filename_len));
@@ -18,80 +18,232 @@
 
 #if !WINDOWS
 #include <semaphore.h>
+#include <pthread.h>
 #endif
 
+// The work queue is split up into 'lanes' (one for each work_queue_priority_enum), and each lane is split up further
+// into one deque per thread. A thread submitting work pushes it onto its own deque. When looking for work, a thread
+// always checks the higher priority lanes first. Within a lane, it first pops the newest entry from its own deque,
+// and otherwise tries to 'steal' the oldest entry from the deque of another thread.
+// The deques are protected by a lightweight spinlock; the critical sections only copy a single entry.
+//
+// If a deque is full, the submitting thread will not drop the job. If the queue is shared by the worker threads, it
+// helps out with executing pending work until there is room again. Otherwise (completion queues, drained by a single
+// consumer thread), the entry spills over into an overflow list. Waiting for the consumer could deadlock, because the
+// consumer may itself be waiting for the submitting thread to finish (e.g. when closing an image during loading).
+
+static inline work_queue_deque_t* work_queue_get_deque(work_queue_t* queue, u32 priority, i32 deque_index) {
+	ASSERT(priority < WORK_QUEUE_PRIORITY_COUNT);
+	ASSERT(deque_index >= 0 && deque_index < queue->deque_count);
+	return queue->deques + priority * queue->deque_count + deque_index;
+}
+
+static inline i32 work_queue_get_local_deque_index(work_queue_t* queue) {
+	i32 thread_index = local_thread_memory ? local_thread_memory->logical_thread_index : 0;
+	return thread_index % queue->deque_count;
+}
+
+static inline void work_queue_deque_lock(work_queue_deque_t* deque) {
+	while (!atomic_compare_exchange(&deque->lock, 1, 0)) {
+		// spin
+	}
+}
+
+static inline void work_queue_deque_unlock(work_queue_deque_t* deque) {
+	atomic_compare_exchange(&deque->lock, 0, 1); // full barrier, so all writes to the entry are visible
+}
+
+void work_queue_init(work_queue_t* queue, i32 deque_count, bool is_shared_by_workers) {
+	ASSERT(deque_count > 0);
+	queue->deque_count = deque_count;
+	queue->is_shared_by_workers = is_shared_by_workers;
+	i32 total_deque_count = WORK_QUEUE_PRIORITY_COUNT * deque_count;
+	queue->deques = (work_queue_deque_t*) calloc(1, total_deque_count * sizeof(work_queue_deque_t));
+	queue->entry_storage = (work_queue_entry_t*) calloc(1, total_deque_count * WORK_QUEUE_DEQUE_CAPACITY * sizeof(work_queue_entry_t));
+	for (i32 i = 0; i < total_deque_count; ++i) {
+		queue->deques[i].entries = queue->entry_storage + i * WORK_QUEUE_DEQUE_CAPACITY;
+	}
+}
+
+void work_queue_destroy(work_queue_t* queue) {
+	if (queue->deques) free(queue->deques);
+	if (queue->entry_storage) free(queue->entry_storage);
+	arrfree(queue->overflow_entries);
+	queue->overflow_count = 0;
+	queue->deques = NULL;
+	queue->entry_storage = NULL;
+	queue->deque_count = 0;
+}
+
 i32 get_work_queue_task_count(work_queue_t* queue) {
-	i32 count = queue->next_entry_to_submit - queue->next_entry_to_execute;
-	while (count < 0) {
-		count += COUNT(queue->entries);
+	i32 count = queue->start_goal - queue->start_count;
+	return ATLEAST(count, 0);
+}
+
+i32 get_work_queue_task_count_for_priority(work_queue_t* queue, u32 priority) {
+	ASSERT(priority < WORK_QUEUE_PRIORITY_COUNT);
+	return queue->lane_task_count[priority];
+}
+
+static bool work_queue_try_push(work_queue_t* queue, u32 priority, work_queue_callback_t callback, void* userdata, size_t userdata_size) {
+	work_queue_deque_t* deque = work_queue_get_deque(queue, priority, work_queue_get_local_deque_index(queue));
+	bool succeeded = false;
+	work_queue_deque_lock(deque);
+	if (deque->tail - deque->head < WORK_QUEUE_DEQUE_CAPACITY) {
+		work_queue_entry_t* entry = deque->entries + (deque->tail & (WORK_QUEUE_DEQUE_CAPACITY - 1));
+		*entry = (work_queue_entry_t){ .callback = callback, .priority = priority };
+		if (userdata_size > 0) {
+			ASSERT(userdata);
+			memcpy(entry->userdata, userdata, userdata_size);
+		}
+		entry->is_valid = true;
+		++deque->tail;
+		// Raise the goals before the entry becomes visible to other threads, so that the counters never lag behind.
+		atomic_increment(&queue->lane_task_count[priority]);
+		atomic_increment(&queue->completion_goal);
+		atomic_increment(&queue->start_goal);
+		succeeded = true;
+	}
+	work_queue_deque_unlock(deque);
+	if (succeeded) {
+		semaphore_post(queue->semaphore);
 	}
-	return count;
+	return succeeded;
 }
 
-bool add_work_queue_entry(work_queue_t* queue, work_queue_callback_t callback, void* userdata, size_t userdata_size) {
+static void work_queue_push_overflow(work_queue_t* queue, u32 priority, work_queue_callback_t callback, void* userdata, size_t userdata_size) {
+	work_queue_entry_t entry = { .callback = callback, .priority = priority };
+	if (userdata_size > 0) {
+		ASSERT(userdata);
+		memcpy(entry.userdata, userdata, userdata_size);
+	}
+	entry.is_valid = true;
+	while (!atomic_compare_exchange(&queue->overflow_lock, 1, 0)) {
+		// spin
+	}
+	arrput(queue->overflow_entries, entry);
+	queue->overflow_count = arrlen(queue->overflow_entries);
+	atomic_increment(&queue->lane_task_count[priority]);
+	atomic_increment(&queue->completion_goal);
+	atomic_increment(&queue->start_goal);
+	atomic_compare_exchange(&queue->overflow_lock, 0, 1);
+	semaphore_post(queue->semaphore);
+}
+
+static bool work_queue_try_pop_overflow(work_queue_t* queue, u32 priority, work_queue_entry_t* result) {
+	if (queue->overflow_count == 0) {
+		return false; // quick check without taking the lock
+	}
+	bool succeeded = false;
+	while (!atomic_compare_exchange(&queue->overflow_lock, 1, 0)) {
+		// spin
+	}
+	i32 count = arrlen(queue->overflow_entries);
+	for (i32 i = 0; i < count; ++i) {
+		if (queue->overflow_entries[i].priority == priority) {
+			*result = queue->overflow_entries[i];
+			arrdel(queue->overflow_entries, i);
+			queue->overflow_count = count - 1;
+			succeeded = true;
+			break;
+		}
+	}
+	atomic_compare_exchange(&queue->overflow_lock, 0, 1);
+	return succeeded;
+}
+
+bool try_add_work_queue_entry(work_queue_t* queue, u32 priority, work_queue_callback_t callback, void* userdata, size_t userdata_size) {
 	if (userdata_size > sizeof(((work_queue_entry_t*)0)->userdata)) {
 		ASSERT(!"userdata_size overflows available space");
 		panic();
 	}
-	for (i32 tries = 0; tries < 1000; ++tries) {
-		// Circular FIFO buffer
-		i32 entry_to_submit = queue->next_entry_to_submit;
-		i32 new_next_entry_to_submit = (queue->next_entry_to_submit + 1) % COUNT(queue->entries);
-		if (new_next_entry_to_submit == queue->next_entry_to_execute) {
-			// TODO: fix multithreading problem: completion queue overflowing
-			console_print_error("Warning: work queue is overflowing - job is cancelled\n");
-			return false;
-		}
-
-		bool succeeded = atomic_compare_exchange(&queue->next_entry_to_submit,
-		                                         new_next_entry_to_submit, entry_to_submit);
-		if (succeeded) {
-//		    console_print("exhange succeeded\n");
-			work_queue_entry_t* entry = queue->entries + entry_to_submit;
-			*entry = (work_queue_entry_t){ .callback = callback };
-			if (userdata_size > 0) {
-				ASSERT(userdata);
-				memcpy(entry->userdata, userdata, userdata_size);
-			}
-			write_barrier;
-			entry->is_valid = true;
-			write_barrier;
-			atomic_increment(&queue->completion_goal);
-			atomic_increment(&queue->start_goal);
-//		    queue->next_entry_to_submit = new_next_entry_to_submit;
-			semaphore_post(queue->semaphore);
+	return work_queue_try_push(queue, priority, callback, userdata, userdata_size);
+}
+
+bool add_work_queue_entry_with_priority(work_queue_t* queue, u32 priority, work_queue_callback_t callback, void* userdata, size_t userdata_size) {
+	if (userdata_size > sizeof(((work_queue_entry_t*)0)->userdata)) {
+		ASSERT(!"userdata_size overflows available space");
+		panic();
+	}
+	bool has_warned = false;
+	for (;;) {
+		if (work_queue_try_push(queue, priority, callback, userdata, userdata_size)) {
 			return true;
-		} else {
-			if (tries > 5) {
-				console_print_error("exchange failed, retrying (try #%d)\n", tries);
+		}
+		// Back-pressure: our deque is full.
+		if (!has_warned) {
+			console_print_verbose("Work queue is full (priority lane %d), applying back-pressure\n", priority);
+			has_warned = true;
+		}
+		if (queue->is_shared_by_workers) {
+			// Make ourselves useful while waiting for room to free up.
+			if (!do_worker_work(queue, local_thread_memory ? local_thread_memory->logical_thread_index : 0)) {
+				platform_sleep_ns(50000);
 			}
-			continue;
+		} else {
+			// Don't wait for the consumer to make room, it might be waiting for us.
+			work_queue_push_overflow(queue, priority, callback, userdata, userdata_size);
+			return true;
 		}
+	}
+}
 
+static bool work_queue_try_pop_from_deque(work_queue_t* queue, work_queue_deque_t* deque, bool is_own_deque, work_queue_entry_t* result) {
+	if (deque->tail == deque->head) {
+		return false; // nothing to do (quick check without taking the lock)
 	}
-	return false;
+	bool succeeded = false;
+	work_queue_deque_lock(deque);
+	if (deque->tail != deque->head) {
+		i32 index;
+		if (is_own_deque) {
+			index = --deque->tail; // newest entry
+		} else {
+			index = deque->head++; // oldest entry
+		}
+		work_queue_entry_t* entry = deque->entries + (index & (WORK_QUEUE_DEQUE_CAPACITY - 1));
+		*result = *entry;
+		entry->is_valid = false;
+		succeeded = true;
+	}
+	work_queue_deque_unlock(deque);
+	return succeeded;
 }
 
 work_queue_entry_t get_next_work_queue_entry(work_queue_t* queue) {
 	work_queue_entry_t result = {0};
+	if (queue->start_goal <= queue->start_count) {
+		return result; // no work waiting to start
+	}
 
-	i32 entry_to_execute = queue->next_entry_to_execute;
-	i32 new_next_entry_to_execute = (entry_to_execute + 1) % COUNT(queue->entries);
-
-	// don't even try to execute a task if it is not yet submitted, or not yet fully submitted
-	if ((entry_to_execute != queue->next_entry_to_submit) && (queue->entries[entry_to_execute].is_valid)) {
-		bool succeeded = atomic_compare_exchange(&queue->next_entry_to_execute,
-		                                         new_next_entry_to_execute, entry_to_execute);
-		if (succeeded) {
-			// We have dibs to execute this task!
-			result = queue->entries[entry_to_execute];
-			queue->entries[entry_to_execute].is_valid = false; // discourage competing threads (maybe not needed?)
+	i32 own_deque_index = work_queue_get_local_deque_index(queue);
+	for (u32 priority = 0; priority < WORK_QUEUE_PRIORITY_COUNT; ++priority) {
+		if (queue->lane_task_count[priority] <= 0) {
+			continue;
+		}
+		// Look in our own deque first, then try to steal from the other threads.
+		bool found = false;
+		for (i32 i = 0; i < queue->deque_count; ++i) {
+			i32 deque_index = (own_deque_index + i) % queue->deque_count;
+			work_queue_deque_t* deque = work_queue_get_deque(queue, priority, deque_index);
+			if (work_queue_try_pop_from_deque(queue, deque, (i == 0), &result)) {
+				found = true;
+				break;
+			}
+		}
+		if (!found) {
+			found = work_queue_try_pop_overflow(queue, priority, &result);
+		}
+		if (found) {
+			atomic_decrement(&queue->lane_task_count[priority]);
+			atomic_increment(&queue->start_count);
 			if (!result.callback) {
 				console_print_error("Error: encountered a work entry with a missing callback routine\n");
 				ASSERT(!"invalid code path");
 			}
 			result.is_valid = true;
 			read_barrier;
+			return result;
 		}
 	}
 
@@ -106,7 +258,6 @@ bool do_worker_work(work_queue_t* queue, int logical_thread_index) {
 	work_queue_entry_t entry = get_next_work_queue_entry(queue);
 	if (entry.is_valid) {
 		atomic_decrement(&global_worker_thread_idle_count);
-		atomic_increment(&queue->start_count);
 		ASSERT(entry.callback);
 		if (entry.callback) {
 			// Simple way to keep track if we are executing a 'nested' task (i.e. executing a job while waiting to continue another job)
@@ -161,25 +312,25 @@ void echo_task_completed(int logical_thread_index, void* userdata) {
 void echo_task(int logical_thread_index, void* userdata) {
 	console_print("thread %d: %s\n", logical_thread_index, (char*) userdata);
 
-	add_work_queue_entry(&global_completion_queue, echo_task_completed, userdata, strlen(userdata)+1);
+	add_work_queue_entry_with_priority(&global_completion_queue, WORK_QUEUE_PRIORITY_BACKGROUND, echo_task_completed, userdata, strlen(userdata)+1);
 }
 #endif
 
 void test_multithreading_work_queue() {
 #ifdef TEST_THREAD_QUEUE
-	add_work_queue_entry(&global_work_queue, echo_task, (void*)"NULL entry", 11);
-	add_work_queue_entry(&global_work_queue, echo_task, (void*)"string 0", 9);
-	add_work_queue_entry(&global_work_queue, echo_task, (void*)"string 1", 9);
-	add_work_queue_entry(&global_work_queue, echo_task, (void*)"string 2", 9);
-	add_work_queue_entry(&global_work_queue, echo_task, (void*)"string 3", 9);
-	add_work_queue_entry(&global_work_queue, echo_task, (void*)"string 4", 9);
-	add_work_queue_entry(&global_work_queue, echo_task, (void*)"string 5", 9);
-	add_work_queue_entry(&global_work_queue, echo_task, (void*)"string 6", 9);
-	add_work_queue_entry(&global_work_queue, echo_task, (void*)"string 7", 9);
-	add_work_queue_entry(&global_work_queue, echo_task, (void*)"string 8", 9);
-	add_work_queue_entry(&global_work_queue, echo_task, (void*)"string 9", 9);
-	add_work_queue_entry(&global_work_queue, echo_task, (void*)"string 10", 10);
-	add_work_queue_entry(&global_work_queue, echo_task, (void*)"string 11", 10);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, echo_task, (void*)"NULL entry", 11);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, echo_task, (void*)"string 0", 9);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, echo_task, (void*)"string 1", 9);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, echo_task, (void*)"string 2", 9);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, echo_task, (void*)"string 3", 9);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, echo_task, (void*)"string 4", 9);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, echo_task, (void*)"string 5", 9);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, echo_task, (void*)"string 6", 9);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, echo_task, (void*)"string 7", 9);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, echo_task, (void*)"string 8", 9);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, echo_task, (void*)"string 9", 9);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, echo_task, (void*)"string 10", 10);
+	add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_BACKGROUND, echo_task, (void*)"string 11", 10);
 
 //	while (is_queue_work_in_progress(&global_work_queue)) {
 //		do_worker_work(&global_work_queue, 0);
@@ -188,4 +339,154 @@ void test_multithreading_work_queue() {
 		do_worker_work(&global_completion_queue, 0);
 	}
 #endif
-}
\ No newline at end of file
+}
+// Microbenchmark for the work queue: measures throughput (jobs/sec) and queueing latency (time from submission until
+// a thread starts executing the job) for different numbers of worker threads.
+// Can be run from the console using the 'bench_work_queue' command.
+
+typedef struct work_queue_benchmark_t {
+	work_queue_t queue;
+	volatile bool32 stop;
+	float* latencies;
+} work_queue_benchmark_t;
+
+typedef struct work_queue_benchmark_thread_info_t {
+	work_queue_benchmark_t* benchmark;
+	i32 logical_thread_index;
+#if WINDOWS
+	HANDLE thread;
+#else
+	pthread_t thread;
+#endif
+} work_queue_benchmark_thread_info_t;
+
+typedef struct work_queue_benchmark_job_t {
+	i64 submit_clock;
+	float* latency;
+	u32 seed;
+} work_queue_benchmark_job_t;
+
+static volatile u32 work_queue_benchmark_sink;
+
+static void work_queue_benchmark_job_func(int logical_thread_index, void* userdata) {
+	work_queue_benchmark_job_t* job = (work_queue_benchmark_job_t*) userdata;
+	*job->latency = get_seconds_elapsed(job->submit_clock, get_clock());
+	// Simulate a small amount of work (roughly a microsecond)
+	u32 x = job->seed | 1;
+	for (i32 i = 0; i < 256; ++i) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+	}
+	work_queue_benchmark_sink = x;
+}
+
+#if WINDOWS
+static DWORD WINAPI work_queue_benchmark_thread_proc(void* parameter) {
+#else
+static void* work_queue_benchmark_thread_proc(void* parameter) {
+#endif
+	work_queue_benchmark_thread_info_t* thread_info = (work_queue_benchmark_thread_info_t*) parameter;
+	work_queue_t* queue = &thread_info->benchmark->queue;
+	init_thread_memory(thread_info->logical_thread_index);
+	while (!thread_info->benchmark->stop) {
+		if (!is_queue_work_waiting_to_start(queue)) {
+			semaphore_wait(queue->semaphore);
+		}
+		do_worker_work(queue, thread_info->logical_thread_index);
+	}
+	free(local_thread_memory);
+	local_thread_memory = NULL;
+	return 0;
+}
+
+static int work_queue_benchmark_float_compare_func(const void* a, const void* b) {
+	float x = *(float*)a;
+	float y = *(float*)b;
+	return (x > y) - (x < y);
+}
+
+static float work_queue_benchmark_percentile(float* sorted_values, i32 count, float percentile) {
+	i32 index = (i32)((float)(count - 1) * percentile);
+	return sorted_values[CLAMP(index, 0, count - 1)];
+}
+
+void benchmark_work_queue(i32 max_thread_count) {
+	i32 job_count = 100000;
+	max_thread_count = CLAMP(max_thread_count, 1, MAX_THREAD_COUNT - 1);
+	float* latencies = (float*) malloc(job_count * sizeof(float));
+	float* sorted_latencies = (float*) malloc(job_count * sizeof(float));
+	work_queue_benchmark_thread_info_t* thread_infos = (work_queue_benchmark_thread_info_t*) calloc(max_thread_count + 1, sizeof(work_queue_benchmark_thread_info_t));
+
+	console_print("Work queue benchmark: %d jobs per run\n", job_count);
+	console_print("threads   jobs/sec     p50 (us)   p99 (us)   p99.9 (us)   p99 visible lane (us)\n");
+	for (i32 thread_count = 1; thread_count <= max_thread_count; thread_count *= 2) {
+		work_queue_benchmark_t benchmark = {0};
+		benchmark.latencies = latencies;
+		// The submitting (main) thread owns deque 0, the benchmark threads own deques 1..thread_count.
+		work_queue_init(&benchmark.queue, thread_count + 1, true);
+		benchmark.queue.semaphore = semaphore_create(0, job_count);
+
+		for (i32 i = 1; i <= thread_count; ++i) {
+			work_queue_benchmark_thread_info_t* thread_info = thread_infos + i;
+			thread_info->benchmark = &benchmark;
+			thread_info->logical_thread_index = i;
+#if WINDOWS
+			thread_info->thread = CreateThread(NULL, 0, work_queue_benchmark_thread_proc, thread_info, 0, NULL);
+#else
+			pthread_create(&thread_info->thread, NULL, &work_queue_benchmark_thread_proc, thread_info);
+#endif
+		}
+
+		i64 start = get_clock();
+		for (i32 i = 0; i < job_count; ++i) {
+			work_queue_benchmark_job_t job = {0};
+			job.latency = latencies + i;
+			job.seed = (u32)i;
+			job.submit_clock = get_clock();
+			u32 priority = (u32)i % WORK_QUEUE_PRIORITY_COUNT; // spread the jobs evenly over the priority lanes
+			add_work_queue_entry_with_priority(&benchmark.queue, priority, work_queue_benchmark_job_func, &job, sizeof(job));
+		}
+		while (is_queue_work_in_progress(&benchmark.queue)) {
+			if (!do_worker_work(&benchmark.queue, 0)) {
+				platform_sleep_ns(10000);
+			}
+		}
+		float seconds_elapsed = get_seconds_elapsed(start, get_clock());
+
+		benchmark.stop = true;
+		for (i32 i = 1; i <= thread_count; ++i) {
+			semaphore_post(benchmark.queue.semaphore);
+		}
+		for (i32 i = 1; i <= thread_count; ++i) {
+#if WINDOWS
+			WaitForSingleObject(thread_infos[i].thread, INFINITE);
+			CloseHandle(thread_infos[i].thread);
+#else
+			pthread_join(thread_infos[i].thread, NULL);
+#endif
+		}
+
+		memcpy(sorted_latencies, latencies, job_count * sizeof(float));
+		qsort(sorted_latencies, job_count, sizeof(float), work_queue_benchmark_float_compare_func);
+		// Latencies for only the jobs in the highest priority lane
+		i32 visible_lane_count = 0;
+		for (i32 i = 0; i < job_count; i += WORK_QUEUE_PRIORITY_COUNT) {
+			latencies[visible_lane_count++] = latencies[i];
+		}
+		qsort(latencies, visible_lane_count, sizeof(float), work_queue_benchmark_float_compare_func);
+
+		console_print("%7d   %10.0f   %8.1f   %8.1f   %10.1f   %21.1f\n", thread_count, (float)job_count / seconds_elapsed,
+		              work_queue_benchmark_percentile(sorted_latencies, job_count, 0.5f) * 1e6f,
+		              work_queue_benchmark_percentile(sorted_latencies, job_count, 0.99f) * 1e6f,
+		              work_queue_benchmark_percentile(sorted_latencies, job_count, 0.999f) * 1e6f,
+		              work_queue_benchmark_percentile(latencies, visible_lane_count, 0.99f) * 1e6f);
+
+		semaphore_destroy(benchmark.queue.semaphore);
+		work_queue_destroy(&benchmark.queue);
+	}
+
+	free(latencies);
+	free(sorted_latencies);
+	free(thread_infos);
+}
@@ -70,6 +70,9 @@
 #include <string.h>    //strlen
 #include <sys/stat.h>
 #include <pthread.h>
+#ifndef _WIN32
+#include <sys/socket.h> // shutdown
+#endif
 
 #include <time.h>
 #include <errno.h>
@@ -77,13 +80,22 @@
 #include "tiff.h"
 #include "stringutils.h"
 
-#define MAX_NUM_THREADS 16
+// Clients keep their connections open (one per client thread), so each of them occupies a thread here.
+#define MAX_NUM_THREADS 64
 #define SERVER_VERBOSE 1
+// Close persistent connections that have been idle for this long.
+#define SERVER_KEEP_ALIVE_TIMEOUT_MS 30000
+// Upper limit for a request, including pipelined requests that have already arrived but are not yet handled.
+#define SERVER_REQUEST_BUFFER_SIZE KILOBYTES(16)
 
 typedef struct {
 	mbedtls_net_context client_fd;
 	int thread_complete;
 	const mbedtls_ssl_config *config;
+	// Protected by idle_connection_mutex:
+	int is_idle; // waiting for the next request on a persistent connection
+	int close_requested; // the slot is being reclaimed for a new connection
+	i64 idle_since;
 } thread_info_t;
 
 typedef struct {
@@ -94,12 +106,15 @@ typedef struct {
 
 static thread_info_t    base_info;
 static pthread_info_t   threads[MAX_NUM_THREADS];
+static pthread_mutex_t  idle_connection_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 typedef struct {
 	thread_info_t *thread_info;
 	mbedtls_net_context *client_fd;
 	long int thread_id;
 	mbedtls_ssl_context ssl;
+	bool keep_alive;
+	bool is_response_started;
 } server_connection_t;
 
 bool ssl_send(server_connection_t* connection, u8* buf, i32 send_size) {
@@ -108,6 +123,7 @@ bool ssl_send(server_connection_t* connection, u8* buf, i32 send_size) {
 	 */
 	mbedtls_printf( "  [ #%ld ]  > Write to client:\n", connection->thread_id );
 	i32 ret = 1;
+	connection->is_response_started = true;
 
 	u8* send_buffer_pos = buf;
 	u32 send_size_remaining = (u32)send_size;
@@ -210,6 +226,7 @@ typedef struct http_request_t {
 	char* method_name;
 	char* uri;
 	char* protocol;
+	bool keep_alive;
 } http_request_t;
 
 http_request_t* parse_http_headers(const char* http_headers, u64 size) {
@@ -244,6 +261,21 @@ http_request_t* parse_http_headers(const char* http_headers, u64 size) {
 	result->uri = uri;
 	result->protocol = protocol;
 
+	// Persistent connections are the default from HTTP/1.1 onwards
+	result->keep_alive = (strcmp(protocol, "HTTP/1.0") != 0);
+	for (i32 i = 1; i < num_lines; ++i) {
+		char* line = lines[i];
+		if (strncasecmp(line, "Connection:", 11) == 0) {
+			char* value = line + 11;
+			while (*value == ' ') ++value;
+			if (strncasecmp(value, "close", 5) == 0) {
+				result->keep_alive = false;
+			} else if (strncasecmp(value, "keep-alive", 10) == 0) {
+				result->keep_alive = true;
+			}
+		}
+	}
+
 	goto cleanup;
 	fail:
 	printf("Error: malformed HTTP headers\n");
@@ -321,12 +353,21 @@ void locate_file_prepend_env(const char* base_filename, const char* env, char* p
 	strcpy(path_buffer, base_filename);
 }
 
+bool server_send_response_headers(server_connection_t* connection, const char* status, u64 content_length) {
+	char http_headers[4096];
+	snprintf(http_headers, sizeof(http_headers),
+	         "HTTP/1.1 %s\r\nConnection: %s\r\nContent-type: application/octet-stream\r\nContent-length: %llu\r\n\r\n",
+	         status, connection->keep_alive ? "keep-alive" : "close", content_length);
+	return ssl_send(connection, (u8*)http_headers, (i32)strlen(http_headers));
+}
+
 bool server_send_test(server_connection_t* connection) {
 	bool32 success = false;
 
 	mem_t* file_mem = platform_read_entire_file("test_google.html");
 	if (file_mem) {
-		success = ssl_send(connection, file_mem->data, file_mem->len);
+		success = server_send_response_headers(connection, "200 OK", file_mem->len) &&
+		          ssl_send(connection, file_mem->data, file_mem->len);
 		free(file_mem);
 	}
 
@@ -342,7 +383,8 @@ bool32 execute_slide_set_api_call(server_connection_t* connection, slide_api_cal
 	locate_file_prepend_env(call->filename, "SLIDES_DIR", path_buffer, sizeof(path_buffer));
 	mem_t* file_mem = platform_read_entire_file(path_buffer);
 	if (file_mem) {
-		success = ssl_send(connection, file_mem->data, file_mem->len);
+		success = server_send_response_headers(connection, "200 OK", file_mem->len) &&
+		          ssl_send(connection, file_mem->data, file_mem->len);
 		free(file_mem);
 	}
 
@@ -383,22 +425,8 @@ bool32 execute_slide_api_call(server_connection_t* connection, slide_api_call_t
 					memrw_t payload_buffer = {};
 					tiff_serialize(&tiff, &payload_buffer);
 
-					// rewrite the HTTP headers at the start, the Content-Length now isn't correct
-					char http_headers[4096];
-					snprintf(http_headers, sizeof(http_headers),
-					         "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-type: application/octet-stream\r\nContent-length: %-16llu\r\n\r\n",
-					         payload_buffer.used_size);
-					u64 http_headers_size = strlen(http_headers);
-
-					u64 send_size = http_headers_size + payload_buffer.used_size;
-					u8* send_buffer = malloc(send_size);
-					memcpy(send_buffer, http_headers, http_headers_size);
-					memcpy(send_buffer + http_headers_size, payload_buffer.data, payload_buffer.used_size);
-					success = ssl_send(connection, send_buffer, send_size);
-
-//				    tls_close_notify(context);
-//				    send_pending(client_sock, context);
-					free(send_buffer);
+					success = server_send_response_headers(connection, "200 OK", payload_buffer.used_size) &&
+					          ssl_send(connection, payload_buffer.data, payload_buffer.used_size);
 					memrw_destroy(&payload_buffer);
 					tiff_destroy(&tiff);
 				} else {
@@ -436,38 +464,34 @@ bool32 execute_slide_api_call(server_connection_t* connection, slide_api_call_t
 					if (fstat(fileno(fp), &st) == 0) {
 						i64 filesize = st.st_size;
 
-						char http_headers[4096];
-						snprintf(http_headers, sizeof(http_headers),
-						         "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-type: application/octet-stream\r\nContent-length: %llu\r\n\r\n",
-						         total_size);
-						u64 http_headers_size = strlen(http_headers);
-
-						u64 send_size = http_headers_size + total_size;
-						u8* send_buffer = malloc(send_size);
-						memcpy(send_buffer, http_headers, http_headers_size);
-						u8* data_buffer = send_buffer + http_headers_size;
-						u8* data_buffer_pos = data_buffer;
-
 						bool32 ok = true;
-
+						i64 max_chunk_size = 0;
 						for (i32 i = 0; i < batch_size; ++i) {
-							// try to interpret the parameters as numbers
-							i64 requested_offset = chunk_offsets[i];
-							i64 requested_size = chunk_sizes[i];
-							fseeko64(fp, requested_offset, SEEK_SET);
-							ok = ok && (fread(data_buffer_pos, requested_size, 1, fp) == 1);
-							if (!ok) {
-								printf("Error reading from %s\n", call->filename);
+							if (chunk_offsets[i] < 0 || chunk_sizes[i] <= 0 || chunk_offsets[i] + chunk_sizes[i] > filesize) {
+								printf("Requested chunk out of bounds for %s\n", call->filename);
+								ok = false;
 							}
-							data_buffer_pos += requested_size;
+							max_chunk_size = MAX(max_chunk_size, chunk_sizes[i]);
 						}
 
+						// Stream the chunks one at a time, instead of assembling the whole response first.
 						if (ok) {
-
-							ssl_send(connection, send_buffer, send_size);
-
+							u8* data_buffer = malloc(max_chunk_size);
+							ok = server_send_response_headers(connection, "200 OK", total_size);
+							for (i32 i = 0; i < batch_size && ok; ++i) {
+								i64 requested_offset = chunk_offsets[i];
+								i64 requested_size = chunk_sizes[i];
+								fseeko64(fp, requested_offset, SEEK_SET);
+								ok = (fread(data_buffer, requested_size, 1, fp) == 1);
+								if (!ok) {
+									printf("Error reading from %s\n", call->filename);
+									break;
+								}
+								ok = ssl_send(connection, data_buffer, requested_size);
+							}
+							free(data_buffer);
 						}
-						free(send_buffer);
+						success = ok;
 					}
 					fclose(fp);
 				}
@@ -637,13 +661,27 @@ static void my_mutexed_debug( void *ctx, int level,
 
 
 
+// Returns false if the main thread wants to reclaim the slot; the connection should then be closed.
+static bool set_connection_idle(thread_info_t* thread_info, bool is_idle) {
+	bool result = false;
+	pthread_mutex_lock(&idle_connection_mutex);
+	if (!thread_info->close_requested) {
+		thread_info->is_idle = is_idle;
+		if (is_idle) {
+			thread_info->idle_since = (i64)time(NULL);
+		}
+		result = true;
+	}
+	pthread_mutex_unlock(&idle_connection_mutex);
+	return result;
+}
+
 static void *handle_ssl_connection( void *data )
 {
 	int ret, len;
 //	thread_info_t *thread_info = (thread_info_t *) data;
 //	mbedtls_net_context *client_fd = &thread_info->client_fd;
 //	long int thread_id = (long int) pthread_self();
-	unsigned char buf[1024];
 //	mbedtls_ssl_context ssl;
 
 	server_connection_t connection = {};
@@ -666,7 +704,7 @@ static void *handle_ssl_connection( void *data )
 		goto thread_exit;
 	}
 
-	mbedtls_ssl_set_bio( &connection.ssl, connection.client_fd, mbedtls_net_send, mbedtls_net_recv, NULL );
+	mbedtls_ssl_set_bio( &connection.ssl, connection.client_fd, mbedtls_net_send, NULL, mbedtls_net_recv_timeout );
 
 	/*
 	 * 5. Handshake
@@ -686,66 +724,105 @@ static void *handle_ssl_connection( void *data )
 	mbedtls_printf( "  [ #%ld ]  ok\n", connection.thread_id );
 
 	/*
-	 * 6. Read the HTTP Request
+	 * 6. Read and answer HTTP requests, until the client closes the connection (or it times out).
+	 * The client may send several requests at once without waiting for the responses (pipelining); these are
+	 * answered in order.
 	 */
-	mbedtls_printf( "  [ #%ld ]  < Read from client\n", connection.thread_id );
-
-	do
-	{
-		len = sizeof( buf ) - 1;
-		memset( buf, 0, sizeof( buf ) );
-		ret = mbedtls_ssl_read( &connection.ssl, buf, len );
+	u8* request_buffer = malloc(SERVER_REQUEST_BUFFER_SIZE);
+	i32 request_buffer_used = 0;
+	connection.keep_alive = true;
+	while (connection.keep_alive) {
+		i64 request_size = find_end_of_http_headers(request_buffer, request_buffer_used);
+		if (request_size == 0) {
+			// No complete request in the buffer yet, need to read more.
+			if (request_buffer_used >= SERVER_REQUEST_BUFFER_SIZE) {
+				fprintf(stderr, "[thread %ld] Warning: request too large\n", connection.thread_id);
+				break;
+			}
+			// Between requests, the connection can be given up if another client needs the slot.
+			bool is_between_requests = (request_buffer_used == 0);
+			if (is_between_requests && !set_connection_idle(connection.thread_info, true)) {
+				break;
+			}
+			mbedtls_printf( "  [ #%ld ]  < Read from client\n", connection.thread_id );
+			len = SERVER_REQUEST_BUFFER_SIZE - request_buffer_used;
+			ret = mbedtls_ssl_read( &connection.ssl, request_buffer + request_buffer_used, len );
+			if (is_between_requests && !set_connection_idle(connection.thread_info, false)) {
+				mbedtls_printf( "  [ #%ld ]  idle connection closed to make room for a new client\n",
+				                connection.thread_id );
+				break;
+			}
 
-		if( ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE )
-			continue;
+			if( ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE )
+				continue;
 
-		if( ret <= 0 )
-		{
-			switch( ret )
+			if( ret <= 0 )
 			{
-				case MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY:
-					mbedtls_printf( "  [ #%ld ]  connection was closed gracefully\n",
-					                connection.thread_id );
-					goto thread_exit;
-
-				case MBEDTLS_ERR_NET_CONN_RESET:
-					mbedtls_printf( "  [ #%ld ]  connection was reset by peer\n",
-					                connection.thread_id );
-					goto thread_exit;
-
-				default:
-					mbedtls_printf( "  [ #%ld ]  mbedtls_ssl_read returned -0x%04x\n",
-					                connection.thread_id, -ret );
-					goto thread_exit;
+				switch( ret )
+				{
+					case 0:
+					case MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY:
+						mbedtls_printf( "  [ #%ld ]  connection was closed gracefully\n",
+						                connection.thread_id );
+						ret = 0;
+						break;
+
+					case MBEDTLS_ERR_SSL_TIMEOUT:
+						mbedtls_printf( "  [ #%ld ]  connection was idle for too long\n",
+						                connection.thread_id );
+						ret = 0;
+						break;
+
+					case MBEDTLS_ERR_NET_CONN_RESET:
+						mbedtls_printf( "  [ #%ld ]  connection was reset by peer\n",
+						                connection.thread_id );
+						free(request_buffer);
+						goto thread_exit;
+
+					default:
+						mbedtls_printf( "  [ #%ld ]  mbedtls_ssl_read returned -0x%04x\n",
+						                connection.thread_id, -ret );
+						free(request_buffer);
+						goto thread_exit;
+				}
+				break;
 			}
-		}
 
-		len = ret;
-		mbedtls_printf( "  [ #%ld ]  %d bytes read\n=====\n%s\n=====\n",
-		                connection.thread_id, len, (char *) buf );
-
-		if( ret > 0 )
-			break;
-	}
-	while( 1 );
+			mbedtls_printf( "  [ #%ld ]  %d bytes read\n", connection.thread_id, ret );
+			request_buffer_used += ret;
+			continue;
+		}
 
-	// TODO: assemble chunks into request buffer
-	http_request_t* request = parse_http_headers((char *) buf, len);
-	if (!request) {
-		fprintf(stderr, "[thread %d] Warning: bad request\n", connection.thread_id);
-	} else {
-		fprintf(stderr, "[thread %d] Received request: %s\n", connection.thread_id, request->uri);
-		slide_api_call_t* call = interpret_api_request(request);
-		if (call) {
-			if (execute_slide_api_call(&connection, call)) {
-				// success!
+		http_request_t* request = parse_http_headers((char *) request_buffer, request_size);
+		connection.is_response_started = false;
+		bool32 success = false;
+		if (!request) {
+			fprintf(stderr, "[thread %ld] Warning: bad request\n", connection.thread_id);
+			connection.keep_alive = false;
+		} else {
+			fprintf(stderr, "[thread %ld] Received request: %s\n", connection.thread_id, request->uri);
+			connection.keep_alive = request->keep_alive;
+			slide_api_call_t* call = interpret_api_request(request);
+			if (call) {
+				success = execute_slide_api_call(&connection, call);
+				free(call);
 			}
+			free(request);
+		}
+		if (!connection.is_response_started) {
+			// The client is waiting for an answer (and may have more requests queued up behind this one).
+			success = server_send_response_headers(&connection, "404 Not Found", 0);
+		}
+		if (!success) {
+			// If we failed halfway through a response, the client has no way to make sense of the rest.
+			connection.keep_alive = false;
 		}
-	}
 
-	// write
-//	bool send_ok = ssl_send(&connection, buf, len);
-//	if (!send_ok) goto thread_exit;
+		// Move any pipelined requests that came in after this one to the front.
+		request_buffer_used -= (i32)request_size;
+		memmove(request_buffer, request_buffer + request_size, request_buffer_used);
+	}
+	free(request_buffer);
 
 	mbedtls_printf( "  [ #%ld ]  . Closing the connection...", connection.thread_id );
 
@@ -784,6 +861,36 @@ static void *handle_ssl_connection( void *data )
 	return( NULL );
 }
 
+// When all slots are taken, most of them are usually held by persistent connections that are just waiting for the
+// client's next request. Close the one that has been idle the longest (the client will reconnect when it needs to),
+// and return its slot. Returns -1 if no connection is idle.
+static int reclaim_least_recently_used_idle_slot(void) {
+	int lru = -1;
+	pthread_mutex_lock(&idle_connection_mutex);
+	for (int i = 0; i < MAX_NUM_THREADS; ++i) {
+		thread_info_t* info = &threads[i].data;
+		if (threads[i].active && info->is_idle && !info->close_requested) {
+			if (lru < 0 || info->idle_since < threads[lru].data.idle_since) {
+				lru = i;
+			}
+		}
+	}
+	if (lru >= 0) {
+		threads[lru].data.close_requested = 1;
+		// Wake up the blocking read; the socket stays open for the close_notify. The worker can't free the socket
+		// before it has seen close_requested, which requires the mutex we are still holding.
+		shutdown(threads[lru].data.client_fd.fd, 0 /* SHUT_RD / SD_RECEIVE */);
+	}
+	pthread_mutex_unlock(&idle_connection_mutex);
+
+	if (lru >= 0) {
+		mbedtls_printf( "  [ main ]  All slots in use, closing idle connection in slot %d\n", lru );
+		pthread_join(threads[lru].thread, NULL );
+		memset( &threads[lru], 0, sizeof(pthread_info_t) );
+	}
+	return lru;
+}
+
 static int thread_create( mbedtls_net_context *client_fd )
 {
 	int ret, i;
@@ -806,7 +913,11 @@ static int thread_create( mbedtls_net_context *client_fd )
 	}
 
 	if( i == MAX_NUM_THREADS )
-		return( -1 );
+	{
+		i = reclaim_least_recently_used_idle_slot();
+		if( i < 0 )
+			return( -1 );
+	}
 
 	/*
 	 * Fill thread-info for thread
@@ -942,6 +1053,7 @@ int main( void )
 
 	mbedtls_ssl_conf_rng( &conf, mbedtls_ctr_drbg_random, &ctr_drbg );
 	mbedtls_ssl_conf_dbg( &conf, my_mutexed_debug, stdout );
+	mbedtls_ssl_conf_read_timeout( &conf, SERVER_KEEP_ALIVE_TIMEOUT_MS );
 
 	/* mbedtls_ssl_cache_get() and mbedtls_ssl_cache_set() are thread-safe if
 	 * MBEDTLS_THREADING_C is set.
@@ -1140,6 +1140,18 @@ cl_hash(LZWCodecState* sp)
 		hp->hash = -1;
 }
 
+/* Release the state allocated by LZWSetupDecode(). */
+void
+LZWCleanupDecode(PseudoTIFF* tif)
+{
+	if (tif->tif_data == NULL)
+		return;
+	if (DecoderState(tif)->dec_codetab)
+		free(DecoderState(tif)->dec_codetab);
+	free(tif->tif_data);
+	tif->tif_data = NULL;
+}
+
 static void
 LZWCleanup(PseudoTIFF* tif)
 {
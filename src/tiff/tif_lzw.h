@@ -28,6 +28,7 @@ int LZWSetupDecode(PseudoTIFF* tif);
 int LZWPreDecode(PseudoTIFF* tif, uint16 s);
 int LZWDecode(PseudoTIFF* tif, uint8* op0, size_t occ0, uint16 s);
 int LZWDecodeCompat(PseudoTIFF* tif, uint8* op0, size_t occ0, uint16 s);
+void LZWCleanupDecode(PseudoTIFF* tif);
 
 #ifdef __cplusplus
 }
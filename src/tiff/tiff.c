@@ -463,7 +463,7 @@ bool32 tiff_read_ifd(tiff_t* tiff, tiff_ifd_t* ifd, u64* next_ifd_offset) {
 					free(tags);
 					return false; // failed
 				}
-			}
+			} break;
 			case TIFF_TAG_X_RESOLUTION: {
 				tiff_rational_t resolution = tiff_read_field_rational(tiff, tag);
 				ifd->x_resolution = resolution;
@@ -636,6 +636,26 @@ bool32 tiff_read_ifd(tiff_t* tiff, tiff_ifd_t* ifd, u64* next_ifd_offset) {
 }
 
 // Calculate various derived values (better name for this procedure??)
+// Returns the number of rows in each band of a strip, or 0 if the strips are too large to decode at all.
+// Uncompressed and LZW-compressed strips can be decoded in parts; JPEG-compressed strips need to be decoded as a whole.
+static inline u32 tiff_get_rows_per_band(tiff_ifd_t* ifd) {
+	i64 row_size = (i64)ifd->image_width * BYTES_PER_PIXEL;
+	i64 strip_size = row_size * ifd->rows_per_strip;
+	if (strip_size <= TIFF_STRIP_CACHE_MAX_ENTRY_SIZE) {
+		return ifd->rows_per_strip;
+	} else if (ifd->compression == TIFF_COMPRESSION_NONE || ifd->compression == TIFF_COMPRESSION_LZW) {
+		if (row_size > TIFF_STRIP_CACHE_BUDGET) {
+			return 0;
+		}
+		i64 rows_per_band = ATLEAST(1, TIFF_STRIP_CACHE_MAX_ENTRY_SIZE / row_size);
+		return (u32)MIN(rows_per_band, ifd->rows_per_strip);
+	} else if (strip_size <= TIFF_STRIP_CACHE_BUDGET) {
+		return ifd->rows_per_strip;
+	} else {
+		return 0;
+	}
+}
+
 void tiff_post_init(tiff_t* tiff) {
 	// TODO: make more robust
 	// Assume the first IFD is the main image, and also level 0.
@@ -731,16 +751,39 @@ void tiff_post_init(tiff_t* tiff) {
 		}
 	} else {
 		// In this case the main image is a regular image consisting of strips, not tiles.
+		// We present it as a grid of 'virtual' tiles, with the downsampled levels generated on the fly from the
+		// same strips (see tiff_decode_virtual_tile()).
 		tiff->level_image_ifd_count = 1;
-		tiff->max_downsample_level = 0;
+		if (main_image->rows_per_strip == 0 || main_image->rows_per_strip > main_image->image_height) {
+			main_image->rows_per_strip = main_image->image_height; // RowsPerStrip defaults to 2^32-1 (= single strip)
+		}
+		main_image->tile_width = TIFF_VIRTUAL_TILE_SIZE;
+		main_image->tile_height = TIFF_VIRTUAL_TILE_SIZE;
+		main_image->width_in_tiles = (main_image->image_width + TIFF_VIRTUAL_TILE_SIZE - 1) / TIFF_VIRTUAL_TILE_SIZE;
+		main_image->height_in_tiles = (main_image->image_height + TIFF_VIRTUAL_TILE_SIZE - 1) / TIFF_VIRTUAL_TILE_SIZE;
+		// Add levels until the whole image fits within a single tile.
+		i32 max_downsample_level = 0;
+		while (max_downsample_level < TIFF_MAX_VIRTUAL_LEVELS - 1 &&
+		       ((main_image->image_width >> max_downsample_level) > TIFF_VIRTUAL_TILE_SIZE ||
+		        (main_image->image_height >> max_downsample_level) > TIFF_VIRTUAL_TILE_SIZE)) {
+			++max_downsample_level;
+		}
+		tiff->max_downsample_level = max_downsample_level;
 		main_image->downsample_level = 0;
 		main_image->downsample_factor = 1.0f;
 		main_image->um_per_pixel_x = tiff->mpp_x;
 		main_image->um_per_pixel_y = tiff->mpp_y;
-		main_image->tile_width = main_image->image_width;
-		main_image->tile_height = main_image->image_height;
 		main_image->x_tile_side_in_um = main_image->um_per_pixel_x * (float)main_image->tile_width;
 		main_image->y_tile_side_in_um = main_image->um_per_pixel_y * (float)main_image->tile_height;
+#if !IS_SERVER
+		if (!tiff->strip_cache) {
+			tiff->strip_cache = tiff_strip_cache_create();
+		}
+		if (tiff_get_rows_per_band(main_image) == 0) {
+			console_print_error("TIFF: cannot decode the image, the strips are too large (%u rows per strip, compression=%d)\n",
+			                    main_image->rows_per_strip, main_image->compression);
+		}
+#endif
 	}
 
 }
@@ -835,6 +878,7 @@ bool32 open_tiff_file(tiff_t* tiff, const char* filename) {
 			}
 
 #endif
+			file_mapping_open(&tiff->file_mapping, tiff->file_handle, FILE_MAPPING_ADVICE_RANDOM);
 #endif
 		}
 
@@ -908,6 +952,9 @@ memrw_t* tiff_serialize(tiff_t* tiff, memrw_t* buffer) {
 			.chroma_subsampling_horizontal = ifd->chroma_subsampling_horizontal,
 			.chroma_subsampling_vertical = ifd->chroma_subsampling_vertical,
 			.subimage_type = ifd->subimage_type,
+			.strip_count = ifd->strip_count,
+			.rows_per_strip = ifd->rows_per_strip,
+			.samples_per_pixel = ifd->samples_per_pixel,
 		};
 #if INCLUDE_IMAGE_DESCRIPTION
 		uncompressed_size += ifd->image_description_length;
@@ -915,6 +962,8 @@ memrw_t* tiff_serialize(tiff_t* tiff, memrw_t* buffer) {
 		uncompressed_size += ifd->jpeg_tables_length;
 		uncompressed_size += ifd->tile_count * sizeof(ifd->tile_offsets[0]);
 		uncompressed_size += ifd->tile_count * sizeof(ifd->tile_byte_counts[0]);
+		uncompressed_size += ifd->strip_count * sizeof(ifd->strip_offsets[0]);
+		uncompressed_size += ifd->strip_count * sizeof(ifd->strip_byte_counts[0]);
 	}
 	uncompressed_size += tiff->ifd_count * sizeof(tiff_serial_ifd_t);
 
@@ -925,6 +974,9 @@ memrw_t* tiff_serialize(tiff_t* tiff, memrw_t* buffer) {
 	uncompressed_size += tiff->ifd_count * sizeof(serial_block_t);
 	uncompressed_size += tiff->ifd_count * sizeof(serial_block_t);
 	uncompressed_size += tiff->ifd_count * sizeof(serial_block_t);
+	// blocks: strip offsets and strip byte counts (for striped images)
+	uncompressed_size += tiff->ifd_count * sizeof(serial_block_t);
+	uncompressed_size += tiff->ifd_count * sizeof(serial_block_t);
 
 	// block: terminator (end of stream marker)
 	uncompressed_size += sizeof(serial_block_t);
@@ -955,6 +1007,14 @@ memrw_t* tiff_serialize(tiff_t* tiff, memrw_t* buffer) {
 		memrw_push_tiff_block(buffer, SERIAL_BLOCK_TIFF_JPEG_TABLES, i, ifd->jpeg_tables_length);
 		memrw_push_back(buffer, ifd->jpeg_tables, ifd->jpeg_tables_length);
 
+		u64 strip_offsets_size = ifd->strip_count * sizeof(ifd->strip_offsets[0]);
+		memrw_push_tiff_block(buffer, SERIAL_BLOCK_TIFF_STRIP_OFFSETS, i, strip_offsets_size);
+		memrw_push_back(buffer, ifd->strip_offsets, strip_offsets_size);
+
+		u64 strip_byte_counts_size = ifd->strip_count * sizeof(ifd->strip_byte_counts[0]);
+		memrw_push_tiff_block(buffer, SERIAL_BLOCK_TIFF_STRIP_BYTE_COUNTS, i, strip_byte_counts_size);
+		memrw_push_back(buffer, ifd->strip_byte_counts, strip_byte_counts_size);
+
 	}
 
 	memrw_push_tiff_block(buffer, SERIAL_BLOCK_TERMINATOR, 0, 0);
@@ -1003,7 +1063,7 @@ i64 find_end_of_http_headers(u8* str, u64 len) {
 	static const char crlfcrlf[] = "\r\n\r\n";
 	u32 search_key = *(u32*)crlfcrlf;
 	i64 result = 0;
-	for (i64 offset = 0; offset < len - 4; ++offset) {
+	for (i64 offset = 0; offset + 4 <= (i64)len; ++offset) {
 		u8* pos = str + offset;
 		u32 check = *(u32*)pos;
 		if (check == search_key) {
@@ -1120,6 +1180,12 @@ bool32 tiff_deserialize(tiff_t* tiff, u8* buffer, u64 buffer_size) {
 		ifd->tile_count = serial_ifd->tile_count;
 		ifd->tile_offsets = NULL; // set later
 		ifd->tile_byte_counts = NULL; // set later
+		ifd->is_tiled = (ifd->tile_count > 0);
+		ifd->strip_count = serial_ifd->strip_count;
+		ifd->strip_offsets = NULL; // set later
+		ifd->strip_byte_counts = NULL; // set later
+		ifd->rows_per_strip = serial_ifd->rows_per_strip;
+		ifd->samples_per_pixel = serial_ifd->samples_per_pixel;
 		ifd->image_description = NULL; // set later
 		ifd->image_description_length = serial_ifd->image_description_length;
 		ifd->jpeg_tables = NULL; // set later
@@ -1187,6 +1253,24 @@ bool32 tiff_deserialize(tiff_t* tiff, u8* buffer, u64 buffer_size) {
 				referenced_ifd->tile_byte_counts = (u64*) malloc(block->length);
 				memcpy(referenced_ifd->tile_byte_counts, block_content, block->length);
 			} break;
+			case SERIAL_BLOCK_TIFF_STRIP_OFFSETS: {
+				if (referenced_ifd->strip_offsets) {
+					console_print_error("tiff_deserialize(): IFD %u already has strip offsets\n", block->index);
+					goto failed;
+				}
+				if (block->length != referenced_ifd->strip_count * sizeof(u64)) goto failed;
+				referenced_ifd->strip_offsets = (u64*) malloc(block->length);
+				memcpy(referenced_ifd->strip_offsets, block_content, block->length);
+			} break;
+			case SERIAL_BLOCK_TIFF_STRIP_BYTE_COUNTS: {
+				if (referenced_ifd->strip_byte_counts) {
+					console_print_error("tiff_deserialize(): IFD %u already has strip byte counts\n", block->index);
+					goto failed;
+				}
+				if (block->length != referenced_ifd->strip_count * sizeof(u64)) goto failed;
+				referenced_ifd->strip_byte_counts = (u64*) malloc(block->length);
+				memcpy(referenced_ifd->strip_byte_counts, block_content, block->length);
+			} break;
 			case SERIAL_BLOCK_TIFF_JPEG_TABLES: {
 				if (referenced_ifd->jpeg_tables) {
 					console_print_error("tiff_deserialize(): IFD %u already has JPEG tables\n", block->index);
@@ -1232,6 +1316,11 @@ void tiff_destroy(tiff_t* tiff) {
 		tiff->fp = NULL;
 	}
 #if !IS_SERVER
+	file_mapping_close(&tiff->file_mapping);
+	if (tiff->strip_cache) {
+		tiff_strip_cache_destroy(tiff->strip_cache);
+		tiff->strip_cache = NULL;
+	}
 #if WINDOWS
 	if (tiff->file_handle) {
 		CloseHandle(tiff->file_handle);
@@ -1247,6 +1336,8 @@ void tiff_destroy(tiff_t* tiff) {
 		tiff_ifd_t* ifd = tiff->ifds + i;
 		if (ifd->tile_offsets) free(ifd->tile_offsets);
 		if (ifd->tile_byte_counts) free(ifd->tile_byte_counts);
+		if (ifd->strip_offsets) free(ifd->strip_offsets);
+		if (ifd->strip_byte_counts) free(ifd->strip_byte_counts);
 		if (ifd->image_description) free(ifd->image_description);
 		if (ifd->software) free(ifd->software);
 		if (ifd->jpeg_tables) free(ifd->jpeg_tables);
@@ -1304,101 +1395,591 @@ static inline u32 lookup_color_from_lut(u8 index) {
 	return color;
 }
 
-u8* tiff_decode_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* level_ifd, i32 tile_index, i32 level, i32 tile_x, i32 tile_y) {
+// Convert 8-bit samples (grayscale, RGB or RGBA) to BGRA.
+static bool tiff_convert_samples_to_bgra(tiff_ifd_t* ifd, u8* samples, u32* pixels, u64 pixel_count) {
+	u64 source_pos = 0;
+	if (ifd->samples_per_pixel == 4) {
+		for (u64 i = 0; i < pixel_count; ++i) {
+			pixels[i] = MAKE_BGRA(samples[source_pos], samples[source_pos+1], samples[source_pos+2], samples[source_pos+3]);
+			source_pos += 4;
+		}
+	} else if (ifd->samples_per_pixel == 3) {
+
+		// NOTE: Some TIFFs should actually be treated as palettized, but still set PhotometricInterpretation to TIFF_PHOTOMETRIC_RGB.
+		// (as an example, the TIFF masks from the Kaggle challenge do this)
+		// However, in that case they will still probably have set SMaxSampleValue to a low value (the number of colors/categories used).
+		// We can use this fact to guess that we still want to treat the image as palettized / using a color lookup table.
+		// (A value of 0 means that SMaxSampleValue was not set, which is normal for regular RGB images.)
+		bool palettized = ifd->color_space == TIFF_PHOTOMETRIC_PALETTE || (ifd->max_sample_value > 0 && ifd->max_sample_value < 64);
+
+		// TODO: vectorize: https://stackoverflow.com/questions/7194452/fast-vectorized-conversion-from-rgb-to-bgra
+		if (palettized) {
+			for (u64 i = 0; i < pixel_count; ++i) {
+				u8 r = samples[source_pos]; // only the red channel is being used
+				u32 color = lookup_color_from_lut(r);
+				color = BGRA_SET_ALPHA(color, 128); // TODO: make color lookup tables configurable
+				pixels[i] = color;
+				source_pos+=3;
+			}
+		} else {
+			for (u64 i = 0; i < pixel_count; ++i) {
+				u8 r = samples[source_pos];
+				u8 g = samples[source_pos+1];
+				u8 b = samples[source_pos+2];
+				pixels[i] = MAKE_BGRA(r, g, b, 255);
+				source_pos+=3;
+			}
+		}
+	} else if (ifd->samples_per_pixel == 1) {
+		// Grayscale image
+		u8 output_for_min_value = 0;
+		u8 output_for_max_value = 255;
+		if (ifd->color_space == TIFF_PHOTOMETRIC_MINISBLACK) {
+			// no action
+		} else if (ifd->color_space == TIFF_PHOTOMETRIC_MINISWHITE) {
+			output_for_min_value = 255;
+			output_for_max_value = 0;
+		} else {
+			// Issue warning? PhotometricInterpretation missing
+		}
 
-	u16 compression = level_ifd->compression;
-	u8* jpeg_tables = level_ifd->jpeg_tables;
-	u64 jpeg_tables_length = level_ifd->jpeg_tables_length;
+		bool is_bilevel = ifd->max_sample_value == 1 && ifd->min_sample_value == 0;
 
-	u64 tile_offset = 0;
-	u64 compressed_tile_size_in_bytes = 0;
-	u8* compressed_tile_data = NULL;
-	bool failed = false;
+		if (is_bilevel) {
+			for (u64 i = 0; i < pixel_count; ++i) {
+				u8 r = samples[source_pos];
+				r = r ? output_for_max_value : output_for_min_value;
+				u32 color = MAKE_BGRA(r, r, r, 255);
+				pixels[i] = color;
+				source_pos+=1;
+			}
+		} else {
+			if (ifd->max_sample_value == 0 /*assume not set*/ || ifd->max_sample_value == 255) {
+				// output raw value as RGB value
+				for (u64 i = 0; i < pixel_count; ++i) {
+					u8 r = samples[source_pos];
+					u32 color = MAKE_BGRA(r, r, r, 255);
+					pixels[i] = color;
+					source_pos+=1;
+				}
+			} else {
+				// resample
+				float convert_factor = (1.0f / (float)ifd->max_sample_value) * 255.0f;
+				for (u64 i = 0; i < pixel_count; ++i) {
+					u8 r = samples[source_pos];
+					r = (u8)((float)r * convert_factor);
+					u32 color = MAKE_BGRA(r, r, r, 255);
+					pixels[i] = color;
+					source_pos+=1;
+				}
+			}
+		}
+	} else {
+		console_print_error("TIFF: unexpected number of samples per pixel (%d)\n", ifd->samples_per_pixel);
+		return false;
+	}
+	return true;
+}
 
-	if (level_ifd->is_tiled) {
-		tile_offset = level_ifd->tile_offsets[tile_index];
-		compressed_tile_size_in_bytes = level_ifd->tile_byte_counts[tile_index];
-		compressed_tile_data = (u8*)arena_push_size(&local_thread_memory->temp_arena, compressed_tile_size_in_bytes);
+// Decode LZW-compressed data. The first skip_size bytes of the decompressed data are thrown away (this still requires
+// decoding them, but the output buffer only needs to hold the part we are interested in).
+static bool tiff_lzw_decode(u8* compressed, u64 compressed_size, u64 skip_size, u8* decompressed, u64 decompressed_size) {
+	PseudoTIFF tif = {};
+	tif.tif_rawdata = compressed;
+	tif.tif_rawcp = compressed;
+	tif.tif_rawdatasize = compressed_size;
+	tif.tif_rawcc = compressed_size;
+	LZWSetupDecode(&tif);
+	LZWPreDecode(&tif, 0);
+	// Check for old bit-reversed codes.
+	bool is_compat = tif.tif_rawcc >= 2 && tif.tif_rawdata[0] == 0 && (tif.tif_rawdata[1] & 0x1);
+	int decode_success = 1;
+	while (decode_success && skip_size > 0) {
+		u64 chunk_size = MIN(skip_size, decompressed_size);
+		decode_success = is_compat ? LZWDecodeCompat(&tif, decompressed, chunk_size, 0) : LZWDecode(&tif, decompressed, chunk_size, 0);
+		skip_size -= chunk_size;
+	}
+	if (decode_success) {
+		decode_success = is_compat ? LZWDecodeCompat(&tif, decompressed, decompressed_size, 0) : LZWDecode(&tif, decompressed, decompressed_size, 0);
+	}
+	LZWCleanupDecode(&tif);
+	return decode_success != 0;
+}
 
-		// Some tiles apparently contain no data (not even an empty/dummy JPEG stream like some other tiles have).
-		// We need to check for this situation and chicken out if this is the case.
-		if (tile_offset == 0 || compressed_tile_size_in_bytes == 0) {
-#if DO_DEBUG
-			console_print("thread %d: tile level %d, tile %d (%d, %d) appears to be empty\n", logical_thread_index, level, tile_index, tile_x, tile_y);
-#endif
-			return NULL;
-		}
+#if !IS_SERVER
 
-		if (!tiff->is_remote) {
-			file_handle_read_at_offset(compressed_tile_data, tiff->file_handle, tile_offset, compressed_tile_size_in_bytes);
-		} else {
-			console_print_verbose("[thread %d] remote tile requested: level %d, tile %d (%d, %d)\n", logical_thread_index, level, tile_index, tile_x, tile_y);
+tiff_strip_cache_t* tiff_strip_cache_create(void) {
+	tiff_strip_cache_t* cache = (tiff_strip_cache_t*) calloc(1, sizeof(tiff_strip_cache_t));
+	cache->lock = benaphore_create();
+	for (i32 i = 0; i < TIFF_STRIP_CACHE_CAPACITY; ++i) {
+		cache->entries[i].band_index = -1;
+	}
+	return cache;
+}
 
-			i32 bytes_read = 0;
-			u8* read_buffer = download_remote_chunk(tiff->location.hostname, tiff->location.portno, tiff->location.filename,
-			                                        tile_offset, compressed_tile_size_in_bytes, &bytes_read, logical_thread_index);
-			if (read_buffer && bytes_read > 0) {
-				i64 content_offset = find_end_of_http_headers(read_buffer, bytes_read);
-				i64 content_length = bytes_read - content_offset;
-				u8* content = read_buffer + content_offset;
+void tiff_strip_cache_destroy(tiff_strip_cache_t* cache) {
+	for (i32 i = 0; i < TIFF_STRIP_CACHE_CAPACITY; ++i) {
+		tiff_strip_cache_entry_t* entry = cache->entries + i;
+		ASSERT(entry->ref_count == 0);
+		if (entry->pixels) free(entry->pixels);
+	}
+	benaphore_destroy(&cache->lock);
+	free(cache);
+}
 
-				if (content_length >= compressed_tile_size_in_bytes) {
-					memcpy(compressed_tile_data, content, compressed_tile_size_in_bytes);
-				} else {
-					failed = true;
-				}
+static inline i64 tiff_get_decoded_band_size(tiff_ifd_t* ifd, u32 rows_per_band) {
+	// Note: for whole strips, always allocate for the full RowsPerStrip, because the JPEG stream of the last strip may be padded.
+	return (i64)ifd->image_width * rows_per_band * BYTES_PER_PIXEL;
+}
 
-			} else {
-				failed = true;
-			}
-			if (read_buffer) {
-				free(read_buffer);
+// Returns the compressed data for (part of) a strip: either a pointer into the file mapping, or a copy that the caller
+// needs to free.
+static u8* tiff_read_strip_data(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* ifd, u64 strip_index,
+                                u64 range_offset, u64 range_size, bool* need_free) {
+	u64 strip_offset = ifd->strip_offsets[strip_index];
+	u64 strip_size = ifd->strip_byte_counts[strip_index];
+	*need_free = false;
+	if (strip_offset == 0 || strip_size == 0 || range_size == 0 || range_offset + range_size > strip_size) {
+		return NULL;
+	}
+	u64 offset = strip_offset + range_offset;
+	if (!tiff->is_remote) {
+		u8* data = file_mapping_get_range(&tiff->file_mapping, offset, range_size);
+		if (!data) {
+			// Strips can be too large for the thread-local arena, so use the heap here.
+			data = (u8*)malloc(range_size);
+			if (!data) {
+				return NULL;
 			}
-			if (failed) {
-				console_print_error("[thread %d] failed to read from remote level %d, tile %d (%d, %d)\n", logical_thread_index, level, tile_index, tile_x, tile_y);
+			*need_free = true;
+			size_t bytes_read = file_handle_read_at_offset(data, tiff->file_handle, offset, range_size);
+			if (bytes_read != range_size) {
+				free(data);
+				*need_free = false;
 				return NULL;
 			}
 		}
+		return data;
+	} else {
+		u8* data = NULL;
+		i32 bytes_read = 0;
+		u8* read_buffer = download_remote_chunk(tiff->location.hostname, tiff->location.portno, tiff->location.filename,
+		                                        offset, range_size, &bytes_read, logical_thread_index);
+		if (read_buffer && bytes_read > 0) {
+			i64 content_offset = find_end_of_http_headers(read_buffer, bytes_read);
+			i64 content_length = bytes_read - content_offset;
+			if (content_length >= range_size) {
+				data = (u8*)malloc(range_size);
+				if (data) {
+					memcpy(data, read_buffer + content_offset, range_size);
+					*need_free = true;
+				}
+			}
+		}
+		if (read_buffer) {
+			free(read_buffer);
+		}
+		return data;
+	}
+}
 
+// Decode row_count rows of a strip, starting at first_row_in_strip.
+static u32* tiff_decode_strip_band(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* ifd, u64 strip_index,
+                                   u32 first_row_in_strip, u32 row_count, u32 rows_per_band) {
+	u64 strip_size = ifd->strip_byte_counts[strip_index];
+	u64 row_samples_size = (u64)ifd->image_width * ifd->samples_per_pixel;
+	u64 pixel_count = (u64)ifd->image_width * row_count;
+	u64 samples_size = pixel_count * ifd->samples_per_pixel;
+
+	// Uncompressed strips can be read partially; otherwise we need the compressed data for the whole strip.
+	u64 range_offset = 0;
+	u64 range_size = strip_size;
+	if (ifd->compression == TIFF_COMPRESSION_NONE) {
+		range_offset = first_row_in_strip * row_samples_size;
+		range_size = samples_size;
+	}
+	bool need_free = false;
+	u8* compressed = tiff_read_strip_data(logical_thread_index, tiff, ifd, strip_index, range_offset, range_size, &need_free);
+	if (!compressed) {
+		console_print_error("[thread %d] failed to read TIFF strip %llu\n", logical_thread_index, strip_index);
+		return NULL;
+	}
+	u32* pixels = (u32*)malloc(tiff_get_decoded_band_size(ifd, rows_per_band));
+	if (!pixels) {
+		console_print_error("[thread %d] failed to decode TIFF strip %llu: out of memory\n", logical_thread_index, strip_index);
+		if (need_free) {
+			free(compressed);
+		}
+		return NULL;
+	}
+	bool success = false;
+
+	if (ifd->compression == TIFF_COMPRESSION_JPEG) {
+		ASSERT(first_row_in_strip == 0); // see tiff_get_rows_per_band()
+		success = jpeg_decode_tile(ifd->jpeg_tables, ifd->jpeg_tables_length, compressed, range_size,
+		                           (u8*)pixels, (ifd->color_space == TIFF_PHOTOMETRIC_YCBCR));
+	} else if (ifd->compression == TIFF_COMPRESSION_LZW) {
+		u8* samples = (u8*)malloc(samples_size);
+		if (samples) {
+			success = tiff_lzw_decode(compressed, range_size, first_row_in_strip * row_samples_size, samples, samples_size) &&
+			          tiff_convert_samples_to_bgra(ifd, samples, pixels, pixel_count);
+			free(samples);
+		}
+	} else if (ifd->compression == TIFF_COMPRESSION_NONE) {
+		success = tiff_convert_samples_to_bgra(ifd, compressed, pixels, pixel_count);
 	} else {
-		// image is not tiled
-		compressed_tile_size_in_bytes = level_ifd->strip_byte_counts[0];
-		// TODO: handle super large files
-		compressed_tile_data = (u8*)arena_push_size(&local_thread_memory->temp_arena, compressed_tile_size_in_bytes);
-		if (!tiff->is_remote) {
+		console_print_error("[thread %d] failed to decode TIFF strip %llu: unsupported TIFF compression method (compression=%d)\n",
+		                    logical_thread_index, strip_index, ifd->compression);
+	}
 
-			if (level_ifd->strip_count > 0) {
-				ASSERT(level_ifd->strip_offsets);
-				ASSERT(level_ifd->strip_byte_counts);
-				if (level_ifd->strip_count == 1) {
-					file_handle_read_at_offset(compressed_tile_data, tiff->file_handle, level_ifd->strip_offsets[0], compressed_tile_size_in_bytes);
-				} else {
-					/*u8** strip_data = (u8**)alloca(level_ifd->strip_count * sizeof(u8**));
-					for (i32 i = 0; i < level_ifd->strip_count; ++i) {
-						u64 strip_offset = level_ifd->strip_offsets[i];
-						u64 strip_byte_count = level_ifd->strip_byte_counts[i];
-						strip_data[i] = (u8*)calloc(1, strip_byte_count);
-						file_handle_read_at_offset(strip_data[i], tiff->file_handle, strip_offset, strip_byte_count);
+	if (need_free) {
+		free(compressed);
+	}
+	if (!success) {
+		free(pixels);
+		return NULL;
+	}
+	return pixels;
+}
+
+// Find a free slot for a new band, evicting the least recently used bands until the new band fits within the budget.
+// Bands that are still in use are never evicted; if that's all there is, we may go over budget.
+// NOTE: cache->lock needs to be held.
+static tiff_strip_cache_entry_t* tiff_strip_cache_reserve_slot(tiff_strip_cache_t* cache, i64 bytes_needed) {
+	for (;;) {
+		tiff_strip_cache_entry_t* free_slot = NULL;
+		tiff_strip_cache_entry_t* lru_entry = NULL;
+		for (i32 i = 0; i < TIFF_STRIP_CACHE_CAPACITY; ++i) {
+			tiff_strip_cache_entry_t* entry = cache->entries + i;
+			if (entry->band_index < 0) {
+				if (!free_slot) free_slot = entry;
+			} else if (entry->ref_count == 0 && entry->pixels != NULL) {
+				if (!lru_entry || entry->last_used < lru_entry->last_used) lru_entry = entry;
+			}
+		}
+		bool is_over_budget = cache->bytes_resident + bytes_needed > TIFF_STRIP_CACHE_BUDGET;
+		if ((free_slot && !is_over_budget) || !lru_entry) {
+			return free_slot;
+		}
+		free(lru_entry->pixels);
+		lru_entry->pixels = NULL;
+		lru_entry->band_index = -1;
+		cache->bytes_resident -= bytes_needed; // all decoded bands have the same allocation size
+	}
+}
+
+// Get a decoded band from the cache (decoding it if needed), with its reference count incremented.
+// Returns NULL if the band could not be decoded, or if another thread is busy decoding it (*is_busy is set).
+static tiff_strip_cache_entry_t* tiff_strip_cache_acquire(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* ifd,
+                                                          u32 rows_per_band, u64 band_index, bool* is_busy) {
+	tiff_strip_cache_t* cache = tiff->strip_cache;
+	i64 band_size = tiff_get_decoded_band_size(ifd, rows_per_band);
+	*is_busy = false;
+
+	benaphore_lock(&cache->lock);
+	tiff_strip_cache_entry_t* entry = NULL;
+	for (i32 i = 0; i < TIFF_STRIP_CACHE_CAPACITY; ++i) {
+		if (cache->entries[i].band_index == (i64)band_index) {
+			entry = cache->entries + i;
+			break;
+		}
+	}
+	if (entry) {
+		if (entry->pixels == NULL) {
+			*is_busy = true;
+			entry = NULL;
+		} else {
+			++entry->ref_count;
+			entry->last_used = ++cache->use_counter;
+		}
+		benaphore_unlock(&cache->lock);
+		return entry;
+	}
+	// Claim the slot before decoding, so that other threads won't decode the same band in the meantime.
+	entry = tiff_strip_cache_reserve_slot(cache, band_size);
+	if (!entry) {
+		*is_busy = true; // all slots in use; try again later
+		benaphore_unlock(&cache->lock);
+		return NULL;
+	}
+	entry->band_index = (i64)band_index;
+	entry->ref_count = 1;
+	entry->pixels = NULL;
+	cache->bytes_resident += band_size;
+	benaphore_unlock(&cache->lock);
+
+	u32 bands_per_strip = (ifd->rows_per_strip + rows_per_band - 1) / rows_per_band;
+	u64 strip_index = band_index / bands_per_strip;
+	u32 first_row_in_strip = (u32)(band_index % bands_per_strip) * rows_per_band;
+	i64 first_row = (i64)strip_index * ifd->rows_per_strip + first_row_in_strip;
+	u32 row_count = (u32)MIN(MIN(rows_per_band, ifd->rows_per_strip - first_row_in_strip), ifd->image_height - first_row);
+	u32* pixels = tiff_decode_strip_band(logical_thread_index, tiff, ifd, strip_index, first_row_in_strip, row_count, rows_per_band);
+
+	benaphore_lock(&cache->lock);
+	if (pixels) {
+		entry->pixels = pixels;
+		entry->first_row = first_row;
+		entry->row_count = row_count;
+		entry->last_used = ++cache->use_counter;
+	} else {
+		entry->band_index = -1;
+		entry->ref_count = 0;
+		cache->bytes_resident -= band_size;
+		entry = NULL;
+	}
+	benaphore_unlock(&cache->lock);
+	return entry;
+}
+
+static void tiff_strip_cache_release(tiff_strip_cache_t* cache, tiff_strip_cache_entry_t* entry) {
+	benaphore_lock(&cache->lock);
+	ASSERT(entry->ref_count > 0);
+	--entry->ref_count;
+	benaphore_unlock(&cache->lock);
+}
+
+// Assemble a virtual tile from the strips (or bands of rows within large strips) that overlap it.
+// For the downsampled levels, rows and columns are point-sampled: the rows in between are skipped, so at the levels
+// where the step size exceeds the band height, the bands in between never need to be decoded at all.
+static u8* tiff_decode_virtual_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* ifd, i32 level, i32 tile_x, i32 tile_y) {
+	if (!tiff->strip_cache || ifd->strip_count == 0 || !ifd->strip_offsets || !ifd->strip_byte_counts || ifd->rows_per_strip == 0) {
+		return NULL;
+	}
+	u64 expected_strip_count = (ifd->image_height + ifd->rows_per_strip - 1) / ifd->rows_per_strip;
+	if (ifd->strip_count < expected_strip_count) {
+		console_print_error("[thread %d] Cannot decode TIFF: expected %llu strips, but found %llu (planar configuration not supported?)\n",
+		                    logical_thread_index, expected_strip_count, ifd->strip_count);
+		return NULL;
+	}
+	u32 rows_per_band = tiff_get_rows_per_band(ifd);
+	if (rows_per_band == 0) {
+		return NULL; // the strips are too large to decode (already reported in tiff_post_init())
+	}
+	u32 bands_per_strip = (ifd->rows_per_strip + rows_per_band - 1) / rows_per_band;
+	i32 downsample_level = level - ifd->downsample_level;
+	ASSERT(downsample_level >= 0);
+	i64 step = 1LL << downsample_level;
+	i64 tile_size = TIFF_VIRTUAL_TILE_SIZE;
+	i64 x0 = tile_x * tile_size * step;
+	i64 y0 = tile_y * tile_size * step;
+	if (x0 >= ifd->image_width || y0 >= ifd->image_height) {
+		return NULL;
+	}
+	i32 cols_in_tile = (i32)MIN(tile_size, (ifd->image_width - x0 + step - 1) / step);
+	i32 rows_in_tile = (i32)MIN(tile_size, (ifd->image_height - y0 + step - 1) / step);
+
+	// Collect the bands that contain the rows we need.
+	u64 pending_bands[TIFF_VIRTUAL_TILE_SIZE];
+	i32 pending_count = 0;
+	for (i32 row = 0; row < rows_in_tile; ++row) {
+		u64 y = (u64)(y0 + row * step);
+		u64 band_index = (y / ifd->rows_per_strip) * bands_per_strip + (y % ifd->rows_per_strip) / rows_per_band;
+		if (pending_count == 0 || pending_bands[pending_count-1] != band_index) {
+			pending_bands[pending_count++] = band_index;
+		}
+	}
+
+	size_t pixel_memory_size = tile_size * tile_size * BYTES_PER_PIXEL;
+	u32* pixels = (u32*)tile_pixels_alloc(pixel_memory_size);
+	memset(pixels, 0, pixel_memory_size); // transparent beyond the image edges
+	i32 bands_decoded = 0;
+
+	// The worker threads loading neighbouring tiles need mostly the same bands. A band that is being decoded by another
+	// thread is skipped for now, so that the threads end up decoding different bands in parallel.
+	while (pending_count > 0) {
+		bool made_progress = false;
+		for (i32 i = 0; i < pending_count; ++i) {
+			u64 band_index = pending_bands[i];
+			bool is_busy = false;
+			tiff_strip_cache_entry_t* entry = tiff_strip_cache_acquire(logical_thread_index, tiff, ifd, rows_per_band, band_index, &is_busy);
+			if (is_busy) {
+				continue;
+			}
+			if (entry) {
+				i64 band_first_row = entry->first_row;
+				i64 band_end_row = band_first_row + entry->row_count;
+				i32 row_begin = band_first_row <= y0 ? 0 : (i32)((band_first_row - y0 + step - 1) / step);
+				i32 row_end = (i32)MIN(rows_in_tile, (band_end_row - 1 - y0) / step + 1);
+				for (i32 row = row_begin; row < row_end; ++row) {
+					u32* source = entry->pixels + (y0 + row * step - band_first_row) * ifd->image_width + x0;
+					u32* dest = pixels + row * tile_size;
+					if (step == 1) {
+						memcpy(dest, source, cols_in_tile * BYTES_PER_PIXEL);
+					} else {
+						for (i32 col = 0; col < cols_in_tile; ++col) {
+							dest[col] = source[col * step];
+						}
 					}
-					// TODO: stub
-
-					for (i32 i = 0; i < level_ifd->strip_count; ++i) {
-						free(strip_data[i]);
-					}*/
-					failed = true;
-					console_print_error("[thread %d] Cannot decode TIFF: multi-strip TIFFs not implemented.\n");
-					return NULL; // TODO: release compressed tile data
 				}
+				tiff_strip_cache_release(tiff->strip_cache, entry);
+				++bands_decoded;
+			}
+			pending_bands[i--] = pending_bands[--pending_count];
+			made_progress = true;
+		}
+		if (!made_progress) {
+			platform_sleep(1); // all remaining bands are still being decoded by other threads
+		}
+	}
+
+	if (bands_decoded == 0) {
+		tile_pixels_free(pixels);
+		return NULL;
+	}
+	return (u8*)pixels;
+}
 
+#endif //!IS_SERVER
+
+// For a pyramid level that is missing from the file, find the nearest finer level it can be synthesized from.
+// JPEG DCT scaling goes down to 1/8, so the source can be at most 3 levels finer.
+// Returns an index into tiff->level_images_ifd, or -1 if the level can't be synthesized.
+i32 tiff_get_virtual_level_source(tiff_t* tiff, i32 level) {
+	if (tiff->is_remote) return -1; // remote tiles are decoded elsewhere (see viewer_io_remote.cpp)
+	for (i32 scale_shift = 1; scale_shift <= 3 && scale_shift <= level; ++scale_shift) {
+		for (i32 i = 0; i < tiff->level_image_ifd_count; ++i) {
+			tiff_ifd_t* ifd = tiff->level_images_ifd + i;
+			if (ifd->downsample_level != level - scale_shift) continue;
+			u32 divisor_mask = (1u << scale_shift) - 1;
+			if (ifd->is_tiled && ifd->compression == TIFF_COMPRESSION_JPEG &&
+			    (ifd->tile_width & divisor_mask) == 0 && (ifd->tile_height & divisor_mask) == 0) {
+				return i;
+			}
+			return -1; // the nearest finer level is not suitable; don't go looking further
+		}
+	}
+	return -1;
+}
+
+// Returns the compressed data for a tile: either straight from the file mapping, or copied into the thread's temporary
+// arena. Returns NULL if the tile is empty or could not be read.
+static u8* tiff_read_tile_data(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* ifd, i32 tile_index, u64* compressed_size) {
+	u64 tile_offset = ifd->tile_offsets[tile_index];
+	u64 compressed_tile_size_in_bytes = ifd->tile_byte_counts[tile_index];
+	*compressed_size = compressed_tile_size_in_bytes;
+
+	// Some tiles apparently contain no data (not even an empty/dummy JPEG stream like some other tiles have).
+	// We need to check for this situation and chicken out if this is the case.
+	if (tile_offset == 0 || compressed_tile_size_in_bytes == 0) {
+		return NULL;
+	}
+
+	u8* compressed_tile_data = NULL;
+	if (!tiff->is_remote) {
+		// The decoders only read the compressed data, so if the file is mapped we don't need our own copy.
+		compressed_tile_data = file_mapping_get_range(&tiff->file_mapping, tile_offset, compressed_tile_size_in_bytes);
+		if (!compressed_tile_data) {
+			compressed_tile_data = (u8*)arena_push_size(&local_thread_memory->temp_arena, compressed_tile_size_in_bytes);
+			file_handle_read_at_offset(compressed_tile_data, tiff->file_handle, tile_offset, compressed_tile_size_in_bytes);
+		}
+	} else {
+		compressed_tile_data = (u8*)arena_push_size(&local_thread_memory->temp_arena, compressed_tile_size_in_bytes);
+		bool failed = false;
+		i32 bytes_read = 0;
+		u8* read_buffer = download_remote_chunk(tiff->location.hostname, tiff->location.portno, tiff->location.filename,
+		                                        tile_offset, compressed_tile_size_in_bytes, &bytes_read, logical_thread_index);
+		if (read_buffer && bytes_read > 0) {
+			i64 content_offset = find_end_of_http_headers(read_buffer, bytes_read);
+			i64 content_length = bytes_read - content_offset;
+			u8* content = read_buffer + content_offset;
+
+			if (content_length >= compressed_tile_size_in_bytes) {
+				memcpy(compressed_tile_data, content, compressed_tile_size_in_bytes);
 			} else {
-				failed = true; // no tiles and no strips?
-				return NULL; // TODO: release compressed tile data
+				failed = true;
 			}
 
 		} else {
-			// TODO: stub
 			failed = true;
-			return NULL; // TODO: release compressed tile data
+		}
+		if (read_buffer) {
+			free(read_buffer);
+		}
+		if (failed) {
+			return NULL;
+		}
+	}
+	return compressed_tile_data;
+}
+
+// Synthesize a tile for a pyramid level that is missing from the file. The tile covers (2^scale_shift)^2 tiles of the
+// finer level stored in source_ifd; each of those is decoded at reduced resolution using DCT scaling, which costs only a
+// fraction of a full decode.
+static u8* tiff_decode_downscaled_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* source_ifd, i32 scale_shift, i32 tile_x, i32 tile_y) {
+	ASSERT(source_ifd->compression == TIFF_COMPRESSION_JPEG);
+	u32 tile_width = source_ifd->tile_width;
+	u32 tile_height = source_ifd->tile_height;
+	u32 part_width = tile_width >> scale_shift;
+	u32 part_height = tile_height >> scale_shift;
+	u32 pitch = tile_width * BYTES_PER_PIXEL;
+	u8* pixels = tile_pixels_alloc(tile_height * pitch);
+	memset(pixels, 0xFF, tile_height * pitch);
+	bool is_ycbcr = (source_ifd->color_space == TIFF_PHOTOMETRIC_YCBCR);
+
+	i32 parts_per_side = 1 << scale_shift;
+	i32 parts_decoded = 0;
+	for (i32 part_y = 0; part_y < parts_per_side; ++part_y) {
+		i32 source_tile_y = (tile_y << scale_shift) + part_y;
+		if (source_tile_y >= (i32)source_ifd->height_in_tiles) break;
+		for (i32 part_x = 0; part_x < parts_per_side; ++part_x) {
+			i32 source_tile_x = (tile_x << scale_shift) + part_x;
+			if (source_tile_x >= (i32)source_ifd->width_in_tiles) break;
+			i32 source_tile_index = source_tile_y * source_ifd->width_in_tiles + source_tile_x;
+
+			temp_memory_t temp_memory = begin_temp_memory_on_local_thread();
+			u64 compressed_size = 0;
+			u8* compressed = tiff_read_tile_data(logical_thread_index, tiff, source_ifd, source_tile_index, &compressed_size);
+			if (compressed && !(compressed[0] == 0xFF && compressed[1] == 0xD9)) {
+				u8* dest = pixels + (part_y * part_height) * pitch + (part_x * part_width) * BYTES_PER_PIXEL;
+				if (jpeg_decode_tile_downscaled(source_ifd->jpeg_tables, source_ifd->jpeg_tables_length, compressed, compressed_size,
+				                                dest, pitch, part_width, part_height, is_ycbcr, scale_shift)) {
+					++parts_decoded;
+				} else {
+					console_print_error("thread %d: failed to decode tile %d (%d, %d) at 1/%d scale\n", logical_thread_index,
+					                    source_tile_index, source_tile_x, source_tile_y, parts_per_side);
+				}
+			}
+			release_temp_memory(&temp_memory);
+		}
+	}
+	if (parts_decoded == 0) {
+		tile_pixels_free(pixels);
+		return NULL;
+	}
+	return pixels;
+}
+
+u8* tiff_decode_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* level_ifd, i32 tile_index, i32 level, i32 tile_x, i32 tile_y) {
+
+	u16 compression = level_ifd->compression;
+	u8* jpeg_tables = level_ifd->jpeg_tables;
+	u64 jpeg_tables_length = level_ifd->jpeg_tables_length;
+
+	u64 compressed_tile_size_in_bytes = 0;
+	u8* compressed_tile_data = NULL;
+	bool failed = false;
+
+	if (!level_ifd->is_tiled) {
+		// Striped image: assemble the tile from the strips (the tile grid and the downsampled levels are virtual)
+		return tiff_decode_virtual_tile(logical_thread_index, tiff, level_ifd, level, tile_x, tile_y);
+	} else if (level > level_ifd->downsample_level) {
+		// This level is missing from the pyramid, and is synthesized from a finer level (see tiff_get_virtual_level_source())
+		return tiff_decode_downscaled_tile(logical_thread_index, tiff, level_ifd, level - level_ifd->downsample_level, tile_x, tile_y);
+	} else {
+		if (tiff->is_remote) {
+			console_print_verbose("[thread %d] remote tile requested: level %d, tile %d (%d, %d)\n", logical_thread_index, level, tile_index, tile_x, tile_y);
+		}
+		compressed_tile_data = tiff_read_tile_data(logical_thread_index, tiff, level_ifd, tile_index, &compressed_tile_size_in_bytes);
+		if (!compressed_tile_data) {
+			if (tiff->is_remote && compressed_tile_size_in_bytes > 0) {
+				console_print_error("[thread %d] failed to read from remote level %d, tile %d (%d, %d)\n", logical_thread_index, level, tile_index, tile_x, tile_y);
+			}
+#if DO_DEBUG
+			else {
+				console_print("thread %d: tile level %d, tile %d (%d, %d) appears to be empty\n", logical_thread_index, level, tile_index, tile_x, tile_y);
+			}
+#endif
+			return NULL;
 		}
 	}
 	ASSERT(compressed_tile_data != NULL);
@@ -1415,7 +1996,7 @@ u8* tiff_decode_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* level_i
 			if (compressed_tile_data[0] == 0xFF && compressed_tile_data[1] == 0xD9) {
 				// JPEG stream is empty
 			} else {
-				u8* pixel_memory = (u8*)malloc(pixel_memory_size);
+				u8* pixel_memory = tile_pixels_alloc(pixel_memory_size);
 				if (jpeg_decode_tile(jpeg_tables, jpeg_tables_length, compressed_tile_data,
 				                     compressed_tile_size_in_bytes,
 				                     pixel_memory, (level_ifd->color_space == TIFF_PHOTOMETRIC_YCBCR))) {
@@ -1423,153 +2004,41 @@ u8* tiff_decode_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* level_i
 					return pixel_memory;
 				} else {
 					console_print_error("thread %d: failed to decode level %d, tile %d (%d, %d)\n", logical_thread_index, level, tile_index, tile_x, tile_y);
-					free(pixel_memory);
+					tile_pixels_free(pixel_memory);
 					return NULL;
 				}
 			}
 		} else if (level_ifd->compression == TIFF_COMPRESSION_LZW) {
 
-			size_t decompressed_size = level_ifd->tile_width * level_ifd->tile_height * level_ifd->samples_per_pixel;
+			u64 pixel_count = level_ifd->tile_width * level_ifd->tile_height;
+			size_t decompressed_size = pixel_count * level_ifd->samples_per_pixel;
 			u8* decompressed = (u8*)malloc(decompressed_size);
-
-			PseudoTIFF tif = {};
-			tif.tif_rawdata = compressed_tile_data;
-			tif.tif_rawcp = compressed_tile_data;
-			tif.tif_rawdatasize = compressed_tile_size_in_bytes;
-			tif.tif_rawcc = compressed_tile_size_in_bytes;
-			LZWSetupDecode(&tif);
-			LZWPreDecode(&tif, 0);
-			// Check for old bit-reversed codes.
-			int decode_success = 0;
-			if (tif.tif_rawcc >= 2 && tif.tif_rawdata[0] == 0 && (tif.tif_rawdata[1] & 0x1)) {
-				decode_success = LZWDecodeCompat(&tif, decompressed, decompressed_size, 0);
-			} else {
-				decode_success = LZWDecode(&tif, decompressed, decompressed_size, 0);
-			}
-			if (!decode_success) {
+			if (!tiff_lzw_decode(compressed_tile_data, compressed_tile_size_in_bytes, 0, decompressed, decompressed_size)) {
 				console_print_error("LZW decompression failed\n");
 				free(decompressed);
 				return NULL;
 			}
-
-			// Convert RGB to BGRA
-			if (level_ifd->samples_per_pixel == 4) {
-				// TODO: convert RGBA to BGRA
-				console_print_error("LZW decompression: RGBA to BGRA conversion not implemented, assuming already in BGRA\n");
-				ASSERT(decompressed_size == pixel_memory_size);
-				return decompressed;
-			} else if (level_ifd->samples_per_pixel == 3) {
-
-				// NOTE: Some TIFFs should actually be treated as palettized, but still set PhotometricInterpretation to TIFF_PHOTOMETRIC_RGB.
-				// (as an example, the TIFF masks from the Kaggle challenge do this)
-				// However, in that case they will still probably have set SMaxSampleValue to a low value (the number of colors/categories used).
-				// We can use this fact to guess that we still want to treat the image as palettized / using a color lookup table.
-				bool palettized = level_ifd->color_space == TIFF_PHOTOMETRIC_PALETTE || level_ifd->max_sample_value < 64;
-
-				u64 pixel_count = level_ifd->tile_width * level_ifd->tile_height;
-				i32 source_pos = 0;
-				u32* pixels = (u32*)malloc(pixel_memory_size);
-
-				// TODO: vectorize: https://stackoverflow.com/questions/7194452/fast-vectorized-conversion-from-rgb-to-bgra
-				if (palettized) {
-					for (u64 i = 0; i < pixel_count; ++i) {
-						u8 r = decompressed[source_pos]; // only the red channel is being used
-//						    u8 g = decompressed[source_pos+1];
-//					    	u8 b = decompressed[source_pos+2];
-//					    	pixels[i]=(r<<16) | (g<<8) | b | (0xff << 24);
-						u32 color = lookup_color_from_lut(r);
-						color = BGRA_SET_ALPHA(color, 128); // TODO: make color lookup tables configurable
-						pixels[i] = color;
-						source_pos+=3;
-					}
-				} else {
-					for (u64 i = 0; i < pixel_count; ++i) {
-						u8 r = decompressed[source_pos]; // only the red channel is being used
-						u8 g = decompressed[source_pos+1];
-						u8 b = decompressed[source_pos+2];
-						pixels[i] = MAKE_BGRA(r, g, b, 255);
-						source_pos+=3;
-					}
-				}
-
-				free(decompressed);
-			} else if (level_ifd->samples_per_pixel == 1) {
-				// Grayscale image
-				u64 pixel_count = level_ifd->tile_width * level_ifd->tile_height;
-				i32 source_pos = 0;
-				u32* pixels = (u32*)malloc(pixel_memory_size);
-
-				u8 output_for_min_value = 0;
-				u8 output_for_max_value = 255;
-				if (level_ifd->color_space == TIFF_PHOTOMETRIC_MINISBLACK) {
-					// no action
-				} else if (level_ifd->color_space == TIFF_PHOTOMETRIC_MINISWHITE) {
-					output_for_min_value = 255;
-					output_for_max_value = 0;
-				} else {
-					// Issue warning? PhotometricInterpretation missing
-				}
-
-				bool is_bilevel = level_ifd->max_sample_value == 1 && level_ifd->min_sample_value == 0;
-
-				if (is_bilevel) {
-					for (u64 i = 0; i < pixel_count; ++i) {
-						u8 r = decompressed[source_pos];
-						r = r ? output_for_max_value : output_for_min_value;
-						u32 color = MAKE_BGRA(r, r, r, 255);
-						pixels[i] = color;
-						source_pos+=1;
-					}
-				} else {
-					if (level_ifd->max_sample_value == 0 /*assume not set*/ || level_ifd->max_sample_value == 255) {
-						// output raw value as RGB value
-						for (u64 i = 0; i < pixel_count; ++i) {
-							u8 r = decompressed[source_pos];
-							u32 color = MAKE_BGRA(r, r, r, 255);
-							pixels[i] = color;
-							source_pos+=1;
-						}
-					} else {
-						// resample
-						float convert_factor = (1.0f / (float)level_ifd->max_sample_value) * 255.0f;
-						for (u64 i = 0; i < pixel_count; ++i) {
-							u8 r = decompressed[source_pos];
-							r = (u8)((float)r * convert_factor);
-							u32 color = MAKE_BGRA(r, r, r, 255);
-							pixels[i] = color;
-							source_pos+=1;
-						}
-					}
-
-				}
-
-				free(decompressed);
-				return (u8*)pixels;
-			} else {
-				console_print_error("LZW decompression: unexpected number of samples per pixel (%d)\n", level_ifd->samples_per_pixel);
-				failed = true;
+			u32* pixels = (u32*)tile_pixels_alloc(pixel_memory_size);
+			bool converted = tiff_convert_samples_to_bgra(level_ifd, decompressed, pixels, pixel_count);
+			free(decompressed);
+			if (!converted) {
+				tile_pixels_free(pixels);
 				return NULL;
 			}
+			return (u8*)pixels;
 
 		} else if (level_ifd->compression == TIFF_COMPRESSION_NONE) {
-			u8* decompressed = (u8*)compressed_tile_data;
 			u64 pixel_count = level_ifd->tile_width * level_ifd->tile_height;
-			i32 source_pos = 0;
-			if (level_ifd->samples_per_pixel == 3) {
-				u32* pixels = (u32*)malloc(pixel_memory_size);
-				for (u64 i = 0; i < pixel_count; ++i) {
-					u8 r = decompressed[source_pos]; // only the red channel is being used
-					u8 g = decompressed[source_pos+1];
-					u8 b = decompressed[source_pos+2];
-					pixels[i] = MAKE_BGRA(r, g, b, 255);
-					source_pos+=3;
-				}
-				return (u8*)pixels;
-			} else {
-				// TODO
-				failed = true;
+			if (compressed_tile_size_in_bytes < pixel_count * level_ifd->samples_per_pixel) {
+				console_print_error("thread %d: failed to decode level %d, tile %d (%d, %d): not enough data\n", logical_thread_index, level, tile_index, tile_x, tile_y);
 				return NULL;
 			}
+			u32* pixels = (u32*)tile_pixels_alloc(pixel_memory_size);
+			if (!tiff_convert_samples_to_bgra(level_ifd, compressed_tile_data, pixels, pixel_count)) {
+				tile_pixels_free(pixels);
+				return NULL;
+			}
+			return (u8*)pixels;
 		} else {
 			console_print_error("\"thread %d: failed to decode level %d, tile %d (%d, %d): unsupported TIFF compression method (compression=%d)\n", logical_thread_index, level, tile_index, tile_x, tile_y, compression);
 			failed = true;
@@ -1600,3 +2069,116 @@ u8* tiff_decode_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* level_i
 		}
 	}*/
 }
+
+#if !IS_SERVER
+// Benchmark JPEG tile decoding on a sample of the tiles in the currently loaded TIFF file, with and without reusing
+// the per-thread JPEG decompressor. Can be run from the console using the 'bench_jpeg' command.
+void tiff_benchmark_jpeg_decode(tiff_t* tiff, i32 max_tiles, i32 iterations) {
+	if (max_tiles <= 0) max_tiles = 1024;
+	if (iterations <= 0) iterations = 3;
+	if (tiff->is_remote) {
+		console_print_error("JPEG benchmark: not supported for remote images\n");
+		return;
+	}
+	tiff_ifd_t* ifd = NULL;
+	for (i32 i = 0; i < tiff->level_image_ifd_count; ++i) {
+		tiff_ifd_t* level_ifd = tiff->level_images_ifd + i;
+		if (level_ifd->is_tiled && level_ifd->compression == TIFF_COMPRESSION_JPEG && level_ifd->tile_count > 0) {
+			ifd = level_ifd;
+			break;
+		}
+	}
+	if (!ifd) {
+		console_print_error("JPEG benchmark: no JPEG-compressed tiled level found\n");
+		return;
+	}
+
+	// Sample non-empty tiles evenly across the level.
+	i32 sample_stride = MAX(1, (i32)(ifd->tile_count / max_tiles));
+	u64* sample_offsets = (u64*)malloc(max_tiles * sizeof(u64));
+	u64* sample_sizes = (u64*)malloc(max_tiles * sizeof(u64));
+	i32 sample_count = 0;
+	u64 total_compressed_size = 0;
+	for (u64 i = 0; i < ifd->tile_count && sample_count < max_tiles; i += sample_stride) {
+		u64 size = ifd->tile_byte_counts[i];
+		if (ifd->tile_offsets[i] == 0 || size < 4) continue;
+		sample_offsets[sample_count] = total_compressed_size;
+		sample_sizes[sample_count] = size;
+		++sample_count;
+		total_compressed_size += size;
+	}
+	u8* compressed = (u8*)malloc(MAX(1, total_compressed_size));
+	for (u64 i = 0, sample = 0; i < ifd->tile_count && sample < sample_count; i += sample_stride) {
+		if (ifd->tile_offsets[i] == 0 || ifd->tile_byte_counts[i] < 4) continue;
+		file_handle_read_at_offset(compressed + sample_offsets[sample], tiff->file_handle, ifd->tile_offsets[i], sample_sizes[sample]);
+		++sample;
+	}
+	// Empty tiles (just an EOI marker) are skipped by the tile loader, so leave them out here too.
+	i32 valid_count = 0;
+	for (i32 i = 0; i < sample_count; ++i) {
+		u8* data = compressed + sample_offsets[i];
+		if (!(data[0] == 0xFF && data[1] == 0xD9)) {
+			sample_offsets[valid_count] = sample_offsets[i];
+			sample_sizes[valid_count] = sample_sizes[i];
+			++valid_count;
+		}
+	}
+	sample_count = valid_count;
+	if (sample_count == 0) {
+		console_print_error("JPEG benchmark: no non-empty tiles found\n");
+		free(compressed);
+		free(sample_offsets);
+		free(sample_sizes);
+		return;
+	}
+
+	size_t pixel_memory_size = ifd->tile_width * ifd->tile_height * BYTES_PER_PIXEL;
+	u8* reference = (u8*)malloc(pixel_memory_size);
+	u8* output = (u8*)malloc(pixel_memory_size);
+	bool is_ycbcr = (ifd->color_space == TIFF_PHOTOMETRIC_YCBCR);
+
+	bool old_reuse_enabled = jpeg_decoder_reuse_enabled;
+	i32 mismatch_count = 0;
+	for (i32 i = 0; i < sample_count; ++i) {
+		u8* data = compressed + sample_offsets[i];
+		jpeg_decoder_reuse_enabled = false;
+		jpeg_decode_tile(ifd->jpeg_tables, ifd->jpeg_tables_length, data, sample_sizes[i], reference, is_ycbcr);
+		jpeg_decoder_reuse_enabled = true;
+		jpeg_decode_tile(ifd->jpeg_tables, ifd->jpeg_tables_length, data, sample_sizes[i], output, is_ycbcr);
+		if (memcmp(reference, output, pixel_memory_size) != 0) {
+			++mismatch_count;
+		}
+	}
+
+	console_print("JPEG benchmark: %d tiles (%dx%d), %.2f MB compressed, %d iterations (single thread)\n",
+	              sample_count, ifd->tile_width, ifd->tile_height, (float)total_compressed_size / MEGABYTES(1), iterations);
+	float baseline_tiles_per_s = 0.0f;
+	for (i32 pass = 0; pass < 2; ++pass) {
+		jpeg_decoder_reuse_enabled = (pass == 1);
+		i64 clock_start = get_clock();
+		for (i32 iteration = 0; iteration < iterations; ++iteration) {
+			for (i32 i = 0; i < sample_count; ++i) {
+				jpeg_decode_tile(ifd->jpeg_tables, ifd->jpeg_tables_length, compressed + sample_offsets[i], sample_sizes[i],
+				                 output, is_ycbcr);
+			}
+		}
+		float seconds = get_seconds_elapsed(clock_start, get_clock());
+		float tiles_per_s = (float)(sample_count * iterations) / seconds;
+		if (pass == 0) baseline_tiles_per_s = tiles_per_s;
+		console_print("    %-10s %8.1f tiles/s per core  %8.1f us/tile  (%5.2fx)\n", pass == 0 ? "baseline" : "reused",
+		              tiles_per_s, seconds * 1e6f / (float)(sample_count * iterations), tiles_per_s / baseline_tiles_per_s);
+	}
+	if (mismatch_count > 0) {
+		console_print_error("Error: %d tiles decoded differently with the reused decompressor\n", mismatch_count);
+	} else {
+		console_print("    output of the reused decompressor is bit-exact\n");
+	}
+	jpeg_decoder_reuse_enabled = old_reuse_enabled;
+
+	free(reference);
+	free(output);
+	free(compressed);
+	free(sample_offsets);
+	free(sample_sizes);
+}
+#endif //!IS_SERVER
@@ -226,6 +226,31 @@ enum subimage_type_enum {
 
 typedef struct tiff_t tiff_t;
 
+// Striped (non-tiled) images are presented to the viewer as a pyramid of 'virtual' tiles.
+#define TIFF_VIRTUAL_TILE_SIZE 512
+#define TIFF_MAX_VIRTUAL_LEVELS 16
+#define TIFF_STRIP_CACHE_CAPACITY 1024
+#define TIFF_STRIP_CACHE_BUDGET MEGABYTES(256)
+// Strips that would take up a large part of the budget are decoded and cached in bands of rows instead (if possible).
+#define TIFF_STRIP_CACHE_MAX_ENTRY_SIZE (TIFF_STRIP_CACHE_BUDGET / 8)
+
+typedef struct tiff_strip_cache_entry_t {
+	i64 band_index; // -1 if the slot is unused (same as the strip index, unless the strips are split into bands)
+	u32* pixels; // decoded BGRA, image_width * row_count (NULL while the band is still being decoded)
+	i64 first_row;
+	u32 row_count;
+	i32 ref_count;
+	i64 last_used;
+} tiff_strip_cache_entry_t;
+
+// Decoded strips (or bands of rows within large strips) are shared between the virtual tiles that overlap them.
+typedef struct tiff_strip_cache_t {
+	benaphore_t lock;
+	tiff_strip_cache_entry_t entries[TIFF_STRIP_CACHE_CAPACITY];
+	i64 bytes_resident;
+	i64 use_counter;
+} tiff_strip_cache_t;
+
 
 typedef struct tiff_ifd_t {
 	u64 ifd_index;
@@ -287,6 +312,7 @@ struct tiff_t {
 	file_stream_t fp;
 #if !IS_SERVER
 	file_handle_t file_handle;
+	file_mapping_t file_mapping; // if valid, compressed tiles are decoded straight from the mapping
 #endif
 	i64 filesize;
 	u32 bytesize_of_offsets;
@@ -308,6 +334,9 @@ struct tiff_t {
 	float mpp_x;
 	float mpp_y;
 	i32 max_downsample_level;
+#if !IS_SERVER
+	tiff_strip_cache_t* strip_cache; // only for striped images
+#endif
 };
 
 #pragma pack(push, 1)
@@ -351,6 +380,9 @@ typedef struct {
 	u16 chroma_subsampling_vertical;
 	u32 subimage_type;
 //	tiff_tile_t* tiles;
+	u64 strip_count;
+	u32 rows_per_strip;
+	u16 samples_per_pixel;
 } tiff_serial_ifd_t;
 
 enum serial_block_type_enum {
@@ -361,6 +393,8 @@ enum serial_block_type_enum {
 	SERIAL_BLOCK_TIFF_TILE_OFFSETS = 9004,
 	SERIAL_BLOCK_TIFF_TILE_BYTE_COUNTS = 9005,
 	SERIAL_BLOCK_TIFF_JPEG_TABLES = 9006,
+	SERIAL_BLOCK_TIFF_STRIP_OFFSETS = 9007,
+	SERIAL_BLOCK_TIFF_STRIP_BYTE_COUNTS = 9008,
 	SERIAL_BLOCK_TERMINATOR = 800,
 };
 
@@ -378,7 +412,13 @@ memrw_t* tiff_serialize(tiff_t* tiff, memrw_t* buffer);
 i64 find_end_of_http_headers(u8* str, u64 len);
 bool32 tiff_deserialize(tiff_t* tiff, u8* buffer, u64 buffer_size);
 void tiff_destroy(tiff_t* tiff);
+i32 tiff_get_virtual_level_source(tiff_t* tiff, i32 level);
 u8* tiff_decode_tile(i32 logical_thread_index, tiff_t* tiff, tiff_ifd_t* level_ifd, i32 tile_index, i32 level, i32 tile_x, i32 tile_y);
+#if !IS_SERVER
+tiff_strip_cache_t* tiff_strip_cache_create(void);
+void tiff_strip_cache_destroy(tiff_strip_cache_t* cache);
+void tiff_benchmark_jpeg_decode(tiff_t* tiff, i32 max_tiles, i32 iterations);
+#endif
 double tiff_rational_to_float(tiff_rational_t rational);
 tiff_rational_t float_to_tiff_rational(double x);
 
@@ -19,6 +19,7 @@
 #include "common.h"
 #include "mathutils.h"
 #include "stringutils.h"
+#include "intrinsics.h"
 
 #include "tiff.h"
 #include "viewer.h"
@@ -124,478 +125,662 @@ static u64 add_large_bigtiff_tag(memrw_t* tag_buffer, memrw_t* data_buffer, memr
 	}
 }
 
+// A decoded tile from the source image, needed for constructing one or more of the level 0 tiles.
+typedef struct export_source_tile_t {
+	u8* pixels; // NULL if the tile is empty or could not be decoded
+	volatile bool32 is_ready;
+	bool is_requested;
+	i32 export_tiles_waiting; // the pixels are released as soon as all the exported tiles that overlap it are written
+} export_source_tile_t;
+
+// Only the highest resolution level is constructed from the source image; the lower levels are generated from that.
+typedef struct export_source_t {
+	bounds2i pixel_bounds; // the exported region, in pixel coordinates of the source image
+	i32 tile_width;
+	i32 tile_height;
+	bounds2i tile_bounds;
+	u32 width_in_tiles;
+	u32 height_in_tiles;
+	u32 tile_count;
+	export_source_tile_t* tiles;
+} export_source_t;
+
+typedef struct export_tile_t {
+	u8* pixels; // uncompressed, kept until the next level down has been generated from it
+	u8* jpeg_buffer;
+	u32 jpeg_size;
+	volatile bool32 is_done;
+} export_tile_t;
+
 typedef struct export_level_task_data_t {
-	bool is_represented;
 	u64 offset_of_tile_offsets;
 	u64 offset_of_tile_bytecounts;
 	bool are_tile_offsets_inlined_in_tag;
-	bounds2i pixel_bounds;
+	i32 width_in_pixels;
+	i32 height_in_pixels;
 	u32 export_width_in_tiles;
 	u32 export_height_in_tiles;
 	u32 export_tile_count;
-	bounds2i source_tile_bounds;
-	u32 source_bounds_width_in_tiles;
-	u32 source_bounds_height_in_tiles;
-	u32 source_tile_count;
-	tile_t** source_tiles;
+	export_tile_t* tiles;
+	u64* tile_offsets;
+	u64* tile_bytecounts;
+	i32 next_tile_to_write;
+	i32 rows_started; // the tasks for constructing the tiles in these rows have been submitted
+	i32 rows_released; // the pixels for these rows have been freed (no longer needed for the next level)
+	u32 tiles_skipped;
 } export_level_task_data_t;
 
 typedef struct export_task_data_t {
 	i32 ifd_count;
 	i32 max_level;
-	i32 source_tile_width;
 	i32 export_tile_width;
 	i32 quality;
 	u64 image_data_base_offset;
 	u64 current_image_data_write_offset;
 	u64 total_tiles_to_export;
+	u64 tiles_written;
 	float progress_per_exported_tile; // for progress bar
-	volatile i32 tiles_left_to_compress_in_batch;
 	FILE* fp;
 	bool use_rgb;
 	bool is_valid;
+	// Throughput statistics
+	u64 source_tiles_decoded;
+	u64 tiles_encoded;
+	u64 tiles_skipped;
+	export_source_t source;
 	export_level_task_data_t level_task_datas[WSI_MAX_LEVELS];
 } export_task_data_t;
 
-void export_notify_load_tile_completed(int logical_thread_index, void* userdata) {
-	viewer_notify_tile_completed_task_t* task = (viewer_notify_tile_completed_task_t*)userdata;
-	add_work_queue_entry(&global_export_completion_queue, export_notify_load_tile_completed, userdata, sizeof(viewer_notify_tile_completed_task_t));
+// The pixel bounds (within the source image) covered by a level 0 tile, clipped to the exported region.
+static bounds2i export_get_tile_pixel_bounds(export_task_data_t* export_task, i32 export_tile_x, i32 export_tile_y) {
+	i32 export_tile_width = export_task->export_tile_width;
+	bounds2i result = {0};
+	result.left = export_task->source.pixel_bounds.left + export_tile_x * export_tile_width;
+	result.top = export_task->source.pixel_bounds.top + export_tile_y * export_tile_width;
+	result.right = MIN(result.left + export_tile_width, export_task->source.pixel_bounds.right);
+	result.bottom = MIN(result.top + export_tile_width, export_task->source.pixel_bounds.bottom);
+	return result;
 }
 
-void construct_new_tile_from_source_tiles(export_task_data_t* export_task, export_level_task_data_t* level_task, i32 export_tile_x, i32 export_tile_y, u8** jpeg_buffer, u32* jpeg_size) {
-	u32 export_tile_width = export_task->export_tile_width;
-	i32 source_tile_width = export_task->source_tile_width;
-	u64 tile_size_in_bytes = SQUARE(export_tile_width) * BYTES_PER_PIXEL;
-	u8* dest = malloc(tile_size_in_bytes);
-	memset(dest, 0xFF, tile_size_in_bytes);
-
-	i32 source_tile_offset_x = level_task->pixel_bounds.left % source_tile_width;
-	i32 source_tile_offset_y = level_task->pixel_bounds.top % source_tile_width;
-	i32 remainder_x = (level_task->pixel_bounds.right - level_task->pixel_bounds.left) % export_tile_width;
-	i32 remainder_y = (level_task->pixel_bounds.bottom - level_task->pixel_bounds.top) % export_tile_width;
-	i32 extra_tiles_x = (source_tile_offset_x + export_tile_width - 1) / source_tile_width;
-	i32 extra_tiles_y = (source_tile_offset_y + export_tile_width - 1) / source_tile_width;
-	// TODO: Find a way that this makes more sense. We don't want to go out of bounds for the source tile!
-	if (extra_tiles_x > 0 && export_tile_x == level_task->export_width_in_tiles - 1) {
-		extra_tiles_x = (source_tile_offset_x + remainder_x - 1) / source_tile_width;
-	}
-	if (extra_tiles_y > 0 && export_tile_y == level_task->export_height_in_tiles - 1) {
-		extra_tiles_y = (source_tile_offset_y + remainder_y - 1) / source_tile_width;
-	}
-
+// The (absolute) source tile coordinates overlapping a level 0 tile, clipped to the source tiles that exist.
+static bounds2i export_get_source_tile_range(export_task_data_t* export_task, i32 export_tile_x, i32 export_tile_y) {
+	export_source_t* source = &export_task->source;
+	bounds2i pixel_bounds = export_get_tile_pixel_bounds(export_task, export_tile_x, export_tile_y);
+	bounds2i result = {0};
+	result.left = ATLEAST(div_floor(pixel_bounds.left, source->tile_width), source->tile_bounds.left);
+	result.top = ATLEAST(div_floor(pixel_bounds.top, source->tile_height), source->tile_bounds.top);
+	result.right = ATMOST(div_floor(pixel_bounds.right - 1, source->tile_width) + 1, source->tile_bounds.right);
+	result.bottom = ATMOST(div_floor(pixel_bounds.bottom - 1, source->tile_height) + 1, source->tile_bounds.bottom);
+	return result;
+}
 
-	i32 source_tile_index = export_tile_y * level_task->source_bounds_width_in_tiles + export_tile_x;
-//					i32 source_tile_x = source_tile_index % level_task->source_bounds_width_in_tiles;
-//					i32 source_tile_y = source_tile_index / level_task->source_bounds_width_in_tiles;
+static inline export_source_tile_t* export_get_source_tile(export_source_t* source, i32 source_tile_x, i32 source_tile_y) {
+	i32 rel_x = source_tile_x - source->tile_bounds.left;
+	i32 rel_y = source_tile_y - source->tile_bounds.top;
+	ASSERT(rel_x >= 0 && rel_x < source->width_in_tiles);
+	ASSERT(rel_y >= 0 && rel_y < source->height_in_tiles);
+	return source->tiles + rel_y * source->width_in_tiles + rel_x;
+}
 
-	i32 source_pitch = source_tile_width * BYTES_PER_PIXEL;
+// Assemble a level 0 tile from the parts of all the source tiles that overlap with it.
+// (The source tiles may be smaller or larger than the exported tiles, and need not be aligned with them.)
+// Returns false if none of the source tiles contributed anything.
+bool construct_new_tile_from_source_tiles(export_task_data_t* export_task, i32 export_tile_x, i32 export_tile_y, u8* dest) {
+	export_source_t* source = &export_task->source;
+	i32 source_pitch = source->tile_width * BYTES_PER_PIXEL;
 	i32 dest_pitch = export_task->export_tile_width * BYTES_PER_PIXEL;
 
-	i32 dest_left_section_width = source_tile_width - source_tile_offset_x;
-	i32 dest_top_section_height = source_tile_width - source_tile_offset_y;
-	i32 dest_right_section_width = export_tile_width - dest_left_section_width;
-	i32 dest_bottom_section_height = export_tile_width - dest_top_section_height;
-
-	// TODO: what if source tile size and export tile size are not the same?
-
+	bounds2i tile_pixel_bounds = export_get_tile_pixel_bounds(export_task, export_tile_x, export_tile_y);
+	bounds2i source_range = export_get_source_tile_range(export_task, export_tile_x, export_tile_y);
 	i32 contributing_source_tiles_count = 0;
-
-	// Top-left source tile
-	{
-		tile_t* source_tile = level_task->source_tiles[source_tile_index];
-		if (source_tile && !source_tile->is_empty) {
+	for (i32 source_tile_y = source_range.top; source_tile_y < source_range.bottom; ++source_tile_y) {
+		for (i32 source_tile_x = source_range.left; source_tile_x < source_range.right; ++source_tile_x) {
+			export_source_tile_t* source_tile = export_get_source_tile(source, source_tile_x, source_tile_y);
+			ASSERT(source_tile->is_ready);
+			if (!source_tile->pixels) continue;
+
+			i32 source_left = source_tile_x * source->tile_width;
+			i32 source_top = source_tile_y * source->tile_height;
+			i32 x0 = MAX(tile_pixel_bounds.left, source_left);
+			i32 y0 = MAX(tile_pixel_bounds.top, source_top);
+			i32 x1 = MIN(tile_pixel_bounds.right, source_left + source->tile_width);
+			i32 y1 = MIN(tile_pixel_bounds.bottom, source_top + source->tile_height);
+			if (x1 <= x0 || y1 <= y0) continue;
 			++contributing_source_tiles_count;
-			ASSERT(source_tile->is_cached && source_tile->pixels);
-			u8* source_pos = source_tile->pixels +
-			                 source_tile_offset_y * source_pitch + source_tile_offset_x * BYTES_PER_PIXEL;
-			u8* dest_pos = dest;
-			for(i32 y = 0; y < dest_top_section_height; ++y) {
-				memcpy(dest_pos, source_pos, dest_left_section_width * BYTES_PER_PIXEL);
-				dest_pos += dest_pitch;
-				source_pos += source_pitch;
-			}
-		}
-	}
 
-	// Top-right source tile
-	if (extra_tiles_x == 1) {
-		tile_t* source_tile = level_task->source_tiles[source_tile_index + 1];
-		if (source_tile && !source_tile->is_empty) {
-			++contributing_source_tiles_count;
-			ASSERT(source_tile->is_cached && source_tile->pixels);
-			u8* source_pos = source_tile->pixels + source_tile_offset_y * source_pitch;
-			u8* dest_pos = dest + dest_left_section_width * BYTES_PER_PIXEL;
-			for(i32 y = 0; y < dest_top_section_height; ++y) {
-				memcpy(dest_pos, source_pos, dest_right_section_width * BYTES_PER_PIXEL);
+			u8* source_pos = source_tile->pixels + (y0 - source_top) * source_pitch + (x0 - source_left) * BYTES_PER_PIXEL;
+			u8* dest_pos = dest + (y0 - tile_pixel_bounds.top) * dest_pitch + (x0 - tile_pixel_bounds.left) * BYTES_PER_PIXEL;
+			size_t row_size = (x1 - x0) * BYTES_PER_PIXEL;
+			for (i32 y = y0; y < y1; ++y) {
+				memcpy(dest_pos, source_pos, row_size);
 				dest_pos += dest_pitch;
 				source_pos += source_pitch;
 			}
 		}
 	}
+	return (contributing_source_tiles_count > 0);
+}
 
-	// Bottom-left source tile
-	if (extra_tiles_y == 1) {
-		tile_t* source_tile = level_task->source_tiles[source_tile_index + level_task->source_bounds_width_in_tiles];
-		if (source_tile && !source_tile->is_empty) {
-			++contributing_source_tiles_count;
-			ASSERT(source_tile->is_cached && source_tile->pixels);
-			u8* source_pos = source_tile->pixels + source_tile_offset_x * BYTES_PER_PIXEL;
-			u8* dest_pos = dest + dest_top_section_height * dest_pitch;
-			for(i32 y = 0; y < dest_bottom_section_height; ++y) {
-				memcpy(dest_pos, source_pos, dest_left_section_width * BYTES_PER_PIXEL);
-				dest_pos += dest_pitch;
-				source_pos += source_pitch;
-			}
+// Halve the resolution of a block of BGRA pixels, by averaging each 2x2 block of pixels (box filter).
+void downsample_2x2_bgra(u8* dest, i32 dest_pitch, u8* source, i32 source_pitch, i32 dest_width, i32 dest_height) {
+	for (i32 y = 0; y < dest_height; ++y) {
+		u8* row0 = source + (2 * y) * source_pitch;
+		u8* row1 = row0 + source_pitch;
+		u8* out = dest + y * dest_pitch;
+		i32 x = 0;
+#if defined(__SSE2__)
+		__m128i zero = _mm_setzero_si128();
+		__m128i rounding = _mm_set1_epi16(2);
+		for (; x + 4 <= dest_width; x += 4) {
+			// 8 source pixels from each row make 4 destination pixels
+			__m128i a0 = _mm_loadu_si128((__m128i*)(row0 + x * 8));
+			__m128i a1 = _mm_loadu_si128((__m128i*)(row0 + x * 8 + 16));
+			__m128i b0 = _mm_loadu_si128((__m128i*)(row1 + x * 8));
+			__m128i b1 = _mm_loadu_si128((__m128i*)(row1 + x * 8 + 16));
+			// Vertical sums, 16 bits per channel: each register holds two pixels
+			__m128i s01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+			__m128i s23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+			__m128i s45 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+			__m128i s67 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+			// Horizontal sums: add the even pixels to the odd pixels
+			__m128i q01 = _mm_add_epi16(_mm_unpacklo_epi64(s01, s23), _mm_unpackhi_epi64(s01, s23));
+			__m128i q23 = _mm_add_epi16(_mm_unpacklo_epi64(s45, s67), _mm_unpackhi_epi64(s45, s67));
+			q01 = _mm_srli_epi16(_mm_add_epi16(q01, rounding), 2);
+			q23 = _mm_srli_epi16(_mm_add_epi16(q23, rounding), 2);
+			_mm_storeu_si128((__m128i*)(out + x * 4), _mm_packus_epi16(q01, q23));
 		}
-	}
-
-	// Bottom-right source tile
-	if (extra_tiles_x == 1 && extra_tiles_y == 1) {
-		tile_t* source_tile = level_task->source_tiles[source_tile_index + level_task->source_bounds_width_in_tiles + 1];
-		if (source_tile && !source_tile->is_empty) {
-			++contributing_source_tiles_count;
-			ASSERT(source_tile->is_cached && source_tile->pixels);
-			u8* source_pos = source_tile->pixels;
-			u8* dest_pos = dest + dest_top_section_height * dest_pitch + dest_left_section_width * BYTES_PER_PIXEL;
-			for(i32 y = 0; y < dest_bottom_section_height; ++y) {
-				memcpy(dest_pos, source_pos, dest_right_section_width * BYTES_PER_PIXEL);
-				dest_pos += dest_pitch;
-				source_pos += source_pitch;
+#endif
+		for (; x < dest_width; ++x) {
+			u8* p0 = row0 + x * 8;
+			u8* p1 = row1 + x * 8;
+			for (i32 c = 0; c < 4; ++c) {
+				out[x * 4 + c] = (u8)((p0[c] + p0[c + 4] + p1[c] + p1[c + 4] + 2) >> 2);
 			}
 		}
 	}
+}
 
-		// Now we have a fully assembled tile.
-
-#if 0
-		static bool already_tested_jpeg_encode;
-					if (!already_tested_jpeg_encode) {
-						already_tested_jpeg_encode = true;
-						u8* jpeg_buffer = NULL;
-						u32 jpeg_size = 0;
-						jpeg_encode_image(dest, export_tile_width, export_tile_width, quality,
-						                  &jpeg_buffer, &jpeg_size);
-
-						FILE* test_fp = fopen("test.jpeg", "wb");
-						if (test_fp) {
-							fwrite(jpeg_buffer, jpeg_size, 1, test_fp);
-							fclose(test_fp);
-						}
-					}
-#endif
-
-	bool skip = (contributing_source_tiles_count == 0); // empty tiles would only waste space, so skip them
-	if (!skip) {
-		u8* compressed_buffer = NULL;
-		u64 compressed_size = 0;
-		jpeg_encode_tile(dest, export_tile_width, export_tile_width, export_task->quality, NULL, NULL,
-		                 &compressed_buffer, &compressed_size, export_task->use_rgb);
-
-		*jpeg_buffer = compressed_buffer;
-		*jpeg_size = compressed_size;
+// Generate a tile from the 2x2 block of tiles that it covers in the level above.
+// Returns false if none of those tiles contained anything.
+bool construct_new_tile_from_higher_level(export_task_data_t* export_task, i32 level, i32 export_tile_x, i32 export_tile_y, u8* dest) {
+	ASSERT(level > 0);
+	export_level_task_data_t* higher_level_task = export_task->level_task_datas + (level - 1);
+	i32 export_tile_width = export_task->export_tile_width;
+	i32 half_tile_width = export_tile_width / 2;
+	i32 pitch = export_tile_width * BYTES_PER_PIXEL;
+	i32 contributing_tiles_count = 0;
+	for (i32 dy = 0; dy < 2; ++dy) {
+		i32 higher_tile_y = export_tile_y * 2 + dy;
+		if (higher_tile_y >= higher_level_task->export_height_in_tiles) break;
+		for (i32 dx = 0; dx < 2; ++dx) {
+			i32 higher_tile_x = export_tile_x * 2 + dx;
+			if (higher_tile_x >= higher_level_task->export_width_in_tiles) break;
+			export_tile_t* higher_tile = higher_level_task->tiles + higher_tile_y * higher_level_task->export_width_in_tiles + higher_tile_x;
+			ASSERT(higher_tile->is_done);
+			if (!higher_tile->pixels) continue; // empty, leave blank
+			++contributing_tiles_count;
+			u8* dest_pos = dest + (dy * half_tile_width) * pitch + (dx * half_tile_width) * BYTES_PER_PIXEL;
+			downsample_2x2_bgra(dest_pos, pitch, higher_tile->pixels, pitch, half_tile_width, half_tile_width);
+		}
 	}
-
-	free(dest);
+	return (contributing_tiles_count > 0);
 }
 
 typedef struct construct_tile_task_t {
 	export_task_data_t* export_task;
-	export_level_task_data_t* level_task;
+	i32 level;
 	i32 export_tile_x;
 	i32 export_tile_y;
-	u8** jpeg_buffer;
-	u32* jpeg_size;
 } construct_tile_task_t;
 
-void construct_new_tile_from_source_tiles_func(i32 logical_thread_id, void* userdata) {
+void construct_new_tile_func(i32 logical_thread_id, void* userdata) {
 	construct_tile_task_t* task = (construct_tile_task_t*) userdata;
-	construct_new_tile_from_source_tiles(task->export_task, task->level_task, task->export_tile_x, task->export_tile_y, task->jpeg_buffer, task->jpeg_size);
-	atomic_decrement(&task->export_task->tiles_left_to_compress_in_batch);
+	export_task_data_t* export_task = task->export_task;
+	export_level_task_data_t* level_task = export_task->level_task_datas + task->level;
+	export_tile_t* tile = level_task->tiles + task->export_tile_y * level_task->export_width_in_tiles + task->export_tile_x;
+
+	u32 export_tile_width = export_task->export_tile_width;
+	u64 tile_size_in_bytes = SQUARE(export_tile_width) * BYTES_PER_PIXEL;
+	u8* dest = malloc(tile_size_in_bytes);
+	memset(dest, 0xFF, tile_size_in_bytes);
+
+	bool has_content;
+	if (task->level == 0) {
+		has_content = construct_new_tile_from_source_tiles(export_task, task->export_tile_x, task->export_tile_y, dest);
+	} else {
+		has_content = construct_new_tile_from_higher_level(export_task, task->level, task->export_tile_x, task->export_tile_y, dest);
+	}
+
+	// Now we have a fully assembled tile.
+	// Empty tiles would only waste space, so skip them.
+	if (has_content) {
+		u8* compressed_buffer = NULL;
+		u64 compressed_size = 0;
+		jpeg_encode_tile(dest, export_tile_width, export_tile_width, export_task->quality, NULL, NULL,
+		                 &compressed_buffer, &compressed_size, export_task->use_rgb);
+		tile->jpeg_buffer = compressed_buffer;
+		tile->jpeg_size = compressed_size;
+	}
+	if (has_content && task->level < export_task->max_level) {
+		tile->pixels = dest; // the next level down will be generated from this
+	} else {
+		free(dest);
+	}
+	write_barrier;
+	tile->is_done = true;
 }
 
-void begin_construct_new_tile_from_source_tiles(export_task_data_t* export_task, export_level_task_data_t* level_task, i32 export_tile_x, i32 export_tile_y, u8** jpeg_buffer, u32* jpeg_size) {
+void begin_construct_new_tile(export_task_data_t* export_task, i32 level, i32 export_tile_x, i32 export_tile_y) {
 	construct_tile_task_t task = {0};
 	task.export_task = export_task;
-	task.level_task = level_task;
+	task.level = level;
 	task.export_tile_x = export_tile_x;
 	task.export_tile_y = export_tile_y;
-	task.jpeg_buffer = jpeg_buffer;
-	task.jpeg_size = jpeg_size;
 
-	if (!add_work_queue_entry(&global_work_queue, construct_new_tile_from_source_tiles_func, &task, sizeof(task))) {
+	if (!add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_EXPORT, construct_new_tile_func, &task, sizeof(task))) {
 		panic();
 	}
 }
 
-void export_bigtiff_encode_level(app_state_t* app_state, image_t* image, export_task_data_t* export_task, i32 level) {
-	export_level_task_data_t* level_task = export_task->level_task_datas + level;
-	if (!level_task->is_represented) return;
-
-	float seconds_taken_reading = 0.0f;
-	float seconds_taken_compressing = 0.0f;
-
-	u64* tile_offsets = calloc(level_task->export_tile_count, sizeof(u64));
-	u64* tile_bytecounts = calloc(level_task->export_tile_count, sizeof(u64));
+typedef struct export_decode_source_tile_task_t {
+	image_t* image;
+	i32 level;
+	i32 tile_x;
+	i32 tile_y;
+	export_source_tile_t* source_tile;
+} export_decode_source_tile_task_t;
+
+void export_decode_source_tile_func(i32 logical_thread_index, void* userdata) {
+	export_decode_source_tile_task_t* task = (export_decode_source_tile_task_t*) userdata;
+	u8* pixels = decode_tile_pixels(logical_thread_index, task->image, task->level, task->tile_x, task->tile_y);
+	task->source_tile->pixels = pixels;
+	write_barrier;
+	task->source_tile->is_ready = true;
+}
 
+static void export_request_source_tile(image_t* image, export_task_data_t* export_task, i32 source_tile_x, i32 source_tile_y) {
+	export_source_tile_t* source_tile = export_get_source_tile(&export_task->source, source_tile_x, source_tile_y);
+	if (source_tile->is_requested) return;
+	source_tile->is_requested = true;
+	if (source_tile->is_ready) return; // already arrived from the iSyntax streamer
+
+	level_image_t* level_image = image->level_images + 0;
+	tile_t* tile = get_tile(level_image, source_tile_x, source_tile_y);
+	bool is_empty = (tile == NULL || tile->is_empty);
+	if (image->backend == IMAGE_BACKEND_ISYNTAX) {
+		isyntax_image_t* wsi = image->isyntax.images + image->isyntax.wsi_image_index;
+		isyntax_tile_t* isyntax_tile = wsi->levels[0].tiles + source_tile_y * wsi->levels[0].width_in_tiles + source_tile_x;
+		if (!is_empty && isyntax_tile->exists) {
+			// Will be picked up from the iSyntax streamer, see export_collect_isyntax_tiles().
+			if (isyntax_tile->is_loaded) {
+				isyntax_tile->want_reload = true; // the pixels were already handed out earlier, need to reconstruct again
+			}
+			return;
+		}
+		is_empty = true;
+	}
+	if (is_empty) {
+		source_tile->is_ready = true; // nothing to decode
+		return;
+	}
 
-	u32 batch_size = ATLEAST(worker_thread_count, 1);
-	u32 batch_count = (level_task->export_tile_count + batch_size - 1) / batch_size;
+	export_decode_source_tile_task_t task = {0};
+	task.image = image;
+	task.level = 0;
+	task.tile_x = source_tile_x;
+	task.tile_y = source_tile_y;
+	task.source_tile = source_tile;
+	if (!add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_EXPORT, export_decode_source_tile_func, &task, sizeof(task))) {
+		panic();
+	}
+	++export_task->source_tiles_decoded;
+}
 
-	// TODO: don't assume unaligned!
-//			bool x_aligned = level_task->export_width_in_tiles == level_task->source_bounds_width_in_tiles;
-//			bool y_aligned = level_task->export_height_in_tiles == level_task->source_bounds_height_in_tiles;
+// iSyntax tiles can't be decoded one at a time: their reconstruction depends on the neighboring tiles and on the
+// tiles one level higher up. So instead we point the iSyntax streamer at the source tiles we need (like the viewer
+// does for the tiles on the screen), and collect the reconstructed tiles from the completion queue.
+// NOTE: this requires that we are the only consumer of the completion queue, i.e. we are running headless.
+static void export_stream_isyntax_tiles(image_t* image, bounds2i wanted_tiles) {
+	isyntax_t* isyntax = &image->isyntax;
+	isyntax_image_t* wsi = isyntax->images + isyntax->wsi_image_index;
+	if (!wsi->first_load_complete && !wsi->first_load_in_progress) {
+		wsi->first_load_in_progress = true;
+		isyntax_begin_first_load(image->resource_id, isyntax, wsi);
+	} else if (wsi->first_load_complete && !is_tile_stream_task_in_progress) {
+		// The streamer loads the tiles overlapping with the 'camera' bounds; aim at the centers of the outer tiles.
+		level_image_t* level_image = image->level_images + 0;
+		tile_streamer_t tile_streamer = {0};
+		tile_streamer.image = image;
+		tile_streamer.origin_offset = image->origin_offset;
+		tile_streamer.camera_bounds.left = image->origin_offset.x + ((float)wanted_tiles.left + 0.5f) * level_image->x_tile_side_in_um;
+		tile_streamer.camera_bounds.top = image->origin_offset.y + ((float)wanted_tiles.top + 0.5f) * level_image->y_tile_side_in_um;
+		tile_streamer.camera_bounds.right = image->origin_offset.x + ((float)wanted_tiles.right - 0.5f) * level_image->x_tile_side_in_um;
+		tile_streamer.camera_bounds.bottom = image->origin_offset.y + ((float)wanted_tiles.bottom - 0.5f) * level_image->y_tile_side_in_um;
+		// The streamer starts with the tile closest to the center; we want the tiles to arrive roughly in order.
+		tile_streamer.camera_center.x = tile_streamer.camera_bounds.left;
+		tile_streamer.camera_center.y = tile_streamer.camera_bounds.top;
+		tile_streamer.zoom.level = 0;
+		isyntax_begin_stream_image_tiles(&tile_streamer);
+	}
+}
 
-	u32 export_tile_width = export_task->export_tile_width;
-	i32 source_tile_width = export_task->source_tile_width;
-	i32 source_tile_offset_x = level_task->pixel_bounds.left % source_tile_width;
-	i32 source_tile_offset_y = level_task->pixel_bounds.top % source_tile_width;
-	i32 remainder_x = (level_task->pixel_bounds.right - level_task->pixel_bounds.left) % export_tile_width;
-	i32 remainder_y = (level_task->pixel_bounds.bottom - level_task->pixel_bounds.top) % export_tile_width;
-	i32 extra_tiles_x = (source_tile_offset_x + export_tile_width - 1) / source_tile_width;
-	i32 extra_tiles_y = (source_tile_offset_y + export_tile_width - 1) / source_tile_width;
-
-	i32 source_tile_pitch = level_task->source_bounds_width_in_tiles;
-
-	for (i32 batch = 0; batch < batch_count; ++batch) {
-//		console_print_verbose("  starting batch %d out of %d\n", batch, batch_count);
-		u32 start_tile_index = batch * batch_size;
-		i32 tiles_left = level_task->export_tile_count - start_tile_index;
-		i32 current_batch_size = MIN(tiles_left, batch_size);
-//				bool is_last_batch = (tiles_left / batch_size) == 0;
-		u32 end_tile_index = start_tile_index + (current_batch_size - 1);
-		i32 start_tile_x = start_tile_index % level_task->export_width_in_tiles;
-		i32 start_tile_y = start_tile_index / level_task->export_width_in_tiles;
-		i32 end_tile_x = end_tile_index % level_task->export_width_in_tiles;
-		i32 end_tile_y = end_tile_index / level_task->export_width_in_tiles;
-
-		// TODO: Find a way that this makes more sense. We don't want to go out of bounds for the source tile!
-		/*if (end_tile_x == level_task->export_width_in_tiles - 1) {
-			extra_tiles_x = (source_tile_offset_x + remainder_x - 1) / source_tile_width;
-		}
-		if (end_tile_y == level_task->export_height_in_tiles - 1) {
-			extra_tiles_y = (source_tile_offset_y + remainder_y - 1) / source_tile_width;
-		}*/
-//				ASSERT(end_tile_x + extra_tiles_x < level_task->source_bounds_width_in_tiles);
-//				ASSERT(end_tile_y + extra_tiles_y < level_task->source_bounds_height_in_tiles);
-
-		u32 jpeg_compressed_sizes[MAX_THREAD_COUNT] = {0};
-		u8* jpeg_compressed_buffers[MAX_THREAD_COUNT] = {0};
-
-		i32 first_source_tile_needed = start_tile_y * source_tile_pitch + start_tile_x;
-		i32 last_source_tile_needed = (end_tile_y + extra_tiles_y) * source_tile_pitch + end_tile_x + extra_tiles_x;
-		last_source_tile_needed = ATMOST(last_source_tile_needed, level_task->source_tile_count - 1);
-		i32 source_tiles_needed = last_source_tile_needed - first_source_tile_needed + 1;
-
-		load_tile_task_t* wishlist = calloc(source_tiles_needed, sizeof(load_tile_task_t));
-		i32 tiles_to_load = 0;
-
-		i64 read_time_start = get_clock();
-
-		for (i32 tile_index = 0; tile_index <= last_source_tile_needed; ++tile_index) {
-			tile_t* tile = level_task->source_tiles[tile_index];
-			if (tile_index < first_source_tile_needed) {
-				// Release tiles that are no longer needed.
-				if (tile && tile->is_cached && tile->pixels) {
-					tile_release_cache(tile);
-				}
-			} else {
-//				console_print_verbose("   tile %d out of %d\n", tile_index, level_task->export_tile_count);
-				// Load needed tiles into system cache.
-				if (tile) {
-					if (tile->is_empty) continue; // no need to load empty tiles
-					if (tile->is_cached && tile->pixels) {
-						continue; // already cached!
-					} else {
-						tile->need_keep_in_cache = true;
-						wishlist[tiles_to_load++] = (load_tile_task_t){
-								.resource_id = image->resource_id,
-								.image = image, .tile = tile, .level = level,
-								.tile_x = tile->tile_x,
-								.tile_y = tile->tile_y,
-								.need_gpu_residency = tile->need_gpu_residency,
-								.need_keep_in_cache = true,
-								.completion_callback = export_notify_load_tile_completed,
-						};
+static void export_collect_isyntax_tiles(image_t* image, export_source_t* source) {
+	while (is_queue_work_in_progress(&global_completion_queue)) {
+		work_queue_entry_t entry = get_next_work_queue_entry(&global_completion_queue);
+		if (!entry.is_valid) break;
+		if (!entry.callback) panic();
+		mark_queue_entry_completed(&global_completion_queue);
+
+		if (entry.callback == viewer_notify_load_tile_completed) {
+			viewer_notify_tile_completed_task_t* task = (viewer_notify_tile_completed_task_t*) entry.userdata;
+			if (!task->pixel_memory) continue;
+			bool need_free_pixel_memory = true;
+			if (task->resource_id == image->resource_id && task->scale == 0) {
+				level_image_t* level_image = image->level_images + 0;
+				i32 tile_x = task->tile_index % level_image->width_in_tiles;
+				i32 tile_y = task->tile_index / level_image->width_in_tiles;
+				bounds2i bounds = source->tile_bounds;
+				if (tile_x >= bounds.left && tile_x < bounds.right && tile_y >= bounds.top && tile_y < bounds.bottom) {
+					export_source_tile_t* source_tile = export_get_source_tile(source, tile_x, tile_y);
+					if (!source_tile->is_ready && source_tile->export_tiles_waiting > 0) {
+						source_tile->pixels = task->pixel_memory;
+						source_tile->is_ready = true;
+						need_free_pixel_memory = false;
 					}
 				}
 			}
+			// Tiles from other levels are only a by-product (needed to reconstruct the level we are interested in).
+			if (need_free_pixel_memory) {
+				tile_pixels_free(task->pixel_memory);
+			}
 		}
+	}
+}
 
-		request_tiles(app_state, image, wishlist, tiles_to_load);
-		free(wishlist);
-		wishlist = NULL;
-
-		// TODO: fix the copy-pasta
-		i32 pixel_transfer_index_start = app_state->next_pixel_transfer_to_submit;
-		while (is_queue_work_in_progress(&global_work_queue) || is_queue_work_in_progress(&global_export_completion_queue)) {
-			work_queue_entry_t entry = get_next_work_queue_entry(&global_export_completion_queue);
-			if (entry.is_valid) {
-				if (!entry.callback) panic();
-				mark_queue_entry_completed(&global_export_completion_queue);
-
-				if (entry.callback == export_notify_load_tile_completed) {
-					viewer_notify_tile_completed_task_t* task = (viewer_notify_tile_completed_task_t*) entry.userdata;
-					if (task->pixel_memory) {
-						bool need_free_pixel_memory = true;
-						tile_t* tile = get_tile_from_tile_index(image, task->scale, task->tile_index);
-						if (tile) {
-							tile->is_submitted_for_loading = false;
-							if (tile->need_gpu_residency) {
-								/*pixel_transfer_state_t* transfer_state =
-										submit_texture_upload_via_pbo(app_state, task->tile_width, task->tile_width,
-																	  4, task->pixel_memory, finalize_textures_immediately);
-								if (finalize_textures_immediately) {
-									tile->texture = transfer_state->texture;
-								} else {
-									transfer_state->userdata = (void*) tile;
-								}*/
-
-							}
-							if (tile->need_keep_in_cache) {
-								need_free_pixel_memory = false;
-								tile->pixels = task->pixel_memory;
-								tile->is_cached = true;
-							}
-						}
-						if (need_free_pixel_memory) {
-							free(task->pixel_memory);
-						}
-					}
-
-//					free(entry.data);
-				} /*else if (entry.callback == viewer_upload_already_cached_tile_to_gpu) {
-							load_tile_task_t* task = (load_tile_task_t*) entry.data;
-							tile_t* tile = task->tile;
-							if (tile->is_cached && tile->pixels) {
-								if (tile->need_gpu_residency) {
-									pixel_transfer_state_t* transfer_state = submit_texture_upload_via_pbo(app_state, TILE_DIM,
-									                                                                       TILE_DIM, 4,
-									                                                                       tile->pixels, finalize_textures_immediately);
-									tile->texture = transfer_state->texture;
-								} else {
-									ASSERT(!"viewer_only_upload_cached_tile() called but !tile->need_gpu_residency\n");
-								}
-
-								if (!task->need_keep_in_cache) {
-									free(tile->pixels);
-									tile->pixels = NULL;
-									tile->is_cached = false;
-								}
-							} else {
-								console_print("Warning: viewer_only_upload_cached_tile() called on a non-cached tile\n");
-							}
-						}*/
+static void export_release_source_tiles_for_exported_tile(export_task_data_t* export_task, i32 export_tile_x, i32 export_tile_y) {
+	bounds2i source_range = export_get_source_tile_range(export_task, export_tile_x, export_tile_y);
+	for (i32 source_tile_y = source_range.top; source_tile_y < source_range.bottom; ++source_tile_y) {
+		for (i32 source_tile_x = source_range.left; source_tile_x < source_range.right; ++source_tile_x) {
+			export_source_tile_t* source_tile = export_get_source_tile(&export_task->source, source_tile_x, source_tile_y);
+			--source_tile->export_tiles_waiting;
+			ASSERT(source_tile->export_tiles_waiting >= 0);
+			if (source_tile->export_tiles_waiting == 0 && source_tile->pixels) {
+				tile_pixels_free(source_tile->pixels);
+				source_tile->pixels = NULL;
 			}
+		}
+	}
+}
 
+static bool export_are_rows_done(export_level_task_data_t* level_task, i32 first_row, i32 end_row) {
+	end_row = MIN(end_row, (i32)level_task->export_height_in_tiles);
+	i32 first_tile = first_row * level_task->export_width_in_tiles;
+	i32 end_tile = end_row * level_task->export_width_in_tiles;
+	for (i32 i = first_tile; i < end_tile; ++i) {
+		if (!level_task->tiles[i].is_done) return false;
+	}
+	return true;
+}
 
-		}//end of while loop
-
-		// Verify that all tiles are now available
-		for (i32 tile_index = first_source_tile_needed; tile_index <= last_source_tile_needed; ++tile_index) {
-			tile_t* tile = level_task->source_tiles[tile_index];
+// All levels are exported in a single pipelined pass over level 0:
+// - Source tiles are decoded ahead, and level 0 tiles are assembled and JPEG-compressed as soon as their source
+//   tiles are available.
+// - Each lower level is generated from the level above it by downsampling: as soon as two rows of tiles are
+//   complete in one level, the row below them in the next level can be started.
+// - The compressed tiles are written to the file in order (per level) as they come in; the tile offsets and
+//   byte counts are patched in afterwards.
+// The work in flight is bounded, and the uncompressed pixels are only kept around for a few rows per level.
+void export_bigtiff_encode_levels(app_state_t* app_state, image_t* image, export_task_data_t* export_task) {
+	export_source_t* source = &export_task->source;
+	export_level_task_data_t* level0_task = export_task->level_task_datas + 0;
+	i32 max_level = export_task->max_level;
+	i32 logical_thread_index = local_thread_memory ? local_thread_memory->logical_thread_index : 0;
+	bool is_isyntax = (image->backend == IMAGE_BACKEND_ISYNTAX);
+
+	for (i32 level = 0; level <= max_level; ++level) {
+		export_level_task_data_t* level_task = export_task->level_task_datas + level;
+		level_task->tiles = calloc(level_task->export_tile_count, sizeof(export_tile_t));
+		level_task->tile_offsets = calloc(level_task->export_tile_count, sizeof(u64));
+		level_task->tile_bytecounts = calloc(level_task->export_tile_count, sizeof(u64));
+	}
 
-			if (tile) {
-				if (tile->is_empty) continue;
-				if (tile->is_cached && tile->pixels) {
-					continue; // already cached!
-				} else {
-					ASSERT(!"This tile should have been loaded!\n");
+	// Count how many of the level 0 tiles need each source tile, so we know when a source tile can be released.
+	for (i32 export_tile_y = 0; export_tile_y < level0_task->export_height_in_tiles; ++export_tile_y) {
+		for (i32 export_tile_x = 0; export_tile_x < level0_task->export_width_in_tiles; ++export_tile_x) {
+			bounds2i source_range = export_get_source_tile_range(export_task, export_tile_x, export_tile_y);
+			for (i32 source_tile_y = source_range.top; source_tile_y < source_range.bottom; ++source_tile_y) {
+				for (i32 source_tile_x = source_range.left; source_tile_x < source_range.right; ++source_tile_x) {
+					++export_get_source_tile(source, source_tile_x, source_tile_y)->export_tiles_waiting;
 				}
 			}
-
 		}
-		seconds_taken_reading += get_seconds_elapsed(read_time_start, get_clock());
-
-
-		// Now we can proceed with constructing the new tiles from the source tiles, and writing them to disk.
-		i64 compress_time_start = get_clock();
-		export_task->tiles_left_to_compress_in_batch = current_batch_size;
-
-		// Begin JPEG compression tasks for each tile.
-		for (i32 tile_index = start_tile_index; tile_index <= end_tile_index; ++tile_index) {
-			i32 export_tile_x = tile_index % level_task->export_width_in_tiles;
-			i32 export_tile_y = tile_index / level_task->export_width_in_tiles;
-
-			i32 work_index = tile_index % batch_size;
-			u8** jpeg_buffer = &jpeg_compressed_buffers[work_index];
-			u32* jpeg_size = &jpeg_compressed_sizes[work_index];
+	}
 
-			begin_construct_new_tile_from_source_tiles(export_task, level_task, export_tile_x, export_tile_y, jpeg_buffer, jpeg_size);
+	// Rows of uncompressed tiles kept per level: the two rows needed for the next level, plus the one being worked on.
+	const i32 max_rows_in_flight = 3;
+	i32 max_tiles_in_flight = ATLEAST(4 * worker_thread_count, 16);
+	i32 tile_count = (i32)level0_task->export_tile_count;
+	i32 width_in_tiles = (i32)level0_task->export_width_in_tiles;
+	i32 next_tile_to_request = 0; // source tiles have been requested for all level 0 tiles before this one
+	i32 next_tile_to_encode = 0;
+	float saved_tiff_export_progress = global_tiff_export_progress;
+	i64 last_progress_clock = get_clock();
+
+	fseeko64(export_task->fp, export_task->current_image_data_write_offset, SEEK_SET);
+
+	while (export_task->tiles_written < export_task->total_tiles_to_export) {
+		bool made_progress = false;
+
+		// Level 0: construct new tiles from the source tiles.
+		i32 window_end = MIN(level0_task->next_tile_to_write + max_tiles_in_flight, tile_count);
+		if (max_level > 0) {
+			// Don't get too far ahead of the next level, which still needs the pixels.
+			window_end = MIN(window_end, (level0_task->rows_released + max_rows_in_flight) * width_in_tiles);
 		}
 
-		// Wait for all compression tasks in the batch to finish.
-		float saved_tiff_export_progress = global_tiff_export_progress;
-		for(;;) {
-			i32 tiles_left_to_compress_in_batch = export_task->tiles_left_to_compress_in_batch;
-			global_tiff_export_progress = saved_tiff_export_progress + (current_batch_size - export_task->tiles_left_to_compress_in_batch) * export_task->progress_per_exported_tile;
-			if (!(tiles_left_to_compress_in_batch > 0)) {
-				break;
-			} else {
-				if (is_queue_work_waiting_to_start(&global_work_queue)) {
-					do_worker_work(&global_work_queue, 0);
+		// Decode ahead: request the source tiles for every tile in the window.
+		for (; next_tile_to_request < window_end; ++next_tile_to_request) {
+			i32 export_tile_x = next_tile_to_request % width_in_tiles;
+			i32 export_tile_y = next_tile_to_request / width_in_tiles;
+			bounds2i source_range = export_get_source_tile_range(export_task, export_tile_x, export_tile_y);
+			for (i32 source_tile_y = source_range.top; source_tile_y < source_range.bottom; ++source_tile_y) {
+				for (i32 source_tile_x = source_range.left; source_tile_x < source_range.right; ++source_tile_x) {
+					export_request_source_tile(image, export_task, source_tile_x, source_tile_y);
 				}
 			}
-//			if (tiles_left_to_compress_in_batch > 0) {
-//				console_print_verbose("tiles left to compress: %d\n", tiles_left_to_compress_in_batch);
-//			}
 		}
-		global_tiff_export_progress = saved_tiff_export_progress + current_batch_size* export_task->progress_per_exported_tile;
 
-		// batch completed.
+		if (is_isyntax) {
+			export_collect_isyntax_tiles(image, source);
+		}
 
-		fseeko64(export_task->fp, export_task->current_image_data_write_offset, SEEK_SET);
+		// Start constructing and compressing new tiles as soon as all their source tiles are available.
+		for (; next_tile_to_encode < window_end; ++next_tile_to_encode) {
+			i32 export_tile_x = next_tile_to_encode % width_in_tiles;
+			i32 export_tile_y = next_tile_to_encode / width_in_tiles;
+			bounds2i source_range = export_get_source_tile_range(export_task, export_tile_x, export_tile_y);
+			bool are_source_tiles_ready = true;
+			for (i32 source_tile_y = source_range.top; source_tile_y < source_range.bottom && are_source_tiles_ready; ++source_tile_y) {
+				for (i32 source_tile_x = source_range.left; source_tile_x < source_range.right; ++source_tile_x) {
+					if (!export_get_source_tile(source, source_tile_x, source_tile_y)->is_ready) {
+						are_source_tiles_ready = false;
+						break;
+					}
+				}
+			}
+			if (!are_source_tiles_ready) {
+				if (is_isyntax) {
+					// Aim the streamer at the rows of source tiles needed for the rest of the window.
+					i32 last_tile_y = (window_end - 1) / width_in_tiles;
+					bounds2i last_range = export_get_source_tile_range(export_task, 0, last_tile_y);
+					bounds2i wanted_tiles = source->tile_bounds;
+					wanted_tiles.top = source_range.top;
+					wanted_tiles.bottom = ATLEAST(last_range.bottom, source_range.bottom);
+					export_stream_isyntax_tiles(image, wanted_tiles);
+				}
+				break;
+			}
+			read_barrier;
+			begin_construct_new_tile(export_task, 0, export_tile_x, export_tile_y);
+			level0_task->rows_started = export_tile_y + 1;
+			made_progress = true;
+		}
 
-		for (i32 work_index = 0; work_index < current_batch_size; ++work_index) {
-			u8* compressed_buffer = jpeg_compressed_buffers[work_index];
-			u32 compressed_size = jpeg_compressed_sizes[work_index];
+		// Lower levels: start on the next row as soon as the two rows above it are complete.
+		for (i32 level = 1; level <= max_level; ++level) {
+			export_level_task_data_t* level_task = export_task->level_task_datas + level;
+			export_level_task_data_t* higher_level_task = level_task - 1;
+			while (level_task->rows_started < level_task->export_height_in_tiles) {
+				i32 row = level_task->rows_started;
+				if (level < max_level && row >= level_task->rows_released + max_rows_in_flight) {
+					break;
+				}
+				if (!export_are_rows_done(higher_level_task, row * 2, row * 2 + 2)) {
+					break;
+				}
+				read_barrier;
+				for (i32 export_tile_x = 0; export_tile_x < level_task->export_width_in_tiles; ++export_tile_x) {
+					begin_construct_new_tile(export_task, level, export_tile_x, row);
+				}
+				++level_task->rows_started;
+				made_progress = true;
+			}
+		}
 
-			i32 tile_index = start_tile_index + work_index;
-			tile_offsets[tile_index] = export_task->current_image_data_write_offset;
-			tile_bytecounts[tile_index] = compressed_size;
+		// Write out the compressed tiles, in order.
+		for (i32 level = 0; level <= max_level; ++level) {
+			export_level_task_data_t* level_task = export_task->level_task_datas + level;
+			for (; level_task->next_tile_to_write < level_task->export_tile_count; ++level_task->next_tile_to_write) {
+				i32 tile_index = level_task->next_tile_to_write;
+				export_tile_t* tile = level_task->tiles + tile_index;
+				if (!tile->is_done) break;
+				read_barrier;
+				level_task->tile_offsets[tile_index] = export_task->current_image_data_write_offset;
+				level_task->tile_bytecounts[tile_index] = tile->jpeg_size;
+				if (tile->jpeg_buffer) {
+					fwrite(tile->jpeg_buffer, tile->jpeg_size, 1, export_task->fp);
+					libc_free(tile->jpeg_buffer);
+					tile->jpeg_buffer = NULL;
+					export_task->current_image_data_write_offset += tile->jpeg_size;
+					++export_task->tiles_encoded;
+				} else {
+					++level_task->tiles_skipped;
+					++export_task->tiles_skipped;
+				}
+				if (level == 0) {
+					export_release_source_tiles_for_exported_tile(export_task, tile_index % width_in_tiles, tile_index / width_in_tiles);
+				}
+				++export_task->tiles_written;
+				made_progress = true;
+			}
+		}
 
-			fwrite(compressed_buffer, compressed_size, 1, export_task->fp);
-			libc_free(compressed_buffer);
-			jpeg_compressed_buffers[work_index] = NULL;
-			export_task->current_image_data_write_offset += compressed_size;
+		// Free the pixels of the rows that the next level down is done with.
+		for (i32 level = 0; level < max_level; ++level) {
+			export_level_task_data_t* level_task = export_task->level_task_datas + level;
+			export_level_task_data_t* lower_level_task = level_task + 1;
+			while (level_task->rows_released < level_task->export_height_in_tiles) {
+				i32 lower_row = level_task->rows_released / 2;
+				if (lower_row >= lower_level_task->rows_started || !export_are_rows_done(lower_level_task, lower_row, lower_row + 1)) {
+					break;
+				}
+				i32 end_row = MIN(lower_row * 2 + 2, (i32)level_task->export_height_in_tiles);
+				for (i32 i = level_task->rows_released * level_task->export_width_in_tiles; i < end_row * level_task->export_width_in_tiles; ++i) {
+					export_tile_t* tile = level_task->tiles + i;
+					if (tile->pixels) {
+						free(tile->pixels);
+						tile->pixels = NULL;
+					}
+				}
+				level_task->rows_released = end_row;
+				made_progress = true;
+			}
+		}
 
+		global_tiff_export_progress = saved_tiff_export_progress + export_task->tiles_written * export_task->progress_per_exported_tile;
+
+		if (made_progress) {
+			last_progress_clock = get_clock();
+		} else {
+			if (is_isyntax && next_tile_to_encode < window_end && get_seconds_elapsed(last_progress_clock, get_clock()) > 30.0f) {
+				// The streamer did not deliver; don't hang forever, leave the missing source tiles blank instead.
+				i32 export_tile_x = next_tile_to_encode % width_in_tiles;
+				i32 export_tile_y = next_tile_to_encode / width_in_tiles;
+				console_print_error("Export: timed out waiting for the source tiles of tile (%d, %d), leaving them blank\n",
+				                    export_tile_x, export_tile_y);
+				bounds2i source_range = export_get_source_tile_range(export_task, export_tile_x, export_tile_y);
+				for (i32 source_tile_y = source_range.top; source_tile_y < source_range.bottom; ++source_tile_y) {
+					for (i32 source_tile_x = source_range.left; source_tile_x < source_range.right; ++source_tile_x) {
+						export_get_source_tile(source, source_tile_x, source_tile_y)->is_ready = true;
+					}
+				}
+				last_progress_clock = get_clock();
+			}
+			// Make ourselves useful while waiting for the worker threads.
+			if (!do_worker_work(&global_work_queue, logical_thread_index)) {
+				platform_sleep(0);
+			}
 		}
-		seconds_taken_compressing += get_seconds_elapsed(compress_time_start, get_clock());
 	}
-	// level export completed
-
-	console_print_verbose("Export level %d: tile count = %d, read time = %g, compress time = %g\n",
-						  level, level_task->export_tile_count, seconds_taken_reading, seconds_taken_compressing);
+	// export completed
 
-	// Rewrite the tile offsets and tile bytecounts
-	fseeko64(export_task->fp, level_task->offset_of_tile_offsets, SEEK_SET);
-	fwrite(tile_offsets, sizeof(u64), level_task->export_tile_count, export_task->fp);
+	for (i32 level = 0; level <= max_level; ++level) {
+		export_level_task_data_t* level_task = export_task->level_task_datas + level;
+		console_print_verbose("Export level %d: %d x %d tiles (%d empty)\n", level, level_task->export_width_in_tiles,
+		                      level_task->export_height_in_tiles, level_task->tiles_skipped);
 
-	fseeko64(export_task->fp, level_task->offset_of_tile_bytecounts, SEEK_SET);
-	fwrite(tile_bytecounts, sizeof(u64), level_task->export_tile_count, export_task->fp);
+		// Patch the tile offsets and tile bytecounts
+		fseeko64(export_task->fp, level_task->offset_of_tile_offsets, SEEK_SET);
+		fwrite(level_task->tile_offsets, sizeof(u64), level_task->export_tile_count, export_task->fp);
 
-	free(tile_offsets);
-	free(tile_bytecounts);
+		fseeko64(export_task->fp, level_task->offset_of_tile_bytecounts, SEEK_SET);
+		fwrite(level_task->tile_bytecounts, sizeof(u64), level_task->export_tile_count, export_task->fp);
 
-	for (i32 tile_index = 0; tile_index < level_task->source_tile_count; ++tile_index) {
-		tile_t* tile = level_task->source_tiles[tile_index];
-
-		if (tile) {
-			if (tile->is_cached && tile->pixels) {
-				tile_release_cache(tile);
-			}
+		for (i32 i = 0; i < level_task->export_tile_count; ++i) {
+			export_tile_t* tile = level_task->tiles + i;
+			ASSERT(!tile->pixels);
+			if (tile->pixels) free(tile->pixels);
 		}
-
+		free(level_task->tiles);
+		free(level_task->tile_offsets);
+		free(level_task->tile_bytecounts);
+		level_task->tiles = NULL;
+		level_task->tile_offsets = NULL;
+		level_task->tile_bytecounts = NULL;
 	}
 
-	free(level_task->source_tiles);
+	for (i32 i = 0; i < source->tile_count; ++i) {
+		export_source_tile_t* source_tile = source->tiles + i;
+		ASSERT(!source_tile->pixels);
+		if (source_tile->pixels) tile_pixels_free(source_tile->pixels);
+	}
+	free(source->tiles);
+	source->tiles = NULL;
 }
 
-bool32 export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t* tiff, bounds2f world_bounds, bounds2i level0_bounds, const char* filename,
+bool32 export_cropped_bigtiff(app_state_t* app_state, image_t* image, bounds2f world_bounds, bounds2i level0_bounds, const char* filename,
                               u32 export_tile_width, u16 desired_photometric_interpretation, i32 quality, u32 export_flags) {
-	if (!(tiff && tiff->main_image_ifd && (tiff->mpp_x > 0.0f) && (tiff->mpp_y > 0.0f))) {
+	if (!(image && image->type == IMAGE_TYPE_WSI && image->level_count > 0 && image->level_images[0].exists &&
+	      (image->mpp_x > 0.0f) && (image->mpp_y > 0.0f))) {
 		return false;
 	}
 
+	switch(image->backend) {
+		case IMAGE_BACKEND_TIFF:
+		case IMAGE_BACKEND_DICOM:
+		case IMAGE_BACKEND_OPENSLIDE: break;
+		case IMAGE_BACKEND_ISYNTAX: {
+			// The tiles are collected from the iSyntax streamer, which normally reports to the viewer.
+			if (!app_state->headless) {
+				console_print_error("Error exporting BigTIFF: iSyntax images can only be exported in headless mode\n");
+				return false;
+			}
+		} break;
+		default: {
+			console_print_error("Error exporting BigTIFF: unsupported image backend (%d)\n", image->backend);
+		} return false;
+	}
+
 	switch(desired_photometric_interpretation) {
 		case TIFF_PHOTOMETRIC_YCBCR: break;
 		case TIFF_PHOTOMETRIC_RGB: break;
@@ -606,16 +791,9 @@ bool32 export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t* ti
 
 	// TODO: make ASAP understand the resolution in the exported file
 
-	tiff_ifd_t* source_level0_ifd = tiff->main_image_ifd;
-	u32 tile_width = source_level0_ifd->tile_width;
-	u32 tile_height = source_level0_ifd->tile_height;
-	bool is_tile_aligned = ((level0_bounds.left % tile_width) == 0) && ((level0_bounds.top % tile_height) == 0);
-
-	bool need_reuse_tiles = is_tile_aligned && (desired_photometric_interpretation == source_level0_ifd->color_space)
-	                        && (export_tile_width == tile_width) && (tile_width == tile_height); // only allow square tiles for re-use
+	i64 export_start = get_clock();
 
 	export_task_data_t export_task = {0};
-	export_task.source_tile_width = tile_width;
 	export_task.export_tile_width = export_tile_width;
 	export_task.quality = quality;
 	export_task.use_rgb = (desired_photometric_interpretation == TIFF_PHOTOMETRIC_RGB);
@@ -647,9 +825,6 @@ bool32 export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t* ti
 		header.bigtiff.always_zero = 0;
 		memrw_push_back(&tag_buffer, &header, 8);
 
-		// NOTE: the downsampling level does not necessarily equal the ifd index.
-		i32 source_ifd_index = 0;
-		tiff_ifd_t* source_ifd = source_level0_ifd;
 		i32 export_ifd_count = 0;
 		i32 export_max_level = 0;
 
@@ -669,36 +844,35 @@ bool32 export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t* ti
 		u16 chroma_subsampling[4] = {2, 2, 0, 0};
 		raw_bigtiff_tag_t tag_chroma_subsampling = {TIFF_TAG_YCBCRSUBSAMPLING, TIFF_UINT16, 2, .offset = *(u64*)(chroma_subsampling)};
 
+		// The highest resolution level is constructed from the tiles of level 0 in the source image.
+		// The source tiles need not have the same size as the exported tiles.
+		level_image_t* source_level_image = image->level_images + 0;
+		export_source_t* source = &export_task.source;
+		source->pixel_bounds = level0_bounds;
+		source->tile_width = source_level_image->tile_width;
+		source->tile_height = source_level_image->tile_height;
+		source->tile_bounds.left = ATLEAST(div_floor(level0_bounds.left, source->tile_width), 0);
+		source->tile_bounds.top = ATLEAST(div_floor(level0_bounds.top, source->tile_height), 0);
+		source->tile_bounds.right = ATMOST(div_floor(level0_bounds.right - 1, source->tile_width) + 1, (i32)source_level_image->width_in_tiles);
+		source->tile_bounds.bottom = ATMOST(div_floor(level0_bounds.bottom - 1, source->tile_height) + 1, (i32)source_level_image->height_in_tiles);
+		source->tile_bounds.right = ATLEAST(source->tile_bounds.right, source->tile_bounds.left);
+		source->tile_bounds.bottom = ATLEAST(source->tile_bounds.bottom, source->tile_bounds.top);
+		source->width_in_tiles = source->tile_bounds.right - source->tile_bounds.left;
+		source->height_in_tiles = source->tile_bounds.bottom - source->tile_bounds.top;
+		source->tile_count = source->width_in_tiles * source->height_in_tiles;
+		source->tiles = calloc(ATLEAST(source->tile_count, 1), sizeof(export_source_tile_t));
+
+		// The lower levels are generated from level 0, halving the resolution at each step (regardless of which
+		// levels are present in the source image), until we reach a level that fits in a single tile.
+		i32 export_width_in_pixels = level0_bounds.right - level0_bounds.left;
+		i32 export_height_in_pixels = level0_bounds.bottom - level0_bounds.top;
 		bool reached_level_with_only_one_tile_in_it = false;
-		for (i32 level = 0; level < image->level_count && !reached_level_with_only_one_tile_in_it; ++level) {
+		for (i32 level = 0; level < WSI_MAX_LEVELS && !reached_level_with_only_one_tile_in_it; ++level) {
 
 			export_level_task_data_t* level_task_data = export_task.level_task_datas + level;
 
-			// Find an IFD for this downsampling level
-			if (source_ifd->downsample_level != level) {
-				++source_ifd_index;
-				bool found = false;
-				for (i32 i = source_ifd_index; i < tiff->level_image_ifd_count; ++i) {
-					tiff_ifd_t* ifd = tiff->level_images_ifd + i;
-					if (ifd->downsample_level == level) {
-						found = true;
-						level_task_data->is_represented = true;
-						source_ifd_index = i;
-						source_ifd = ifd;
-						break;
-					}
-				}
-				if (!found) {
-#if DO_DEBUG
-					console_print("Warning: source TIFF does not contain level %d, will be skipped\n", level);
-#endif
-					continue;
-				}
-			}
-
 			export_max_level = level;
 			++export_ifd_count;
-			level_image_t* source_level_image = image->level_images + level;
 
 			// Offset to the beginning of the next IFD (= 8 bytes directly after the current offset)
 			u64 next_ifd_offset = tag_buffer.used_size + sizeof(u64);
@@ -708,14 +882,10 @@ bool32 export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t* ti
 			u64 tag_count_for_ifd_offset = memrw_push_back(&tag_buffer, &tag_count_for_ifd, sizeof(u64));
 
 			// Calculate dimensions for the current downsampling level
-			bounds2i pixel_bounds = level0_bounds;
-			pixel_bounds.left >>= level;
-			pixel_bounds.top >>= level;
-			pixel_bounds.right >>= level;
-			pixel_bounds.bottom >>= level;
-
-			i32 export_width_in_pixels = pixel_bounds.right - pixel_bounds.left;
-			i32 export_height_in_pixels = pixel_bounds.bottom - pixel_bounds.top;
+			if (level > 0) {
+				export_width_in_pixels = (export_width_in_pixels + 1) / 2;
+				export_height_in_pixels = (export_height_in_pixels + 1) / 2;
+			}
 
 			u32 export_width_in_tiles = (export_width_in_pixels + (export_tile_width - 1)) / export_tile_width;
 			u32 export_height_in_tiles = (export_height_in_pixels + (export_tile_width - 1)) / export_tile_width;
@@ -726,49 +896,12 @@ bool32 export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t* ti
 			}
 			export_task.total_tiles_to_export += export_tile_count;
 
-			level_task_data->is_represented = true;
-			level_task_data->pixel_bounds = pixel_bounds;
+			level_task_data->width_in_pixels = export_width_in_pixels;
+			level_task_data->height_in_pixels = export_height_in_pixels;
 			level_task_data->export_width_in_tiles = export_width_in_tiles;
 			level_task_data->export_height_in_tiles = export_height_in_tiles;
 			level_task_data->export_tile_count = export_tile_count;
 
-			// Make some preparations for requesting the source tiles we will need to generate the new tiles.
-
-			i32 source_bounds_width_in_tiles = export_width_in_tiles + 1;//source_tile_bounds.right - source_tile_bounds.left + 1;
-			i32 source_bounds_height_in_tiles = export_height_in_tiles + 1; //source_tile_bounds.bottom - source_tile_bounds.top + 1;
-			u32 source_tile_count = source_bounds_width_in_tiles * source_bounds_height_in_tiles;
-
-			bounds2i source_tile_bounds = pixel_bounds;
-			source_tile_bounds.left = div_floor(pixel_bounds.left, export_tile_width);
-			source_tile_bounds.top = div_floor(pixel_bounds.top, export_tile_width);
-			source_tile_bounds.right = source_tile_bounds.left + export_tile_width * source_bounds_width_in_tiles;//div_floor(pixel_bounds.right + export_tile_width - 1, export_tile_width);
-			source_tile_bounds.bottom = source_tile_bounds.top + export_tile_width * source_bounds_height_in_tiles;//div_floor(pixel_bounds.bottom  + export_tile_width - 1, export_tile_width);
-
-			level_task_data->source_tile_bounds = source_tile_bounds;
-			level_task_data->source_bounds_width_in_tiles = source_bounds_width_in_tiles;
-			level_task_data->source_bounds_height_in_tiles = source_bounds_height_in_tiles;
-			level_task_data->source_tile_count = source_tile_count;
-
-
-			// Create a 'subsetted' tile map to request source tiles from.
-			// We store pointers to tile_t, and will use those with the usual routines for tile loading.
-			level_task_data->source_tiles = calloc(source_tile_count, sizeof(tile_t*));
-			for (i32 rel_source_tile_y = 0; rel_source_tile_y < source_bounds_height_in_tiles; ++rel_source_tile_y) {
-				i32 abs_source_tile_y = level_task_data->source_tile_bounds.top + rel_source_tile_y;
-				bool out_of_bounds = (abs_source_tile_y < 0 || abs_source_tile_y >= source_ifd->height_in_tiles);
-				if (!out_of_bounds) {
-					for (i32 rel_source_tile_x = 0; rel_source_tile_x < source_bounds_width_in_tiles; ++rel_source_tile_x) {
-						i32 abs_source_tile_x = level_task_data->source_tile_bounds.left + rel_source_tile_x;
-						out_of_bounds = (abs_source_tile_x < 0 || abs_source_tile_x >= source_ifd->width_in_tiles);
-						if (!out_of_bounds) {
-							tile_t* tile = get_tile(source_level_image, abs_source_tile_x, abs_source_tile_y);
-							level_task_data->source_tiles[rel_source_tile_y * source_bounds_width_in_tiles + rel_source_tile_x] = tile;
-						}
-					}
-				}
-
-			}
-
 			// Include the NewSubfileType tag in every IFD except the first one
 			if (level > 0) {
 				memrw_push_back(&tag_buffer, &tag_new_subfile_type, sizeof(raw_bigtiff_tag_t));
@@ -812,11 +945,6 @@ bool32 export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t* ti
 				tag_x_resolution.offset = *(u64*)(&resolution);
 				memrw_push_bigtiff_tag(&tag_buffer, &tag_x_resolution);
 				++tag_count_for_ifd;
-			} else if (source_ifd->x_resolution.b > 0) {
-				// TODO: remove this fallback?
-				tag_x_resolution.offset = *(u64*)(&source_ifd->x_resolution);
-				memrw_push_bigtiff_tag(&tag_buffer, &tag_x_resolution);
-				++tag_count_for_ifd;
 			}
 			raw_bigtiff_tag_t tag_y_resolution = {TIFF_TAG_Y_RESOLUTION, TIFF_RATIONAL, 1, 0};
 			if (image->is_mpp_known) {
@@ -824,11 +952,6 @@ bool32 export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t* ti
 				tag_y_resolution.offset = *(u64*)(&resolution);
 				memrw_push_bigtiff_tag(&tag_buffer, &tag_y_resolution);
 				++tag_count_for_ifd;
-			} else if (source_ifd->y_resolution.b > 0) {
-				// TODO: remove this fallback?
-				tag_y_resolution.offset = *(u64*)(&source_ifd->y_resolution);
-				memrw_push_bigtiff_tag(&tag_buffer, &tag_y_resolution);
-				++tag_count_for_ifd;
 			}
 
 #if 0
@@ -879,11 +1002,6 @@ bool32 export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t* ti
 			// Update the tag count, which was written incorrectly as a placeholder at the beginning of the IFD
 			*(u64*)(tag_buffer.data + tag_count_for_ifd_offset) = tag_count_for_ifd;
 
-			/*if (need_reuse_tiles && level == 0) {
-				u32 tile_offset_x = level0_pixel_bounds.left / tile_width;
-				u32 tile_offset_y = level0_pixel_bounds.top / tile_height;
-			}*/
-
 		}
 		// TODO: progress bar progress managed on the main thread?
 		global_tiff_export_progress = 0.05f;
@@ -907,7 +1025,6 @@ bool32 export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t* ti
 		// (At this point these sections still contain only placeholder zeroes. We need to rewrite these later.)
 		for (i32 level = 0; level <= export_max_level; ++level) {
 			export_level_task_data_t* level_task_data = export_task.level_task_datas + level;
-			if (!level_task_data->is_represented) continue;
 			if (!level_task_data->are_tile_offsets_inlined_in_tag) {
 				u64 tile_offsets_actual_offset_in_file    = *(u64*)(tag_buffer.data + level_task_data->offset_of_tile_offsets);
 				u64 tile_bytecounts_actual_offset_in_file = *(u64*)(tag_buffer.data + level_task_data->offset_of_tile_bytecounts);
@@ -940,16 +1057,23 @@ bool32 export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t* ti
 		export_task.progress_per_exported_tile = progress_left / (float)(ATLEAST(1, export_task.total_tiles_to_export));
 
 		console_print_verbose("Starting TIFF export, total tiles to export = %d\n", export_task.total_tiles_to_export);
-		for (i32 level = 0; level <= export_task.max_level; ++level) {
-			export_bigtiff_encode_level(app_state, image, &export_task, level);
-		}
+		export_bigtiff_encode_levels(app_state, image, &export_task);
 		fclose(export_task.fp);
 
+		float seconds_elapsed = get_seconds_elapsed(export_start, get_clock());
 		console_print("Exported region to '%s'\n", filename);
+		console_print("   %llu tiles (%llu empty) in %g seconds, %.1f tiles/s; %llu source tiles decoded\n",
+		              export_task.tiles_encoded + export_task.tiles_skipped, export_task.tiles_skipped, seconds_elapsed,
+		              (float)(export_task.tiles_encoded + export_task.tiles_skipped) / ATLEAST(seconds_elapsed, 1e-6f),
+		              export_task.source_tiles_decoded);
+		success = true;
 
 	}
 
 	if (export_flags & EXPORT_FLAGS_ALSO_EXPORT_ANNOTATIONS) {
+		// The caller must make sure that the annotations are fully loaded (see begin_export_cropped_bigtiff()),
+		// otherwise we would write out a truncated XML file.
+		ASSERT(app_state->scene.annotation_set.loader == NULL);
 		bool push_coordinates_inward = export_flags & EXPORT_FLAGS_PUSH_ANNOTATION_COORDINATES_INWARD;
 		annotation_set_t derived_set = create_offsetted_annotation_set_for_area(&app_state->scene.annotation_set, world_bounds, push_coordinates_inward);
 
@@ -969,7 +1093,6 @@ bool32 export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t* ti
 typedef struct export_region_task_t {
 	app_state_t* app_state;
 	image_t* image;
-	tiff_t* tiff;
 	bounds2f world_bounds;
 	bounds2i level0_bounds;
 	const char* filename;
@@ -981,7 +1104,7 @@ typedef struct export_region_task_t {
 
 void export_cropped_bigtiff_func(i32 logical_thread_index, void* userdata) {
 	export_region_task_t* task = (export_region_task_t*) userdata;
-	bool success = export_cropped_bigtiff(task->app_state, task->image, task->tiff, task->world_bounds, task->level0_bounds,
+	bool success = export_cropped_bigtiff(task->app_state, task->image, task->world_bounds, task->level0_bounds,
 	                                      task->filename, task->export_tile_width,
 	                                      task->desired_photometric_interpretation, task->quality, task->export_flags);
 	global_tiff_export_progress = 1.0f;
@@ -990,12 +1113,11 @@ void export_cropped_bigtiff_func(i32 logical_thread_index, void* userdata) {
 //	atomic_decrement(&task->isyntax->refcount); // TODO: release
 }
 
-void begin_export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t* tiff, bounds2f world_bounds, bounds2i level0_bounds, const char* filename,
+void begin_export_cropped_bigtiff(app_state_t* app_state, image_t* image, bounds2f world_bounds, bounds2i level0_bounds, const char* filename,
                                   u32 export_tile_width, u16 desired_photometric_interpretation, i32 quality, u32 export_flags) {
 	export_region_task_t task = {0};
 	task.app_state = app_state;
 	task.image = image;
-	task.tiff = tiff;
 	task.world_bounds = world_bounds;
 	task.level0_bounds = level0_bounds;
 	task.filename = filename;
@@ -1004,11 +1126,16 @@ void begin_export_cropped_bigtiff(app_state_t* app_state, image_t* image, tiff_t
 	task.quality = quality;
 	task.export_flags = export_flags;
 
+	if (export_flags & EXPORT_FLAGS_ALSO_EXPORT_ANNOTATIONS) {
+		// Finish loading the annotations now, on the main thread; the export itself runs on a worker thread.
+		annotation_loader_wait(&app_state->scene.annotation_set);
+	}
+
 	global_tiff_export_progress = 0.0f;
 	app_state->is_export_in_progress = true;
 
 //	atomic_increment(&isyntax->refcount); // TODO: retain; don't destroy  while busy
-	if (!add_work_queue_entry(&global_work_queue, export_cropped_bigtiff_func, &task, sizeof(task))) {
+	if (!add_work_queue_entry_with_priority(&global_work_queue, WORK_QUEUE_PRIORITY_EXPORT, export_cropped_bigtiff_func, &task, sizeof(task))) {
 //		tile->is_submitted_for_loading = false; // chicken out
 //		atomic_decrement(&isyntax->refcount);
 		app_state->is_export_in_progress = false;
@@ -6,6 +6,7 @@
 #define EMSCRIPTEN_KEEPALIVE
 #endif
 #include "jpeglib.h"
+#include <setjmp.h>
 
 static void on_error(j_common_ptr cinfo) {
 	(*cinfo->err->output_message)(cinfo);
@@ -63,10 +64,149 @@ void setup_jpeg_source(j_decompress_ptr cinfo, uint8_t *input_ptr, uint32_t inpu
 
 // https://www.ridgesolutions.ie/index.php/2019/12/10/libjpeg-example-encode-jpeg-to-memory-buffer-instead-of-file/
 
+// Tiles in TIFF and DICOM files are usually abbreviated JPEG streams that share one set of tables (JPEGTables).
+// Creating a decompressor and parsing the tables for every tile is expensive, so each thread keeps its own decompressor
+// alive, together with a copy of the tables that are currently loaded into it. Tiles using the same tables can skip
+// straight to decoding the tile header.
+// Disable jpeg_decoder_reuse_enabled to fall back to a fresh decompressor per tile (for benchmarking).
+bool jpeg_decoder_reuse_enabled = true;
 
+typedef struct jpeg_decoder_error_mgr_t {
+	struct jpeg_error_mgr pub;
+	jmp_buf setjmp_buffer;
+} jpeg_decoder_error_mgr_t;
+
+typedef struct jpeg_decoder_t {
+	struct jpeg_decompress_struct cinfo;
+	jpeg_decoder_error_mgr_t jerr;
+	u8* loaded_tables; // copy of the tables that were last loaded into cinfo
+	u32 loaded_tables_length;
+	JSAMPROW* rows;
+	u32 row_capacity;
+	u8* scratch_row;
+} jpeg_decoder_t;
+
+static THREAD_LOCAL jpeg_decoder_t* local_jpeg_decoder;
+
+static void on_error_longjmp(j_common_ptr cinfo) {
+	jpeg_decoder_error_mgr_t* err = (jpeg_decoder_error_mgr_t*) cinfo->err;
+	(*cinfo->err->output_message)(cinfo);
+	longjmp(err->setjmp_buffer, 1);
+}
+
+static jpeg_decoder_t* jpeg_decoder_get_local(void) {
+	if (!local_jpeg_decoder) {
+		jpeg_decoder_t* decoder = (jpeg_decoder_t*) calloc(1, sizeof(jpeg_decoder_t));
+		decoder->cinfo.err = jpeg_std_error(&decoder->jerr.pub);
+		decoder->jerr.pub.error_exit = on_error_longjmp;
+		jpeg_create_decompress(&decoder->cinfo);
+		local_jpeg_decoder = decoder;
+	}
+	return local_jpeg_decoder;
+}
+
+// Forget the loaded tables, e.g. because a tile replaced them with its own, or because decoding failed halfway.
+static void jpeg_decoder_invalidate_tables(jpeg_decoder_t* decoder) {
+	decoder->loaded_tables_length = 0;
+}
+
+// Check whether a JPEG stream defines quantization or Huffman tables of its own, before the start of scan.
+// (Those overwrite the tables loaded into the decompressor.)
+static bool jpeg_stream_defines_tables(u8* data, u32 length) {
+	u32 pos = 2; // skip SOI
+	while (pos + 4 <= length) {
+		if (data[pos] != 0xFF) return true; // not a marker; be conservative
+		u8 marker = data[pos + 1];
+		if (marker == 0xFF) {
+			++pos; // fill byte
+			continue;
+		}
+		if (marker == 0xDB /* DQT */ || marker == 0xC4 /* DHT */) return true;
+		if (marker == 0xDA /* SOS */ || marker == 0xD9 /* EOI */) return false;
+		u32 segment_length = ((u32)data[pos + 2] << 8) | data[pos + 3];
+		pos += 2 + segment_length;
+	}
+	return false;
+}
+
+// output_stride, max_width and max_height may be 0: rows are then tightly packed and the output is not clipped.
+static boolean jpeg_decode_with_local_decoder(u8* table_ptr, u32 table_length, u8* input_ptr, u32 input_length, u8* output_ptr,
+                                              u32 output_stride, u32 max_width, u32 max_height, bool32 is_YCbCr, i32 scale_shift) {
+	jpeg_decoder_t* decoder = jpeg_decoder_get_local();
+	struct jpeg_decompress_struct* cinfo = &decoder->cinfo;
+
+	if (setjmp(decoder->jerr.setjmp_buffer)) {
+		jpeg_abort_decompress(cinfo);
+		jpeg_decoder_invalidate_tables(decoder);
+		return FALSE;
+	}
+
+	// Load Jpeg table (only if different from the tables we already have)
+	if (table_ptr && table_length > 0) {
+		if (!(decoder->loaded_tables_length == table_length && memcmp(decoder->loaded_tables, table_ptr, table_length) == 0)) {
+			jpeg_decoder_invalidate_tables(decoder);
+			setup_jpeg_source(cinfo, table_ptr, table_length);
+			if (jpeg_read_header(cinfo, FALSE) != JPEG_HEADER_TABLES_ONLY) {
+				printf("Failed to load table\n");
+				jpeg_abort_decompress(cinfo);
+				return FALSE;
+			}
+			decoder->loaded_tables = (u8*) realloc(decoder->loaded_tables, table_length);
+			memcpy(decoder->loaded_tables, table_ptr, table_length);
+			decoder->loaded_tables_length = table_length;
+		}
+	}
+	if (jpeg_stream_defines_tables(input_ptr, input_length)) {
+		jpeg_decoder_invalidate_tables(decoder);
+	}
+
+	// Read tile data
+	setup_jpeg_source(cinfo, input_ptr, input_length);
+	if (jpeg_read_header(cinfo, TRUE) != JPEG_HEADER_OK) {
+		printf("Failed to read header\n");
+		jpeg_abort_decompress(cinfo);
+		return FALSE;
+	}
+
+	if (cinfo->num_components == 3) {
+		cinfo->jpeg_color_space = is_YCbCr ? JCS_YCbCr : JCS_RGB;
+	}
+	cinfo->out_color_space = JCS_EXT_BGRA;
+	cinfo->scale_num = 1;
+	cinfo->scale_denom = 1 << scale_shift; // DCT scaling: 1/2, 1/4 or 1/8 resolution at a fraction of the cost
+
+	jpeg_start_decompress(cinfo);
+	if (max_width > 0 && cinfo->output_width > max_width) {
+		printf("JPEG output is wider than the destination\n");
+		jpeg_abort_decompress(cinfo);
+		return FALSE;
+	}
+
+	// Decode straight into the output buffer, as many scanlines per call as the decompressor is able to produce.
+	// Rows that fall outside the destination are sent to a scratch row.
+	u32 row_count = cinfo->output_height;
+	if (decoder->row_capacity < row_count) {
+		decoder->rows = (JSAMPROW*) realloc(decoder->rows, row_count * sizeof(JSAMPROW));
+		decoder->row_capacity = row_count;
+	}
+	size_t row_stride = output_stride > 0 ? output_stride : (size_t)cinfo->output_width * 4;
+	if (max_height > 0 && row_count > max_height) {
+		decoder->scratch_row = (u8*) realloc(decoder->scratch_row, cinfo->output_width * 4);
+	}
+	for (u32 i = 0; i < row_count; ++i) {
+		decoder->rows[i] = (max_height == 0 || i < max_height) ? output_ptr + i * row_stride : decoder->scratch_row;
+	}
+	while (cinfo->output_scanline < cinfo->output_height) {
+		(void) jpeg_read_scanlines(cinfo, decoder->rows + cinfo->output_scanline, cinfo->output_height - cinfo->output_scanline);
+	}
+
+	(void) jpeg_finish_decompress(cinfo); // keeps the tables loaded for the next tile
+
+	return TRUE;
+}
+
+static boolean jpeg_decode_tile_with_new_decoder(uint8_t *table_ptr, uint32_t table_length, uint8_t *input_ptr, uint32_t input_length, uint8_t *output_ptr, bool32 is_YCbCr) {
 
-EMSCRIPTEN_KEEPALIVE
-boolean jpeg_decode_tile(uint8_t *table_ptr, uint32_t table_length, uint8_t *input_ptr, uint32_t input_length, uint8_t *output_ptr, bool32 is_YCbCr) {
 	struct jpeg_decompress_struct cinfo;
 	struct jpeg_error_mgr jerr;
 
@@ -116,6 +256,25 @@ boolean jpeg_decode_tile(uint8_t *table_ptr, uint32_t table_length, uint8_t *inp
 	return TRUE;
 }
 
+EMSCRIPTEN_KEEPALIVE
+boolean jpeg_decode_tile(uint8_t *table_ptr, uint32_t table_length, uint8_t *input_ptr, uint32_t input_length, uint8_t *output_ptr, bool32 is_YCbCr) {
+	if (jpeg_decoder_reuse_enabled) {
+		return jpeg_decode_with_local_decoder(table_ptr, table_length, input_ptr, input_length, output_ptr, 0, 0, 0, is_YCbCr, 0);
+	} else {
+		return jpeg_decode_tile_with_new_decoder(table_ptr, table_length, input_ptr, input_length, output_ptr, is_YCbCr);
+	}
+}
+
+// Decode a JPEG stream at 1/2, 1/4 or 1/8 of its resolution (scale_shift = 1, 2 or 3) into a region of a larger
+// BGRA buffer. Used to synthesize pyramid levels that are missing from the file. The tables may be NULL for
+// self-contained JPEG streams.
+boolean jpeg_decode_tile_downscaled(u8* table_ptr, u32 table_length, u8* input_ptr, u32 input_length, u8* output_ptr,
+                                    u32 output_stride, u32 max_width, u32 max_height, bool32 is_YCbCr, i32 scale_shift) {
+	ASSERT(scale_shift >= 0 && scale_shift <= 3);
+	return jpeg_decode_with_local_decoder(table_ptr, table_length, input_ptr, input_length, output_ptr, output_stride,
+	                                      max_width, max_height, is_YCbCr, scale_shift);
+}
+
 u8* jpeg_decode_image(u8* input_ptr, u32 input_length, i32* width, i32* height, i32 *channels_in_file) {
 	struct jpeg_decompress_struct cinfo;
 	struct jpeg_error_mgr jerr;
@@ -10,11 +10,15 @@ extern "C" {
 #define EMSCRIPTEN_KEEPALIVE
 #endif
 
+extern bool jpeg_decoder_reuse_enabled;
+
 void jpeg_encode_tile(u8* pixels, i32 width, i32 height, i32 quality, u8** tables_buffer, u64* tables_size_ptr,
                       u8** jpeg_buffer, u64* jpeg_size_ptr, bool use_rgb);
 void jpeg_encode_image(u8* pixels, i32 width, i32 height, i32 quality, u8** jpeg_buffer, u64* jpeg_size_ptr);
 u8* jpeg_decode_image(u8* input_ptr, u32 input_length, i32 *width, i32 *height, i32 *channels_in_file);
 EMSCRIPTEN_KEEPALIVE bool8 jpeg_decode_tile(uint8_t *table_ptr, uint32_t table_length, uint8_t *input_ptr, uint32_t input_length, uint8_t *output_ptr, bool32 is_YCbCr);
+bool32 jpeg_decode_tile_downscaled(u8* table_ptr, u32 table_length, u8* input_ptr, u32 input_length, u8* output_ptr,
+                                   u32 output_stride, u32 max_width, u32 max_height, bool32 is_YCbCr, i32 scale_shift);
 EMSCRIPTEN_KEEPALIVE uint8_t *create_buffer(int size);
 EMSCRIPTEN_KEEPALIVE void destroy_buffer(uint8_t *p);
 
@@ -152,3 +152,91 @@ size_t count_lines(char* buffer) {
 	} while (c != '\0');
 	return lines_counted;
 }
+
+// Fast replacement for strtof(), for parsing large numbers of plain decimal values (e.g. annotation coordinates).
+// Up to 19 significant digits are accumulated as an integer, and scaled by an exact power of ten.
+// Anything out of the ordinary (hexadecimal, inf/nan, extreme exponents) is handed over to strtod().
+float parse_float(const char* s, const char** end) {
+	static const double powers_of_ten[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+	const char* start = s;
+	while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r') ++s;
+	bool negative = false;
+	if (*s == '-') {
+		negative = true;
+		++s;
+	} else if (*s == '+') {
+		++s;
+	}
+	u64 mantissa = 0;
+	i32 significant_digits = 0;
+	i32 exponent = 0;
+	bool has_digits = false;
+	while (*s >= '0' && *s <= '9') {
+		has_digits = true;
+		if (significant_digits < 19) {
+			mantissa = mantissa * 10 + (u64)(*s - '0');
+			if (mantissa != 0) ++significant_digits;
+		} else {
+			++exponent; // digit does not fit, only its magnitude counts
+		}
+		++s;
+	}
+	if (*s == '.') {
+		++s;
+		while (*s >= '0' && *s <= '9') {
+			has_digits = true;
+			if (significant_digits < 19) {
+				mantissa = mantissa * 10 + (u64)(*s - '0');
+				if (mantissa != 0) ++significant_digits;
+				--exponent;
+			}
+			++s;
+		}
+	}
+	if (!has_digits || *s == 'x' || *s == 'X') {
+		goto fallback; // not a plain decimal value (or not a number at all)
+	}
+	if (*s == 'e' || *s == 'E') {
+		const char* exponent_start = s;
+		++s;
+		bool negative_exponent = false;
+		if (*s == '-') {
+			negative_exponent = true;
+			++s;
+		} else if (*s == '+') {
+			++s;
+		}
+		if (*s >= '0' && *s <= '9') {
+			i32 explicit_exponent = 0;
+			while (*s >= '0' && *s <= '9') {
+				if (explicit_exponent < 10000) explicit_exponent = explicit_exponent * 10 + (*s - '0');
+				++s;
+			}
+			exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+		} else {
+			s = exponent_start; // e.g. "1e" -> the 'e' is not part of the number
+		}
+	}
+	if (exponent < -22 || exponent > 22) {
+		goto fallback;
+	}
+	{
+		double value = (double)mantissa;
+		if (exponent < 0) {
+			value /= powers_of_ten[-exponent];
+		} else {
+			value *= powers_of_ten[exponent];
+		}
+		if (end) *end = s;
+		return (float)(negative ? -value : value);
+	}
+
+	fallback:;
+	char* fallback_end = NULL;
+	float result = (float)strtod(start, &fallback_end);
+	if (end) *end = fallback_end;
+	return result;
+}
@@ -32,6 +32,7 @@ const char* get_file_extension(const char* filename);
 void replace_file_extension(char* filename, i32 max_len, const char* new_ext);
 char** split_into_lines(char* buffer, size_t* num_lines);
 size_t count_lines(char* buffer);
+float parse_float(const char* s, const char** end);
 
 #ifdef __cplusplus
 };
@@ -16,40 +16,14 @@
   along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
-// Adapted from:
+// Polygon triangulation (with holes), using a port of the earcut algorithm:
+// https://github.com/mapbox/earcut (ISC license, Copyright (c) 2016, Mapbox)
+// triangulate_area() and triangulate_inside_triangle() are adapted from John W. Ratcliff's triangulator:
 // https://www.flipcode.com/archives/Efficient_Polygon_Triangulation.shtml
 
 
-// COTD Entry submitted by John W. Ratcliff [jratcliff@verant.com]
-
-// ** THIS IS A CODE SNIPPET WHICH WILL EFFICIEINTLY TRIANGULATE ANY
-// ** POLYGON/CONTOUR (without holes) AS A STATIC CLASS.  THIS SNIPPET
-// ** IS COMPRISED OF 3 FILES, TRIANGULATE.H, THE HEADER FILE FOR THE
-// ** TRIANGULATE BASE CLASS, TRIANGULATE.CPP, THE IMPLEMENTATION OF
-// ** THE TRIANGULATE BASE CLASS, AND TEST.CPP, A SMALL TEST PROGRAM
-// ** DEMONSTRATING THE USAGE OF THE TRIANGULATOR.  THE TRIANGULATE
-// ** BASE CLASS ALSO PROVIDES TWO USEFUL HELPER METHODS, ONE WHICH
-// ** COMPUTES THE AREA OF A POLYGON, AND ANOTHER WHICH DOES AN EFFICENT
-// ** POINT IN A TRIANGLE TEST.
-// ** SUBMITTED BY JOHN W. RATCLIFF (jratcliff@verant.com) July 22, 2000
-
-/*****************************************************************/
-/** Static class to triangulate any contour/polygon efficiently **/
-/** You should replace Vector2d with whatever your own Vector   **/
-/** class might be.  Does not support polygons with holes.      **/
-/** Uses STL vectors to represent a dynamic array of vertices.  **/
-/** This code snippet was submitted to FlipCode.com by          **/
-/** John W. Ratcliff (jratcliff@verant.com) on July 22, 2000    **/
-/** I did not write the original code/algorithm for this        **/
-/** this triangulator, in fact, I can't even remember where I   **/
-/** found it in the first place.  However, I did rework it into **/
-/** the following black-box static class so you can make easy   **/
-/** use of it in your own code.  Simply replace Vector2d with   **/
-/** whatever your own Vector implementation might be.           **/
-/*****************************************************************/
-
-
 #include "triangulate.h"
+#include <float.h>
 
 static const float EPSILON=0.0000000001f;
 
@@ -89,91 +63,611 @@ bool triangulate_inside_triangle(float Ax, float Ay,
 	return ((aCROSSbp >= 0.0f) && (bCROSScp >= 0.0f) && (cCROSSap >= 0.0f));
 };
 
-bool triangulate_snip(const v2f* contour, int u,int v,int w,int n,int *V) {
-	int p;
-	float Ax, Ay, Bx, By, Cx, Cy, Px, Py;
 
-	Ax = contour[V[u]].x;
-	Ay = contour[V[u]].y;
+// Polygon triangulation with holes, using the earcut algorithm.
+// Ported from: https://github.com/mapbox/earcut (ISC license, Copyright (c) 2016, Mapbox)
+// Ears are clipped from a doubly linked list of vertices. For large polygons, the vertices are additionally linked in
+// z-order (along a Morton curve), so that checking whether an ear contains other vertices only needs to look at the
+// vertices nearby; this makes the algorithm run in roughly O(n log n) time instead of O(n^2).
+// Holes are bridged into the outer ring. Self-touching and (locally) self-intersecting rings are handled by curing
+// the local intersections, and if that isn't enough, by splitting the polygon in two along a valid diagonal.
+
+typedef struct earcut_node_t earcut_node_t;
+struct earcut_node_t {
+	i32 i; // vertex index
+	double x, y;
+	earcut_node_t* prev;
+	earcut_node_t* next;
+	i32 z; // z-order curve value
+	earcut_node_t* prev_z;
+	earcut_node_t* next_z;
+	bool steiner; // indicates whether this is a steiner point (a hole consisting of a single vertex)
+};
 
-	Bx = contour[V[v]].x;
-	By = contour[V[v]].y;
+typedef struct earcut_node_block_t earcut_node_block_t;
+struct earcut_node_block_t {
+	earcut_node_block_t* prev_block;
+	i32 node_count;
+	i32 node_capacity;
+	earcut_node_t nodes[];
+};
 
-	Cx = contour[V[w]].x;
-	Cy = contour[V[w]].y;
+typedef struct earcut_t {
+	const v2f* vertices;
+	earcut_node_block_t* block; // nodes are never moved once allocated, so new nodes go in additional blocks
+	double min_x, min_y;
+	double inv_size; // 0 if the z-order hashing is not used
+	v2f** result;
+	i32 triangle_count;
+} earcut_t;
+
+static void earcut_add_node_block(earcut_t* ec, i32 node_capacity) {
+	earcut_node_block_t* block = (earcut_node_block_t*) malloc(sizeof(earcut_node_block_t) + node_capacity * sizeof(earcut_node_t));
+	block->prev_block = ec->block;
+	block->node_count = 0;
+	block->node_capacity = node_capacity;
+	ec->block = block;
+}
 
-	if ( EPSILON > (((Bx-Ax)*(Cy-Ay)) - ((By-Ay)*(Cx-Ax))) ) return false;
+static earcut_node_t* earcut_allocate_node(earcut_t* ec) {
+	if (ec->block->node_count == ec->block->node_capacity) {
+		earcut_add_node_block(ec, 1024);
+	}
+	earcut_node_t* p = ec->block->nodes + ec->block->node_count++;
+	memset(p, 0, sizeof(*p));
+	return p;
+}
 
-	for (p=0;p<n;p++)
-	{
-		if( (p == u) || (p == v) || (p == w) ) continue;
-		Px = contour[V[p]].x;
-		Py = contour[V[p]].y;
-		if (triangulate_inside_triangle(Ax,Ay,Bx,By,Cx,Cy,Px,Py)) return false;
+static void earcut_free_node_blocks(earcut_t* ec) {
+	while (ec->block) {
+		earcut_node_block_t* prev_block = ec->block->prev_block;
+		free(ec->block);
+		ec->block = prev_block;
 	}
+}
 
-	return true;
+static earcut_node_t* earcut_insert_node(earcut_t* ec, i32 i, earcut_node_t* last) {
+	earcut_node_t* p = earcut_allocate_node(ec);
+	p->i = i;
+	p->x = ec->vertices[i].x;
+	p->y = ec->vertices[i].y;
+	if (!last) {
+		p->prev = p;
+		p->next = p;
+	} else {
+		p->next = last->next;
+		p->prev = last;
+		last->next->prev = p;
+		last->next = p;
+	}
+	return p;
 }
 
-bool triangulate_process(const v2f* contour, i32 contour_size, v2f** result) {
-	/* allocate and initialize list of Vertices in polygon */
+static void earcut_remove_node(earcut_node_t* p) {
+	p->next->prev = p->prev;
+	p->prev->next = p->next;
+	if (p->prev_z) p->prev_z->next_z = p->next_z;
+	if (p->next_z) p->next_z->prev_z = p->prev_z;
+}
 
-	int n = contour_size;
-	if ( n < 3 ) return false;
+static inline double earcut_area(earcut_node_t* p, earcut_node_t* q, earcut_node_t* r) {
+	return (q->y - p->y) * (r->x - q->x) - (q->x - p->x) * (r->y - q->y);
+}
 
-	i32* V = (i32*) alloca(sizeof(i32) * n);
+static inline bool earcut_equals(earcut_node_t* p1, earcut_node_t* p2) {
+	return p1->x == p2->x && p1->y == p2->y;
+}
 
-	/* we want a counter-clockwise polygon in V */
+static inline bool earcut_point_in_triangle(double ax, double ay, double bx, double by, double cx, double cy, double px, double py) {
+	return (cx - px) * (ay - py) >= (ax - px) * (cy - py) &&
+	       (ax - px) * (by - py) >= (bx - px) * (ay - py) &&
+	       (bx - px) * (cy - py) >= (cx - px) * (by - py);
+}
 
-	if ( 0.0f < triangulate_area(contour, contour_size) )
-		for (int v=0; v<n; v++) V[v] = v;
-	else
-		for(int v=0; v<n; v++) V[v] = (n-1)-v;
+static inline i32 earcut_sign(double value) {
+	return (value > 0.0) - (value < 0.0);
+}
 
-	int nv = n;
+// For collinear points p, q, r: check if point q lies on segment pr
+static inline bool earcut_on_segment(earcut_node_t* p, earcut_node_t* q, earcut_node_t* r) {
+	return q->x <= MAX(p->x, r->x) && q->x >= MIN(p->x, r->x) && q->y <= MAX(p->y, r->y) && q->y >= MIN(p->y, r->y);
+}
 
-	/*  remove nv-2 Vertices, creating 1 triangle every time */
-	int count = 2*nv;   /* error detection */
+static bool earcut_intersects(earcut_node_t* p1, earcut_node_t* q1, earcut_node_t* p2, earcut_node_t* q2) {
+	i32 o1 = earcut_sign(earcut_area(p1, q1, p2));
+	i32 o2 = earcut_sign(earcut_area(p1, q1, q2));
+	i32 o3 = earcut_sign(earcut_area(p2, q2, p1));
+	i32 o4 = earcut_sign(earcut_area(p2, q2, q1));
+	if (o1 != o2 && o3 != o4) return true; // general case
+	if (o1 == 0 && earcut_on_segment(p1, p2, q1)) return true; // p1, q1 and p2 are collinear and p2 lies on p1q1
+	if (o2 == 0 && earcut_on_segment(p1, q2, q1)) return true; // p1, q1 and q2 are collinear and q2 lies on p1q1
+	if (o3 == 0 && earcut_on_segment(p2, p1, q2)) return true; // p2, q2 and p1 are collinear and p1 lies on p2q2
+	if (o4 == 0 && earcut_on_segment(p2, q1, q2)) return true; // p2, q2 and q1 are collinear and q1 lies on p2q2
+	return false;
+}
 
-	for(int m=0, v=nv-1; nv>2; )
-	{
-		/* if we loop, it is probably a non-simple polygon */
-		if (0 >= (count--))
-		{
-			//** Triangulate: ERROR - probable bad polygon!
-			return false;
+// Check if a polygon diagonal intersects any polygon segments
+static bool earcut_intersects_polygon(earcut_node_t* a, earcut_node_t* b) {
+	earcut_node_t* p = a;
+	do {
+		if (p->i != a->i && p->next->i != a->i && p->i != b->i && p->next->i != b->i && earcut_intersects(p, p->next, a, b)) {
+			return true;
+		}
+		p = p->next;
+	} while (p != a);
+	return false;
+}
+
+// Check if a polygon diagonal is locally inside the polygon
+static bool earcut_locally_inside(earcut_node_t* a, earcut_node_t* b) {
+	if (earcut_area(a->prev, a, a->next) < 0) {
+		return earcut_area(a, b, a->next) >= 0 && earcut_area(a, a->prev, b) >= 0;
+	} else {
+		return earcut_area(a, b, a->prev) < 0 || earcut_area(a, a->next, b) < 0;
+	}
+}
+
+// Check if the middle point of a polygon diagonal is inside the polygon
+static bool earcut_middle_inside(earcut_node_t* a, earcut_node_t* b) {
+	earcut_node_t* p = a;
+	bool inside = false;
+	double px = (a->x + b->x) / 2;
+	double py = (a->y + b->y) / 2;
+	do {
+		if (((p->y > py) != (p->next->y > py)) && p->next->y != p->y &&
+		    (px < (p->next->x - p->x) * (py - p->y) / (p->next->y - p->y) + p->x)) {
+			inside = !inside;
 		}
+		p = p->next;
+	} while (p != a);
+	return inside;
+}
 
-		/* three consecutive vertices in current polygon, <u,v,w> */
-		int u = v  ; if (nv <= u) u = 0;     /* previous */
-		v = u+1; if (nv <= v) v = 0;     /* new v    */
-		int w = v+1; if (nv <= w) w = 0;     /* next     */
+// Check if a diagonal between two polygon nodes is valid (lies in the polygon interior)
+static bool earcut_is_valid_diagonal(earcut_node_t* a, earcut_node_t* b) {
+	return a->next->i != b->i && a->prev->i != b->i && !earcut_intersects_polygon(a, b) && // doesn't intersect other edges
+	       ((earcut_locally_inside(a, b) && earcut_locally_inside(b, a) && earcut_middle_inside(a, b) && // locally visible
+	         (earcut_area(a->prev, a, b->prev) != 0 || earcut_area(a, b->prev, b) != 0)) || // does not create opposite-facing sectors
+	        (earcut_equals(a, b) && earcut_area(a->prev, a, a->next) > 0 && earcut_area(b->prev, b, b->next) > 0)); // special zero-length case
+}
 
-		if ( triangulate_snip(contour,u,v,w,nv,V) )
-		{
-			int a,b,c,s,t;
+// Link two polygon vertices with a bridge; if the vertices belong to the same ring, it splits the polygon into two.
+// If one belongs to the outer ring and another to a hole, it merges it into a single ring.
+static earcut_node_t* earcut_split_polygon(earcut_t* ec, earcut_node_t* a, earcut_node_t* b) {
+	earcut_node_t* a2 = earcut_allocate_node(ec);
+	earcut_node_t* b2 = earcut_allocate_node(ec);
+	a2->i = a->i;
+	a2->x = a->x;
+	a2->y = a->y;
+	b2->i = b->i;
+	b2->x = b->x;
+	b2->y = b->y;
+	earcut_node_t* an = a->next;
+	earcut_node_t* bp = b->prev;
+
+	a->next = b;
+	b->prev = a;
+	a2->next = an;
+	an->prev = a2;
+	b2->next = a2;
+	a2->prev = b2;
+	bp->next = b2;
+	b2->prev = bp;
+	return b2;
+}
 
-			/* true names of the vertices */
-			a = V[u]; b = V[v]; c = V[w];
+// Eliminate colinear or duplicate points
+static earcut_node_t* earcut_filter_points(earcut_node_t* start, earcut_node_t* end) {
+	if (!start) return start;
+	if (!end) end = start;
+	earcut_node_t* p = start;
+	bool again;
+	do {
+		again = false;
+		if (!p->steiner && (earcut_equals(p, p->next) || earcut_area(p->prev, p, p->next) == 0)) {
+			earcut_remove_node(p);
+			p = end = p->prev;
+			if (p == p->next) break;
+			again = true;
+		} else {
+			p = p->next;
+		}
+	} while (again || p != end);
+	return end;
+}
 
-			/* output Triangle */
-			arrput(*result, contour[a] );
-			arrput(*result, contour[b] );
-			arrput(*result, contour[c] );
+// Create a circular doubly linked list from the polygon points in the specified winding order
+static earcut_node_t* earcut_linked_list(earcut_t* ec, i32 start, i32 end, bool clockwise) {
+	double signed_area = 0.0;
+	for (i32 i = start, j = end - 1; i < end; j = i++) {
+		signed_area += ((double)ec->vertices[j].x - ec->vertices[i].x) * ((double)ec->vertices[i].y + ec->vertices[j].y);
+	}
+	earcut_node_t* last = NULL;
+	if (clockwise == (signed_area > 0)) {
+		for (i32 i = start; i < end; ++i) last = earcut_insert_node(ec, i, last);
+	} else {
+		for (i32 i = end - 1; i >= start; --i) last = earcut_insert_node(ec, i, last);
+	}
+	if (last && earcut_equals(last, last->next)) {
+		earcut_remove_node(last);
+		last = last->next;
+	}
+	return last;
+}
 
-			m++;
+// z-order of a point given coords and inverse of the longer side of data bbox
+static i32 earcut_z_order(earcut_t* ec, double px, double py) {
+	// coords are transformed into non-negative 15-bit integer range
+	u32 x = (u32)ATLEAST(0.0, ATMOST(32767.0, (px - ec->min_x) * ec->inv_size));
+	u32 y = (u32)ATLEAST(0.0, ATMOST(32767.0, (py - ec->min_y) * ec->inv_size));
+	x = (x | (x << 8)) & 0x00FF00FF;
+	x = (x | (x << 4)) & 0x0F0F0F0F;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	y = (y | (y << 8)) & 0x00FF00FF;
+	y = (y | (y << 4)) & 0x0F0F0F0F;
+	y = (y | (y << 2)) & 0x33333333;
+	y = (y | (y << 1)) & 0x55555555;
+	return (i32)(x | (y << 1));
+}
 
-			/* remove v from remaining polygon */
-			for(s=v,t=v+1;t<nv;s++,t++) {
-				V[s] = V[t];
+// Simon Tatham's linked list merge sort algorithm
+// http://www.chiark.greenend.org.uk/~sgtatham/algorithms/listsort.html
+static earcut_node_t* earcut_sort_linked(earcut_node_t* list) {
+	i32 in_size = 1;
+	i32 merge_count;
+	do {
+		earcut_node_t* p = list;
+		earcut_node_t* tail = NULL;
+		list = NULL;
+		merge_count = 0;
+		while (p) {
+			++merge_count;
+			earcut_node_t* q = p;
+			i32 p_size = 0;
+			for (i32 i = 0; i < in_size; ++i) {
+				++p_size;
+				q = q->next_z;
+				if (!q) break;
 			}
-			nv--;
+			i32 q_size = in_size;
+			while (p_size > 0 || (q_size > 0 && q)) {
+				earcut_node_t* e;
+				if (p_size != 0 && (q_size == 0 || !q || p->z <= q->z)) {
+					e = p;
+					p = p->next_z;
+					--p_size;
+				} else {
+					e = q;
+					q = q->next_z;
+					--q_size;
+				}
+				if (tail) tail->next_z = e;
+				else list = e;
+				e->prev_z = tail;
+				tail = e;
+			}
+			p = q;
+		}
+		tail->next_z = NULL;
+		in_size *= 2;
+	} while (merge_count > 1);
+	return list;
+}
 
-			/* resest error detection counter */
-			count = 2*nv;
+// Interlink polygon nodes in z-order
+static void earcut_index_curve(earcut_t* ec, earcut_node_t* start) {
+	earcut_node_t* p = start;
+	do {
+		if (p->z == 0) p->z = earcut_z_order(ec, p->x, p->y);
+		p->prev_z = p->prev;
+		p->next_z = p->next;
+		p = p->next;
+	} while (p != start);
+	p->prev_z->next_z = NULL;
+	p->prev_z = NULL;
+	earcut_sort_linked(p);
+}
+
+// Check whether a polygon node forms a valid ear with adjacent nodes
+static bool earcut_is_ear(earcut_node_t* ear) {
+	earcut_node_t* a = ear->prev;
+	earcut_node_t* b = ear;
+	earcut_node_t* c = ear->next;
+	if (earcut_area(a, b, c) >= 0) return false; // reflex, can't be an ear
+
+	// now make sure we don't have other points inside the potential ear
+	double x0 = MIN(a->x, MIN(b->x, c->x));
+	double y0 = MIN(a->y, MIN(b->y, c->y));
+	double x1 = MAX(a->x, MAX(b->x, c->x));
+	double y1 = MAX(a->y, MAX(b->y, c->y));
+	earcut_node_t* p = c->next;
+	while (p != a) {
+		if (p->x >= x0 && p->x <= x1 && p->y >= y0 && p->y <= y1 &&
+		    earcut_point_in_triangle(a->x, a->y, b->x, b->y, c->x, c->y, p->x, p->y) &&
+		    earcut_area(p->prev, p, p->next) >= 0) {
+			return false;
 		}
+		p = p->next;
 	}
+	return true;
+}
 
+static inline bool earcut_blocks_ear(earcut_node_t* p, earcut_node_t* a, earcut_node_t* b, earcut_node_t* c,
+                                     double x0, double y0, double x1, double y1) {
+	return p->x >= x0 && p->x <= x1 && p->y >= y0 && p->y <= y1 && p != a && p != c &&
+	       earcut_point_in_triangle(a->x, a->y, b->x, b->y, c->x, c->y, p->x, p->y) &&
+	       earcut_area(p->prev, p, p->next) >= 0;
+}
+
+static bool earcut_is_ear_hashed(earcut_t* ec, earcut_node_t* ear) {
+	earcut_node_t* a = ear->prev;
+	earcut_node_t* b = ear;
+	earcut_node_t* c = ear->next;
+	if (earcut_area(a, b, c) >= 0) return false; // reflex, can't be an ear
+
+	// triangle bbox
+	double x0 = MIN(a->x, MIN(b->x, c->x));
+	double y0 = MIN(a->y, MIN(b->y, c->y));
+	double x1 = MAX(a->x, MAX(b->x, c->x));
+	double y1 = MAX(a->y, MAX(b->y, c->y));
+
+	// z-order range for the current triangle bbox
+	i32 min_z = earcut_z_order(ec, x0, y0);
+	i32 max_z = earcut_z_order(ec, x1, y1);
+
+	earcut_node_t* p = ear->prev_z;
+	earcut_node_t* n = ear->next_z;
+
+	// look for points inside the triangle in both directions
+	while (p && p->z >= min_z && n && n->z <= max_z) {
+		if (earcut_blocks_ear(p, a, b, c, x0, y0, x1, y1)) return false;
+		p = p->prev_z;
+		if (earcut_blocks_ear(n, a, b, c, x0, y0, x1, y1)) return false;
+		n = n->next_z;
+	}
+	// look for remaining points in decreasing z-order
+	while (p && p->z >= min_z) {
+		if (earcut_blocks_ear(p, a, b, c, x0, y0, x1, y1)) return false;
+		p = p->prev_z;
+	}
+	// look for remaining points in increasing z-order
+	while (n && n->z <= max_z) {
+		if (earcut_blocks_ear(n, a, b, c, x0, y0, x1, y1)) return false;
+		n = n->next_z;
+	}
 	return true;
 }
 
+static void earcut_emit_triangle(earcut_t* ec, earcut_node_t* a, earcut_node_t* b, earcut_node_t* c) {
+	arrput(*ec->result, ec->vertices[a->i]);
+	arrput(*ec->result, ec->vertices[b->i]);
+	arrput(*ec->result, ec->vertices[c->i]);
+	++ec->triangle_count;
+}
+
+// Go through all polygon nodes and cure small local self-intersections
+static earcut_node_t* earcut_cure_local_intersections(earcut_t* ec, earcut_node_t* start) {
+	earcut_node_t* p = start;
+	do {
+		earcut_node_t* a = p->prev;
+		earcut_node_t* b = p->next->next;
+		if (!earcut_equals(a, b) && earcut_intersects(a, p, p->next, b) && earcut_locally_inside(a, b) && earcut_locally_inside(b, a)) {
+			earcut_emit_triangle(ec, a, p, b);
+			// remove two nodes involved
+			earcut_remove_node(p);
+			earcut_remove_node(p->next);
+			p = start = b;
+		}
+		p = p->next;
+	} while (p != start);
+	return earcut_filter_points(p, NULL);
+}
+
+static void earcut_linked(earcut_t* ec, earcut_node_t* ear, i32 pass);
+
+// Try splitting the polygon into two and triangulate them independently
+static void earcut_split(earcut_t* ec, earcut_node_t* start) {
+	// look for a valid diagonal that divides the polygon into two
+	earcut_node_t* a = start;
+	do {
+		earcut_node_t* b = a->next->next;
+		while (b != a->prev) {
+			if (a->i != b->i && earcut_is_valid_diagonal(a, b)) {
+				// split the polygon in two by the diagonal
+				earcut_node_t* c = earcut_split_polygon(ec, a, b);
+				// filter colinear points around the cuts
+				a = earcut_filter_points(a, a->next);
+				c = earcut_filter_points(c, c->next);
+				// run earcut on each half
+				earcut_linked(ec, a, 0);
+				earcut_linked(ec, c, 0);
+				return;
+			}
+			b = b->next;
+		}
+		a = a->next;
+	} while (a != start);
+}
+
+// Main ear slicing loop which triangulates a polygon (given as a linked list)
+static void earcut_linked(earcut_t* ec, earcut_node_t* ear, i32 pass) {
+	if (!ear) return;
+	// interlink polygon nodes in z-order
+	if (pass == 0 && ec->inv_size != 0.0) earcut_index_curve(ec, ear);
+
+	earcut_node_t* stop = ear;
+	// iterate through ears, slicing them one by one
+	while (ear->prev != ear->next) {
+		earcut_node_t* prev = ear->prev;
+		earcut_node_t* next = ear->next;
+		if (ec->inv_size != 0.0 ? earcut_is_ear_hashed(ec, ear) : earcut_is_ear(ear)) {
+			// cut off the triangle
+			earcut_emit_triangle(ec, prev, ear, next);
+			earcut_remove_node(ear);
+			// skipping the next vertex leads to less sliver triangles
+			ear = next->next;
+			stop = next->next;
+			continue;
+		}
+		ear = next;
+		// if we looped through the whole remaining polygon and can't find any more ears
+		if (ear == stop) {
+			if (pass == 0) {
+				// try filtering points and slicing again
+				earcut_linked(ec, earcut_filter_points(ear, NULL), 1);
+			} else if (pass == 1) {
+				// if this didn't work, try curing all small self-intersections locally
+				ear = earcut_cure_local_intersections(ec, earcut_filter_points(ear, NULL));
+				earcut_linked(ec, ear, 2);
+			} else if (pass == 2) {
+				// as a last resort, try splitting the remaining polygon into two
+				earcut_split(ec, ear);
+			}
+			break;
+		}
+	}
+}
+
+static earcut_node_t* earcut_get_leftmost(earcut_node_t* start) {
+	earcut_node_t* p = start;
+	earcut_node_t* leftmost = start;
+	do {
+		if (p->x < leftmost->x || (p->x == leftmost->x && p->y < leftmost->y)) leftmost = p;
+		p = p->next;
+	} while (p != start);
+	return leftmost;
+}
+
+static int earcut_compare_x(const void* a_raw, const void* b_raw) {
+	earcut_node_t* a = *(earcut_node_t**)a_raw;
+	earcut_node_t* b = *(earcut_node_t**)b_raw;
+	return (a->x > b->x) - (a->x < b->x);
+}
+
+// Whether sector in vertex m contains sector in vertex p in the same coordinates
+static bool earcut_sector_contains_sector(earcut_node_t* m, earcut_node_t* p) {
+	return earcut_area(m->prev, m, p->prev) < 0 && earcut_area(p->next, m, m->next) < 0;
+}
+
+// David Eberly's algorithm for finding a bridge between hole and outer polygon
+static earcut_node_t* earcut_find_hole_bridge(earcut_node_t* hole, earcut_node_t* outer_node) {
+	earcut_node_t* p = outer_node;
+	double hx = hole->x;
+	double hy = hole->y;
+	double qx = -DBL_MAX;
+	earcut_node_t* m = NULL;
+
+	// find a segment intersected by a ray from the hole's leftmost point to the left;
+	// segment's endpoint with lesser x will be potential connection point
+	do {
+		if (hy <= p->y && hy >= p->next->y && p->next->y != p->y) {
+			double x = p->x + (hy - p->y) * (p->next->x - p->x) / (p->next->y - p->y);
+			if (x <= hx && x > qx) {
+				qx = x;
+				m = p->x < p->next->x ? p : p->next;
+				if (x == hx) return m; // hole touches outer segment; pick leftmost endpoint
+			}
+		}
+		p = p->next;
+	} while (p != outer_node);
+
+	if (!m) return NULL;
+
+	// look for points inside the triangle of hole point, segment intersection and endpoint;
+	// if there are no points found, we have a valid connection;
+	// otherwise choose the point of the minimum angle with the ray as connection point
+	earcut_node_t* stop = m;
+	double mx = m->x;
+	double my = m->y;
+	double tan_min = DBL_MAX;
+	p = m;
+	do {
+		if (hx >= p->x && p->x >= mx && hx != p->x &&
+		    earcut_point_in_triangle(hy < my ? hx : qx, hy, mx, my, hy < my ? qx : hx, hy, p->x, p->y)) {
+			double tan = fabs(hy - p->y) / (hx - p->x); // tangential
+			if (earcut_locally_inside(p, hole) &&
+			    (tan < tan_min || (tan == tan_min && (p->x > m->x || (p->x == m->x && earcut_sector_contains_sector(m, p)))))) {
+				m = p;
+				tan_min = tan;
+			}
+		}
+		p = p->next;
+	} while (p != stop);
+	return m;
+}
+
+// Find a bridge between vertices that connects hole with an outer ring and link it
+static earcut_node_t* earcut_eliminate_hole(earcut_t* ec, earcut_node_t* hole, earcut_node_t* outer_node) {
+	earcut_node_t* bridge = earcut_find_hole_bridge(hole, outer_node);
+	if (!bridge) {
+		return outer_node;
+	}
+	earcut_node_t* bridge_reverse = earcut_split_polygon(ec, bridge, hole);
+	// filter collinear points around the cuts
+	earcut_filter_points(bridge_reverse, bridge_reverse->next);
+	return earcut_filter_points(bridge, bridge->next);
+}
+
+// Triangulate a polygon, optionally with holes. The outer ring consists of the vertices up to the first hole; each hole
+// starts at the index given in hole_starts and runs up to the next hole (or the end). The winding order doesn't matter.
+// The triangles are appended to the result array (3 vertices per triangle).
+bool triangulate_polygon(const v2f* vertices, i32 vertex_count, const i32* hole_starts, i32 hole_count, v2f** result) {
+	i32 outer_count = hole_count > 0 ? hole_starts[0] : vertex_count;
+	if (outer_count < 3) return false;
+
+	earcut_t ec = {0};
+	ec.vertices = vertices;
+	ec.result = result;
+	// One node per vertex, plus two for every bridge or split (which usually aren't many)
+	earcut_add_node_block(&ec, vertex_count + 2 * hole_count + 64);
+
+	earcut_node_t* outer_node = earcut_linked_list(&ec, 0, outer_count, true);
+	if (!outer_node || outer_node->next == outer_node->prev) {
+		earcut_free_node_blocks(&ec);
+		return false;
+	}
+
+	if (hole_count > 0) {
+		earcut_node_t** queue = (earcut_node_t**) malloc(hole_count * sizeof(earcut_node_t*));
+		i32 queue_count = 0;
+		for (i32 h = 0; h < hole_count; ++h) {
+			i32 start = hole_starts[h];
+			i32 end = (h < hole_count - 1) ? hole_starts[h + 1] : vertex_count;
+			earcut_node_t* list = earcut_linked_list(&ec, start, end, false);
+			if (!list) continue;
+			if (list == list->next) list->steiner = true;
+			queue[queue_count++] = earcut_get_leftmost(list);
+		}
+		qsort(queue, queue_count, sizeof(earcut_node_t*), earcut_compare_x);
+		// process holes from left to right
+		for (i32 i = 0; i < queue_count; ++i) {
+			outer_node = earcut_eliminate_hole(&ec, queue[i], outer_node);
+		}
+		free(queue);
+	}
+
+	// if the shape is not too simple, we'll use z-order curve hash later; calculate polygon bbox
+	if (vertex_count > 80) {
+		double min_x = DBL_MAX, min_y = DBL_MAX, max_x = -DBL_MAX, max_y = -DBL_MAX;
+		for (i32 i = 0; i < outer_count; ++i) {
+			min_x = MIN(min_x, vertices[i].x);
+			min_y = MIN(min_y, vertices[i].y);
+			max_x = MAX(max_x, vertices[i].x);
+			max_y = MAX(max_y, vertices[i].y);
+		}
+		ec.min_x = min_x;
+		ec.min_y = min_y;
+		// min_x, min_y and inv_size are later used to transform coords into integers for z-order calculation
+		double size = MAX(max_x - min_x, max_y - min_y);
+		ec.inv_size = size != 0.0 ? 32767.0 / size : 0.0;
+	}
+
+	earcut_linked(&ec, outer_node, 0);
+	earcut_free_node_blocks(&ec);
+	return ec.triangle_count > 0;
+}
+
+bool triangulate_process(const v2f* contour, i32 contour_size, v2f** result) {
+	return triangulate_polygon(contour, contour_size, NULL, 0, result);
+}
@@ -16,38 +16,11 @@
   along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
-// Adapted from:
+// Polygon triangulation (with holes), using a port of the earcut algorithm:
+// https://github.com/mapbox/earcut (ISC license, Copyright (c) 2016, Mapbox)
+// triangulate_area() and triangulate_inside_triangle() are adapted from John W. Ratcliff's triangulator:
 // https://www.flipcode.com/archives/Efficient_Polygon_Triangulation.shtml
 
-
-// COTD Entry submitted by John W. Ratcliff [jratcliff@verant.com]
-
-// ** THIS IS A CODE SNIPPET WHICH WILL EFFICIEINTLY TRIANGULATE ANY
-// ** POLYGON/CONTOUR (without holes) AS A STATIC CLASS.  THIS SNIPPET
-// ** IS COMPRISED OF 3 FILES, TRIANGULATE.H, THE HEADER FILE FOR THE
-// ** TRIANGULATE BASE CLASS, TRIANGULATE.CPP, THE IMPLEMENTATION OF
-// ** THE TRIANGULATE BASE CLASS, AND TEST.CPP, A SMALL TEST PROGRAM
-// ** DEMONSTRATING THE USAGE OF THE TRIANGULATOR.  THE TRIANGULATE
-// ** BASE CLASS ALSO PROVIDES TWO USEFUL HELPER METHODS, ONE WHICH
-// ** COMPUTES THE AREA OF A POLYGON, AND ANOTHER WHICH DOES AN EFFICENT
-// ** POINT IN A TRIANGLE TEST.
-// ** SUBMITTED BY JOHN W. RATCLIFF (jratcliff@verant.com) July 22, 2000
-
-/*****************************************************************/
-/** Static class to triangulate any contour/polygon efficiently **/
-/** You should replace Vector2d with whatever your own Vector   **/
-/** class might be.  Does not support polygons with holes.      **/
-/** Uses STL vectors to represent a dynamic array of vertices.  **/
-/** This code snippet was submitted to FlipCode.com by          **/
-/** John W. Ratcliff (jratcliff@verant.com) on July 22, 2000    **/
-/** I did not write the original code/algorithm for this        **/
-/** this triangulator, in fact, I can't even remember where I   **/
-/** found it in the first place.  However, I did rework it into **/
-/** the following black-box static class so you can make easy   **/
-/** use of it in your own code.  Simply replace Vector2d with   **/
-/** whatever your own Vector implementation might be.           **/
-/*****************************************************************/
-
 #pragma once
 
 #ifdef __cplusplus
@@ -58,6 +31,7 @@ extern "C" {
 #include "mathutils.h"
 
 
+bool triangulate_polygon(const v2f* vertices, i32 vertex_count, const i32* hole_starts, i32 hole_count, v2f** result);
 bool triangulate_process(const v2f* contour, i32 contour_size, v2f** result);
 float triangulate_area(const v2f* contour, i32 contour_size);
 bool triangulate_inside_triangle(float Ax, float Ay,